@@ -74,6 +74,7 @@ Abstract:
 #define TAG_IRP_CONTEXT         'cidC'      //  Irp Context
 #define TAG_IRP_CONTEXT_LITE    'lidC'      //  Irp Context lite
 #define TAG_MCB_ARRAY           'amdC'      //  Mcb array
+#define TAG_NAME_INDEX          'indC'      //  Path table and directory name index
 #define TAG_PATH_ENTRY_NAME     'nPdC'      //  CdName in path entry
 #define TAG_PREFIX_ENTRY        'epdC'      //  Prefix Entry
 #define TAG_PREFIX_NAME         'npdC'      //  Prefix Entry name
@@ -663,6 +664,20 @@ CdFullCompareNames (
     _In_ PUNICODE_STRING NameB
     );
 
+ULONG
+CdHashName (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PUNICODE_STRING Name,
+    _In_ ULONG Seed
+    );
+
+PCD_NAME_INDEX
+CdCreateNameIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_reads_(EntryCount) PCD_NAME_INDEX_ENTRY Entries,
+    _In_ ULONG EntryCount
+    );
+
 
 //
 //  Filesystem control operations.  Implemented in Fsctrl.c
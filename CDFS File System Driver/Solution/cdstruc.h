@@ -456,6 +456,45 @@ typedef struct _CD_SECTOR_CACHE_CHUNK {
 #define CD_SEC_CACHE_CHUNKS  4
 #define CD_SEC_CHUNK_BLOCKS  0x18
 
+//
+//  A name index is a hash of the names in a path table or a directory,
+//  built the first time a large one is searched so that later opens don't
+//  have to walk every entry.  Since the media is read only the index never
+//  goes stale.  Each entry holds the hash of an upcased name (seeded with
+//  the parent ordinal for path table entries) and where to find the entry,
+//  and each hash chain is in ascending offset order so the first entry we
+//  verify is the one a linear scan would have found.  The buckets follow
+//  the entries in the same allocation.
+//
+
+#define CD_NAME_INDEX_NIL           (0xffffffff)
+
+typedef struct _CD_NAME_INDEX_ENTRY {
+
+    ULONG Next;
+    ULONG Hash;
+
+    //
+    //  Offset of the path table entry or initial file dirent, and the
+    //  ordinal of a path table entry.
+    //
+
+    ULONG Offset;
+    ULONG Ordinal;
+
+} CD_NAME_INDEX_ENTRY, *PCD_NAME_INDEX_ENTRY;
+
+typedef struct _CD_NAME_INDEX {
+
+    ULONG IndexSize;
+    ULONG BucketMask;
+    PULONG Buckets;
+
+    ULONG EntryCount;
+    CD_NAME_INDEX_ENTRY Entries[1];
+
+} CD_NAME_INDEX, *PCD_NAME_INDEX;
+
 //
 //  The Vcb (Volume control block) record corresponds to every
 //  volume mounted by the file system.  They are ordered in a queue off
@@ -681,6 +720,21 @@ typedef struct _VCB {
     PIRP SectorCacheIrp;
     KEVENT SectorCacheEvent;
     ERESOURCE SectorCacheResource;
+
+    //
+    //  Name index for the path table, and whether we have tried to build
+    //  it yet.  Set once under the Vcb mutex, and freed with the path
+    //  table Fcb.
+    //
+
+    PCD_NAME_INDEX PathTableIndex;
+    BOOLEAN PathTableIndexBuilt;
+
+    //
+    //  Pool used by the name indexes of directories on this volume.
+    //
+
+    __volatile LONG DirentIndexBytes;
     
 #if DBG
     ULONG SecCacheHits;
@@ -835,6 +889,14 @@ typedef struct _FCB_INDEX {
     PRTL_SPLAY_LINKS ExactCaseRoot;
     PRTL_SPLAY_LINKS IgnoreCaseRoot;
 
+    //
+    //  Name index of the files in a large directory.  This complements
+    //  the prefix trees above, which only hold names already opened.
+    //  Set once under the Fcb mutex.
+    //
+
+    PCD_NAME_INDEX DirentIndex;
+
 } FCB_INDEX;
 typedef FCB_INDEX *PFCB_INDEX;
 
@@ -1029,6 +1091,7 @@ typedef FCB *PFCB;
 #define FCB_STATE_MODE2FORM2_FILE               (0x00000004)
 #define FCB_STATE_MODE2_FILE                    (0x00000008)
 #define FCB_STATE_DA_FILE                       (0x00000010)
+#define FCB_STATE_DIRENT_INDEX_BUILT            (0x00000020)
 
 //
 //  These file types are read as raw 2352 byte sectors
@@ -1070,6 +1133,17 @@ typedef struct _CCB {
 
     PFCB Fcb;
 
+    //
+    //  Sequential read tracking for cached reads on this handle.  We
+    //  remember where the last read ended, how many reads in a row have
+    //  started there and the read ahead granularity we last gave to the
+    //  cache manager for this file object.
+    //
+
+    LONGLONG NextReadOffset;
+    ULONG SequentialReadCount;
+    ULONG ReadAheadGranularity;
+
     //
     //  We store state information in the Ccb for a directory
     //  enumeration on this handle.
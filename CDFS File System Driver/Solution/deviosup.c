@@ -1753,22 +1753,43 @@ Return Value:
             CurrentByteCount = SectorTruncate( CurrentByteCount );
 
             //
-            //  Read these sectors from the disk.
+            //  If the previous run also reads directly into the user's
+            //  buffer and ends where these sectors begin then just extend
+            //  it.  Adjacent extents of a multi-extent file are often
+            //  physically contiguous and this lets us issue a single
+            //  transfer for them.
             //
 
-            ThisIoRun->DiskOffset = DiskOffset;
-            ThisIoRun->DiskByteCount = CurrentByteCount;
+            if ((ThisIoRun != IoRuns) &&
+                ((ThisIoRun - 1)->TransferMdl == Irp->MdlAddress) &&
+                ((ThisIoRun - 1)->DiskOffset + (ThisIoRun - 1)->DiskByteCount == DiskOffset)) {
 
-            //
-            //  Use the user's buffer and Mdl as our transfer buffer
-            //  and Mdl.
-            //
+                (ThisIoRun - 1)->DiskByteCount += CurrentByteCount;
+
+                ThisIoRun->UserBuffer = NULL;
+                ThisIoRun -= 1;
+                *RunCount -= 1;
+
+            } else {
+
+                //
+                //  Read these sectors from the disk.
+                //
+
+                ThisIoRun->DiskOffset = DiskOffset;
+                ThisIoRun->DiskByteCount = CurrentByteCount;
 
-            ThisIoRun->TransferBuffer = CurrentUserBuffer;
-            ThisIoRun->TransferMdl = Irp->MdlAddress;
-            ThisIoRun->TransferVirtualAddress = Add2Ptr( Irp->UserBuffer,
-                                                         CurrentUserBufferOffset,
-                                                         PVOID );
+                //
+                //  Use the user's buffer and Mdl as our transfer buffer
+                //  and Mdl.
+                //
+
+                ThisIoRun->TransferBuffer = CurrentUserBuffer;
+                ThisIoRun->TransferMdl = Irp->MdlAddress;
+                ThisIoRun->TransferVirtualAddress = Add2Ptr( Irp->UserBuffer,
+                                                             CurrentUserBufferOffset,
+                                                             PVOID );
+            }
         }
 
         //
@@ -2139,21 +2160,49 @@ Return Value:
                 }
                 
                 //
-                //  Update the IO run array.  We point to the scratch buffer as
-                //  well as the buffer and Mdl in the original Irp.
+                //  If the previous run also reads whole raw sectors into the
+                //  user's buffer and ends where this one begins on the disk then
+                //  fold this transfer into it, provided the combined read stays
+                //  within the device's raw transfer and page limits.  This is
+                //  common for XA files whose extents were recorded back to back.
                 //
 
-                ThisIoRun->DiskByteCount = SectorAlign( CurrentCookedByteCount);
+                if ((ThisIoRun != IoRuns) &&
+                    ((ThisIoRun - 1)->TransferMdl == Irp->MdlAddress) &&
+                    ((ThisIoRun - 1)->DiskOffset + (ThisIoRun - 1)->DiskByteCount == DiskOffset) &&
+                    (CurrentRawByteCount == (SectorAlign( CurrentCookedByteCount ) >> SECTOR_SHIFT) * RAW_SECTOR_SIZE) &&
+                    (SectorsFromBytes( (ThisIoRun - 1)->DiskByteCount + SectorAlign( CurrentCookedByteCount )) <= Fcb->Vcb->MaximumTransferRawSectors) &&
+                    (ADDRESS_AND_SIZE_TO_SPAN_PAGES( (ThisIoRun - 1)->TransferBuffer,
+                                                     SectorsFromBytes( (ThisIoRun - 1)->DiskByteCount ) * RAW_SECTOR_SIZE + CurrentRawByteCount ) <=
+                     Fcb->Vcb->MaximumPhysicalPages)) {
 
-                //
-                //  Point to the user's buffer and Mdl for this transfer.
-                //
+                    (ThisIoRun - 1)->DiskByteCount += SectorAlign( CurrentCookedByteCount );
 
-                ThisIoRun->TransferBuffer = CurrentUserBuffer;
-                ThisIoRun->TransferMdl = Irp->MdlAddress;
-                ThisIoRun->TransferVirtualAddress = Add2Ptr( Irp->UserBuffer, 
-                                                             CurrentUserBufferOffset,
-                                                             PVOID);
+                    ThisIoRun->DiskOffset = 0;
+                    ThisIoRun->TransferBufferOffset = 0;
+                    ThisIoRun->UserBuffer = NULL;
+                    ThisIoRun -= 1;
+                    *RunCount -= 1;
+
+                } else {
+
+                    //
+                    //  Update the IO run array.  We point to the scratch buffer as
+                    //  well as the buffer and Mdl in the original Irp.
+                    //
+
+                    ThisIoRun->DiskByteCount = SectorAlign( CurrentCookedByteCount);
+
+                    //
+                    //  Point to the user's buffer and Mdl for this transfer.
+                    //
+
+                    ThisIoRun->TransferBuffer = CurrentUserBuffer;
+                    ThisIoRun->TransferMdl = Irp->MdlAddress;
+                    ThisIoRun->TransferVirtualAddress = Add2Ptr( Irp->UserBuffer, 
+                                                                 CurrentUserBufferOffset,
+                                                                 PVOID);
+                }
 
             } else {
 
@@ -88,6 +88,20 @@ Abstract:
 #define CdRawDirent(IC,DC)                                      \
     Add2Ptr( (DC)->Sector, (DC)->SectorOffset, PRAW_DIRENT )
 
+//
+//  Directories smaller than this are always searched sequentially.  We
+//  also cap the pool the directory indexes on one volume may use.
+//
+
+#define CD_DIRENT_INDEX_MIN_SIZE            (8 * SECTOR_SIZE)
+#define CD_DIRENT_INDEX_MAX_VOLUME_BYTES    (0x800000)
+
+//
+//  The smallest dirent is a 33 byte header with a one byte name.
+//
+
+#define CD_MIN_DIRENT_LENGTH                (34)
+
 //
 //  Local support routines
 //
@@ -105,7 +119,14 @@ CdCheckForXAExtent (
     _Inout_ PDIRENT Dirent
     );
 
+VOID
+CdBuildDirentIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFCB Fcb
+    );
+
 #ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, CdBuildDirentIndex)
 #pragma alloc_text(PAGE, CdCheckForXAExtent)
 #pragma alloc_text(PAGE, CdCheckRawDirentBounds)
 #pragma alloc_text(PAGE, CdCleanupFileContext)
@@ -867,6 +888,10 @@ Return Value:
 
     BOOLEAN Found = FALSE;
 
+    PCD_NAME_INDEX Index;
+    ULONG Hash;
+    ULONG Entry;
+
     PAGED_CODE();
 
     //
@@ -881,6 +906,68 @@ Return Value:
 
     ShortNameDirentOffset = CdShortNameDirentOffset( IrpContext, &Name->FileName );
 
+    //
+    //  A possible short name depends on where the dirent sits, so only use
+    //  the name index when this can't be one.  Index a large directory the
+    //  first time through.
+    //
+
+    if (ShortNameDirentOffset == MAXULONG) {
+
+        if (!FlagOn( Fcb->FcbState, FCB_STATE_DIRENT_INDEX_BUILT ) &&
+            (Fcb->FileSize.QuadPart >= CD_DIRENT_INDEX_MIN_SIZE)) {
+
+            CdBuildDirentIndex( IrpContext, Fcb );
+        }
+
+        Index = Fcb->DirentIndex;
+
+        if (Index != NULL) {
+
+            Hash = CdHashName( IrpContext, &Name->FileName, 0 );
+
+            for (Entry = Index->Buckets[Hash & Index->BucketMask];
+                 Entry != CD_NAME_INDEX_NIL;
+                 Entry = Index->Entries[Entry].Next) {
+
+                if (Index->Entries[Entry].Hash != Hash) {
+
+                    continue;
+                }
+
+                CdCleanupFileContext( IrpContext, FileContext );
+                CdInitializeFileContext( IrpContext, FileContext );
+
+                CdLookupInitialFileDirent( IrpContext,
+                                           Fcb,
+                                           FileContext,
+                                           Index->Entries[Entry].Offset );
+
+                Dirent = &FileContext->InitialDirent->Dirent;
+
+                CdUpdateDirentName( IrpContext, Dirent, IgnoreCase );
+
+                if (CdIsNameInExpression( IrpContext,
+                                          &Dirent->CdCaseFileName,
+                                          Name,
+                                          0,
+                                          TRUE )) {
+
+                    *MatchingName = &Dirent->CdCaseFileName;
+                    Found = TRUE;
+                    break;
+                }
+            }
+
+            if (Found) {
+
+                CdLookupLastFileDirent( IrpContext, Fcb, FileContext );
+            }
+
+            return Found;
+        }
+    }
+
     //
     //  Position ourselves at the first entry.
     //
@@ -992,6 +1079,149 @@ Return Value:
     return Found;
 }
 
+
+//
+//  Local support routine
+//
+
+VOID
+CdBuildDirentIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFCB Fcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine walks a directory once and builds the name index of the
+    files in it.  Only the first caller for a directory does the work.  If
+    the volume has used its share of pool for these, or we can't get the
+    pool, the directory just goes on without an index.
+
+Arguments:
+
+    Fcb - Fcb for the directory.  The stream file has been created.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    FILE_ENUM_CONTEXT FileContext;
+    PDIRENT Dirent;
+
+    PCD_NAME_INDEX_ENTRY Entries = NULL;
+    PCD_NAME_INDEX Index = NULL;
+    ULONG MaximumEntries;
+    ULONG EntryCount = 0;
+
+    BOOLEAN Build;
+
+    PAGED_CODE();
+
+    //
+    //  Only one thread gets to build the index.
+    //
+
+    CdLockFcb( IrpContext, Fcb );
+
+    Build = !FlagOn( Fcb->FcbState, FCB_STATE_DIRENT_INDEX_BUILT );
+    SetFlag( Fcb->FcbState, FCB_STATE_DIRENT_INDEX_BUILT );
+
+    CdUnlockFcb( IrpContext, Fcb );
+
+    if (!Build ||
+        (Fcb->Vcb->DirentIndexBytes >= CD_DIRENT_INDEX_MAX_VOLUME_BYTES)) {
+
+        return;
+    }
+
+    //
+    //  The size of the directory bounds the number of dirents in it.
+    //
+
+    MaximumEntries = (ULONG) ((Fcb->FileSize.QuadPart - Fcb->StreamOffset) / CD_MIN_DIRENT_LENGTH) + 1;
+
+    if (MaximumEntries * sizeof( CD_NAME_INDEX_ENTRY ) >= CD_DIRENT_INDEX_MAX_VOLUME_BYTES) {
+
+        return;
+    }
+
+    Entries = ExAllocatePoolWithTag( CdPagedPool,
+                                     MaximumEntries * sizeof( CD_NAME_INDEX_ENTRY ),
+                                     TAG_NAME_INDEX );
+
+    if (Entries == NULL) {
+
+        return;
+    }
+
+    CdInitializeFileContext( IrpContext, &FileContext );
+
+    try {
+
+        CdLookupInitialFileDirent( IrpContext, Fcb, &FileContext, Fcb->StreamOffset );
+
+        do {
+
+            Dirent = &FileContext.InitialDirent->Dirent;
+
+            //
+            //  CdFindFile only looks for files, and never at constant entries.
+            //
+
+            if (!FlagOn( Dirent->DirentFlags, CD_ATTRIBUTE_ASSOC | CD_ATTRIBUTE_DIRECTORY )) {
+
+                CdUpdateDirentName( IrpContext, Dirent, FALSE );
+
+                if (!FlagOn( Dirent->Flags, DIRENT_FLAG_CONSTANT_ENTRY )) {
+
+                    if (EntryCount == MaximumEntries) {
+
+                        try_return( NOTHING );
+                    }
+
+                    Entries[EntryCount].Hash = CdHashName( IrpContext,
+                                                           &Dirent->CdFileName.FileName,
+                                                           0 );
+
+                    Entries[EntryCount].Offset = Dirent->DirentOffset;
+                    Entries[EntryCount].Ordinal = 0;
+
+                    EntryCount += 1;
+                }
+            }
+
+        } while (CdLookupNextInitialFileDirent( IrpContext, Fcb, &FileContext ));
+
+        Index = CdCreateNameIndex( IrpContext, Entries, EntryCount );
+
+        if (Index != NULL) {
+
+            InterlockedExchangeAdd( &Fcb->Vcb->DirentIndexBytes, (LONG) Index->IndexSize );
+
+            CdLockFcb( IrpContext, Fcb );
+
+            NT_ASSERT( Fcb->DirentIndex == NULL );
+            Fcb->DirentIndex = Index;
+            Index = NULL;
+
+            CdUnlockFcb( IrpContext, Fcb );
+        }
+
+    try_exit: NOTHING;
+    } finally {
+
+        CdCleanupFileContext( IrpContext, &FileContext );
+
+        CdFreePool( &Entries );
+        CdFreePool( &Index );
+    }
+}
+
 
 BOOLEAN
 CdFindDirectory (
@@ -24,9 +24,11 @@ Abstract:
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, CdConvertBigToLittleEndian)
 #pragma alloc_text(PAGE, CdConvertNameToCdName)
+#pragma alloc_text(PAGE, CdCreateNameIndex)
 #pragma alloc_text(PAGE, CdDissectName)
 #pragma alloc_text(PAGE, CdGenerate8dot3Name)
 #pragma alloc_text(PAGE, CdFullCompareNames)
+#pragma alloc_text(PAGE, CdHashName)
 #pragma alloc_text(PAGE, CdIsLegalName)
 #pragma alloc_text(PAGE, CdIs8dot3Name)
 #pragma alloc_text(PAGE, CdIsNameInExpression)
@@ -1125,5 +1127,135 @@ Return Value:
     return Result;
 }
 
+
+ULONG
+CdHashName (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PUNICODE_STRING Name,
+    _In_ ULONG Seed
+    )
+
+/*++
+
+Routine Description:
+
+    This routine computes the hash of a name for a name index.  The hash
+    ignores case so the same index serves both exact and ignore case
+    searches.
+
+Arguments:
+
+    Name - Name to hash, without any version string.
+
+    Seed - Value to mix into the hash.  Path table entries use the
+        ordinal of their parent.
+
+Return Value:
+
+    ULONG - The hash of the name.
+
+--*/
+
+{
+    ULONG Hash = 0x811c9dc5 ^ Seed;
+    ULONG Index;
+    WCHAR Char;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    for (Index = 0; Index < Name->Length / sizeof( WCHAR ); Index++) {
+
+        Char = RtlUpcaseUnicodeChar( Name->Buffer[Index] );
+
+        Hash = (Hash ^ (Char & 0xff)) * 0x01000193;
+        Hash = (Hash ^ (Char >> 8)) * 0x01000193;
+    }
+
+    return Hash;
+}
+
+
+PCD_NAME_INDEX
+CdCreateNameIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_reads_(EntryCount) PCD_NAME_INDEX_ENTRY Entries,
+    _In_ ULONG EntryCount
+    )
+
+/*++
+
+Routine Description:
 
+    This routine allocates a name index and hashes the given entries into
+    it.  The entries must be in ascending offset order.
+
+Arguments:
+
+    Entries - Hash, offset and ordinal of each name.  The Next fields are
+        ignored.
+
+    EntryCount - Number of entries.
+
+Return Value:
+
+    PCD_NAME_INDEX - The new index, or NULL if there was no pool for it.
+
+--*/
+
+{
+    PCD_NAME_INDEX Index;
+    ULONG BucketCount;
+    ULONG IndexSize;
+    ULONG Entry;
+    PULONG Bucket;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    //
+    //  Use a power of two number of buckets, about one per entry.
+    //
+
+    for (BucketCount = 64; BucketCount < EntryCount; BucketCount <<= 1) {
+
+        NOTHING;
+    }
+
+    IndexSize = FIELD_OFFSET( CD_NAME_INDEX, Entries ) +
+                EntryCount * sizeof( CD_NAME_INDEX_ENTRY ) +
+                BucketCount * sizeof( ULONG );
+
+    Index = ExAllocatePoolWithTag( CdPagedPool, IndexSize, TAG_NAME_INDEX );
+
+    if (Index == NULL) {
+
+        return NULL;
+    }
+
+    Index->IndexSize = IndexSize;
+    Index->BucketMask = BucketCount - 1;
+    Index->EntryCount = EntryCount;
+    Index->Buckets = (PULONG) &Index->Entries[EntryCount];
+
+    RtlCopyMemory( Index->Entries, Entries, EntryCount * sizeof( CD_NAME_INDEX_ENTRY ));
+    RtlFillMemory( Index->Buckets, BucketCount * sizeof( ULONG ), 0xff );
+
+    //
+    //  Push the entries onto their chains from last to first, which leaves
+    //  each chain in ascending offset order.
+    //
+
+    for (Entry = EntryCount; Entry-- != 0; ) {
+
+        Bucket = &Index->Buckets[Index->Entries[Entry].Hash & Index->BucketMask];
+
+        Index->Entries[Entry].Next = *Bucket;
+        *Bucket = Entry;
+    }
+
+    return Index;
+}
 
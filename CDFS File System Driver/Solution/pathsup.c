@@ -96,6 +96,21 @@ Abstract:
 #define CdRawPathEntry(IC, PC)      \
     Add2Ptr( (PC)->Data, (PC)->DataOffset, PRAW_PATH_ENTRY )
 
+//
+//  Path tables smaller than this are always searched sequentially.  We
+//  won't index a path table with more entries than the maximum.
+//
+
+#define CD_PATH_TABLE_INDEX_MIN_SIZE        (4 * SECTOR_SIZE)
+#define CD_PATH_TABLE_INDEX_MAX_ENTRIES     (0x100000)
+
+//
+//  The smallest path table entry is an 8 byte header with a one byte name,
+//  padded to an even length.
+//
+
+#define CD_MIN_PATH_ENTRY_LENGTH            (10)
+
 //
 //  Local support routines
 //
@@ -118,7 +133,14 @@ CdUpdatePathEntryFromRawPathEntry (
     _Out_ PPATH_ENTRY PathEntry
     );
 
+VOID
+CdBuildPathTableIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _Inout_ PVCB Vcb
+    );
+
 #ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, CdBuildPathTableIndex)
 #pragma alloc_text(PAGE, CdFindPathEntry)
 #pragma alloc_text(PAGE, CdLookupPathEntry)
 #pragma alloc_text(PAGE, CdLookupNextPathEntry)
@@ -341,6 +363,11 @@ Return Value:
     ULONG StartingOffset;
     ULONG StartingOrdinal;
 
+    PVCB Vcb = ParentFcb->Vcb;
+    PCD_NAME_INDEX Index;
+    ULONG Hash;
+    ULONG Entry;
+
     PAGED_CODE();
 
     //
@@ -367,6 +394,65 @@ Return Value:
 		CdRaiseStatus( IrpContext, STATUS_DISK_CORRUPT_ERROR );
 	}
 
+    //
+    //  If the path table is large then index it the first time through.
+    //
+
+    if (!Vcb->PathTableIndexBuilt &&
+        (Vcb->PathTableFcb->FileSize.QuadPart >= CD_PATH_TABLE_INDEX_MIN_SIZE)) {
+
+        CdBuildPathTableIndex( IrpContext, Vcb );
+    }
+
+    //
+    //  With an index we only need to look at the entries under this parent
+    //  whose names hash the same, in path table order.
+    //
+
+    Index = Vcb->PathTableIndex;
+
+    if (Index != NULL) {
+
+        Hash = CdHashName( IrpContext, &DirName->FileName, ParentFcb->Ordinal );
+
+        for (Entry = Index->Buckets[Hash & Index->BucketMask];
+             Entry != CD_NAME_INDEX_NIL;
+             Entry = Index->Entries[Entry].Next) {
+
+            if (Index->Entries[Entry].Hash != Hash) {
+
+                continue;
+            }
+
+            CdCleanupCompoundPathEntry( IrpContext, CompoundPathEntry );
+            CdInitializeCompoundPathEntry( IrpContext, CompoundPathEntry );
+
+            CdLookupPathEntry( IrpContext,
+                               Index->Entries[Entry].Offset,
+                               Index->Entries[Entry].Ordinal,
+                               FALSE,
+                               CompoundPathEntry );
+
+            if (CompoundPathEntry->PathEntry.ParentOrdinal != ParentFcb->Ordinal) {
+
+                continue;
+            }
+
+            CdUpdatePathEntryName( IrpContext, &CompoundPathEntry->PathEntry, IgnoreCase );
+
+            if (CdIsNameInExpression( IrpContext,
+                                      &CompoundPathEntry->PathEntry.CdCaseDirName,
+                                      DirName,
+                                      0,
+                                      FALSE )) {
+
+                return TRUE;
+            }
+        }
+
+        return FALSE;
+    }
+
     CdLockFcb( IrpContext, ParentFcb );
 
     if (ParentFcb->ChildPathTableOffset != 0) {
@@ -480,6 +566,141 @@ Return Value:
 //  Local support routine
 //
 
+VOID
+CdBuildPathTableIndex (
+    _In_ PIRP_CONTEXT IrpContext,
+    _Inout_ PVCB Vcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine walks the whole path table once and builds the name index
+    for it.  Only the first caller for a volume does the work.  If we can't
+    get the pool then the volume just goes on without an index.
+
+Arguments:
+
+    Vcb - Vcb for the volume.  This must be the volume in the IrpContext.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    COMPOUND_PATH_ENTRY CompoundPathEntry;
+    PPATH_ENTRY PathEntry = &CompoundPathEntry.PathEntry;
+
+    PCD_NAME_INDEX_ENTRY Entries = NULL;
+    PCD_NAME_INDEX Index = NULL;
+    ULONG MaximumEntries;
+    ULONG EntryCount = 0;
+
+    BOOLEAN Build;
+
+    PAGED_CODE();
+
+    NT_ASSERT( Vcb == IrpContext->Vcb );
+
+    //
+    //  Only one thread gets to build the index.
+    //
+
+    CdLockVcb( IrpContext, Vcb );
+
+    Build = !Vcb->PathTableIndexBuilt;
+    Vcb->PathTableIndexBuilt = TRUE;
+
+    CdUnlockVcb( IrpContext, Vcb );
+
+    if (!Build) {
+
+        return;
+    }
+
+    //
+    //  The size of the path table bounds the number of entries in it.
+    //
+
+    if (Vcb->PathTableFcb->FileSize.QuadPart / CD_MIN_PATH_ENTRY_LENGTH >= CD_PATH_TABLE_INDEX_MAX_ENTRIES) {
+
+        return;
+    }
+
+    MaximumEntries = (ULONG) (Vcb->PathTableFcb->FileSize.QuadPart / CD_MIN_PATH_ENTRY_LENGTH) + 1;
+
+    Entries = ExAllocatePoolWithTag( CdPagedPool,
+                                     MaximumEntries * sizeof( CD_NAME_INDEX_ENTRY ),
+                                     TAG_NAME_INDEX );
+
+    if (Entries == NULL) {
+
+        return;
+    }
+
+    CdInitializeCompoundPathEntry( IrpContext, &CompoundPathEntry );
+
+    try {
+
+        CdLookupPathEntry( IrpContext,
+                           CdQueryFidPathTableOffset( Vcb->RootIndexFcb->FileId ),
+                           Vcb->RootIndexFcb->Ordinal,
+                           FALSE,
+                           &CompoundPathEntry );
+
+        do {
+
+            if (EntryCount == MaximumEntries) {
+
+                try_return( NOTHING );
+            }
+
+            CdUpdatePathEntryName( IrpContext, PathEntry, FALSE );
+
+            Entries[EntryCount].Hash = CdHashName( IrpContext,
+                                                   &PathEntry->CdDirName.FileName,
+                                                   PathEntry->ParentOrdinal );
+
+            Entries[EntryCount].Offset = PathEntry->PathTableOffset;
+            Entries[EntryCount].Ordinal = PathEntry->Ordinal;
+
+            EntryCount += 1;
+
+        } while (CdLookupNextPathEntry( IrpContext,
+                                        &CompoundPathEntry.PathContext,
+                                        PathEntry ));
+
+        Index = CdCreateNameIndex( IrpContext, Entries, EntryCount );
+
+        if (Index != NULL) {
+
+            CdLockVcb( IrpContext, Vcb );
+
+            NT_ASSERT( Vcb->PathTableIndex == NULL );
+            Vcb->PathTableIndex = Index;
+            Index = NULL;
+
+            CdUnlockVcb( IrpContext, Vcb );
+        }
+
+    try_exit: NOTHING;
+    } finally {
+
+        CdCleanupCompoundPathEntry( IrpContext, &CompoundPathEntry );
+
+        CdFreePool( &Entries );
+        CdFreePool( &Index );
+    }
+}
+
+
+//
+//  Local support routine
+//
+
 VOID
 CdMapPathTableBlock (
     _In_ PIRP_CONTEXT IrpContext,
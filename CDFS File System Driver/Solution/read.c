@@ -49,8 +49,31 @@ __pragma(warning(suppress: 6320))                           \
 
 #define READ_AHEAD_GRANULARITY           (0x10000)
 
+//
+//  Largest read ahead granularity a handle doing sequential reads will
+//  grow to, and the number of back to back sequential reads needed
+//  before we double it.
+//
+
+#define MAX_READ_AHEAD_GRANULARITY       (0x100000)
+#define SEQUENTIAL_READS_PER_STEP        (4)
+
+//
+//  Local support routines
+//
+
+VOID
+CdUpdateReadAhead (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFILE_OBJECT FileObject,
+    _Inout_ PCCB Ccb,
+    _In_ LONGLONG StartingOffset,
+    _In_ ULONG ByteCount
+    );
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, CdCommonRead)
+#pragma alloc_text(PAGE, CdUpdateReadAhead)
 #endif
 
 
@@ -466,6 +489,26 @@ Return Value:
                                   Fcb );
 
             CcSetReadAheadGranularity( IrpSp->FileObject, READ_AHEAD_GRANULARITY );
+
+            if (Ccb != NULL) {
+
+                Ccb->SequentialReadCount = 0;
+                Ccb->ReadAheadGranularity = READ_AHEAD_GRANULARITY;
+            }
+        }
+
+        //
+        //  Grow the read ahead window if this handle is reading the file
+        //  sequentially.
+        //
+
+        if ((TypeOfOpen == UserFileOpen) && (Ccb != NULL)) {
+
+            CdUpdateReadAhead( IrpContext,
+                               IrpSp->FileObject,
+                               Ccb,
+                               StartingOffset,
+                               ByteCount );
         }
 
         //
@@ -562,4 +605,96 @@ Return Value:
     return Status;
 }
 
+
+//
+//  Local support routine
+//
+
+VOID
+CdUpdateReadAhead (
+    _In_ PIRP_CONTEXT IrpContext,
+    _In_ PFILE_OBJECT FileObject,
+    _Inout_ PCCB Ccb,
+    _In_ LONGLONG StartingOffset,
+    _In_ ULONG ByteCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tracks cached reads on a handle and scales the cache
+    manager's read ahead granularity for the file object to match.  Every
+    SEQUENTIAL_READS_PER_STEP reads which begin where the previous read
+    ended double the granularity, up to MAX_READ_AHEAD_GRANULARITY.  A read
+    anywhere else drops the handle back to READ_AHEAD_GRANULARITY.
+
+    The file is only held shared here so readers sharing this handle may
+    race on the Ccb fields.  These are only a hint; the worst case is a
+    read ahead granularity which is briefly too large or too small.
+
+Arguments:
+
+    FileObject - File object for this read.  Its private cache map has
+        already been initialized.
+
+    Ccb - Ccb for this handle.
+
+    StartingOffset - Offset in the file where this read begins.
+
+    ByteCount - Number of bytes in this read.
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    ULONG Granularity = Ccb->ReadAheadGranularity;
+
+    PAGED_CODE();
+
+    UNREFERENCED_PARAMETER( IrpContext );
+
+    if (Granularity == 0) {
+
+        Granularity = READ_AHEAD_GRANULARITY;
+    }
+
+    //
+    //  Extend the current run if this read picks up where the last one
+    //  ended, otherwise start over with the default granularity.
+    //
+
+    if (StartingOffset == Ccb->NextReadOffset) {
+
+        Ccb->SequentialReadCount += 1;
+
+        if ((Ccb->SequentialReadCount >= SEQUENTIAL_READS_PER_STEP) &&
+            (Granularity < MAX_READ_AHEAD_GRANULARITY)) {
+
+            Granularity <<= 1;
+            Ccb->SequentialReadCount = 0;
+        }
+
+    } else {
+
+        Ccb->SequentialReadCount = 0;
+        Granularity = READ_AHEAD_GRANULARITY;
+    }
+
+    Ccb->NextReadOffset = StartingOffset + ByteCount;
+
+    //
+    //  Only call the cache manager when the granularity changes.
+    //
+
+    if (Granularity != Ccb->ReadAheadGranularity) {
+
+        Ccb->ReadAheadGranularity = Granularity;
+        CcSetReadAheadGranularity( FileObject, Granularity );
+    }
+}
+
 
@@ -928,6 +928,7 @@ Return Value:
 
     CdFreePool( &Vcb->XASector );
     CdFreePool( &Vcb->SectorCacheBuffer);
+    CdFreePool( &Vcb->PathTableIndex );
 
     if (Vcb->SectorCacheIrp != NULL) {
 
@@ -2491,6 +2492,18 @@ Return Value:
 
             Vcb = Fcb->Vcb;
             Vcb->PathTableFcb = NULL;
+
+            CdFreePool( &Vcb->PathTableIndex );
+        }
+
+        //
+        //  Free the name index for this directory.
+        //
+
+        if (Fcb->DirentIndex != NULL) {
+
+            InterlockedExchangeAdd( &Fcb->Vcb->DirentIndexBytes, -(LONG) Fcb->DirentIndex->IndexSize );
+            CdFreePool( &Fcb->DirentIndex );
         }
 
         CdDeallocateFcbIndex( IrpContext, Fcb );
@@ -49,6 +49,18 @@ BootEnvironmentIsWinPE(
     VOID
     );
 
+BOOLEAN
+RequestDeferUntilConcurrentReadsDrain(
+    _In_ PCDROM_DEVICE_EXTENSION DeviceExtension,
+    _In_ WDFREQUEST              Request
+    );
+
+NTSTATUS
+RequestForwardConcurrentRead(
+    _In_ PCDROM_DEVICE_EXTENSION DeviceExtension,
+    _In_ WDFREQUEST              Request
+    );
+
 #ifdef ALLOC_PRAGMA
 
 #pragma alloc_text(INIT, DriverEntry)
@@ -557,6 +569,12 @@ Return Value:
     //      the Dispatch routines will be completed here.  Anything requiring device
     //      I/O will be sent through the serial I/O queue.
     //
+    // c. Concurrent read queue: parallel queue
+    //      On devices that support command queuing, the serial queue forwards reads
+    //      here so that several of them can be in flight. It presents at most one
+    //      read per concurrent scratch context. Any other request on the serial
+    //      queue waits until the concurrent reads have drained.
+    //
     // 10. Set up IO queues after device being created.
     //
     {
@@ -584,6 +602,23 @@ Return Value:
             goto Exit;
         }
 
+        // this queue is dedicated for reads that run concurrently.
+        WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchParallel);
+
+        queueConfig.PowerManaged                = WdfFalse;
+        queueConfig.EvtIoRead                   = ConcurrentQueueEvtIoRead;
+        queueConfig.EvtIoCanceledOnQueue        = ConcurrentQueueEvtCanceledOnQueue;
+        queueConfig.Settings.Parallel.NumberOfPresentedRequests = CDROM_CONCURRENT_READ_CONTEXTS;
+
+        status = WdfIoQueueCreate(device,
+                                  &queueConfig,
+                                  WDF_NO_OBJECT_ATTRIBUTES,
+                                  &(deviceExtension->ConcurrentReadQueue));
+        if (!NT_SUCCESS(status)) 
+        {
+            goto Exit;
+        }
+
         // this queue is dedicated for file create requests.
         WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchParallel);
 
@@ -646,6 +681,9 @@ Return Value:
     // Clear the SrbFlags and disable synchronous transfers
     deviceExtension->SrbFlags = SRB_FLAGS_DISABLE_SYNCH_TRANSFER;
 
+    // No reads are running on the concurrent read queue yet
+    KeInitializeSpinLock(&deviceExtension->ConcurrentReadLock);
+
     // Set timeout value in seconds.
     deviceExtension->TimeOutValue = DeviceGetTimeOutValueFromRegistry();
     if ((deviceExtension->TimeOutValue > 30 * 60) || // longer than 30 minutes
@@ -911,6 +949,7 @@ Return Value:
     // Purge unprocessed requests, stop the IO queues.
     // Incoming request will be completed with STATUS_INVALID_DEVICE_STATE status.
     WdfIoQueuePurge(deviceExtension->SerialIOQueue, WDF_NO_EVENT_CALLBACK, WDF_NO_CONTEXT);
+    WdfIoQueuePurge(deviceExtension->ConcurrentReadQueue, WDF_NO_EVENT_CALLBACK, WDF_NO_CONTEXT);
     WdfIoQueuePurge(deviceExtension->CreateQueue, WDF_NO_EVENT_CALLBACK, WDF_NO_CONTEXT);
      
     // Close the IoTarget so that we are sure there are no outstanding I/Os in the stack.
@@ -3180,6 +3219,7 @@ Return Value:
     PIRP                    wdmIrp = WdfRequestWdmGetIrp(Request);
     PIO_STACK_LOCATION      currentIrpStack = IoGetCurrentIrpStackLocation(wdmIrp);
     PCDROM_DATA             cdData = &(deviceExtension->DeviceAdditionalData);
+    BOOLEAN                 concurrentRead = FALSE;
 
     // Get the request parameters
     WDF_REQUEST_PARAMETERS_INIT(&requestParameters);
@@ -3196,6 +3236,21 @@ Return Value:
                     "Receiving WRITE, Length %Ix\n", (ULONG) Length));
     }
 
+    // Reads can run concurrently with each other as long as the device supports
+    // command queuing and tagged queuing has not been turned off because of errors.
+    // Writes, and reads that need the MMC capabilities refreshed first, stay serialized
+    // and have to wait for the concurrent reads that are still in flight.
+    concurrentRead = (requestParameters.Type == WdfRequestTypeRead) &&
+                     deviceExtension->ConcurrentReadsSupported &&
+                     (deviceExtension->ErrorCount < CLASS_ERROR_LEVEL_1) &&
+                     !DeviceIsMmcUpdateRequired(device);
+
+    if (!concurrentRead &&
+        RequestDeferUntilConcurrentReadsDrain(deviceExtension, Request))
+    {
+        return;
+    }
+
     // Check if a verify is required before a READ/WRITE
     if (TEST_FLAG(deviceExtension->DeviceObject->Flags, DO_VERIFY_VOLUME) &&
         (requestParameters.MinorFunction != CDROM_VOLUME_VERIFY_CHECKED) &&
@@ -3263,7 +3318,14 @@ Return Value:
 
             if (NT_SUCCESS(status))
             {
-                status = RequestHandleReadWrite(deviceExtension, Request, requestParameters);
+                if (concurrentRead)
+                {
+                    status = RequestForwardConcurrentRead(deviceExtension, Request);
+                }
+                else
+                {
+                    status = RequestHandleReadWrite(deviceExtension, &deviceExtension->ScratchContext, Request, requestParameters);
+                }
             }
         }
 
@@ -3328,7 +3390,7 @@ Return Value:
     }
     if (NT_SUCCESS(status))
     {
-        status = RequestHandleReadWrite(deviceExtension, readWriteRequest, readWriteRequestParameters);
+        status = RequestHandleReadWrite(deviceExtension, &deviceExtension->ScratchContext, readWriteRequest, readWriteRequestParameters);
     }
 
     // Complete the request immediately on failure
@@ -3375,6 +3437,12 @@ Return Value:
     UNREFERENCED_PARAMETER(InputBufferLength);
     UNREFERENCED_PARAMETER(IoControlCode);
 
+    // IOCTLs are not reordered with the reads that are still running concurrently.
+    if (RequestDeferUntilConcurrentReadsDrain(deviceExtension, Request))
+    {
+        return;
+    }
+
     // get the request parameters
     WDF_REQUEST_PARAMETERS_INIT(&requestParameters);
     WdfRequestGetParameters(Request, &requestParameters);
@@ -3822,6 +3890,251 @@ Return Value:
 }
 
 
+BOOLEAN
+RequestDeferUntilConcurrentReadsDrain(
+    _In_ PCDROM_DEVICE_EXTENSION DeviceExtension,
+    _In_ WDFREQUEST              Request
+    )
+/*++
+Routine Description:
+
+    Hold a request presented by the serial queue while reads are still running
+    on the concurrent read queue. The serial queue does not present another
+    request until this one is done, so no new concurrent reads can start and
+    at most one request is held at a time. The last concurrent read to complete
+    dispatches the held request again.
+
+Arguments:
+
+    DeviceExtension - device context
+    Request - request presented by the serial queue
+
+Return Value:
+
+    TRUE if the request is held; FALSE if it can be processed now.
+
+--*/
+{
+    BOOLEAN deferred = FALSE;
+    KIRQL   oldIrql;
+
+    KeAcquireSpinLock(&DeviceExtension->ConcurrentReadLock, &oldIrql);
+
+    if (DeviceExtension->ConcurrentReadsOutstanding > 0)
+    {
+        NT_ASSERT(DeviceExtension->ConcurrentReadDrainRequest == NULL);
+
+        DeviceExtension->ConcurrentReadDrainRequest = Request;
+        deferred = TRUE;
+    }
+
+    KeReleaseSpinLock(&DeviceExtension->ConcurrentReadLock, oldIrql);
+
+    return deferred;
+}
+
+
+NTSTATUS
+RequestForwardConcurrentRead(
+    _In_ PCDROM_DEVICE_EXTENSION DeviceExtension,
+    _In_ WDFREQUEST              Request
+    )
+/*++
+Routine Description:
+
+    Hand a validated read over to the concurrent read queue.
+
+Arguments:
+
+    DeviceExtension - device context
+    Request - read request presented by the serial queue
+
+Return Value:
+
+    NTSTATUS. On failure, the caller completes the request.
+
+--*/
+{
+    NTSTATUS    status = STATUS_SUCCESS;
+    KIRQL       oldIrql;
+
+    KeAcquireSpinLock(&DeviceExtension->ConcurrentReadLock, &oldIrql);
+    DeviceExtension->ConcurrentReadsOutstanding++;
+    KeReleaseSpinLock(&DeviceExtension->ConcurrentReadLock, oldIrql);
+
+    status = WdfRequestForwardToIoQueue(Request, DeviceExtension->ConcurrentReadQueue);
+
+    if (!NT_SUCCESS(status))
+    {
+        TracePrint((TRACE_LEVEL_WARNING, TRACE_FLAG_GENERAL,
+                    "RequestForwardConcurrentRead: WdfRequestForwardToIoQueue failed, %!STATUS!\n",
+                    status));
+
+        DeviceConcurrentReadCompleted(DeviceExtension);
+    }
+
+    return status;
+}
+
+
+VOID
+DeviceConcurrentReadCompleted(
+    _In_ PCDROM_DEVICE_EXTENSION DeviceExtension
+    )
+/*++
+Routine Description:
+
+    Account for a read forwarded to the concurrent read queue that has been
+    completed. When the last one completes, the serial queue request held by
+    RequestDeferUntilConcurrentReadsDrain is dispatched again.
+
+Arguments:
+
+    DeviceExtension - device context
+
+Return Value:
+
+    None
+
+--*/
+{
+    WDFREQUEST  drainRequest = NULL;
+    KIRQL       oldIrql;
+
+    KeAcquireSpinLock(&DeviceExtension->ConcurrentReadLock, &oldIrql);
+
+    NT_ASSERT(DeviceExtension->ConcurrentReadsOutstanding > 0);
+    DeviceExtension->ConcurrentReadsOutstanding--;
+
+    if (DeviceExtension->ConcurrentReadsOutstanding == 0)
+    {
+        drainRequest = DeviceExtension->ConcurrentReadDrainRequest;
+        DeviceExtension->ConcurrentReadDrainRequest = NULL;
+    }
+
+    KeReleaseSpinLock(&DeviceExtension->ConcurrentReadLock, oldIrql);
+
+    if (drainRequest != NULL)
+    {
+        WDF_REQUEST_PARAMETERS  requestParameters;
+
+        WDF_REQUEST_PARAMETERS_INIT(&requestParameters);
+        WdfRequestGetParameters(drainRequest, &requestParameters);
+
+        if (requestParameters.Type == WdfRequestTypeDeviceControl)
+        {
+            SequentialQueueEvtIoDeviceControl(DeviceExtension->SerialIOQueue,
+                                              drainRequest,
+                                              requestParameters.Parameters.DeviceIoControl.OutputBufferLength,
+                                              requestParameters.Parameters.DeviceIoControl.InputBufferLength,
+                                              requestParameters.Parameters.DeviceIoControl.IoControlCode);
+        }
+        else
+        {
+            SequentialQueueEvtIoReadWrite(DeviceExtension->SerialIOQueue,
+                                          drainRequest,
+                                          (requestParameters.Type == WdfRequestTypeRead) ?
+                                            requestParameters.Parameters.Read.Length :
+                                            requestParameters.Parameters.Write.Length);
+        }
+    }
+
+    return;
+}
+
+
+VOID
+ConcurrentQueueEvtIoRead(
+    _In_ WDFQUEUE    Queue,
+    _In_ WDFREQUEST  Request,
+    _In_ size_t      Length
+    )
+/*++
+Routine Description:
+
+    Start a read forwarded from the serial queue on a concurrent scratch context.
+    The request has already been validated by the serial queue.
+
+Arguments:
+
+    Queue - concurrent read queue
+
+    Request - handle to the incoming WDF Request object
+
+    Length - read length
+
+Return Value:
+
+    None
+
+--*/
+{
+    NTSTATUS                status = STATUS_SUCCESS;
+    WDFDEVICE               device = WdfIoQueueGetDevice(Queue);
+    PCDROM_DEVICE_EXTENSION deviceExtension = DeviceGetExtension(device);
+    PCDROM_SCRATCH_CONTEXT  scratchContext = NULL;
+    WDF_REQUEST_PARAMETERS  requestParameters;
+
+    UNREFERENCED_PARAMETER(Length);
+
+    WDF_REQUEST_PARAMETERS_INIT(&requestParameters);
+    WdfRequestGetParameters(Request, &requestParameters);
+
+    // The queue presents no more reads than there are concurrent scratch
+    // contexts, so one is expected to be free.
+    scratchContext = ScratchBuffer_AcquireConcurrentContext(deviceExtension);
+    NT_ASSERT(scratchContext != NULL);
+
+    if (scratchContext == NULL)
+    {
+        RequestCompletion(deviceExtension, Request, STATUS_INSUFFICIENT_RESOURCES, 0);
+        DeviceConcurrentReadCompleted(deviceExtension);
+    }
+    else
+    {
+        status = RequestHandleReadWrite(deviceExtension, scratchContext, Request, requestParameters);
+
+        if (!NT_SUCCESS(status))
+        {
+            ScratchBuffer_CompleteReadWrite(deviceExtension, scratchContext, Request, status);
+        }
+    }
+
+    return;
+}
+
+
+VOID
+ConcurrentQueueEvtCanceledOnQueue(
+    _In_ WDFQUEUE   Queue,
+    _In_ WDFREQUEST Request
+    )
+/*++
+Routine Description:
+
+    Complete a read that was cancelled while waiting in the concurrent read queue.
+
+Arguments:
+
+    Queue - concurrent read queue
+    Request - handle to the incoming WDF Request object
+
+Return Value:
+
+    None
+
+--*/
+{
+    PCDROM_DEVICE_EXTENSION deviceExtension = DeviceGetExtension(WdfIoQueueGetDevice(Queue));
+
+    RequestCompletion(deviceExtension, Request, STATUS_CANCELLED, 0);
+
+    DeviceConcurrentReadCompleted(deviceExtension);
+
+    return;
+}
+
+
 NTSTATUS
 RequestSynchronizeProcessWithSerialQueue(
     _In_ WDFDEVICE Device,
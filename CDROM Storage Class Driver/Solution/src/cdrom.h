@@ -304,6 +304,10 @@ typedef struct _CDROM_SCRATCH_CONTEXT {
   
 } CDROM_SCRATCH_CONTEXT, *PCDROM_SCRATCH_CONTEXT;
 
+// Number of additional scratch contexts used to keep reads in flight
+// concurrently on devices that support command queuing.
+#define CDROM_CONCURRENT_READ_CONTEXTS  4
+
 // Context structure for the IOCTL work item
 typedef struct _CDROM_IOCTL_CONTEXT {
 
@@ -456,6 +460,10 @@ typedef struct _CDROM_DEVICE_EXTENSION {
     // Additional WDF queue for serial I/O processing
     WDFQUEUE        SerialIOQueue;
 
+    // Parallel queue that reads are forwarded to from the serial queue when
+    // they can run on one of the concurrent scratch contexts.
+    WDFQUEUE        ConcurrentReadQueue;
+
     // A separate queue for all the create file requests in sync with device
     // removal
     WDFQUEUE        CreateQueue;
@@ -578,6 +586,19 @@ typedef struct _CDROM_DEVICE_EXTENSION {
     // scratch buffer related fields.
     CDROM_SCRATCH_CONTEXT   ScratchContext;
 
+    // Scratch contexts for concurrent reads. Only allocated, and only used,
+    // if both the device and the adapter report command queuing. All other
+    // commands keep using ScratchContext on the serial queue.
+    CDROM_SCRATCH_CONTEXT   ConcurrentScratchContexts[CDROM_CONCURRENT_READ_CONTEXTS];
+    LONG                    ConcurrentScratchBusyMask;
+    BOOLEAN                 ConcurrentReadsSupported;
+
+    // Reads forwarded to the concurrent read queue that have not completed yet,
+    // and the serial queue request (if any) waiting for them to drain.
+    KSPIN_LOCK              ConcurrentReadLock;
+    ULONG                   ConcurrentReadsOutstanding;
+    WDFREQUEST              ConcurrentReadDrainRequest;
+
     // Hold new private data that only classpnp should modify
     // in this structure.
     PCDROM_PRIVATE_FDO_DATA PrivateFdoData;
@@ -643,6 +664,9 @@ typedef struct _CDROM_REQUEST_CONTEXT {
     BOOLEAN         ReadWriteIsCompleted;
     BOOLEAN         ReadWriteRetryInitialized;
 
+    // Scratch context that is carrying out this READ/WRITE request.
+    PCDROM_SCRATCH_CONTEXT  ReadWriteScratchContext;
+
 } CDROM_REQUEST_CONTEXT, *PCDROM_REQUEST_CONTEXT;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(CDROM_REQUEST_CONTEXT, RequestGetContext)
@@ -878,6 +902,17 @@ EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL SequentialQueueEvtIoDeviceControl;
 
 EVT_WDF_IO_QUEUE_IO_CANCELED_ON_QUEUE SequentialQueueEvtCanceledOnQueue;
 
+// Concurrent Read Queue Event callbacks
+
+EVT_WDF_IO_QUEUE_IO_READ ConcurrentQueueEvtIoRead;
+
+EVT_WDF_IO_QUEUE_IO_CANCELED_ON_QUEUE ConcurrentQueueEvtCanceledOnQueue;
+
+VOID
+DeviceConcurrentReadCompleted(
+    _In_ PCDROM_DEVICE_EXTENSION DeviceExtension
+    );
+
 // Miscellaneous request callbacks
 
 EVT_WDF_OBJECT_CONTEXT_CLEANUP RequestEvtCleanup;
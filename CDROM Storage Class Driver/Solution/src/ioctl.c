@@ -6343,6 +6343,7 @@ Return Value:
 NTSTATUS
 RequestHandleReadWrite(
     _In_  PCDROM_DEVICE_EXTENSION  DeviceExtension, 
+    _In_  PCDROM_SCRATCH_CONTEXT   ScratchContext,
     _In_  WDFREQUEST               Request, 
     _In_  WDF_REQUEST_PARAMETERS   RequestParameters
     )
@@ -6355,6 +6356,8 @@ Routine Description:
 Arguments:
 
     DeviceExtension - device context
+    ScratchContext - scratch context to carry out the transfer: the serial one,
+                     or a concurrent read context
     Request - request to be handled
     RequestParameters - request parameter
 
@@ -6443,10 +6446,14 @@ Return Value:
         originalRequestContext = RequestGetContext(Request);
 
 
-        ScratchBuffer_BeginUse(DeviceExtension);
+        // A concurrent read context is already in use once it has been acquired.
+        if (ScratchContext == &DeviceExtension->ScratchContext)
+        {
+            ScratchBuffer_BeginUse(DeviceExtension);
+        }
 
-        readWriteContext = &DeviceExtension->ScratchContext.ScratchReadWriteContext;
-        requestContext = RequestGetContext(DeviceExtension->ScratchContext.ScratchRequest);
+        readWriteContext = &ScratchContext->ScratchReadWriteContext;
+        requestContext = RequestGetContext(ScratchContext->ScratchRequest);
 
         readWriteContext->PacketsCount = packetsCount;
         readWriteContext->EntireXferLen = entireXferLen;
@@ -6468,8 +6475,9 @@ Return Value:
         originalRequestContext->ReadWriteIsCompleted = FALSE;
         originalRequestContext->ReadWriteRetryInitialized = FALSE;
         originalRequestContext->DeviceExtension = DeviceExtension;
+        originalRequestContext->ReadWriteScratchContext = ScratchContext;
 
-        status = ScratchBuffer_PerformNextReadWrite(DeviceExtension, TRUE);
+        status = ScratchBuffer_PerformNextReadWrite(DeviceExtension, ScratchContext, TRUE);
                         
         // We do not call ScratchBuffer_EndUse here, because we're not releasing the scratch SRB.
         // It will be released in the completion routine.
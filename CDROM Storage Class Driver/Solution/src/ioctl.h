@@ -601,6 +601,7 @@ RequestHandleScsiPassThrough(
 NTSTATUS
 RequestHandleReadWrite(
     _In_  PCDROM_DEVICE_EXTENSION  DeviceExtension, 
+    _In_  PCDROM_SCRATCH_CONTEXT   ScratchContext,
     _In_  WDFREQUEST               Request, 
     _In_  WDF_REQUEST_PARAMETERS   RequestParameters
     );
@@ -91,8 +91,9 @@ Return Value:
 
     currentStack = IoGetCurrentIrpStackLocation(Irp);
 
-    // finish all current requests
+    // finish all current requests, including reads running on the concurrent read queue
     WdfIoQueueStopSynchronously(deviceExtension->SerialIOQueue);
+    WdfIoQueueStopSynchronously(deviceExtension->ConcurrentReadQueue);
 
     // sync cache
     if (NT_SUCCESS(status))
@@ -117,7 +118,8 @@ Return Value:
         status = RequestIssueShutdownFlush(deviceExtension, Irp);
     }
 
-    // restart queue to allow processing further requests.
+    // restart queues to allow processing further requests.
+    WdfIoQueueStart(deviceExtension->ConcurrentReadQueue);
     WdfIoQueueStart(deviceExtension->SerialIOQueue);
 
     // release the shutdown/flush lock
@@ -38,9 +38,25 @@ Revision History:
 // Forward declarations
 EVT_WDF_REQUEST_COMPLETION_ROUTINE  ScratchBuffer_ReadWriteCompletionRoutine;
 
+_IRQL_requires_max_(APC_LEVEL)
+VOID
+ScratchBuffer_DeallocateContext(
+    _Inout_ PCDROM_SCRATCH_CONTEXT  ScratchContext
+    );
+
+_IRQL_requires_max_(APC_LEVEL)
+NTSTATUS
+ScratchBuffer_AllocateContext(
+    _In_    PCDROM_DEVICE_EXTENSION DeviceExtension,
+    _Inout_ PCDROM_SCRATCH_CONTEXT  ScratchContext,
+    _In_    BOOLEAN                 AllocateBuffer
+    );
+
 #ifdef ALLOC_PRAGMA
 
+#pragma alloc_text(PAGE, ScratchBuffer_DeallocateContext)
 #pragma alloc_text(PAGE, ScratchBuffer_Deallocate)
+#pragma alloc_text(PAGE, ScratchBuffer_AllocateContext)
 #pragma alloc_text(PAGE, ScratchBuffer_Allocate)
 #pragma alloc_text(PAGE, ScratchBuffer_SetupSrb)
 #pragma alloc_text(PAGE, ScratchBuffer_ExecuteCdbEx)
@@ -49,18 +65,18 @@ EVT_WDF_REQUEST_COMPLETION_ROUTINE  ScratchBuffer_ReadWriteCompletionRoutine;
 
 _IRQL_requires_max_(APC_LEVEL)
 VOID
-ScratchBuffer_Deallocate(
-    _Inout_ PCDROM_DEVICE_EXTENSION DeviceExtension
+ScratchBuffer_DeallocateContext(
+    _Inout_ PCDROM_SCRATCH_CONTEXT  ScratchContext
     )
 /*++
 
 Routine Description:
 
-    release all resources allocated for scratch.
+    release all resources allocated for one scratch context.
 
 Arguments:
 
-    DeviceExtension - device extension
+    ScratchContext - scratch context
 
 Return Value:
 
@@ -70,68 +86,69 @@ Return Value:
 {
     PAGED_CODE ();
 
-    NT_ASSERT(DeviceExtension->ScratchContext.ScratchInUse == 0);
+    NT_ASSERT(ScratchContext->ScratchInUse == 0);
 
-    if (DeviceExtension->ScratchContext.ScratchHistory != NULL)
+    if (ScratchContext->ScratchHistory != NULL)
     {
-        ExFreePool(DeviceExtension->ScratchContext.ScratchHistory);
-        DeviceExtension->ScratchContext.ScratchHistory = NULL;
+        ExFreePool(ScratchContext->ScratchHistory);
+        ScratchContext->ScratchHistory = NULL;
     }
-    if (DeviceExtension->ScratchContext.ScratchSense != NULL)
+    if (ScratchContext->ScratchSense != NULL)
     {
-        ExFreePool(DeviceExtension->ScratchContext.ScratchSense);
-        DeviceExtension->ScratchContext.ScratchSense = NULL;
+        ExFreePool(ScratchContext->ScratchSense);
+        ScratchContext->ScratchSense = NULL;
     }
-    if (DeviceExtension->ScratchContext.ScratchSrb != NULL)
+    if (ScratchContext->ScratchSrb != NULL)
     {
-        ExFreePool(DeviceExtension->ScratchContext.ScratchSrb);
-        DeviceExtension->ScratchContext.ScratchSrb = NULL;
+        ExFreePool(ScratchContext->ScratchSrb);
+        ScratchContext->ScratchSrb = NULL;
     }
-    if (DeviceExtension->ScratchContext.ScratchBufferSize != 0)
+    if (ScratchContext->ScratchBufferSize != 0)
     {
-        DeviceExtension->ScratchContext.ScratchBufferSize = 0;
+        ScratchContext->ScratchBufferSize = 0;
     }
-    if (DeviceExtension->ScratchContext.ScratchBufferMdl != NULL)
+    if (ScratchContext->ScratchBufferMdl != NULL)
     {
-        IoFreeMdl(DeviceExtension->ScratchContext.ScratchBufferMdl);
-        DeviceExtension->ScratchContext.ScratchBufferMdl = NULL;
+        IoFreeMdl(ScratchContext->ScratchBufferMdl);
+        ScratchContext->ScratchBufferMdl = NULL;
     }
-    if (DeviceExtension->ScratchContext.ScratchBuffer != NULL)
+    if (ScratchContext->ScratchBuffer != NULL)
     {
-        ExFreePool(DeviceExtension->ScratchContext.ScratchBuffer);
-        DeviceExtension->ScratchContext.ScratchBuffer = NULL;
+        ExFreePool(ScratchContext->ScratchBuffer);
+        ScratchContext->ScratchBuffer = NULL;
     }
 
-    if (DeviceExtension->ScratchContext.PartialMdl != NULL)
+    if (ScratchContext->PartialMdl != NULL)
     {
-        IoFreeMdl(DeviceExtension->ScratchContext.PartialMdl);
-        DeviceExtension->ScratchContext.PartialMdl = NULL;
+        IoFreeMdl(ScratchContext->PartialMdl);
+        ScratchContext->PartialMdl = NULL;
     }
 
-    if (DeviceExtension->ScratchContext.ScratchRequest != NULL)
+    if (ScratchContext->ScratchRequest != NULL)
     {
-        PIRP irp = WdfRequestWdmGetIrp(DeviceExtension->ScratchContext.ScratchRequest);
+        PIRP irp = WdfRequestWdmGetIrp(ScratchContext->ScratchRequest);
         if (irp->MdlAddress)
         {
             irp->MdlAddress = NULL;
         }
-        WdfObjectDelete(DeviceExtension->ScratchContext.ScratchRequest);
-        DeviceExtension->ScratchContext.ScratchRequest = NULL;
+        WdfObjectDelete(ScratchContext->ScratchRequest);
+        ScratchContext->ScratchRequest = NULL;
     }
 
     return;
 }
 
 _IRQL_requires_max_(APC_LEVEL)
-BOOLEAN
-ScratchBuffer_Allocate(
+VOID
+ScratchBuffer_Deallocate(
     _Inout_ PCDROM_DEVICE_EXTENSION DeviceExtension
     )
 /*++
 
 Routine Description:
 
-    allocate resources allocated for scratch.
+    release all resources allocated for scratch, including the
+    concurrent read contexts.
 
 Arguments:
 
@@ -143,80 +160,108 @@ Return Value:
 
 --*/
 {
-    NTSTATUS status = STATUS_SUCCESS;
+    ULONG i;
 
     PAGED_CODE ();
 
-    NT_ASSERT(DeviceExtension->ScratchContext.ScratchInUse == 0);
+    DeviceExtension->ConcurrentReadsSupported = FALSE;
 
-    // quick-exit if already allocated
-    if ((DeviceExtension->ScratchContext.ScratchBuffer     != NULL) &&
-        (DeviceExtension->ScratchContext.ScratchBufferMdl  != NULL) &&
-        (DeviceExtension->ScratchContext.ScratchBufferSize != 0)    &&
-        (DeviceExtension->ScratchContext.ScratchRequest    != NULL) &&
-        (DeviceExtension->ScratchContext.ScratchSrb        != NULL) &&
-        (DeviceExtension->ScratchContext.ScratchHistory    != NULL) &&
-        (DeviceExtension->ScratchContext.PartialMdl  != NULL)
-        )
+    for (i = 0; i < CDROM_CONCURRENT_READ_CONTEXTS; i++)
     {
-        return TRUE;
+        ScratchBuffer_DeallocateContext(&DeviceExtension->ConcurrentScratchContexts[i]);
     }
 
-    // validate max transfer already determined
-    NT_ASSERT(DeviceExtension->DeviceAdditionalData.MaxPageAlignedTransferBytes != 0);
+    ScratchBuffer_DeallocateContext(&DeviceExtension->ScratchContext);
+
+    return;
+}
+
+_IRQL_requires_max_(APC_LEVEL)
+NTSTATUS
+ScratchBuffer_AllocateContext(
+    _In_    PCDROM_DEVICE_EXTENSION DeviceExtension,
+    _Inout_ PCDROM_SCRATCH_CONTEXT  ScratchContext,
+    _In_    BOOLEAN                 AllocateBuffer
+    )
+/*++
+
+Routine Description:
+
+    allocate resources for one scratch context.
+
+Arguments:
+
+    DeviceExtension - device extension
+    ScratchContext - scratch context to be allocated
+    AllocateBuffer - TRUE to also allocate the data buffer. Contexts that are
+                     only used for reads transfer straight into the caller's MDL
+                     and do not need one.
+
+Return Value:
+
+    NTSTATUS
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    PAGED_CODE ();
 
     // validate no partially-saved state
-    NT_ASSERT(DeviceExtension->ScratchContext.ScratchBuffer     == NULL);
-    NT_ASSERT(DeviceExtension->ScratchContext.ScratchBufferMdl  == NULL);
-    NT_ASSERT(DeviceExtension->ScratchContext.ScratchBufferSize == 0);
-    NT_ASSERT(DeviceExtension->ScratchContext.ScratchRequest    == NULL);
-    NT_ASSERT(DeviceExtension->ScratchContext.PartialMdl == NULL);
+    NT_ASSERT(ScratchContext->ScratchBuffer     == NULL);
+    NT_ASSERT(ScratchContext->ScratchBufferMdl  == NULL);
+    NT_ASSERT(ScratchContext->ScratchBufferSize == 0);
+    NT_ASSERT(ScratchContext->ScratchRequest    == NULL);
+    NT_ASSERT(ScratchContext->PartialMdl == NULL);
 
     // limit the scratch buffer to between 4k and 64k (so data length fits into USHORT -- req'd for many commands)
-    DeviceExtension->ScratchContext.ScratchBufferSize = min(DeviceExtension->DeviceAdditionalData.MaxPageAlignedTransferBytes, (64*1024));
+    if (AllocateBuffer)
+    {
+        ScratchContext->ScratchBufferSize = min(DeviceExtension->DeviceAdditionalData.MaxPageAlignedTransferBytes, (64*1024));
+    }
 
     // allocate the buffer
-    if (NT_SUCCESS(status))
+    if (NT_SUCCESS(status) && AllocateBuffer)
     {
-        DeviceExtension->ScratchContext.ScratchBuffer = ExAllocatePoolWithTag(NonPagedPoolNx,
-                                                                              DeviceExtension->ScratchContext.ScratchBufferSize,
-                                                                              CDROM_TAG_SCRATCH);
-        if (DeviceExtension->ScratchContext.ScratchBuffer == NULL)
+        ScratchContext->ScratchBuffer = ExAllocatePoolWithTag(NonPagedPoolNx,
+                                                              ScratchContext->ScratchBufferSize,
+                                                              CDROM_TAG_SCRATCH);
+        if (ScratchContext->ScratchBuffer == NULL)
         {
             status = STATUS_INSUFFICIENT_RESOURCES;
             TracePrint((TRACE_LEVEL_WARNING, TRACE_FLAG_INIT,
                         "Failed to allocate scratch buffer of %x bytes\n",
-                        DeviceExtension->ScratchContext.ScratchBufferSize
+                        ScratchContext->ScratchBufferSize
                         ));
         }
-        else if (BYTE_OFFSET(DeviceExtension->ScratchContext.ScratchBuffer) != 0)
+        else if (BYTE_OFFSET(ScratchContext->ScratchBuffer) != 0)
         {
             status = STATUS_INTERNAL_ERROR;
             TracePrint((TRACE_LEVEL_FATAL, TRACE_FLAG_INIT,
                         "Allocation of %x bytes non-paged pool was not "
                         "allocated on page boundary?  STATUS_INTERNAL_ERROR\n",
-                        DeviceExtension->ScratchContext.ScratchBufferSize
+                        ScratchContext->ScratchBufferSize
                         ));
         }
     }
 
     // allocate the MDL
-    if (NT_SUCCESS(status))
+    if (NT_SUCCESS(status) && AllocateBuffer)
     {
-        DeviceExtension->ScratchContext.ScratchBufferMdl = IoAllocateMdl(DeviceExtension->ScratchContext.ScratchBuffer,
-                                                                         DeviceExtension->ScratchContext.ScratchBufferSize,
-                                                                         FALSE, FALSE, NULL);
-        if (DeviceExtension->ScratchContext.ScratchBufferMdl == NULL)
+        ScratchContext->ScratchBufferMdl = IoAllocateMdl(ScratchContext->ScratchBuffer,
+                                                         ScratchContext->ScratchBufferSize,
+                                                         FALSE, FALSE, NULL);
+        if (ScratchContext->ScratchBufferMdl == NULL)
         {
             status = STATUS_INSUFFICIENT_RESOURCES;
             TracePrint((TRACE_LEVEL_WARNING, TRACE_FLAG_INIT,
                         "Failed to allocate MDL for %x byte buffer\n",
-                        DeviceExtension->ScratchContext.ScratchBufferSize
+                        ScratchContext->ScratchBufferSize
                         ));
         }
         else
         {
-            MmBuildMdlForNonPagedPool(DeviceExtension->ScratchContext.ScratchBufferMdl);
+            MmBuildMdlForNonPagedPool(ScratchContext->ScratchBufferMdl);
         }
     }
 
@@ -229,10 +274,10 @@ Return Value:
 
         status =  WdfRequestCreate(&attributes,
                                    DeviceExtension->IoTarget,
-                                   &DeviceExtension->ScratchContext.ScratchRequest);
+                                   &ScratchContext->ScratchRequest);
 
         if ((!NT_SUCCESS(status)) ||
-            (DeviceExtension->ScratchContext.ScratchRequest == NULL))
+            (ScratchContext->ScratchRequest == NULL))
         {
             status = STATUS_INSUFFICIENT_RESOURCES;
             TracePrint((TRACE_LEVEL_WARNING, TRACE_FLAG_INIT,
@@ -243,11 +288,11 @@ Return Value:
     // allocate the srb
     if (NT_SUCCESS(status))
     {
-        DeviceExtension->ScratchContext.ScratchSrb = ExAllocatePoolWithTag(NonPagedPoolNx,
-                                                                           sizeof(SCSI_REQUEST_BLOCK),
-                                                                           CDROM_TAG_SCRATCH);
+        ScratchContext->ScratchSrb = ExAllocatePoolWithTag(NonPagedPoolNx,
+                                                           sizeof(SCSI_REQUEST_BLOCK),
+                                                           CDROM_TAG_SCRATCH);
 
-        if (DeviceExtension->ScratchContext.ScratchSrb == NULL)
+        if (ScratchContext->ScratchSrb == NULL)
         {
             status = STATUS_INSUFFICIENT_RESOURCES;
             TracePrint((TRACE_LEVEL_WARNING, TRACE_FLAG_INIT,
@@ -258,11 +303,11 @@ Return Value:
     // allocate the sense buffer
     if (NT_SUCCESS(status))
     {
-        DeviceExtension->ScratchContext.ScratchSense = ExAllocatePoolWithTag(NonPagedPoolNx,
-                                                                             sizeof(SENSE_DATA),
-                                                                             CDROM_TAG_SCRATCH);
+        ScratchContext->ScratchSense = ExAllocatePoolWithTag(NonPagedPoolNx,
+                                                             sizeof(SENSE_DATA),
+                                                             CDROM_TAG_SCRATCH);
 
-        if (DeviceExtension->ScratchContext.ScratchSense == NULL)
+        if (ScratchContext->ScratchSense == NULL)
         {
             status = STATUS_INSUFFICIENT_RESOURCES;
             TracePrint((TRACE_LEVEL_WARNING, TRACE_FLAG_INIT,
@@ -277,10 +322,10 @@ Return Value:
         size_t allocationSize = sizeof(SRB_HISTORY) - sizeof(SRB_HISTORY_ITEM);
         allocationSize += 20 * sizeof(SRB_HISTORY_ITEM);
 
-        DeviceExtension->ScratchContext.ScratchHistory = ExAllocatePoolWithTag(NonPagedPoolNx,
-                                                                               allocationSize,
-                                                                               CDROM_TAG_SCRATCH);
-        if (DeviceExtension->ScratchContext.ScratchHistory == NULL)
+        ScratchContext->ScratchHistory = ExAllocatePoolWithTag(NonPagedPoolNx,
+                                                               allocationSize,
+                                                               CDROM_TAG_SCRATCH);
+        if (ScratchContext->ScratchHistory == NULL)
         {
             status = STATUS_INSUFFICIENT_RESOURCES;
             TracePrint((TRACE_LEVEL_WARNING, TRACE_FLAG_INIT,
@@ -290,8 +335,8 @@ Return Value:
         else
         {
             // must be initialized here...
-            RtlZeroMemory(DeviceExtension->ScratchContext.ScratchHistory, allocationSize);
-            DeviceExtension->ScratchContext.ScratchHistory->TotalHistoryCount = 20;
+            RtlZeroMemory(ScratchContext->ScratchHistory, allocationSize);
+            ScratchContext->ScratchHistory->TotalHistoryCount = 20;
         }
     }
 
@@ -303,22 +348,22 @@ Return Value:
         status = RtlULongAdd(DeviceExtension->DeviceAdditionalData.MaxPageAlignedTransferBytes, PAGE_SIZE, &transferLength);
         if (NT_SUCCESS(status))
         {
-            DeviceExtension->ScratchContext.PartialMdl = IoAllocateMdl(NULL,
-                                                                       transferLength,
-                                                                       FALSE,
-                                                                       FALSE,
-                                                                       NULL);
-            if (DeviceExtension->ScratchContext.PartialMdl == NULL)
+            ScratchContext->PartialMdl = IoAllocateMdl(NULL,
+                                                       transferLength,
+                                                       FALSE,
+                                                       FALSE,
+                                                       NULL);
+            if (ScratchContext->PartialMdl == NULL)
             {
                 status = STATUS_INSUFFICIENT_RESOURCES;
                 TracePrint((TRACE_LEVEL_WARNING, TRACE_FLAG_INIT,
                             "Failed to allocate MDL for %x byte buffer\n",
-                            DeviceExtension->ScratchContext.ScratchBufferSize
+                            ScratchContext->ScratchBufferSize
                             ));
             }
             else 
             {
-                NT_ASSERT(DeviceExtension->ScratchContext.PartialMdl->Size >= 
+                NT_ASSERT(ScratchContext->PartialMdl->Size >= 
                        (CSHORT)(sizeof(MDL) + BYTES_TO_PAGES(DeviceExtension->DeviceAdditionalData.MaxPageAlignedTransferBytes) * sizeof(PFN_NUMBER)));
             }
         }
@@ -331,7 +376,90 @@ Return Value:
     // cleanup on failure
     if (!NT_SUCCESS(status))
     {
-        ScratchBuffer_Deallocate(DeviceExtension);
+        ScratchBuffer_DeallocateContext(ScratchContext);
+    }
+
+    return status;
+}
+
+_IRQL_requires_max_(APC_LEVEL)
+BOOLEAN
+ScratchBuffer_Allocate(
+    _Inout_ PCDROM_DEVICE_EXTENSION DeviceExtension
+    )
+/*++
+
+Routine Description:
+
+    allocate resources allocated for scratch.
+
+Arguments:
+
+    DeviceExtension - device extension
+
+Return Value:
+
+    none
+
+--*/
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    PAGED_CODE ();
+
+    NT_ASSERT(DeviceExtension->ScratchContext.ScratchInUse == 0);
+
+    // quick-exit if already allocated
+    if ((DeviceExtension->ScratchContext.ScratchBuffer     != NULL) &&
+        (DeviceExtension->ScratchContext.ScratchBufferMdl  != NULL) &&
+        (DeviceExtension->ScratchContext.ScratchBufferSize != 0)    &&
+        (DeviceExtension->ScratchContext.ScratchRequest    != NULL) &&
+        (DeviceExtension->ScratchContext.ScratchSrb        != NULL) &&
+        (DeviceExtension->ScratchContext.ScratchHistory    != NULL) &&
+        (DeviceExtension->ScratchContext.PartialMdl  != NULL)
+        )
+    {
+        return TRUE;
+    }
+
+    // validate max transfer already determined
+    NT_ASSERT(DeviceExtension->DeviceAdditionalData.MaxPageAlignedTransferBytes != 0);
+
+    status = ScratchBuffer_AllocateContext(DeviceExtension, &DeviceExtension->ScratchContext, TRUE);
+
+    // Reads may run concurrently on additional contexts when both the device and
+    // the adapter report command queuing. These contexts are optional: if they
+    // cannot be allocated, reads stay on the serial queue.
+    if (NT_SUCCESS(status) &&
+        DeviceExtension->DeviceDescriptor->CommandQueueing &&
+        DeviceExtension->AdapterDescriptor->CommandQueueing)
+    {
+        NTSTATUS    contextStatus = STATUS_SUCCESS;
+        ULONG       i;
+
+        for (i = 0; (i < CDROM_CONCURRENT_READ_CONTEXTS) && NT_SUCCESS(contextStatus); i++)
+        {
+            contextStatus = ScratchBuffer_AllocateContext(DeviceExtension,
+                                                          &DeviceExtension->ConcurrentScratchContexts[i],
+                                                          FALSE);
+        }
+
+        if (NT_SUCCESS(contextStatus))
+        {
+            DeviceExtension->ConcurrentScratchBusyMask = 0;
+            DeviceExtension->ConcurrentReadsSupported = TRUE;
+        }
+        else
+        {
+            TracePrint((TRACE_LEVEL_WARNING, TRACE_FLAG_INIT,
+                        "Failed to allocate concurrent read contexts, reads will be serialized\n"
+                        ));
+
+            for (i = 0; i < CDROM_CONCURRENT_READ_CONTEXTS; i++)
+            {
+                ScratchBuffer_DeallocateContext(&DeviceExtension->ConcurrentScratchContexts[i]);
+            }
+        }
     }
 
     return NT_SUCCESS(status);
@@ -339,8 +467,9 @@ Return Value:
 
 
 VOID
-ScratchBuffer_ResetItems(
+ScratchBuffer_ResetContextItems(
     _Inout_ PCDROM_DEVICE_EXTENSION DeviceExtension,
+    _Inout_ PCDROM_SCRATCH_CONTEXT  ScratchContext,
     _In_ BOOLEAN                    ResetRequestHistory
     )
 /*++
@@ -352,6 +481,7 @@ Routine Description:
 Arguments:
 
     DeviceExtension - device extension
+    ScratchContext - scratch context to be reset
     ResetRequestHistory - reset history fields or not
 
 Return Value:
@@ -364,20 +494,21 @@ Return Value:
     WDF_REQUEST_REUSE_PARAMS reuseParams;
     PIRP                     irp = NULL;
 
-    NT_ASSERT(DeviceExtension->ScratchContext.ScratchHistory    != NULL);
-    NT_ASSERT(DeviceExtension->ScratchContext.ScratchSense      != NULL);
-    NT_ASSERT(DeviceExtension->ScratchContext.ScratchSrb        != NULL);
-    NT_ASSERT(DeviceExtension->ScratchContext.ScratchRequest    != NULL);
-    NT_ASSERT(DeviceExtension->ScratchContext.ScratchBufferSize != 0);
-    NT_ASSERT(DeviceExtension->ScratchContext.ScratchBuffer     != NULL);
-    NT_ASSERT(DeviceExtension->ScratchContext.ScratchBufferMdl  != NULL);
-    NT_ASSERT(DeviceExtension->ScratchContext.ScratchInUse      != 0);
+    NT_ASSERT(ScratchContext->ScratchHistory    != NULL);
+    NT_ASSERT(ScratchContext->ScratchSense      != NULL);
+    NT_ASSERT(ScratchContext->ScratchSrb        != NULL);
+    NT_ASSERT(ScratchContext->ScratchRequest    != NULL);
+    // only the serial scratch context owns a data buffer
+    NT_ASSERT((ScratchContext->ScratchBufferSize != 0) || (ScratchContext != &DeviceExtension->ScratchContext));
+    NT_ASSERT((ScratchContext->ScratchBuffer     != NULL) || (ScratchContext != &DeviceExtension->ScratchContext));
+    NT_ASSERT((ScratchContext->ScratchBufferMdl  != NULL) || (ScratchContext != &DeviceExtension->ScratchContext));
+    NT_ASSERT(ScratchContext->ScratchInUse      != 0);
 
-    irp = WdfRequestWdmGetIrp(DeviceExtension->ScratchContext.ScratchRequest);
+    irp = WdfRequestWdmGetIrp(ScratchContext->ScratchRequest);
 
     if (ResetRequestHistory)
     {
-        PSRB_HISTORY history = DeviceExtension->ScratchContext.ScratchHistory;
+        PSRB_HISTORY history = ScratchContext->ScratchHistory;
         RtlZeroMemory(history->History, sizeof(SRB_HISTORY_ITEM) * history->TotalHistoryCount);
         history->ClassDriverUse[0] = 0;
         history->ClassDriverUse[1] = 0;
@@ -396,15 +527,15 @@ Return Value:
     }
 
     WDF_REQUEST_REUSE_PARAMS_INIT(&reuseParams, WDF_REQUEST_REUSE_NO_FLAGS, STATUS_NOT_SUPPORTED);
-    status = WdfRequestReuse(DeviceExtension->ScratchContext.ScratchRequest, &reuseParams);
+    status = WdfRequestReuse(ScratchContext->ScratchRequest, &reuseParams);
     // WDF request to format the request befor sending it
     if (NT_SUCCESS(status))
     {
         // clean up completion routine.
-        WdfRequestSetCompletionRoutine(DeviceExtension->ScratchContext.ScratchRequest, NULL, NULL);
+        WdfRequestSetCompletionRoutine(ScratchContext->ScratchRequest, NULL, NULL);
 
         status = WdfIoTargetFormatRequestForInternalIoctlOthers(DeviceExtension->IoTarget, 
-                                                                DeviceExtension->ScratchContext.ScratchRequest,
+                                                                ScratchContext->ScratchRequest,
                                                                 IOCTL_SCSI_EXECUTE_IN,
                                                                 NULL, NULL,
                                                                 NULL, NULL,
@@ -412,13 +543,13 @@ Return Value:
         if (!NT_SUCCESS(status))
         {
             TracePrint((TRACE_LEVEL_ERROR, TRACE_FLAG_GENERAL,  
-                       "ScratchBuffer_ResetItems: WdfIoTargetFormatRequestForInternalIoctlOthers failed, %!STATUS!\n",
+                       "ScratchBuffer_ResetContextItems: WdfIoTargetFormatRequestForInternalIoctlOthers failed, %!STATUS!\n",
                        status));
         }
     }
 
-    RtlZeroMemory(DeviceExtension->ScratchContext.ScratchSense, sizeof(SENSE_DATA));
-    RtlZeroMemory(DeviceExtension->ScratchContext.ScratchSrb, sizeof(SCSI_REQUEST_BLOCK));
+    RtlZeroMemory(ScratchContext->ScratchSense, sizeof(SENSE_DATA));
+    RtlZeroMemory(ScratchContext->ScratchSrb, sizeof(SCSI_REQUEST_BLOCK));
     
     return;
 }
@@ -427,6 +558,7 @@ Return Value:
 NTSTATUS
 ScratchBuffer_PerformNextReadWrite(
     _In_ PCDROM_DEVICE_EXTENSION  DeviceExtension,
+    _In_ PCDROM_SCRATCH_CONTEXT   ScratchContext,
     _In_ BOOLEAN                  FirstTry
     )
 /*++
@@ -438,6 +570,8 @@ Routine Description:
 Arguments:
 
     DeviceExtension - Device extension
+    ScratchContext - scratch context that owns the read/write
+    FirstTry - TRUE if this is not a retry
 
 Return Value:
 
@@ -445,8 +579,8 @@ Return Value:
 
 --*/
 {
-    PCDROM_SCRATCH_READ_WRITE_CONTEXT   readWriteContext = &DeviceExtension->ScratchContext.ScratchReadWriteContext;
-    PCDROM_REQUEST_CONTEXT              requestContext = RequestGetContext(DeviceExtension->ScratchContext.ScratchRequest);
+    PCDROM_SCRATCH_READ_WRITE_CONTEXT   readWriteContext = &ScratchContext->ScratchReadWriteContext;
+    PCDROM_REQUEST_CONTEXT              requestContext = RequestGetContext(ScratchContext->ScratchRequest);
     WDFREQUEST                          originalRequest = requestContext->OriginalRequest;
     NTSTATUS                            status = STATUS_SUCCESS;
 
@@ -457,14 +591,15 @@ Return Value:
 
     if (FirstTry)
     {
-        DeviceExtension->ScratchContext.NumRetries = 0;
+        ScratchContext->NumRetries = 0;
     }
 
-    ScratchBuffer_ResetItems(DeviceExtension, FALSE);
+    ScratchBuffer_ResetContextItems(DeviceExtension, ScratchContext, FALSE);
 
     usePartialMdl = (readWriteContext->PacketsCount > 1 || readWriteContext->TransferedBytes > 0);
 
     ScratchBuffer_SetupReadWriteSrb(DeviceExtension,
+                                    ScratchContext,
                                     originalRequest,
                                     readWriteContext->StartingOffset,
                                     transferSize,
@@ -473,15 +608,112 @@ Return Value:
                                     usePartialMdl
                                     );
 
-    WdfRequestSetCompletionRoutine(DeviceExtension->ScratchContext.ScratchRequest,
-            ScratchBuffer_ReadWriteCompletionRoutine, DeviceExtension);
+    WdfRequestSetCompletionRoutine(ScratchContext->ScratchRequest,
+            ScratchBuffer_ReadWriteCompletionRoutine, ScratchContext);
 
-    status = ScratchBuffer_SendSrb(DeviceExtension, FALSE, (FirstTry ? &readWriteContext->SrbHistoryItem : NULL));
+    status = ScratchBuffer_SendContextSrb(DeviceExtension, ScratchContext, FALSE, (FirstTry ? &readWriteContext->SrbHistoryItem : NULL));
 
     return status;
 }
 
 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+PCDROM_SCRATCH_CONTEXT
+ScratchBuffer_AcquireConcurrentContext(
+    _In_ PCDROM_DEVICE_EXTENSION  DeviceExtension
+    )
+/*++
+
+Routine Description:
+
+    Take a free concurrent read context and begin using it. The concurrent read
+    queue never presents more requests than there are contexts, so one is
+    normally always free.
+
+Arguments:
+
+    DeviceExtension - Device extension
+
+Return Value:
+
+    the scratch context, or NULL if none is free or concurrent reads are not supported
+
+--*/
+{
+    ULONG i;
+
+    if (!DeviceExtension->ConcurrentReadsSupported)
+    {
+        return NULL;
+    }
+
+    for (i = 0; i < CDROM_CONCURRENT_READ_CONTEXTS; i++)
+    {
+        if (!InterlockedBitTestAndSet(&DeviceExtension->ConcurrentScratchBusyMask, i))
+        {
+            PCDROM_SCRATCH_CONTEXT scratchContext = &DeviceExtension->ConcurrentScratchContexts[i];
+
+            ScratchBuffer_BeginContextUse(DeviceExtension, scratchContext);
+
+            return scratchContext;
+        }
+    }
+
+    return NULL;
+}
+
+
+VOID
+ScratchBuffer_CompleteReadWrite(
+    _In_ PCDROM_DEVICE_EXTENSION  DeviceExtension,
+    _In_ PCDROM_SCRATCH_CONTEXT   ScratchContext,
+    _In_ WDFREQUEST               OriginalRequest,
+    _In_ NTSTATUS                 Status
+    )
+/*++
+
+Routine Description:
+
+    Release the scratch context of a read/write and complete the original request.
+    A concurrent read context is returned to the pool before the request is
+    completed, so that the concurrent read queue can present the next read.
+
+Arguments:
+
+    DeviceExtension - Device extension
+    ScratchContext - scratch context that owns the read/write
+    OriginalRequest - the read/write request
+    Status - completion status
+
+Return Value:
+
+    none
+
+--*/
+{
+    ULONG transferedBytes = ScratchContext->ScratchReadWriteContext.TransferedBytes;
+
+    ScratchBuffer_EndContextUse(ScratchContext);
+
+    if (ScratchContext == &DeviceExtension->ScratchContext)
+    {
+        RequestCompletion(DeviceExtension, OriginalRequest, Status, transferedBytes);
+    }
+    else
+    {
+        LONG index = (LONG)(ScratchContext - DeviceExtension->ConcurrentScratchContexts);
+
+        NT_ASSERT((index >= 0) && (index < CDROM_CONCURRENT_READ_CONTEXTS));
+
+        InterlockedBitTestAndReset(&DeviceExtension->ConcurrentScratchBusyMask, index);
+
+        RequestCompletion(DeviceExtension, OriginalRequest, Status, transferedBytes);
+
+        DeviceConcurrentReadCompleted(DeviceExtension);
+    }
+}
+
+
 VOID
 ScratchBuffer_ReadWriteTimerRoutine(
     struct _KDPC *Dpc,
@@ -506,7 +738,7 @@ Return Value:
 --*/
 {
     PCDROM_DEVICE_EXTENSION             deviceExtension = NULL;
-    PCDROM_SCRATCH_READ_WRITE_CONTEXT   readWriteContext = NULL;
+    PCDROM_SCRATCH_CONTEXT              scratchContext = NULL;
     WDFREQUEST                          originalRequest = NULL;
     PCDROM_REQUEST_CONTEXT              requestContext = NULL;
     NTSTATUS                            status = STATUS_SUCCESS;
@@ -544,15 +776,14 @@ Return Value:
     if (status != STATUS_CANCELLED)
     {
         deviceExtension = requestContext->DeviceExtension;
-        readWriteContext = &deviceExtension->ScratchContext.ScratchReadWriteContext;
+        scratchContext = requestContext->ReadWriteScratchContext;
 
-        // We use timer only for retries, that's why the second parameter is always FALSE
-        status = ScratchBuffer_PerformNextReadWrite(deviceExtension, FALSE);
+        // We use timer only for retries, that's why the last parameter is always FALSE
+        status = ScratchBuffer_PerformNextReadWrite(deviceExtension, scratchContext, FALSE);
 
         if (!NT_SUCCESS(status))
         {
-            ScratchBuffer_EndUse(deviceExtension);
-            RequestCompletion(deviceExtension, originalRequest, status, readWriteContext->TransferedBytes);
+            ScratchBuffer_CompleteReadWrite(deviceExtension, scratchContext, originalRequest, status);
         }
     }
 
@@ -588,7 +819,7 @@ Return Value:
 {
     PCDROM_REQUEST_CONTEXT             requestContext = RequestGetContext(Request);
     PCDROM_DEVICE_EXTENSION            deviceExtension = requestContext->DeviceExtension;
-    PCDROM_SCRATCH_READ_WRITE_CONTEXT  readWriteContext = &deviceExtension->ScratchContext.ScratchReadWriteContext;
+    PCDROM_SCRATCH_CONTEXT             scratchContext = requestContext->ReadWriteScratchContext;
     KIRQL                              oldIrql;
 
     KeAcquireSpinLock(&requestContext->ReadWriteCancelSpinLock, &oldIrql);
@@ -613,11 +844,9 @@ Return Value:
 
     KeReleaseSpinLock(&requestContext->ReadWriteCancelSpinLock, oldIrql);
 
-    ScratchBuffer_EndUse(deviceExtension);
-
     // If WdfTimerStop returned TRUE, it means this request was scheduled for a retry
     // and the retry has not happened yet. We just need to cancel it and release the scratch buffer.
-    RequestCompletion(deviceExtension, Request, STATUS_CANCELLED, readWriteContext->TransferedBytes);
+    ScratchBuffer_CompleteReadWrite(deviceExtension, scratchContext, Request, STATUS_CANCELLED);
 }
 
 VOID
@@ -637,7 +866,7 @@ Arguments:
     Request - WDF request
     Target - The IO target the request was completed by.
     Params - the request completion parameters
-    Context - context
+    Context - the scratch context that owns the read/write
 
 Return Value:
 
@@ -645,10 +874,11 @@ Return Value:
 
 --*/
 {
-    PCDROM_DEVICE_EXTENSION             deviceExtension = (PCDROM_DEVICE_EXTENSION) Context;
-    PCDROM_SCRATCH_READ_WRITE_CONTEXT   readWriteContext = &deviceExtension->ScratchContext.ScratchReadWriteContext;
+    PCDROM_SCRATCH_CONTEXT              scratchContext = (PCDROM_SCRATCH_CONTEXT) Context;
+    PCDROM_SCRATCH_READ_WRITE_CONTEXT   readWriteContext = &scratchContext->ScratchReadWriteContext;
     NTSTATUS                            status = STATUS_SUCCESS;
-    PCDROM_REQUEST_CONTEXT              requestContext = RequestGetContext(deviceExtension->ScratchContext.ScratchRequest);
+    PCDROM_REQUEST_CONTEXT              requestContext = RequestGetContext(scratchContext->ScratchRequest);
+    PCDROM_DEVICE_EXTENSION             deviceExtension = requestContext->DeviceExtension;
     WDFREQUEST                          originalRequest = requestContext->OriginalRequest;
 
     if (!NT_SUCCESS(WdfRequestGetStatus(Request)))
@@ -665,31 +895,33 @@ Return Value:
     // We are not calling ScratchBuffer_BeginUse / ScratchBuffer_EndUse in this function, because we already own
     // the scratch buffer if this function is being called.
 
-    if ((deviceExtension->ScratchContext.ScratchSrb->SrbStatus == SRB_STATUS_ABORTED) &&
-        (deviceExtension->ScratchContext.ScratchSrb->InternalStatus == STATUS_CANCELLED))
+    if ((scratchContext->ScratchSrb->SrbStatus == SRB_STATUS_ABORTED) &&
+        (scratchContext->ScratchSrb->InternalStatus == STATUS_CANCELLED))
     {
         // The request has been cancelled, just need to complete it
     }
-    else if (SRB_STATUS(deviceExtension->ScratchContext.ScratchSrb->SrbStatus) != SRB_STATUS_SUCCESS)
+    else if (SRB_STATUS(scratchContext->ScratchSrb->SrbStatus) != SRB_STATUS_SUCCESS)
     {
         // The SCSI command that we sent down has failed, retry it if necessary
         BOOLEAN shouldRetry = TRUE;
         LONGLONG retryIn100nsUnits = 0;
 
-        shouldRetry = RequestSenseInfoInterpretForScratchBuffer(deviceExtension,
-                                                                deviceExtension->ScratchContext.NumRetries,
-                                                                &status,
-                                                                &retryIn100nsUnits);
+        shouldRetry = RequestSenseInfoInterpret(deviceExtension,
+                                                scratchContext->ScratchRequest,
+                                                scratchContext->ScratchSrb,
+                                                scratchContext->NumRetries,
+                                                &status,
+                                                &retryIn100nsUnits);
 
         if (shouldRetry)
         {
-            deviceExtension->ScratchContext.NumRetries++;
+            scratchContext->NumRetries++;
 
             if (retryIn100nsUnits == 0)
             {
                 // We take a shortcut here by calling ScratchBuffer_PerformNextReadWrite directly:
                 // this helps to avoid unnecessary context switch.
-                status = ScratchBuffer_PerformNextReadWrite(deviceExtension, FALSE);
+                status = ScratchBuffer_PerformNextReadWrite(deviceExtension, scratchContext, FALSE);
 
                 if (NT_SUCCESS(status))
                 {
@@ -747,9 +979,9 @@ Return Value:
     else
     {
         // The SCSI command has succeeded
-        readWriteContext->DataBuffer += deviceExtension->ScratchContext.ScratchSrb->DataTransferLength;
-        readWriteContext->StartingOffset.QuadPart += deviceExtension->ScratchContext.ScratchSrb->DataTransferLength;
-        readWriteContext->TransferedBytes += deviceExtension->ScratchContext.ScratchSrb->DataTransferLength;
+        readWriteContext->DataBuffer += scratchContext->ScratchSrb->DataTransferLength;
+        readWriteContext->StartingOffset.QuadPart += scratchContext->ScratchSrb->DataTransferLength;
+        readWriteContext->TransferedBytes += scratchContext->ScratchSrb->DataTransferLength;
         readWriteContext->PacketsCount--;
 
         // Update the SRB history item
@@ -761,35 +993,35 @@ Return Value:
             KeQueryTickCount(&readWriteContext->SrbHistoryItem->TickCountCompleted);
         
             // Copy the SRB Status...
-            readWriteContext->SrbHistoryItem->SrbStatus = deviceExtension->ScratchContext.ScratchSrb->SrbStatus;
+            readWriteContext->SrbHistoryItem->SrbStatus = scratchContext->ScratchSrb->SrbStatus;
         
             // Determine the amount of valid sense data
-            if (deviceExtension->ScratchContext.ScratchSrb->SenseInfoBufferLength >=
+            if (scratchContext->ScratchSrb->SenseInfoBufferLength >=
                     RTL_SIZEOF_THROUGH_FIELD(SENSE_DATA, AdditionalSenseLength))
             {
-                PSENSE_DATA sense = (PSENSE_DATA)deviceExtension->ScratchContext.ScratchSrb->SenseInfoBuffer;
+                PSENSE_DATA sense = (PSENSE_DATA)scratchContext->ScratchSrb->SenseInfoBuffer;
                 senseSize = RTL_SIZEOF_THROUGH_FIELD(SENSE_DATA, AdditionalSenseLength) +
                             sense->AdditionalSenseLength;
                 senseSize = min(senseSize, sizeof(SENSE_DATA));
             }
             else
             {
-                senseSize = deviceExtension->ScratchContext.ScratchSrb->SenseInfoBufferLength;
+                senseSize = scratchContext->ScratchSrb->SenseInfoBufferLength;
             }
 
             // Normalize the sense data copy in the history
             RtlZeroMemory(&(readWriteContext->SrbHistoryItem->NormalizedSenseData), sizeof(SENSE_DATA));
             RtlCopyMemory(&(readWriteContext->SrbHistoryItem->NormalizedSenseData),
-                    deviceExtension->ScratchContext.ScratchSrb->SenseInfoBuffer, senseSize);
+                    scratchContext->ScratchSrb->SenseInfoBuffer, senseSize);
         }
 
         // Check whether we need to send more SCSI commands to complete the request
         if (readWriteContext->PacketsCount > 0)
         {
             // reuse the partial mdl
-            MmPrepareMdlForReuse(deviceExtension->ScratchContext.PartialMdl);
+            MmPrepareMdlForReuse(scratchContext->PartialMdl);
 
-            status = ScratchBuffer_PerformNextReadWrite(deviceExtension, TRUE);
+            status = ScratchBuffer_PerformNextReadWrite(deviceExtension, scratchContext, TRUE);
 
             if (NT_SUCCESS(status))
             {
@@ -799,10 +1031,7 @@ Return Value:
         }
     }
 
-    ScratchBuffer_EndUse(deviceExtension);
-
-
-    RequestCompletion(deviceExtension, originalRequest, status, readWriteContext->TransferedBytes);
+    ScratchBuffer_CompleteReadWrite(deviceExtension, scratchContext, originalRequest, status);
 }
 
 _IRQL_requires_max_(APC_LEVEL)
@@ -902,8 +1131,9 @@ Return Value:
 
 
 NTSTATUS
-ScratchBuffer_SendSrb(
+ScratchBuffer_SendContextSrb(
     _Inout_     PCDROM_DEVICE_EXTENSION DeviceExtension,
+    _Inout_     PCDROM_SCRATCH_CONTEXT  ScratchContext,
     _In_        BOOLEAN                 SynchronousSrb,
     _When_(SynchronousSrb, _Pre_null_)
     _When_(!SynchronousSrb, _In_opt_)
@@ -918,6 +1148,7 @@ Routine Description:
 Arguments:
 
     DeviceExtension - device extension
+    ScratchContext - scratch context whose SRB is sent
     SynchronousSrb - indicates whether the SRB needs to be sent synchronously or nor
     SrbHistoryItem - storage for SRB history item, if this is an asynchronous request
 
@@ -928,8 +1159,8 @@ Return Value:
 --*/
 {
     NTSTATUS                 status  = STATUS_SUCCESS;
-    PSCSI_REQUEST_BLOCK      srb = DeviceExtension->ScratchContext.ScratchSrb;
-    PSRB_HISTORY             history = DeviceExtension->ScratchContext.ScratchHistory;
+    PSCSI_REQUEST_BLOCK      srb = ScratchContext->ScratchSrb;
+    PSRB_HISTORY             history = ScratchContext->ScratchHistory;
     PSRB_HISTORY_ITEM        item = NULL;
     BOOLEAN                  requestCancelled = FALSE;
 
@@ -973,7 +1204,7 @@ Return Value:
 
     // get cancellation status;
     {
-        PCDROM_REQUEST_CONTEXT  requestContext = RequestGetContext(DeviceExtension->ScratchContext.ScratchRequest);
+        PCDROM_REQUEST_CONTEXT  requestContext = RequestGetContext(ScratchContext->ScratchRequest);
 
         if (requestContext->OriginalRequest != NULL)
         {
@@ -984,7 +1215,7 @@ Return Value:
     if (!requestCancelled)
     {
         status = RequestSend(DeviceExtension,
-                             DeviceExtension->ScratchContext.ScratchRequest,
+                             ScratchContext->ScratchRequest,
                              DeviceExtension->IoTarget,
                              SynchronousSrb ? WDF_REQUEST_SEND_OPTION_SYNCHRONOUS : 0,
                              NULL);
@@ -1020,8 +1251,8 @@ Return Value:
     }
     else
     {
-        DeviceExtension->ScratchContext.ScratchSrb->SrbStatus = SRB_STATUS_ABORTED;
-        DeviceExtension->ScratchContext.ScratchSrb->InternalStatus = (ULONG)STATUS_CANCELLED;
+        ScratchContext->ScratchSrb->SrbStatus = SRB_STATUS_ABORTED;
+        ScratchContext->ScratchSrb->InternalStatus = (ULONG)STATUS_CANCELLED;
         status = STATUS_CANCELLED;
     }
 
@@ -1212,6 +1443,7 @@ ValidateSrbHistoryDataPresumptions(
 VOID
 ScratchBuffer_SetupReadWriteSrb(
     _Inout_ PCDROM_DEVICE_EXTENSION     DeviceExtension,
+    _Inout_ PCDROM_SCRATCH_CONTEXT      ScratchContext,
     _In_    WDFREQUEST                  OriginalRequest,
     _In_    LARGE_INTEGER               StartingOffset,
     _In_    ULONG                       RequiredLength,
@@ -1228,6 +1460,7 @@ Routine Description:
 Arguments:
 
     DeviceExtension - device extension
+    ScratchContext - scratch context whose SRB is set up
     OriginalRequest - read/write request
     StartingOffset - read/write starting offset
     DataBuffer - buffer for read/write
@@ -1241,17 +1474,17 @@ Return Value:
 {
     //NOTE: R/W request not use the ScratchBuffer, instead, it uses the buffer associated with IRP.
 
-    PSCSI_REQUEST_BLOCK srb = DeviceExtension->ScratchContext.ScratchSrb;
+    PSCSI_REQUEST_BLOCK srb = ScratchContext->ScratchSrb;
     PCDB                cdb = (PCDB)srb->Cdb;
     LARGE_INTEGER       logicalBlockAddr;
     ULONG               numTransferBlocks;
 
     PIRP                originalIrp = WdfRequestWdmGetIrp(OriginalRequest);
 
-    PIRP                irp = WdfRequestWdmGetIrp(DeviceExtension->ScratchContext.ScratchRequest);
+    PIRP                irp = WdfRequestWdmGetIrp(ScratchContext->ScratchRequest);
     PIO_STACK_LOCATION  irpStack = NULL;
 
-    PCDROM_REQUEST_CONTEXT  requestContext = RequestGetContext(DeviceExtension->ScratchContext.ScratchRequest);
+    PCDROM_REQUEST_CONTEXT  requestContext = RequestGetContext(ScratchContext->ScratchRequest);
 
     requestContext->OriginalRequest = OriginalRequest;
 
@@ -1280,7 +1513,7 @@ Return Value:
     srb->ScsiStatus = 0;
     srb->NextSrb = NULL;
     srb->SenseInfoBufferLength = SENSE_BUFFER_SIZE;
-    srb->SenseInfoBuffer = DeviceExtension->ScratchContext.ScratchSense;
+    srb->SenseInfoBuffer = ScratchContext->ScratchSense;
 
     srb->DataBuffer = DataBuffer;
     srb->DataTransferLength = RequiredLength;
@@ -1357,8 +1590,8 @@ Return Value:
     } 
     else 
     {
-        IoBuildPartialMdl(originalIrp->MdlAddress, DeviceExtension->ScratchContext.PartialMdl, srb->DataBuffer, srb->DataTransferLength);
-        irp->MdlAddress = DeviceExtension->ScratchContext.PartialMdl;
+        IoBuildPartialMdl(originalIrp->MdlAddress, ScratchContext->PartialMdl, srb->DataBuffer, srb->DataTransferLength);
+        irp->MdlAddress = ScratchContext->PartialMdl;
     }
 
     //DBGLOGSENDPACKET(Pkt);
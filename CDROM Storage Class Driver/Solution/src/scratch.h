@@ -40,11 +40,22 @@ ScratchBuffer_Allocate(
     _Inout_ PCDROM_DEVICE_EXTENSION DeviceExtension
     );
 
+VOID
+ScratchBuffer_ResetContextItems(
+    _Inout_ PCDROM_DEVICE_EXTENSION DeviceExtension,
+    _Inout_ PCDROM_SCRATCH_CONTEXT  ScratchContext,
+    _In_ BOOLEAN                    ResetRequestHistory
+    );
+
+__inline
 VOID
 ScratchBuffer_ResetItems(
     _Inout_ PCDROM_DEVICE_EXTENSION DeviceExtension,
     _In_ BOOLEAN                 ResetRequestHistory
-    );
+    )
+{
+    ScratchBuffer_ResetContextItems(DeviceExtension, &DeviceExtension->ScratchContext, ResetRequestHistory);
+}
 
 _IRQL_requires_max_(APC_LEVEL)
 VOID
@@ -58,6 +69,7 @@ ScratchBuffer_SetupSrb(
 VOID
 ScratchBuffer_SetupReadWriteSrb(
     _Inout_ PCDROM_DEVICE_EXTENSION     DeviceExtension,
+    _Inout_ PCDROM_SCRATCH_CONTEXT      ScratchContext,
     _In_    WDFREQUEST                  OriginalRequest,
     _In_    LARGE_INTEGER               StartingOffset,
     _In_    ULONG                       RequiredLength,
@@ -67,41 +79,75 @@ ScratchBuffer_SetupReadWriteSrb(
     );
 
 NTSTATUS
-ScratchBuffer_SendSrb(
+ScratchBuffer_SendContextSrb(
     _Inout_     PCDROM_DEVICE_EXTENSION DeviceExtension,
+    _Inout_     PCDROM_SCRATCH_CONTEXT  ScratchContext,
     _In_        BOOLEAN                 SynchronousSrb,
     _When_(SynchronousSrb, _Pre_null_)
     _When_(!SynchronousSrb, _In_opt_)
                 PSRB_HISTORY_ITEM       *SrbHistoryItem
     );
 
+__inline
+NTSTATUS
+ScratchBuffer_SendSrb(
+    _Inout_     PCDROM_DEVICE_EXTENSION DeviceExtension,
+    _In_        BOOLEAN                 SynchronousSrb,
+    _When_(SynchronousSrb, _Pre_null_)
+    _When_(!SynchronousSrb, _In_opt_)
+                PSRB_HISTORY_ITEM       *SrbHistoryItem
+    )
+{
+    return ScratchBuffer_SendContextSrb(DeviceExtension,
+                                        &DeviceExtension->ScratchContext,
+                                        SynchronousSrb,
+                                        SrbHistoryItem);
+}
+
 NTSTATUS
 ScratchBuffer_PerformNextReadWrite(
     _In_ PCDROM_DEVICE_EXTENSION  DeviceExtension,
+    _In_ PCDROM_SCRATCH_CONTEXT   ScratchContext,
     _In_ BOOLEAN                  FirstTry
     );
 
+_IRQL_requires_max_(DISPATCH_LEVEL)
+PCDROM_SCRATCH_CONTEXT
+ScratchBuffer_AcquireConcurrentContext(
+    _In_ PCDROM_DEVICE_EXTENSION  DeviceExtension
+    );
+
+VOID
+ScratchBuffer_CompleteReadWrite(
+    _In_ PCDROM_DEVICE_EXTENSION  DeviceExtension,
+    _In_ PCDROM_SCRATCH_CONTEXT   ScratchContext,
+    _In_ WDFREQUEST               OriginalRequest,
+    _In_ NTSTATUS                 Status
+    );
+
 #if DBG
-    #define ScratchBuffer_BeginUse(context) ScratchBuffer_BeginUseX((context), __FILE__, __LINE__)
+    #define ScratchBuffer_BeginUse(context) ScratchBuffer_BeginUseX((context), &(context)->ScratchContext, __FILE__, __LINE__)
+    #define ScratchBuffer_BeginContextUse(context, scratch) ScratchBuffer_BeginUseX((context), (scratch), __FILE__, __LINE__)
 #else
-    #define ScratchBuffer_BeginUse(context) ScratchBuffer_BeginUseX((context), NULL, (ULONG)-1)
+    #define ScratchBuffer_BeginUse(context) ScratchBuffer_BeginUseX((context), &(context)->ScratchContext, NULL, (ULONG)-1)
+    #define ScratchBuffer_BeginContextUse(context, scratch) ScratchBuffer_BeginUseX((context), (scratch), NULL, (ULONG)-1)
 #endif
 
-__inline VOID ScratchBuffer_BeginUseX(_Inout_ PCDROM_DEVICE_EXTENSION DeviceExtension, _In_opt_ LPCSTR File, ULONG Line)
+__inline VOID ScratchBuffer_BeginUseX(_Inout_ PCDROM_DEVICE_EXTENSION DeviceExtension, _Inout_ PCDROM_SCRATCH_CONTEXT ScratchContext, _In_opt_ LPCSTR File, ULONG Line)
 {
     // NOTE: these are not "real" locks.  They are simply to help
     //       avoid multiple uses of the scratch buffer. Thus, it
     //       is not critical to have atomic operations here.
-    PVOID tmp = InterlockedCompareExchangePointer((PVOID)&(DeviceExtension->ScratchContext.ScratchInUse), (PVOID)-1, NULL);
+    PVOID tmp = InterlockedCompareExchangePointer((PVOID)&(ScratchContext->ScratchInUse), (PVOID)-1, NULL);
     NT_ASSERT(tmp == NULL);
     UNREFERENCED_PARAMETER(tmp); //defensive coding, avoid PREFAST warning.
-    DeviceExtension->ScratchContext.ScratchInUseFileName = File;
-    DeviceExtension->ScratchContext.ScratchInUseLineNumber = Line;
-    ScratchBuffer_ResetItems(DeviceExtension, TRUE);
-    RequestClearSendTime(DeviceExtension->ScratchContext.ScratchRequest);
+    ScratchContext->ScratchInUseFileName = File;
+    ScratchContext->ScratchInUseLineNumber = Line;
+    ScratchBuffer_ResetContextItems(DeviceExtension, ScratchContext, TRUE);
+    RequestClearSendTime(ScratchContext->ScratchRequest);
     return;
 }
-__inline VOID ScratchBuffer_EndUse(_Inout_ PCDROM_DEVICE_EXTENSION DeviceExtension)
+__inline VOID ScratchBuffer_EndContextUse(_Inout_ PCDROM_SCRATCH_CONTEXT ScratchContext)
 {
     // NOTE: these are not "real" locks.  They are simply to help
     //       avoid multiple uses of the scratch buffer.  Thus, it
@@ -115,18 +161,22 @@ __inline VOID ScratchBuffer_EndUse(_Inout_ PCDROM_DEVICE_EXTENSION DeviceExtensi
     ULONG  scratchInUseLineNumber;
     PVOID  tmp;
 
-    scratchInUseFileName = DeviceExtension->ScratchContext.ScratchInUseFileName;
-    scratchInUseLineNumber = DeviceExtension->ScratchContext.ScratchInUseLineNumber;
+    scratchInUseFileName = ScratchContext->ScratchInUseFileName;
+    scratchInUseLineNumber = ScratchContext->ScratchInUseLineNumber;
     UNREFERENCED_PARAMETER(scratchInUseFileName);
     UNREFERENCED_PARAMETER(scratchInUseLineNumber);
-    DeviceExtension->ScratchContext.ScratchInUseFileName = NULL;
-    DeviceExtension->ScratchContext.ScratchInUseLineNumber = 0;
+    ScratchContext->ScratchInUseFileName = NULL;
+    ScratchContext->ScratchInUseLineNumber = 0;
 
-    tmp = InterlockedCompareExchangePointer((PVOID)&(DeviceExtension->ScratchContext.ScratchInUse), NULL, (PVOID)-1);
+    tmp = InterlockedCompareExchangePointer((PVOID)&(ScratchContext->ScratchInUse), NULL, (PVOID)-1);
     NT_ASSERT(tmp == ((PVOID)-1));
     UNREFERENCED_PARAMETER(tmp); //defensive coding, avoid PREFAST warning.
     return;
 }
+__inline VOID ScratchBuffer_EndUse(_Inout_ PCDROM_DEVICE_EXTENSION DeviceExtension)
+{
+    ScratchBuffer_EndContextUse(&DeviceExtension->ScratchContext);
+}
 
 VOID
 CompressSrbHistoryData(
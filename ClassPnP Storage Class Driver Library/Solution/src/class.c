@@ -1963,6 +1963,9 @@ NTSTATUS ClassPnpStartDevice(IN PDEVICE_OBJECT DeviceObject)
                 // Initialize idle timer for disk devices
                 ClasspInitializeIdleTimer(fdoExtension);
 
+                // Initialize the optional request merge stage for disk devices
+                ClasspInitializeMergeQueue(fdoExtension);
+
                 if (ClasspIsObsoletePortDriver(fdoExtension) == FALSE) {
                     // get INQUIRY VPD support information. It's safe to send command as everything is ready in ClassInitDevice().
                     ClasspGetInquiryVpdSupportInfo(fdoExtension);
@@ -2320,7 +2323,17 @@ NTSTATUS ClassReadWrite(IN PDEVICE_OBJECT DeviceObject, IN PIRP Irp)
                             ClassAcquireRemoveLock(DeviceObject, (PIRP)&uniqueAddr);
 
                             ClasspMarkIrpAsIdle(Irp, FALSE);
-                            status = ServiceTransferRequest(DeviceObject, Irp, FALSE);
+
+                            //
+                            // Give the optional merge stage a chance to hold the request
+                            // and combine it with adjacent ones before it is sent down.
+                            //
+                            if (ClasspMergeTransferRequest(DeviceObject, Irp)) {
+                                status = STATUS_PENDING;
+                            }
+                            else {
+                                status = ServiceTransferRequest(DeviceObject, Irp, FALSE);
+                            }
                             if (fdoData->IdlePrioritySupported == TRUE) {
                                 fdoData->LastIoTime = ClasspGetCurrentTime(NULL);
                                 fdoData->IdleTicks = 0;
@@ -9925,6 +9938,8 @@ ClassRemoveDevice(
                     RemoveEntryList(&fdoExtension->PrivateFdoData->AllFdosListEntry);
                     InitializeListHead(&fdoExtension->PrivateFdoData->AllFdosListEntry);
 
+                    ClasspUninitializeMergeQueue(fdoExtension);
+
                     DestroyAllTransferPackets(DeviceObject);
 
 
@@ -9977,6 +9992,13 @@ ClassRemoveDevice(
 
         if (RemoveType == IRP_MN_REMOVE_DEVICE){
 
+            //
+            // Handles may still be open, in which case the dictionary is
+            // freed when the last of them is closed.
+            //
+
+            UninitializeDictionary(&(commonExtension->FileObjectDictionary));
+
             ClasspUninitializeRemoveTracking(DeviceObject);
 
             IoDeleteDevice(DeviceObject);
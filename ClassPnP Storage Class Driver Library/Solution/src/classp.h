@@ -111,6 +111,7 @@ extern ULONG ClassMaxInterleavePerCriticalIo;
 #define CLASSP_REG_IDLE_TIMEOUT_IN_SECONDS          (L"IdleTimeoutInSeconds")
 #define CLASSP_REG_DISABLE_D3COLD                   (L"DisableD3Cold")
 #define CLASSP_REG_QERR_OVERRIDE_MODE               (L"QERROverrideMode")
+#define CLASSP_REG_MERGE_DELAY_IN_MICROSECONDS      (L"MergeDelayInMicroseconds")
 
 #define CLASS_PERF_RESTORE_MINIMUM                  (0x10)
 #define CLASS_ERROR_LEVEL_1                         (0x4)
@@ -166,6 +167,7 @@ extern ULONG ClassMaxInterleavePerCriticalIo;
 #define CLASSPNP_POOL_TAG_SRB                       'rScS'
 #define CLASSPNP_POOL_TAG_VPD                       'pVcS'
 #define CLASSPNP_POOL_TAG_LOG_MESSAGE               'mlcS'
+#define CLASSPNP_POOL_TAG_MERGE                     'gMcS'
 
 //
 // Macros related to Token Operation commands
@@ -585,6 +587,9 @@ typedef struct _TRANSFER_PACKET {
  *  whatever is required by the current activity, up to the memory limit;
  *  as soon as stress ends, we snap down to MAX_WORKINGSET_TRANSFER_PACKETS;
  *  we then lazily work down to MIN_WORKINGSET_TRANSFER_PACKETS.
+ *  Within those limits the working set actually kept follows the load
+ *  (see WorkingSetTargetTransferPackets): after a sustained burst we only
+ *  trim down to the depth the burst needed, and drift lower as it subsides.
  */
 #define MIN_INITIAL_TRANSFER_PACKETS                    1
 #define MIN_WORKINGSET_TRANSFER_PACKETS_Consumer        8
@@ -595,6 +600,73 @@ typedef struct _TRANSFER_PACKET {
 #define MAX_WORKINGSET_TRANSFER_PACKETS_Enterprise   2048
 #define MAX_CLEANUP_TRANSFER_PACKETS_AT_ONCE         8192
 
+/*
+ *  Each processor keeps a few free TRANSFER_PACKETs of its own in front of
+ *  FreeTransferPacketsList, so that the common enqueue/dequeue touches a
+ *  cache line local to that processor instead of the shared slist header.
+ *  Slots are claimed with interlocked exchanges, so a thread that migrates
+ *  to another processor in the middle of an operation is still safe.
+ */
+#define TRANSFER_PACKET_CPU_CACHE_DEPTH                 4
+
+typedef struct _TRANSFER_PACKET_CPU_CACHE {
+    PTRANSFER_PACKET Packets[TRANSFER_PACKET_CPU_CACHE_DEPTH];
+    UCHAR Reserved[SYSTEM_CACHE_ALIGNMENT_SIZE - TRANSFER_PACKET_CPU_CACHE_DEPTH * sizeof(PTRANSFER_PACKET)];
+} TRANSFER_PACKET_CPU_CACHE, *PTRANSFER_PACKET_CPU_CACHE;
+
+
+//
+// State of the optional request merge stage (see ClasspMergeTransferRequest).
+// Small read/write IRPs are held for up to Delay while LBA-contiguous,
+// same-direction requests are appended; the run is then sent down as a
+// single transfer and the completion is fanned back out to the held IRPs.
+//
+typedef struct _CLASS_MERGE_QUEUE {
+
+    //
+    // TRUE if the MergeDelayInMicroseconds registry value enabled merging.
+    //
+    BOOLEAN Enabled;
+
+    //
+    // Direction and stack location flags shared by all IRPs in the run.
+    //
+    UCHAR MajorFunction;
+    UCHAR StackFlags;
+
+    //
+    // Protects the fields below.
+    //
+    KSPIN_LOCK Lock;
+
+    //
+    // IRPs held in the current run, in LBA order
+    // (linked through Tail.Overlay.ListEntry).
+    //
+    LIST_ENTRY IrpList;
+    ULONG NumIrps;
+
+    //
+    // Bytes held in the run, and the disk byte offset just past its end.
+    //
+    ULONG Length;
+    LARGE_INTEGER NextOffset;
+
+    //
+    // Upper bounds for the whole run and for a single IRP to be held.
+    //
+    ULONG MaxLength;
+    ULONG MaxRequestLength;
+
+    //
+    // Relative due time of the timer that bounds how long a run is held.
+    //
+    LARGE_INTEGER Delay;
+    KTIMER Timer;
+    KDPC Dpc;
+
+} CLASS_MERGE_QUEUE, *PCLASS_MERGE_QUEUE;
+
 
 //
 // !!! WARNING !!!
@@ -647,6 +719,15 @@ struct _CLASS_PRIVATE_FDO_DATA {
     ULONG LocalMinWorkingSetTransferPackets;
     ULONG LocalMaxWorkingSetTransferPackets;
 
+    //
+    // Working set target that adapts to the load, kept between the two limits
+    // above.  It jumps up to the peak number of packets seen outside the free
+    // list and decays back toward it each time the device goes idle.  Both
+    // values are approximate and updated without a lock.
+    //
+    ULONG WorkingSetTargetTransferPackets;
+    ULONG PeakOutstandingTransferPackets;
+
     /*
      *  Entry in static list used by debug extension to quickly find all class FDOs.
      */
@@ -704,6 +785,14 @@ struct _CLASS_PRIVATE_FDO_DATA {
     ULONG NumTotalTransferPackets;
     ULONG DbgPeakNumTransferPackets;
 
+    /*
+     *  Per-processor caches in front of FreeTransferPacketsList.
+     *  NumFreeTransferPackets does not include packets held here.
+     *  NULL if the caches could not be allocated.
+     */
+    PTRANSFER_PACKET_CPU_CACHE TransferPacketCpuCaches;
+    ULONG NumTransferPacketCpuCaches;
+
     /*
      *  Queue for deferred client irps
      */
@@ -887,6 +976,11 @@ struct _CLASS_PRIVATE_FDO_DATA {
     //
     LONG ActiveIdleIoCount;
 
+    //
+    // Bounded-delay merging of small adjacent requests
+    //
+    CLASS_MERGE_QUEUE MergeQueue;
+
     //
     // Support for class drivers to extend
     // the interpret sense information routine
@@ -1075,6 +1169,9 @@ typedef struct _IO_RETRIED_LOG_MESSAGE_CONTEXT {
 #define CLASS_STARVATION_INTERVAL   500         // 500 milliseconds
 #define CLASS_IDLE_TIMER_TICKS      4
 
+#define CLASS_MERGE_MAX_DELAY_IN_MICROSECONDS   10000       // 10 milliseconds
+#define CLASS_MERGE_MAX_REQUEST_LENGTH          (64 * 1024)
+
 
 /*
  *  Simple singly-linked-list queuing macros, with no synchronization.
@@ -1398,6 +1495,11 @@ InitializeDictionary(
     IN PDICTIONARY Dictionary
     );
 
+VOID
+UninitializeDictionary(
+    IN PDICTIONARY Dictionary
+    );
+
 BOOLEAN
 TestDictionarySignature(
     IN PDICTIONARY Dictionary
@@ -1927,6 +2029,22 @@ ClasspInitializeIdleTimer(
     PFUNCTIONAL_DEVICE_EXTENSION FdoExtension
     );
 
+VOID
+ClasspInitializeMergeQueue(
+    PFUNCTIONAL_DEVICE_EXTENSION FdoExtension
+    );
+
+VOID
+ClasspUninitializeMergeQueue(
+    PFUNCTIONAL_DEVICE_EXTENSION FdoExtension
+    );
+
+BOOLEAN
+ClasspMergeTransferRequest(
+    PDEVICE_OBJECT Fdo,
+    PIRP Irp
+    );
+
 NTSTATUS
 ClasspIsPortable(
     _In_ PFUNCTIONAL_DEVICE_EXTENSION   FdoExtension,
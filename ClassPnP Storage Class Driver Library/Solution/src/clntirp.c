@@ -53,6 +53,34 @@ ClasspDequeueIdleRequest(
     PFUNCTIONAL_DEVICE_EXTENSION FdoExtension
     );
 
+KDEFERRED_ROUTINE ClasspMergeTimerDpc;
+
+IO_COMPLETION_ROUTINE ClasspMergedIrpCompletion;
+
+VOID
+ClasspTakeMergeRun(
+    PCLASS_MERGE_QUEUE MergeQueue,
+    PLIST_ENTRY IrpList
+    );
+
+VOID
+ClasspSubmitMergeRun(
+    PDEVICE_OBJECT Fdo,
+    PLIST_ENTRY IrpList,
+    BOOLEAN PostToDpc
+    );
+
+//
+// Context of a merged request in flight: the held client IRPs
+// and the bounce buffer the merged transfer was done into.
+//
+typedef struct _CLASS_MERGE_CONTEXT {
+    PDEVICE_OBJECT Fdo;
+    LIST_ENTRY IrpList;
+    UCHAR MajorFunction;
+    PUCHAR Buffer;
+} CLASS_MERGE_CONTEXT, *PCLASS_MERGE_CONTEXT;
+
 
 /*++
 
@@ -779,5 +807,525 @@ ClasspServiceIdleRequest(
     return;
 }
 
+/*++
+
+ClasspInitializeMergeQueue
+
+Routine Description:
+
+    Initialize the request merge stage for the given device.
+    Merging is off unless the MergeDelayInMicroseconds registry value
+    is set to a non-zero value.
+
+Arguments:
+
+    FdoExtension    - Pointer to the device extension
+
+Return Value:
+
+    None
+
+--*/
+VOID
+ClasspInitializeMergeQueue(
+    PFUNCTIONAL_DEVICE_EXTENSION FdoExtension
+    )
+{
+    PCLASS_PRIVATE_FDO_DATA fdoData = FdoExtension->PrivateFdoData;
+    PCLASS_MERGE_QUEUE mergeQueue = &fdoData->MergeQueue;
+    ULONG mergeDelay = 0;
+
+    mergeQueue->Enabled = FALSE;
+
+    ClassGetDeviceParameter(FdoExtension,
+                            CLASSP_REG_SUBKEY_NAME,
+                            CLASSP_REG_MERGE_DELAY_IN_MICROSECONDS,
+                            &mergeDelay);
+
+    if (mergeDelay == 0) {
+        return;
+    }
+
+    mergeDelay = min(mergeDelay, CLASS_MERGE_MAX_DELAY_IN_MICROSECONDS);
+
+    KeInitializeSpinLock(&mergeQueue->Lock);
+    InitializeListHead(&mergeQueue->IrpList);
+    KeInitializeTimer(&mergeQueue->Timer);
+    KeInitializeDpc(&mergeQueue->Dpc, ClasspMergeTimerDpc, FdoExtension);
+    mergeQueue->NumIrps = 0;
+    mergeQueue->Length = 0;
+
+    //
+    // convert microseconds to a relative 100ns
+    //
+    mergeQueue->Delay.QuadPart = Int32x32To64(mergeDelay, -10);
+
+    //
+    // A run always fits in one transfer packet, whatever the alignment of
+    // the bounce buffer.  Only requests up to half of that are held back.
+    //
+    mergeQueue->MaxLength = fdoData->HwMaxXferLen;
+    mergeQueue->MaxRequestLength = min(CLASS_MERGE_MAX_REQUEST_LENGTH, mergeQueue->MaxLength / 2);
+
+    TracePrint((TRACE_LEVEL_INFORMATION, TRACE_FLAG_GENERAL,
+                "ClasspInitializeMergeQueue: Merging requests up to %u bytes within %u us for %p\n",
+                mergeQueue->MaxLength, mergeDelay, FdoExtension));
+
+    mergeQueue->Enabled = TRUE;
+    return;
+}
+
+/*++
+
+ClasspUninitializeMergeQueue
+
+Routine Description:
+
+    Make sure the merge timer DPC is no longer running before the
+    private fdo data is freed.  All held IRPs have completed by now,
+    since each of them holds the remove lock.
+
+Arguments:
+
+    FdoExtension    - Pointer to the device extension
+
+Return Value:
+
+    None
+
+--*/
+VOID
+ClasspUninitializeMergeQueue(
+    PFUNCTIONAL_DEVICE_EXTENSION FdoExtension
+    )
+{
+    PCLASS_MERGE_QUEUE mergeQueue = &FdoExtension->PrivateFdoData->MergeQueue;
+
+    if (mergeQueue->Enabled) {
+        NT_ASSERT(mergeQueue->NumIrps == 0);
+        (VOID)KeCancelTimer(&mergeQueue->Timer);
+        KeFlushQueuedDpcs();
+        mergeQueue->Enabled = FALSE;
+    }
+    return;
+}
+
+/*++
+
+ClasspMergeTransferRequest
+
+Routine Description:
+
+    Offer a read/write request to the merge stage.  Small requests are held
+    for up to the configured delay; a request that starts where the current
+    run ends, in the same direction and with the same stack flags, is
+    appended to it.  The run is sent down as a single transfer when the timer
+    fires, when the next request of the same size would not fit, or when a
+    request arrives that cannot extend it.
+
+    Paging I/O, copy-specific reads and high priority requests are never
+    held back.
+
+Arguments:
+
+    Fdo     - Pointer to the device object
+    Irp     - Pointer to the I/O request packet, with a disk-relative byte offset
+
+Return Value:
+
+    TRUE if the request was taken (and marked pending); the caller must
+    return STATUS_PENDING.  FALSE if the caller must service it as usual.
 
+--*/
+BOOLEAN
+ClasspMergeTransferRequest(
+    PDEVICE_OBJECT Fdo,
+    PIRP Irp
+    )
+{
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExtension = Fdo->DeviceExtension;
+    PCLASS_PRIVATE_FDO_DATA fdoData = fdoExtension->PrivateFdoData;
+    PCLASS_MERGE_QUEUE mergeQueue = &fdoData->MergeQueue;
+    PIO_STACK_LOCATION currentSp = IoGetCurrentIrpStackLocation(Irp);
+    ULONG length = currentSp->Parameters.Read.Length;
+    LARGE_INTEGER byteOffset = currentSp->Parameters.Read.ByteOffset;
+    LIST_ENTRY flushList;
+    KIRQL oldIrql;
+
+    if (!mergeQueue->Enabled) {
+        return FALSE;
+    }
+
+    if ((length > mergeQueue->MaxRequestLength) ||
+        (Irp->MdlAddress == NULL) ||
+        TEST_FLAG(Irp->Flags, IRP_PAGING_IO | IRP_SYNCHRONOUS_PAGING_IO) ||
+        TEST_FLAG(currentSp->Flags, SL_KEY_SPECIFIED) ||
+        (IoGetIoPriorityHint(Irp) > IoPriorityNormal)) {
+        return FALSE;
+    }
+
+    //
+    // Map the client buffer now, so that copying to or from the
+    // bounce buffer cannot fail once the request has been held.
+    //
+    if (MmGetSystemAddressForMdlSafe(Irp->MdlAddress, NormalPagePriority | MdlMappingNoExecute) == NULL) {
+        return FALSE;
+    }
+
+    InitializeListHead(&flushList);
+    IoMarkIrpPending(Irp);
+
+    KeAcquireSpinLock(&mergeQueue->Lock, &oldIrql);
+
+    if ((mergeQueue->NumIrps > 0) &&
+        ((mergeQueue->MajorFunction != currentSp->MajorFunction) ||
+         (mergeQueue->StackFlags != currentSp->Flags) ||
+         (mergeQueue->NextOffset.QuadPart != byteOffset.QuadPart) ||
+         (mergeQueue->Length + length > mergeQueue->MaxLength))) {
+        //
+        // This request cannot extend the current run.
+        // Send the run down and start a new one.
+        //
+        ClasspTakeMergeRun(mergeQueue, &flushList);
+    }
+
+    if (mergeQueue->NumIrps == 0) {
+        mergeQueue->MajorFunction = currentSp->MajorFunction;
+        mergeQueue->StackFlags = currentSp->Flags;
+        KeSetTimer(&mergeQueue->Timer, mergeQueue->Delay, &mergeQueue->Dpc);
+    }
+
+    InsertTailList(&mergeQueue->IrpList, &Irp->Tail.Overlay.ListEntry);
+    mergeQueue->NumIrps++;
+    mergeQueue->Length += length;
+    mergeQueue->NextOffset.QuadPart = byteOffset.QuadPart + length;
+
+    //
+    // If another request of this size would not fit, don't wait for it.
+    // (A new run can't be full yet, so there is at most one run to send.)
+    //
+    if (mergeQueue->Length + length > mergeQueue->MaxLength) {
+        NT_ASSERT(IsListEmpty(&flushList));
+        ClasspTakeMergeRun(mergeQueue, &flushList);
+    }
+
+    KeReleaseSpinLock(&mergeQueue->Lock, oldIrql);
+
+    if (!IsListEmpty(&flushList)) {
+        ClasspSubmitMergeRun(Fdo, &flushList, FALSE);
+    }
+
+    return TRUE;
+}
+
+/*++
+
+ClasspTakeMergeRun
+
+Routine Description:
+
+    Move the IRPs of the current run to the given list and reset the run.
+    Called with the merge queue lock held.
+
+Arguments:
+
+    MergeQueue  - Pointer to the merge queue
+    IrpList     - List to move the held IRPs to
+
+Return Value:
+
+    None
+
+--*/
+VOID
+ClasspTakeMergeRun(
+    PCLASS_MERGE_QUEUE MergeQueue,
+    PLIST_ENTRY IrpList
+    )
+{
+    (VOID)KeCancelTimer(&MergeQueue->Timer);
+
+    while (!IsListEmpty(&MergeQueue->IrpList)) {
+        InsertTailList(IrpList, RemoveHeadList(&MergeQueue->IrpList));
+    }
+
+    MergeQueue->NumIrps = 0;
+    MergeQueue->Length = 0;
+    return;
+}
+
+/*++
+
+ClasspMergeTimerDpc
+
+Routine Description:
+
+    Timer DPC bounding how long a run is held.  Sends down whatever
+    has been collected.
+
+Arguments:
+
+    Dpc             - Pointer to DPC object
+    Context         - Pointer to the fdo device extension
+    SystemArgument1 - Not used
+    SystemArgument2 - Not used
+
+Return Value:
+
+    None
+
+--*/
+VOID
+ClasspMergeTimerDpc(
+    IN PKDPC Dpc,
+    IN PVOID Context,
+    IN PVOID SystemArgument1,
+    IN PVOID SystemArgument2
+    )
+{
+    PFUNCTIONAL_DEVICE_EXTENSION fdoExtension = Context;
+    PCLASS_MERGE_QUEUE mergeQueue;
+    LIST_ENTRY irpList;
+    KIRQL oldIrql;
+
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    if (fdoExtension == NULL) {
+        NT_ASSERT(fdoExtension != NULL);
+        return;
+    }
+
+    mergeQueue = &fdoExtension->PrivateFdoData->MergeQueue;
+    InitializeListHead(&irpList);
+
+    KeAcquireSpinLock(&mergeQueue->Lock, &oldIrql);
+    ClasspTakeMergeRun(mergeQueue, &irpList);
+    KeReleaseSpinLock(&mergeQueue->Lock, oldIrql);
+
+    if (!IsListEmpty(&irpList)) {
+        ClasspSubmitMergeRun(fdoExtension->DeviceObject, &irpList, FALSE);
+    }
+    return;
+}
+
+/*++
+
+ClasspSubmitMergeRun
+
+Routine Description:
+
+    Send a run of held IRPs down.  A run of more than one IRP is copied
+    into a bounce buffer (for writes) and issued through ServiceTransferRequest
+    as one private IRP, whose completion fans out to the held IRPs.
+    A single IRP, or a run for which resources can't be allocated,
+    is sent down IRP by IRP.
+
+Arguments:
+
+    Fdo         - Pointer to the device object
+    IrpList     - The held IRPs, in LBA order.  Emptied on return.
+    PostToDpc   - Flag to pass to ServiceTransferRequest
+
+Return Value:
+
+    None
+
+--*/
+VOID
+ClasspSubmitMergeRun(
+    PDEVICE_OBJECT Fdo,
+    PLIST_ENTRY IrpList,
+    BOOLEAN PostToDpc
+    )
+{
+    PIRP firstIrp = CONTAINING_RECORD(IrpList->Flink, IRP, Tail.Overlay.ListEntry);
+    PIO_STACK_LOCATION firstSp = IoGetCurrentIrpStackLocation(firstIrp);
+    PCLASS_MERGE_CONTEXT mergeContext = NULL;
+    PIRP mergeIrp = NULL;
+    PMDL mdl = NULL;
+    PIO_STACK_LOCATION mergeSp;
+    PLIST_ENTRY listEntry;
+    PIRP irp;
+    PVOID systemAddress;
+    ULONG irpLength;
+    ULONG numIrps = 0;
+    ULONG length = 0;
+    ULONG offset = 0;
+
+    NT_ASSERT(!IsListEmpty(IrpList));
+
+    for (listEntry = IrpList->Flink; listEntry != IrpList; listEntry = listEntry->Flink) {
+        irp = CONTAINING_RECORD(listEntry, IRP, Tail.Overlay.ListEntry);
+        length += IoGetCurrentIrpStackLocation(irp)->Parameters.Read.Length;
+        numIrps++;
+    }
+
+    if (numIrps > 1) {
+        mergeContext = ExAllocatePoolWithTag(NonPagedPoolNx, sizeof(CLASS_MERGE_CONTEXT), CLASSPNP_POOL_TAG_MERGE);
+        if (mergeContext != NULL) {
+            RtlZeroMemory(mergeContext, sizeof(CLASS_MERGE_CONTEXT));
+
+            //
+            // Round up to whole pages so the buffer is page aligned.
+            //
+            mergeContext->Buffer = ExAllocatePoolWithTag(NonPagedPoolNx, ROUND_TO_PAGES(length), CLASSPNP_POOL_TAG_MERGE);
+            if (mergeContext->Buffer != NULL) {
+                mdl = IoAllocateMdl(mergeContext->Buffer, length, FALSE, FALSE, NULL);
+            }
+            if (mdl != NULL) {
+                MmBuildMdlForNonPagedPool(mdl);
+                mergeIrp = IoAllocateIrp(1, FALSE);
+            }
+        }
+
+        if (mergeIrp == NULL) {
+            TracePrint((TRACE_LEVEL_WARNING, TRACE_FLAG_RW, "ClasspSubmitMergeRun: Failed to allocate merged request, sending %u requests separately.", numIrps));
+            if (mdl != NULL) {
+                IoFreeMdl(mdl);
+            }
+            if (mergeContext != NULL) {
+                FREE_POOL(mergeContext->Buffer);
+                FREE_POOL(mergeContext);
+            }
+        }
+    }
+
+    if (mergeIrp == NULL) {
+        while (!IsListEmpty(IrpList)) {
+            listEntry = RemoveHeadList(IrpList);
+            irp = CONTAINING_RECORD(listEntry, IRP, Tail.Overlay.ListEntry);
+            InitializeListHead(&irp->Tail.Overlay.ListEntry);
+            ServiceTransferRequest(Fdo, irp, PostToDpc);
+        }
+        return;
+    }
+
+    mergeContext->Fdo = Fdo;
+    mergeContext->MajorFunction = firstSp->MajorFunction;
+    InitializeListHead(&mergeContext->IrpList);
+
+    //
+    // The merged IRP carries one stack location of our own, set up like a
+    // client read/write so that the packet engine can service it directly.
+    //
+    mergeIrp->MdlAddress = mdl;
+    IoSetCompletionRoutine(mergeIrp, ClasspMergedIrpCompletion, mergeContext, TRUE, TRUE, TRUE);
+    IoSetNextIrpStackLocation(mergeIrp);
+    mergeSp = IoGetCurrentIrpStackLocation(mergeIrp);
+    mergeSp->MajorFunction = firstSp->MajorFunction;
+    mergeSp->Flags = firstSp->Flags;
+    mergeSp->DeviceObject = Fdo;
+    mergeSp->Parameters.Read.Length = length;
+    mergeSp->Parameters.Read.ByteOffset = firstSp->Parameters.Read.ByteOffset;
+
+    while (!IsListEmpty(IrpList)) {
+        listEntry = RemoveHeadList(IrpList);
+        irp = CONTAINING_RECORD(listEntry, IRP, Tail.Overlay.ListEntry);
+        irpLength = IoGetCurrentIrpStackLocation(irp)->Parameters.Read.Length;
+
+        if (mergeContext->MajorFunction == IRP_MJ_WRITE) {
+            systemAddress = MmGetSystemAddressForMdlSafe(irp->MdlAddress, NormalPagePriority | MdlMappingNoExecute);
+            NT_ASSERT(systemAddress != NULL);
+            RtlCopyMemory(mergeContext->Buffer + offset, systemAddress, irpLength);
+        }
+
+        offset += irpLength;
+        InsertTailList(&mergeContext->IrpList, listEntry);
+    }
+
+    TracePrint((TRACE_LEVEL_VERBOSE, TRACE_FLAG_RW, "ClasspSubmitMergeRun: Merged %u requests into %u bytes (Irp=%p).", numIrps, length, mergeIrp));
+
+    //
+    // TransferPktComplete releases the remove lock for the merged IRP
+    // before completing it.
+    //
+    ClassAcquireRemoveLock(Fdo, mergeIrp);
+    ServiceTransferRequest(Fdo, mergeIrp, PostToDpc);
+    return;
+}
+
+/*++
+
+ClasspMergedIrpCompletion
+
+Routine Description:
+
+    Completion routine for a merged request.  On success, copies read data
+    back and completes each held IRP.  On failure, re-drives each held IRP
+    on its own, so that each one gets its own retries and final status
+    instead of inheriting the failure of the whole run.
+
+Arguments:
+
+    NullFdo - Not used (the merged IRP has no stack location above ours)
+    Irp     - The merged IRP
+    Context - Pointer to the merge context
+
+Return Value:
+
+    STATUS_MORE_PROCESSING_REQUIRED; the merged IRP is freed here.
+
+--*/
+NTSTATUS
+ClasspMergedIrpCompletion(
+    IN PDEVICE_OBJECT NullFdo,
+    IN PIRP Irp,
+    IN PVOID Context
+    )
+{
+    PCLASS_MERGE_CONTEXT mergeContext = Context;
+    PDEVICE_OBJECT fdo = mergeContext->Fdo;
+    NTSTATUS status = Irp->IoStatus.Status;
+    PLIST_ENTRY listEntry;
+    PIRP originalIrp;
+    PVOID systemAddress;
+    ULONG length;
+    ULONG offset = 0;
+
+    UNREFERENCED_PARAMETER(NullFdo);
+
+    while (!IsListEmpty(&mergeContext->IrpList)) {
+        listEntry = RemoveHeadList(&mergeContext->IrpList);
+        originalIrp = CONTAINING_RECORD(listEntry, IRP, Tail.Overlay.ListEntry);
+        InitializeListHead(&originalIrp->Tail.Overlay.ListEntry);
+        length = IoGetCurrentIrpStackLocation(originalIrp)->Parameters.Read.Length;
+
+        if (NT_SUCCESS(status)) {
+            if (mergeContext->MajorFunction == IRP_MJ_READ) {
+                systemAddress = MmGetSystemAddressForMdlSafe(originalIrp->MdlAddress, NormalPagePriority | MdlMappingNoExecute);
+                NT_ASSERT(systemAddress != NULL);
+                RtlCopyMemory(systemAddress, mergeContext->Buffer + offset, length);
+            }
+
+            originalIrp->IoStatus.Status = status;
+            originalIrp->IoStatus.Information = length;
+            ClassReleaseRemoveLock(fdo, originalIrp);
+            ClassCompleteRequest(fdo, originalIrp, IO_DISK_INCREMENT);
+        }
+        else {
+            //
+            // We are inside a packet completion, so post the re-driven
+            // packets to a DPC rather than recursing down the stack.
+            //
+            ServiceTransferRequest(fdo, originalIrp, TRUE);
+        }
+
+        offset += length;
+    }
+
+    if (!NT_SUCCESS(status)) {
+        TracePrint((TRACE_LEVEL_WARNING, TRACE_FLAG_RW, "ClasspMergedIrpCompletion: Merged request %p failed with %!STATUS!, re-driving requests separately.", Irp, status));
+    }
+
+    IoFreeMdl(Irp->MdlAddress);
+    Irp->MdlAddress = NULL;
+    IoFreeIrp(Irp);
+
+    FREE_POOL(mergeContext->Buffer);
+    FREE_POOL(mergeContext);
+
+    return STATUS_MORE_PROCESSING_REQUIRED;
+}
 
@@ -19,6 +19,10 @@ Notes:
 
     This module generates a static library
 
+    The entries are kept in a hash table which doubles in size as it
+    fills.  Lookups take no lock; inserts and removes lock only a stripe
+    of the buckets.
+
 Revision History:
 
 --*/
@@ -27,6 +31,7 @@ Revision History:
 #include <classpnp.h>
 
 #define DICTIONARY_SIGNATURE 'tciD'
+#define DICTIONARY_TAG       'hciD'
 
 #pragma warning(push)
 #pragma warning(disable:4200) // nonstandard extension used : zero-sized array in struct/union
@@ -40,7 +45,284 @@ struct _DICTIONARY_HEADER {
 struct _DICTIONARY_HEADER;
 typedef struct _DICTIONARY_HEADER DICTIONARY_HEADER, *PDICTIONARY_HEADER;
 
-
+//
+// The DICTIONARY itself is embedded in the device extensions and can't
+// change, so its List field points to a DICTIONARY_STATE, which is
+// allocated on the first insert.
+//
+// Inserts and removes take one of DICTIONARY_LOCKS locks, chosen by the
+// hash of the key, so they only contend with changes to the same stripe
+// of buckets.  The stripe of a key doesn't depend on the table size.
+// Growing the table takes all of the locks.
+//
+// Lookups take no lock.  Each bucket has a sequence number which is odd
+// while its chain is being changed, and a lookup which finds it odd or
+// sees it change starts over.  Since a lookup may still be walking an
+// entry after it is removed, entries are not freed while the dictionary
+// is in use: removed entries go on a free list to be reused, and tables
+// that have been replaced are kept until the dictionary is freed.  Every
+// entry is allocated large enough for a FILE_OBJECT_EXTENSION, the
+// largest size allowed, so any free entry can be reused for any insert.
+//
+// The state is freed when the dictionary has been uninitialized and its
+// last entry has been freed, which may be after the device was removed
+// since closes still come through then.
+//
+
+#define DICTIONARY_LOCKS            16      // also the initial bucket count
+#define DICTIONARY_LOAD_FACTOR      2
+#define DICTIONARY_MAX_BUCKETS      (1 << 16)
+
+#define DICTIONARY_ENTRY_SIZE       (sizeof(DICTIONARY_HEADER) + sizeof(FILE_OBJECT_EXTENSION))
+
+C_ASSERT((FIELD_OFFSET(DICTIONARY_HEADER, Data) % MEMORY_ALLOCATION_ALIGNMENT) == 0);
+C_ASSERT(sizeof(FILE_OBJECT_EXTENSION) >= sizeof(SLIST_ENTRY));
+
+typedef struct _DICTIONARY_BUCKET {
+    PDICTIONARY_HEADER volatile Head;
+    volatile LONG Sequence;
+} DICTIONARY_BUCKET, *PDICTIONARY_BUCKET;
+
+typedef struct _DICTIONARY_TABLE {
+    struct _DICTIONARY_TABLE *Retired;      // the table this one replaced
+    ULONG Mask;                             // number of buckets - 1
+    DICTIONARY_BUCKET Buckets[ANYSIZE_ARRAY];
+} DICTIONARY_TABLE, *PDICTIONARY_TABLE;
+
+//
+// Each lock has a cache line to itself.
+//
+
+typedef struct _DICTIONARY_LOCK {
+    KSPIN_LOCK Lock;
+    UCHAR Reserved[SYSTEM_CACHE_ALIGNMENT_SIZE - sizeof(KSPIN_LOCK)];
+} DICTIONARY_LOCK, *PDICTIONARY_LOCK;
+
+typedef struct _DICTIONARY_STATE {
+
+    //
+    // Entries that have been freed, linked through their data.
+    //
+
+    SLIST_HEADER FreeList;
+
+    PDICTIONARY_TABLE volatile Table;
+
+    //
+    // The number of entries, plus one until the dictionary is uninitialized.
+    //
+
+    volatile LONG References;
+
+    DICTIONARY_LOCK Locks[DICTIONARY_LOCKS];
+
+} DICTIONARY_STATE, *PDICTIONARY_STATE;
+
+#define DICTIONARY_TABLE_SIZE(_buckets) \
+    (FIELD_OFFSET(DICTIONARY_TABLE, Buckets) + ((_buckets) * sizeof(DICTIONARY_BUCKET)))
+
+
+static
+__inline
+PDICTIONARY_STATE
+DictionaryGetState(
+    IN PDICTIONARY Dictionary
+    )
+{
+    return (PDICTIONARY_STATE) *((PVOID volatile *) &Dictionary->List);
+}
+
+
+static
+__inline
+ULONG
+DictionaryHash(
+    IN ULONGLONG Key
+    )
+{
+    //
+    // Keys are usually pool addresses, whose low bits are all the same,
+    // so take the high bits of a multiplicative hash.
+    //
+
+    return (ULONG) ((Key * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+
+static
+PDICTIONARY_STATE
+DictionaryCreateState(
+    IN PDICTIONARY Dictionary
+    )
+{
+    PDICTIONARY_STATE state;
+    PDICTIONARY_TABLE table;
+    KIRQL oldIrql;
+    ULONG i;
+
+    state = ExAllocatePoolWithTag(NonPagedPoolNxCacheAligned,
+                                  sizeof(DICTIONARY_STATE),
+                                  DICTIONARY_TAG);
+    table = ExAllocatePoolWithTag(NonPagedPoolNx,
+                                  DICTIONARY_TABLE_SIZE(DICTIONARY_LOCKS),
+                                  DICTIONARY_TAG);
+
+    if ((state == NULL) || (table == NULL)) {
+        FREE_POOL(state);
+        FREE_POOL(table);
+        return NULL;
+    }
+
+    RtlZeroMemory(table, DICTIONARY_TABLE_SIZE(DICTIONARY_LOCKS));
+    table->Mask = DICTIONARY_LOCKS - 1;
+
+    RtlZeroMemory(state, sizeof(DICTIONARY_STATE));
+    InitializeSListHead(&state->FreeList);
+    state->Table = table;
+    state->References = 1;
+
+    for (i = 0; i < DICTIONARY_LOCKS; i++) {
+        KeInitializeSpinLock(&state->Locks[i].Lock);
+    }
+
+    //
+    // Someone else may have beaten us to it.
+    //
+
+    KeAcquireSpinLock(&(Dictionary->SpinLock), &oldIrql);
+
+    if (Dictionary->List == NULL) {
+        KeMemoryBarrier();
+        Dictionary->List = (PDICTIONARY_HEADER) state;
+    } else {
+        FREE_POOL(table);
+        FREE_POOL(state);
+        state = (PDICTIONARY_STATE) Dictionary->List;
+    }
+
+    KeReleaseSpinLock(&(Dictionary->SpinLock), oldIrql);
+
+    return state;
+}
+
+
+static
+VOID
+DictionaryFreeState(
+    IN PDICTIONARY Dictionary,
+    IN PDICTIONARY_STATE State
+    )
+{
+    PDICTIONARY_TABLE table;
+    PDICTIONARY_TABLE retired;
+    PSLIST_ENTRY freeEntry;
+
+    Dictionary->List = NULL;
+
+    while ((freeEntry = InterlockedPopEntrySList(&State->FreeList)) != NULL) {
+        ExFreePool(CONTAINING_RECORD(freeEntry, DICTIONARY_HEADER, Data));
+    }
+
+    table = State->Table;
+
+    while (table != NULL) {
+        retired = table->Retired;
+        ExFreePool(table);
+        table = retired;
+    }
+
+    ExFreePool(State);
+    return;
+}
+
+
+static
+VOID
+DictionaryGrow(
+    IN PDICTIONARY_STATE State,
+    IN PDICTIONARY_TABLE Table
+    )
+{
+    PDICTIONARY_TABLE newTable;
+    PDICTIONARY_BUCKET newBucket;
+    PDICTIONARY_HEADER entry;
+    PDICTIONARY_HEADER next;
+    ULONG buckets;
+    KIRQL oldIrql;
+    ULONG i;
+
+    buckets = (Table->Mask + 1) * 2;
+
+    newTable = ExAllocatePoolWithTag(NonPagedPoolNx,
+                                     DICTIONARY_TABLE_SIZE(buckets),
+                                     DICTIONARY_TAG);
+
+    if (newTable == NULL) {
+
+        //
+        // We'll just have longer chains.
+        //
+
+        return;
+    }
+
+    RtlZeroMemory(newTable, DICTIONARY_TABLE_SIZE(buckets));
+    newTable->Mask = buckets - 1;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &oldIrql);
+
+    for (i = 0; i < DICTIONARY_LOCKS; i++) {
+        KeAcquireSpinLockAtDpcLevel(&State->Locks[i].Lock);
+    }
+
+    if (State->Table == Table) {
+
+        //
+        // Make the old buckets odd for good, so lookups in them retry
+        // until they see the new table.
+        //
+
+        for (i = 0; i <= Table->Mask; i++) {
+            Table->Buckets[i].Sequence++;
+        }
+
+        KeMemoryBarrier();
+
+        for (i = 0; i <= Table->Mask; i++) {
+
+            entry = Table->Buckets[i].Head;
+
+            while (entry != NULL) {
+                next = entry->Next;
+                newBucket = &newTable->Buckets[DictionaryHash(entry->Key) & newTable->Mask];
+                entry->Next = newBucket->Head;
+                newBucket->Head = entry;
+                entry = next;
+            }
+        }
+
+        newTable->Retired = Table;
+
+        KeMemoryBarrier();
+        State->Table = newTable;
+        newTable = NULL;
+    }
+
+    for (i = DICTIONARY_LOCKS; i > 0; i--) {
+        KeReleaseSpinLockFromDpcLevel(&State->Locks[i - 1].Lock);
+    }
+
+    KeLowerIrql(oldIrql);
+
+    //
+    // If someone else grew the table first we don't need ours.
+    //
+
+    FREE_POOL(newTable);
+    return;
+}
+
+
 VOID
 InitializeDictionary(
     IN PDICTIONARY Dictionary
@@ -52,7 +334,31 @@ InitializeDictionary(
     return;
 }
 
-
+
+VOID
+UninitializeDictionary(
+    IN PDICTIONARY Dictionary
+    )
+{
+    PDICTIONARY_STATE state;
+
+    //
+    // Drop the dictionary's reference on the state.  Entries still in
+    // the dictionary keep it until they are freed.
+    //
+
+    state = DictionaryGetState(Dictionary);
+
+    if ((state != NULL) &&
+        (InterlockedDecrement(&state->References) == 0)) {
+
+        DictionaryFreeState(Dictionary, state);
+    }
+
+    return;
+}
+
+
 BOOLEAN
 TestDictionarySignature(
     IN PDICTIONARY Dictionary
@@ -70,37 +376,64 @@ AllocateDictionaryEntry(
     OUT PVOID *Entry
     )
 {
+    PDICTIONARY_STATE state;
+    PDICTIONARY_TABLE table;
+    PDICTIONARY_BUCKET bucket;
     PDICTIONARY_HEADER header;
+    PDICTIONARY_HEADER entry;
+    PSLIST_ENTRY freeEntry;
+    ULONG hash;
     KIRQL oldIrql;
-    PDICTIONARY_HEADER *entry;
+    BOOLEAN grow = FALSE;
 
     NTSTATUS status = STATUS_SUCCESS;
 
+    UNREFERENCED_PARAMETER(Size);
+    NT_ASSERT(Size <= sizeof(FILE_OBJECT_EXTENSION));
+
     *Entry = NULL;
 
-    header = ExAllocatePoolWithTag(NonPagedPoolNx,
-                                   Size + sizeof(DICTIONARY_HEADER),
-                                   Tag);
+    state = DictionaryGetState(Dictionary);
 
-    if(header == NULL) {
-        return STATUS_INSUFFICIENT_RESOURCES;
+    if (state == NULL) {
+        state = DictionaryCreateState(Dictionary);
+        if (state == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
     }
 
-    RtlZeroMemory(header, sizeof(DICTIONARY_HEADER) + Size);
-    header->Key = Key;
-
     //
-    // Find the correct location for this entry in the dictionary.
+    // Reuse a freed entry if there is one.
     //
 
-    KeAcquireSpinLock(&(Dictionary->SpinLock), &oldIrql);
+    freeEntry = InterlockedPopEntrySList(&state->FreeList);
+
+    if (freeEntry != NULL) {
+        header = CONTAINING_RECORD(freeEntry, DICTIONARY_HEADER, Data);
+    } else {
+        header = ExAllocatePoolWithTag(NonPagedPoolNx,
+                                       DICTIONARY_ENTRY_SIZE,
+                                       Tag);
+
+        if(header == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    RtlZeroMemory(header, DICTIONARY_ENTRY_SIZE);
+    header->Key = Key;
+
+    hash = DictionaryHash(Key);
+
+    KeAcquireSpinLock(&(state->Locks[hash % DICTIONARY_LOCKS].Lock), &oldIrql);
 
     TRY {
 
-        entry = &(Dictionary->List);
+        table = state->Table;
+        bucket = &table->Buckets[hash & table->Mask];
 
-        while(*entry != NULL) {
-            if((*entry)->Key == Key) {
+        for (entry = bucket->Head; entry != NULL; entry = entry->Next) {
+            if(entry->Key == Key) {
 
                 //
                 // Dictionary must have unique keys.
@@ -108,15 +441,6 @@ AllocateDictionaryEntry(
 
                 status = STATUS_OBJECT_NAME_COLLISION;
                 LEAVE;
-
-            } else if ((*entry)->Key < Key) {
-
-                //
-                // We will go ahead and insert the key in here.
-                //
-                break;
-            } else {
-                entry = &((*entry)->Next);
             }
         }
 
@@ -124,75 +448,149 @@ AllocateDictionaryEntry(
         // If we make it here then we will go ahead and do the insertion.
         //
 
-        header->Next = *entry;
-        *entry = header;
+        header->Next = bucket->Head;
+
+        bucket->Sequence++;
+        KeMemoryBarrier();
+        bucket->Head = header;
+        KeMemoryBarrier();
+        bucket->Sequence++;
+
+        if (((ULONG) InterlockedIncrement(&state->References) >
+                 DICTIONARY_LOAD_FACTOR * (table->Mask + 1)) &&
+            (table->Mask + 1 < DICTIONARY_MAX_BUCKETS)) {
+
+            grow = TRUE;
+        }
 
     } FINALLY {
-        KeReleaseSpinLock(&(Dictionary->SpinLock), oldIrql);
+        KeReleaseSpinLock(&(state->Locks[hash % DICTIONARY_LOCKS].Lock), oldIrql);
 
         if(!NT_SUCCESS(status)) {
-            FREE_POOL(header);
+            InterlockedPushEntrySList(&state->FreeList,
+                                      (PSLIST_ENTRY) header->Data);
         } else {
             *Entry = (PVOID) header->Data;
         }
     }
+
+    if (grow) {
+        DictionaryGrow(state, table);
+    }
+
     return status;
 }
 
-
+
 PVOID
 GetDictionaryEntry(
     IN PDICTIONARY Dictionary,
     IN ULONGLONG Key
     )
 {
+    PDICTIONARY_STATE state;
+    PDICTIONARY_TABLE table;
+    PDICTIONARY_BUCKET bucket;
     PDICTIONARY_HEADER entry;
     PVOID data;
-    KIRQL oldIrql;
+    LONG sequence;
+    ULONG hash;
 
+    state = DictionaryGetState(Dictionary);
 
-    data = NULL;
+    if (state == NULL) {
+        return NULL;
+    }
 
-    KeAcquireSpinLock(&(Dictionary->SpinLock), &oldIrql);
+    hash = DictionaryHash(Key);
 
-    entry = Dictionary->List;
-    while (entry != NULL) {
+    for (;;) {
 
-        if (entry->Key == Key) {
-            data = entry->Data;
-            break;
-        } else {
-            entry = entry->Next;
+        table = state->Table;
+        bucket = &table->Buckets[hash & table->Mask];
+
+        sequence = bucket->Sequence;
+
+        if (sequence & 1) {
+
+            //
+            // The chain is being changed, or the table is being grown.
+            //
+
+            YieldProcessor();
+            continue;
         }
-    }
 
-    KeReleaseSpinLock(&(Dictionary->SpinLock), oldIrql);
+        KeMemoryBarrier();
+
+        data = NULL;
+
+        for (entry = bucket->Head; entry != NULL; entry = entry->Next) {
 
-    return data;
+            //
+            // If the chain changed under us the entry may have moved to
+            // another chain, and we could go around in circles.
+            //
+
+            if (bucket->Sequence != sequence) {
+                break;
+            }
+
+            if (entry->Key == Key) {
+                data = entry->Data;
+                break;
+            }
+        }
+
+        KeMemoryBarrier();
+
+        if (bucket->Sequence == sequence) {
+            return data;
+        }
+    }
 }
 
-
+
 VOID
 FreeDictionaryEntry(
     IN PDICTIONARY Dictionary,
     IN PVOID Entry
     )
 {
+    PDICTIONARY_STATE state;
+    PDICTIONARY_TABLE table;
+    PDICTIONARY_BUCKET bucket;
     PDICTIONARY_HEADER header;
     PDICTIONARY_HEADER *entry;
+    ULONG hash;
     KIRQL oldIrql;
     BOOLEAN found;
 
     found = FALSE;
     header = CONTAINING_RECORD(Entry, DICTIONARY_HEADER, Data);
+    state = DictionaryGetState(Dictionary);
 
-    KeAcquireSpinLock(&(Dictionary->SpinLock), &oldIrql);
+    NT_ASSERT(state != NULL);
+    if (state == NULL) {
+        return;
+    }
+
+    hash = DictionaryHash(header->Key);
 
-    entry = &(Dictionary->List);
+    KeAcquireSpinLock(&(state->Locks[hash % DICTIONARY_LOCKS].Lock), &oldIrql);
+
+    table = state->Table;
+    bucket = &table->Buckets[hash & table->Mask];
+
+    entry = (PDICTIONARY_HEADER *) &(bucket->Head);
     while(*entry != NULL) {
 
         if(*entry == header) {
+            bucket->Sequence++;
+            KeMemoryBarrier();
             *entry = header->Next;
+            KeMemoryBarrier();
+            bucket->Sequence++;
             found = TRUE;
             break;
         } else {
@@ -200,7 +598,7 @@ FreeDictionaryEntry(
         }
     }
 
-    KeReleaseSpinLock(&(Dictionary->SpinLock), oldIrql);
+    KeReleaseSpinLock(&(state->Locks[hash % DICTIONARY_LOCKS].Lock), oldIrql);
 
     //
     // calling this w/an invalid pointer invalidates the dictionary system,
@@ -209,7 +607,18 @@ FreeDictionaryEntry(
 
     NT_ASSERT(found);
     if (found) {
-        FREE_POOL(header);
+
+        //
+        // Lookups may still be looking at the entry, so keep it for reuse
+        // rather than freeing it.
+        //
+
+        InterlockedPushEntrySList(&state->FreeList,
+                                  (PSLIST_ENTRY) header->Data);
+
+        if (InterlockedDecrement(&state->References) == 0) {
+            DictionaryFreeState(Dictionary, state);
+        }
     }
 
     return;
@@ -40,6 +40,164 @@ Revision History:
 ULONG MinWorkingSetTransferPackets = MIN_WORKINGSET_TRANSFER_PACKETS_Consumer;
 ULONG MaxWorkingSetTransferPackets = MAX_WORKINGSET_TRANSFER_PACKETS_Consumer;
 
+/*
+ *  TransferPacketCpuCache
+ *
+ *      Return the free packet cache of the current processor, or NULL if
+ *      there is none (the caches could not be allocated, or the processor
+ *      was hot-added after the device started).
+ */
+static
+__inline
+PTRANSFER_PACKET_CPU_CACHE
+TransferPacketCpuCache(PCLASS_PRIVATE_FDO_DATA FdoData)
+{
+    ULONG processor;
+
+    if (FdoData->TransferPacketCpuCaches == NULL) {
+        return NULL;
+    }
+
+    processor = KeGetCurrentProcessorNumberEx(NULL);
+    if (processor >= FdoData->NumTransferPacketCpuCaches) {
+        return NULL;
+    }
+
+    return &FdoData->TransferPacketCpuCaches[processor];
+}
+
+/*
+ *  PushCachedTransferPacket
+ *
+ *      Park a free packet in the given cache.  Returns FALSE if it is full.
+ */
+static
+BOOLEAN
+PushCachedTransferPacket(PTRANSFER_PACKET_CPU_CACHE Cache, PTRANSFER_PACKET Pkt)
+{
+    ULONG i;
+
+    for (i = 0; i < TRANSFER_PACKET_CPU_CACHE_DEPTH; i++) {
+        if ((Cache->Packets[i] == NULL) &&
+            (InterlockedCompareExchangePointer((PVOID volatile *)&Cache->Packets[i], Pkt, NULL) == NULL)) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/*
+ *  PopCachedTransferPacket
+ *
+ *      Take a packet out of the given cache.  Returns NULL if it is empty.
+ */
+static
+PTRANSFER_PACKET
+PopCachedTransferPacket(PTRANSFER_PACKET_CPU_CACHE Cache)
+{
+    PTRANSFER_PACKET pkt;
+    ULONG i;
+
+    for (i = 0; i < TRANSFER_PACKET_CPU_CACHE_DEPTH; i++) {
+        if (Cache->Packets[i] != NULL) {
+            pkt = InterlockedExchangePointer((PVOID volatile *)&Cache->Packets[i], NULL);
+            if (pkt != NULL) {
+                return pkt;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ *  StealCachedTransferPacket
+ *
+ *      Take a packet out of any processor's cache.  This is only used once
+ *      the global free list is empty, so that packets parked on idle
+ *      processors are reused (or trimmed) before new ones are allocated.
+ */
+static
+PTRANSFER_PACKET
+StealCachedTransferPacket(PCLASS_PRIVATE_FDO_DATA FdoData)
+{
+    PTRANSFER_PACKET pkt = NULL;
+    ULONG i;
+
+    for (i = 0; (i < FdoData->NumTransferPacketCpuCaches) && (pkt == NULL); i++) {
+        pkt = PopCachedTransferPacket(&FdoData->TransferPacketCpuCaches[i]);
+    }
+
+    return pkt;
+}
+
+/*
+ *  AllTransferPacketsFree
+ *
+ *      Returns TRUE if every packet is either on the global free list or
+ *      parked in a processor cache, i.e. the device has gone idle.
+ *      The caches are only walked when they could make up the difference.
+ */
+static
+BOOLEAN
+AllTransferPacketsFree(PCLASS_PRIVATE_FDO_DATA FdoData)
+{
+    ULONG numFree = FdoData->NumFreeTransferPackets;
+    ULONG numTotal = FdoData->NumTotalTransferPackets;
+    ULONG i, j;
+
+    if (numFree >= numTotal) {
+        return TRUE;
+    }
+
+    if (numTotal - numFree > FdoData->NumTransferPacketCpuCaches * TRANSFER_PACKET_CPU_CACHE_DEPTH) {
+        return FALSE;
+    }
+
+    for (i = 0; i < FdoData->NumTransferPacketCpuCaches; i++) {
+        for (j = 0; j < TRANSFER_PACKET_CPU_CACHE_DEPTH; j++) {
+            if (ReadPointerNoFence((PVOID volatile *)&FdoData->TransferPacketCpuCaches[i].Packets[j]) != NULL) {
+                numFree++;
+            }
+        }
+    }
+
+    return (numFree >= numTotal);
+}
+
+/*
+ *  AdaptTransferPacketWorkingSet
+ *
+ *      Called when the device goes idle.  Move the working set target up to
+ *      the peak number of packets that were outside the global free list
+ *      since the last idle point, or a quarter of the way down toward it,
+ *      and start a new sampling period.  The target stays within the
+ *      Local{Min,Max}WorkingSetTransferPackets limits.
+ *      This is a heuristic; races with concurrent completions are harmless.
+ */
+static
+VOID
+AdaptTransferPacketWorkingSet(PCLASS_PRIVATE_FDO_DATA FdoData)
+{
+    ULONG peak = FdoData->PeakOutstandingTransferPackets;
+    ULONG target = FdoData->WorkingSetTargetTransferPackets;
+
+    FdoData->PeakOutstandingTransferPackets = 0;
+
+    if (peak >= target) {
+        target = peak;
+    }
+    else {
+        target -= (target - peak + 3) / 4;
+    }
+
+    target = MAX(target, FdoData->LocalMinWorkingSetTransferPackets);
+    target = MIN(target, FdoData->LocalMaxWorkingSetTransferPackets);
+
+    FdoData->WorkingSetTargetTransferPackets = target;
+}
+
 /*
  *  InitializeTransferPackets
  *
@@ -71,6 +229,23 @@ NTSTATUS InitializeTransferPackets(PDEVICE_OBJECT Fdo)
     InitializeSListHead(&fdoData->FreeTransferPacketsList);
     InitializeListHead(&fdoData->AllTransferPacketsList);
 
+    /*
+     *  Allocate the per-processor packet caches.  These are only an
+     *  optimization; without them every packet goes through the global list.
+     */
+    fdoData->NumTransferPacketCpuCaches = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+    fdoData->TransferPacketCpuCaches = ExAllocatePoolWithTag(NonPagedPoolNxCacheAligned,
+                                                             fdoData->NumTransferPacketCpuCaches * sizeof(TRANSFER_PACKET_CPU_CACHE),
+                                                             'cpPC');
+    if (fdoData->TransferPacketCpuCaches != NULL) {
+        RtlZeroMemory(fdoData->TransferPacketCpuCaches,
+                      fdoData->NumTransferPacketCpuCaches * sizeof(TRANSFER_PACKET_CPU_CACHE));
+    }
+    else {
+        TracePrint((TRACE_LEVEL_WARNING, TRACE_FLAG_INIT, "InitializeTransferPackets: Failed to allocate per-processor packet caches."));
+        fdoData->NumTransferPacketCpuCaches = 0;
+    }
+
     /*
      *  Set the packet threshold numbers based on the Windows SKU.
      */
@@ -126,7 +301,14 @@ NTSTATUS InitializeTransferPackets(PDEVICE_OBJECT Fdo)
         // that's all the adjustments required/allowed
     } // end working set size special code
 
-    while (fdoData->NumFreeTransferPackets < MIN_INITIAL_TRANSFER_PACKETS){
+    fdoData->WorkingSetTargetTransferPackets = fdoData->LocalMinWorkingSetTransferPackets;
+    fdoData->PeakOutstandingTransferPackets = 0;
+
+    /*
+     *  Count total rather than free packets here;
+     *  the first few free packets land in the per-processor cache.
+     */
+    while (fdoData->NumTotalTransferPackets < MIN_INITIAL_TRANSFER_PACKETS){
         PTRANSFER_PACKET pkt = NewTransferPacket(Fdo);
         if (pkt){
             InterlockedIncrement((volatile LONG *)&fdoData->NumTotalTransferPackets);
@@ -203,6 +385,9 @@ VOID DestroyAllTransferPackets(PDEVICE_OBJECT Fdo)
 
     NT_ASSERT(fdoData->NumTotalTransferPackets == 0);
 
+    FREE_POOL(fdoData->TransferPacketCpuCaches);
+    fdoData->NumTransferPacketCpuCaches = 0;
+
     FREE_POOL(fdoData->SrbTemplate);
 }
 
@@ -395,28 +580,43 @@ VOID EnqueueFreeTransferPacket(PDEVICE_OBJECT Fdo, __drv_aliasesMem PTRANSFER_PA
 {
     PFUNCTIONAL_DEVICE_EXTENSION fdoExt = Fdo->DeviceExtension;
     PCLASS_PRIVATE_FDO_DATA fdoData = fdoExt->PrivateFdoData;
+    PTRANSFER_PACKET_CPU_CACHE cache;
     KIRQL oldIrql;
 
     NT_ASSERT(!Pkt->SlistEntry.Next);
 
+    /*
+     *  Keep the packet on this processor if its cache has room.
+     *  The working set is not re-evaluated on this path; the caches are small
+     *  and fill up quickly once stress ends, after which completions go to the
+     *  global list below and the trimming logic runs as before.
+     */
+    cache = TransferPacketCpuCache(fdoData);
+    if ((cache != NULL) && PushCachedTransferPacket(cache, Pkt)) {
+        return;
+    }
+
     InterlockedPushEntrySList(&fdoData->FreeTransferPacketsList, &Pkt->SlistEntry);
     InterlockedIncrement((volatile LONG *)&fdoData->NumFreeTransferPackets);
 
     /*
-     *  If the total number of packets is larger than LocalMinWorkingSetTransferPackets,
+     *  If the total number of packets is larger than WorkingSetTargetTransferPackets,
      *  that means that we've been in stress.  If all those packets are now
      *  free, then we are now out of stress and can free the extra packets.
-     *  Attempt to free down to LocalMaxWorkingSetTransferPackets immediately, and
-     *  down to LocalMinWorkingSetTransferPackets lazily (one at a time).
+     *  The target itself is adapted to the load seen since the last idle point.
+     *  Attempt to free down to the target immediately if we are above
+     *  LocalMaxWorkingSetTransferPackets, and otherwise lazily (one at a time).
      *  However, since we're at DPC, do this is a work item. If the device is removed
      *  or we are unable to allocate the work item, do NOT free more than
      *  MAX_CLEANUP_TRANSFER_PACKETS_AT_ONCE. Subsequent IO completions will end up freeing
      *  up the rest, even if it is MAX_CLEANUP_TRANSFER_PACKETS_AT_ONCE at a time.
      */
-    if (fdoData->NumFreeTransferPackets >= fdoData->NumTotalTransferPackets) {
+    if (AllTransferPacketsFree(fdoData)) {
+
+        AdaptTransferPacketWorkingSet(fdoData);
 
         /*
-         *  1.  Immediately snap down to our UPPER threshold.
+         *  1.  If above our UPPER threshold, immediately snap down to the target.
          */
         if (fdoData->NumTotalTransferPackets > fdoData->LocalMaxWorkingSetTransferPackets) {
 
@@ -464,9 +664,9 @@ VOID EnqueueFreeTransferPacket(PDEVICE_OBJECT Fdo, __drv_aliasesMem PTRANSFER_PA
         }
 
         /*
-         *  2.  Lazily work down to our LOWER threshold (by only freeing one packet at a time).
+         *  2.  Lazily work down to the target (by only freeing one packet at a time).
          */
-        if (fdoData->NumTotalTransferPackets > fdoData->LocalMinWorkingSetTransferPackets){
+        if (fdoData->NumTotalTransferPackets > fdoData->WorkingSetTargetTransferPackets){
             /*
              *  Check the counter again with lock held.  This eliminates a race condition
              *  while still allowing us to not grab the spinlock in the common codepath.
@@ -478,18 +678,18 @@ VOID EnqueueFreeTransferPacket(PDEVICE_OBJECT Fdo, __drv_aliasesMem PTRANSFER_PA
              */
             PTRANSFER_PACKET pktToDelete = NULL;
 
-            TracePrint((TRACE_LEVEL_INFORMATION, TRACE_FLAG_RW, "Exiting stress, lazily freeing one of %d/%d packets.", fdoData->NumTotalTransferPackets, fdoData->LocalMinWorkingSetTransferPackets));
+            TracePrint((TRACE_LEVEL_INFORMATION, TRACE_FLAG_RW, "Exiting stress, lazily freeing one of %d/%d packets.", fdoData->NumTotalTransferPackets, fdoData->WorkingSetTargetTransferPackets));
 
             KeAcquireSpinLock(&fdoData->SpinLock, &oldIrql);
-            if ((fdoData->NumFreeTransferPackets >= fdoData->NumTotalTransferPackets) &&
-                (fdoData->NumTotalTransferPackets > fdoData->LocalMinWorkingSetTransferPackets)){
+            if (AllTransferPacketsFree(fdoData) &&
+                (fdoData->NumTotalTransferPackets > fdoData->WorkingSetTargetTransferPackets)){
 
                 pktToDelete = DequeueFreeTransferPacket(Fdo, FALSE);
                 if (pktToDelete){
                     InterlockedDecrement((volatile LONG *)&fdoData->NumTotalTransferPackets);
                 }
                 else {
-                    TracePrint((TRACE_LEVEL_INFORMATION, TRACE_FLAG_RW, "Extremely unlikely condition (non-fatal): %d packets dequeued at once for Fdo %p. NumTotalTransferPackets=%d (2).", fdoData->LocalMinWorkingSetTransferPackets, Fdo, fdoData->NumTotalTransferPackets));
+                    TracePrint((TRACE_LEVEL_INFORMATION, TRACE_FLAG_RW, "Extremely unlikely condition (non-fatal): %d packets dequeued at once for Fdo %p. NumTotalTransferPackets=%d (2).", fdoData->WorkingSetTargetTransferPackets, Fdo, fdoData->NumTotalTransferPackets));
                 }
             }
             KeReleaseSpinLock(&fdoData->SpinLock, oldIrql);
@@ -507,18 +707,45 @@ PTRANSFER_PACKET DequeueFreeTransferPacket(PDEVICE_OBJECT Fdo, BOOLEAN AllocIfNe
 {
     PFUNCTIONAL_DEVICE_EXTENSION fdoExt = Fdo->DeviceExtension;
     PCLASS_PRIVATE_FDO_DATA fdoData = fdoExt->PrivateFdoData;
-    PTRANSFER_PACKET pkt;
+    PTRANSFER_PACKET_CPU_CACHE cache;
+    PTRANSFER_PACKET pkt = NULL;
     PSLIST_ENTRY slistEntry;
+    ULONG numFree, numTotal;
+
+    /*
+     *  Try this processor's cache first, then the global list,
+     *  then the caches of the other processors.
+     */
+    cache = TransferPacketCpuCache(fdoData);
+    if (cache != NULL) {
+        pkt = PopCachedTransferPacket(cache);
+    }
+
+    if (pkt == NULL) {
+        slistEntry = InterlockedPopEntrySList(&fdoData->FreeTransferPacketsList);
+        if (slistEntry){
+            slistEntry->Next = NULL;
+            pkt = CONTAINING_RECORD(slistEntry, TRANSFER_PACKET, SlistEntry);
+            numFree = (ULONG)InterlockedDecrement((volatile LONG *)&fdoData->NumFreeTransferPackets);
+            numTotal = fdoData->NumTotalTransferPackets;
 
-    slistEntry = InterlockedPopEntrySList(&fdoData->FreeTransferPacketsList);
-    if (slistEntry){
-        slistEntry->Next = NULL;
-        pkt = CONTAINING_RECORD(slistEntry, TRANSFER_PACKET, SlistEntry);
-        InterlockedDecrement((volatile LONG *)&fdoData->NumFreeTransferPackets);
+            /*
+             *  Sample the load for the adaptive working set.  Packets in the
+             *  processor caches count as outstanding, since we want to keep them.
+             */
+            if ((numTotal > numFree) &&
+                (numTotal - numFree > fdoData->PeakOutstandingTransferPackets)) {
+                fdoData->PeakOutstandingTransferPackets = numTotal - numFree;
+            }
+        }
+        else {
+            pkt = StealCachedTransferPacket(fdoData);
+        }
+    }
 
+    if (pkt){
         // when dequeue'ing the packet, also reset the history data
         HISTORYINITIALIZERETRYLOGS(pkt);
-
     }
     else {
         if (AllocIfNeeded){
@@ -530,16 +757,16 @@ PTRANSFER_PACKET DequeueFreeTransferPacket(PDEVICE_OBJECT Fdo, BOOLEAN AllocIfNe
              */
             pkt = NewTransferPacket(Fdo);
             if (pkt){
-                InterlockedIncrement((volatile LONG *)&fdoData->NumTotalTransferPackets);
+                numTotal = (ULONG)InterlockedIncrement((volatile LONG *)&fdoData->NumTotalTransferPackets);
                 fdoData->DbgPeakNumTransferPackets = max(fdoData->DbgPeakNumTransferPackets, fdoData->NumTotalTransferPackets);
+                if (numTotal > fdoData->PeakOutstandingTransferPackets) {
+                    fdoData->PeakOutstandingTransferPackets = numTotal;
+                }
             }
             else {
                 TracePrint((TRACE_LEVEL_WARNING, TRACE_FLAG_RW, "DequeueFreeTransferPacket: packet allocation failed"));
             }
         }
-        else {
-            pkt = NULL;
-        }
     }
 
     return pkt;
@@ -1425,7 +1652,8 @@ CleanupTransferPacketToWorkingSetSize(
 Routine Description:
 
     This function frees the resources for the free transfer packets attempting
-    to bring them down within the working set size.
+    to bring them down to the adaptive working set target
+    (WorkingSetTargetTransferPackets).
 
 Arguments:
     Fdo: The FDO that represents the device whose transfer packet size needs to be trimmed.
@@ -1440,7 +1668,9 @@ Arguments:
     SINGLE_LIST_ENTRY pktList;
     PSINGLE_LIST_ENTRY slistEntry;
     PTRANSFER_PACKET pktToDelete;
-    ULONG requiredNumPktToDelete = fdoData->NumTotalTransferPackets - fdoData->LocalMaxWorkingSetTransferPackets;
+    ULONG targetNumPkts = fdoData->WorkingSetTargetTransferPackets;
+    ULONG numTotalPkts = fdoData->NumTotalTransferPackets;
+    ULONG requiredNumPktToDelete = (numTotalPkts > targetNumPkts) ? (numTotalPkts - targetNumPkts) : 0;
 
     if (LimitNumPktToDelete) {
         requiredNumPktToDelete = MIN(requiredNumPktToDelete, MAX_CLEANUP_TRANSFER_PACKETS_AT_ONCE);
@@ -1456,22 +1686,24 @@ Arguments:
      *  packets to send (DequeueFreeTransferPacket does that with a lightweight
      *  interlocked exchange); the spinlock prevents multiple threads in this function
      *  from deciding to free too many extra packets at once.
+     *  The idle check walks the processor caches, so it is made once up front.
      */
     SimpleInitSlistHdr(&pktList);
     KeAcquireSpinLock(&fdoData->SpinLock, &oldIrql);
-    while ((fdoData->NumFreeTransferPackets >= fdoData->NumTotalTransferPackets) &&
-           (fdoData->NumTotalTransferPackets > fdoData->LocalMaxWorkingSetTransferPackets) &&
-           (requiredNumPktToDelete--)){
-
-        pktToDelete = DequeueFreeTransferPacket(Fdo, FALSE);
-        if (pktToDelete){
-            SimplePushSlist(&pktList,
-                            (PSINGLE_LIST_ENTRY)&pktToDelete->SlistEntry);
-            InterlockedDecrement((volatile LONG *)&fdoData->NumTotalTransferPackets);
-        }
-        else {
-            TracePrint((TRACE_LEVEL_INFORMATION, TRACE_FLAG_RW, "Extremely unlikely condition (non-fatal): %d packets dequeued at once for Fdo %p. NumTotalTransferPackets=%d (1).", fdoData->LocalMaxWorkingSetTransferPackets, Fdo, fdoData->NumTotalTransferPackets));
-            break;
+    if (AllTransferPacketsFree(fdoData)) {
+        while ((fdoData->NumTotalTransferPackets > targetNumPkts) &&
+               (requiredNumPktToDelete--)){
+
+            pktToDelete = DequeueFreeTransferPacket(Fdo, FALSE);
+            if (pktToDelete){
+                SimplePushSlist(&pktList,
+                                (PSINGLE_LIST_ENTRY)&pktToDelete->SlistEntry);
+                InterlockedDecrement((volatile LONG *)&fdoData->NumTotalTransferPackets);
+            }
+            else {
+                TracePrint((TRACE_LEVEL_INFORMATION, TRACE_FLAG_RW, "Extremely unlikely condition (non-fatal): %d packets dequeued at once for Fdo %p. NumTotalTransferPackets=%d (1).", targetNumPkts, Fdo, fdoData->NumTotalTransferPackets));
+                break;
+            }
         }
     }
     KeReleaseSpinLock(&fdoData->SpinLock, oldIrql);
@@ -34,6 +34,8 @@ Notes:
 
 #include "ntstrsafe.h"
 
+#include "diskperf.h"
+
 #ifdef POOL_TAGGING
 #ifdef ExAllocatePool
 #undef ExAllocatePool
@@ -43,6 +45,21 @@ Notes:
 
 #define DISKPERF_MAXSTR         64
 
+//
+// Latency histograms, kept per processor.  Each processor only updates its
+// own, so no locks or interlocked operations are needed, and they are
+// summed when queried.  The size is a multiple of the cache line size so
+// processors don't share lines.
+//
+
+typedef struct _DISKPERF_LATENCY_COUNTERS {
+
+    ULONG Counts[DISKPERF_DIRECTIONS][DISKPERF_SIZE_CLASSES][DISKPERF_LATENCY_BUCKETS];
+
+} DISKPERF_LATENCY_COUNTERS, *PDISKPERF_LATENCY_COUNTERS;
+
+C_ASSERT((sizeof(DISKPERF_LATENCY_COUNTERS) % SYSTEM_CACHE_ALIGNMENT_SIZE) == 0);
+
 //
 // Device Extension
 //
@@ -97,6 +114,8 @@ typedef struct _DEVICE_EXTENSION {
 
     ULONG   Processors;
     PDISK_PERFORMANCE DiskCounters;    // per processor counters
+    PDISKPERF_LATENCY_COUNTERS Histograms;  // per processor histograms
+    LARGE_INTEGER Frequency;           // clock ticks per second
     LARGE_INTEGER LastIdleClock;
     LONG QueueDepth;
     LONG CountersEnabled;
@@ -134,6 +153,19 @@ where PROCESSOR_COUNTERS_SIZE is less than sizeof(DISK_PERFORMANCE) since
 we only put those we actually use for counting.
 */
 
+//
+// Per processor latency histograms are laid out the same way, one
+// DISKPERF_LATENCY_COUNTERS per processor.
+//
+
+ULONG DiskPerfSizeClassLimit[DISKPERF_SIZE_CLASSES] =
+{
+    4 * 1024,
+    64 * 1024,
+    1024 * 1024,
+    MAXULONG
+};
+
 UNICODE_STRING DiskPerfRegistryPath;
 
 
@@ -213,6 +245,27 @@ DiskPerfAddCounters(
     IN LARGE_INTEGER Frequency
     );
 
+VOID
+DiskPerfEnableCountersAlways(
+    IN PDEVICE_EXTENSION DeviceExtension
+    );
+
+ULONG
+DiskPerfLatencyBucket(
+    IN ULONGLONG Microseconds
+    );
+
+ULONG
+DiskPerfSizeClass(
+    IN ULONG Length
+    );
+
+VOID
+DiskPerfAddHistograms(
+    IN PDEVICE_EXTENSION DeviceExtension,
+    OUT PDISK_LATENCY_HISTOGRAM Histogram
+    );
+
 #if DBG
 
 ULONG DiskPerfDebug = 0;
@@ -257,6 +310,11 @@ WMIGUIDREGINFO DiskperfGuidList[] =
     { &DiskPerfGuid,
       1,
       0
+    },
+
+    { &DiskPerfHistogramGuid,
+      1,
+      0
     }
 };
 
@@ -439,6 +497,11 @@ Return Value:
 
     RtlZeroMemory(deviceExtension, DEVICE_EXTENSION_SIZE);
     DiskPerfGetClock(deviceExtension->LastIdleClock, NULL);
+#ifdef USE_PERF_CTR
+    KeQueryPerformanceCounter(&deviceExtension->Frequency);
+#else
+    deviceExtension->Frequency.QuadPart = 10000000;
+#endif
     DebugPrint((10, "DiskPerfAddDevice: LIC=%I64u\n",
                     deviceExtension->LastIdleClock));
 
@@ -472,6 +535,24 @@ Return Value:
             IO_ERR_INSUFFICIENT_RESOURCES);
     }
 
+    //
+    // Allocate per processor latency histograms
+    //
+
+    buffersize = sizeof(DISKPERF_LATENCY_COUNTERS) * deviceExtension->Processors;
+    buffer = (PCHAR) ExAllocatePool(NonPagedPool, buffersize);
+    if (buffer != NULL) {
+        RtlZeroMemory(buffer, buffersize);
+        deviceExtension->Histograms = (PDISKPERF_LATENCY_COUNTERS) buffer;
+    }
+    else {
+        DiskPerfLogError(
+            filterDeviceObject,
+            514,
+            STATUS_SUCCESS,
+            IO_ERR_INSUFFICIENT_RESOURCES);
+    }
+
     //
     // Attaches the device object to the highest device object in the chain and
     // return the previously highest device object, which is passed to
@@ -484,8 +565,14 @@ Return Value:
         IoAttachDeviceToDeviceStack(filterDeviceObject, PhysicalDeviceObject);
 
     if (deviceExtension->TargetDeviceObject == NULL) {
-        ExFreePool(deviceExtension->DiskCounters);
-        deviceExtension->DiskCounters = NULL;
+        if (deviceExtension->DiskCounters != NULL) {
+            ExFreePool(deviceExtension->DiskCounters);
+            deviceExtension->DiskCounters = NULL;
+        }
+        if (deviceExtension->Histograms != NULL) {
+            ExFreePool(deviceExtension->Histograms);
+            deviceExtension->Histograms = NULL;
+        }
         IoDeleteDevice(filterDeviceObject);
         DebugPrint((1, "DiskPerfAddDevice: Unable to attach 0x%p to target 0x%p\n",
             filterDeviceObject, PhysicalDeviceObject));
@@ -925,6 +1012,10 @@ Return Value:
     if (deviceExtension->DiskCounters) {
         ExFreePool(deviceExtension->DiskCounters);
     }
+
+    if (deviceExtension->Histograms) {
+        ExFreePool(deviceExtension->Histograms);
+    }
     
     //
     // Call Remove lock and wait to ensure all outstanding operations
@@ -1205,10 +1296,12 @@ Return Value:
     IoCopyCurrentIrpStackLocationToNext(Irp);
 
     //
-    // Time stamp current request start.
+    // Time stamp current request start.  The next stack location has the
+    // parameters now, so ours are free to use; the time stamp goes over
+    // the byte offset, leaving the length for the completion routine.
     //
 
-    timeStamp = (PLARGE_INTEGER) &currentIrpStack->Parameters.Read;
+    timeStamp = &currentIrpStack->Parameters.Read.ByteOffset;
     DiskPerfGetClock(*timeStamp, NULL);
     DebugPrint((10, "DiskPerfReadWrite: TS=%I64u\n", *timeStamp));
 
@@ -1277,8 +1370,10 @@ Return Value:
     ULONG              processor         = KeGetCurrentProcessorNumber();
 #endif
     PDISK_PERFORMANCE  partitionCounters = NULL;
+    PDISKPERF_LATENCY_COUNTERS histogram;
     LARGE_INTEGER      timeStampComplete;
     PLARGE_INTEGER     difference;
+    ULONGLONG          latency;
     LONG               queueLen;
 
     UNREFERENCED_PARAMETER(Context);
@@ -1291,7 +1386,7 @@ Return Value:
     // Time stamp current request complete.
     //
 
-    difference = (PLARGE_INTEGER) &irpStack->Parameters.Read;
+    difference = &irpStack->Parameters.Read.ByteOffset;
     DiskPerfGetClock(timeStampComplete, NULL);
     difference->QuadPart = timeStampComplete.QuadPart - difference->QuadPart;
     DebugPrint((10, "DiskPerfIoCompletion: TS=%I64u diff %I64u\n",
@@ -1388,6 +1483,28 @@ Return Value:
         partitionCounters->SplitCount++;
     }
 
+    //
+    // Count the request in the latency histogram for its direction and
+    // size.  The histograms have the same per processor layout as the
+    // counters.
+    //
+
+    if (deviceExtension->Histograms != NULL) {
+
+        histogram = deviceExtension->Histograms + processor;
+
+        latency = 0;
+        if (difference->QuadPart > 0) {
+            latency = (ULONGLONG) difference->QuadPart * 1000000 /
+                      (ULONGLONG) deviceExtension->Frequency.QuadPart;
+        }
+
+        histogram->Counts[(irpStack->MajorFunction == IRP_MJ_READ) ?
+                            DISKPERF_READ : DISKPERF_WRITE]
+                         [DiskPerfSizeClass(irpStack->Parameters.Read.Length)]
+                         [DiskPerfLatencyBucket(latency)]++;
+    }
+
     //
     // Release the remove lock
     //
@@ -1486,25 +1603,7 @@ Return Value:
                 return STATUS_UNSUCCESSFUL;
             }
 
-            if (InterlockedCompareExchange(&deviceExtension->EnabledAlways, 1, 0) == 0)
-            {
-                InterlockedIncrement(&deviceExtension->CountersEnabled);
-
-                //
-                // reset per processor counters only
-                //
-                if (deviceExtension->DiskCounters != NULL)
-                {
-                    RtlZeroMemory(deviceExtension->DiskCounters, PROCESSOR_COUNTERS_SIZE * deviceExtension->Processors);
-                }
-
-                DiskPerfGetClock(deviceExtension->LastIdleClock, NULL);
-
-                deviceExtension->QueueDepth = 0;
-
-                DebugPrint((10, "DiskPerfDeviceControl: LIC=%I64u\n", deviceExtension->LastIdleClock));
-                DebugPrint((3, "DiskPerfDeviceControl: Counters enabled %d\n", deviceExtension->CountersEnabled));
-            }
+            DiskPerfEnableCountersAlways(deviceExtension);
 
             totalCounters = (PDISK_PERFORMANCE) Irp->AssociatedIrp.SystemBuffer;
             RtlZeroMemory(totalCounters, sizeof(DISK_PERFORMANCE));
@@ -1563,6 +1662,48 @@ Return Value:
 
     }
 
+    else if (currentIrpStack->Parameters.DeviceIoControl.IoControlCode ==
+             IOCTL_DISK_PERFORMANCE_HISTOGRAM) {
+
+        //
+        // Verify user buffer is large enough for the histograms.
+        //
+
+        if (currentIrpStack->Parameters.DeviceIoControl.OutputBufferLength <
+                sizeof(DISK_LATENCY_HISTOGRAM)) {
+
+            status = STATUS_BUFFER_TOO_SMALL;
+            Irp->IoStatus.Information = 0;
+        }
+
+        else if (deviceExtension->Histograms == NULL) {
+
+            status = STATUS_UNSUCCESSFUL;
+            Irp->IoStatus.Information = 0;
+        }
+
+        else {
+
+            //
+            // Like IOCTL_DISK_PERFORMANCE, the first query turns counting
+            // on for good.
+            //
+
+            DiskPerfEnableCountersAlways(deviceExtension);
+
+            DiskPerfAddHistograms(deviceExtension,
+                                  (PDISK_LATENCY_HISTOGRAM) Irp->AssociatedIrp.SystemBuffer);
+
+            status = STATUS_SUCCESS;
+            Irp->IoStatus.Information = sizeof(DISK_LATENCY_HISTOGRAM);
+        }
+
+        Irp->IoStatus.Status = status;
+        IoReleaseRemoveLock(&deviceExtension->RemoveLock, Irp);
+        IoCompleteRequest(Irp, IO_NO_INCREMENT);
+        return status;
+    }
+
     else {
 
         //
@@ -2328,6 +2469,26 @@ Return Value:
             status = STATUS_BUFFER_TOO_SMALL;
         }
 
+    } else if (GuidIndex == 1) {
+
+        sizeNeeded = sizeof(DISK_LATENCY_HISTOGRAM);
+        if (deviceExtension->Histograms == NULL)
+        {
+            status = STATUS_UNSUCCESSFUL;
+        }
+        else if ((BufferAvail >= sizeNeeded) && (Buffer != NULL))
+        {
+            DiskPerfAddHistograms(deviceExtension,
+                                  (PDISK_LATENCY_HISTOGRAM) Buffer);
+            if (InstanceLengthArray) {
+                *InstanceLengthArray = sizeNeeded;
+            }
+
+            status = STATUS_SUCCESS;
+        } else {
+            status = STATUS_BUFFER_TOO_SMALL;
+        }
+
     } else {
         status = STATUS_WMI_GUID_NOT_FOUND;
         sizeNeeded = 0;
@@ -2386,7 +2547,12 @@ Return Value:
 
     deviceExtension = DeviceObject->DeviceExtension;
 
-    if (GuidIndex == 0)
+    //
+    // Both data blocks come from the same counters, so each enable of
+    // either one counts.
+    //
+
+    if (GuidIndex == 0 || GuidIndex == 1)
     {
         if (Function == WmiDataBlockControl) {
           if (Enable) {
@@ -2399,6 +2565,11 @@ Return Value:
                         deviceExtension->DiskCounters,
                         PROCESSOR_COUNTERS_SIZE * deviceExtension->Processors);
                 }
+                if (deviceExtension->Histograms != NULL) {
+                    RtlZeroMemory(
+                        deviceExtension->Histograms,
+                        sizeof(DISKPERF_LATENCY_COUNTERS) * deviceExtension->Processors);
+                }
                 DiskPerfGetClock(deviceExtension->LastIdleClock, NULL);
                 DebugPrint((10,
                     "DiskPerfWmiFunctionControl: LIC=%I64u\n",
@@ -2462,6 +2633,186 @@ DiskPerfAddCounters(
     }
 }
 
+
+VOID
+DiskPerfEnableCountersAlways(
+    IN PDEVICE_EXTENSION DeviceExtension
+    )
+/*++
+
+Routine Description:
+
+    Turns counting on for good the first time an application queries the
+    counters through a device control, resetting them.
+
+Arguments:
+
+    DeviceExtension - the device extension of the filter device
+
+Return Value:
+
+    None
+
+--*/
+{
+    if (InterlockedCompareExchange(&DeviceExtension->EnabledAlways, 1, 0) == 0)
+    {
+        InterlockedIncrement(&DeviceExtension->CountersEnabled);
+
+        //
+        // reset per processor counters only
+        //
+        if (DeviceExtension->DiskCounters != NULL)
+        {
+            RtlZeroMemory(DeviceExtension->DiskCounters, PROCESSOR_COUNTERS_SIZE * DeviceExtension->Processors);
+        }
+
+        if (DeviceExtension->Histograms != NULL)
+        {
+            RtlZeroMemory(DeviceExtension->Histograms, sizeof(DISKPERF_LATENCY_COUNTERS) * DeviceExtension->Processors);
+        }
+
+        DiskPerfGetClock(DeviceExtension->LastIdleClock, NULL);
+
+        DeviceExtension->QueueDepth = 0;
+
+        DebugPrint((10, "DiskPerfEnableCountersAlways: LIC=%I64u\n", DeviceExtension->LastIdleClock));
+        DebugPrint((3, "DiskPerfEnableCountersAlways: Counters enabled %d\n", DeviceExtension->CountersEnabled));
+    }
+}
+
+
+ULONG
+DiskPerfLatencyBucket(
+    IN ULONGLONG Microseconds
+    )
+/*++
+
+Routine Description:
+
+    Returns the histogram bucket for a latency.  See diskperf.h for how
+    the buckets are laid out.
+
+Arguments:
+
+    Microseconds - the latency
+
+Return Value:
+
+    The bucket index
+
+--*/
+{
+    ULONG exponent;
+
+    if (Microseconds < DISKPERF_SUB_BUCKETS) {
+        return (ULONG) Microseconds;
+    }
+
+    if (Microseconds >= (1ULL << DISKPERF_MAX_LATENCY_BITS)) {
+        return DISKPERF_LATENCY_BUCKETS - 1;
+    }
+
+    //
+    // The top bit picks the power of 2, the next DISKPERF_SUB_BUCKET_BITS
+    // bits the bucket within it.
+    //
+
+    _BitScanReverse(&exponent, (ULONG) Microseconds);
+
+    return ((exponent - DISKPERF_SUB_BUCKET_BITS + 1) * DISKPERF_SUB_BUCKETS) +
+           ((ULONG) (Microseconds >> (exponent - DISKPERF_SUB_BUCKET_BITS)) &
+               (DISKPERF_SUB_BUCKETS - 1));
+}
+
+
+ULONG
+DiskPerfSizeClass(
+    IN ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    Returns the histogram size class for a transfer length.
+
+Arguments:
+
+    Length - the transfer length in bytes
+
+Return Value:
+
+    The size class
+
+--*/
+{
+    ULONG i;
+
+    for (i = 0; i < DISKPERF_SIZE_CLASSES - 1; i++) {
+        if (Length <= DiskPerfSizeClassLimit[i]) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+
+VOID
+DiskPerfAddHistograms(
+    IN PDEVICE_EXTENSION DeviceExtension,
+    OUT PDISK_LATENCY_HISTOGRAM Histogram
+    )
+/*++
+
+Routine Description:
+
+    Sums the per processor latency histograms into one.  The counts are
+    read while they are being updated, so the result is a snapshot that
+    may be slightly out of date, the same as the other counters.
+
+Arguments:
+
+    DeviceExtension - the device extension of the filter device
+
+    Histogram - receives the summed histograms
+
+Return Value:
+
+    None
+
+--*/
+{
+    PDISKPERF_LATENCY_COUNTERS histograms = DeviceExtension->Histograms;
+    PULONG counts;
+    PULONGLONG totals;
+    ULONG i, j;
+
+    RtlZeroMemory(Histogram, sizeof(DISK_LATENCY_HISTOGRAM));
+
+    KeQuerySystemTime(&Histogram->QueryTime);
+    Histogram->StorageDeviceNumber = DeviceExtension->DiskNumber;
+    Histogram->BucketCount = DISKPERF_LATENCY_BUCKETS;
+    Histogram->SubBucketBits = DISKPERF_SUB_BUCKET_BITS;
+    Histogram->SizeClassCount = DISKPERF_SIZE_CLASSES;
+    RtlCopyMemory(Histogram->SizeClassLimit,
+                  DiskPerfSizeClassLimit,
+                  sizeof(DiskPerfSizeClassLimit));
+
+    //
+    // Both arrays have the same shape, so add them up as flat arrays.
+    //
+
+    totals = &Histogram->Counts[0][0][0];
+
+    for (i = 0; i < DeviceExtension->Processors; i++) {
+        counts = &histograms[i].Counts[0][0][0];
+        for (j = 0; j < DISKPERF_DIRECTIONS * DISKPERF_SIZE_CLASSES * DISKPERF_LATENCY_BUCKETS; j++) {
+            totals[j] += counts[j];
+        }
+    }
+}
+
 #if DBG
 
 VOID
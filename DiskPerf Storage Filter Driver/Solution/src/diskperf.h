@@ -0,0 +1,107 @@
+/*++
+Copyright (C) Microsoft Corporation, 1991 - 1999
+
+Module Name:
+
+    diskperf.h
+
+Abstract:
+
+    Declarations shared by the disk performance driver and the applications
+    that read its latency histograms.
+
+    Every completed read and write is counted in a latency histogram for
+    its direction and transfer size.  The histograms are read through
+    IOCTL_DISK_PERFORMANCE_HISTOGRAM, or through the WMI data block
+    DiskPerfHistogramGuid, both of which return a DISK_LATENCY_HISTOGRAM.
+
+    Latencies are in microseconds.  Below DISKPERF_SUB_BUCKETS each
+    microsecond has its own bucket; above, each power of 2 is split into
+    DISKPERF_SUB_BUCKETS buckets, so a bucket is never more than 1/8 of
+    its value wide.  Latencies of DISKPERF_MAX_LATENCY_BITS bits or more
+    are counted in the last bucket.  To find, say, the p99 latency, add up
+    the counts from bucket 0 until they reach 99% of the total; the answer
+    lies between the lower bounds of that bucket and the next.
+
+Environment:
+
+    kernel and user mode
+
+--*/
+
+#ifndef __DISKPERF_H__
+#define __DISKPERF_H__
+
+//
+// {D07CAA59-B00C-4EC5-9B14-A1AF4C68A2F3}
+//
+
+DEFINE_GUID(DiskPerfHistogramGuid,
+    0xd07caa59, 0xb00c, 0x4ec5, 0x9b, 0x14, 0xa1, 0xaf, 0x4c, 0x68, 0xa2, 0xf3);
+
+#define IOCTL_DISK_PERFORMANCE_HISTOGRAM \
+    CTL_CODE(IOCTL_DISK_BASE, 0x0800, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+#define DISKPERF_SUB_BUCKET_BITS    3
+#define DISKPERF_SUB_BUCKETS        (1 << DISKPERF_SUB_BUCKET_BITS)
+#define DISKPERF_MAX_LATENCY_BITS   27      // about 134 seconds
+
+#define DISKPERF_LATENCY_BUCKETS \
+    ((DISKPERF_MAX_LATENCY_BITS - DISKPERF_SUB_BUCKET_BITS + 1) * DISKPERF_SUB_BUCKETS)
+
+//
+// The smallest latency, in microseconds, counted in the given bucket.
+//
+
+#define DISKPERF_BUCKET_LOWER_BOUND(i)                                  \
+    (((i) < DISKPERF_SUB_BUCKETS) ?                                     \
+        (ULONGLONG) (i) :                                               \
+        ((ULONGLONG) (DISKPERF_SUB_BUCKETS + ((i) % DISKPERF_SUB_BUCKETS)) \
+            << ((i) / DISKPERF_SUB_BUCKETS - 1)))
+
+//
+// Transfers are split by direction and by size: up to 4KB, up to 64KB,
+// up to 1MB and anything larger.
+//
+
+#define DISKPERF_READ               0
+#define DISKPERF_WRITE              1
+#define DISKPERF_DIRECTIONS         2
+
+#define DISKPERF_SIZE_CLASSES       4
+
+typedef struct _DISK_LATENCY_HISTOGRAM {
+
+    //
+    // When the histograms were read
+    //
+
+    LARGE_INTEGER QueryTime;
+
+    //
+    // Same as DISK_PERFORMANCE.StorageDeviceNumber
+    //
+
+    ULONG StorageDeviceNumber;
+
+    //
+    // Layout of Counts, so an application can check it was built with the
+    // same definitions as the driver.
+    //
+
+    ULONG BucketCount;              // DISKPERF_LATENCY_BUCKETS
+    ULONG SubBucketBits;            // DISKPERF_SUB_BUCKET_BITS
+    ULONG SizeClassCount;           // DISKPERF_SIZE_CLASSES
+
+    //
+    // Largest transfer, in bytes, in each size class.  The last one
+    // is MAXULONG.
+    //
+
+    ULONG SizeClassLimit[DISKPERF_SIZE_CLASSES];
+
+    ULONGLONG Counts[DISKPERF_DIRECTIONS][DISKPERF_SIZE_CLASSES][DISKPERF_LATENCY_BUCKETS];
+
+} DISK_LATENCY_HISTOGRAM, *PDISK_LATENCY_HISTOGRAM;
+
+#endif // __DISKPERF_H__
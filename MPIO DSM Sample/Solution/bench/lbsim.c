@@ -0,0 +1,1139 @@
+/*++
+
+Copyright (C) 2004-2010  Microsoft Corporation
+
+Module Name:
+
+    lbsim.c
+
+Abstract:
+
+    This is a user mode simulation harness that replays an I/O trace over a
+    set of synthetic paths, so that MSDSM's load balance policies can be
+    compared with each other.
+
+    Each path has a fixed latency and a bandwidth. A request sent down a path
+    waits for the requests ahead of it to be transferred, takes its own
+    transfer time, and then completes after the path's latency (plus some
+    random jitter). A path can be made slow for a window of time, in latency,
+    in bandwidth or both, to model a path that is degraded but still working.
+
+    The trace is replayed once for each of these policies:
+
+    - RR: Round Robin, the next path in turn.
+    - LQD: Least Queue Depth, the path with the fewest requests in flight.
+    - LB: Least Blocks, the path with the fewest bytes outstanding.
+    - LST: Least Service Time, the path with the lowest moving average of
+      completion latency times the number of requests ahead, as computed by
+      DsmpUpdateServiceTime and DsmpGetExpectedServiceTime.
+
+    The simulation is event driven, so it doesn't depend on the speed of the
+    machine it runs on, and the same trace and seed always give the same
+    results. Time is kept in 100ns units, as KeQueryInterruptTime returns it,
+    so that the LST constants below are the ones used by the DSM.
+
+    A trace is a text file with one request per line:
+
+        <arrival time in us> <R|W> <starting LBA> <number of 512 byte blocks>
+
+    Lines starting with '#' are skipped. If no trace is given, a random one is
+    generated; it can be saved with -w and replayed later.
+
+Environment:
+
+    User mode
+
+Notes:
+
+--*/
+
+#include <windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+//
+// These match the Least Service Time definitions in msdsm.h.
+//
+#define DSM_LST_EWMA_SHIFT              3
+#define DSM_LST_MIN_SERVICE_TIME        1000
+#define DSM_LST_AGING_INTERVAL          (1000 * 1000 * 10)
+
+#define LBSIM_TICKS_PER_US              10
+#define LBSIM_TICKS_PER_SECOND          (1000 * 1000 * 10)
+#define LBSIM_BLOCK_SIZE                512
+
+#define LBSIM_MAX_PATHS                 16
+#define LBSIM_MAX_WINDOWS               16
+
+#define LBSIM_DEFAULT_SECONDS           4
+#define LBSIM_DEFAULT_IOPS              40000
+#define LBSIM_DEFAULT_READ_PERCENT      70
+#define LBSIM_DEFAULT_PATHS             4
+#define LBSIM_DEFAULT_LATENCY_US        200
+#define LBSIM_DEFAULT_BANDWIDTH_MBPS    400
+
+//
+// Each completion takes 3/4 of the path's latency plus an exponentially
+// distributed jitter with a mean of the remaining 1/4.
+//
+#define LBSIM_JITTER_FRACTION           0.25
+
+typedef enum _LBSIM_POLICY {
+
+    LbSimRoundRobin = 0,
+    LbSimLeastQueueDepth,
+    LbSimLeastBlocks,
+    LbSimLeastServiceTime,
+    LbSimPolicyCount
+
+} LBSIM_POLICY;
+
+const char *LbSimPolicyNames[LbSimPolicyCount] = { "RR", "LQD", "LB", "LST" };
+
+typedef struct _LBSIM_REQUEST {
+
+    ULONGLONG ArrivalTime;
+    ULONGLONG StartingLba;
+    ULONG Blocks;
+    BOOLEAN IsWrite;
+
+} LBSIM_REQUEST, *PLBSIM_REQUEST;
+
+//
+// A window of time during which a path is slower than usual.
+//
+typedef struct _LBSIM_WINDOW {
+
+    ULONG Path;
+    ULONGLONG StartTime;
+    ULONGLONG EndTime;
+    ULONG LatencyUs;
+    ULONG BandwidthMBps;
+
+} LBSIM_WINDOW, *PLBSIM_WINDOW;
+
+typedef struct _LBSIM_PATH {
+
+    //
+    // Configuration.
+    //
+    ULONG LatencyUs;
+    ULONG BandwidthMBps;
+
+    //
+    // Time at which the path is done transferring the requests already sent.
+    //
+    ULONGLONG TransferFreeTime;
+
+    //
+    // The counters that the policies look at, as kept in DSM_FAILOVER_GROUP.
+    //
+    LONG NumberOfRequestsInFlight;
+    ULONGLONG OutstandingBytesOfIO;
+    LONGLONG AverageServiceTime;
+    ULONGLONG LastServiceTimeUpdate;
+
+    ULONGLONG Requests;
+
+} LBSIM_PATH, *PLBSIM_PATH;
+
+//
+// A request in flight, kept in a heap ordered by completion time.
+//
+typedef struct _LBSIM_COMPLETION {
+
+    ULONGLONG CompletionTime;
+    ULONGLONG ArrivalTime;
+    ULONG Path;
+    ULONG Bytes;
+
+} LBSIM_COMPLETION, *PLBSIM_COMPLETION;
+
+typedef struct _LBSIM_RUN {
+
+    PLBSIM_REQUEST Requests;
+    ULONG RequestCount;
+
+    LBSIM_PATH Paths[LBSIM_MAX_PATHS];
+    ULONG PathCount;
+
+    LBSIM_WINDOW Windows[LBSIM_MAX_WINDOWS];
+    ULONG WindowCount;
+
+    PLBSIM_COMPLETION Heap;
+    ULONG HeapCount;
+
+    ULONG NextRoundRobinPath;
+    ULONGLONG Seed;
+
+    //
+    // Latency (in ticks) of each request, and of those that arrived while
+    // some path was degraded.
+    //
+    PULONGLONG Latencies;
+    ULONG LatencyCount;
+    PULONGLONG DegradedLatencies;
+    ULONG DegradedLatencyCount;
+
+} LBSIM_RUN, *PLBSIM_RUN;
+
+
+VOID
+Usage (
+    VOID
+    )
+{
+    printf( "Replays an I/O trace over synthetic paths for each MSDSM load balance policy\n" );
+    printf( "Usage: lbsim [-t trace] [-w trace] [-s seconds] [-i iops] [-r read %%] [-x seed]\n" );
+    printf( "             [-p latency us[:MB/s]]... [-d path:latency us[:MB/s]@from s-to s]...\n" );
+    printf( "    -t  Replay this trace instead of generating one\n" );
+    printf( "    -w  Save the generated trace to this file\n" );
+    printf( "    -s  Length of the generated trace (default %d s)\n", LBSIM_DEFAULT_SECONDS );
+    printf( "    -i  Average arrival rate of the generated trace (default %d)\n", LBSIM_DEFAULT_IOPS );
+    printf( "    -r  Percentage of reads in the generated trace (default %d)\n", LBSIM_DEFAULT_READ_PERCENT );
+    printf( "    -x  Random seed (default 1)\n" );
+    printf( "    -p  Add a path (default %d paths of %d us, %d MB/s)\n",
+            LBSIM_DEFAULT_PATHS,
+            LBSIM_DEFAULT_LATENCY_US,
+            LBSIM_DEFAULT_BANDWIDTH_MBPS );
+    printf( "    -d  Degrade a path (numbered from 0) for a window of time\n" );
+    printf( "        (default: path 0 goes to 2000 us, 100 MB/s from 1 s to 3 s)\n" );
+}
+
+
+ULONGLONG
+LbSimRandom (
+    _Inout_ PULONGLONG Seed
+    )
+/*++
+
+Routine Description:
+
+    xorshift64* generator, so that runs are repeatable on any C runtime.
+
+--*/
+{
+    ULONGLONG x = *Seed;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *Seed = x;
+
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+
+double
+LbSimRandomUnit (
+    _Inout_ PULONGLONG Seed
+    )
+/*++
+
+Routine Description:
+
+    Returns a uniformly distributed number in (0, 1].
+
+--*/
+{
+    return ((double)(LbSimRandom( Seed ) >> 11) + 1.0) / 9007199254740992.0;
+}
+
+
+BOOLEAN
+LbSimGenerateTrace (
+    _Inout_ PLBSIM_RUN Run,
+    _In_ ULONG Seconds,
+    _In_ ULONG Iops,
+    _In_ ULONG ReadPercent
+    )
+/*++
+
+Routine Description:
+
+    Generates a random trace with Poisson arrivals. Most requests are small
+    random ones, and the rest are 64KB requests that continue a sequential
+    stream, as a mix of database and backup I/O would look.
+
+--*/
+{
+    ULONGLONG duration = (ULONGLONG)Seconds * LBSIM_TICKS_PER_SECOND;
+    ULONGLONG now = 0;
+    ULONGLONG streamLba = 0;
+    ULONG capacity;
+    ULONG size;
+    PLBSIM_REQUEST request;
+
+    capacity = (ULONG)((ULONGLONG)Seconds * Iops * 5 / 4) + 16;
+    Run->Requests = malloc( capacity * sizeof(LBSIM_REQUEST) );
+
+    if (Run->Requests == NULL) {
+
+        return FALSE;
+    }
+
+    Run->RequestCount = 0;
+
+    for (;;) {
+
+        now += (ULONGLONG)(-log( LbSimRandomUnit( &Run->Seed ) ) * LBSIM_TICKS_PER_SECOND / Iops);
+
+        if (now >= duration || Run->RequestCount == capacity) {
+
+            break;
+        }
+
+        request = &Run->Requests[Run->RequestCount++];
+        request->ArrivalTime = now;
+        request->IsWrite = (BOOLEAN)((LbSimRandom( &Run->Seed ) % 100) >= ReadPercent);
+
+        size = (ULONG)(LbSimRandom( &Run->Seed ) % 10);
+
+        if (size < 6) {
+
+            request->Blocks = 8;
+            request->StartingLba = (LbSimRandom( &Run->Seed ) % (1ULL << 30)) & ~7ULL;
+
+        } else if (size < 8) {
+
+            request->Blocks = 16;
+            request->StartingLba = (LbSimRandom( &Run->Seed ) % (1ULL << 30)) & ~15ULL;
+
+        } else {
+
+            request->Blocks = 128;
+            request->StartingLba = streamLba;
+            streamLba += 128;
+        }
+    }
+
+    return TRUE;
+}
+
+
+BOOLEAN
+LbSimReadTrace (
+    _Inout_ PLBSIM_RUN Run,
+    _In_ const char *FileName
+    )
+{
+    FILE *file;
+    char line[256];
+    double arrivalUs;
+    char op;
+    ULONGLONG lba;
+    ULONG blocks;
+    ULONG capacity = 65536;
+    ULONGLONG lastArrival = 0;
+    PLBSIM_REQUEST requests;
+    PLBSIM_REQUEST request;
+
+    if (fopen_s( &file, FileName, "r" ) != 0) {
+
+        printf( "Can't open trace %s\n", FileName );
+        return FALSE;
+    }
+
+    Run->Requests = malloc( capacity * sizeof(LBSIM_REQUEST) );
+    Run->RequestCount = 0;
+
+    while (Run->Requests && fgets( line, sizeof(line), file )) {
+
+        if (line[0] == '#' || sscanf_s( line, "%lf %c %llu %u", &arrivalUs, &op, 1, &lba, &blocks ) != 4) {
+
+            continue;
+        }
+
+        if (Run->RequestCount == capacity) {
+
+            capacity *= 2;
+            requests = realloc( Run->Requests, capacity * sizeof(LBSIM_REQUEST) );
+
+            if (requests == NULL) {
+
+                free( Run->Requests );
+                Run->Requests = NULL;
+                break;
+            }
+
+            Run->Requests = requests;
+        }
+
+        request = &Run->Requests[Run->RequestCount++];
+        request->ArrivalTime = (ULONGLONG)(arrivalUs * LBSIM_TICKS_PER_US);
+        request->IsWrite = (BOOLEAN)(op == 'W' || op == 'w');
+        request->StartingLba = lba;
+        request->Blocks = blocks ? blocks : 1;
+
+        //
+        // The replay needs the requests in arrival order.
+        //
+        if (request->ArrivalTime < lastArrival) {
+
+            request->ArrivalTime = lastArrival;
+        }
+
+        lastArrival = request->ArrivalTime;
+    }
+
+    fclose( file );
+
+    if (Run->Requests == NULL) {
+
+        printf( "Out of memory\n" );
+        return FALSE;
+    }
+
+    if (Run->RequestCount == 0) {
+
+        printf( "No requests in trace %s\n", FileName );
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+BOOLEAN
+LbSimWriteTrace (
+    _In_ PLBSIM_RUN Run,
+    _In_ const char *FileName
+    )
+{
+    FILE *file;
+    ULONG i;
+
+    if (fopen_s( &file, FileName, "w" ) != 0) {
+
+        printf( "Can't create trace %s\n", FileName );
+        return FALSE;
+    }
+
+    fprintf( file, "# arrival us, R/W, starting LBA, blocks\n" );
+
+    for (i = 0; i < Run->RequestCount; i++) {
+
+        fprintf( file,
+                 "%.1f %c %llu %u\n",
+                 (double)Run->Requests[i].ArrivalTime / LBSIM_TICKS_PER_US,
+                 Run->Requests[i].IsWrite ? 'W' : 'R',
+                 Run->Requests[i].StartingLba,
+                 Run->Requests[i].Blocks );
+    }
+
+    fclose( file );
+
+    return TRUE;
+}
+
+
+BOOLEAN
+LbSimIsDegraded (
+    _In_ PLBSIM_RUN Run,
+    _In_ ULONGLONG Time
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Run->WindowCount; i++) {
+
+        if (Time >= Run->Windows[i].StartTime && Time < Run->Windows[i].EndTime) {
+
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+
+VOID
+LbSimGetPathSpeed (
+    _In_ PLBSIM_RUN Run,
+    _In_ ULONG Path,
+    _In_ ULONGLONG Time,
+    _Out_ PULONG LatencyUs,
+    _Out_ PULONG BandwidthMBps
+    )
+{
+    ULONG i;
+
+    *LatencyUs = Run->Paths[Path].LatencyUs;
+    *BandwidthMBps = Run->Paths[Path].BandwidthMBps;
+
+    for (i = 0; i < Run->WindowCount; i++) {
+
+        if (Run->Windows[i].Path == Path &&
+            Time >= Run->Windows[i].StartTime && Time < Run->Windows[i].EndTime) {
+
+            *LatencyUs = Run->Windows[i].LatencyUs;
+
+            if (Run->Windows[i].BandwidthMBps) {
+
+                *BandwidthMBps = Run->Windows[i].BandwidthMBps;
+            }
+        }
+    }
+}
+
+
+VOID
+LbSimHeapPush (
+    _Inout_ PLBSIM_RUN Run,
+    _In_ PLBSIM_COMPLETION Completion
+    )
+{
+    ULONG i = Run->HeapCount++;
+    ULONG parent;
+
+    while (i > 0) {
+
+        parent = (i - 1) / 2;
+
+        if (Run->Heap[parent].CompletionTime <= Completion->CompletionTime) {
+
+            break;
+        }
+
+        Run->Heap[i] = Run->Heap[parent];
+        i = parent;
+    }
+
+    Run->Heap[i] = *Completion;
+}
+
+
+VOID
+LbSimHeapPop (
+    _Inout_ PLBSIM_RUN Run,
+    _Out_ PLBSIM_COMPLETION Completion
+    )
+{
+    LBSIM_COMPLETION last;
+    ULONG i = 0;
+    ULONG child;
+
+    *Completion = Run->Heap[0];
+    last = Run->Heap[--Run->HeapCount];
+
+    for (;;) {
+
+        child = (i * 2) + 1;
+
+        if (child >= Run->HeapCount) {
+
+            break;
+        }
+
+        if (child + 1 < Run->HeapCount &&
+            Run->Heap[child + 1].CompletionTime < Run->Heap[child].CompletionTime) {
+
+            child += 1;
+        }
+
+        if (last.CompletionTime <= Run->Heap[child].CompletionTime) {
+
+            break;
+        }
+
+        Run->Heap[i] = Run->Heap[child];
+        i = child;
+    }
+
+    Run->Heap[i] = last;
+}
+
+
+VOID
+LbSimUpdateServiceTime (
+    _Inout_ PLBSIM_PATH Path,
+    _In_ ULONGLONG StartTime,
+    _In_ ULONGLONG CurrentTime
+    )
+/*++
+
+Routine Description:
+
+    Folds a completion into the path's moving average, as
+    DsmpUpdateServiceTime does.
+
+--*/
+{
+    LONGLONG sample = (LONGLONG)(CurrentTime - StartTime);
+
+    if (Path->AverageServiceTime == 0) {
+
+        Path->AverageServiceTime = sample << DSM_LST_EWMA_SHIFT;
+
+    } else {
+
+        Path->AverageServiceTime += sample - (Path->AverageServiceTime >> DSM_LST_EWMA_SHIFT);
+    }
+
+    Path->LastServiceTimeUpdate = CurrentTime;
+}
+
+
+ULONGLONG
+LbSimGetExpectedServiceTime (
+    _In_ PLBSIM_PATH Path,
+    _In_ ULONGLONG CurrentTime
+    )
+/*++
+
+Routine Description:
+
+    Estimates the service time of a new request on the path, as
+    DsmpGetExpectedServiceTime does.
+
+--*/
+{
+    ULONGLONG averageServiceTime = (ULONGLONG)Path->AverageServiceTime >> DSM_LST_EWMA_SHIFT;
+    ULONGLONG agingIntervals;
+
+    if (Path->LastServiceTimeUpdate && CurrentTime > Path->LastServiceTimeUpdate) {
+
+        agingIntervals = (CurrentTime - Path->LastServiceTimeUpdate) / DSM_LST_AGING_INTERVAL;
+
+        if (agingIntervals >= 63) {
+
+            averageServiceTime = 0;
+
+        } else {
+
+            averageServiceTime >>= agingIntervals;
+        }
+    }
+
+    if (averageServiceTime < DSM_LST_MIN_SERVICE_TIME) {
+
+        averageServiceTime = DSM_LST_MIN_SERVICE_TIME;
+    }
+
+    return averageServiceTime * ((ULONGLONG)Path->NumberOfRequestsInFlight + 1);
+}
+
+
+ULONG
+LbSimGetPath (
+    _Inout_ PLBSIM_RUN Run,
+    _In_ LBSIM_POLICY Policy,
+    _In_ ULONGLONG CurrentTime
+    )
+/*++
+
+Routine Description:
+
+    Picks the path for a new request the way DsmpGetPath does for the given
+    policy, with all the paths Active/Optimized. Ties go to the first path,
+    as the DSM walks its list in order and only takes a strictly better one.
+
+--*/
+{
+    ULONG path = 0;
+    ULONG inx;
+    ULONGLONG value;
+    ULONGLONG leastValue = MAXULONGLONG;
+
+    switch (Policy) {
+
+        case LbSimRoundRobin: {
+
+            path = Run->NextRoundRobinPath;
+            Run->NextRoundRobinPath = (path + 1) % Run->PathCount;
+            break;
+        }
+
+        case LbSimLeastQueueDepth:
+        case LbSimLeastBlocks:
+        case LbSimLeastServiceTime: {
+
+            for (inx = 0; inx < Run->PathCount; inx++) {
+
+                if (Policy == LbSimLeastQueueDepth) {
+
+                    value = Run->Paths[inx].NumberOfRequestsInFlight;
+
+                } else if (Policy == LbSimLeastBlocks) {
+
+                    value = Run->Paths[inx].OutstandingBytesOfIO;
+
+                } else {
+
+                    value = LbSimGetExpectedServiceTime( &Run->Paths[inx], CurrentTime );
+                }
+
+                if (value < leastValue) {
+
+                    leastValue = value;
+                    path = inx;
+                }
+            }
+
+            break;
+        }
+
+        default: {
+
+            break;
+        }
+    }
+
+    return path;
+}
+
+
+VOID
+LbSimComplete (
+    _Inout_ PLBSIM_RUN Run,
+    _In_ ULONGLONG UpTo
+    )
+/*++
+
+Routine Description:
+
+    Completes every request in flight that is done by the given time.
+
+--*/
+{
+    LBSIM_COMPLETION completion;
+    PLBSIM_PATH path;
+    ULONGLONG latency;
+
+    while (Run->HeapCount && Run->Heap[0].CompletionTime <= UpTo) {
+
+        LbSimHeapPop( Run, &completion );
+
+        path = &Run->Paths[completion.Path];
+        path->NumberOfRequestsInFlight -= 1;
+        path->OutstandingBytesOfIO -= completion.Bytes;
+
+        LbSimUpdateServiceTime( path, completion.ArrivalTime, completion.CompletionTime );
+
+        latency = completion.CompletionTime - completion.ArrivalTime;
+        Run->Latencies[Run->LatencyCount++] = latency;
+
+        if (LbSimIsDegraded( Run, completion.ArrivalTime )) {
+
+            Run->DegradedLatencies[Run->DegradedLatencyCount++] = latency;
+        }
+    }
+}
+
+
+VOID
+LbSimReplay (
+    _Inout_ PLBSIM_RUN Run,
+    _In_ LBSIM_POLICY Policy,
+    _In_ ULONGLONG Seed
+    )
+{
+    PLBSIM_REQUEST request;
+    PLBSIM_PATH path;
+    LBSIM_COMPLETION completion;
+    ULONG latencyUs;
+    ULONG bandwidthMBps;
+    ULONGLONG start;
+    ULONGLONG transfer;
+    ULONGLONG latency;
+    ULONG i;
+
+    for (i = 0; i < Run->PathCount; i++) {
+
+        path = &Run->Paths[i];
+        path->TransferFreeTime = 0;
+        path->NumberOfRequestsInFlight = 0;
+        path->OutstandingBytesOfIO = 0;
+        path->AverageServiceTime = 0;
+        path->LastServiceTimeUpdate = 0;
+        path->Requests = 0;
+    }
+
+    Run->HeapCount = 0;
+    Run->NextRoundRobinPath = 0;
+    Run->LatencyCount = 0;
+    Run->DegradedLatencyCount = 0;
+    Run->Seed = Seed;
+
+    for (i = 0; i < Run->RequestCount; i++) {
+
+        request = &Run->Requests[i];
+
+        LbSimComplete( Run, request->ArrivalTime );
+
+        completion.Path = LbSimGetPath( Run, Policy, request->ArrivalTime );
+        completion.Bytes = request->Blocks * LBSIM_BLOCK_SIZE;
+        completion.ArrivalTime = request->ArrivalTime;
+
+        path = &Run->Paths[completion.Path];
+        LbSimGetPathSpeed( Run, completion.Path, request->ArrivalTime, &latencyUs, &bandwidthMBps );
+
+        //
+        // The request is transferred after the ones already queued on the
+        // path, then completes after the path's latency.
+        //
+        start = max( request->ArrivalTime, path->TransferFreeTime );
+        transfer = (ULONGLONG)completion.Bytes * LBSIM_TICKS_PER_SECOND / ((ULONGLONG)bandwidthMBps * 1000 * 1000);
+        path->TransferFreeTime = start + transfer;
+
+        latency = (ULONGLONG)latencyUs * LBSIM_TICKS_PER_US;
+        latency = latency - (ULONGLONG)(latency * LBSIM_JITTER_FRACTION) +
+                  (ULONGLONG)(-log( LbSimRandomUnit( &Run->Seed ) ) * latency * LBSIM_JITTER_FRACTION);
+
+        completion.CompletionTime = start + transfer + latency;
+
+        path->NumberOfRequestsInFlight += 1;
+        path->OutstandingBytesOfIO += completion.Bytes;
+        path->Requests += 1;
+
+        LbSimHeapPush( Run, &completion );
+    }
+
+    LbSimComplete( Run, MAXULONGLONG );
+}
+
+
+int __cdecl
+LbSimCompare (
+    _In_ const void *Left,
+    _In_ const void *Right
+    )
+{
+    ULONGLONG left = *(const ULONGLONG *)Left;
+    ULONGLONG right = *(const ULONGLONG *)Right;
+
+    return (left > right) - (left < right);
+}
+
+
+double
+LbSimPercentileUs (
+    _In_reads_(Count) PULONGLONG Sorted,
+    _In_ ULONG Count,
+    _In_ ULONG PerTenThousand
+    )
+{
+    if (Count == 0) {
+
+        return 0;
+    }
+
+    return (double)Sorted[(ULONGLONG)(Count - 1) * PerTenThousand / 10000] / LBSIM_TICKS_PER_US;
+}
+
+
+VOID
+LbSimReport (
+    _In_ PLBSIM_RUN Run,
+    _In_ LBSIM_POLICY Policy
+    )
+{
+    ULONGLONG total = 0;
+    ULONG i;
+
+    qsort( Run->Latencies, Run->LatencyCount, sizeof(ULONGLONG), LbSimCompare );
+    qsort( Run->DegradedLatencies, Run->DegradedLatencyCount, sizeof(ULONGLONG), LbSimCompare );
+
+    for (i = 0; i < Run->LatencyCount; i++) {
+
+        total += Run->Latencies[i];
+    }
+
+    printf( "%-6s %9.0f %9.0f %9.0f %10.0f %11.0f",
+            LbSimPolicyNames[Policy],
+            (double)total / Run->LatencyCount / LBSIM_TICKS_PER_US,
+            LbSimPercentileUs( Run->Latencies, Run->LatencyCount, 5000 ),
+            LbSimPercentileUs( Run->Latencies, Run->LatencyCount, 9900 ),
+            LbSimPercentileUs( Run->Latencies, Run->LatencyCount, 9990 ),
+            (double)Run->Latencies[Run->LatencyCount - 1] / LBSIM_TICKS_PER_US );
+
+    if (Run->WindowCount) {
+
+        printf( " %10.0f %10.0f",
+                LbSimPercentileUs( Run->DegradedLatencies, Run->DegradedLatencyCount, 5000 ),
+                LbSimPercentileUs( Run->DegradedLatencies, Run->DegradedLatencyCount, 9900 ) );
+    }
+
+    printf( "  " );
+
+    for (i = 0; i < Run->PathCount; i++) {
+
+        printf( " %5.1f", 100.0 * Run->Paths[i].Requests / Run->RequestCount );
+    }
+
+    printf( "\n" );
+}
+
+
+BOOLEAN
+LbSimParsePath (
+    _Inout_ PLBSIM_RUN Run,
+    _In_ const char *Spec
+    )
+{
+    PLBSIM_PATH path;
+
+    if (Run->PathCount == LBSIM_MAX_PATHS) {
+
+        return FALSE;
+    }
+
+    path = &Run->Paths[Run->PathCount];
+    path->BandwidthMBps = LBSIM_DEFAULT_BANDWIDTH_MBPS;
+
+    if (sscanf_s( Spec, "%u:%u", &path->LatencyUs, &path->BandwidthMBps ) < 1 ||
+        path->BandwidthMBps == 0) {
+
+        return FALSE;
+    }
+
+    Run->PathCount += 1;
+
+    return TRUE;
+}
+
+
+BOOLEAN
+LbSimParseWindow (
+    _Inout_ PLBSIM_RUN Run,
+    _In_ const char *Spec
+    )
+{
+    PLBSIM_WINDOW window;
+    double from;
+    double to;
+
+    if (Run->WindowCount == LBSIM_MAX_WINDOWS) {
+
+        return FALSE;
+    }
+
+    window = &Run->Windows[Run->WindowCount];
+    window->BandwidthMBps = 0;
+
+    if (sscanf_s( Spec, "%u:%u:%u@%lf-%lf", &window->Path, &window->LatencyUs,
+                &window->BandwidthMBps, &from, &to ) != 5 &&
+        sscanf_s( Spec, "%u:%u@%lf-%lf", &window->Path, &window->LatencyUs, &from, &to ) != 4) {
+
+        return FALSE;
+    }
+
+    if (to <= from) {
+
+        return FALSE;
+    }
+
+    window->StartTime = (ULONGLONG)(from * LBSIM_TICKS_PER_SECOND);
+    window->EndTime = (ULONGLONG)(to * LBSIM_TICKS_PER_SECOND);
+
+    Run->WindowCount += 1;
+
+    return TRUE;
+}
+
+
+int __cdecl
+main (
+    _In_ int argc,
+    _In_reads_(argc) char *argv[]
+    )
+{
+    PLBSIM_RUN run;
+    const char *traceFile = NULL;
+    const char *saveFile = NULL;
+    ULONG seconds = LBSIM_DEFAULT_SECONDS;
+    ULONG iops = LBSIM_DEFAULT_IOPS;
+    ULONG readPercent = LBSIM_DEFAULT_READ_PERCENT;
+    ULONGLONG seed = 1;
+    BOOLEAN defaultWindows = TRUE;
+    ULONG policy;
+    ULONG i;
+
+    run = calloc( 1, sizeof(LBSIM_RUN) );
+
+    if (run == NULL) {
+
+        printf( "Out of memory\n" );
+        return 1;
+    }
+
+    for (i = 1; i < (ULONG)argc; i++) {
+
+        if ((argv[i][0] != '-' && argv[i][0] != '/') || argv[i][1] == '\0' ||
+            argv[i][2] != '\0' || i + 1 == (ULONG)argc) {
+
+            Usage();
+            return 1;
+        }
+
+        switch (argv[i][1]) {
+
+            case 't':
+                traceFile = argv[++i];
+                break;
+
+            case 'w':
+                saveFile = argv[++i];
+                break;
+
+            case 's':
+                seconds = atoi( argv[++i] );
+                break;
+
+            case 'i':
+                iops = atoi( argv[++i] );
+                break;
+
+            case 'r':
+                readPercent = atoi( argv[++i] );
+                break;
+
+            case 'x':
+                seed = _strtoui64( argv[++i], NULL, 0 );
+                break;
+
+            case 'p':
+                if (!LbSimParsePath( run, argv[++i] )) {
+
+                    Usage();
+                    return 1;
+                }
+                break;
+
+            case 'd':
+                defaultWindows = FALSE;
+                if (!LbSimParseWindow( run, argv[++i] )) {
+
+                    Usage();
+                    return 1;
+                }
+                break;
+
+            default:
+                Usage();
+                return 1;
+        }
+    }
+
+    if (seconds == 0 || iops == 0 || readPercent > 100 || seed == 0) {
+
+        Usage();
+        return 1;
+    }
+
+    if (run->PathCount == 0) {
+
+        for (i = 0; i < LBSIM_DEFAULT_PATHS; i++) {
+
+            run->Paths[i].LatencyUs = LBSIM_DEFAULT_LATENCY_US;
+            run->Paths[i].BandwidthMBps = LBSIM_DEFAULT_BANDWIDTH_MBPS;
+        }
+
+        run->PathCount = LBSIM_DEFAULT_PATHS;
+    }
+
+    if (defaultWindows) {
+
+        run->Windows[0].Path = 0;
+        run->Windows[0].LatencyUs = 2000;
+        run->Windows[0].BandwidthMBps = 100;
+        run->Windows[0].StartTime = 1ULL * LBSIM_TICKS_PER_SECOND;
+        run->Windows[0].EndTime = 3ULL * LBSIM_TICKS_PER_SECOND;
+        run->WindowCount = 1;
+    }
+
+    for (i = 0; i < run->WindowCount; i++) {
+
+        if (run->Windows[i].Path >= run->PathCount) {
+
+            printf( "No path %u to degrade\n", run->Windows[i].Path );
+            return 1;
+        }
+    }
+
+    run->Seed = seed;
+
+    if (traceFile) {
+
+        if (!LbSimReadTrace( run, traceFile )) {
+
+            return 1;
+        }
+
+    } else {
+
+        if (!LbSimGenerateTrace( run, seconds, iops, readPercent )) {
+
+            printf( "Out of memory\n" );
+            return 1;
+        }
+
+        if (saveFile && !LbSimWriteTrace( run, saveFile )) {
+
+            return 1;
+        }
+    }
+
+    run->Heap = malloc( run->RequestCount * sizeof(LBSIM_COMPLETION) );
+    run->Latencies = malloc( run->RequestCount * sizeof(ULONGLONG) );
+    run->DegradedLatencies = malloc( run->RequestCount * sizeof(ULONGLONG) );
+
+    if (run->Heap == NULL || run->Latencies == NULL || run->DegradedLatencies == NULL) {
+
+        printf( "Out of memory\n" );
+        return 1;
+    }
+
+    printf( "LbSim: %u requests over %.2f s, %u paths:",
+            run->RequestCount,
+            (double)run->Requests[run->RequestCount - 1].ArrivalTime / LBSIM_TICKS_PER_SECOND,
+            run->PathCount );
+
+    for (i = 0; i < run->PathCount; i++) {
+
+        printf( " %u us/%u MB/s", run->Paths[i].LatencyUs, run->Paths[i].BandwidthMBps );
+    }
+
+    printf( "\n" );
+
+    for (i = 0; i < run->WindowCount; i++) {
+
+        printf( "Path %u degraded to %u us",
+                run->Windows[i].Path,
+                run->Windows[i].LatencyUs );
+
+        if (run->Windows[i].BandwidthMBps) {
+
+            printf( "/%u MB/s", run->Windows[i].BandwidthMBps );
+        }
+
+        printf( " from %.2f s to %.2f s\n",
+                (double)run->Windows[i].StartTime / LBSIM_TICKS_PER_SECOND,
+                (double)run->Windows[i].EndTime / LBSIM_TICKS_PER_SECOND );
+    }
+
+    printf( "%-6s %9s %9s %9s %10s %11s", "policy", "mean us", "p50 us", "p99 us", "p99.9 us", "max us" );
+
+    if (run->WindowCount) {
+
+        printf( " %10s %10s", "deg p50", "deg p99" );
+    }
+
+    printf( "   %% of requests per path\n" );
+
+    for (policy = 0; policy < LbSimPolicyCount; policy++) {
+
+        LbSimReplay( run, (LBSIM_POLICY)policy, seed );
+        LbSimReport( run, (LBSIM_POLICY)policy );
+    }
+
+    free( run->DegradedLatencies );
+    free( run->Latencies );
+    free( run->Heap );
+    free( run->Requests );
+    free( run );
+
+    return 0;
+}
@@ -0,0 +1,714 @@
+/*++
+
+Copyright (C) 2004-2010  Microsoft Corporation
+
+Module Name:
+
+    pathflap.c
+
+Abstract:
+
+    This is a user mode stress test for the way MSDSM routes read/write
+    requests while paths keep failing and coming back.
+
+    Reader threads pick a path for each request the way DsmLBGetPath does for
+    the Least Queue Depth policy, while a flapper thread keeps taking paths
+    down and bringing them back up the way path removal and arrival do. The
+    time taken by each pick is recorded, and the latency distribution is
+    reported for two modes:
+
+    - locked: the pick takes DsmContextLock in Shared mode and walks the
+      group's paths, as DsmpGetPath does. The flapper holds the lock in
+      Exclusive mode while it reconfigures the group.
+
+    - snapshot: the pick takes a reference on the group's published path
+      snapshot, as DsmpGetPathFromSnapshot does. The flapper builds the
+      group's new snapshot while it holds DsmContextLock and swaps it in
+      before releasing the lock, as DsmpUpdatePathSnapshot does.
+
+    The DSM itself only builds against the MPIO headers in the WDK, so its
+    locking is modeled here: SRW locks stand in for the EX_SPIN_LOCKs, and
+    the work done by the DSM while it holds DsmContextLock exclusive is
+    modeled by spinning for a given time.
+
+    A pick is counted as stale if the chosen path is down by the time the
+    request would be sent. Those are the requests that MPIO would have to
+    retry. In snapshot mode they are picks made from the old snapshot while a
+    flap is being processed; in locked mode only a flap that lands between
+    the pick and the check can cause one.
+
+Environment:
+
+    User mode
+
+Notes:
+
+--*/
+
+#include <windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define PATHFLAP_DEFAULT_SECONDS        2
+#define PATHFLAP_DEFAULT_FLAP_MS        1
+#define PATHFLAP_DEFAULT_HOLD_US        50
+#define PATHFLAP_MAX_THREADS            64
+#define PATHFLAP_GROUPS                 8
+#define PATHFLAP_PATHS                  4
+
+//
+// Latencies are kept in a histogram with four buckets per power of two
+// nanoseconds.
+//
+#define PATHFLAP_BUCKETS                (64 * 4)
+
+//
+// A path (failover group). Each one is on its own cache lines, since every
+// request updates its number of requests in flight.
+//
+typedef struct DECLSPEC_CACHEALIGN _PATHFLAP_PATH {
+
+    volatile LONG NumberOfRequestsInFlight;
+
+    //
+    // Non-zero if the path is up.
+    //
+    volatile LONG Active;
+
+} PATHFLAP_PATH, *PPATHFLAP_PATH;
+
+//
+// Immutable copy of a group's usable paths, as DSM_PATH_SNAPSHOT.
+//
+typedef struct _PATHFLAP_SNAPSHOT {
+
+    volatile LONG ReferenceCount;
+    ULONG NumberPaths;
+    PPATHFLAP_PATH Paths[PATHFLAP_PATHS];
+
+} PATHFLAP_SNAPSHOT, *PPATHFLAP_SNAPSHOT;
+
+//
+// A multi-path group (LUN).
+//
+typedef struct DECLSPEC_CACHEALIGN _PATHFLAP_GROUP {
+
+    SRWLOCK PathSnapshotLock;
+    PPATHFLAP_SNAPSHOT PathSnapshot;
+
+    PATHFLAP_PATH Paths[PATHFLAP_PATHS];
+
+} PATHFLAP_GROUP, *PPATHFLAP_GROUP;
+
+typedef struct _PATHFLAP_RUN {
+
+    //
+    // Stands in for DsmContextLock.
+    //
+    SRWLOCK DsmContextLock;
+
+    PATHFLAP_GROUP Groups[PATHFLAP_GROUPS];
+
+    BOOLEAN UseSnapshots;
+    ULONG HoldMicroseconds;
+    LARGE_INTEGER Frequency;
+
+    ULONG Flaps;
+
+    HANDLE StartEvent;
+    volatile LONG Stop;
+
+} PATHFLAP_RUN, *PPATHFLAP_RUN;
+
+typedef struct _PATHFLAP_THREAD {
+
+    PPATHFLAP_RUN Run;
+    ULONG Seed;
+    HANDLE Thread;
+
+    ULONGLONG Picks;
+    ULONGLONG StalePicks;
+    ULONGLONG MaxNanoseconds;
+    ULONGLONG Histogram[PATHFLAP_BUCKETS];
+
+} PATHFLAP_THREAD, *PPATHFLAP_THREAD;
+
+
+VOID
+Usage (
+    VOID
+    )
+{
+    printf( "Measures how long MSDSM's path selection takes while paths flap\n" );
+    printf( "Usage: pathflap [seconds] [flap interval ms] [lock hold us] [threads]\n" );
+    printf( "    Each mode runs for this many seconds (default %d)\n",
+            PATHFLAP_DEFAULT_SECONDS );
+    printf( "    A path goes down or comes back every interval (default %d ms)\n",
+            PATHFLAP_DEFAULT_FLAP_MS );
+    printf( "    Each flap holds the context lock exclusive this long (default %d us)\n",
+            PATHFLAP_DEFAULT_HOLD_US );
+    printf( "    Number of threads picking paths (default: processors, at least 2)\n" );
+}
+
+
+ULONG
+PathFlapBucket (
+    _In_ ULONGLONG Nanoseconds
+    )
+{
+    ULONG msb = 0;
+
+    if (Nanoseconds < 4) {
+
+        return (ULONG)Nanoseconds;
+    }
+
+    while ((Nanoseconds >> msb) > 1) {
+
+        msb += 1;
+    }
+
+    return (msb * 4) + (ULONG)((Nanoseconds >> (msb - 2)) & 3);
+}
+
+
+ULONGLONG
+PathFlapBucketLimit (
+    _In_ ULONG Bucket
+    )
+/*++
+
+Routine Description:
+
+    Returns the largest value that falls in the given histogram bucket.
+
+--*/
+{
+    ULONG msb = Bucket / 4;
+
+    if (Bucket < 4) {
+
+        return Bucket;
+    }
+
+    return ((4ULL + (Bucket & 3) + 1) << (msb - 2)) - 1;
+}
+
+
+VOID
+PathFlapDereferenceSnapshot (
+    _In_ PPATHFLAP_SNAPSHOT Snapshot
+    )
+{
+    if (InterlockedDecrement( &Snapshot->ReferenceCount ) == 0) {
+
+        free( Snapshot );
+    }
+}
+
+
+VOID
+PathFlapUpdateSnapshot (
+    _In_ PPATHFLAP_GROUP Group
+    )
+/*++
+
+Routine Description:
+
+    Builds a new snapshot of the group's active paths and publishes it, as
+    DsmpUpdatePathSnapshot does. Called with DsmContextLock held exclusive.
+
+--*/
+{
+    PPATHFLAP_SNAPSHOT snapshot;
+    PPATHFLAP_SNAPSHOT oldSnapshot;
+    ULONG inx;
+
+    snapshot = calloc( 1, sizeof(PATHFLAP_SNAPSHOT) );
+
+    if (snapshot) {
+
+        snapshot->ReferenceCount = 1;
+
+        for (inx = 0; inx < PATHFLAP_PATHS; inx++) {
+
+            if (Group->Paths[inx].Active) {
+
+                snapshot->Paths[snapshot->NumberPaths++] = &Group->Paths[inx];
+            }
+        }
+    }
+
+    AcquireSRWLockExclusive( &Group->PathSnapshotLock );
+
+    oldSnapshot = Group->PathSnapshot;
+    Group->PathSnapshot = snapshot;
+
+    ReleaseSRWLockExclusive( &Group->PathSnapshotLock );
+
+    if (oldSnapshot) {
+
+        PathFlapDereferenceSnapshot( oldSnapshot );
+    }
+}
+
+
+PPATHFLAP_PATH
+PathFlapGetPathLocked (
+    _In_ PPATHFLAP_RUN Run,
+    _In_ PPATHFLAP_GROUP Group
+    )
+/*++
+
+Routine Description:
+
+    Picks the active path with the least requests in flight, walking the
+    group under DsmContextLock as DsmpGetPath does.
+
+--*/
+{
+    PPATHFLAP_PATH path = NULL;
+    LONG leastQueueDepth = MAXLONG;
+    ULONG inx;
+
+    AcquireSRWLockShared( &Run->DsmContextLock );
+
+    for (inx = 0; inx < PATHFLAP_PATHS; inx++) {
+
+        if (Group->Paths[inx].Active &&
+            Group->Paths[inx].NumberOfRequestsInFlight < leastQueueDepth) {
+
+            leastQueueDepth = Group->Paths[inx].NumberOfRequestsInFlight;
+            path = &Group->Paths[inx];
+        }
+    }
+
+    if (path) {
+
+        InterlockedIncrement( &path->NumberOfRequestsInFlight );
+    }
+
+    ReleaseSRWLockShared( &Run->DsmContextLock );
+
+    return path;
+}
+
+
+PPATHFLAP_PATH
+PathFlapGetPathFromSnapshot (
+    _In_ PPATHFLAP_GROUP Group
+    )
+/*++
+
+Routine Description:
+
+    Picks the path with the least requests in flight from the group's
+    published snapshot, as DsmpGetPathFromSnapshot does.
+
+--*/
+{
+    PPATHFLAP_SNAPSHOT snapshot;
+    PPATHFLAP_PATH path = NULL;
+    LONG leastQueueDepth = MAXLONG;
+    ULONG inx;
+
+    AcquireSRWLockShared( &Group->PathSnapshotLock );
+
+    snapshot = Group->PathSnapshot;
+    if (snapshot) {
+
+        InterlockedIncrement( &snapshot->ReferenceCount );
+    }
+
+    ReleaseSRWLockShared( &Group->PathSnapshotLock );
+
+    if (!snapshot) {
+
+        return NULL;
+    }
+
+    for (inx = 0; inx < snapshot->NumberPaths; inx++) {
+
+        if (snapshot->Paths[inx]->NumberOfRequestsInFlight < leastQueueDepth) {
+
+            leastQueueDepth = snapshot->Paths[inx]->NumberOfRequestsInFlight;
+            path = snapshot->Paths[inx];
+        }
+    }
+
+    if (path) {
+
+        InterlockedIncrement( &path->NumberOfRequestsInFlight );
+    }
+
+    PathFlapDereferenceSnapshot( snapshot );
+
+    return path;
+}
+
+
+DWORD
+WINAPI
+PathFlapReader (
+    _In_ LPVOID Parameter
+    )
+{
+    PPATHFLAP_THREAD thread = Parameter;
+    PPATHFLAP_RUN run = thread->Run;
+    PPATHFLAP_GROUP group;
+    PPATHFLAP_PATH path;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    ULONGLONG nanoseconds;
+    ULONG seed = thread->Seed;
+
+    WaitForSingleObject( run->StartEvent, INFINITE );
+
+    while (!run->Stop) {
+
+        seed = seed * 1103515245 + 12345;
+        group = &run->Groups[(seed >> 16) % PATHFLAP_GROUPS];
+
+        QueryPerformanceCounter( &start );
+
+        if (run->UseSnapshots) {
+
+            path = PathFlapGetPathFromSnapshot( group );
+
+            //
+            // The driver falls back to the locked path if there is no
+            // snapshot.
+            //
+            if (!path) {
+
+                path = PathFlapGetPathLocked( run, group );
+            }
+
+        } else {
+
+            path = PathFlapGetPathLocked( run, group );
+        }
+
+        QueryPerformanceCounter( &end );
+
+        nanoseconds = (ULONGLONG)(end.QuadPart - start.QuadPart) * 1000000000ULL / run->Frequency.QuadPart;
+
+        thread->Histogram[PathFlapBucket( nanoseconds )] += 1;
+        thread->Picks += 1;
+
+        if (nanoseconds > thread->MaxNanoseconds) {
+
+            thread->MaxNanoseconds = nanoseconds;
+        }
+
+        if (path) {
+
+            if (!path->Active) {
+
+                thread->StalePicks += 1;
+            }
+
+            //
+            // The request completes right away.
+            //
+            InterlockedDecrement( &path->NumberOfRequestsInFlight );
+        }
+    }
+
+    thread->Seed = seed;
+
+    return 0;
+}
+
+
+VOID
+PathFlapHold (
+    _In_ PPATHFLAP_RUN Run
+    )
+/*++
+
+Routine Description:
+
+    Models the work the DSM does while it holds DsmContextLock exclusive to
+    process a path arrival or removal.
+
+--*/
+{
+    LARGE_INTEGER start;
+    LARGE_INTEGER now;
+    LONGLONG ticks = (LONGLONG)Run->HoldMicroseconds * Run->Frequency.QuadPart / 1000000;
+
+    QueryPerformanceCounter( &start );
+
+    do {
+
+        YieldProcessor();
+        QueryPerformanceCounter( &now );
+
+    } while (now.QuadPart - start.QuadPart < ticks);
+}
+
+
+VOID
+PathFlapFlap (
+    _In_ PPATHFLAP_RUN Run
+    )
+/*++
+
+Routine Description:
+
+    Takes the next path down, or brings it back up. Groups and paths are
+    visited in turn, and the last active path of a group is never taken down,
+    as the DSM always keeps a path to route requests to.
+
+--*/
+{
+    PPATHFLAP_GROUP group = &Run->Groups[Run->Flaps % PATHFLAP_GROUPS];
+    PPATHFLAP_PATH path = &group->Paths[(Run->Flaps / PATHFLAP_GROUPS) % PATHFLAP_PATHS];
+    ULONG active = 0;
+    ULONG inx;
+
+    AcquireSRWLockExclusive( &Run->DsmContextLock );
+
+    for (inx = 0; inx < PATHFLAP_PATHS; inx++) {
+
+        active += (group->Paths[inx].Active != 0);
+    }
+
+    if (!path->Active) {
+
+        InterlockedExchange( &path->Active, 1 );
+
+    } else if (active > 1) {
+
+        InterlockedExchange( &path->Active, 0 );
+    }
+
+    PathFlapHold( Run );
+
+    if (Run->UseSnapshots) {
+
+        PathFlapUpdateSnapshot( group );
+    }
+
+    ReleaseSRWLockExclusive( &Run->DsmContextLock );
+
+    Run->Flaps += 1;
+}
+
+
+VOID
+PathFlapReport (
+    _In_ PPATHFLAP_RUN Run,
+    _In_ PPATHFLAP_THREAD Threads,
+    _In_ ULONG ThreadCount,
+    _In_ ULONG Seconds
+    )
+{
+    ULONGLONG histogram[PATHFLAP_BUCKETS] = {0};
+    ULONGLONG picks = 0;
+    ULONGLONG stale = 0;
+    ULONGLONG maxNanoseconds = 0;
+    ULONGLONG count;
+    ULONGLONG percentiles[3] = {0};
+    ULONG fractions[3] = {500, 990, 999};
+    ULONG i;
+    ULONG j;
+
+    for (i = 0; i < ThreadCount; i++) {
+
+        picks += Threads[i].Picks;
+        stale += Threads[i].StalePicks;
+        maxNanoseconds = max( maxNanoseconds, Threads[i].MaxNanoseconds );
+
+        for (j = 0; j < PATHFLAP_BUCKETS; j++) {
+
+            histogram[j] += Threads[i].Histogram[j];
+        }
+    }
+
+    for (i = 0; i < 3; i++) {
+
+        count = 0;
+
+        for (j = 0; j < PATHFLAP_BUCKETS; j++) {
+
+            count += histogram[j];
+
+            if (count * 1000 >= picks * fractions[i]) {
+
+                percentiles[i] = min( PathFlapBucketLimit( j ), maxNanoseconds );
+                break;
+            }
+        }
+    }
+
+    printf( "%-9s %12llu %9llu %9llu %9llu %10llu %10llu %7u\n",
+            Run->UseSnapshots ? "snapshot" : "locked",
+            picks / Seconds,
+            percentiles[0],
+            percentiles[1],
+            percentiles[2],
+            maxNanoseconds,
+            stale,
+            Run->Flaps );
+}
+
+
+int
+_cdecl
+main (
+    _In_ int argc,
+    _In_reads_(argc) char *argv[]
+    )
+{
+    PPATHFLAP_RUN run;
+    PPATHFLAP_THREAD threads;
+    SYSTEM_INFO systemInfo;
+    ULONG seconds = PATHFLAP_DEFAULT_SECONDS;
+    ULONG flapMilliseconds = PATHFLAP_DEFAULT_FLAP_MS;
+    ULONG holdMicroseconds = PATHFLAP_DEFAULT_HOLD_US;
+    ULONG threadCount;
+    ULONGLONG startTime;
+    ULONG mode;
+    ULONG i;
+    ULONG j;
+
+    GetSystemInfo( &systemInfo );
+    threadCount = max( systemInfo.dwNumberOfProcessors, 2 );
+
+    if (argc > 1) {
+
+        if (argv[1][0] == '?' || argv[1][0] == '-' || argv[1][0] == '/') {
+
+            Usage();
+            return 0;
+        }
+
+        seconds = atoi( argv[1] );
+    }
+
+    if (argc > 2) {
+
+        flapMilliseconds = atoi( argv[2] );
+    }
+
+    if (argc > 3) {
+
+        holdMicroseconds = atoi( argv[3] );
+    }
+
+    if (argc > 4) {
+
+        threadCount = atoi( argv[4] );
+    }
+
+    if (seconds == 0 || flapMilliseconds == 0 ||
+        threadCount == 0 || threadCount > PATHFLAP_MAX_THREADS) {
+
+        Usage();
+        return 1;
+    }
+
+    run = _aligned_malloc( sizeof(PATHFLAP_RUN), SYSTEM_CACHE_ALIGNMENT_SIZE );
+    threads = calloc( threadCount, sizeof(PATHFLAP_THREAD) );
+
+    if (run == NULL || threads == NULL) {
+
+        printf( "Out of memory\n" );
+        return 1;
+    }
+
+    printf( "Pathflap: %u processors, %u threads, %u groups of %u paths, %u seconds per mode\n",
+            systemInfo.dwNumberOfProcessors,
+            threadCount,
+            PATHFLAP_GROUPS,
+            PATHFLAP_PATHS,
+            seconds );
+    printf( "A path flaps every %u ms, holding the context lock for %u us\n",
+            flapMilliseconds,
+            holdMicroseconds );
+    printf( "%-9s %12s %9s %9s %9s %10s %10s %7s\n",
+            "mode", "picks/s", "p50 ns", "p99 ns", "p99.9 ns", "max ns", "stale", "flaps" );
+
+    for (mode = 0; mode < 2; mode++) {
+
+        ZeroMemory( run, sizeof(PATHFLAP_RUN) );
+        ZeroMemory( threads, threadCount * sizeof(PATHFLAP_THREAD) );
+
+        InitializeSRWLock( &run->DsmContextLock );
+        run->UseSnapshots = (mode == 1);
+        run->HoldMicroseconds = holdMicroseconds;
+        QueryPerformanceFrequency( &run->Frequency );
+
+        for (i = 0; i < PATHFLAP_GROUPS; i++) {
+
+            InitializeSRWLock( &run->Groups[i].PathSnapshotLock );
+
+            for (j = 0; j < PATHFLAP_PATHS; j++) {
+
+                run->Groups[i].Paths[j].Active = 1;
+            }
+
+            if (run->UseSnapshots) {
+
+                PathFlapUpdateSnapshot( &run->Groups[i] );
+            }
+        }
+
+        run->StartEvent = CreateEvent( NULL, TRUE, FALSE, NULL );
+
+        if (run->StartEvent == NULL) {
+
+            printf( "Failed to create the start event: %u\n", GetLastError() );
+            return 1;
+        }
+
+        for (i = 0; i < threadCount; i++) {
+
+            threads[i].Run = run;
+            threads[i].Seed = i * 7919 + 1;
+            threads[i].Thread = CreateThread( NULL, 0, PathFlapReader, &threads[i], 0, NULL );
+
+            if (threads[i].Thread == NULL) {
+
+                printf( "Failed to create thread: %u\n", GetLastError() );
+                return 1;
+            }
+        }
+
+        SetEvent( run->StartEvent );
+        startTime = GetTickCount64();
+
+        while (GetTickCount64() - startTime < seconds * 1000ULL) {
+
+            Sleep( flapMilliseconds );
+            PathFlapFlap( run );
+        }
+
+        InterlockedExchange( &run->Stop, 1 );
+
+        for (i = 0; i < threadCount; i++) {
+
+            WaitForSingleObject( threads[i].Thread, INFINITE );
+            CloseHandle( threads[i].Thread );
+        }
+
+        CloseHandle( run->StartEvent );
+
+        PathFlapReport( run, threads, threadCount, seconds );
+
+        for (i = 0; i < PATHFLAP_GROUPS; i++) {
+
+            if (run->Groups[i].PathSnapshot) {
+
+                PathFlapDereferenceSnapshot( run->Groups[i].PathSnapshot );
+            }
+        }
+    }
+
+    free( threads );
+    _aligned_free( run );
+
+    return 0;
+}
@@ -167,7 +167,7 @@ Return Value:
                      }
 
                      DsmpFreeZombieGroupList(failGroup);
-                     DsmpFreePool(failGroup);
+                     DsmpDereferenceFOGroup(failGroup);
                      InterlockedDecrement((LONG volatile*)&DsmContext->NumberFOGroups);
                  }
              }
@@ -211,7 +211,7 @@ Return Value:
                      InterlockedDecrement((LONG volatile*)&DsmContext->NumberStaleFOGroups);
                      NT_ASSERT(IsListEmpty(&failGroup->FOG_DeviceList));
                      DsmpFreeZombieGroupList(failGroup);
-                     DsmpFreePool(failGroup);
+                     DsmpDereferenceFOGroup(failGroup);
                  }
              }
         }
@@ -378,6 +378,7 @@ Return Value:
     if (group) {
 
         InitializeListHead(&group->FailingDevInfoList);
+        KeInitializeSpinLock(&group->StreamLock);
         group->GroupNumber = InterlockedIncrement((LONG volatile*)&DsmContext->NumberGroups);
         group->GroupSig = DSM_GROUP_SIG;
         group->State = DSM_GP_NORMAL;
@@ -2202,6 +2203,11 @@ Return Value:
 
         failOverGroup->FailOverSig = DSM_FOG_SIG;
 
+        //
+        // This reference is dropped when the path is removed.
+        //
+        failOverGroup->ReferenceCount = 1;
+
         //
         // Add it to the global list.
         //
@@ -2833,6 +2839,11 @@ Return Value:
     //
     DsmpRemoveZombieGroupEntry(DsmContext, GroupEntry);
 
+    //
+    // No more requests will be routed using this group's path snapshot.
+    //
+    DsmpReleasePathSnapshot(GroupEntry);
+
     //
     // Add it to the list of multi-path groups.
     //
@@ -3286,483 +3297,1525 @@ DsmpDecrementCounters(
 }
 
 
-PDSM_FAILOVER_GROUP
-DsmpGetPath(
-    _In_ IN PDSM_CONTEXT DsmContext,
-    _In_ IN PDSM_IDS DsmList,
-    _In_ IN PSCSI_REQUEST_BLOCK Srb
+VOID
+DsmpUpdateServiceTime(
+    _In_ PDSM_FAILOVER_GROUP FailGroup,
+    _In_ ULONGLONG StartTime
     )
 /*++
 
 Routine Description:
 
-    This routine will pick a path, for processing a request, based
-    on the current LoadBalance policy that is set.
+    This routine folds the service time of a completed read/write request
+    into the moving average kept for the path that it was sent down.
 
-    N.B: This routine must be called with DSM Context Lock held in Shared mode.
+    N.B: Concurrent completions on the same path race to update the average,
+         so the update is done using a compare-exchange loop.
 
 Arguments:
 
-    DsmContext - DSM context given to MPIO during initialization
-    DsmList    - List of DSM Ids sent by MPIO
-    Srb        - The read/write/verify request
+    FailGroup - The path that serviced the request.
+    StartTime - Interrupt time at which the request was dispatched.
 
 Return Value:
 
-    FailOver Group that should be used for processing the request
+    None
+
 --*/
 {
-    //
-    // Algorithm:
-    // ==========
-    // Failover-only:
-    // --------------
-    //      If symmetric LUA (ie. ALUA not supported, or symmetric LUA using ALUA semantics (viz. storage reports
-    //                                                              implicit-only transitions and all TPGs in A/O):
-    //          One path AO,            <- this will be the only path used for I/O
-    //          M paths in SB,          <- one of these will be made active on failure of the above active path
-    //          Rest of the paths Failed (Invalidated/PendingRemove/Removed)
-    //
-    //      If ALUA:
-    //          One path AO,            <- this will be the only path used for I/O
-    //          M paths in AU, SB or UA <- one of these made active on failover. Pref: AU > SB > UA. Also, controller affinity.
-    //          Rest of the paths Failed
-    //
-    //      Automatic failback will happen only if Preferred path has been set.
-    //      This is the only policy that will support failback.
-    //
-    // Round-Robin:
-    // ------------
-    //      If symmetric LUA:
-    //          N paths AO,             <- round robin among these
-    //          Rest of the paths Failed
-    //
-    //      If ALUA:
-    //          Round Robin policy not supported since all paths can't be in A/O state.
-    //
-    // Round-Robin With Subset:
-    // ------------------------
-    //      If symmetric LUA:
-    //          N paths AO,             <- round robin among these
-    //          M paths SB,             <- if no active paths left, make one of these active
-    //          Rest of the paths Failed
-    //
-    //      If ALUA:
-    //          N paths AO,             <- round robin among these (NOTE: paths in AU not considered)
-    //          M paths AU, SB or UA    <- if no active paths, make subset of these active (based on TPG states after transition)
-    //          Rest of the paths Failed
-    //
-    // Least-Queue Depth:
-    // ------------------
-    //      If symmetric LUA:
-    //          N paths AO,             <- one with least outstanding I/O is chosen
-    //          Rest of the paths Failed
-    //
-    //      If ALUA:
-    //          N paths AO,             <- one with least outstanding I/O is chosen
-    //          M paths AU, SB or UA    <- if no AO paths available, subset of these become active (based on TPG
-    //                                        states after transition) - one with least outstanding I/O is chosen.
-    //          Rest of the paths Failed
-    //
-    // Least-Weighted:
-    // ---------------
-    //      If symmetric LUA:
-    //          N paths AO,             <- every path has an associated weight, path with least weight is used.
-    //          Rest of the paths Failed
-    //
-    //      If ALUA:
-    //          N paths AO,
-    //          M paths AU, SB or UA    <- if no AO paths available, subset of these become active (based on TPG
-    //                                        states after transition) - path with least weight used.
-    //          Rest of the paths Failed
-    //
-    // Least-Blocks:
-    // -------------
-    //      If symmetric LUA:
-    //          N paths AO,             <- one with least cumulative outstanding IO is chosen
-    //          Rest of the paths Failed
-    //
-    //      If ALUA:
-    //          N paths AO,             <- one with least cumulative outstanding IO is chosen
-    //          M paths AU, SB or UA    <- if no AO paths available, subset of these become active (based on TPG
-    //                                        states after transition) - one with least cumulative outstanding is chosen.
-    //
-    // Actual implementation of algorithm happens in the following routines: DsmpGetAnyActivePath,
-    //          DsmpGetActivePathToBeUsed, flavors of DsmpSetLBForPathXXX.
-    //
-
-    PDSM_FAILOVER_GROUP failGroup = NULL;
-    PDSM_DEVICE_INFO deviceInfo = DsmList->IdList[0];
-    PDSM_GROUP_ENTRY groupEntry;
-    ULONG inx = 0;
-
-    UNREFERENCED_PARAMETER(DsmContext);
-
-    TracePrint((TRACE_LEVEL_VERBOSE,
-                TRACE_FLAG_RW,
-                "DsmpGetPath (DsmIds %p): Entering function.\n",
-                DsmList));
+    ULONGLONG currentTime = KeQueryInterruptTime();
+    LONGLONG sample;
+    LONGLONG oldAverage;
+    LONGLONG newAverage;
 
-    if (!(DsmList->Count && deviceInfo)) {
-
-        TracePrint((TRACE_LEVEL_ERROR,
-                    TRACE_FLAG_RW,
-                    "DsmpGetPath (DsmIds %p): Called with no available paths.\n",
-                    DsmList));
+    if (!StartTime || currentTime < StartTime) {
 
-        goto __Exit_DsmpGetPath;
+        return;
     }
 
-    groupEntry = deviceInfo->Group;
-    DSM_ASSERT(groupEntry->GroupSig == DSM_GROUP_SIG);
+    sample = (LONGLONG)(currentTime - StartTime);
 
-    switch (groupEntry->LoadBalanceType) {
+    do {
 
-        case DSM_LB_FAILOVER:
-        case DSM_LB_WEIGHTED_PATHS: {
+        oldAverage = InterlockedCompareExchange64(&FailGroup->AverageServiceTime, 0, 0);
+
+        if (oldAverage == 0) {
 
             //
-            // For FailOverOnly there is only one active path so we can
-            // just grab it from the cached location and go with it.
-            // For LeastWeightPath we always choose the lowest weighted
-            // one so we grab that and go
+            // First sample on this path, so use it as is.
             //
-            failGroup = groupEntry->PathToBeUsed;
+            newAverage = sample << DSM_LST_EWMA_SHIFT;
 
-            break;
+        } else {
+
+            newAverage = oldAverage + sample - (oldAverage >> DSM_LST_EWMA_SHIFT);
         }
 
-        case DSM_LB_ROUND_ROBIN:
-        case DSM_LB_ROUND_ROBIN_WITH_SUBSET: {
+    } while (InterlockedCompareExchange64(&FailGroup->AverageServiceTime, newAverage, oldAverage) != oldAverage);
 
-            PDSM_DEVICE_INFO candidateDevice = NULL;
-            PDSM_GROUP_ENTRY newGroup = NULL;
-            ULONG newPath;
-            BOOLEAN foundPath = FALSE;
-            ULONG jnx = 0;
-            ULONG counter = 0;
-            BOOLEAN reset = FALSE;
+    InterlockedExchange64(&FailGroup->LastServiceTimeUpdate, (LONGLONG)currentTime);
 
-            for (inx = 0; inx < DsmList->Count; inx++) {
+    return;
+}
 
-                deviceInfo = DsmList->IdList[inx];
 
-                if (!(deviceInfo && DsmpIsDeviceInitialized(deviceInfo) && DsmpIsDeviceUsable(deviceInfo) && DsmpIsDeviceUsablePR(deviceInfo))) {
+ULONGLONG
+DsmpGetExpectedServiceTime(
+    _In_ PDSM_FAILOVER_GROUP FailGroup,
+    _In_ ULONGLONG CurrentTime
+    )
+/*++
 
-                    continue;
-                }
+Routine Description:
 
-                if (deviceInfo->FailGroup == groupEntry->PathToBeUsed) {
+    This routine estimates how long a new request sent down the given path
+    will take to complete. This is the average service time of the path
+    multiplied by the number of requests that will be ahead of it.
 
-                    //
-                    // We've reached the devInfo that corresponds to the path
-                    // that we should be using. If this devInfo is not in the
-                    // right state to be used, we need to find the first candidate
-                    // starting from this one to satisfy the request.
-                    // To play it safe, we may have already considered a previous
-                    // devInfo to be a candidate, that now needs to be reset to
-                    // the one that we now find.
-                    //
-                    reset = TRUE;
-                }
+    The average is aged if the path hasn't completed a request in a while,
+    so that a path that was slow at one point gets to be tried again.
 
-#if DBG
-                if (deviceInfo->TargetPortGroup && !DsmpIsDeviceFailedState(deviceInfo->State)) {
+Arguments:
 
-                    if (deviceInfo->State != deviceInfo->ALUAState) {
+    FailGroup - The path being considered.
+    CurrentTime - Current interrupt time.
 
-                        DSM_ASSERT(groupEntry->LoadBalanceType == DSM_LB_ROUND_ROBIN_WITH_SUBSET &&
-                                   deviceInfo->State == DSM_DEV_ACTIVE_UNOPTIMIZED &&
-                                   deviceInfo->DesiredState != DSM_DEV_ACTIVE_OPTIMIZED);
-                    }
-                }
-#endif
+Return Value:
 
-                if (deviceInfo->State == DSM_DEV_ACTIVE_OPTIMIZED) {
+    The expected service time (in 100ns units).
 
-                    if (!candidateDevice || reset) {
+--*/
+{
+    ULONGLONG averageServiceTime;
+    ULONGLONG lastUpdate;
+    ULONGLONG agingIntervals;
+    LONG requestsInFlight;
 
-                        candidateDevice = deviceInfo;
-                        TracePrint((TRACE_LEVEL_WARNING,
-                                    TRACE_FLAG_RW,
-                                    "DsmpGetPath (DsmIds %p): Candidate device %p.\n",
-                                    DsmList,
-                                    candidateDevice));
+    averageServiceTime = (ULONGLONG)InterlockedCompareExchange64(&FailGroup->AverageServiceTime, 0, 0) >> DSM_LST_EWMA_SHIFT;
+    lastUpdate = (ULONGLONG)InterlockedCompareExchange64(&FailGroup->LastServiceTimeUpdate, 0, 0);
 
-                        jnx = inx;
-                    }
+    if (lastUpdate && CurrentTime > lastUpdate) {
 
-                    if (!groupEntry->PathToBeUsed || deviceInfo->FailGroup == groupEntry->PathToBeUsed) {
+        agingIntervals = (CurrentTime - lastUpdate) / DSM_LST_AGING_INTERVAL;
 
-                        //
-                        // The devInfo that corresponds to the path that we were
-                        // supposed to use, is in a state that makes it usable.
-                        // So we've found our devInfo.
-                        //
-                        InterlockedExchangePointer(&(groupEntry->PathToBeUsed), (PVOID)deviceInfo->FailGroup);
-                        foundPath = TRUE;
-                        candidateDevice = NULL;
+        if (agingIntervals >= 63) {
 
-                        break;
-                    }
-                }
-            }
+            averageServiceTime = 0;
 
-            if (!foundPath) {
+        } else {
 
-                if (candidateDevice) {
+            averageServiceTime >>= agingIntervals;
+        }
+    }
 
-                    InterlockedExchangePointer(&(groupEntry->PathToBeUsed), (PVOID)candidateDevice->FailGroup);
-                    inx = jnx;
-                    candidateDevice = NULL;
+    if (averageServiceTime < DSM_LST_MIN_SERVICE_TIME) {
 
-                } else {
+        averageServiceTime = DSM_LST_MIN_SERVICE_TIME;
+    }
 
-                    inx = 0;
-                }
-            }
+    requestsInFlight = InterlockedCompareExchange(&FailGroup->NumberOfRequestsInFlight, 0, 0);
+    if (requestsInFlight < 0) {
 
-            failGroup = groupEntry->PathToBeUsed;
+        requestsInFlight = 0;
+    }
 
-            TracePrint((TRACE_LEVEL_WARNING,
-                        TRACE_FLAG_RW,
-                        "DsmpGetPath (DsmIds %p): Path to be used is %p.\n",
-                        DsmList,
-                        groupEntry->PathToBeUsed));
+    return averageServiceTime * ((ULONGLONG)requestsInFlight + 1);
+}
 
-            //
-            // The current chosen path is given by failGroup. Find the next path
-            // that should be chosen in the RoundRobin policy. Start with the
-            // device at index inx + 1, and look for the one with Active state.
-            //
-            for (counter = 0, jnx = inx + 1;
-                 counter < DsmList->Count && !newGroup;
-                 counter++, jnx++) {
 
-                newPath = jnx % DsmList->Count;
+PDSM_DEVICE_INFO
+DsmpGetActiveDeviceOnPath(
+    _In_ IN PDSM_IDS DsmList,
+    _In_ IN PDSM_FAILOVER_GROUP FailGroup
+    )
+/*++
 
-                deviceInfo = DsmList->IdList[newPath];
+Routine Description:
 
-                if (!(deviceInfo && DsmpIsDeviceInitialized(deviceInfo) && DsmpIsDeviceUsable(deviceInfo) && DsmpIsDeviceUsablePR(deviceInfo))) {
+    This routine finds the device in the given list that is on the given path,
+    provided it can be used for I/O and is in A/O state.
 
-                    continue;
-                }
+Arguments:
 
-                if (deviceInfo->State == DSM_DEV_ACTIVE_OPTIMIZED) {
+    DsmList - List of DSM Ids sent by MPIO
+    FailGroup - The path
 
-                    newGroup = deviceInfo->Group;
-                    DSM_ASSERT(newGroup == groupEntry);
+Return Value:
 
-                    InterlockedExchangePointer(&(newGroup->PathToBeUsed), (PVOID)deviceInfo->FailGroup);
+    The device on the path, or NULL if there isn't a usable A/O one.
 
-                    TracePrint((TRACE_LEVEL_WARNING,
-                                TRACE_FLAG_RW,
-                                "DsmpGetPath (DsmIds %p): New Path is %p.\n",
-                                DsmList,
-                                newGroup->PathToBeUsed));
+--*/
+{
+    PDSM_DEVICE_INFO deviceInfo;
+    ULONG inx;
+
+    for (inx = 0; inx < DsmList->Count; inx++) {
+
+        deviceInfo = DsmList->IdList[inx];
+
+        if (!(deviceInfo && DsmpIsDeviceInitialized(deviceInfo) && DsmpIsDeviceUsable(deviceInfo) && DsmpIsDeviceUsablePR(deviceInfo))) {
+
+            continue;
+        }
+
+        if (deviceInfo->FailGroup == FailGroup &&
+            deviceInfo->State == DSM_DEV_ACTIVE_OPTIMIZED) {
+
+            return deviceInfo;
+        }
+    }
+
+    return NULL;
+}
+
+
+PDSM_FAILOVER_GROUP
+DsmpGetSequentialStreamPath(
+    _In_ IN PDSM_CONTEXT DsmContext,
+    _In_ IN PDSM_GROUP_ENTRY Group,
+    _In_ IN PDSM_IDS DsmList,
+    _In_ IN PSCSI_REQUEST_BLOCK Srb,
+    _Out_ OUT PULONG StreamIndex
+    )
+/*++
+
+Routine Description:
+
+    This routine matches a read/write request against the sequential streams
+    being tracked for the group. If the request continues a stream that is
+    bound to a path, and the stream hasn't used up its share of bytes on that
+    path, the same path is returned.
+
+    If the request continues a stream that needs to be (re)bound to a path,
+    the index of the stream is returned so that the caller can bind it to
+    the path picked by the load balance policy.
+
+    N.B: This routine must be called with DSM Context Lock held in Shared mode.
+
+Arguments:
+
+    DsmContext - DSM context given to MPIO during initialization
+    Group - The multi-path group that the request is for
+    DsmList - List of DSM Ids sent by MPIO
+    Srb - The request
+    StreamIndex - Returns the index of the stream that needs to be bound to
+                  the path chosen by the caller, or DSM_MAX_SEQUENTIAL_STREAMS
+                  if there isn't one.
+
+Return Value:
+
+    The path that the stream is bound to, or NULL if the policy should choose.
+
+--*/
+{
+    PDSM_FAILOVER_GROUP failGroup = NULL;
+    PDSM_DEVICE_INFO deviceInfo = NULL;
+    PDSM_SEQUENTIAL_STREAM stream = NULL;
+    PDSM_SEQUENTIAL_STREAM victim = NULL;
+    PCDB cdb;
+    ULONG bytes;
+    ULONGLONG startLba = 0;
+    ULONG numBlocks = 0;
+    ULONG inx;
+
+    *StreamIndex = DSM_MAX_SEQUENTIAL_STREAMS;
+
+    cdb = SrbGetCdb(Srb);
+
+    if (!(cdb && DsmIsReadWrite(cdb->AsByte[0]))) {
+
+        return NULL;
+    }
+
+    bytes = SrbGetDataTransferLength(Srb);
+
+    if (SrbGetCdbLength(Srb) == 16) {
+
+        REVERSE_BYTES_QUAD(&startLba, &cdb->CDB16.LogicalBlock);
+        REVERSE_BYTES(&numBlocks, &cdb->CDB16.TransferLength);
+
+    } else {
+
+        REVERSE_BYTES(&startLba, &cdb->CDB10.LogicalBlockByte0);
+        REVERSE_BYTES_SHORT(&numBlocks, &cdb->CDB10.TransferBlocksMsb);
+    }
+
+    KeAcquireSpinLockAtDpcLevel(&Group->StreamLock);
+
+    Group->StreamClock++;
+
+    for (inx = 0; inx < DSM_MAX_SEQUENTIAL_STREAMS; inx++) {
+
+        if (Group->Streams[inx].SequentialCount &&
+            Group->Streams[inx].NextLba == startLba) {
+
+            stream = &Group->Streams[inx];
+            break;
+        }
+
+        if (!victim ||
+            !Group->Streams[inx].SequentialCount ||
+            (victim->SequentialCount && Group->StreamClock - Group->Streams[inx].LastUsed > Group->StreamClock - victim->LastUsed)) {
+
+            victim = &Group->Streams[inx];
+        }
+    }
+
+    if (!stream) {
+
+        //
+        // Not part of any known stream. Start tracking it in place of the
+        // least recently used entry in case more requests follow it.
+        //
+        victim->NextLba = startLba + numBlocks;
+        victim->BytesOnPath = 0;
+        victim->FailGroup = NULL;
+        victim->SequentialCount = 1;
+        victim->LastUsed = Group->StreamClock;
+
+        goto __Exit_DsmpGetSequentialStreamPath;
+    }
+
+    stream->NextLba = startLba + numBlocks;
+    stream->LastUsed = Group->StreamClock;
+
+    if (stream->SequentialCount < MAXULONG) {
+
+        stream->SequentialCount++;
+    }
+
+    if (stream->SequentialCount < DSM_SEQUENTIAL_STREAM_THRESHOLD) {
+
+        goto __Exit_DsmpGetSequentialStreamPath;
+    }
+
+    //
+    // Stay on the stream's path as long as it is still A/O, it hasn't been
+    // sent its share of the stream yet, and it isn't at its request limit.
+    //
+    if (stream->FailGroup &&
+        stream->BytesOnPath + bytes <= Group->StreamAffinityBytes) {
+
+        deviceInfo = DsmpGetActiveDeviceOnPath(DsmList, stream->FailGroup);
+
+        if (deviceInfo &&
+            (!Group->MaxRequestsPerPath ||
+             (ULONG)InterlockedCompareExchange(&deviceInfo->FailGroup->NumberOfRequestsInFlight, 0, 0) < Group->MaxRequestsPerPath)) {
+
+            stream->BytesOnPath += bytes;
+            failGroup = deviceInfo->FailGroup;
+        }
+    }
+
+    if (!failGroup) {
+
+        //
+        // The stream needs to move on to the path that the policy picks.
+        //
+        stream->FailGroup = NULL;
+        stream->BytesOnPath = bytes;
+        *StreamIndex = (ULONG)(stream - Group->Streams);
+    }
+
+__Exit_DsmpGetSequentialStreamPath:
+
+    KeReleaseSpinLockFromDpcLevel(&Group->StreamLock);
+
+    if (failGroup && !DsmContext->DisableStatsGathering) {
+
+        InterlockedExchangeAdd64((LONGLONG volatile*)&deviceInfo->DeviceStats.SequentialStreamBytes, bytes);
+    }
+
+    return failGroup;
+}
+
+
+VOID
+DsmpBindSequentialStream(
+    _In_ IN PDSM_CONTEXT DsmContext,
+    _In_ IN PDSM_GROUP_ENTRY Group,
+    _In_ IN PDSM_IDS DsmList,
+    _In_ IN ULONG StreamIndex,
+    _In_ IN PDSM_FAILOVER_GROUP FailGroup
+    )
+/*++
+
+Routine Description:
+
+    This routine binds a sequential stream, as returned by
+    DsmpGetSequentialStreamPath, to the path chosen for its current request.
+
+    N.B: This routine must be called with DSM Context Lock held in Shared mode.
+
+Arguments:
+
+    DsmContext - DSM context given to MPIO during initialization
+    Group - The multi-path group that the request is for
+    DsmList - List of DSM Ids sent by MPIO
+    StreamIndex - Index of the stream to bind
+    FailGroup - The path chosen for the request
+
+Return Value:
+
+    None
+
+--*/
+{
+    PDSM_SEQUENTIAL_STREAM stream = &Group->Streams[StreamIndex];
+    PDSM_DEVICE_INFO deviceInfo;
+    ULONGLONG bytes = 0;
+    BOOLEAN bound = FALSE;
+
+    KeAcquireSpinLockAtDpcLevel(&Group->StreamLock);
+
+    //
+    // The entry may have been recycled for another stream in the meantime,
+    // in which case there is nothing to bind.
+    //
+    if (!stream->FailGroup &&
+        stream->SequentialCount >= DSM_SEQUENTIAL_STREAM_THRESHOLD) {
+
+        stream->FailGroup = FailGroup;
+        bytes = stream->BytesOnPath;
+        bound = TRUE;
+    }
+
+    KeReleaseSpinLockFromDpcLevel(&Group->StreamLock);
+
+    if (bound && !DsmContext->DisableStatsGathering) {
+
+        deviceInfo = DsmpGetActiveDeviceOnPath(DsmList, FailGroup);
+
+        if (deviceInfo) {
+
+            InterlockedIncrement((LONG volatile*)&deviceInfo->DeviceStats.SequentialStreamsBound);
+            InterlockedExchangeAdd64((LONGLONG volatile*)&deviceInfo->DeviceStats.SequentialStreamBytes, bytes);
+        }
+    }
+
+    TracePrint((TRACE_LEVEL_VERBOSE,
+                TRACE_FLAG_RW,
+                "DsmpBindSequentialStream (Group %p): Stream %u bound %u to path %p.\n",
+                Group,
+                StreamIndex,
+                bound,
+                FailGroup));
+
+    return;
+}
+
+
+PDSM_FAILOVER_GROUP
+DsmpApplyPathRequestLimit(
+    _In_ IN PDSM_CONTEXT DsmContext,
+    _In_ IN PDSM_GROUP_ENTRY Group,
+    _In_ IN PDSM_IDS DsmList,
+    _In_ IN PDSM_FAILOVER_GROUP FailGroup
+    )
+/*++
+
+Routine Description:
+
+    If the path chosen by the load balance policy already has the maximum
+    number of requests outstanding, this routine picks the A/O path with the
+    fewest outstanding requests that is below the limit instead.
+
+    If every A/O path is at its limit, the chosen path is used anyway since
+    the request still needs to be sent somewhere.
+
+    N.B: This routine must be called with DSM Context Lock held in Shared mode.
+
+Arguments:
+
+    DsmContext - DSM context given to MPIO during initialization
+    Group - The multi-path group that the request is for
+    DsmList - List of DSM Ids sent by MPIO
+    FailGroup - The path chosen by the load balance policy
+
+Return Value:
+
+    The path to use.
+
+--*/
+{
+    PDSM_FAILOVER_GROUP failGroup = NULL;
+    PDSM_DEVICE_INFO deviceInfo;
+    LONG leastQueueDepth;
+    LONG queueDepth;
+    ULONG inx;
+
+    if ((ULONG)InterlockedCompareExchange(&FailGroup->NumberOfRequestsInFlight, 0, 0) < Group->MaxRequestsPerPath) {
+
+        return FailGroup;
+    }
+
+    leastQueueDepth = (Group->MaxRequestsPerPath > MAXLONG) ? MAXLONG : (LONG)Group->MaxRequestsPerPath;
+
+    for (inx = 0; inx < DsmList->Count; inx++) {
+
+        deviceInfo = DsmList->IdList[inx];
+
+        if (!(deviceInfo && DsmpIsDeviceInitialized(deviceInfo) && DsmpIsDeviceUsable(deviceInfo) && DsmpIsDeviceUsablePR(deviceInfo))) {
+
+            continue;
+        }
+
+        if (deviceInfo->State != DSM_DEV_ACTIVE_OPTIMIZED || deviceInfo->FailGroup == FailGroup) {
+
+            continue;
+        }
+
+        queueDepth = InterlockedCompareExchange(&deviceInfo->FailGroup->NumberOfRequestsInFlight, 0, 0);
+
+        if (queueDepth < leastQueueDepth) {
+
+            leastQueueDepth = queueDepth;
+            failGroup = deviceInfo->FailGroup;
+        }
+    }
+
+    if (!failGroup) {
+
+        return FailGroup;
+    }
+
+    TracePrint((TRACE_LEVEL_VERBOSE,
+                TRACE_FLAG_RW,
+                "DsmpApplyPathRequestLimit (Group %p): Path %p at request limit, using path %p.\n",
+                Group,
+                FailGroup,
+                failGroup));
+
+    if (!DsmContext->DisableStatsGathering) {
+
+        deviceInfo = DsmpGetActiveDeviceOnPath(DsmList, FailGroup);
+
+        if (deviceInfo) {
+
+            InterlockedIncrement((LONG volatile*)&deviceInfo->DeviceStats.QueueLimitRedirects);
+        }
+    }
+
+    return failGroup;
+}
+
+
+PDSM_FAILOVER_GROUP
+DsmpGetPath(
+    _In_ IN PDSM_CONTEXT DsmContext,
+    _In_ IN PDSM_IDS DsmList,
+    _In_ IN PSCSI_REQUEST_BLOCK Srb
+    )
+/*++
+
+Routine Description:
+
+    This routine will pick a path, for processing a request, based
+    on the current LoadBalance policy that is set.
+
+    N.B: This routine must be called with DSM Context Lock held in Shared mode.
+
+Arguments:
+
+    DsmContext - DSM context given to MPIO during initialization
+    DsmList    - List of DSM Ids sent by MPIO
+    Srb        - The read/write/verify request
+
+Return Value:
+
+    FailOver Group that should be used for processing the request
+--*/
+{
+    //
+    // Algorithm:
+    // ==========
+    // Failover-only:
+    // --------------
+    //      If symmetric LUA (ie. ALUA not supported, or symmetric LUA using ALUA semantics (viz. storage reports
+    //                                                              implicit-only transitions and all TPGs in A/O):
+    //          One path AO,            <- this will be the only path used for I/O
+    //          M paths in SB,          <- one of these will be made active on failure of the above active path
+    //          Rest of the paths Failed (Invalidated/PendingRemove/Removed)
+    //
+    //      If ALUA:
+    //          One path AO,            <- this will be the only path used for I/O
+    //          M paths in AU, SB or UA <- one of these made active on failover. Pref: AU > SB > UA. Also, controller affinity.
+    //          Rest of the paths Failed
+    //
+    //      Automatic failback will happen only if Preferred path has been set.
+    //      This is the only policy that will support failback.
+    //
+    // Round-Robin:
+    // ------------
+    //      If symmetric LUA:
+    //          N paths AO,             <- round robin among these
+    //          Rest of the paths Failed
+    //
+    //      If ALUA:
+    //          Round Robin policy not supported since all paths can't be in A/O state.
+    //
+    // Round-Robin With Subset:
+    // ------------------------
+    //      If symmetric LUA:
+    //          N paths AO,             <- round robin among these
+    //          M paths SB,             <- if no active paths left, make one of these active
+    //          Rest of the paths Failed
+    //
+    //      If ALUA:
+    //          N paths AO,             <- round robin among these (NOTE: paths in AU not considered)
+    //          M paths AU, SB or UA    <- if no active paths, make subset of these active (based on TPG states after transition)
+    //          Rest of the paths Failed
+    //
+    // Least-Queue Depth:
+    // ------------------
+    //      If symmetric LUA:
+    //          N paths AO,             <- one with least outstanding I/O is chosen
+    //          Rest of the paths Failed
+    //
+    //      If ALUA:
+    //          N paths AO,             <- one with least outstanding I/O is chosen
+    //          M paths AU, SB or UA    <- if no AO paths available, subset of these become active (based on TPG
+    //                                        states after transition) - one with least outstanding I/O is chosen.
+    //          Rest of the paths Failed
+    //
+    // Least-Weighted:
+    // ---------------
+    //      If symmetric LUA:
+    //          N paths AO,             <- every path has an associated weight, path with least weight is used.
+    //          Rest of the paths Failed
+    //
+    //      If ALUA:
+    //          N paths AO,
+    //          M paths AU, SB or UA    <- if no AO paths available, subset of these become active (based on TPG
+    //                                        states after transition) - path with least weight used.
+    //          Rest of the paths Failed
+    //
+    // Least-Blocks:
+    // -------------
+    //      If symmetric LUA:
+    //          N paths AO,             <- one with least cumulative outstanding IO is chosen
+    //          Rest of the paths Failed
+    //
+    //      If ALUA:
+    //          N paths AO,             <- one with least cumulative outstanding IO is chosen
+    //          M paths AU, SB or UA    <- if no AO paths available, subset of these become active (based on TPG
+    //                                        states after transition) - one with least cumulative outstanding is chosen.
+    //
+    // Least-Service Time:
+    // -------------------
+    //      If symmetric LUA:
+    //          N paths AO,             <- one with least expected service time (average completion latency times
+    //                                        the number of requests that will be ahead of this one) is chosen
+    //          Rest of the paths Failed
+    //
+    //      If ALUA:
+    //          N paths AO,             <- one with least expected service time is chosen
+    //          M paths AU, SB or UA    <- if no AO paths available, subset of these become active (based on TPG
+    //                                        states after transition) - one with least expected service time is chosen.
+    //
+    // Actual implementation of algorithm happens in the following routines: DsmpGetAnyActivePath,
+    //          DsmpGetActivePathToBeUsed, flavors of DsmpSetLBForPathXXX.
+    //
+
+    PDSM_FAILOVER_GROUP failGroup = NULL;
+    PDSM_DEVICE_INFO deviceInfo = DsmList->IdList[0];
+    PDSM_GROUP_ENTRY groupEntry;
+    ULONG inx = 0;
+    ULONG streamIndex = DSM_MAX_SEQUENTIAL_STREAMS;
+
+    TracePrint((TRACE_LEVEL_VERBOSE,
+                TRACE_FLAG_RW,
+                "DsmpGetPath (DsmIds %p): Entering function.\n",
+                DsmList));
+
+    if (!(DsmList->Count && deviceInfo)) {
+
+        TracePrint((TRACE_LEVEL_ERROR,
+                    TRACE_FLAG_RW,
+                    "DsmpGetPath (DsmIds %p): Called with no available paths.\n",
+                    DsmList));
+
+        goto __Exit_DsmpGetPath;
+    }
+
+    groupEntry = deviceInfo->Group;
+    DSM_ASSERT(groupEntry->GroupSig == DSM_GROUP_SIG);
+
+    //
+    // Keep the requests of a sequential stream on one path so as not to defeat
+    // the array's prefetching. Least Blocks already does this for sequential
+    // IO when it is set up to use the cache, so leave it alone in that case.
+    //
+    if (Srb &&
+        groupEntry->StreamAffinityBytes &&
+        DsmpIsMultiPathLoadBalanceType(groupEntry) &&
+        !(groupEntry->LoadBalanceType == DSM_LB_LEAST_BLOCKS && groupEntry->UseCacheForLeastBlocks)) {
+
+        failGroup = DsmpGetSequentialStreamPath(DsmContext, groupEntry, DsmList, Srb, &streamIndex);
+
+        if (failGroup) {
+
+            TracePrint((TRACE_LEVEL_VERBOSE,
+                        TRACE_FLAG_RW,
+                        "DsmpGetPath (DsmIds %p): Sequential stream, so using same path %p.\n",
+                        DsmList,
+                        failGroup));
+
+            goto __Exit_DsmpGetPath;
+        }
+    }
+
+    switch (groupEntry->LoadBalanceType) {
+
+        case DSM_LB_FAILOVER:
+        case DSM_LB_WEIGHTED_PATHS: {
+
+            //
+            // For FailOverOnly there is only one active path so we can
+            // just grab it from the cached location and go with it.
+            // For LeastWeightPath we always choose the lowest weighted
+            // one so we grab that and go
+            //
+            failGroup = groupEntry->PathToBeUsed;
+
+            break;
+        }
+
+        case DSM_LB_ROUND_ROBIN:
+        case DSM_LB_ROUND_ROBIN_WITH_SUBSET: {
+
+            PDSM_DEVICE_INFO candidateDevice = NULL;
+            PDSM_GROUP_ENTRY newGroup = NULL;
+            ULONG newPath;
+            BOOLEAN foundPath = FALSE;
+            ULONG jnx = 0;
+            ULONG counter = 0;
+            BOOLEAN reset = FALSE;
+
+            for (inx = 0; inx < DsmList->Count; inx++) {
+
+                deviceInfo = DsmList->IdList[inx];
+
+                if (!(deviceInfo && DsmpIsDeviceInitialized(deviceInfo) && DsmpIsDeviceUsable(deviceInfo) && DsmpIsDeviceUsablePR(deviceInfo))) {
+
+                    continue;
+                }
+
+                if (deviceInfo->FailGroup == groupEntry->PathToBeUsed) {
+
+                    //
+                    // We've reached the devInfo that corresponds to the path
+                    // that we should be using. If this devInfo is not in the
+                    // right state to be used, we need to find the first candidate
+                    // starting from this one to satisfy the request.
+                    // To play it safe, we may have already considered a previous
+                    // devInfo to be a candidate, that now needs to be reset to
+                    // the one that we now find.
+                    //
+                    reset = TRUE;
+                }
+
+#if DBG
+                if (deviceInfo->TargetPortGroup && !DsmpIsDeviceFailedState(deviceInfo->State)) {
+
+                    if (deviceInfo->State != deviceInfo->ALUAState) {
+
+                        DSM_ASSERT(groupEntry->LoadBalanceType == DSM_LB_ROUND_ROBIN_WITH_SUBSET &&
+                                   deviceInfo->State == DSM_DEV_ACTIVE_UNOPTIMIZED &&
+                                   deviceInfo->DesiredState != DSM_DEV_ACTIVE_OPTIMIZED);
+                    }
+                }
+#endif
+
+                if (deviceInfo->State == DSM_DEV_ACTIVE_OPTIMIZED) {
+
+                    if (!candidateDevice || reset) {
+
+                        candidateDevice = deviceInfo;
+                        TracePrint((TRACE_LEVEL_WARNING,
+                                    TRACE_FLAG_RW,
+                                    "DsmpGetPath (DsmIds %p): Candidate device %p.\n",
+                                    DsmList,
+                                    candidateDevice));
+
+                        jnx = inx;
+                    }
+
+                    if (!groupEntry->PathToBeUsed || deviceInfo->FailGroup == groupEntry->PathToBeUsed) {
+
+                        //
+                        // The devInfo that corresponds to the path that we were
+                        // supposed to use, is in a state that makes it usable.
+                        // So we've found our devInfo.
+                        //
+                        InterlockedExchangePointer(&(groupEntry->PathToBeUsed), (PVOID)deviceInfo->FailGroup);
+                        foundPath = TRUE;
+                        candidateDevice = NULL;
+
+                        break;
+                    }
+                }
+            }
+
+            if (!foundPath) {
+
+                if (candidateDevice) {
+
+                    InterlockedExchangePointer(&(groupEntry->PathToBeUsed), (PVOID)candidateDevice->FailGroup);
+                    inx = jnx;
+                    candidateDevice = NULL;
+
+                } else {
+
+                    inx = 0;
+                }
+            }
+
+            failGroup = groupEntry->PathToBeUsed;
+
+            TracePrint((TRACE_LEVEL_WARNING,
+                        TRACE_FLAG_RW,
+                        "DsmpGetPath (DsmIds %p): Path to be used is %p.\n",
+                        DsmList,
+                        groupEntry->PathToBeUsed));
+
+            //
+            // The current chosen path is given by failGroup. Find the next path
+            // that should be chosen in the RoundRobin policy. Start with the
+            // device at index inx + 1, and look for the one with Active state.
+            //
+            for (counter = 0, jnx = inx + 1;
+                 counter < DsmList->Count && !newGroup;
+                 counter++, jnx++) {
+
+                newPath = jnx % DsmList->Count;
+
+                deviceInfo = DsmList->IdList[newPath];
+
+                if (!(deviceInfo && DsmpIsDeviceInitialized(deviceInfo) && DsmpIsDeviceUsable(deviceInfo) && DsmpIsDeviceUsablePR(deviceInfo))) {
+
+                    continue;
+                }
+
+                if (deviceInfo->State == DSM_DEV_ACTIVE_OPTIMIZED) {
+
+                    newGroup = deviceInfo->Group;
+                    DSM_ASSERT(newGroup == groupEntry);
+
+                    InterlockedExchangePointer(&(newGroup->PathToBeUsed), (PVOID)deviceInfo->FailGroup);
+
+                    TracePrint((TRACE_LEVEL_WARNING,
+                                TRACE_FLAG_RW,
+                                "DsmpGetPath (DsmIds %p): New Path is %p.\n",
+                                DsmList,
+                                newGroup->PathToBeUsed));
+
+                     break;
+                }
+            }
+
+            break;
+        }
+
+        case DSM_LB_DYN_LEAST_QUEUE_DEPTH: {
+
+            LONG leastQueueDepth = 0x7FFFFFFF;
+
+            for (inx = 0; inx < DsmList->Count; inx++) {
+
+                deviceInfo = DsmList->IdList[inx];
+
+                if (!(deviceInfo && DsmpIsDeviceInitialized(deviceInfo) && DsmpIsDeviceUsable(deviceInfo) && DsmpIsDeviceUsablePR(deviceInfo))) {
+
+                    continue;
+                }
+
+                if (deviceInfo->State == DSM_DEV_ACTIVE_OPTIMIZED &&
+                    deviceInfo->FailGroup->NumberOfRequestsInFlight < leastQueueDepth) {
+
+                    leastQueueDepth = deviceInfo->FailGroup->NumberOfRequestsInFlight;
+                    failGroup = deviceInfo->FailGroup;
+                }
+            }
+
+            if (failGroup) {
+
+                TracePrint((TRACE_LEVEL_WARNING,
+                            TRACE_FLAG_RW,
+                            "DsmpGetPath (DsmIds %p): Path to be used for LQD is %p.\n",
+                            DsmList,
+                            failGroup));
+
+            } else {
+
+                //
+                // It is possible for ALUA storage supporting implicit transitions
+                // that the storage initiated a transition that left no TPG in A/O
+                // state. For such storages, we should return some path instead of
+                // just failing the I/O. The path will likely be an A/U path until
+                // the storage does a transition to make a TPG A/O.
+                //
+                if (!DsmpIsSymmetricAccess((PDSM_DEVICE_INFO)DsmList->IdList[0]) &&
+                    ((PDSM_DEVICE_INFO)DsmList->IdList[0])->ALUASupport != DSM_DEVINFO_ALUA_EXPLICIT) {
+
+                    //
+                    // Use the same path as the one used for the previous request.
+                    //
+                    failGroup = groupEntry->PathToBeUsed;
+
+                    TracePrint((TRACE_LEVEL_WARNING,
+                                TRACE_FLAG_PNP,
+                                "DsmpGetPath (DsmIds %p): Using same path (FOG %p) as previous request for LQD.\n",
+                                DsmList,
+                                failGroup));
+                } else {
+
+                    TracePrint((TRACE_LEVEL_ERROR,
+                                TRACE_FLAG_RW,
+                                "DsmpGetPath (DsmIds %p): Failed to find a path for LQD.\n",
+                                DsmList));
+                }
+            }
+
+            break;
+        }
+
+        case DSM_LB_LEAST_BLOCKS: {
+
+            ULONG bytes = 0;
+            PCDB cdb = NULL;
+            ULONG cdbLength = 0;
+            BOOLEAN isRead = FALSE;
+            BOOLEAN isWrite = FALSE;
+            PDSM_FAILOVER_GROUP lastPathUsed = groupEntry->PathToBeUsed;
+            ULONGLONG leastOutstandingIO = MAXULONGLONG;
+            ULONGLONG startLba = 0;
+
+            //
+            // Use the last path under the following conditions:
+            //
+            // 1. The cache is disabled or
+            // 2. This is not a read/write request or
+            // 3. This is a read/write request
+            //   a. The request is sequential and
+            //   b. The cache is not exhausted
+            //
+
+            if (Srb) {
+
+                cdb = SrbGetCdb(Srb);
+
+                if (cdb && DsmIsReadRequest(cdb->AsByte[0])) {
+
+                    isRead = TRUE;
+                }
+
+                if (cdb && DsmIsWriteRequest(cdb->AsByte[0])) {
+
+                    isWrite = TRUE;
+                }
+            }
+
+            if ((isRead || isWrite) && (groupEntry->UseCacheForLeastBlocks)) {
+
+                bytes = SrbGetDataTransferLength(Srb);
+
+                cdbLength = SrbGetCdbLength(Srb);
+
+                if (cdbLength == 16) {
+
+                    REVERSE_BYTES_QUAD(&startLba, &cdb->CDB16.LogicalBlock);
+
+                } else {
+
+                    REVERSE_BYTES(&startLba, &cdb->CDB10.LogicalBlockByte0);
+                }
+
+                //
+                // Check if:
+                // 1. The IO is sequential, AND
+                // 2. It is either:
+                //    a. read request, OR
+                //    b. write request and outstanding bytes will be within the cache limit
+                //
+                if ((startLba >= lastPathUsed->LastLba) &&
+                    ((isRead) ||
+                     (isWrite && lastPathUsed->OutstandingBytesOfIO + bytes <= groupEntry->CacheSizeForLeastBlocks))) {
+
+                    failGroup = groupEntry->PathToBeUsed;
+
+                    TracePrint((TRACE_LEVEL_WARNING,
+                                TRACE_FLAG_RW,
+                                "DsmpGetPath (DsmIds %p): Sequential IO, so using same path %p for LeastBlocks.\n",
+                                DsmList,
+                                failGroup));
+                }
+
+            } else {
+
+                failGroup = groupEntry->PathToBeUsed;
+            }
+
+            if (!failGroup) {
+
+                for (inx = 0; inx < DsmList->Count; inx++) {
+
+                    deviceInfo = DsmList->IdList[inx];
+
+                    if (!(deviceInfo && DsmpIsDeviceInitialized(deviceInfo) && DsmpIsDeviceUsable(deviceInfo) && DsmpIsDeviceUsablePR(deviceInfo))) {
+
+                        continue;
+                    }
+
+                    if (deviceInfo->State == DSM_DEV_ACTIVE_OPTIMIZED &&
+                        deviceInfo->FailGroup->OutstandingBytesOfIO < leastOutstandingIO) {
+
+                        leastOutstandingIO = deviceInfo->FailGroup->OutstandingBytesOfIO;
+                        failGroup = deviceInfo->FailGroup;
+                    }
+                }
+            }
+
+            if (failGroup) {
+
+                TracePrint((TRACE_LEVEL_WARNING,
+                            TRACE_FLAG_RW,
+                            "DsmpGetPath (DsmIds %p): Path to be used for LeastBlocks is %p.\n",
+                            DsmList,
+                            failGroup));
+
+            } else {
+
+                //
+                // It is possible for ALUA storage supporting implicit transitions
+                // that the storage initiated a transition that left no TPG in A/O
+                // state. For such storages, we should return some path instead of
+                // just failing the I/O. The path will likely be an A/U path until
+                // the storage does a transition to make a TPG A/O.
+                //
+                if (!DsmpIsSymmetricAccess((PDSM_DEVICE_INFO)DsmList->IdList[0]) &&
+                    ((PDSM_DEVICE_INFO)DsmList->IdList[0])->ALUASupport != DSM_DEVINFO_ALUA_EXPLICIT) {
+
+                    //
+                    // Use the same path as the one used for the previous request.
+                    //
+                    failGroup = groupEntry->PathToBeUsed;
+
+                    TracePrint((TRACE_LEVEL_WARNING,
+                                TRACE_FLAG_PNP,
+                                "DsmpGetPath (DsmIds %p): Using same path (FOG %p) as previous request for LeastBlocks.\n",
+                                DsmList,
+                                failGroup));
+                } else {
+
+                    TracePrint((TRACE_LEVEL_ERROR,
+                                TRACE_FLAG_RW,
+                                "DsmpGetPath (DsmIds %p): Failed to find a path for LeastBlocks.\n",
+                                DsmList));
+                }
+            }
+
+            break;
+        }
+
+        case DSM_LB_LEAST_SERVICE_TIME: {
+
+            ULONGLONG currentTime = KeQueryInterruptTime();
+            ULONGLONG expectedServiceTime;
+            ULONGLONG leastServiceTime = MAXULONGLONG;
+
+            for (inx = 0; inx < DsmList->Count; inx++) {
+
+                deviceInfo = DsmList->IdList[inx];
+
+                if (!(deviceInfo && DsmpIsDeviceInitialized(deviceInfo) && DsmpIsDeviceUsable(deviceInfo) && DsmpIsDeviceUsablePR(deviceInfo))) {
+
+                    continue;
+                }
+
+                if (deviceInfo->State == DSM_DEV_ACTIVE_OPTIMIZED) {
+
+                    expectedServiceTime = DsmpGetExpectedServiceTime(deviceInfo->FailGroup, currentTime);
+
+                    if (expectedServiceTime < leastServiceTime) {
+
+                        leastServiceTime = expectedServiceTime;
+                        failGroup = deviceInfo->FailGroup;
+                    }
+                }
+            }
+
+            if (failGroup) {
+
+                TracePrint((TRACE_LEVEL_WARNING,
+                            TRACE_FLAG_RW,
+                            "DsmpGetPath (DsmIds %p): Path to be used for LST is %p (expected service time %I64u).\n",
+                            DsmList,
+                            failGroup,
+                            leastServiceTime));
+
+            } else {
+
+                //
+                // It is possible for ALUA storage supporting implicit transitions
+                // that the storage initiated a transition that left no TPG in A/O
+                // state. For such storages, we should return some path instead of
+                // just failing the I/O. The path will likely be an A/U path until
+                // the storage does a transition to make a TPG A/O.
+                //
+                if (!DsmpIsSymmetricAccess((PDSM_DEVICE_INFO)DsmList->IdList[0]) &&
+                    ((PDSM_DEVICE_INFO)DsmList->IdList[0])->ALUASupport != DSM_DEVINFO_ALUA_EXPLICIT) {
+
+                    //
+                    // Use the same path as the one used for the previous request.
+                    //
+                    failGroup = groupEntry->PathToBeUsed;
+
+                    TracePrint((TRACE_LEVEL_WARNING,
+                                TRACE_FLAG_PNP,
+                                "DsmpGetPath (DsmIds %p): Using same path (FOG %p) as previous request for LST.\n",
+                                DsmList,
+                                failGroup));
+                } else {
+
+                    TracePrint((TRACE_LEVEL_ERROR,
+                                TRACE_FLAG_RW,
+                                "DsmpGetPath (DsmIds %p): Failed to find a path for LST.\n",
+                                DsmList));
+                }
+            }
+
+            break;
+        }
+
+        default: {
+
+            TracePrint((TRACE_LEVEL_ERROR,
+                        TRACE_FLAG_RW,
+                        "DsmpGetPath (DsmIds %p): Invalid LB Type %d set for group %p.\n",
+                        DsmList,
+                        groupEntry->LoadBalanceType,
+                        groupEntry));
+
+            DSM_ASSERT(FALSE);
+
+            break;
+        }
+    }
+
+    if (failGroup) {
+
+        if (groupEntry->MaxRequestsPerPath && DsmpIsMultiPathLoadBalanceType(groupEntry)) {
+
+            failGroup = DsmpApplyPathRequestLimit(DsmContext, groupEntry, DsmList, failGroup);
+        }
+
+        if (streamIndex < DSM_MAX_SEQUENTIAL_STREAMS) {
+
+            DsmpBindSequentialStream(DsmContext, groupEntry, DsmList, streamIndex, failGroup);
+        }
+    }
+
+__Exit_DsmpGetPath:
+
+    TracePrint((TRACE_LEVEL_VERBOSE,
+                TRACE_FLAG_RW,
+                "DsmpGetPath (DsmIds %p): Exiting function with failGroup %p.\n",
+                DsmList,
+                failGroup));
+
+    return failGroup;
+}
+
+
+VOID
+DsmpDereferenceFOGroup(
+    _In_ IN PDSM_FAILOVER_GROUP FailGroup
+    )
+/*++
+
+Routine Description:
+
+    This routine drops a reference on a failover group, and frees it once
+    the last reference is gone.
+
+    N.B: The FOG must already have been removed from the DSM's lists by the
+         time the reference owned by the DSM is dropped.
+
+Arguments:
+
+    FailGroup - The failover group.
+
+Return Value:
+
+    None
+
+--*/
+{
+    if (InterlockedDecrement(&FailGroup->ReferenceCount) == 0) {
+
+        DsmpFreePool(FailGroup);
+    }
+
+    return;
+}
+
+
+PDSM_PATH_SNAPSHOT
+DsmpReferencePathSnapshot(
+    _In_ IN PDSM_GROUP_ENTRY Group
+    )
+/*++
+
+Routine Description:
+
+    This routine returns the group's published path snapshot with a reference
+    taken on it. The caller must drop the reference using
+    DsmpDereferencePathSnapshot.
+
+    Taking the snapshot lock in Shared mode only excludes the snapshot being
+    replaced at the same time, never any other request.
+
+Arguments:
+
+    Group - The multi-path group.
+
+Return Value:
+
+    The snapshot, or NULL if none is published.
+
+--*/
+{
+    PDSM_PATH_SNAPSHOT snapshot;
+    KIRQL irql;
+
+    irql = ExAcquireSpinLockShared(&Group->PathSnapshotLock);
+
+    snapshot = Group->PathSnapshot;
+    if (snapshot) {
+
+        InterlockedIncrement(&snapshot->ReferenceCount);
+    }
+
+    ExReleaseSpinLockShared(&Group->PathSnapshotLock, irql);
+
+    return snapshot;
+}
+
+
+VOID
+DsmpDereferencePathSnapshot(
+    _In_ IN PDSM_PATH_SNAPSHOT Snapshot
+    )
+/*++
+
+Routine Description:
+
+    This routine drops a reference on a path snapshot. When the last reference
+    goes away the snapshot is freed, along with its references on the paths.
+
+Arguments:
+
+    Snapshot - The path snapshot.
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONG inx;
+
+    if (InterlockedDecrement(&Snapshot->ReferenceCount) == 0) {
+
+        for (inx = 0; inx < Snapshot->NumberPaths; inx++) {
+
+            DsmpDereferenceFOGroup(Snapshot->Paths[inx]);
+        }
+
+        DsmpFreePool(Snapshot);
+    }
+
+    return;
+}
+
+
+VOID
+DsmpUpdatePathSnapshot(
+    _In_ IN PDSM_GROUP_ENTRY Group
+    )
+/*++
+
+Routine Description:
+
+    This routine builds a new path snapshot from the group's current state and
+    publishes it in place of the old one. It is called by the routines that
+    change the state of the group's paths or its load balance policy, once
+    they are done, so only this group's snapshot is replaced. Requests that
+    already hold a reference on the old snapshot keep using it until they are
+    done with it.
+
+    If the allocation fails, the old snapshot is still withdrawn, so that
+    requests are routed through DsmpGetPath until the next update.
+
+    N.B: This routine must be called with DSM Context Lock held in Exclusive mode.
+
+Arguments:
+
+    Group - The multi-path group.
+
+Return Value:
+
+    None
+
+--*/
+{
+    PDSM_PATH_SNAPSHOT snapshot = NULL;
+    PDSM_PATH_SNAPSHOT oldSnapshot;
+    PDSM_DEVICE_INFO deviceInfo;
+    KIRQL irql;
+    ULONG inx;
+
+    //
+    // DsmpGetPathFromSnapshot doesn't use the snapshot if sequential stream
+    // affinity or the per-path request limit are configured.
+    //
+    if (!(Group->StreamAffinityBytes || Group->MaxRequestsPerPath)) {
+
+        snapshot = DsmpAllocatePool(NonPagedPoolNx,
+                                    sizeof(DSM_PATH_SNAPSHOT),
+                                    DSM_TAG_PATH_SNAPSHOT);
+
+        if (snapshot) {
+
+            snapshot->ReferenceCount = 1;
+            snapshot->LoadBalanceType = Group->LoadBalanceType;
+
+            if (Group->LoadBalanceType == DSM_LB_FAILOVER ||
+                Group->LoadBalanceType == DSM_LB_WEIGHTED_PATHS) {
+
+                if (Group->PathToBeUsed) {
+
+                    snapshot->Paths[snapshot->NumberPaths++] = Group->PathToBeUsed;
+                }
+
+            } else {
+
+                for (inx = 0; inx < Group->NumberDevices; inx++) {
+
+                    deviceInfo = Group->DeviceList[inx];
+
+                    if (!(deviceInfo && DsmpIsDeviceInitialized(deviceInfo) && DsmpIsDeviceUsable(deviceInfo) && DsmpIsDeviceUsablePR(deviceInfo))) {
+
+                        continue;
+                    }
+
+                    if (deviceInfo->State == DSM_DEV_ACTIVE_OPTIMIZED && deviceInfo->FailGroup) {
+
+                        snapshot->Paths[snapshot->NumberPaths++] = deviceInfo->FailGroup;
+                    }
+                }
+            }
+
+            for (inx = 0; inx < snapshot->NumberPaths; inx++) {
+
+                InterlockedIncrement(&snapshot->Paths[inx]->ReferenceCount);
+            }
+
+        } else {
+
+            TracePrint((TRACE_LEVEL_WARNING,
+                        TRACE_FLAG_RW,
+                        "DsmpUpdatePathSnapshot (Group %p): Failed to allocate path snapshot.\n",
+                        Group));
+        }
+    }
+
+    irql = ExAcquireSpinLockExclusive(&Group->PathSnapshotLock);
+
+    oldSnapshot = Group->PathSnapshot;
+    Group->PathSnapshot = snapshot;
+
+    ExReleaseSpinLockExclusive(&Group->PathSnapshotLock, irql);
+
+    if (oldSnapshot) {
+
+        DsmpDereferencePathSnapshot(oldSnapshot);
+    }
+
+    TracePrint((TRACE_LEVEL_VERBOSE,
+                TRACE_FLAG_RW,
+                "DsmpUpdatePathSnapshot (Group %p): Published snapshot %p.\n",
+                Group,
+                snapshot));
+
+    return;
+}
+
+
+VOID
+DsmpReleasePathSnapshot(
+    _In_ IN PDSM_GROUP_ENTRY Group
+    )
+/*++
 
-                     break;
-                }
-            }
+Routine Description:
 
-            break;
-        }
+    This routine withdraws the group's path snapshot, if any. Called when the
+    group is being removed.
 
-        case DSM_LB_DYN_LEAST_QUEUE_DEPTH: {
+Arguments:
 
-            LONG leastQueueDepth = 0x7FFFFFFF;
+    Group - The multi-path group.
 
-            for (inx = 0; inx < DsmList->Count; inx++) {
+Return Value:
 
-                deviceInfo = DsmList->IdList[inx];
+    None
 
-                if (!(deviceInfo && DsmpIsDeviceInitialized(deviceInfo) && DsmpIsDeviceUsable(deviceInfo) && DsmpIsDeviceUsablePR(deviceInfo))) {
+--*/
+{
+    PDSM_PATH_SNAPSHOT snapshot;
+    KIRQL irql;
 
-                    continue;
-                }
+    irql = ExAcquireSpinLockExclusive(&Group->PathSnapshotLock);
 
-                if (deviceInfo->State == DSM_DEV_ACTIVE_OPTIMIZED &&
-                    deviceInfo->FailGroup->NumberOfRequestsInFlight < leastQueueDepth) {
+    snapshot = Group->PathSnapshot;
+    Group->PathSnapshot = NULL;
 
-                    leastQueueDepth = deviceInfo->FailGroup->NumberOfRequestsInFlight;
-                    failGroup = deviceInfo->FailGroup;
-                }
-            }
+    ExReleaseSpinLockExclusive(&Group->PathSnapshotLock, irql);
 
-            if (failGroup) {
+    if (snapshot) {
 
-                TracePrint((TRACE_LEVEL_WARNING,
-                            TRACE_FLAG_RW,
-                            "DsmpGetPath (DsmIds %p): Path to be used for LQD is %p.\n",
-                            DsmList,
-                            failGroup));
+        DsmpDereferencePathSnapshot(snapshot);
+    }
 
-            } else {
+    return;
+}
 
-                //
-                // It is possible for ALUA storage supporting implicit transitions
-                // that the storage initiated a transition that left no TPG in A/O
-                // state. For such storages, we should return some path instead of
-                // just failing the I/O. The path will likely be an A/U path until
-                // the storage does a transition to make a TPG A/O.
-                //
-                if (!DsmpIsSymmetricAccess((PDSM_DEVICE_INFO)DsmList->IdList[0]) &&
-                    ((PDSM_DEVICE_INFO)DsmList->IdList[0])->ALUASupport != DSM_DEVINFO_ALUA_EXPLICIT) {
 
-                    //
-                    // Use the same path as the one used for the previous request.
-                    //
-                    failGroup = groupEntry->PathToBeUsed;
+PVOID
+DsmpGetPathFromSnapshot(
+    _In_ IN PDSM_IDS DsmList
+    )
+/*++
 
-                    TracePrint((TRACE_LEVEL_WARNING,
-                                TRACE_FLAG_PNP,
-                                "DsmpGetPath (DsmIds %p): Using same path (FOG %p) as previous request for LQD.\n",
-                                DsmList,
-                                failGroup));
-                } else {
+Routine Description:
 
-                    TracePrint((TRACE_LEVEL_ERROR,
-                                TRACE_FLAG_RW,
-                                "DsmpGetPath (DsmIds %p): Failed to find a path for LQD.\n",
-                                DsmList));
-                }
-            }
+    This routine picks a path for a read/write request using the group's
+    published path snapshot, without acquiring DSM Context Lock. This keeps
+    I/O from stalling behind path arrival, removal and failover processing
+    that holds the lock in Exclusive mode. While that processing is going on,
+    requests are routed using the group's previous snapshot, until the new
+    one is published at the end of it.
 
-            break;
-        }
+    NULL is returned whenever the request needs DsmpGetPath to pick its path:
+    - no snapshot is published,
+    - no A/O path is in the snapshot (ALUA fallbacks need the lock),
+    - sequential stream affinity, the per-path request limit or the Least
+      Blocks cache are configured, since those track state per request.
 
-        case DSM_LB_LEAST_BLOCKS: {
+Arguments:
 
-            ULONG bytes = 0;
-            PCDB cdb = NULL;
-            ULONG cdbLength = 0;
-            BOOLEAN isRead = FALSE;
-            BOOLEAN isWrite = FALSE;
-            PDSM_FAILOVER_GROUP lastPathUsed = groupEntry->PathToBeUsed;
-            ULONGLONG leastOutstandingIO = MAXULONGLONG;
-            ULONGLONG startLba = 0;
+    DsmList - List of DSM Ids sent by MPIO
 
-            //
-            // Use the last path under the following conditions:
-            //
-            // 1. The cache is disabled or
-            // 2. This is not a read/write request or
-            // 3. This is a read/write request
-            //   a. The request is sequential and
-            //   b. The cache is not exhausted
-            //
+Return Value:
 
-            if (Srb) {
+    PathId of the path to use, or NULL.
 
-                cdb = SrbGetCdb(Srb);
+--*/
+{
+    PDSM_GROUP_ENTRY group = ((PDSM_DEVICE_INFO)DsmList->IdList[0])->Group;
+    PDSM_PATH_SNAPSHOT snapshot;
+    PDSM_FAILOVER_GROUP failGroup = NULL;
+    PVOID pathId = NULL;
+    ULONG inx;
 
-                if (cdb && DsmIsReadRequest(cdb->AsByte[0])) {
+    if (group->StreamAffinityBytes || group->MaxRequestsPerPath) {
 
-                    isRead = TRUE;
-                }
+        return NULL;
+    }
 
-                if (cdb && DsmIsWriteRequest(cdb->AsByte[0])) {
+    snapshot = DsmpReferencePathSnapshot(group);
+    if (!snapshot) {
 
-                    isWrite = TRUE;
-                }
-            }
+        return NULL;
+    }
 
-            if ((isRead || isWrite) && (groupEntry->UseCacheForLeastBlocks)) {
+    if (snapshot->NumberPaths == 0) {
 
-                bytes = SrbGetDataTransferLength(Srb);
+        goto __Exit_DsmpGetPathFromSnapshot;
+    }
 
-                cdbLength = SrbGetCdbLength(Srb);
+    switch (snapshot->LoadBalanceType) {
 
-                if (cdbLength == 16) {
+        case DSM_LB_FAILOVER:
+        case DSM_LB_WEIGHTED_PATHS: {
 
-                    REVERSE_BYTES_QUAD(&startLba, &cdb->CDB16.LogicalBlock);
+            failGroup = snapshot->Paths[0];
 
-                } else {
+            break;
+        }
 
-                    REVERSE_BYTES(&startLba, &cdb->CDB10.LogicalBlockByte0);
-                }
+        case DSM_LB_ROUND_ROBIN:
+        case DSM_LB_ROUND_ROBIN_WITH_SUBSET: {
 
-                //
-                // Check if:
-                // 1. The IO is sequential, AND
-                // 2. It is either:
-                //    a. read request, OR
-                //    b. write request and outstanding bytes will be within the cache limit
-                //
-                if ((startLba >= lastPathUsed->LastLba) &&
-                    ((isRead) ||
-                     (isWrite && lastPathUsed->OutstandingBytesOfIO + bytes <= groupEntry->CacheSizeForLeastBlocks))) {
+            inx = (ULONG)InterlockedIncrement(&group->RoundRobinCursor) % snapshot->NumberPaths;
+            failGroup = snapshot->Paths[inx];
 
-                    failGroup = groupEntry->PathToBeUsed;
+            break;
+        }
 
-                    TracePrint((TRACE_LEVEL_WARNING,
-                                TRACE_FLAG_RW,
-                                "DsmpGetPath (DsmIds %p): Sequential IO, so using same path %p for LeastBlocks.\n",
-                                DsmList,
-                                failGroup));
-                }
+        case DSM_LB_DYN_LEAST_QUEUE_DEPTH: {
 
-            } else {
+            LONG leastQueueDepth = 0x7FFFFFFF;
 
-                failGroup = groupEntry->PathToBeUsed;
+            for (inx = 0; inx < snapshot->NumberPaths; inx++) {
+
+                if (snapshot->Paths[inx]->NumberOfRequestsInFlight < leastQueueDepth) {
+
+                    leastQueueDepth = snapshot->Paths[inx]->NumberOfRequestsInFlight;
+                    failGroup = snapshot->Paths[inx];
+                }
             }
 
-            if (!failGroup) {
+            break;
+        }
 
-                for (inx = 0; inx < DsmList->Count; inx++) {
+        case DSM_LB_LEAST_BLOCKS: {
 
-                    deviceInfo = DsmList->IdList[inx];
+            ULONGLONG leastOutstandingIO = MAXULONGLONG;
 
-                    if (!(deviceInfo && DsmpIsDeviceInitialized(deviceInfo) && DsmpIsDeviceUsable(deviceInfo) && DsmpIsDeviceUsablePR(deviceInfo))) {
+            if (group->UseCacheForLeastBlocks) {
 
-                        continue;
-                    }
+                break;
+            }
 
-                    if (deviceInfo->State == DSM_DEV_ACTIVE_OPTIMIZED &&
-                        deviceInfo->FailGroup->OutstandingBytesOfIO < leastOutstandingIO) {
+            for (inx = 0; inx < snapshot->NumberPaths; inx++) {
 
-                        leastOutstandingIO = deviceInfo->FailGroup->OutstandingBytesOfIO;
-                        failGroup = deviceInfo->FailGroup;
-                    }
+                if (snapshot->Paths[inx]->OutstandingBytesOfIO < leastOutstandingIO) {
+
+                    leastOutstandingIO = snapshot->Paths[inx]->OutstandingBytesOfIO;
+                    failGroup = snapshot->Paths[inx];
                 }
             }
 
-            if (failGroup) {
+            break;
+        }
 
-                TracePrint((TRACE_LEVEL_WARNING,
-                            TRACE_FLAG_RW,
-                            "DsmpGetPath (DsmIds %p): Path to be used for LeastBlocks is %p.\n",
-                            DsmList,
-                            failGroup));
+        case DSM_LB_LEAST_SERVICE_TIME: {
 
-            } else {
+            ULONGLONG currentTime = KeQueryInterruptTime();
+            ULONGLONG expectedServiceTime;
+            ULONGLONG leastServiceTime = MAXULONGLONG;
 
-                //
-                // It is possible for ALUA storage supporting implicit transitions
-                // that the storage initiated a transition that left no TPG in A/O
-                // state. For such storages, we should return some path instead of
-                // just failing the I/O. The path will likely be an A/U path until
-                // the storage does a transition to make a TPG A/O.
-                //
-                if (!DsmpIsSymmetricAccess((PDSM_DEVICE_INFO)DsmList->IdList[0]) &&
-                    ((PDSM_DEVICE_INFO)DsmList->IdList[0])->ALUASupport != DSM_DEVINFO_ALUA_EXPLICIT) {
+            for (inx = 0; inx < snapshot->NumberPaths; inx++) {
 
-                    //
-                    // Use the same path as the one used for the previous request.
-                    //
-                    failGroup = groupEntry->PathToBeUsed;
+                expectedServiceTime = DsmpGetExpectedServiceTime(snapshot->Paths[inx], currentTime);
 
-                    TracePrint((TRACE_LEVEL_WARNING,
-                                TRACE_FLAG_PNP,
-                                "DsmpGetPath (DsmIds %p): Using same path (FOG %p) as previous request for LeastBlocks.\n",
-                                DsmList,
-                                failGroup));
-                } else {
+                if (expectedServiceTime < leastServiceTime) {
 
-                    TracePrint((TRACE_LEVEL_ERROR,
-                                TRACE_FLAG_RW,
-                                "DsmpGetPath (DsmIds %p): Failed to find a path for LeastBlocks.\n",
-                                DsmList));
+                    leastServiceTime = expectedServiceTime;
+                    failGroup = snapshot->Paths[inx];
                 }
             }
 
@@ -3771,28 +4824,26 @@ Return Value:
 
         default: {
 
-            TracePrint((TRACE_LEVEL_ERROR,
-                        TRACE_FLAG_RW,
-                        "DsmpGetPath (DsmIds %p): Invalid LB Type %d set for group %p.\n",
-                        DsmList,
-                        groupEntry->LoadBalanceType,
-                        groupEntry));
-
-            DSM_ASSERT(FALSE);
-
             break;
         }
     }
 
-__Exit_DsmpGetPath:
+    if (failGroup) {
+
+        pathId = failGroup->PathId;
+    }
+
+__Exit_DsmpGetPathFromSnapshot:
+
+    DsmpDereferencePathSnapshot(snapshot);
 
     TracePrint((TRACE_LEVEL_VERBOSE,
                 TRACE_FLAG_RW,
-                "DsmpGetPath (DsmIds %p): Exiting function with failGroup %p.\n",
+                "DsmpGetPathFromSnapshot (DsmIds %p): Exiting function with path %p.\n",
                 DsmList,
-                failGroup));
+                pathId));
 
-    return failGroup;
+    return pathId;
 }
 
 
@@ -4384,6 +5435,11 @@ Return Value:
 
     if (failGroup) {
 
+        if (DsmIsReadWrite(opCode)) {
+
+            DsmpUpdateServiceTime(failGroup, completionContext->StartTime);
+        }
+
         DsmpDecrementCounters(failGroup, Srb);
 
         //
@@ -4411,7 +5467,7 @@ Return Value:
                             failGroup,
                             failGroup->PathId));
 
-                DsmpFreePool(failGroup);
+                DsmpDereferenceFOGroup(failGroup);
                 ExReleaseSpinLockExclusive(&(dsmContext->DsmContextLock), oldIrql);
             }
         }
@@ -5041,12 +6097,13 @@ Return Value:
 
     switch (Group->LoadBalanceType) {
 
+        case DSM_LB_LEAST_SERVICE_TIME:
         case DSM_LB_LEAST_BLOCKS:
         case DSM_LB_DYN_LEAST_QUEUE_DEPTH: {
 
             //
-            // Since we choose the path with the smallest queue or cumulative size in
-            // DsmpGetPath, we just pick any path now
+            // Since we choose the path with the smallest queue, cumulative size or
+            // expected service time in DsmpGetPath, we just pick any path now
             //
 
             // fall through
@@ -5493,6 +6550,8 @@ Return Value:
                 devInfo = group->DeviceList[devInfoIndex];
                 DsmpSetNewDefaultLBPolicy(DsmContext, devInfo, group->LoadBalanceType);
             }
+
+            DsmpUpdatePathSnapshot(group);
         }
     }
 
@@ -5692,6 +6751,8 @@ Return Value:
                 devInfo = group->DeviceList[devInfoIndex];
                 DsmpSetNewDefaultLBPolicy(DsmContext, devInfo, group->LoadBalanceType);
             }
+
+            DsmpUpdatePathSnapshot(group);
         }
     }
 
@@ -6056,13 +7117,14 @@ Return Value:
             break;
         }
 
+        case DSM_LB_LEAST_SERVICE_TIME:
         case DSM_LB_LEAST_BLOCKS:
         case DSM_LB_ROUND_ROBIN:
         case DSM_LB_DYN_LEAST_QUEUE_DEPTH:
         case DSM_LB_WEIGHTED_PATHS: {
 
             //
-            // In RR, LWP, LB and LQD all paths are active so the new device
+            // In RR, LWP, LB, LST and LQD all paths are active so the new device
             // becomes AO or AU.
             //
             if (NewDeviceInfo->State != DSM_DEV_ACTIVE_OPTIMIZED) {
@@ -6117,6 +7179,11 @@ __Exit_DsmpSetLBForPathArrival:
         InterlockedExchangePointer(&(group->PathToBeUsed), NULL);
     }
 
+    //
+    // Let requests be routed using the group's new path states.
+    //
+    DsmpUpdatePathSnapshot(group);
+
     TracePrint((TRACE_LEVEL_VERBOSE,
                 TRACE_FLAG_PNP,
                 "DsmpSetLBForPathArrival (DevInfo %p): Exiting function with status %x\n",
@@ -6384,6 +7451,17 @@ __Exit_DsmpSetLBForPathArrivalALUA:
         }
     }
 
+    //
+    // Let requests be routed using the group's new path states.
+    //
+    if (!lockHeld) {
+
+        irql = ExAcquireSpinLockExclusive(&(DsmContext->DsmContextLock));
+        lockHeld = TRUE;
+    }
+
+    DsmpUpdatePathSnapshot(group);
+
     if (lockHeld) {
         ExReleaseSpinLockExclusive(&(DsmContext->DsmContextLock), irql);
     }
@@ -6513,13 +7591,14 @@ Return Value:
             break;
         }
 
+        case DSM_LB_LEAST_SERVICE_TIME:
         case DSM_LB_LEAST_BLOCKS:
         case DSM_LB_ROUND_ROBIN:
         case DSM_LB_WEIGHTED_PATHS:
         case DSM_LB_DYN_LEAST_QUEUE_DEPTH: {
 
             //
-            // In RR, LQD, LB and LWP, all paths are active so we don't
+            // In RR, LQD, LB, LST and LWP, all paths are active so we don't
             // need to worry about activating a new path
             //
             TracePrint((TRACE_LEVEL_INFORMATION,
@@ -6561,6 +7640,11 @@ Return Value:
         InterlockedExchangePointer(&(group->PathToBeUsed), NULL);
     }
 
+    //
+    // Stop routing requests to the removed path.
+    //
+    DsmpUpdatePathSnapshot(group);
+
     ExReleaseSpinLockExclusive(&(DsmContext->DsmContextLock), irql);
 
     TracePrint((TRACE_LEVEL_VERBOSE,
@@ -6649,7 +7733,7 @@ Return Value:
     }
 
     if (group->LoadBalanceType < DSM_LB_FAILOVER ||
-        group->LoadBalanceType > DSM_LB_LEAST_BLOCKS) {
+        group->LoadBalanceType > DSM_LB_LEAST_SERVICE_TIME) {
 
         status = STATUS_INVALID_PARAMETER;
 
@@ -6807,6 +7891,17 @@ Return Value:
         }
     }
 
+    //
+    // Stop routing requests to the removed path.
+    //
+    if (!lockHeld) {
+
+        irql = ExAcquireSpinLockExclusive(&(DsmContext->DsmContextLock));
+        lockHeld = TRUE;
+    }
+
+    DsmpUpdatePathSnapshot(group);
+
     if (lockHeld) {
 
         ExReleaseSpinLockExclusive(&(DsmContext->DsmContextLock), irql);
@@ -6939,7 +8034,7 @@ Return Value:
     group = FailingDeviceInfo->Group;
 
     if (group->LoadBalanceType < DSM_LB_FAILOVER ||
-        group->LoadBalanceType > DSM_LB_LEAST_BLOCKS) {
+        group->LoadBalanceType > DSM_LB_LEAST_SERVICE_TIME) {
 
         status = STATUS_INVALID_PARAMETER;
 
@@ -7225,6 +8320,14 @@ Return Value:
                     group));
     }
 
+    //
+    // Stop routing requests to the failing path. If an STPG/RTPG was sent
+    // down, the snapshot is published again once it completes.
+    //
+    irql = ExAcquireSpinLockExclusive(&(DsmContext->DsmContextLock));
+    DsmpUpdatePathSnapshot(group);
+    ExReleaseSpinLockExclusive(&(DsmContext->DsmContextLock), irql);
+
     TracePrint((TRACE_LEVEL_VERBOSE,
                 TRACE_FLAG_RW,
                 "DsmpSetLBForPathFailingALUA (DevInfo %p): Exiting function with status %x.\n",
@@ -7300,7 +8403,7 @@ Return Value:
     group = FailingDeviceInfo->Group;
 
     if (group->LoadBalanceType < DSM_LB_FAILOVER ||
-        group->LoadBalanceType > DSM_LB_LEAST_BLOCKS) {
+        group->LoadBalanceType > DSM_LB_LEAST_SERVICE_TIME) {
 
         status = STATUS_INVALID_PARAMETER;
 
@@ -8404,6 +9507,8 @@ Return Value:
                     }
                 }
             }
+
+            DsmpUpdatePathSnapshot(group);
         }
 
         failDevInfoListEntry = DsmpFindFailPathDevInfoEntry(context->CompletionContext->DsmContext,
@@ -8586,6 +9691,7 @@ Return Value:
     UCHAR prScope;
     ULONGLONG saKey;
     ULONGLONG resKey;
+    KIRQL irql;
 
     UNREFERENCED_PARAMETER(Event);
 
@@ -9115,6 +10221,17 @@ __DsmpPersistentReserveOut_RetryRequest:
         }
     }
 
+    //
+    // Registrations decide which paths may be used, so have requests routed
+    // using the new ones.
+    //
+    if (savePRKeyIfAnySucceed || clearPRKey) {
+
+        irql = ExAcquireSpinLockExclusive(&(DsmContext->DsmContextLock));
+        DsmpUpdatePathSnapshot(group);
+        ExReleaseSpinLockExclusive(&(DsmContext->DsmContextLock), irql);
+    }
+
     TracePrint((TRACE_LEVEL_INFORMATION,
                 TRACE_FLAG_IOCTL,
                 "DsmpPersistentReserveOut (DsmIds %p): PR_OUT for %u completed with status %x.\n",
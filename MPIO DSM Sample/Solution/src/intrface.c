@@ -530,6 +530,8 @@ Return Value:
     ULONG maxPRRetryTimeDuringStateTransition = DSM_MAX_PR_UNIT_ATTENTION_RETRY_TIME;
     BOOLEAN useCacheForLeastBlocks = FALSE;
     ULONGLONG cacheSizeForLeastBlocks = 0;
+    ULONG streamAffinityBytes = 0;
+    ULONG maxRequestsPerPath = 0;
     BOOLEAN fakeControllerEntryExists = FALSE;
 
 #if DBG
@@ -968,6 +970,10 @@ Return Value:
                                           &useCacheForLeastBlocks,
                                           &cacheSizeForLeastBlocks);
 
+    DsmpQueryStreamInformationFromRegistry(DsmContext,
+                                           &streamAffinityBytes,
+                                           &maxRequestsPerPath);
+
     //
     // Build LUN's hardware id.  Needs to be called at PASSIVE_LEVEL, so
     // do it before grabbing the lock.  The hardware id of the group is
@@ -1025,6 +1031,8 @@ Return Value:
 
             group->UseCacheForLeastBlocks = useCacheForLeastBlocks;
             group->CacheSizeForLeastBlocks = cacheSizeForLeastBlocks;
+            group->StreamAffinityBytes = streamAffinityBytes;
+            group->MaxRequestsPerPath = maxRequestsPerPath;
 
         } else {
 
@@ -2409,7 +2417,7 @@ Return Value:
             // Free the zombie group list and then the failover group.
             //
             DsmpFreeZombieGroupList(failGroup);
-            DsmpFreePool(failGroup);
+            DsmpDereferenceFOGroup(failGroup);
         }
     }
 
@@ -2866,6 +2874,13 @@ Return Value:
                     foGroup->State = DSM_FG_NORMAL;
                     deviceInfo->State = deviceInfo->LastKnownGoodState;
                 }
+
+                //
+                // The path may be usable again, so route requests over it.
+                //
+                irql = ExAcquireSpinLockExclusive(&(dsmCtxt->DsmContextLock));
+                DsmpUpdatePathSnapshot(group);
+                ExReleaseSpinLockExclusive(&(dsmCtxt->DsmContextLock), irql);
             }
         }
     }
@@ -3543,7 +3558,7 @@ Return Value:
                 // Free the zombie group list and then the failover group.
                 //
                 DsmpFreeZombieGroupList(failGroup);
-                DsmpFreePool(failGroup);
+                DsmpDereferenceFOGroup(failGroup);
             }
         } else {
 
@@ -3648,6 +3663,23 @@ Return Value:
         goto __Exit_DsmLBGetPath;
     }
 
+    //
+    // Try to pick the path from the group's published path snapshot first,
+    // which doesn't need DsmContextLock. A retried request needs to move its
+    // accounting from the old path to the new one under the lock, so it
+    // always goes the slow way.
+    //
+    if (!(Srb && DsmIsReadWrite(opCode) && DsmGetContextFromSrb(Srb))) {
+
+        newPath = DsmpGetPathFromSnapshot(DsmList);
+
+        if (newPath) {
+
+            *Status = STATUS_SUCCESS;
+            goto __Exit_DsmLBGetPath;
+        }
+    }
+
     irql = ExAcquireSpinLockShared(&(dsmContext->DsmContextLock));
 
     deviceInfo = DsmList->IdList[0];
@@ -3798,7 +3830,7 @@ Return Value:
                                         oldPath,
                                         oldPath->PathId));
 
-                            DsmpFreePool(oldPath);
+                            DsmpDereferenceFOGroup(oldPath);
                         }
                     }
 
@@ -4233,6 +4265,7 @@ Return Value:
     completionContext->DeviceInfo = deviceInfo;
     completionContext->DsmContext = DsmContext;
     completionContext->RequestUnique1 = (PVOID)Irp;
+    completionContext->StartTime = KeQueryInterruptTime();
 
     //
     // Save off the path that was selected to service this request in Argument3.
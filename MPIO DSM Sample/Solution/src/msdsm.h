@@ -71,6 +71,15 @@ Notes:
 #define DSM_USE_CACHE_FOR_LEAST_BLOCKS          L"DsmUseCacheForLeastBlocks"
 #define DSM_CACHE_SIZE_FOR_LEAST_BLOCKS         L"DsmCacheSizeForLeastBlocks"
 
+//
+// Names of the values in the registry for the number of bytes of a sequential
+// stream that are sent down the same path before the path is re-evaluated, and
+// for the number of requests that may be outstanding on a path before it gets
+// passed over in favour of another active path.
+//
+#define DSM_STREAM_AFFINITY_BYTES               L"DsmSequentialStreamAffinityBytes"
+#define DSM_MAX_REQUESTS_PER_PATH               L"DsmMaxRequestsPerPath"
+
 //
 // Name of the value in the registry for the maximum request retry time during ALUA
 // state transitions. This value is found in the DSM's Services' Parameters key, and
@@ -99,7 +108,39 @@ Notes:
 //
 // Number of LB Policies that are supported by this driver.
 //
-#define DSM_NUMBER_OF_LB_POLICIES 6
+#define DSM_NUMBER_OF_LB_POLICIES 7
+
+//
+// Number of sequential streams tracked per LUN, and the number of consecutive
+// requests after which an I/O pattern is considered to be a sequential stream.
+//
+#define DSM_MAX_SEQUENTIAL_STREAMS      8
+#define DSM_SEQUENTIAL_STREAM_THRESHOLD 2
+
+//
+// MSDSM's own Least Service Time policy. Paths are chosen based on their
+// recent completion latency. It is reported in the vendor-specific slot.
+//
+#define DSM_LB_LEAST_SERVICE_TIME   DSM_LB_VENDOR_SPECIFIC
+
+//
+// The service time average kept per path for the Least Service Time policy
+// is scaled by 2^DSM_LST_EWMA_SHIFT, so each new sample has a weight of 1/8.
+//
+#define DSM_LST_EWMA_SHIFT          3
+
+//
+// Floor (in 100ns units) used for the service time of a path so that a path
+// without any history doesn't attract all the I/O before its first completion.
+//
+#define DSM_LST_MIN_SERVICE_TIME    1000
+
+//
+// If no request has completed on a path for this long (in 100ns units), its
+// average is halved for every such interval so that a path that was slow in
+// the past will eventually be tried again.
+//
+#define DSM_LST_AGING_INTERVAL      DSM_SECONDS_TO_TICKS(1)
 
 //
 // Size of the buffer passed to read in Persistent Reserve keys.
@@ -231,6 +272,7 @@ DSM_INIT_DATA gDsmInitData;
 #define DSM_TAG_REG_VALUE_RELATED           '42ZZ'
 #define DSM_TAG_ZOMBIEGROUP_ENTRY           '52ZZ'
 #define DSM_TAG_PERSISTENT_RESERVATION      '62ZZ'
+#define DSM_TAG_PATH_SNAPSHOT               '72ZZ'
 
 
 //
@@ -446,6 +488,16 @@ typedef enum _DSM_DEVICE_STATE {
                                                      ((_DeviceInfo)->ALUASupport == DSM_DEVINFO_ALUA_IMPLICIT && \
                                                       (_DeviceInfo)->Group->Symmetric))
 
+//
+// Macro to determine if the group's load balance policy spreads I/O across
+// all of its A/O paths.
+//
+#define DsmpIsMultiPathLoadBalanceType(_Group)      ((_Group)->LoadBalanceType == DSM_LB_ROUND_ROBIN || \
+                                                     (_Group)->LoadBalanceType == DSM_LB_ROUND_ROBIN_WITH_SUBSET || \
+                                                     (_Group)->LoadBalanceType == DSM_LB_DYN_LEAST_QUEUE_DEPTH || \
+                                                     (_Group)->LoadBalanceType == DSM_LB_LEAST_BLOCKS || \
+                                                     (_Group)->LoadBalanceType == DSM_LB_LEAST_SERVICE_TIME)
+
 //
 // Multi-path Group State
 //
@@ -612,6 +664,9 @@ typedef struct _DSM_STATS {
     ULONG      NumberWrites;
     ULONGLONG  BytesRead;
     ULONGLONG  BytesWritten;
+    ULONG      SequentialStreamsBound;
+    ULONG      QueueLimitRedirects;
+    ULONGLONG  SequentialStreamBytes;
 
 } DSM_STATS, *PDSM_STATS;
 
@@ -809,6 +864,68 @@ typedef enum _DSM_DEFAULT_LB_POLICY_TYPE {
 typedef ULONG   DSM_LOAD_BALANCE_TYPE, *PDSM_LOAD_BALANCE_TYPE;
 
 
+//
+// A sequential stream of requests being tracked for a multi-path group.
+//
+typedef struct _DSM_SEQUENTIAL_STREAM {
+
+    //
+    // LBA that the next request of the stream is expected to start at.
+    //
+    ULONGLONG NextLba;
+
+    //
+    // Number of bytes sent down FailGroup since the stream was bound to it.
+    //
+    ULONGLONG BytesOnPath;
+
+    //
+    // The path the stream is bound to. NULL if not bound yet.
+    //
+    struct _DSM_FAILOVER_GROUP *FailGroup;
+
+    //
+    // Number of consecutive sequential requests seen. Zero if the entry is free.
+    //
+    ULONG SequentialCount;
+
+    //
+    // Value of the group's StreamClock when the stream was last used. Used to
+    // pick which entry to recycle for a new stream.
+    //
+    ULONG LastUsed;
+
+} DSM_SEQUENTIAL_STREAM, *PDSM_SEQUENTIAL_STREAM;
+
+//
+// Immutable copy of the state that a multi-path group's load balance policy
+// needs to pick a path. A new one is built and published by
+// DsmpUpdatePathSnapshot whenever the group's paths change state, so that
+// requests can be routed without acquiring DsmContextLock.
+//
+typedef struct _DSM_PATH_SNAPSHOT {
+
+    //
+    // One reference is owned by the group while the snapshot is published,
+    // and one by each request that is using it.
+    //
+    volatile LONG ReferenceCount;
+
+    //
+    // The group's Load Balance policy when built.
+    //
+    ULONG LoadBalanceType;
+
+    //
+    // Paths that can be chosen. For FailOver Only and Least Weighted this is
+    // just the group's PathToBeUsed, otherwise it is every usable A/O path.
+    // A reference is held on each path for the life of the snapshot.
+    //
+    ULONG NumberPaths;
+    struct _DSM_FAILOVER_GROUP *Paths[DSM_MAX_PATHS];
+
+} DSM_PATH_SNAPSHOT, *PDSM_PATH_SNAPSHOT;
+
 //
 // Information about multi-path groups: The same device found via multiple paths
 // are put under one group. Each group will have it's own Load Balance policy
@@ -929,6 +1046,34 @@ typedef struct _DSM_GROUP_ENTRY {
     //
     ULONGLONG CacheSizeForLeastBlocks;
 
+    //
+    // Number of bytes of a sequential stream to keep on the same path (zero
+    // disables stream detection), and the maximum number of requests that can
+    // be outstanding on a path before another path is chosen (zero for none).
+    // Only used by policies that spread I/O across multiple paths.
+    //
+    ULONG StreamAffinityBytes;
+    ULONG MaxRequestsPerPath;
+
+    //
+    // Sequential streams being tracked for this LUN. Protected by StreamLock.
+    //
+    KSPIN_LOCK StreamLock;
+    ULONG StreamClock;
+    DSM_SEQUENTIAL_STREAM Streams[DSM_MAX_SEQUENTIAL_STREAMS];
+
+    //
+    // Currently published path snapshot, and the lock that protects taking
+    // a reference on it against it being replaced.
+    //
+    EX_SPIN_LOCK PathSnapshotLock;
+    PDSM_PATH_SNAPSHOT PathSnapshot;
+
+    //
+    // Round Robin position used when choosing paths from the snapshot.
+    //
+    volatile LONG RoundRobinCursor;
+
     //
     // The HardwareId (VID/PID) of the LUN
     //
@@ -1007,6 +1152,21 @@ typedef struct _DSM_FAILOVER_GROUP {
     //
     volatile LONG NumberOfRequestsInFlight;
 
+    //
+    // One reference is held by the DSM while the path exists, and one by each
+    // path snapshot that includes it. The FOG is freed when the last goes away.
+    //
+    volatile LONG ReferenceCount;
+
+    //
+    // Moving average of the read/write completion latency (in 100ns units,
+    // scaled by 2^DSM_LST_EWMA_SHIFT) and the interrupt time at which it was
+    // last updated. These will be used in LST load balance policy.
+    //
+    volatile LONGLONG AverageServiceTime;
+
+    volatile LONGLONG LastServiceTimeUpdate;
+
     //
     // Number of devices in this FOG.
     //
@@ -1299,6 +1459,12 @@ typedef struct _DSM_COMPLETION_CONTEXT {
 
     ULONG_PTR RequestUnique2;
 
+    //
+    // Interrupt time at which the request was dispatched. Used to compute
+    // the service time of the path for the LST load balance policy.
+    //
+    ULONGLONG StartTime;
+
 #if DBG
     //
     // Request time-stamp.
@@ -500,6 +500,50 @@ DsmpDecrementCounters(
     _In_ PSCSI_REQUEST_BLOCK Srb
     );
 
+VOID
+DsmpUpdateServiceTime(
+    _In_ PDSM_FAILOVER_GROUP FailGroup,
+    _In_ ULONGLONG StartTime
+    );
+
+ULONGLONG
+DsmpGetExpectedServiceTime(
+    _In_ PDSM_FAILOVER_GROUP FailGroup,
+    _In_ ULONGLONG CurrentTime
+    );
+
+PDSM_DEVICE_INFO
+DsmpGetActiveDeviceOnPath(
+    _In_ IN PDSM_IDS DsmList,
+    _In_ IN PDSM_FAILOVER_GROUP FailGroup
+    );
+
+PDSM_FAILOVER_GROUP
+DsmpGetSequentialStreamPath(
+    _In_ IN PDSM_CONTEXT DsmContext,
+    _In_ IN PDSM_GROUP_ENTRY Group,
+    _In_ IN PDSM_IDS DsmList,
+    _In_ IN PSCSI_REQUEST_BLOCK Srb,
+    _Out_ OUT PULONG StreamIndex
+    );
+
+VOID
+DsmpBindSequentialStream(
+    _In_ IN PDSM_CONTEXT DsmContext,
+    _In_ IN PDSM_GROUP_ENTRY Group,
+    _In_ IN PDSM_IDS DsmList,
+    _In_ IN ULONG StreamIndex,
+    _In_ IN PDSM_FAILOVER_GROUP FailGroup
+    );
+
+PDSM_FAILOVER_GROUP
+DsmpApplyPathRequestLimit(
+    _In_ IN PDSM_CONTEXT DsmContext,
+    _In_ IN PDSM_GROUP_ENTRY Group,
+    _In_ IN PDSM_IDS DsmList,
+    _In_ IN PDSM_FAILOVER_GROUP FailGroup
+    );
+
 PDSM_FAILOVER_GROUP
 DsmpGetPath(
     _In_ IN PDSM_CONTEXT DsmContext,
@@ -507,6 +551,36 @@ DsmpGetPath(
     _In_ IN PSCSI_REQUEST_BLOCK Srb
     );
 
+VOID
+DsmpDereferenceFOGroup(
+    _In_ IN PDSM_FAILOVER_GROUP FailGroup
+    );
+
+PDSM_PATH_SNAPSHOT
+DsmpReferencePathSnapshot(
+    _In_ IN PDSM_GROUP_ENTRY Group
+    );
+
+VOID
+DsmpDereferencePathSnapshot(
+    _In_ IN PDSM_PATH_SNAPSHOT Snapshot
+    );
+
+VOID
+DsmpUpdatePathSnapshot(
+    _In_ IN PDSM_GROUP_ENTRY Group
+    );
+
+VOID
+DsmpReleasePathSnapshot(
+    _In_ IN PDSM_GROUP_ENTRY Group
+    );
+
+PVOID
+DsmpGetPathFromSnapshot(
+    _In_ IN PDSM_IDS DsmList
+    );
+
 PVOID
 DsmpGetPathIdFromPassThroughPath(
     _In_ IN PDSM_CONTEXT DsmContext,
@@ -1090,6 +1164,13 @@ DsmpQueryCacheInformationFromRegistry(
     _Out_ OUT PULONGLONG CacheSizeForLeastBlocks
     );
 
+NTSTATUS
+DsmpQueryStreamInformationFromRegistry(
+    _In_ IN PDSM_CONTEXT DsmContext,
+    _Out_ OUT PULONG StreamAffinityBytes,
+    _Out_ OUT PULONG MaxRequestsPerPath
+    );
+
 BOOLEAN
 DsmpConvertSharedSpinLockToExclusive(
     _Inout_ _Requires_lock_held_(*_Curr_) PEX_SPIN_LOCK SpinLock
@@ -7825,6 +7825,93 @@ Return Value:
     return status;
 }
 
+
+NTSTATUS
+DsmpQueryStreamInformationFromRegistry(
+    _In_ IN PDSM_CONTEXT DsmContext,
+    _Out_ OUT PULONG StreamAffinityBytes,
+    _Out_ OUT PULONG MaxRequestsPerPath
+    )
+/*++
+
+Routine Description:
+
+    This routine is used to get the number of bytes of a sequential stream
+    that should be kept on the same path, and the maximum number of requests
+    that can be outstanding on a path before another path is chosen.
+    The values are determined by querying the values found at
+    "msdsm\Parameters\DsmSequentialStreamAffinityBytes" and
+    "msdsm\Parameters\DsmMaxRequestsPerPath"
+
+    If a value is not present, zero is returned for it, which disables the
+    corresponding feature.
+
+Arguments:
+
+    Context - The DSM Context value.
+    StreamAffinityBytes - Returns the number of bytes of a sequential stream
+                            to send down the same path.
+    MaxRequestsPerPath - Returns the maximum number of outstanding requests
+                            per path.
+
+Return Value:
+
+    Status of the RtlQueryRegistryValues call.
+
+--*/
+{
+    RTL_QUERY_REGISTRY_TABLE queryTable[3];
+    WCHAR registryKeyName[56] = {0};
+    NTSTATUS status;
+
+    TracePrint((TRACE_LEVEL_VERBOSE,
+                TRACE_FLAG_PNP,
+                "DsmpQueryStreamInformationFromRegistry (DsmCtxt %p): Entering function.\n",
+                DsmContext));
+
+    NT_ASSERT(StreamAffinityBytes);
+    NT_ASSERT(MaxRequestsPerPath);
+
+    *StreamAffinityBytes = 0;
+    *MaxRequestsPerPath = 0;
+
+    RtlZeroMemory(queryTable, sizeof(queryTable));
+
+    //
+    // Build the key value name that we want as the base of the query.
+    //
+    RtlStringCbPrintfW(registryKeyName,
+                       sizeof(registryKeyName),
+                       DSM_PARAMETER_PATH_W);
+
+    //
+    // The query table has three entries. One for the stream affinity size,
+    // one for the per-path request limit and the third which is the 'NULL'
+    // terminator. Neither value is required to be present.
+    //
+    queryTable[0].Flags = RTL_QUERY_REGISTRY_DIRECT;
+    queryTable[0].Name = DSM_STREAM_AFFINITY_BYTES;
+    queryTable[0].EntryContext = StreamAffinityBytes;
+
+    queryTable[1].Flags = RTL_QUERY_REGISTRY_DIRECT;
+    queryTable[1].Name = DSM_MAX_REQUESTS_PER_PATH;
+    queryTable[1].EntryContext = MaxRequestsPerPath;
+
+    status = RtlQueryRegistryValues(RTL_REGISTRY_SERVICES,
+                                    registryKeyName,
+                                    queryTable,
+                                    registryKeyName,
+                                    NULL);
+
+    TracePrint((TRACE_LEVEL_VERBOSE,
+                TRACE_FLAG_PNP,
+                "DsmpQueryStreamInformationFromRegistry (DsmCtxt %p): Exiting function with status %x.\n",
+                DsmContext,
+                status));
+
+    return status;
+}
+
 BOOLEAN
 DsmpConvertSharedSpinLockToExclusive(
     _Inout_ _Requires_lock_held_(*_Curr_) PEX_SPIN_LOCK SpinLock
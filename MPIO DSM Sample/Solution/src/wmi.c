@@ -495,7 +495,7 @@ Return Value:
                     continue;
                 }
 
-                if (targetPolicyInfo->LoadBalancePolicy >= DSM_LB_VENDOR_SPECIFIC) {
+                if (targetPolicyInfo->LoadBalancePolicy > DSM_LB_LEAST_SERVICE_TIME) {
 
                     errorStatus = STATUS_INVALID_PARAMETER;
 
@@ -571,7 +571,7 @@ Return Value:
             //
             // First ensure that the values make sense.
             //
-            if (loadBalancePolicy >= DSM_LB_VENDOR_SPECIFIC) {
+            if (loadBalancePolicy > DSM_LB_LEAST_SERVICE_TIME) {
 
                 status = STATUS_INVALID_PARAMETER;
                 TracePrint((TRACE_LEVEL_ERROR,
@@ -1067,6 +1067,7 @@ Return Value:
     if (NT_SUCCESS(status) && rtpgDeviceInfo) {
 
         DsmpAdjustDeviceStatesALUA(groupEntry, NULL);
+        DsmpUpdatePathSnapshot(groupEntry);
     }
 
     supportedLBPolicies = &(((PDSM_QueryLBPolicy_V2)Buffer)->LoadBalancePolicy);
@@ -1170,7 +1171,8 @@ Return Value:
             NT_ASSERT(groupEntry->LoadBalanceType != DSM_LB_ROUND_ROBIN &&
                    groupEntry->LoadBalanceType != DSM_LB_WEIGHTED_PATHS &&
                    groupEntry->LoadBalanceType != DSM_LB_DYN_LEAST_QUEUE_DEPTH &&
-                   groupEntry->LoadBalanceType != DSM_LB_LEAST_BLOCKS);
+                   groupEntry->LoadBalanceType != DSM_LB_LEAST_BLOCKS &&
+                   groupEntry->LoadBalanceType != DSM_LB_LEAST_SERVICE_TIME);
         }
 #endif
 
@@ -1544,6 +1546,7 @@ Return Value:
     DSM_LOAD_BALANCE_TYPE loadBalanceType;
     ULONGLONG preferredPath = (ULONGLONG)((ULONG_PTR)MAXULONG);
     ULONG devInfoIndex;
+    KIRQL irql;
 
     TracePrint((TRACE_LEVEL_VERBOSE,
                 TRACE_FLAG_WMI,
@@ -1705,6 +1708,13 @@ Return Value:
                                   group->LoadBalanceType);
     }
 
+    //
+    // Route requests according to the new policy.
+    //
+    irql = ExAcquireSpinLockExclusive(&(DsmContext->DsmContextLock));
+    DsmpUpdatePathSnapshot(group);
+    ExReleaseSpinLockExclusive(&(DsmContext->DsmContextLock), irql);
+
 __Exit_DsmpClearLoadBalancePolicy:
 
     if (deviceKey) {
@@ -2017,7 +2027,7 @@ Return Value:
                     devInfo->State = DSM_DEV_ACTIVE_UNOPTIMIZED;
 
                     //
-                    // For LB policy RR, WP, LB and LQD, all paths must be in A/O
+                    // For LB policy RR, WP, LB, LST and LQD, all paths must be in A/O
                     // state. However, this is not possible for ALUA storages.
                     // For these storages, A/U is allowable only if that is the
                     // access state that the TPG is in.
@@ -2025,7 +2035,8 @@ Return Value:
                     if (loadBalancePolicy == DSM_LB_ROUND_ROBIN ||
                         loadBalancePolicy == DSM_LB_WEIGHTED_PATHS ||
                         loadBalancePolicy == DSM_LB_DYN_LEAST_QUEUE_DEPTH ||
-                        loadBalancePolicy == DSM_LB_LEAST_BLOCKS) {
+                        loadBalancePolicy == DSM_LB_LEAST_BLOCKS ||
+                        loadBalancePolicy == DSM_LB_LEAST_SERVICE_TIME) {
 
                         if (devInfo->TargetPortGroup && devInfo->ALUAState != DSM_DEV_ACTIVE_UNOPTIMIZED) {
 
@@ -2061,14 +2072,15 @@ Return Value:
                 }
 
                 //
-                // For RR, LQD, LB and WP, all paths must be in A/O state for non-ALUA
+                // For RR, LQD, LB, LST and WP, all paths must be in A/O state for non-ALUA
                 // storage. For ALUA storage, the only time path states can be in
                 // S/B or U/A is if the TPG itself is in that state.
                 //
                 if (loadBalancePolicy == DSM_LB_ROUND_ROBIN ||
                     loadBalancePolicy == DSM_LB_WEIGHTED_PATHS ||
                     loadBalancePolicy == DSM_LB_DYN_LEAST_QUEUE_DEPTH ||
-                    loadBalancePolicy == DSM_LB_LEAST_BLOCKS) {
+                    loadBalancePolicy == DSM_LB_LEAST_BLOCKS ||
+                    loadBalancePolicy == DSM_LB_LEAST_SERVICE_TIME) {
 
                     if ((!devInfo->TargetPortGroup) ||
                         (devInfo->TargetPortGroup && devInfo->State != devInfo->ALUAState)) {
@@ -2453,6 +2465,11 @@ Return Value:
         }
     }
 
+    //
+    // Route requests according to the new (or restored) path states.
+    //
+    DsmpUpdatePathSnapshot(groupEntry);
+
     ExReleaseSpinLockExclusive(&(DsmContext->DsmContextLock), irql);
 
     if (NT_SUCCESS(status) && savedLBSettings) {
@@ -2604,7 +2621,7 @@ Return Value:
     }
 
     if ((supportedLBPolicies->LoadBalancePolicy < DSM_LB_FAILOVER) ||
-        (supportedLBPolicies->LoadBalancePolicy > DSM_LB_LEAST_BLOCKS)) {
+        (supportedLBPolicies->LoadBalancePolicy > DSM_LB_LEAST_SERVICE_TIME)) {
 
         TracePrint((TRACE_LEVEL_ERROR,
                     TRACE_FLAG_WMI,
@@ -3150,6 +3167,9 @@ Return Value:
             pathPerf->NumberWrites = (devInfo->DeviceStats).NumberWrites;
             pathPerf->BytesRead = (devInfo->DeviceStats).BytesRead;
             pathPerf->BytesWritten = (devInfo->DeviceStats).BytesWritten;
+            pathPerf->SequentialStreamsBound = (devInfo->DeviceStats).SequentialStreamsBound;
+            pathPerf->QueueLimitRedirects = (devInfo->DeviceStats).QueueLimitRedirects;
+            pathPerf->SequentialStreamBytes = (devInfo->DeviceStats).SequentialStreamBytes;
         }
     }
 
@@ -3231,6 +3251,9 @@ Return Value:
             (devInfo->DeviceStats).BytesWritten = 0;
             (devInfo->DeviceStats).NumberReads = 0;
             (devInfo->DeviceStats).NumberWrites = 0;
+            (devInfo->DeviceStats).SequentialStreamsBound = 0;
+            (devInfo->DeviceStats).QueueLimitRedirects = 0;
+            (devInfo->DeviceStats).SequentialStreamBytes = 0;
         }
     }
 
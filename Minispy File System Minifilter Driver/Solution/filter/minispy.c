@@ -128,10 +128,18 @@ Return Value:
         MiniSpyData.RecordsAllocated = 0;
         MiniSpyData.NameQueryMethod = DEFAULT_NAME_QUERY_METHOD;
 
+        MiniSpyData.LogRingSize = DEFAULT_LOG_RING_SIZE;
+
         MiniSpyData.DriverObject = DriverObject;
 
-        InitializeListHead( &MiniSpyData.OutputBufferList );
-        KeInitializeSpinLock( &MiniSpyData.OutputBufferLock );
+        ExInitializeFastMutex( &MiniSpyData.LogConsumerLock );
+
+        //
+        //  Nobody can signal a mapped consumer until the rings are mapped.
+        //
+
+        ExInitializeRundownProtection( &MiniSpyData.LogMapRundown );
+        ExWaitForRundownProtectionRelease( &MiniSpyData.LogMapRundown );
 
         ExInitializeNPagedLookasideList( &MiniSpyData.FreeBufferList,
                                          NULL,
@@ -162,6 +170,17 @@ Return Value:
 
         SpyReadDriverParameters(RegistryPath);
 
+        //
+        //  Now that we know how big they should be, allocate the log rings.
+        //
+
+        status = SpyAllocateLogRings();
+
+        if (!NT_SUCCESS( status )) {
+
+           leave;
+        }
+
         //
         //  Now that our global configuration is complete, register with FltMgr.
         //
@@ -224,6 +243,7 @@ Return Value:
                  FltUnregisterFilter( MiniSpyData.Filter );
              }
 
+             SpyFreeLogRings();
              ExDeleteNPagedLookasideList( &MiniSpyData.FreeBufferList );
         }
     }
@@ -298,6 +318,12 @@ Return value
 
     UNREFERENCED_PARAMETER( ConnectionCookie );
 
+    //
+    //  The rings can't stay mapped into a process that is going away.
+    //
+
+    SpyUnmapLog();
+
     //
     //  Close our handle
     //
@@ -343,7 +369,8 @@ Return Value:
 
     FltUnregisterFilter( MiniSpyData.Filter );
 
-    SpyEmptyOutputBufferList();
+    SpyUnmapLog();
+    SpyFreeLogRings();
     ExDeleteNPagedLookasideList( &MiniSpyData.FreeBufferList );
 
     return STATUS_SUCCESS;
@@ -418,6 +445,8 @@ Return Value:
 --*/
 {
     MINISPY_COMMAND command;
+    ULONGLONG eventHandle;
+    LOG_MAP_INFORMATION mapInformation;
     NTSTATUS status;
 
     PAGED_CODE();
@@ -569,6 +598,64 @@ Return Value:
                 status = STATUS_SUCCESS;
                 break;
 
+            case MapMiniSpyLog:
+
+                //
+                //  Map the log rings into the caller.  The input carries
+                //  the handle of the event to signal when the caller is
+                //  waiting for records.
+                //
+
+                if ((InputBufferSize < (FIELD_OFFSET(COMMAND_MESSAGE,Data) +
+                                        sizeof(ULONGLONG))) ||
+                    (OutputBufferSize < sizeof( LOG_MAP_INFORMATION )) ||
+                    (OutputBuffer == NULL)) {
+
+                    status = STATUS_INVALID_PARAMETER;
+                    break;
+                }
+
+                if (!IS_ALIGNED(OutputBuffer,sizeof(ULONG))) {
+
+                    status = STATUS_DATATYPE_MISALIGNMENT;
+                    break;
+                }
+
+                try {
+
+                    eventHandle = *((ULONGLONG UNALIGNED *) ((PCOMMAND_MESSAGE) InputBuffer)->Data);
+
+                } except (SpyExceptionFilter( GetExceptionInformation(), TRUE )) {
+
+                    return GetExceptionCode();
+                }
+
+                status = SpyMapLog( (HANDLE)(ULONG_PTR) eventHandle,
+                                    &mapInformation );
+
+                if (!NT_SUCCESS( status )) {
+
+                    break;
+                }
+
+                try {
+
+                    RtlCopyMemory( OutputBuffer,
+                                   &mapInformation,
+                                   sizeof( LOG_MAP_INFORMATION ) );
+
+                } except (SpyExceptionFilter( GetExceptionInformation(), TRUE )) {
+
+                    //
+                    //  The rings stay mapped until the port is closed.
+                    //
+
+                    return GetExceptionCode();
+                }
+
+                *ReturnOutputBufferLength = sizeof( LOG_MAP_INFORMATION );
+                break;
+
             default:
                 status = STATUS_INVALID_PARAMETER;
                 break;
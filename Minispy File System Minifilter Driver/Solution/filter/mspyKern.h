@@ -111,6 +111,47 @@ typedef enum _ECP_TYPE {
 
 #endif
 
+//---------------------------------------------------------------------------
+//      Log rings
+//---------------------------------------------------------------------------
+
+//
+//  Each processor has its own LOG_RING (see minispy.h).  A ring is only
+//  written by its own processor, at DISPATCH_LEVEL, so producers need no
+//  lock.  SpyGetLog, or mspyUser once it has mapped the rings, is the only
+//  consumer.
+//
+//  The LOG_RINGs can be mapped into user mode, so the producer keeps its
+//  own copy of Tail and never trusts anything it reads back from them
+//  except Head, which only decides whether a record fits.
+//
+
+typedef struct DECLSPEC_CACHEALIGN _SPY_LOG_RING {
+
+    //
+    //  Tail as last published, and records dropped since the last record
+    //  that made it into the ring.
+    //
+
+    __volatile ULONG Tail;
+    ULONG PendingDrops;
+
+    //
+    //  The ring itself, or NULL if this processor has none.
+    //
+
+    PLOG_RING Shared;
+
+} SPY_LOG_RING, *PSPY_LOG_RING;
+
+#define SpyRingOffset(Count)        ((Count) & (MiniSpyData.LogRingSize - 1))
+
+#if MINISPY_WIN7
+#define SpyCurrentProcessorIndex()  KeGetCurrentProcessorNumberEx( NULL )
+#else
+#define SpyCurrentProcessorIndex()  KeGetCurrentProcessorNumber()
+#endif
+
 //---------------------------------------------------------------------------
 //      Global variables
 //---------------------------------------------------------------------------
@@ -143,14 +184,47 @@ typedef struct _MINISPY_DATA {
     PFLT_PORT ClientPort;
 
     //
-    //  List of buffers with data to send to user mode.
+    //  Per-processor rings of records to send to user mode, indexed by
+    //  processor number.  Processors added after we loaded have no ring and
+    //  their records are counted in UnloggedRecords.
+    //
+
+    PSPY_LOG_RING LogRings;
+    ULONG LogRingCount;
+    ULONG LogRingSize;
+    __volatile LONG64 UnloggedRecords;
+
+    //
+    //  The LOG_RINGs all live in one block of pages after LogMap.  LogMapMdl
+    //  describes the pages, which are ours alone, so they can be mapped
+    //  into user mode with it.  LogMap is their system address.
+    //
+
+    PLOG_MAP LogMap;
+    ULONG LogMapSize;
+    PMDL LogMapMdl;
+
+    //
+    //  Where the rings are mapped, the process they are mapped into, and
+    //  its event to signal when it is waiting for records.  Signallers hold
+    //  LogMapRundown, which is run down whenever the rings aren't mapped.
     //
 
-    KSPIN_LOCK OutputBufferLock;
-    LIST_ENTRY OutputBufferList;
+    PVOID LogMapUserAddress;
+    PEPROCESS LogMapProcess;
+    PKEVENT LogMapEvent;
+    EX_RUNDOWN_REF LogMapRundown;
 
     //
-    //  Lookaside list used for allocating buffers.
+    //  Serializes consumers of the log rings, and mapping and unmapping
+    //  them.
+    //
+
+    FAST_MUTEX LogConsumerLock;
+
+    //
+    //  Lookaside list used for allocating the buffer an operation's record
+    //  is built in before SpyLog copies it into a ring.
     //
 
     NPAGED_LOOKASIDE_LIST FreeBufferList;
@@ -242,6 +316,10 @@ extern MINISPY_DATA MiniSpyData;
 #define DEFAULT_MAX_RECORDS_TO_ALLOCATE     500
 #define MAX_RECORDS_TO_ALLOCATE             L"MaxRecords"
 
+#define DEFAULT_LOG_RING_SIZE               (128 * 1024)
+#define MIN_LOG_RING_SIZE                   (4 * RECORD_SIZE)
+#define LOG_RING_SIZE                       L"LogRingSize"
+
 #define DEFAULT_NAME_QUERY_METHOD           FLT_FILE_NAME_QUERY_ALWAYS_ALLOW_CACHE_LOOKUP
 #define NAME_QUERY_METHOD                   L"NameQueryMethod"
 
@@ -397,8 +475,29 @@ SpyGetLog (
     _Out_ PULONG ReturnOutputBufferLength
     );
 
+PLOG_RECORD
+SpyPeekLogRing (
+    _In_ PSPY_LOG_RING Ring
+    );
+
+NTSTATUS
+SpyMapLog (
+    _In_ HANDLE EventHandle,
+    _Out_ PLOG_MAP_INFORMATION MapInformation
+    );
+
+VOID
+SpyUnmapLog (
+    VOID
+    );
+
+NTSTATUS
+SpyAllocateLogRings (
+    VOID
+    );
+
 VOID
-SpyEmptyOutputBufferList (
+SpyFreeLogRings (
     VOID
     );
 
@@ -35,6 +35,10 @@ Environment:
 
 #ifdef ALLOC_PRAGMA
     #pragma alloc_text(INIT, SpyReadDriverParameters)
+    #pragma alloc_text(INIT, SpyAllocateLogRings)
+    #pragma alloc_text(PAGE, SpyFreeLogRings)
+    #pragma alloc_text(PAGE, SpyMapLog)
+    #pragma alloc_text(PAGE, SpyUnmapLog)
 #if MINISPY_VISTA
     #pragma alloc_text(PAGE, SpyBuildEcpDataString)
     #pragma alloc_text(PAGE, SpyParseEcps)
@@ -1210,29 +1214,190 @@ SpyLog (
 
 Routine Description:
 
-    This routine inserts the given log record into the list to be sent
-    to the user mode application.
+    This routine copies the given log record into the current processor's
+    log ring to be sent to the user mode application, and frees the record.
+
+    We raise to DISPATCH_LEVEL so that nothing else can write this
+    processor's ring until we are done, which lets us write it without a
+    lock.  If the ring is full the record is dropped and counted, and the
+    next record that fits carries the count up to user mode.
 
     NOTE:  This code must be NON-PAGED because it can be called on the
-           paging path or at DPC level and uses a spin-lock
+           paging path or at DPC level.
 
 Arguments:
 
-    RecordList - The record to append to the MiniSpyData.OutputBufferList
+    RecordList - The record to log.
 
 Return Value:
 
-    The function returns STATUS_SUCCESS.
+    None.
+
+--*/
+{
+    PSPY_LOG_RING ring = NULL;
+    PLOG_RING shared;
+    PLOG_RECORD pLogRecord = &RecordList->LogRecord;
+    ULONG processor;
+    ULONG tail;
+    ULONG offset;
+    ULONG pad;
+    KIRQL oldIrql;
+
+    //
+    //  If no filename was set then make it into a NULL file name.
+    //
+
+    if (REMAINING_NAME_SPACE( pLogRecord ) == MAX_NAME_SPACE) {
+
+        //
+        //  We don't have a name, so return an empty string.
+        //  We have to always start a new log record on a PVOID aligned boundary.
+        //
+
+        pLogRecord->Length += ROUND_TO_SIZE( sizeof( UNICODE_NULL ), sizeof( PVOID ) );
+        pLogRecord->Name[0] = UNICODE_NULL;
+    }
+
+    KeRaiseIrql( DISPATCH_LEVEL, &oldIrql );
+
+    processor = SpyCurrentProcessorIndex();
+
+    if (processor < MiniSpyData.LogRingCount) {
+
+        ring = &MiniSpyData.LogRings[processor];
+    }
+
+    if ((ring == NULL) || (ring->Shared == NULL)) {
+
+        InterlockedIncrement64( &MiniSpyData.UnloggedRecords );
+
+    } else {
+
+        shared = ring->Shared;
+        tail = ring->Tail;
+        offset = SpyRingOffset( tail );
+
+        //
+        //  Skip to the start of the buffer if the record won't fit before
+        //  the end.
+        //
+
+        pad = 0;
+
+        if (MiniSpyData.LogRingSize - offset < pLogRecord->Length) {
+
+            pad = MiniSpyData.LogRingSize - offset;
+        }
+
+        if ((tail - shared->Head) + pad + pLogRecord->Length > MiniSpyData.LogRingSize) {
+
+            ring->PendingDrops += 1;
+            shared->DroppedRecords += 1;
+
+        } else {
+
+            if (pad != 0) {
+
+                *((PULONG) &shared->Buffer[offset]) = 0;
+                tail += pad;
+                offset = 0;
+            }
+
+            if (ring->PendingDrops != 0) {
+
+                SetFlag( pLogRecord->RecordType, RECORD_TYPE_FLAG_RECORDS_DROPPED );
+                pLogRecord->DroppedRecords = ring->PendingDrops;
+                ring->PendingDrops = 0;
+            }
+
+            RtlCopyMemory( &shared->Buffer[offset], pLogRecord, pLogRecord->Length );
+
+            //
+            //  Make sure the record is visible before we publish it.
+            //
+
+            KeMemoryBarrier();
+            ring->Tail = tail + pLogRecord->Length;
+            shared->Tail = tail + pLogRecord->Length;
+
+            //
+            //  Wake a mapped consumer that has run out of records.  It sets
+            //  ConsumerWaiting before it looks at the rings for the last
+            //  time, so either it sees this record or we see the flag.
+            //
+
+            KeMemoryBarrier();
+
+            if ((MiniSpyData.LogMap->ConsumerWaiting != 0) &&
+                (InterlockedExchange( &MiniSpyData.LogMap->ConsumerWaiting, 0 ) != 0) &&
+                ExAcquireRundownProtection( &MiniSpyData.LogMapRundown )) {
+
+                KeSetEvent( MiniSpyData.LogMapEvent, IO_NO_INCREMENT, FALSE );
+                ExReleaseRundownProtection( &MiniSpyData.LogMapRundown );
+            }
+        }
+    }
+
+    KeLowerIrql( oldIrql );
+
+    SpyFreeRecord( RecordList );
+}
+
+
+PLOG_RECORD
+SpyPeekLogRing (
+    _In_ PSPY_LOG_RING Ring
+    )
+/*++
+
+Routine Description:
+
+    Returns the oldest record in the given ring without removing it,
+    stepping over any padding at the end of the buffer.
+
+    NOTE:  This is only called by SpyGetLog with LogConsumerLock held.
+
+Arguments:
+
+    Ring - The ring to look at.
 
+Return Value:
 
+    The oldest record, or NULL if the ring is empty.
 
 --*/
 {
-    KIRQL oldIrql;
+    PLOG_RING shared = Ring->Shared;
+    ULONG head = shared->Head;
+    ULONG tail = Ring->Tail;
+    PLOG_RECORD pLogRecord;
+
+    //
+    //  Don't look at record data until we have seen the Tail that
+    //  published it.
+    //
+
+    KeMemoryBarrier();
+
+    while (head != tail) {
+
+        pLogRecord = (PLOG_RECORD) &shared->Buffer[SpyRingOffset( head )];
 
-    KeAcquireSpinLock(&MiniSpyData.OutputBufferLock, &oldIrql);
-    InsertTailList(&MiniSpyData.OutputBufferList, &RecordList->List);
-    KeReleaseSpinLock(&MiniSpyData.OutputBufferLock, oldIrql);
+        if (pLogRecord->Length != 0) {
+
+            return pLogRecord;
+        }
+
+        //
+        //  A zero length marks the unused end of the buffer.
+        //
+
+        head += MiniSpyData.LogRingSize - SpyRingOffset( head );
+        shared->Head = head;
+    }
+
+    return NULL;
 }
 
 
@@ -1249,7 +1414,12 @@ Routine Description:
     The LOG_RECORDs are variable sizes and are tightly packed in the
     OutputBuffer.
 
-    NOTE:  This code must be NON-PAGED because it uses a spin-lock.
+    Records are taken from the per-processor rings oldest sequence number
+    first, so the output is in the same order the records were created in
+    across all processors.
+
+    NOTE:  This code must be NON-PAGED because it is the consumer of rings
+           written at DISPATCH_LEVEL.
 
 Arguments:
     OutputBuffer - The user's buffer to fill with the log data we have
@@ -1268,100 +1438,112 @@ Return Value:
     STATUS_BUFFER_TOO_SMALL if the OutputBuffer is too small to
         hold even one record and we have data to return.
 
+    STATUS_INVALID_DEVICE_STATE if the rings are mapped into user mode.
+
 --*/
 {
-    PLIST_ENTRY pList;
     ULONG bytesWritten = 0;
     PLOG_RECORD pLogRecord;
+    PLOG_RECORD pOldestRecord;
+    PSPY_LOG_RING pOldestRing;
     NTSTATUS status = STATUS_NO_MORE_ENTRIES;
-    PRECORD_LIST pRecordList;
-    KIRQL oldIrql;
     BOOLEAN recordsAvailable = FALSE;
+    ULONG i;
 
-    KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
+    ExAcquireFastMutex( &MiniSpyData.LogConsumerLock );
 
-    while (!IsListEmpty( &MiniSpyData.OutputBufferList ) && (OutputBufferLength > 0)) {
+    //
+    //  The records belong to whoever mapped the rings.
+    //
 
-        //
-        //  Mark we have records
-        //
+    if (MiniSpyData.LogMapUserAddress != NULL) {
 
-        recordsAvailable = TRUE;
+        ExReleaseFastMutex( &MiniSpyData.LogConsumerLock );
+
+        *ReturnOutputBufferLength = 0;
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+
+    while (OutputBufferLength > 0) {
 
         //
-        //  Get the next available record
+        //  Find the ring whose next record is the oldest.
         //
 
-        pList = RemoveHeadList( &MiniSpyData.OutputBufferList );
+        pOldestRecord = NULL;
+        pOldestRing = NULL;
 
-        pRecordList = CONTAINING_RECORD( pList, RECORD_LIST, List );
+        for (i = 0; i < MiniSpyData.LogRingCount; i++) {
 
-        pLogRecord = &pRecordList->LogRecord;
+            if (MiniSpyData.LogRings[i].Shared == NULL) {
 
-        //
-        //  If no filename was set then make it into a NULL file name.
-        //
+                continue;
+            }
 
-        if (REMAINING_NAME_SPACE( pLogRecord ) == MAX_NAME_SPACE) {
+            pLogRecord = SpyPeekLogRing( &MiniSpyData.LogRings[i] );
 
-            //
-            //  We don't have a name, so return an empty string.
-            //  We have to always start a new log record on a PVOID aligned boundary.
-            //
+            if ((pLogRecord != NULL) &&
+                ((pOldestRecord == NULL) ||
+                 ((LONG)(pLogRecord->SequenceNumber - pOldestRecord->SequenceNumber) < 0))) {
 
-            pLogRecord->Length += ROUND_TO_SIZE( sizeof( UNICODE_NULL ), sizeof( PVOID ) );
-            pLogRecord->Name[0] = UNICODE_NULL;
+                pOldestRecord = pLogRecord;
+                pOldestRing = &MiniSpyData.LogRings[i];
+            }
+        }
+
+        if (pOldestRecord == NULL) {
+
+            break;
         }
 
         //
-        //  Put it back if we've run out of room.
+        //  Mark we have records
+        //
+
+        recordsAvailable = TRUE;
+
+        //
+        //  Leave it in the ring if we've run out of room.
         //
 
-        if (OutputBufferLength < pLogRecord->Length) {
+        if (OutputBufferLength < pOldestRecord->Length) {
 
-            InsertHeadList( &MiniSpyData.OutputBufferList, pList );
             break;
         }
 
-        KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
-
         //
-        //  The lock is released, return the data, adjust pointers.
+        //  Return the data, adjust pointers.
         //  Protect access to raw user-mode OutputBuffer with an exception handler
         //
 
         try {
-            RtlCopyMemory( OutputBuffer, pLogRecord, pLogRecord->Length );
+            RtlCopyMemory( OutputBuffer, pOldestRecord, pOldestRecord->Length );
         } except (SpyExceptionFilter( GetExceptionInformation(), TRUE )) {
 
             //
-            //  Put the record back in
+            //  The record is still in its ring.
             //
 
-            KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
-            InsertHeadList( &MiniSpyData.OutputBufferList, pList );
-            KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
+            ExReleaseFastMutex( &MiniSpyData.LogConsumerLock );
 
             return GetExceptionCode();
-
         }
 
-        bytesWritten += pLogRecord->Length;
+        bytesWritten += pOldestRecord->Length;
 
-        OutputBufferLength -= pLogRecord->Length;
+        OutputBufferLength -= pOldestRecord->Length;
 
-        OutputBuffer += pLogRecord->Length;
-
-        SpyFreeRecord( pRecordList );
+        OutputBuffer += pOldestRecord->Length;
 
         //
-        //  Relock the list
+        //  Hand the space back to the producer.
         //
 
-        KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
+        KeMemoryBarrier();
+        pOldestRing->Shared->Head += pOldestRecord->Length;
     }
 
-    KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
+    ExReleaseFastMutex( &MiniSpyData.LogConsumerLock );
 
     //
     //  Set proper status
@@ -1392,19 +1574,309 @@ Return Value:
 }
 
 
+NTSTATUS
+SpyAllocateLogRings (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine allocates a log ring for each active processor.  The ring
+    array is sized for the maximum number of processors so that processors
+    added later can be recognized; they just don't get a ring.
+
+    The LOG_RINGs are carved out of a single block of pages that starts
+    with the LOG_MAP describing them.  The pages come straight from the
+    memory manager rather than from pool, so no other allocation can share
+    them and the whole block can be mapped into user mode without exposing
+    anything else.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    STATUS_SUCCESS, or STATUS_INSUFFICIENT_RESOURCES.
+
+--*/
+{
+    PHYSICAL_ADDRESS lowAddress;
+    PHYSICAL_ADDRESS highAddress;
+    PHYSICAL_ADDRESS skipBytes;
+    ULONG activeCount;
+    ULONG ringStride;
+    ULONG i;
+
+    PAGED_CODE();
+
+#if MINISPY_WIN7
+    MiniSpyData.LogRingCount = KeQueryMaximumProcessorCountEx( ALL_PROCESSOR_GROUPS );
+    activeCount = KeQueryActiveProcessorCountEx( ALL_PROCESSOR_GROUPS );
+#else
+    MiniSpyData.LogRingCount = KeNumberProcessors;
+    activeCount = KeNumberProcessors;
+#endif
+
+    activeCount = min( activeCount, MiniSpyData.LogRingCount );
+
+    MiniSpyData.LogRings = ExAllocatePoolWithTag( NonPagedPool,
+                                                  MiniSpyData.LogRingCount * sizeof( SPY_LOG_RING ),
+                                                  SPY_TAG );
+
+    if (MiniSpyData.LogRings == NULL) {
+
+        MiniSpyData.LogRingCount = 0;
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory( MiniSpyData.LogRings, MiniSpyData.LogRingCount * sizeof( SPY_LOG_RING ) );
+
+    //
+    //  Whole pages only, so nothing else shares them when they are mapped.
+    //
+
+    ringStride = (ULONG) ROUND_TO_PAGES( FIELD_OFFSET( LOG_RING, Buffer ) + MiniSpyData.LogRingSize );
+
+    MiniSpyData.LogMapSize = PAGE_SIZE + activeCount * ringStride;
+
+    //
+    //  The pages come back zeroed.  Unless we insist, we may get fewer of
+    //  them than we asked for.
+    //
+
+    lowAddress.QuadPart = 0;
+    highAddress.QuadPart = -1;
+    skipBytes.QuadPart = 0;
+
+    MiniSpyData.LogMapMdl = MmAllocatePagesForMdlEx( lowAddress,
+                                                     highAddress,
+                                                     skipBytes,
+                                                     MiniSpyData.LogMapSize,
+                                                     MmCached,
+#if MINISPY_WIN7
+                                                     MM_ALLOCATE_FULLY_REQUIRED );
+#else
+                                                     0 );
+#endif
+
+    if (MiniSpyData.LogMapMdl == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (MmGetMdlByteCount( MiniSpyData.LogMapMdl ) != MiniSpyData.LogMapSize) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    MiniSpyData.LogMap = MmMapLockedPagesSpecifyCache( MiniSpyData.LogMapMdl,
+                                                       KernelMode,
+                                                       MmCached,
+                                                       NULL,
+                                                       FALSE,
+                                                       NormalPagePriority );
+
+    if (MiniSpyData.LogMap == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    MiniSpyData.LogMap->RingCount = activeCount;
+    MiniSpyData.LogMap->RingSize = MiniSpyData.LogRingSize;
+    MiniSpyData.LogMap->RingStride = ringStride;
+    MiniSpyData.LogMap->RingOffset = PAGE_SIZE;
+
+    for (i = 0; i < activeCount; i++) {
+
+        MiniSpyData.LogRings[i].Shared = LogMapRing( MiniSpyData.LogMap, i );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
 VOID
-SpyEmptyOutputBufferList (
+SpyFreeLogRings (
     VOID
     )
 /*++
 
 Routine Description:
 
-    This routine frees all the remaining log records in the OutputBufferList
-    that are not going to get sent up to the user mode application since
-    MiniSpy is shutting down.
+    This routine frees the log rings, and any records in them that are not
+    going to get sent up to the user mode application since MiniSpy is
+    shutting down.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    FLT_ASSERT( MiniSpyData.LogMapUserAddress == NULL );
+
+    if (MiniSpyData.LogMap != NULL) {
+
+        MmUnmapLockedPages( MiniSpyData.LogMap, MiniSpyData.LogMapMdl );
+        MiniSpyData.LogMap = NULL;
+    }
+
+    if (MiniSpyData.LogMapMdl != NULL) {
+
+        MmFreePagesFromMdl( MiniSpyData.LogMapMdl );
+        ExFreePool( MiniSpyData.LogMapMdl );
+        MiniSpyData.LogMapMdl = NULL;
+    }
+
+    if (MiniSpyData.LogRings != NULL) {
+
+        ExFreePoolWithTag( MiniSpyData.LogRings, SPY_TAG );
+        MiniSpyData.LogRings = NULL;
+    }
+
+    MiniSpyData.LogRingCount = 0;
+}
+
+
+NTSTATUS
+SpyMapLog (
+    _In_ HANDLE EventHandle,
+    _Out_ PLOG_MAP_INFORMATION MapInformation
+    )
+/*++
+
+Routine Description:
+
+    This routine maps the log rings into the current process, which must be
+    the one connected to our port, so it can consume records in place.  From
+    now on the filter signals the given event when it logs a record while
+    the consumer is waiting.
 
-    NOTE:  This code must be NON-PAGED because it uses a spin-lock
+    The rings stay mapped until SpyUnmapLog is called when the port is
+    disconnected.
+
+Arguments:
+
+    EventHandle - User mode handle of the event to signal.
+
+    MapInformation - Receives where the rings were mapped and how big the
+        mapping is.
+
+Return Value:
+
+    STATUS_SUCCESS if the rings were mapped.
+
+    STATUS_DEVICE_BUSY if they are already mapped.
+
+    STATUS_INSUFFICIENT_RESOURCES if they can't be mapped.
+
+--*/
+{
+    PKEVENT event = NULL;
+    PVOID userAddress = NULL;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    if (MiniSpyData.LogMapMdl == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    status = ObReferenceObjectByHandle( EventHandle,
+                                        EVENT_MODIFY_STATE,
+                                        *ExEventObjectType,
+                                        UserMode,
+                                        (PVOID *) &event,
+                                        NULL );
+
+    if (!NT_SUCCESS( status )) {
+
+        return status;
+    }
+
+    ExAcquireFastMutex( &MiniSpyData.LogConsumerLock );
+
+    try {
+
+        if (MiniSpyData.LogMapUserAddress != NULL) {
+
+            status = STATUS_DEVICE_BUSY;
+            leave;
+        }
+
+        //
+        //  Mapping into user mode raises an exception on failure.
+        //
+
+        try {
+
+            userAddress = MmMapLockedPagesSpecifyCache( MiniSpyData.LogMapMdl,
+                                                        UserMode,
+                                                        MmCached,
+                                                        NULL,
+                                                        FALSE,
+                                                        NormalPagePriority );
+
+        } except (EXCEPTION_EXECUTE_HANDLER) {
+
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            leave;
+        }
+
+        MiniSpyData.LogMapProcess = PsGetCurrentProcess();
+        ObReferenceObject( MiniSpyData.LogMapProcess );
+
+        MiniSpyData.LogMapEvent = event;
+        event = NULL;
+
+        MiniSpyData.LogMapUserAddress = userAddress;
+
+        //
+        //  Let producers signal the event.
+        //
+
+        ExReInitializeRundownProtection( &MiniSpyData.LogMapRundown );
+
+        MapInformation->Address = (ULONGLONG)(ULONG_PTR) userAddress;
+        MapInformation->Size = MiniSpyData.LogMapSize;
+        MapInformation->Reserved = 0;
+
+    } finally {
+
+        ExReleaseFastMutex( &MiniSpyData.LogConsumerLock );
+
+        if (event != NULL) {
+
+            ObDereferenceObject( event );
+        }
+    }
+
+    return status;
+}
+
+
+VOID
+SpyUnmapLog (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine unmaps the log rings from the process they were mapped
+    into, if they are mapped, and hands them back to SpyGetLog.
+
+    The process may have left anything at all in the rings, so whatever is
+    in them is thrown away.
 
 Arguments:
 
@@ -1416,25 +1888,56 @@ Return Value:
 
 --*/
 {
-    PLIST_ENTRY pList;
-    PRECORD_LIST pRecordList;
-    KIRQL oldIrql;
+    KAPC_STATE apcState;
+    ULONG i;
 
-    KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
+    PAGED_CODE();
 
-    while (!IsListEmpty( &MiniSpyData.OutputBufferList )) {
+    ExAcquireFastMutex( &MiniSpyData.LogConsumerLock );
 
-        pList = RemoveHeadList( &MiniSpyData.OutputBufferList );
-        KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
+    if (MiniSpyData.LogMapUserAddress != NULL) {
 
-        pRecordList = CONTAINING_RECORD( pList, RECORD_LIST, List );
+        //
+        //  Wait for any producer that is signalling the event, and keep any
+        //  more from starting.
+        //
 
-        SpyFreeRecord( pRecordList );
+        ExWaitForRundownProtectionRelease( &MiniSpyData.LogMapRundown );
 
-        KeAcquireSpinLock( &MiniSpyData.OutputBufferLock, &oldIrql );
+        ObDereferenceObject( MiniSpyData.LogMapEvent );
+        MiniSpyData.LogMapEvent = NULL;
+
+        //
+        //  We may be called in the context of any process, so attach to the
+        //  one the rings are mapped into.
+        //
+
+        KeStackAttachProcess( MiniSpyData.LogMapProcess, &apcState );
+        MmUnmapLockedPages( MiniSpyData.LogMapUserAddress, MiniSpyData.LogMapMdl );
+        KeUnstackDetachProcess( &apcState );
+
+        ObDereferenceObject( MiniSpyData.LogMapProcess );
+        MiniSpyData.LogMapProcess = NULL;
+        MiniSpyData.LogMapUserAddress = NULL;
+
+        //
+        //  Everything after our own Tail will have been written by us.
+        //
+
+        KeMemoryBarrier();
+
+        for (i = 0; i < MiniSpyData.LogRingCount; i++) {
+
+            if (MiniSpyData.LogRings[i].Shared != NULL) {
+
+                MiniSpyData.LogRings[i].Shared->Head = MiniSpyData.LogRings[i].Tail;
+            }
+        }
+
+        MiniSpyData.LogMap->ConsumerWaiting = 0;
     }
 
-    KeReleaseSpinLock( &MiniSpyData.OutputBufferLock, oldIrql );
+    ExReleaseFastMutex( &MiniSpyData.LogConsumerLock );
 }
 
 //---------------------------------------------------------------------------
@@ -1456,6 +1959,7 @@ Routine Description:
     This processes the following registry keys:
     hklm\system\CurrentControlSet\Services\Minispy\MaxRecords
     hklm\system\CurrentControlSet\Services\Minispy\NameQueryMethod
+    hklm\system\CurrentControlSet\Services\Minispy\LogRingSize
 
 
 Arguments:
@@ -1536,6 +2040,39 @@ Return Value:
         MiniSpyData.NameQueryMethod = *((PLONG)&(pValuePartialInfo->Data));
     }
 
+    //
+    // Read the LogRingSize entry from the registry.  This is the size of
+    // each processor's log ring and is rounded down to a power of 2.
+    //
+
+    RtlInitUnicodeString( &valueName, LOG_RING_SIZE );
+
+    status = ZwQueryValueKey( driverRegKey,
+                              &valueName,
+                              KeyValuePartialInformation,
+                              buffer,
+                              sizeof(buffer),
+                              &resultLength );
+
+    if (NT_SUCCESS( status )) {
+
+        ULONG ringSize;
+
+        pValuePartialInfo = (PKEY_VALUE_PARTIAL_INFORMATION) buffer;
+        FLT_ASSERT( pValuePartialInfo->Type == REG_DWORD );
+        ringSize = *((PULONG)&(pValuePartialInfo->Data));
+
+        if (ringSize >= MIN_LOG_RING_SIZE) {
+
+            MiniSpyData.LogRingSize = MIN_LOG_RING_SIZE;
+
+            while (MiniSpyData.LogRingSize <= ringSize / 2) {
+
+                MiniSpyData.LogRingSize *= 2;
+            }
+        }
+    }
+
     ZwClose(driverRegKey);
 }
 
@@ -54,7 +54,7 @@ Environment:
 //
 
 #define MINISPY_MAJ_VERSION 2
-#define MINISPY_MIN_VERSION 0
+#define MINISPY_MIN_VERSION 1
 
 typedef struct _MINISPYVER {
 
@@ -90,6 +90,7 @@ typedef _Return_type_success_(return >= 0) LONG NTSTATUS;
 #define RECORD_TYPE_FILETAG                      0x00000004
 
 #define RECORD_TYPE_FLAG_STATIC                  0x80000000
+#define RECORD_TYPE_FLAG_RECORDS_DROPPED         0x40000000
 #define RECORD_TYPE_FLAG_EXCEED_MEMORY_ALLOWANCE 0x20000000
 #define RECORD_TYPE_FLAG_OUT_OF_MEMORY           0x10000000
 #define RECORD_TYPE_FLAG_MASK                    0xffff0000
@@ -147,7 +148,8 @@ typedef struct _LOG_RECORD {
     ULONG SequenceNumber;   // space used by other members of RECORD_LIST
 
     ULONG RecordType;       // The type of log record this is.
-    ULONG Reserved;         // For alignment on IA64
+    ULONG DroppedRecords;   // Records dropped just before this one when
+                            // RECORD_TYPE_FLAG_RECORDS_DROPPED is set
 
     RECORD_DATA Data;
     WCHAR Name[];           //  This is a null terminated string
@@ -183,7 +185,8 @@ typedef struct _RECORD_LIST {
 typedef enum _MINISPY_COMMAND {
 
     GetMiniSpyLog,
-    GetMiniSpyVersion
+    GetMiniSpyVersion,
+    MapMiniSpyLog
 
 } MINISPY_COMMAND;
 
@@ -202,6 +205,79 @@ typedef struct _COMMAND_MESSAGE {
 
 #pragma warning(pop)
 
+//
+//  The filter keeps its records in one ring of packed LOG_RECORDs per
+//  processor.  The MapMiniSpyLog command maps the rings into the caller so
+//  it can read records in place instead of having them copied out with
+//  GetMiniSpyLog.  The mapping starts with a LOG_MAP, and the rings follow
+//  it RingStride bytes apart.
+//
+//  Head and Tail are free running byte counts; the offset in Buffer is the
+//  count masked by RingSize, which is a power of 2.  A record never wraps.
+//  When one doesn't fit before the end of Buffer the filter writes a zero
+//  Length there and starts the record at the beginning.
+//
+//  The filter only writes Tail, and only after the record is in Buffer.
+//  The consumer only writes Head, and only once it is done with the record.
+//  Records come out in order by taking the lowest SequenceNumber at the
+//  head of any ring.
+//
+
+typedef struct _LOG_RING {
+
+    __volatile ULONG Tail;
+    ULONG Reserved;
+
+    //
+    //  Total records dropped because this ring was full.
+    //
+
+    __volatile LONGLONG DroppedRecords;
+
+    //
+    //  Consumer side, on its own cache line.
+    //
+
+    DECLSPEC_CACHEALIGN __volatile ULONG Head;
+
+    DECLSPEC_CACHEALIGN UCHAR Buffer[1];
+
+} LOG_RING, *PLOG_RING;
+
+typedef struct _LOG_MAP {
+
+    ULONG RingCount;
+    ULONG RingSize;
+    ULONG RingStride;
+    ULONG RingOffset;       // Offset of the first ring from the LOG_MAP
+
+    //
+    //  Set by the consumer before it waits for records.  The filter clears
+    //  it and signals the consumer's event when it next logs a record.
+    //
+
+    __volatile LONG ConsumerWaiting;
+
+} LOG_MAP, *PLOG_MAP;
+
+#define LogMapRing(Map,Index) \
+    ((PLOG_RING)Add2Ptr( (Map), (Map)->RingOffset + (Index) * (Map)->RingStride ))
+
+//
+//  MapMiniSpyLog takes the handle of an auto-reset event in the
+//  COMMAND_MESSAGE Data as a ULONGLONG, and returns where the rings were
+//  mapped.  They stay mapped until the port is closed.  GetMiniSpyLog
+//  fails while they are mapped.
+//
+
+typedef struct _LOG_MAP_INFORMATION {
+
+    ULONGLONG Address;
+    ULONG Size;
+    ULONG Reserved;
+
+} LOG_MAP_INFORMATION, *PLOG_MAP_INFORMATION;
+
 //
 //  The maximum number of BYTES that can be used to store the file name in the
 //  RECORD_LIST structure
@@ -92,6 +92,474 @@ Return Value:
 }
 
 
+VOID
+OutputLogRecord (
+    _In_ PLOG_CONTEXT Context,
+    _Inout_ PLOG_RECORD LogRecord
+    )
+/*++
+
+Routine Description:
+
+    Outputs a log record to wherever we are logging it.  The binary log gets
+    the record exactly as the filter logged it; the screen and the text log
+    get it formatted.
+
+Arguments:
+
+    Context - Says where we are logging.
+
+    LogRecord - The record to output.  Formatting a reparse point record
+        moves its name around in place.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    if (Context->LogToBinaryFile) {
+
+        fwrite( LogRecord, LogRecord->Length, 1, Context->BinaryFile );
+    }
+
+    //
+    //  Don't spend any time formatting records nobody will see.
+    //
+
+    if (!Context->LogToScreen && !Context->LogToFile) {
+
+        return;
+    }
+
+
+    //
+    //  See if a reparse point entry
+    //
+
+    if (FlagOn(LogRecord->RecordType,RECORD_TYPE_FILETAG)) {
+
+        if (!TranslateFileTag( LogRecord )){
+
+            //
+            // If this is a reparse point that can't be interpreted, move on.
+            //
+
+            return;
+        }
+    }
+
+    if (Context->LogToScreen) {
+
+        ScreenDump( LogRecord->SequenceNumber,
+                    LogRecord->Name,
+                    &LogRecord->Data );
+    }
+
+    if (Context->LogToFile) {
+
+        FileDump( LogRecord->SequenceNumber,
+                  LogRecord->Name,
+                  &LogRecord->Data,
+                  Context->OutputFile );
+    }
+
+    //
+    //  The RecordType could also designate that we are out of memory
+    //  or hit our program defined memory limit, so check for these
+    //  cases.
+    //
+
+    if (FlagOn(LogRecord->RecordType,RECORD_TYPE_FLAG_OUT_OF_MEMORY)) {
+
+        if (Context->LogToScreen) {
+
+            printf( "M:  %08X System Out of Memory\n",
+                    LogRecord->SequenceNumber );
+        }
+
+        if (Context->LogToFile) {
+
+            fprintf( Context->OutputFile,
+                     "M:\t0x%08X\tSystem Out of Memory\n",
+                     LogRecord->SequenceNumber );
+        }
+
+    } else if (FlagOn(LogRecord->RecordType,RECORD_TYPE_FLAG_EXCEED_MEMORY_ALLOWANCE)) {
+
+        if (Context->LogToScreen) {
+
+            printf( "M:  %08X Exceeded Mamimum Allowed Memory Buffers\n",
+                    LogRecord->SequenceNumber );
+        }
+
+        if (Context->LogToFile) {
+
+            fprintf( Context->OutputFile,
+                     "M:\t0x%08X\tExceeded Mamimum Allowed Memory Buffers\n",
+                     LogRecord->SequenceNumber );
+        }
+    }
+
+    //
+    //  The filter drops records when a processor's log ring is full
+    //  and tells us how many were lost on the next record it logs.
+    //
+
+    if (FlagOn(LogRecord->RecordType,RECORD_TYPE_FLAG_RECORDS_DROPPED)) {
+
+        if (Context->LogToScreen) {
+
+            printf( "D:  %08X %u Records Dropped\n",
+                    LogRecord->SequenceNumber,
+                    LogRecord->DroppedRecords );
+        }
+
+        if (Context->LogToFile) {
+
+            fprintf( Context->OutputFile,
+                     "D:\t0x%08X\t%u Records Dropped\n",
+                     LogRecord->SequenceNumber,
+                     LogRecord->DroppedRecords );
+        }
+    }
+}
+
+
+BOOLEAN
+MapLogRings (
+    _In_ PLOG_CONTEXT Context,
+    _Out_ PLOG_MAP *LogMap,
+    _Out_ HANDLE *Event
+    )
+/*++
+
+Routine Description:
+
+    Asks the filter to map its log rings into this process, along with an
+    event it will signal when we are waiting for records.  The rings stay
+    mapped until we close our port.
+
+Arguments:
+
+    Context - Has the port connected to the filter.
+
+    LogMap - Receives where the rings were mapped.
+
+    Event - Receives the event to wait on when the rings are empty.
+
+Return Value:
+
+    TRUE if the rings were mapped, FALSE if we have to use GetMiniSpyLog.
+
+--*/
+{
+    ULONGLONG commandBuffer[(sizeof( COMMAND_MESSAGE ) + sizeof( ULONGLONG ) + sizeof( ULONGLONG ) - 1) / sizeof( ULONGLONG )];
+    PCOMMAND_MESSAGE commandMessage = (PCOMMAND_MESSAGE) commandBuffer;
+    LOG_MAP_INFORMATION mapInformation;
+    DWORD bytesReturned = 0;
+    HRESULT hResult;
+    HANDLE event;
+
+    *LogMap = NULL;
+    *Event = NULL;
+
+    event = CreateEvent( NULL, FALSE, FALSE, NULL );
+
+    if (event == NULL) {
+
+        return FALSE;
+    }
+
+    commandMessage->Command = MapMiniSpyLog;
+    *((ULONGLONG UNALIGNED *) commandMessage->Data) = (ULONGLONG)(ULONG_PTR) event;
+
+    hResult = FilterSendMessage( Context->Port,
+                                 commandMessage,
+                                 sizeof( COMMAND_MESSAGE ) + sizeof( ULONGLONG ),
+                                 &mapInformation,
+                                 sizeof( mapInformation ),
+                                 &bytesReturned );
+
+    if (IS_ERROR( hResult ) || (bytesReturned < sizeof( mapInformation ))) {
+
+        CloseHandle( event );
+        return FALSE;
+    }
+
+    *LogMap = (PLOG_MAP)(ULONG_PTR) mapInformation.Address;
+    *Event = event;
+    return TRUE;
+}
+
+
+PLOG_RECORD
+PeekMappedLogRing (
+    _In_ PLOG_MAP LogMap,
+    _In_ PLOG_RING Ring
+    )
+/*++
+
+Routine Description:
+
+    Returns the oldest record in a mapped log ring without removing it,
+    stepping over any padding at the end of the buffer.
+
+Arguments:
+
+    LogMap - Describes the mapped rings.
+
+    Ring - The ring to look at.
+
+Return Value:
+
+    The oldest record, or NULL if the ring is empty.
+
+--*/
+{
+    ULONG head = Ring->Head;
+    ULONG tail = Ring->Tail;
+    ULONG offset;
+    PLOG_RECORD pLogRecord;
+
+    //
+    //  Don't look at record data until we have seen the Tail that
+    //  published it.
+    //
+
+    MemoryBarrier();
+
+    while (head != tail) {
+
+        offset = head & (LogMap->RingSize - 1);
+        pLogRecord = (PLOG_RECORD) &Ring->Buffer[offset];
+
+        if (pLogRecord->Length != 0) {
+
+            if ((pLogRecord->Length < (sizeof(LOG_RECORD)+sizeof(WCHAR))) ||
+                (pLogRecord->Length > LogMap->RingSize - offset)) {
+
+                printf( "UNEXPECTED LOG_RECORD->Length: length=%d offset=%d\n",
+                        pLogRecord->Length,
+                        offset );
+
+                //
+                //  We can't find the next record, so skip what's there.
+                //
+
+                Ring->Head = tail;
+                return NULL;
+            }
+
+            return pLogRecord;
+        }
+
+        //
+        //  A zero length marks the unused end of the buffer.
+        //
+
+        head += LogMap->RingSize - offset;
+        Ring->Head = head;
+    }
+
+    return NULL;
+}
+
+
+VOID
+RetrieveMappedLogRecords (
+    _In_ PLOG_CONTEXT Context,
+    _In_ PLOG_MAP LogMap,
+    _In_ HANDLE Event
+    )
+/*++
+
+Routine Description:
+
+    Outputs records straight out of the filter's mapped log rings, oldest
+    first, until we are told to shut down.  When the rings are empty we
+    wait for the filter to signal Event.
+
+Arguments:
+
+    Context - Contains context structure for synchronizing with the
+        main program thread.
+
+    LogMap - Where the filter mapped its log rings.
+
+    Event - Signalled by the filter when it logs a record while we are
+        waiting.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PLOG_RING ring;
+    PLOG_RING pOldestRing;
+    PLOG_RECORD pLogRecord;
+    PLOG_RECORD pOldestRecord;
+    ULONG length;
+    ULONG i;
+
+    while (!Context->CleaningUp) {
+
+        //
+        //  Find the ring whose next record is the oldest.
+        //
+
+        pOldestRecord = NULL;
+        pOldestRing = NULL;
+
+        for (i = 0; i < LogMap->RingCount; i++) {
+
+            ring = LogMapRing( LogMap, i );
+            pLogRecord = PeekMappedLogRing( LogMap, ring );
+
+            if ((pLogRecord != NULL) &&
+                ((pOldestRecord == NULL) ||
+                 ((LONG)(pLogRecord->SequenceNumber - pOldestRecord->SequenceNumber) < 0))) {
+
+                pOldestRecord = pLogRecord;
+                pOldestRing = ring;
+            }
+        }
+
+        if (pOldestRecord == NULL) {
+
+            //
+            //  Tell the filter we are going to wait and then look once
+            //  more, so that a record logged in between either gets seen
+            //  or wakes us up.  Wake up every so often anyway to see if we
+            //  should shut down.
+            //
+
+            if (InterlockedExchange( &LogMap->ConsumerWaiting, 1 ) == 0) {
+
+                continue;
+            }
+
+            WaitForSingleObject( Event, POLL_INTERVAL );
+            continue;
+        }
+
+        length = pOldestRecord->Length;
+
+        OutputLogRecord( Context, pOldestRecord );
+
+        //
+        //  Give the space back to the filter once we are done with it.
+        //
+
+        MemoryBarrier();
+        pOldestRing->Head += length;
+    }
+}
+
+
+BOOLEAN
+WriteBinaryLogHeader (
+    _In_ FILE *File
+    )
+/*++
+
+Routine Description:
+
+    Starts a new binary log file.
+
+Arguments:
+
+    File - The binary log file.
+
+Return Value:
+
+    TRUE if the header was written.
+
+--*/
+{
+    BINARY_LOG_HEADER header;
+
+    header.Signature = BINARY_LOG_SIGNATURE;
+    header.Version = BINARY_LOG_VERSION;
+    header.PointerSize = sizeof( PVOID );
+
+    return (fwrite( &header, sizeof( header ), 1, File ) == 1);
+}
+
+
+BOOLEAN
+FormatBinaryLog (
+    _In_ PLOG_CONTEXT Context,
+    _In_ FILE *File
+    )
+/*++
+
+Routine Description:
+
+    Reads the records in a binary log file and outputs them to the screen
+    and/or text file, just as if they had come from the filter.
+
+Arguments:
+
+    Context - Says where to output the records.
+
+    File - The binary log file, opened for reading.
+
+Return Value:
+
+    TRUE if the whole log was formatted.
+
+--*/
+{
+    PVOID alignedBuffer[BUFFER_SIZE/sizeof( PVOID )];
+    PLOG_RECORD pLogRecord = (PLOG_RECORD) alignedBuffer;
+    BINARY_LOG_HEADER header;
+
+    if ((fread( &header, sizeof( header ), 1, File ) != 1) ||
+        (header.Signature != BINARY_LOG_SIGNATURE)) {
+
+        printf( "Not a MiniSpy binary log\n" );
+        return FALSE;
+    }
+
+    if ((header.Version != BINARY_LOG_VERSION) ||
+        (header.PointerSize != sizeof( PVOID ))) {
+
+        printf( "Binary log version %d with %d byte pointers can't be formatted here\n",
+                header.Version,
+                header.PointerSize );
+        return FALSE;
+    }
+
+    while (fread( &pLogRecord->Length, sizeof( ULONG ), 1, File ) == 1) {
+
+        if ((pLogRecord->Length < (sizeof(LOG_RECORD)+sizeof(WCHAR))) ||
+            (pLogRecord->Length > MAX_LOG_RECORD_LENGTH)) {
+
+            printf( "UNEXPECTED LOG_RECORD->Length: length=%d expected>=%d\n",
+                    pLogRecord->Length,
+                    (sizeof(LOG_RECORD)+sizeof(WCHAR)));
+
+            return FALSE;
+        }
+
+        if (fread( Add2Ptr( pLogRecord, sizeof( ULONG ) ),
+                   pLogRecord->Length - sizeof( ULONG ),
+                   1,
+                   File ) != 1) {
+
+            printf( "Binary log ends in the middle of a record\n" );
+            return FALSE;
+        }
+
+        OutputLogRecord( Context, pLogRecord );
+    }
+
+    return TRUE;
+}
+
+
 DWORD
 WINAPI
 RetrieveLogRecords(
@@ -122,11 +590,24 @@ Return Value:
     PCHAR buffer = (PCHAR) alignedBuffer;
     HRESULT hResult;
     PLOG_RECORD pLogRecord;
-    PRECORD_DATA pRecordData;
     COMMAND_MESSAGE commandMessage;
+    PLOG_MAP logMap;
+    HANDLE mapEvent;
 
     //printf("Log: Starting up\n");
 
+    //
+    //  If the filter will map its log rings into us we read the records in
+    //  place, until we are told to shut down, and the loop below exits
+    //  straight away.  Otherwise we ask the filter for copies of them.
+    //
+
+    if (MapLogRings( context, &logMap, &mapEvent )) {
+
+        RetrieveMappedLogRecords( context, logMap, mapEvent );
+        CloseHandle( mapEvent );
+    }
+
 #pragma warning(push)
 #pragma warning(disable:4127) // conditional expression is constant
 
@@ -215,76 +696,7 @@ Return Value:
                 break;
             }
 
-            pRecordData = &pLogRecord->Data;
-
-            //
-            //  See if a reparse point entry
-            //
-
-            if (FlagOn(pLogRecord->RecordType,RECORD_TYPE_FILETAG)) {
-
-                if (!TranslateFileTag( pLogRecord )){
-
-                    //
-                    // If this is a reparse point that can't be interpreted, move on.
-                    //
-
-                    pLogRecord = (PLOG_RECORD)Add2Ptr(pLogRecord,pLogRecord->Length);
-                    continue;
-                }
-            }
-
-            if (context->LogToScreen) {
-
-                ScreenDump( pLogRecord->SequenceNumber,
-                            pLogRecord->Name,
-                            pRecordData );
-            }
-
-            if (context->LogToFile) {
-
-                FileDump( pLogRecord->SequenceNumber,
-                          pLogRecord->Name,
-                          pRecordData,
-                          context->OutputFile );
-            }
-
-            //
-            //  The RecordType could also designate that we are out of memory
-            //  or hit our program defined memory limit, so check for these
-            //  cases.
-            //
-
-            if (FlagOn(pLogRecord->RecordType,RECORD_TYPE_FLAG_OUT_OF_MEMORY)) {
-
-                if (context->LogToScreen) {
-
-                    printf( "M:  %08X System Out of Memory\n",
-                            pLogRecord->SequenceNumber );
-                }
-
-                if (context->LogToFile) {
-
-                    fprintf( context->OutputFile,
-                             "M:\t0x%08X\tSystem Out of Memory\n",
-                             pLogRecord->SequenceNumber );
-                }
-
-            } else if (FlagOn(pLogRecord->RecordType,RECORD_TYPE_FLAG_EXCEED_MEMORY_ALLOWANCE)) {
-
-                if (context->LogToScreen) {
-
-                    printf( "M:  %08X Exceeded Mamimum Allowed Memory Buffers\n",
-                            pLogRecord->SequenceNumber );
-                }
-
-                if (context->LogToFile) {
-
-                    fprintf( context->OutputFile,
-                             "M:\t0x%08X\tExceeded Mamimum Allowed Memory Buffers\n",
-                             pLogRecord->SequenceNumber );
-                }
-            }
+            OutputLogRecord( context, pLogRecord );
 
             //
             // Move to next LOG_RECORD
@@ -36,6 +36,9 @@ typedef struct _LOG_CONTEXT {
     BOOLEAN LogToFile;
     FILE   *OutputFile;
 
+    BOOLEAN LogToBinaryFile;
+    FILE   *BinaryFile;
+
     BOOLEAN NextLogToScreen;
 
     //
@@ -47,6 +50,25 @@ typedef struct _LOG_CONTEXT {
 
 } LOG_CONTEXT, *PLOG_CONTEXT;
 
+//
+//  A binary log file is a BINARY_LOG_HEADER followed by the LOG_RECORDs
+//  exactly as the filter logged them, packed one after another, so writing
+//  one doesn't cost any formatting.  "mspyUser /r" formats it afterwards.
+//  RECORD_DATA has pointer sized fields, so a log can only be formatted by
+//  a build with the same pointer size as the one that wrote it.
+//
+
+#define BINARY_LOG_SIGNATURE    'GLSM'
+#define BINARY_LOG_VERSION      1
+
+typedef struct _BINARY_LOG_HEADER {
+
+    ULONG Signature;
+    USHORT Version;
+    USHORT PointerSize;
+
+} BINARY_LOG_HEADER, *PBINARY_LOG_HEADER;
+
 //
 //  Function prototypes
 //
@@ -56,6 +78,17 @@ RetrieveLogRecords(
     _In_ LPVOID lpParameter
     );
 
+BOOLEAN
+WriteBinaryLogHeader (
+    _In_ FILE *File
+    );
+
+BOOLEAN
+FormatBinaryLog (
+    _In_ PLOG_CONTEXT Context,
+    _In_ FILE *File
+    );
+
 VOID
 FileDump (
     _In_ ULONG SequenceNumber,
@@ -54,6 +54,12 @@ ListDevices (
     VOID
     );
 
+DWORD
+FormatLogFile (
+    _In_ int argc,
+    _In_reads_(argc) char *argv[]
+    );
+
 VOID
 DisplayError (
    _In_ DWORD Code
@@ -195,6 +201,18 @@ Return Value:
 
     context.ShutDown = NULL;
 
+    //
+    //  Formatting a binary log doesn't need the filter.
+    //
+
+    if ((argc > 1) &&
+        (argv[1][0] == '/') &&
+        ((argv[1][1] == 'r') || (argv[1][1] == 'R'))) {
+
+        FormatLogFile( argc - 1, &argv[1] );
+        return 0;
+    }
+
     //
     //  Open the port that is used to talk to
     //  MiniSpy.
@@ -230,6 +248,8 @@ Return Value:
     context.LogToScreen = FALSE;        //don't start logging yet
     context.NextLogToScreen = TRUE;
     context.OutputFile = NULL;
+    context.LogToBinaryFile = FALSE;
+    context.BinaryFile = NULL;
 
     if (context.ShutDown == NULL) {
 
@@ -416,6 +436,11 @@ Main_Cleanup:
         fclose( context.OutputFile );
     }
 
+    if (context.LogToBinaryFile) {
+
+        fclose( context.BinaryFile );
+    }
+
 Main_Exit:
 
     //
@@ -709,6 +734,56 @@ Return Value:
                 }
                 break;
 
+            case 'b':
+            case 'B':
+
+                //
+                // Output unformatted records to a binary file
+                //
+
+                if (Context->LogToBinaryFile) {
+
+                    printf( "    Stop logging to binary file \n" );
+                    Context->LogToBinaryFile = FALSE;
+                    assert( Context->BinaryFile );
+                    _Analysis_assume_( Context->BinaryFile != NULL );
+                    fclose( Context->BinaryFile );
+                    Context->BinaryFile = NULL;
+
+                } else {
+
+                    parmIndex++;
+
+                    if (parmIndex >= argc) {
+
+                        //
+                        // Not enough parameters
+                        //
+
+                        goto InterpretCommand_Usage;
+                    }
+
+                    parm = argv[parmIndex];
+                    printf( "    Log to binary file %s\n", parm );
+
+                    if (fopen_s( &Context->BinaryFile, parm, "wb" ) != 0) {
+
+                        printf( "    Could not open %s\n", parm );
+                        break;
+                    }
+
+                    if (!WriteBinaryLogHeader( Context->BinaryFile )) {
+
+                        printf( "    Could not write to %s\n", parm );
+                        fclose( Context->BinaryFile );
+                        Context->BinaryFile = NULL;
+                        break;
+                    }
+
+                    Context->LogToBinaryFile = TRUE;
+                }
+                break;
+
             default:
 
                 //
@@ -762,12 +837,15 @@ InterpretCommand_Exit:
     return returnValue;
 
 InterpretCommand_Usage:
-    printf("Valid switches: [/a <drive>] [/d <drive>] [/l] [/s] [/f [<file name>]]\n"
+    printf("Valid switches: [/a <drive>] [/d <drive>] [/l] [/s] [/f [<file name>]] [/b [<file name>]]\n"
            "    [/a <drive>] starts monitoring <drive>\n"
            "    [/d <drive> [<instance id>]] detaches filter <instance id> from <drive>\n"
            "    [/l] lists all the drives the monitor is currently attached to\n"
            "    [/s] turns on and off showing logging output on the screen\n"
            "    [/f [<file name>]] turns on and off logging to the specified file\n"
+           "    [/b [<file name>]] turns on and off logging unformatted records to the specified binary file\n"
+           "  To format a binary file instead of monitoring:\n"
+           "    /r <binary file name> [<file name>] formats to the screen, or the specified file\n"
            "  If you are in command mode:\n"
            "    [enter] will enter command mode\n"
            "    [go|g] will exit command mode\n"
@@ -778,6 +856,77 @@ InterpretCommand_Usage:
 }
 
 
+DWORD
+FormatLogFile (
+    _In_ int argc,
+    _In_reads_(argc) char *argv[]
+    )
+/*++
+
+Routine Description:
+
+    Formats a binary log written with /b, offline, to the screen or to a
+    text file.
+
+Arguments:
+
+    argc - The number of arguments, starting with the /r switch.
+
+    argv - The arguments: /r, the binary log file and an optional text
+        file.
+
+Return Value:
+
+    SUCCESS, or USAGE_ERROR.
+
+--*/
+{
+    LOG_CONTEXT context;
+    FILE *binaryFile;
+
+    if ((argc < 2) || (argc > 3)) {
+
+        printf( "Usage: /r <binary file name> [<file name>]\n" );
+        return USAGE_ERROR;
+    }
+
+    ZeroMemory( &context, sizeof( context ) );
+
+    if (fopen_s( &binaryFile, argv[1], "rb" ) != 0) {
+
+        printf( "Could not open %s\n", argv[1] );
+        return USAGE_ERROR;
+    }
+
+    if (argc > 2) {
+
+        if (fopen_s( &context.OutputFile, argv[2], "w" ) != 0) {
+
+            printf( "Could not open %s\n", argv[2] );
+            fclose( binaryFile );
+            return USAGE_ERROR;
+        }
+
+        context.LogToFile = TRUE;
+
+    } else {
+
+        context.LogToScreen = TRUE;
+    }
+
+    FormatBinaryLog( &context, binaryFile );
+
+    fclose( binaryFile );
+
+    if (context.LogToFile) {
+
+        fclose( context.OutputFile );
+    }
+
+    return SUCCESS;
+}
+
+
 ULONG
 IsAttachedToVolume(
     _In_ LPCWSTR VolumeName
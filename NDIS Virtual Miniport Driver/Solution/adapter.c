@@ -1367,6 +1367,14 @@ Arguments:
 
     ASSERT(Adapter);
 
+    //
+    // Stop counting this adapter as promiscuous.
+    //
+    if (Adapter->PacketFilter & NDIS_PACKET_TYPE_PROMISCUOUS)
+    {
+        InterlockedDecrement(&GlobalData.PromiscuousAdapterCount);
+    }
+
     //
     // Free all the resources we allocated in NICAllocAdapter.
     //
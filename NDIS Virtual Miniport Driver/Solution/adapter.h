@@ -105,6 +105,10 @@ typedef struct _MP_ADAPTER
 {
     LIST_ENTRY              List;
 
+    // TRUE while the adapter is on GlobalData.AdapterList.  Protected by
+    // GlobalData.Lock.
+    BOOLEAN                 Attached;
+
     //
     // Keep track of various device objects.
     //
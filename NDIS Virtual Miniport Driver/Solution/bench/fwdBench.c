@@ -0,0 +1,467 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    FwdBench.C
+
+Abstract:
+
+    This module measures how many frames per second the netvmini data path
+    can switch as the number of adapters grows.
+
+    It builds the driver's Forward.c in user mode and runs one thread per
+    simulated adapter.  Each thread sends unicast frames to the addresses
+    of the other adapters the way RXDeliverFrameToEveryAdapter does: it
+    learns the source address, looks up the destination, and queues the
+    frame on the owner, or on every other adapter if the owner is unknown.
+    Queueing a frame on an adapter is modeled by an interlocked increment
+    of the adapter's receive count.
+
+    Each adapter count is run twice, once with the forwarding table and
+    once flooding every frame to every other adapter, as the driver did
+    before it learned addresses.
+
+--*/
+
+#include <ndis.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "hardware.h"
+#include "forward.h"
+
+
+#define FWDBENCH_DEFAULT_SECONDS           2
+#define FWDBENCH_DEFAULT_ADDRESSES         4
+#define FWDBENCH_MAX_ADAPTERS              64
+#define FWDBENCH_MAX_ADDRESSES             16
+
+//
+// A simulated adapter.  Each one is on its own cache lines, as the real
+// adapters are separate allocations.
+//
+typedef struct DECLSPEC_CACHEALIGN _MP_ADAPTER
+{
+    ULONG                   Index;
+
+    UCHAR                   Addresses[FWDBENCH_MAX_ADDRESSES][NIC_MACADDR_SIZE];
+
+    // Frames queued on this adapter by the others
+    DECLSPEC_CACHEALIGN volatile LONG64 FramesReceived;
+
+    // Frames sent by this adapter's thread
+    DECLSPEC_CACHEALIGN LONG64 FramesSent;
+
+    HANDLE                  Thread;
+} MP_ADAPTER, *PMP_ADAPTER;
+
+typedef struct _FWDBENCH_RUN
+{
+    MP_FORWARDING_TABLE     Table;
+
+    PMP_ADAPTER             Adapters;
+    ULONG                   AdapterCount;
+    ULONG                   AddressCount;
+
+    // TRUE to flood every frame, as the driver did without the table
+    BOOLEAN                 Flood;
+
+    HANDLE                  StartEvent;
+    volatile LONG           Stop;
+} FWDBENCH_RUN, *PFWDBENCH_RUN;
+
+typedef struct _FWDBENCH_THREAD
+{
+    PFWDBENCH_RUN           Run;
+    PMP_ADAPTER             Adapter;
+} FWDBENCH_THREAD, *PFWDBENCH_THREAD;
+
+
+VOID
+Usage(
+    VOID)
+{
+    printf("Measures frames/sec switched by the netvmini forwarding table\n");
+    printf("Usage: fwdbench [max adapters] [seconds per run] [addresses per adapter]\n");
+    printf("    Adapter counts double from 1 up to the maximum (default: processors, at most %d)\n",
+            FWDBENCH_MAX_ADAPTERS);
+    printf("    Each count is run with the forwarding table and flooding (default %d seconds)\n",
+            FWDBENCH_DEFAULT_SECONDS);
+    printf("    Each adapter sends from this many unicast addresses (default %d, at most %d)\n",
+            FWDBENCH_DEFAULT_ADDRESSES,
+            FWDBENCH_MAX_ADDRESSES);
+}
+
+
+static
+VOID
+FwdBenchDeliver(
+    _In_  PFWDBENCH_RUN  Run,
+    _In_  PMP_ADAPTER    SendAdapter,
+    _In_reads_bytes_(NIC_MACADDR_SIZE) PUCHAR  SourceAddress,
+    _In_reads_bytes_(NIC_MACADDR_SIZE) PUCHAR  DestAddress)
+/*++
+
+Routine Description:
+
+    This routine switches one frame the way RXDeliverFrameToEveryAdapter
+    does, without the adapter list lock, which every sender takes shared.
+
+Arguments:
+
+    Run                         The run
+    SendAdapter                 The adapter sending the frame
+    SourceAddress               Source MAC address of the frame
+    DestAddress                 Destination MAC address of the frame
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PMP_ADAPTER OwnerAdapter = NULL;
+    ULONG i;
+
+    if (!Run->Flood)
+    {
+        NICLearnSourceAddress(&Run->Table, SendAdapter, SourceAddress, 0);
+        OwnerAdapter = NICLookupDestinationAddress(&Run->Table, DestAddress, 0);
+    }
+
+    if (OwnerAdapter == SendAdapter)
+    {
+        InterlockedIncrement64(&Run->Table.Stats.FramesFiltered);
+    }
+    else if (OwnerAdapter != NULL)
+    {
+        InterlockedIncrement64(&OwnerAdapter->FramesReceived);
+        InterlockedIncrement64(&Run->Table.Stats.FramesForwarded);
+    }
+    else
+    {
+        for (i = 0; i < Run->AdapterCount; i++)
+        {
+            if (&Run->Adapters[i] != SendAdapter)
+            {
+                InterlockedIncrement64(&Run->Adapters[i].FramesReceived);
+            }
+        }
+
+        InterlockedIncrement64(&Run->Table.Stats.FramesFlooded);
+    }
+}
+
+
+static
+DWORD
+WINAPI
+FwdBenchSendThread(
+    _In_  LPVOID  Parameter)
+/*++
+
+Routine Description:
+
+    This routine sends frames from one adapter until the run is stopped.
+    Each frame goes from the next of the adapter's addresses to a random
+    address of a random other adapter.
+
+Arguments:
+
+    Parameter                   The thread's FWDBENCH_THREAD
+
+Return Value:
+
+    0
+
+--*/
+{
+    PFWDBENCH_THREAD Thread = (PFWDBENCH_THREAD)Parameter;
+    PFWDBENCH_RUN Run = Thread->Run;
+    PMP_ADAPTER Adapter = Thread->Adapter;
+    PMP_ADAPTER DestAdapter;
+    ULONG Random = (Adapter->Index + 1) * 2654435761UL;
+    ULONG Source = 0;
+    ULONG Dest;
+    LONG64 Frames = 0;
+
+    WaitForSingleObject(Run->StartEvent, INFINITE);
+
+    while (Run->Stop == 0)
+    {
+        //
+        // Check the clock only every so often, it costs more than a frame.
+        //
+        ULONG Batch;
+
+        for (Batch = 0; Batch < 256; Batch++)
+        {
+            Random ^= Random << 13;
+            Random ^= Random >> 17;
+            Random ^= Random << 5;
+
+            if (Run->AdapterCount > 1)
+            {
+                Dest = (Adapter->Index + 1 + (Random >> 8) % (Run->AdapterCount - 1)) % Run->AdapterCount;
+            }
+            else
+            {
+                Dest = Adapter->Index;
+            }
+
+            DestAdapter = &Run->Adapters[Dest];
+
+            FwdBenchDeliver(Run,
+                    Adapter,
+                    Adapter->Addresses[Source],
+                    DestAdapter->Addresses[Random % Run->AddressCount]);
+
+            Source = (Source + 1) % Run->AddressCount;
+        }
+
+        Frames += Batch;
+    }
+
+    Adapter->FramesSent = Frames;
+
+    return 0;
+}
+
+
+static
+BOOLEAN
+FwdBenchRun(
+    _In_  ULONG    AdapterCount,
+    _In_  ULONG    AddressCount,
+    _In_  ULONG    Seconds,
+    _In_  BOOLEAN  Flood,
+    _Out_ double  *FramesPerSecond,
+    _Out_ double  *DeliveriesPerSecond)
+/*++
+
+Routine Description:
+
+    This routine runs one adapter count in one mode and reports the frames
+    sent and the frames queued on receiving adapters, per second.
+
+Arguments:
+
+    AdapterCount                Number of adapters, one thread each
+    AddressCount                Unicast addresses per adapter
+    Seconds                     How long to send for
+    Flood                       TRUE to flood every frame
+    FramesPerSecond             Receives the frames sent per second
+    DeliveriesPerSecond         Receives the frames queued per second
+
+Return Value:
+
+    FALSE if we ran out of memory or threads, TRUE otherwise.
+
+--*/
+{
+    PFWDBENCH_RUN Run;
+    FWDBENCH_THREAD Threads[FWDBENCH_MAX_ADAPTERS];
+    LARGE_INTEGER Frequency;
+    LARGE_INTEGER Start;
+    LARGE_INTEGER End;
+    LONG64 Sent = 0;
+    LONG64 Received = 0;
+    double Elapsed;
+    ULONG i;
+    ULONG j;
+    BOOLEAN Result = TRUE;
+
+    Run = (PFWDBENCH_RUN)_aligned_malloc(sizeof(*Run), SYSTEM_CACHE_ALIGNMENT_SIZE);
+    if (Run == NULL)
+    {
+        return FALSE;
+    }
+
+    ZeroMemory(Run, sizeof(*Run));
+
+    Run->Adapters = (PMP_ADAPTER)_aligned_malloc(AdapterCount * sizeof(MP_ADAPTER), SYSTEM_CACHE_ALIGNMENT_SIZE);
+    Run->StartEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (Run->Adapters == NULL || Run->StartEvent == NULL)
+    {
+        Result = FALSE;
+        goto Exit;
+    }
+
+    ZeroMemory(Run->Adapters, AdapterCount * sizeof(MP_ADAPTER));
+
+    NICInitializeForwardingTable(&Run->Table);
+    Run->AdapterCount = AdapterCount;
+    Run->AddressCount = AddressCount;
+    Run->Flood = Flood;
+
+    //
+    // Locally administered unicast addresses, 02-00-00-00-<adapter>-<n>.
+    //
+    for (i = 0; i < AdapterCount; i++)
+    {
+        Run->Adapters[i].Index = i;
+
+        for (j = 0; j < AddressCount; j++)
+        {
+            Run->Adapters[i].Addresses[j][0] = 0x02;
+            Run->Adapters[i].Addresses[j][4] = (UCHAR)i;
+            Run->Adapters[i].Addresses[j][5] = (UCHAR)j;
+        }
+    }
+
+    //
+    // Every adapter has been heard from before the clock starts, as on a
+    // network that has been up for a while.
+    //
+    if (!Flood)
+    {
+        for (i = 0; i < AdapterCount; i++)
+        {
+            for (j = 0; j < AddressCount; j++)
+            {
+                NICLearnSourceAddress(&Run->Table, &Run->Adapters[i], Run->Adapters[i].Addresses[j], 0);
+            }
+        }
+    }
+
+    for (i = 0; i < AdapterCount; i++)
+    {
+        Threads[i].Run = Run;
+        Threads[i].Adapter = &Run->Adapters[i];
+        Run->Adapters[i].Thread = CreateThread(NULL, 0, FwdBenchSendThread, &Threads[i], 0, NULL);
+
+        if (Run->Adapters[i].Thread == NULL)
+        {
+            Run->Stop = 1;
+            Result = FALSE;
+            break;
+        }
+    }
+
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&Start);
+    SetEvent(Run->StartEvent);
+
+    if (Result)
+    {
+        Sleep(Seconds * 1000);
+    }
+
+    InterlockedExchange(&Run->Stop, 1);
+
+    for (i = 0; i < AdapterCount && Run->Adapters[i].Thread != NULL; i++)
+    {
+        WaitForSingleObject(Run->Adapters[i].Thread, INFINITE);
+        CloseHandle(Run->Adapters[i].Thread);
+    }
+
+    QueryPerformanceCounter(&End);
+
+    for (i = 0; i < AdapterCount; i++)
+    {
+        Sent += Run->Adapters[i].FramesSent;
+        Received += Run->Adapters[i].FramesReceived;
+    }
+
+    Elapsed = (double)(End.QuadPart - Start.QuadPart) / (double)Frequency.QuadPart;
+    *FramesPerSecond = (double)Sent / Elapsed;
+    *DeliveriesPerSecond = (double)Received / Elapsed;
+
+    NICFreeForwardingTable(&Run->Table);
+
+Exit:
+
+    if (Run->StartEvent != NULL)
+    {
+        CloseHandle(Run->StartEvent);
+    }
+
+    if (Run->Adapters != NULL)
+    {
+        _aligned_free(Run->Adapters);
+    }
+
+    _aligned_free(Run);
+
+    return Result;
+}
+
+
+int __cdecl
+main(
+    _In_ int argc,
+    _In_reads_(argc) char *argv[])
+{
+    SYSTEM_INFO SystemInfo;
+    ULONG MaxAdapters;
+    ULONG Seconds = FWDBENCH_DEFAULT_SECONDS;
+    ULONG AddressCount = FWDBENCH_DEFAULT_ADDRESSES;
+    ULONG AdapterCount;
+    double Forwarded;
+    double ForwardedDeliveries;
+    double Flooded;
+    double FloodedDeliveries;
+
+    GetSystemInfo(&SystemInfo);
+    MaxAdapters = min(SystemInfo.dwNumberOfProcessors, FWDBENCH_MAX_ADAPTERS);
+
+    if (argc > 1)
+    {
+        MaxAdapters = (ULONG)atoi(argv[1]);
+    }
+
+    if (argc > 2)
+    {
+        Seconds = (ULONG)atoi(argv[2]);
+    }
+
+    if (argc > 3)
+    {
+        AddressCount = (ULONG)atoi(argv[3]);
+    }
+
+    if (MaxAdapters == 0 || MaxAdapters > FWDBENCH_MAX_ADAPTERS
+            || Seconds == 0
+            || AddressCount == 0 || AddressCount > FWDBENCH_MAX_ADDRESSES)
+    {
+        Usage();
+        return 1;
+    }
+
+    printf("Fwdbench: %u processors, %u addresses per adapter, %u seconds per run\n",
+            SystemInfo.dwNumberOfProcessors,
+            AddressCount,
+            Seconds);
+    printf("%8s %16s %16s %16s %16s\n",
+            "adapters", "frames/s", "queued/s", "flood frames/s", "flood queued/s");
+
+    for (AdapterCount = 1; ; AdapterCount = min(AdapterCount * 2, MaxAdapters))
+    {
+        if (!FwdBenchRun(AdapterCount, AddressCount, Seconds, FALSE, &Forwarded, &ForwardedDeliveries)
+                || !FwdBenchRun(AdapterCount, AddressCount, Seconds, TRUE, &Flooded, &FloodedDeliveries))
+        {
+            printf("ERROR: Couldn't run %u adapters\n", AdapterCount);
+            return 2;
+        }
+
+        printf("%8u %16.0f %16.0f %16.0f %16.0f\n",
+                AdapterCount,
+                Forwarded,
+                ForwardedDeliveries,
+                Flooded,
+                FloodedDeliveries);
+
+        if (AdapterCount == MaxAdapters)
+        {
+            break;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+   Ndis.H
+
+Abstract:
+
+    This module stands in for the WDK's ndis.h when fwdbench builds
+    Forward.c in user mode.  It supplies the few NDIS and kernel routines
+    the forwarding table uses, with the same behavior: the spin lock spins,
+    and the interrupt time counts in 100ns units.
+
+--*/
+
+
+#ifndef _FWDBENCH_NDIS_H
+#define _FWDBENCH_NDIS_H
+
+
+#include <windows.h>
+
+
+#define ETH_LENGTH_OF_ADDRESS              6
+
+#define ETH_IS_MULTICAST(_addr) \
+        (BOOLEAN)(((PUCHAR)(_addr))[0] & ((UCHAR)0x01))
+
+#define ETH_COPY_NETWORK_ADDRESS(_dest,_src) \
+        RtlCopyMemory((_dest), (_src), ETH_LENGTH_OF_ADDRESS)
+
+#define NdisZeroMemory(_dest,_length)      RtlZeroMemory((_dest), (_length))
+
+#define KeMemoryBarrier()                  MemoryBarrier()
+
+
+typedef struct _NDIS_SPIN_LOCK
+{
+    volatile LONG           Locked;
+} NDIS_SPIN_LOCK, *PNDIS_SPIN_LOCK;
+
+FORCEINLINE
+VOID
+NdisAllocateSpinLock(
+    _Out_ PNDIS_SPIN_LOCK  SpinLock)
+{
+    SpinLock->Locked = 0;
+}
+
+FORCEINLINE
+VOID
+NdisFreeSpinLock(
+    _In_  PNDIS_SPIN_LOCK  SpinLock)
+{
+    UNREFERENCED_PARAMETER(SpinLock);
+}
+
+FORCEINLINE
+VOID
+NdisDprAcquireSpinLock(
+    _Inout_ PNDIS_SPIN_LOCK  SpinLock)
+{
+    while (InterlockedExchange(&SpinLock->Locked, 1) != 0)
+    {
+        while (SpinLock->Locked != 0)
+        {
+            YieldProcessor();
+        }
+    }
+}
+
+FORCEINLINE
+VOID
+NdisDprReleaseSpinLock(
+    _Inout_ PNDIS_SPIN_LOCK  SpinLock)
+{
+    InterlockedExchange(&SpinLock->Locked, 0);
+}
+
+FORCEINLINE
+ULONG64
+KeQueryInterruptTime(
+    VOID)
+{
+    return GetTickCount64() * 10000;
+}
+
+
+#endif // _FWDBENCH_NDIS_H
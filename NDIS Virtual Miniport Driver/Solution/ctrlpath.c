@@ -1042,6 +1042,21 @@ Return Value:
         // Change the filtering modes on hardware
         //
 
+        //
+        // A promiscuous adapter must see every frame, which turns off
+        // directed forwarding for all adapters.
+        //
+        if ((PacketFilter ^ Adapter->PacketFilter) & NDIS_PACKET_TYPE_PROMISCUOUS)
+        {
+            if (PacketFilter & NDIS_PACKET_TYPE_PROMISCUOUS)
+            {
+                InterlockedIncrement(&GlobalData.PromiscuousAdapterCount);
+            }
+            else
+            {
+                InterlockedDecrement(&GlobalData.PromiscuousAdapterCount);
+            }
+        }
 
         // Save the new packet filter value
         Adapter->PacketFilter = PacketFilter;
@@ -25,6 +25,10 @@ Abstract:
     sent on B would be received on C, & A; and frames sent on C
     would be received on A & B.
 
+    Like a learning switch, the driver remembers which instance sent
+    from each MAC address (per VLAN).  Once B has sent a frame, unicast
+    frames from A to B's address are queued only on B.
+
     This sample miniport goes to some extra lengths so that the data path's
     design resembles the design of a real hardware miniport's data path.  For
     example, this sample has both send and receive queues, even though all the
@@ -959,6 +963,12 @@ Routine Description:
     This routine sends a TCB to each netvmini 6.x adapter (besides the sending
     adapter itself)
 
+    The source address of the frame is learned in the forwarding table.  If
+    the destination is a known unicast address, the frame is only queued on
+    the adapter that owns it.  Broadcast, multicast and unknown unicast frames
+    are still queued on every adapter, as are all frames while any adapter is
+    promiscuous.
+
     Runs at IRQL <= DISPATCH_LEVEL
 
 Arguments:
@@ -976,6 +986,9 @@ Return Value:
 {
     MP_LOCK_STATE  LockState;
     PLIST_ENTRY AdapterLink;
+    PNIC_FRAME_HEADER Header = (PNIC_FRAME_HEADER)Frame->Data;
+    USHORT VlanId = (USHORT)Nbl1QInfo->TagHeader.VlanId;
+    PMP_ADAPTER OwnerAdapter = NULL;
 
 
     DEBUGP(MP_TRACE, "[%p] ---> RXDeliverFrameToEveryAdapter. Frame=0x%p\n", SendAdapter, Frame);
@@ -984,27 +997,60 @@ Return Value:
     UNREFERENCED_PARAMETER(fAtDispatch);
 
     //
-    // Go through the adapter list and queue packet for
-    // indication on them if there are any. Otherwise
-    // just drop the packet on the floor and tell NDIS that
-    // you have completed send.
+    // An adapter that is already detached must not be put back into the
+    // forwarding table.
     //
+    if (SendAdapter->Attached)
+    {
+        NICLearnSourceAddress(&GlobalData.ForwardingTable, SendAdapter, Header->SrcAddress, VlanId);
+    }
 
-    for (
-        AdapterLink = GlobalData.AdapterList.Flink;
-        AdapterLink != &GlobalData.AdapterList;
-        AdapterLink = AdapterLink->Flink
-        )
+    if (!NIC_ADDR_IS_MULTICAST(Header->DestAddress)
+            && GlobalData.PromiscuousAdapterCount == 0)
     {
-        PMP_ADAPTER DestAdapter = CONTAINING_RECORD(AdapterLink, MP_ADAPTER, List);
+        OwnerAdapter = NICLookupDestinationAddress(&GlobalData.ForwardingTable, Header->DestAddress, VlanId);
+    }
 
-        if (DestAdapter == SendAdapter)
+    if (OwnerAdapter == SendAdapter)
+    {
+        //
+        // The destination is on the sending adapter itself, and we don't
+        // loopback packets to the sending adapter.
+        //
+        InterlockedIncrement64(&GlobalData.ForwardingTable.Stats.FramesFiltered);
+    }
+    else if (OwnerAdapter != NULL)
+    {
+        RXQueueFrameOnAdapter(OwnerAdapter, Nbl1QInfo, Frame);
+        InterlockedIncrement64(&GlobalData.ForwardingTable.Stats.FramesForwarded);
+    }
+    else
+    {
+        //
+        // Go through the adapter list and queue packet for
+        // indication on them if there are any. Otherwise
+        // just drop the packet on the floor and tell NDIS that
+        // you have completed send.
+        //
+
+        for (
+            AdapterLink = GlobalData.AdapterList.Flink;
+            AdapterLink != &GlobalData.AdapterList;
+            AdapterLink = AdapterLink->Flink
+            )
         {
-            // Don't loopback packets to the sending adapter.
-            continue;
+            PMP_ADAPTER DestAdapter = CONTAINING_RECORD(AdapterLink, MP_ADAPTER, List);
+
+            if (DestAdapter == SendAdapter)
+            {
+                // Don't loopback packets to the sending adapter.
+                continue;
+            }
+
+            RXQueueFrameOnAdapter(DestAdapter, Nbl1QInfo, Frame);
         }
 
-        RXQueueFrameOnAdapter(DestAdapter, Nbl1QInfo, Frame);
+        InterlockedIncrement64(&GlobalData.ForwardingTable.Stats.FramesFlooded);
     }
 
     UNLOCK_ADAPTER_LIST(&LockState);
@@ -0,0 +1,379 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+    Forward.C
+
+Abstract:
+
+    This module implements the MAC learning forwarding table that lets the
+    data path deliver a known unicast frame to one adapter instead of all
+    of them.  See RXDeliverFrameToEveryAdapter.
+
+    The table only needs ndis.h and the hardware constants, so that the
+    fwdbench tool can build this file in user mode and measure it.
+
+--*/
+
+#include <ndis.h>
+#include "hardware.h"
+#include "forward.h"
+
+
+VOID
+NICInitializeForwardingTable(
+    _Out_ PMP_FORWARDING_TABLE  Table)
+/*++
+
+Routine Description:
+
+    This routine sets up an empty forwarding table.
+
+    Runs at IRQL == PASSIVE_LEVEL.
+
+Arguments:
+
+    Table                       The forwarding table
+
+Return Value:
+
+    None.
+
+--*/
+{
+    NdisZeroMemory(Table, sizeof(*Table));
+    NdisAllocateSpinLock(&Table->Lock);
+}
+
+
+VOID
+NICFreeForwardingTable(
+    _Inout_ PMP_FORWARDING_TABLE  Table)
+/*++
+
+Routine Description:
+
+    This routine frees the resources of a forwarding table.  No adapter may
+    be using it.
+
+    Runs at IRQL == PASSIVE_LEVEL.
+
+Arguments:
+
+    Table                       The forwarding table
+
+Return Value:
+
+    None.
+
+--*/
+{
+    NdisFreeSpinLock(&Table->Lock);
+}
+
+
+static
+ULONG
+NICForwardingHash(
+    _In_reads_bytes_(NIC_MACADDR_SIZE) PUCHAR  Address,
+    _In_  USHORT  VlanId)
+{
+    ULONG Hash = VlanId;
+    ULONG i;
+
+    for (i = 0; i < NIC_MACADDR_SIZE; i++)
+    {
+        Hash = (Hash * 31) + Address[i];
+    }
+
+    return Hash & (NIC_FORWARDING_TABLE_SIZE - 1);
+}
+
+
+//
+// Every change to a forwarding entry is bracketed by these, with the table
+// lock held.  The interlocked increments are full barriers,
+// so a lookup that sees the same even sequence before and after reading an
+// entry has read all of it from one version.
+//
+#define NIC_FORWARDING_ENTRY_BEGIN_CHANGE(_Entry) \
+        InterlockedIncrement(&(_Entry)->Sequence)
+
+#define NIC_FORWARDING_ENTRY_END_CHANGE(_Entry) \
+        InterlockedIncrement(&(_Entry)->Sequence)
+
+
+static
+BOOLEAN
+NICFindForwardingEntry(
+    _In_  PMP_FORWARDING_TABLE  Table,
+    _In_reads_bytes_(NIC_MACADDR_SIZE) PUCHAR  Address,
+    _In_  USHORT       VlanId,
+    _Out_ struct _MP_ADAPTER **Adapter,
+    _Out_ PULONG64     LastSeen)
+/*++
+
+Routine Description:
+
+    This routine finds the entry for Address on VlanId without taking the
+    table lock.  Each entry is read between two reads of its sequence, and
+    read again if it was being changed.
+
+Arguments:
+
+    Table                       The forwarding table
+    Address                     MAC address to find
+    VlanId                      VLAN ID to find it on
+    Adapter                     Receives the adapter that owns the address
+    LastSeen                    Receives when the address was last seen
+
+Return Value:
+
+    TRUE if the address has an entry, FALSE otherwise.
+
+--*/
+{
+    PMP_FORWARDING_ENTRY Entry;
+    ULONG Bucket;
+    ULONG Probe;
+    LONG Sequence;
+    BOOLEAN Match;
+
+    Bucket = NICForwardingHash(Address, VlanId);
+
+    for (Probe = 0; Probe < NIC_FORWARDING_TABLE_MAX_PROBE; Probe++)
+    {
+        Entry = &Table->Entries[(Bucket + Probe) & (NIC_FORWARDING_TABLE_SIZE - 1)];
+
+        for (;;)
+        {
+            Sequence = Entry->Sequence;
+            if (Sequence & 1)
+            {
+                YieldProcessor();
+                continue;
+            }
+
+            KeMemoryBarrier();
+
+            *Adapter = Entry->Adapter;
+            *LastSeen = Entry->LastSeen;
+            Match = (BOOLEAN)(*Adapter != NULL
+                    && Entry->VlanId == VlanId
+                    && NIC_ADDR_EQUAL(Entry->MacAddress, Address));
+
+            KeMemoryBarrier();
+
+            if (Entry->Sequence == Sequence)
+            {
+                break;
+            }
+        }
+
+        if (Match)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+
+VOID
+NICLearnSourceAddress(
+    _In_  PMP_FORWARDING_TABLE  Table,
+    _In_  struct _MP_ADAPTER   *SendAdapter,
+    _In_reads_bytes_(NIC_MACADDR_SIZE) PUCHAR  SourceAddress,
+    _In_  USHORT       VlanId)
+/*++
+
+Routine Description:
+
+    This routine records that SourceAddress on VlanId is owned by the sending
+    adapter.  An existing entry for the address is refreshed (or moved to the
+    new owner); otherwise an unused or aged entry is claimed.  If all the
+    probed entries are live, the least recently seen one is replaced.
+
+    The caller must not learn addresses for an adapter that is detached.
+
+    Runs at IRQL == DISPATCH_LEVEL, with the adapter list locked for read.
+
+Arguments:
+
+    Table                       The forwarding table
+    SendAdapter                 Our adapter that is doing the sending
+    SourceAddress               Source MAC address of the sent frame
+    VlanId                      VLAN ID of the sent frame, 0 if untagged
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PMP_FORWARDING_ENTRY Entry;
+    PMP_FORWARDING_ENTRY Candidate = NULL;
+    struct _MP_ADAPTER *Owner;
+    ULONG64 LastSeen;
+    ULONG64 Now;
+    ULONG Bucket;
+    ULONG Probe;
+
+    if (NIC_ADDR_IS_MULTICAST(SourceAddress))
+    {
+        //
+        // Group addresses are never owned by an adapter.
+        //
+        return;
+    }
+
+    Now = KeQueryInterruptTime();
+    Bucket = NICForwardingHash(SourceAddress, VlanId);
+
+    //
+    // Most frames come from an address that was learned moments ago.  Skip
+    // the lock for those.
+    //
+    if (NICFindForwardingEntry(Table, SourceAddress, VlanId, &Owner, &LastSeen)
+            && Owner == SendAdapter
+            && Now - LastSeen < NIC_FORWARDING_ENTRY_REFRESH)
+    {
+        return;
+    }
+
+    NdisDprAcquireSpinLock(&Table->Lock);
+
+    for (Probe = 0; Probe < NIC_FORWARDING_TABLE_MAX_PROBE; Probe++)
+    {
+        Entry = &Table->Entries[(Bucket + Probe) & (NIC_FORWARDING_TABLE_SIZE - 1)];
+
+        if (Entry->Adapter != NULL
+                && Entry->VlanId == VlanId
+                && NIC_ADDR_EQUAL(Entry->MacAddress, SourceAddress))
+        {
+            NIC_FORWARDING_ENTRY_BEGIN_CHANGE(Entry);
+            Entry->Adapter = SendAdapter;
+            Entry->LastSeen = Now;
+            NIC_FORWARDING_ENTRY_END_CHANGE(Entry);
+            break;
+        }
+
+        if (Candidate == NULL
+                || (Candidate->Adapter != NULL
+                    && (Entry->Adapter == NULL || Entry->LastSeen < Candidate->LastSeen)))
+        {
+            Candidate = Entry;
+        }
+    }
+
+    if (Probe == NIC_FORWARDING_TABLE_MAX_PROBE)
+    {
+        if (Candidate->Adapter != NULL)
+        {
+            Table->Stats.AddressesAged++;
+        }
+
+        NIC_FORWARDING_ENTRY_BEGIN_CHANGE(Candidate);
+        Candidate->Adapter = SendAdapter;
+        Candidate->LastSeen = Now;
+        Candidate->VlanId = VlanId;
+        NIC_COPY_ADDRESS(Candidate->MacAddress, SourceAddress);
+        NIC_FORWARDING_ENTRY_END_CHANGE(Candidate);
+
+        Table->Stats.AddressesLearned++;
+    }
+
+    NdisDprReleaseSpinLock(&Table->Lock);
+}
+
+
+struct _MP_ADAPTER *
+NICLookupDestinationAddress(
+    _In_  PMP_FORWARDING_TABLE  Table,
+    _In_reads_bytes_(NIC_MACADDR_SIZE) PUCHAR  DestAddress,
+    _In_  USHORT       VlanId)
+/*++
+
+Routine Description:
+
+    This routine finds the adapter that owns a unicast DestAddress on VlanId.
+
+    Every unicast send looks up its destination, so this doesn't take the
+    table lock.  The adapter list read lock keeps any adapter found here
+    attached until the frame is queued.
+
+    Runs at IRQL == DISPATCH_LEVEL, with the adapter list locked for read.
+
+Arguments:
+
+    Table                       The forwarding table
+    DestAddress                 Destination MAC address of the frame
+    VlanId                      VLAN ID of the frame, 0 if untagged
+
+Return Value:
+
+    The owning adapter, or NULL if the address is unknown or its entry has
+    aged out.
+
+--*/
+{
+    struct _MP_ADAPTER *Owner;
+    ULONG64 LastSeen;
+
+    if (NICFindForwardingEntry(Table, DestAddress, VlanId, &Owner, &LastSeen)
+            && KeQueryInterruptTime() - LastSeen < NIC_FORWARDING_ENTRY_AGE)
+    {
+        return Owner;
+    }
+
+    return NULL;
+}
+
+
+VOID
+NICForgetAdapterAddresses(
+    _In_  PMP_FORWARDING_TABLE  Table,
+    _In_  struct _MP_ADAPTER   *Adapter)
+/*++
+
+Routine Description:
+
+    This routine removes every forwarding table entry owned by an adapter.
+
+    Runs at IRQL == DISPATCH_LEVEL, with the adapter list locked for write.
+
+Arguments:
+
+    Table                       The forwarding table
+    Adapter                     Pointer to our adapter
+
+Return Value:
+
+    None.
+
+--*/
+{
+    ULONG i;
+
+    NdisDprAcquireSpinLock(&Table->Lock);
+
+    for (i = 0; i < NIC_FORWARDING_TABLE_SIZE; i++)
+    {
+        if (Table->Entries[i].Adapter == Adapter)
+        {
+            NIC_FORWARDING_ENTRY_BEGIN_CHANGE(&Table->Entries[i]);
+            Table->Entries[i].Adapter = NULL;
+            NIC_FORWARDING_ENTRY_END_CHANGE(&Table->Entries[i]);
+        }
+    }
+
+    NdisDprReleaseSpinLock(&Table->Lock);
+}
@@ -0,0 +1,115 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+    THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+    KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A PARTICULAR
+    PURPOSE.
+
+Module Name:
+
+   Forward.H
+
+Abstract:
+
+    This module declares the MAC learning forwarding table, and the functions
+    to manipulate it.
+
+    See the comments in Forward.c.
+
+--*/
+
+
+#ifndef _FORWARD_H
+#define _FORWARD_H
+
+
+//
+// The forwarding table maps a MAC address and VLAN ID to the adapter that
+// sent a frame from that address, so that known unicast frames are delivered
+// only to that adapter instead of every adapter.  Entries that are not
+// refreshed within NIC_FORWARDING_ENTRY_AGE are treated as unused.
+//
+#define NIC_FORWARDING_TABLE_SIZE          256     // must be a power of 2
+#define NIC_FORWARDING_TABLE_MAX_PROBE     8
+#define NIC_FORWARDING_ENTRY_AGE           (300ULL * 10000000ULL)  // 5 minutes, in 100ns units
+#define NIC_FORWARDING_ENTRY_REFRESH       (1ULL * 10000000ULL)    // 1 second, in 100ns units
+
+
+struct _MP_ADAPTER;
+
+typedef struct _MP_FORWARDING_ENTRY
+{
+    // Odd while the entry is being changed.  Changes are made holding the
+    // table's Lock; lookups don't take it, they read the entry again if the
+    // sequence moved while they were looking.
+    volatile LONG           Sequence;
+
+    // Adapter that owns the address, or NULL if the entry is unused
+    struct _MP_ADAPTER     *Adapter;
+
+    // KeQueryInterruptTime of the last frame sent from the address
+    ULONG64                 LastSeen;
+
+    USHORT                  VlanId;
+    UCHAR                   MacAddress[NIC_MACADDR_SIZE];
+} MP_FORWARDING_ENTRY, *PMP_FORWARDING_ENTRY;
+
+typedef struct _MP_FORWARDING_STATS
+{
+    // Unicast frames delivered only to the adapter owning the destination
+    volatile LONG64         FramesForwarded;
+
+    // Frames delivered to every adapter (broadcast, multicast, unknown unicast)
+    volatile LONG64         FramesFlooded;
+
+    // Unicast frames whose destination is owned by the sending adapter
+    volatile LONG64         FramesFiltered;
+
+    volatile LONG64         AddressesLearned;
+
+    // Entries taken over by a new address, because they aged out or were
+    // the least recently seen in a full probe range
+    volatile LONG64         AddressesAged;
+} MP_FORWARDING_STATS, *PMP_FORWARDING_STATS;
+
+typedef struct _MP_FORWARDING_TABLE
+{
+    // Serializes changes to the entries.  Lookups don't take it.
+    NDIS_SPIN_LOCK          Lock;
+
+    MP_FORWARDING_ENTRY     Entries[NIC_FORWARDING_TABLE_SIZE];
+
+    MP_FORWARDING_STATS     Stats;
+} MP_FORWARDING_TABLE, *PMP_FORWARDING_TABLE;
+
+
+VOID
+NICInitializeForwardingTable(
+    _Out_ PMP_FORWARDING_TABLE  Table);
+
+VOID
+NICFreeForwardingTable(
+    _Inout_ PMP_FORWARDING_TABLE  Table);
+
+VOID
+NICLearnSourceAddress(
+    _In_  PMP_FORWARDING_TABLE  Table,
+    _In_  struct _MP_ADAPTER   *SendAdapter,
+    _In_reads_bytes_(NIC_MACADDR_SIZE) PUCHAR  SourceAddress,
+    _In_  USHORT       VlanId);
+
+struct _MP_ADAPTER *
+NICLookupDestinationAddress(
+    _In_  PMP_FORWARDING_TABLE  Table,
+    _In_reads_bytes_(NIC_MACADDR_SIZE) PUCHAR  DestAddress,
+    _In_  USHORT       VlanId);
+
+VOID
+NICForgetAdapterAddresses(
+    _In_  PMP_FORWARDING_TABLE  Table,
+    _In_  struct _MP_ADAPTER   *Adapter);
+
+
+#endif // _FORWARD_H
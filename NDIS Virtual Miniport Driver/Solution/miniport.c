@@ -100,6 +100,11 @@ Arguments:
         //
         NdisInitializeListHead(&GlobalData.AdapterList);
 
+        //
+        // The MAC learning forwarding table starts out empty.
+        //
+        NICInitializeForwardingTable(&GlobalData.ForwardingTable);
+
 
         //
         // The FrameDataLookaside list is used to help emulate an Ethernet hub.
@@ -266,6 +271,15 @@ Return Value:
         FreeAdapterListLock();
     }
 
+    DEBUGP(MP_TRACE, "Forwarding: %I64u forwarded, %I64u flooded, %I64u filtered, %I64u learned, %I64u aged\n",
+            GlobalData.ForwardingTable.Stats.FramesForwarded,
+            GlobalData.ForwardingTable.Stats.FramesFlooded,
+            GlobalData.ForwardingTable.Stats.FramesFiltered,
+            GlobalData.ForwardingTable.Stats.AddressesLearned,
+            GlobalData.ForwardingTable.Stats.AddressesAged);
+
+    NICFreeForwardingTable(&GlobalData.ForwardingTable);
+
     WPP_CLEANUP(DriverObject->DeviceObject);
 
     DEBUGP(MP_TRACE, "<--- DriverUnload\n");
@@ -345,6 +359,7 @@ MPAttachAdapter(
     if(!MPIsAdapterAttached(Adapter))
     {
         InsertTailList(&GlobalData.AdapterList, &Adapter->List);
+        Adapter->Attached = TRUE;
     }
 
     UNLOCK_ADAPTER_LIST(&LockState);
@@ -364,6 +379,14 @@ MPDetachAdapter(
     if(MPIsAdapterAttached(Adapter))
     {
         RemoveEntryList(&Adapter->List);
+        Adapter->Attached = FALSE;
+
+        //
+        // Frames are forwarded while holding the adapter list lock for read,
+        // so once the forwarding table entries are gone no sender can find
+        // this adapter again.
+        //
+        NICForgetAdapterAddresses(&GlobalData.ForwardingTable, Adapter);
     }
 
     UNLOCK_ADAPTER_LIST(&LockState);
@@ -209,6 +209,16 @@ typedef struct _MP_GLOBAL
 
     NPAGED_LOOKASIDE_LIST   FrameDataLookaside;
 
+    //
+    // MAC learning forwarding table.  Entries only reference adapters that
+    // are on the AdapterList; see MPDetachAdapter.
+    //
+    MP_FORWARDING_TABLE     ForwardingTable;
+
+    // Number of adapters with NDIS_PACKET_TYPE_PROMISCUOUS set.  While any
+    // adapter is promiscuous, all frames are flooded.
+    volatile LONG           PromiscuousAdapterCount;
+
 #define fGLOBAL_LOCK_ALLOCATED        0x0001
 #define fGLOBAL_LOOKASIDE_INITIALIZED 0x0002
 #define fGLOBAL_MINIPORT_REGISTERED   0x0004
@@ -30,6 +30,7 @@ _Analysis_mode_(_Analysis_code_type_kernel_driver_);
 
 #include "trace.h"
 #include "hardware.h"
+#include "forward.h"
 #include "miniport.h"
 #include "vmq.h"
 #include "qos.h"
@@ -0,0 +1,599 @@
+/*++
+
+Copyright (c) Microsoft Corporation, All Rights Reserved
+
+Module Name:
+
+    ramdiskbench.c
+
+Abstract:
+
+    Random read/write benchmark for the Ramdisk driver.  It runs the same
+    random workload with an increasing number of threads and reports the
+    IOPS reached at each thread count, so that the scaling of the parallel
+    queue and the striped page locks (see store.c) can be measured.
+
+    The volume on the ramdisk is locked and dismounted for the run, so the
+    requests go straight to the driver instead of through the file system.
+    All threads share one unbuffered, overlapped handle; each thread keeps
+    one request outstanding.  A synchronous handle would have the I/O
+    manager serialize the requests on the file object.
+
+    Writes overwrite the disk, so they are only issued when asked for with
+    -w.  The disk is then filled first so that reads copy committed pages
+    rather than returning zeroes for pages that were never written.
+
+Environment:
+
+    User mode only.
+
+--*/
+
+#include <windows.h>
+#include <winioctl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+//
+// These match ramdisk.h
+//
+
+#define IOCTL_RAMDISK_QUERY_STATISTICS  CTL_CODE(FILE_DEVICE_DISK, 0x800, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+typedef struct _RAMDISK_STATISTICS {
+    ULONGLONG   DiskLength;         // Size of the disk in bytes
+    ULONGLONG   CommittedBytes;     // Bytes of data pages allocated
+    ULONGLONG   IndexBytes;         // Bytes of radix tree nodes allocated
+} RAMDISK_STATISTICS, *PRAMDISK_STATISTICS;
+
+#define BENCH_MAX_THREADS               MAXIMUM_WAIT_OBJECTS
+#define BENCH_DEFAULT_BLOCK_SIZE        4096
+#define BENCH_DEFAULT_SECONDS           5
+#define BENCH_DEFAULT_DRIVE             "R:"
+
+typedef struct _BENCH_THREAD {
+    HANDLE      Thread;
+    ULONG64     Seed;
+    PUCHAR      Buffer;
+    ULONGLONG   Ios;
+    ULONGLONG   Writes;
+    ULONGLONG   LatencyTicks;       // Sum of the request latencies
+    ULONGLONG   MaxLatencyTicks;
+    DWORD       Error;
+} BENCH_THREAD, *PBENCH_THREAD;
+
+HANDLE          BenchDisk;
+ULONGLONG       BenchBlocks;
+ULONG           BenchBlockSize = BENCH_DEFAULT_BLOCK_SIZE;
+ULONG           BenchWritePercent;
+HANDLE          BenchStartEvent;
+volatile LONG   BenchStop;
+BENCH_THREAD    BenchThreads[BENCH_MAX_THREADS];
+
+
+VOID
+Usage(
+    VOID
+    )
+{
+    printf("Usage: ramdiskbench [-d drive] [-t threads,...] [-s seconds] [-b block size] [-w write percent]\n");
+    printf("    -d  Ramdisk drive letter (default %s)\n", BENCH_DEFAULT_DRIVE);
+    printf("    -t  Thread counts to run, e.g. 1,2,4,8 (default 1, 2, 4... up to twice the processors)\n");
+    printf("    -s  Seconds to run each thread count (default %d)\n", BENCH_DEFAULT_SECONDS);
+    printf("    -b  Bytes per request, a multiple of 512 (default %d)\n", BENCH_DEFAULT_BLOCK_SIZE);
+    printf("    -w  Percentage of requests that are writes (default 0).\n");
+    printf("        Anything but 0 overwrites the disk, including its file system.\n");
+}
+
+ULONG64
+BenchRandom(
+    IN OUT PULONG64 Seed
+    )
+
+/*++
+
+Routine Description:
+
+    xorshift64, good enough to pick blocks and far cheaper than the
+    requests it is picking for.
+
+--*/
+
+{
+    ULONG64 x = *Seed;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *Seed = x;
+
+    return x;
+}
+
+BOOL
+BenchDeviceIoControl(
+    IN DWORD IoControlCode,
+    OUT PVOID OutputBuffer,
+    IN DWORD OutputBufferLength
+    )
+
+/*++
+
+Routine Description:
+
+    Sends an IOCTL on the overlapped disk handle and waits for it.
+
+--*/
+
+{
+    OVERLAPPED overlapped = {0};
+    DWORD bytesReturned;
+    BOOL success;
+
+    overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    if (overlapped.hEvent == NULL) {
+        return FALSE;
+    }
+
+    success = DeviceIoControl(BenchDisk,
+                              IoControlCode,
+                              NULL,
+                              0,
+                              OutputBuffer,
+                              OutputBufferLength,
+                              &bytesReturned,
+                              &overlapped);
+
+    if (!success && (GetLastError() == ERROR_IO_PENDING)) {
+        success = GetOverlappedResult(BenchDisk, &overlapped, &bytesReturned, TRUE);
+    }
+
+    CloseHandle(overlapped.hEvent);
+
+    return success;
+}
+
+BOOL
+BenchTransfer(
+    IN BOOLEAN Write,
+    IN ULONGLONG Offset,
+    IN PUCHAR Buffer,
+    IN LPOVERLAPPED Overlapped
+    )
+{
+    DWORD bytes;
+    BOOL success;
+
+    Overlapped->Offset = (DWORD)Offset;
+    Overlapped->OffsetHigh = (DWORD)(Offset >> 32);
+
+    if (Write) {
+        success = WriteFile(BenchDisk, Buffer, BenchBlockSize, NULL, Overlapped);
+    } else {
+        success = ReadFile(BenchDisk, Buffer, BenchBlockSize, NULL, Overlapped);
+    }
+
+    if (!success && (GetLastError() == ERROR_IO_PENDING)) {
+        success = GetOverlappedResult(BenchDisk, Overlapped, &bytes, TRUE);
+    }
+
+    return success;
+}
+
+DWORD
+WINAPI
+BenchThreadRoutine(
+    IN LPVOID Context
+    )
+
+/*++
+
+Routine Description:
+
+    Issues random requests, one at a time, from the start event until
+    BenchStop is set.
+
+--*/
+
+{
+    PBENCH_THREAD benchThread = Context;
+    OVERLAPPED overlapped = {0};
+    LARGE_INTEGER issue;
+    LARGE_INTEGER complete;
+    ULONGLONG latency;
+    BOOLEAN write;
+
+    overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    if (overlapped.hEvent == NULL) {
+        benchThread->Error = GetLastError();
+        return 0;
+    }
+
+    WaitForSingleObject(BenchStartEvent, INFINITE);
+
+    while (!BenchStop) {
+
+        write = (BOOLEAN)((BenchRandom(&benchThread->Seed) % 100) < BenchWritePercent);
+
+        QueryPerformanceCounter(&issue);
+
+        if (!BenchTransfer(write,
+                           (BenchRandom(&benchThread->Seed) % BenchBlocks) * BenchBlockSize,
+                           benchThread->Buffer,
+                           &overlapped)) {
+            benchThread->Error = GetLastError();
+            break;
+        }
+
+        QueryPerformanceCounter(&complete);
+
+        latency = complete.QuadPart - issue.QuadPart;
+        benchThread->LatencyTicks += latency;
+
+        if (latency > benchThread->MaxLatencyTicks) {
+            benchThread->MaxLatencyTicks = latency;
+        }
+
+        benchThread->Ios++;
+
+        if (write) {
+            benchThread->Writes++;
+        }
+    }
+
+    CloseHandle(overlapped.hEvent);
+
+    return 0;
+}
+
+BOOL
+BenchFill(
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    Writes every block once, so that every page of the disk is committed
+    before the timed runs.
+
+--*/
+
+{
+    OVERLAPPED overlapped = {0};
+    ULONGLONG block;
+    BOOL success = TRUE;
+
+    overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    if (overlapped.hEvent == NULL) {
+        return FALSE;
+    }
+
+    for (block = 0; success && (block < BenchBlocks); block++) {
+        success = BenchTransfer(TRUE, block * BenchBlockSize, BenchThreads[0].Buffer, &overlapped);
+    }
+
+    CloseHandle(overlapped.hEvent);
+
+    return success;
+}
+
+BOOL
+BenchRun(
+    IN ULONG ThreadCount,
+    IN ULONG Seconds,
+    IN LONGLONG Frequency,
+    IN OUT double *BaseIops
+    )
+
+/*++
+
+Routine Description:
+
+    Runs the workload with ThreadCount threads for Seconds and prints one
+    line of results.  The first run sets the IOPS the later ones are
+    scaled against.
+
+--*/
+
+{
+    HANDLE threads[BENCH_MAX_THREADS];
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    ULONGLONG ios = 0;
+    ULONGLONG writes = 0;
+    ULONGLONG latencyTicks = 0;
+    ULONGLONG maxLatencyTicks = 0;
+    ULONGLONG minThreadIos = MAXULONGLONG;
+    ULONGLONG maxThreadIos = 0;
+    double elapsed;
+    double iops;
+    ULONG i;
+    BOOL success = TRUE;
+
+    ResetEvent(BenchStartEvent);
+    BenchStop = 0;
+
+    for (i = 0; i < ThreadCount; i++) {
+        BenchThreads[i].Ios = 0;
+        BenchThreads[i].Writes = 0;
+        BenchThreads[i].LatencyTicks = 0;
+        BenchThreads[i].MaxLatencyTicks = 0;
+        BenchThreads[i].Error = ERROR_SUCCESS;
+
+        BenchThreads[i].Thread = CreateThread(NULL, 0, BenchThreadRoutine, &BenchThreads[i], 0, NULL);
+
+        if (BenchThreads[i].Thread == NULL) {
+            printf("CreateThread failed: %u\n", GetLastError());
+            ThreadCount = i;
+            success = FALSE;
+            break;
+        }
+
+        threads[i] = BenchThreads[i].Thread;
+    }
+
+    QueryPerformanceCounter(&start);
+    SetEvent(BenchStartEvent);
+
+    if (success) {
+        Sleep(Seconds * 1000);
+    }
+
+    InterlockedExchange(&BenchStop, 1);
+
+    if (ThreadCount != 0) {
+        WaitForMultipleObjects(ThreadCount, threads, TRUE, INFINITE);
+    }
+
+    QueryPerformanceCounter(&end);
+
+    for (i = 0; i < ThreadCount; i++) {
+        CloseHandle(BenchThreads[i].Thread);
+
+        if (BenchThreads[i].Error != ERROR_SUCCESS) {
+            printf("Request failed: %u\n", BenchThreads[i].Error);
+            success = FALSE;
+        }
+
+        ios += BenchThreads[i].Ios;
+        writes += BenchThreads[i].Writes;
+        latencyTicks += BenchThreads[i].LatencyTicks;
+        maxLatencyTicks = max(maxLatencyTicks, BenchThreads[i].MaxLatencyTicks);
+        minThreadIos = min(minThreadIos, BenchThreads[i].Ios);
+        maxThreadIos = max(maxThreadIos, BenchThreads[i].Ios);
+    }
+
+    if (!success || (ios == 0)) {
+        return FALSE;
+    }
+
+    elapsed = (double)(end.QuadPart - start.QuadPart) / Frequency;
+    iops = ios / elapsed;
+
+    if (*BaseIops == 0) {
+        *BaseIops = iops;
+    }
+
+    printf("%7u %12.0f %9.1f %7.2fx %9.1f %9.1f %12.0f %12.0f %6.1f%%\n",
+           ThreadCount,
+           iops,
+           iops * BenchBlockSize / (1024 * 1024),
+           iops / *BaseIops,
+           (double)latencyTicks * 1000000 / Frequency / ios,
+           (double)maxLatencyTicks * 1000000 / Frequency,
+           minThreadIos / elapsed,
+           maxThreadIos / elapsed,
+           (double)writes * 100 / ios);
+
+    return TRUE;
+}
+
+int
+__cdecl
+main(
+    IN int argc,
+    IN char *argv[]
+    )
+{
+    SYSTEM_INFO systemInfo;
+    GET_LENGTH_INFORMATION lengthInfo;
+    RAMDISK_STATISTICS statistics;
+    LARGE_INTEGER frequency;
+    ULONG threadCounts[BENCH_MAX_THREADS];
+    ULONG threadCountCount = 0;
+    ULONG maxThreads = 0;
+    ULONG seconds = BENCH_DEFAULT_SECONDS;
+    const char *drive = BENCH_DEFAULT_DRIVE;
+    const char *threadList = NULL;
+    char deviceName[16];
+    char *next;
+    double baseIops = 0;
+    ULONG count;
+    ULONG i;
+    int status = 1;
+
+    for (i = 1; i < (ULONG)argc; i++) {
+        if ((argv[i][0] != '-' && argv[i][0] != '/') || (argv[i][1] == '\0') ||
+            (argv[i][2] != '\0') || (i + 1 == (ULONG)argc)) {
+            Usage();
+            return 1;
+        }
+
+        switch (argv[i][1]) {
+        case 'd':
+            drive = argv[++i];
+            break;
+        case 't':
+            threadList = argv[++i];
+            break;
+        case 's':
+            seconds = atoi(argv[++i]);
+            break;
+        case 'b':
+            BenchBlockSize = atoi(argv[++i]);
+            break;
+        case 'w':
+            BenchWritePercent = atoi(argv[++i]);
+            break;
+        default:
+            Usage();
+            return 1;
+        }
+    }
+
+    if ((seconds == 0) || (BenchBlockSize == 0) || (BenchBlockSize % 512 != 0) || (BenchWritePercent > 100)) {
+        Usage();
+        return 1;
+    }
+
+    //
+    // Default to doubling the thread count up to twice the processors, so
+    // the run shows where scaling stops.
+    //
+
+    GetSystemInfo(&systemInfo);
+
+    if (threadList != NULL) {
+        while (*threadList != '\0' && threadCountCount < BENCH_MAX_THREADS) {
+            count = strtoul(threadList, &next, 10);
+
+            if ((next == threadList) || (count == 0) || (count > BENCH_MAX_THREADS) ||
+                ((*next != ',') && (*next != '\0'))) {
+                Usage();
+                return 1;
+            }
+
+            threadCounts[threadCountCount++] = count;
+            threadList = (*next == ',') ? (next + 1) : next;
+        }
+    } else {
+        for (count = 1; count <= min(systemInfo.dwNumberOfProcessors * 2, BENCH_MAX_THREADS); count *= 2) {
+            threadCounts[threadCountCount++] = count;
+        }
+    }
+
+    for (i = 0; i < threadCountCount; i++) {
+        maxThreads = max(maxThreads, threadCounts[i]);
+    }
+
+    sprintf_s(deviceName, sizeof(deviceName), "\\\\.\\%s", drive);
+
+    BenchDisk = CreateFileA(deviceName,
+                            GENERIC_READ | GENERIC_WRITE,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE,
+                            NULL,
+                            OPEN_EXISTING,
+                            FILE_FLAG_NO_BUFFERING | FILE_FLAG_OVERLAPPED,
+                            NULL);
+
+    if (BenchDisk == INVALID_HANDLE_VALUE) {
+        printf("Can't open %s: %u\n", deviceName, GetLastError());
+        return 1;
+    }
+
+    BenchStartEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    if (BenchStartEvent == NULL) {
+        printf("CreateEvent failed: %u\n", GetLastError());
+        goto Exit;
+    }
+
+    if (!BenchDeviceIoControl(FSCTL_LOCK_VOLUME, NULL, 0)) {
+        printf("Can't lock %s, close any files open on it: %u\n", drive, GetLastError());
+        goto Exit;
+    }
+
+    if (!BenchDeviceIoControl(FSCTL_DISMOUNT_VOLUME, NULL, 0)) {
+        printf("Can't dismount %s: %u\n", drive, GetLastError());
+        goto Exit;
+    }
+
+    if (!BenchDeviceIoControl(IOCTL_DISK_GET_LENGTH_INFO, &lengthInfo, sizeof(lengthInfo))) {
+        printf("Can't get the size of %s: %u\n", drive, GetLastError());
+        goto Exit;
+    }
+
+    BenchBlocks = lengthInfo.Length.QuadPart / BenchBlockSize;
+
+    if (BenchBlocks == 0) {
+        printf("%s is smaller than one block\n", drive);
+        goto Exit;
+    }
+
+    for (i = 0; i < maxThreads; i++) {
+        BenchThreads[i].Seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+        BenchThreads[i].Buffer = VirtualAlloc(NULL, BenchBlockSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+        if (BenchThreads[i].Buffer == NULL) {
+            printf("Out of memory\n");
+            goto Exit;
+        }
+
+        FillMemory(BenchThreads[i].Buffer, BenchBlockSize, (BYTE)(0xA5 + i));
+    }
+
+    if (BenchWritePercent != 0) {
+        printf("Filling %s\n", drive);
+
+        if (!BenchFill()) {
+            printf("Filling %s failed: %u\n", drive, GetLastError());
+            goto Exit;
+        }
+    }
+
+    if (BenchDeviceIoControl(IOCTL_RAMDISK_QUERY_STATISTICS, &statistics, sizeof(statistics))) {
+        printf("%s: %I64u KB, %I64u KB committed\n",
+               drive,
+               statistics.DiskLength / 1024,
+               statistics.CommittedBytes / 1024);
+
+        if (statistics.CommittedBytes < statistics.DiskLength / 2) {
+            printf("Most of the disk was never written and reads of it return zeroes without a copy, use -w to fill it\n");
+        }
+    }
+
+    printf("%u processors, %u byte requests, %u%% writes, %u seconds per run\n\n",
+           systemInfo.dwNumberOfProcessors,
+           BenchBlockSize,
+           BenchWritePercent,
+           seconds);
+
+    printf("%7s %12s %9s %8s %9s %9s %12s %12s %7s\n",
+           "threads", "IOPS", "MB/s", "scaling", "mean us", "max us", "min thr IOPS", "max thr IOPS", "writes");
+
+    QueryPerformanceFrequency(&frequency);
+
+    for (i = 0; i < threadCountCount; i++) {
+        if (!BenchRun(threadCounts[i], seconds, frequency.QuadPart, &baseIops)) {
+            goto Exit;
+        }
+    }
+
+    status = 0;
+
+Exit:
+
+    //
+    // Closing the handle unlocks the volume; the file system mounts it
+    // again on the next access.
+    //
+
+    for (i = 0; i < maxThreads; i++) {
+        if (BenchThreads[i].Buffer != NULL) {
+            VirtualFree(BenchThreads[i].Buffer, 0, MEM_RELEASE);
+        }
+    }
+
+    if (BenchStartEvent != NULL) {
+        CloseHandle(BenchStartEvent);
+    }
+
+    CloseHandle(BenchDisk);
+
+    return status;
+}
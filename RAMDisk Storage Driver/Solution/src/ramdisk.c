@@ -9,9 +9,10 @@ Module Name:
 Abstract:
 
     This is the Ramdisk sample driver.  This version of the driver has been
-    modified to support the driver frameworks. This driver basically creates
-    a nonpaged pool and exposes that as a storage media. User can
-    find the device in the disk manager and format the media to use
+    modified to support the driver frameworks. This driver basically backs
+    a disk with nonpaged pool and exposes that as a storage media. Memory
+    is only committed for pages that have been written (see store.c). User
+    can find the device in the disk manager and format the media to use
     as FAT or NTFS volume.
 
 Environment:
@@ -117,10 +118,10 @@ Return Value:
         Status = WdfRequestRetrieveOutputMemory(Request, &hMemory);
         if(NT_SUCCESS(Status)){
 
-            Status = WdfMemoryCopyFromBuffer(hMemory,   // Destination
-                                             0,         // Offset into the destination
-                                             devExt->DiskImage + ByteOffset.LowPart, // source
-                                             Length);
+            RamDiskStoreRead(&devExt->Store,
+                             (ULONGLONG)ByteOffset.QuadPart,
+                             (PUCHAR)WdfMemoryGetBuffer(hMemory, NULL), // Destination
+                             Length);
         }
     }
 
@@ -177,10 +178,10 @@ Return Value:
         Status = WdfRequestRetrieveInputMemory(Request, &hMemory);
         if(NT_SUCCESS(Status)){
 
-            Status = WdfMemoryCopyToBuffer(hMemory, // Source
-                                    0,              // offset in Source memory where the copy has to start
-                                    devExt->DiskImage + ByteOffset.LowPart, // destination
-                                    Length);
+            Status = RamDiskStoreWrite(&devExt->Store,
+                                       (ULONGLONG)ByteOffset.QuadPart,
+                                       (PUCHAR)WdfMemoryGetBuffer(hMemory, NULL), // Source
+                                       Length);
         }
 
     }
@@ -236,21 +237,19 @@ Return Value:
     case IOCTL_DISK_GET_PARTITION_INFO: {
 
             PPARTITION_INFORMATION outputBuffer;
-            PBOOT_SECTOR bootSector = (PBOOT_SECTOR) devExt->DiskImage;
 
             information = sizeof(PARTITION_INFORMATION);
 
             Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(PARTITION_INFORMATION), &outputBuffer, &bufSize);
             if(NT_SUCCESS(Status) ) {
 
-                outputBuffer->PartitionType =
-                    (bootSector->bsFileSystemType[4] == '6') ? PARTITION_FAT_16 : PARTITION_FAT_12;
+                outputBuffer->PartitionType = devExt->PartitionType;
 
                 outputBuffer->BootIndicator       = FALSE;
                 outputBuffer->RecognizedPartition = TRUE;
                 outputBuffer->RewritePartition    = FALSE;
                 outputBuffer->StartingOffset.QuadPart = 0;
-                outputBuffer->PartitionLength.QuadPart = devExt->DiskRegInfo.DiskSize;
+                outputBuffer->PartitionLength.QuadPart = devExt->DiskLength;
                 outputBuffer->HiddenSectors       = (ULONG) (1L);
                 outputBuffer->PartitionNumber     = (ULONG) (-1L);
 
@@ -278,6 +277,150 @@ Return Value:
         }
         break;
 
+    case IOCTL_DISK_GET_LENGTH_INFO:  {
+
+            PGET_LENGTH_INFORMATION outputBuffer;
+
+            information = sizeof(GET_LENGTH_INFORMATION);
+
+            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(GET_LENGTH_INFORMATION), &outputBuffer, &bufSize);
+            if(NT_SUCCESS(Status) ) {
+
+                outputBuffer->Length.QuadPart = devExt->DiskLength;
+                Status = STATUS_SUCCESS;
+            }
+        }
+        break;
+
+    case IOCTL_RAMDISK_QUERY_STATISTICS:  {
+
+            PRAMDISK_STATISTICS outputBuffer;
+
+            //
+            // Report how much of the disk is actually backed by memory.
+            //
+            information = sizeof(RAMDISK_STATISTICS);
+
+            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(RAMDISK_STATISTICS), &outputBuffer, &bufSize);
+            if(NT_SUCCESS(Status) ) {
+
+                outputBuffer->DiskLength     = devExt->DiskLength;
+                outputBuffer->CommittedBytes = (ULONGLONG)devExt->Store.CommittedPages * PAGE_SIZE;
+                outputBuffer->IndexBytes     = (ULONGLONG)devExt->Store.IndexBytes;
+                Status = STATUS_SUCCESS;
+            }
+        }
+        break;
+
+    case IOCTL_STORAGE_QUERY_PROPERTY:  {
+
+            PSTORAGE_PROPERTY_QUERY query;
+            PDEVICE_TRIM_DESCRIPTOR trimDescriptor;
+
+            //
+            // The only property we answer is the trim descriptor, so that
+            // file systems know to send us trims for the blocks they free.
+            //
+            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(STORAGE_PROPERTY_QUERY), &query, &bufSize);
+            if (!NT_SUCCESS(Status)) {
+                break;
+            }
+
+            if (query->PropertyId != StorageDeviceTrimProperty) {
+                Status = STATUS_INVALID_DEVICE_REQUEST;
+                break;
+            }
+
+            if (query->QueryType == PropertyExistsQuery) {
+                Status = STATUS_SUCCESS;
+                break;
+            }
+
+            if (query->QueryType != PropertyStandardQuery) {
+                Status = STATUS_INVALID_PARAMETER;
+                break;
+            }
+
+            Status = WdfRequestRetrieveOutputBuffer(Request, sizeof(STORAGE_DESCRIPTOR_HEADER), &trimDescriptor, &bufSize);
+            if(NT_SUCCESS(Status) ) {
+
+                trimDescriptor->Version = sizeof(DEVICE_TRIM_DESCRIPTOR);
+                trimDescriptor->Size    = sizeof(DEVICE_TRIM_DESCRIPTOR);
+                information = sizeof(STORAGE_DESCRIPTOR_HEADER);
+
+                if (bufSize >= sizeof(DEVICE_TRIM_DESCRIPTOR)) {
+                    trimDescriptor->TrimEnabled = TRUE;
+                    information = sizeof(DEVICE_TRIM_DESCRIPTOR);
+                }
+            }
+        }
+        break;
+
+    case IOCTL_STORAGE_MANAGE_DATA_SET_ATTRIBUTES:  {
+
+            PDEVICE_MANAGE_DATA_SET_ATTRIBUTES dsmAttributes;
+            PDEVICE_DATA_SET_RANGE             ranges;
+            ULONG                              rangeCount;
+            ULONG                              i;
+
+            Status = WdfRequestRetrieveInputBuffer(Request, sizeof(DEVICE_MANAGE_DATA_SET_ATTRIBUTES), &dsmAttributes, &bufSize);
+            if (!NT_SUCCESS(Status)) {
+                break;
+            }
+
+            if (dsmAttributes->Action != DeviceDsmAction_Trim) {
+                Status = STATUS_INVALID_DEVICE_REQUEST;
+                break;
+            }
+
+            //
+            // Trim the whole disk if asked to, otherwise each range given.
+            //
+            if (dsmAttributes->Flags & DEVICE_DSM_FLAG_ENTIRE_DATA_SET_RANGE) {
+
+                RamDiskStoreTrim(&devExt->Store, 0, devExt->DiskLength);
+                Status = STATUS_SUCCESS;
+                break;
+            }
+
+            if ((dsmAttributes->DataSetRangesOffset > bufSize) ||
+                (dsmAttributes->DataSetRangesLength > bufSize - dsmAttributes->DataSetRangesOffset) ||
+                (dsmAttributes->DataSetRangesOffset & (TYPE_ALIGNMENT(DEVICE_DATA_SET_RANGE) - 1))) {
+
+                Status = STATUS_INVALID_PARAMETER;
+                break;
+            }
+
+            ranges = (PDEVICE_DATA_SET_RANGE)((PUCHAR)dsmAttributes + dsmAttributes->DataSetRangesOffset);
+            rangeCount = dsmAttributes->DataSetRangesLength / sizeof(DEVICE_DATA_SET_RANGE);
+
+            //
+            // Validate every range before discarding anything.
+            //
+            for (i = 0; i < rangeCount; i++) {
+
+                if ((ranges[i].StartingOffset < 0) ||
+                    (ranges[i].LengthInBytes > devExt->DiskLength) ||
+                    ((ULONGLONG)ranges[i].StartingOffset > devExt->DiskLength - ranges[i].LengthInBytes)) {
+
+                    Status = STATUS_INVALID_PARAMETER;
+                    break;
+                }
+            }
+
+            if (!NT_SUCCESS(Status)) {
+                break;
+            }
+
+            for (i = 0; i < rangeCount; i++) {
+
+                RamDiskStoreTrim(&devExt->Store,
+                                 (ULONGLONG)ranges[i].StartingOffset,
+                                 ranges[i].LengthInBytes);
+            }
+        }
+        break;
+
     case IOCTL_DISK_CHECK_VERIFY:
     case IOCTL_DISK_IS_WRITABLE:
 
@@ -304,9 +447,7 @@ Routine Description:
    EvtDeviceAdd, except those things that are automatically cleaned
    up by the Framework.
 
-   In the case of this sample, everything is automatically handled.  In a
-   driver derived from this sample, it's quite likely that this function could
-   be deleted.
+   Here we release the pages and nodes of the backing store.
 
 Arguments:
 
@@ -322,9 +463,7 @@ Return Value:
 
     PAGED_CODE();
 
-    if(pDeviceExtension->DiskImage) {
-        ExFreePool(pDeviceExtension->DiskImage);
-    }
+    RamDiskStoreCleanup(&pDeviceExtension->Store);
 }
 
 NTSTATUS
@@ -404,9 +543,13 @@ Return Value:
     // configure-fowarded using WdfDeviceConfigureRequestDispatching to goto
     // other queues get dispatched here.
     //
+    // The queue dispatches in parallel.  The backing store serializes
+    // access per page (see store.c), so requests on different pages copy
+    // concurrently on as many processors as are issuing them.
+    //
     WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE (
         &ioQueueConfig,
-        WdfIoQueueDispatchSequential
+        WdfIoQueueDispatchParallel
         );
 
     ioQueueConfig.EvtIoDeviceControl = RamDiskEvtIoDeviceControl;
@@ -480,23 +623,26 @@ Return Value:
         &pDeviceExtension->DiskRegInfo
         );
 
+    pDeviceExtension->DiskLength =
+        ((ULONGLONG)pDeviceExtension->DiskRegInfo.DiskSizeHigh << 32) |
+        pDeviceExtension->DiskRegInfo.DiskSize;
+
     //
-    // Allocate memory for the disk image.
+    // Set up the backing store for the disk image.  Memory for the image
+    // itself is only allocated as it is written.
     //
-    pDeviceExtension->DiskImage = ExAllocatePoolWithTag(
-        NonPagedPool,
-        pDeviceExtension->DiskRegInfo.DiskSize,
-        RAMDISK_TAG
-        );
+    status = RamDiskStoreInitialize(&pDeviceExtension->Store,
+                                    pDeviceExtension->DiskLength);
 
-    if (pDeviceExtension->DiskImage) {
+    if (NT_SUCCESS(status)) {
 
         UNICODE_STRING deviceName;
         UNICODE_STRING win32Name;
 
-        RamDiskFormatDisk(pDeviceExtension);
-
-        status = STATUS_SUCCESS;
+        status = RamDiskFormatDisk(pDeviceExtension);
+        if (!NT_SUCCESS(status)) {
+            return status;
+        }
 
         //
         // Now try to create a symbolic link for the drive letter.
@@ -547,7 +693,7 @@ Return Value:
 
 {
 
-    RTL_QUERY_REGISTRY_TABLE rtlQueryRegTbl[5 + 1];  // Need 1 for NULL
+    RTL_QUERY_REGISTRY_TABLE rtlQueryRegTbl[6 + 1];  // Need 1 for NULL
     NTSTATUS                 Status;
     DISK_INFO                defDiskRegInfo;
 
@@ -558,6 +704,7 @@ Return Value:
     // Set the default values
 
     defDiskRegInfo.DiskSize          = DEFAULT_DISK_SIZE;
+    defDiskRegInfo.DiskSizeHigh      = DEFAULT_DISK_SIZE_HIGH;
     defDiskRegInfo.RootDirEntries    = DEFAULT_ROOT_DIR_ENTRIES;
     defDiskRegInfo.SectorsPerCluster = DEFAULT_SECTORS_PER_CLUSTER;
 
@@ -608,6 +755,12 @@ Return Value:
     rtlQueryRegTbl[4].DefaultData   = defDiskRegInfo.DriveLetter.Buffer;
     rtlQueryRegTbl[4].DefaultLength = 0;
 
+    rtlQueryRegTbl[5].Flags         = RTL_QUERY_REGISTRY_DIRECT;
+    rtlQueryRegTbl[5].Name          = L"DiskSizeHigh";
+    rtlQueryRegTbl[5].EntryContext  = &DiskRegInfo->DiskSizeHigh;
+    rtlQueryRegTbl[5].DefaultType   = REG_DWORD;
+    rtlQueryRegTbl[5].DefaultData   = &defDiskRegInfo.DiskSizeHigh;
+    rtlQueryRegTbl[5].DefaultLength = sizeof(ULONG);
 
     Status = RtlQueryRegistryValues(
                  RTL_REGISTRY_ABSOLUTE | RTL_REGISTRY_OPTIONAL,
@@ -620,12 +773,14 @@ Return Value:
     if (NT_SUCCESS(Status) == FALSE) {
 
         DiskRegInfo->DiskSize          = defDiskRegInfo.DiskSize;
+        DiskRegInfo->DiskSizeHigh      = defDiskRegInfo.DiskSizeHigh;
         DiskRegInfo->RootDirEntries    = defDiskRegInfo.RootDirEntries;
         DiskRegInfo->SectorsPerCluster = defDiskRegInfo.SectorsPerCluster;
         RtlCopyUnicodeString(&DiskRegInfo->DriveLetter, &defDiskRegInfo.DriveLetter);
     }
 
     KdPrint(("DiskSize          = 0x%lx\n", DiskRegInfo->DiskSize));
+    KdPrint(("DiskSizeHigh      = 0x%lx\n", DiskRegInfo->DiskSizeHigh));
     KdPrint(("RootDirEntries    = 0x%lx\n", DiskRegInfo->RootDirEntries));
     KdPrint(("SectorsPerCluster = 0x%lx\n", DiskRegInfo->SectorsPerCluster));
     KdPrint(("DriveLetter       = %wZ\n",   &(DiskRegInfo->DriveLetter)));
@@ -642,7 +797,10 @@ RamDiskFormatDisk(
 
 Routine Description:
 
-    This routine formats the new disk.
+    This routine formats the new disk.  Only the boot sector and the first
+    sectors of the FAT and root directory hold anything but zeroes, so those
+    are the only sectors written to the backing store.  Disks too large for
+    a FAT12/16 boot sector are left blank.
 
 
 Arguments:
@@ -657,7 +815,9 @@ Return Value:
 --*/
 {
 
-    PBOOT_SECTOR bootSector = (PBOOT_SECTOR) devExt->DiskImage;
+    NTSTATUS     status;
+    PUCHAR       sector;         // Scratch buffer for the sector being built
+    PBOOT_SECTOR bootSector;
     PUCHAR       firstFatSector;
     ULONG        rootDirEntries;
     ULONG        sectorsPerCluster;
@@ -668,9 +828,7 @@ Return Value:
 
     PAGED_CODE();
     ASSERT(sizeof(BOOT_SECTOR) == 512);
-    ASSERT(devExt->DiskImage != NULL);
-
-    RtlZeroMemory(devExt->DiskImage, devExt->DiskRegInfo.DiskSize);
+    ASSERT(devExt->Store.Root != NULL);
 
     devExt->DiskGeometry.BytesPerSector = 512;
     devExt->DiskGeometry.SectorsPerTrack = 32;     // Using Ramdisk value
@@ -680,7 +838,7 @@ Return Value:
     // Calculate number of cylinders.
     //
 
-    devExt->DiskGeometry.Cylinders.QuadPart = devExt->DiskRegInfo.DiskSize / 512 / 32 / 2;
+    devExt->DiskGeometry.Cylinders.QuadPart = devExt->DiskLength / 512 / 32 / 2;
 
     //
     // Our media type is RAMDISK_MEDIA_TYPE
@@ -694,6 +852,30 @@ Return Value:
         devExt->DiskGeometry.SectorsPerTrack, devExt->DiskGeometry.BytesPerSector
         ));
 
+    //
+    // The boot sector can't describe a disk this large.  Leave it blank
+    // and let the user format it from the disk manager.
+    //
+
+    if (devExt->DiskLength > RAMDISK_MAX_FORMAT_SIZE) {
+
+        devExt->PartitionType = PARTITION_IFS;
+        return STATUS_SUCCESS;
+    }
+
+    //
+    // The store copies under a spin lock at DISPATCH_LEVEL, so the scratch
+    // sector handed to RamDiskStoreWrite must not be pageable.
+    //
+
+    sector = ExAllocatePoolWithTag(NonPagedPoolNx, 512, RAMDISK_TAG);
+    if (sector == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(sector, 512);
+    bootSector = (PBOOT_SECTOR) sector;
+
     rootDirEntries = devExt->DiskRegInfo.RootDirEntries;
     sectorsPerCluster = devExt->DiskRegInfo.SectorsPerCluster;
 
@@ -740,7 +922,7 @@ Return Value:
     bootSector->bsFATs        = 1;
     bootSector->bsRootDirEnts = (USHORT)rootDirEntries;
 
-    bootSector->bsSectors     = (USHORT)(devExt->DiskRegInfo.DiskSize /
+    bootSector->bsSectors     = (USHORT)(devExt->DiskLength /
                                          devExt->DiskGeometry.BytesPerSector);
     bootSector->bsMedia       = (UCHAR)devExt->DiskGeometry.MediaType;
     bootSector->bsSecPerClus  = (UCHAR)sectorsPerCluster;
@@ -812,11 +994,20 @@ Return Value:
     bootSector->bsSig2[0] = 0x55;
     bootSector->bsSig2[1] = 0xAA;
 
+    devExt->PartitionType = ( fatType == 16 ) ? PARTITION_FAT_16 : PARTITION_FAT_12;
+
+    status = RamDiskStoreWrite(&devExt->Store, 0, sector, 512);
+    if (!NT_SUCCESS(status)) {
+        goto Exit;
+    }
+
     //
     // The FAT is located immediately following the boot sector.
     //
 
-    firstFatSector    = (PUCHAR)(bootSector + 1);
+    RtlZeroMemory(sector, 512);
+
+    firstFatSector    = sector;
     firstFatSector[0] = (UCHAR)devExt->DiskGeometry.MediaType;
     firstFatSector[1] = 0xFF;
     firstFatSector[2] = 0xFF;
@@ -825,10 +1016,17 @@ Return Value:
         firstFatSector[3] = 0xFF;
     }
 
+    status = RamDiskStoreWrite(&devExt->Store, 512, sector, 512);
+    if (!NT_SUCCESS(status)) {
+        goto Exit;
+    }
+
     //
     // The Root Directory follows the FAT
     //
-    rootDir = (PDIR_ENTRY)(bootSector + 1 + fatSectorCnt);
+    RtlZeroMemory(sector, 512);
+
+    rootDir = (PDIR_ENTRY) sector;
 
     //
     // Set device name to "MS-RAMDR"
@@ -853,7 +1051,16 @@ Return Value:
 
     rootDir->deAttributes = DIR_ATTR_VOLUME;
 
-    return STATUS_SUCCESS;
+    status = RamDiskStoreWrite(&devExt->Store,
+                               (ULONGLONG)(1 + fatSectorCnt) * 512,
+                               sector,
+                               512);
+
+Exit:
+
+    ExFreePoolWithTag(sector, RAMDISK_TAG);
+
+    return status;
 }
 
 BOOLEAN
@@ -873,9 +1080,9 @@ RamDiskCheckParameters(
     // file system.
     //
 
-    if( devExt->DiskRegInfo.DiskSize < Length ||
+    if( devExt->DiskLength < Length ||
         ByteOffset.QuadPart < 0 || // QuadPart is signed so check for negative values
-        ((ULONGLONG)ByteOffset.QuadPart > (devExt->DiskRegInfo.DiskSize - Length)) ||
+        ((ULONGLONG)ByteOffset.QuadPart > (devExt->DiskLength - Length)) ||
             (Length & (devExt->DiskGeometry.BytesPerSector - 1))) {
 
         //
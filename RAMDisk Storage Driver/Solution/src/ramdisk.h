@@ -22,6 +22,7 @@ Environment:
 #pragma warning(disable:4201)  // nameless struct/union warning
 
 #include <ntddk.h>
+#include <ntddstor.h>
 #include <ntdddisk.h>
 
 #pragma warning(default:4201)
@@ -45,19 +46,78 @@ Environment:
 #define DIR_ENTRIES_PER_SECTOR          16
 
 #define DEFAULT_DISK_SIZE               (1024*1024)     // 1 MB
+#define DEFAULT_DISK_SIZE_HIGH          0
 #define DEFAULT_ROOT_DIR_ENTRIES        512
 #define DEFAULT_SECTORS_PER_CLUSTER     2
 #define DEFAULT_DRIVE_LETTER            L"Z:"
 
+//
+// Largest disk RamDiskFormatDisk can lay a FAT12/16 volume on.  The boot
+// sector only has 16 bits for the sector count; bigger disks are left
+// blank for the user to format.
+//
+
+#define RAMDISK_MAX_FORMAT_SIZE         (0xFFFF * 512)
+
+//
+// The backing store is a radix tree.  Each interior node holds
+// RAMDISK_STORE_NODE_ENTRIES pointers to the next level down, and level 1
+// nodes point at PAGE_SIZE data pages.
+//
+
+#define RAMDISK_STORE_NODE_SHIFT        9
+#define RAMDISK_STORE_NODE_ENTRIES      (1 << RAMDISK_STORE_NODE_SHIFT)
+#define RAMDISK_STORE_NODE_SIZE         (RAMDISK_STORE_NODE_ENTRIES * sizeof(PVOID))
+
+//
+// Pages hash onto this many reader/writer spin lock stripes.  Each stripe
+// is padded out to its own cache line.
+//
+
+#define RAMDISK_STORE_LOCK_COUNT        256
+
+typedef struct _RAMDISK_STORE_LOCK {
+    EX_SPIN_LOCK    Lock;
+    UCHAR           Reserved[SYSTEM_CACHE_ALIGNMENT_SIZE - sizeof(EX_SPIN_LOCK)];
+} RAMDISK_STORE_LOCK, *PRAMDISK_STORE_LOCK;
+
+typedef struct _RAMDISK_STORE {
+    PVOID           Root;               // Top node of the radix tree
+    ULONG           Levels;             // Number of node levels above the pages
+    ULONGLONG       Length;             // Size of the store in bytes
+    volatile LONG64 CommittedPages;     // Data pages allocated so far
+    volatile LONG64 IndexBytes;         // Bytes held by interior nodes
+    RAMDISK_STORE_LOCK Locks[RAMDISK_STORE_LOCK_COUNT]; // Page lock stripes
+} RAMDISK_STORE, *PRAMDISK_STORE;
+
+#define RamDiskStorePageLock(Store, PageIndex) \
+    (&(Store)->Locks[(ULONG)(PageIndex) & (RAMDISK_STORE_LOCK_COUNT - 1)].Lock)
+
+//
+// IOCTL_RAMDISK_QUERY_STATISTICS returns how much memory the disk is
+// actually using.
+//
+
+#define IOCTL_RAMDISK_QUERY_STATISTICS  CTL_CODE(FILE_DEVICE_DISK, 0x800, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+typedef struct _RAMDISK_STATISTICS {
+    ULONGLONG   DiskLength;         // Size of the disk in bytes
+    ULONGLONG   CommittedBytes;     // Bytes of data pages allocated
+    ULONGLONG   IndexBytes;         // Bytes of radix tree nodes allocated
+} RAMDISK_STATISTICS, *PRAMDISK_STATISTICS;
+
 typedef struct _DISK_INFO {
-    ULONG   DiskSize;           // Ramdisk size in bytes
+    ULONG   DiskSize;           // Ramdisk size in bytes, low 32 bits
+    ULONG   DiskSizeHigh;       // Ramdisk size in bytes, high 32 bits
     ULONG   RootDirEntries;     // No. of root directory entries
     ULONG   SectorsPerCluster;  // Sectors per cluster
     UNICODE_STRING DriveLetter; // Drive letter to be used
 } DISK_INFO, *PDISK_INFO;
 
 typedef struct _DEVICE_EXTENSION {
-    PUCHAR              DiskImage;                  // Pointer to beginning of disk image
+    RAMDISK_STORE       Store;                      // Sparse backing store for the disk image
+    ULONGLONG           DiskLength;                 // Ramdisk size in bytes
+    UCHAR               PartitionType;              // Partition type reported for the disk
     DISK_GEOMETRY       DiskGeometry;               // Drive parameters built by Ramdisk
     DISK_INFO           DiskRegInfo;                // Disk parameters from the registry
     UNICODE_STRING      SymbolicLink;               // Dos symbolic name; Drive letter
@@ -192,5 +252,39 @@ RamDiskCheckParameters(
     IN size_t Length
     );
 
+NTSTATUS
+RamDiskStoreInitialize(
+    IN PRAMDISK_STORE Store,
+    IN ULONGLONG Length
+    );
+
+VOID
+RamDiskStoreCleanup(
+    IN PRAMDISK_STORE Store
+    );
+
+VOID
+RamDiskStoreRead(
+    IN PRAMDISK_STORE Store,
+    IN ULONGLONG ByteOffset,
+    OUT PUCHAR Buffer,
+    IN size_t Length
+    );
+
+NTSTATUS
+RamDiskStoreWrite(
+    IN PRAMDISK_STORE Store,
+    IN ULONGLONG ByteOffset,
+    IN PUCHAR Buffer,
+    IN size_t Length
+    );
+
+VOID
+RamDiskStoreTrim(
+    IN PRAMDISK_STORE Store,
+    IN ULONGLONG ByteOffset,
+    IN ULONGLONG Length
+    );
+
 #endif    // _RAMDISK_H_
 
@@ -0,0 +1,588 @@
+/*++
+
+Copyright (c) Microsoft Corporation, All Rights Reserved
+
+Module Name:
+
+    store.c
+
+Abstract:
+
+    This file implements the sparse backing store for the Ramdisk driver.
+    The disk is described by a radix tree of page-sized leaves.  Interior
+    nodes and leaves are allocated on the first write that lands in them,
+    so reads of untouched ranges return zeroes without allocating and a
+    large disk only costs the memory that has actually been written.
+
+    Requests are dispatched in parallel.  Each page maps to one of a set of
+    reader/writer spin lock stripes.  Reads and writes hold the stripe
+    shared while they copy a page, and trims hold it exclusive while they
+    unlink and free one, so a page can't be freed under a copy.  Interior
+    nodes are only freed at cleanup and need no locking.
+
+Environment:
+
+    Kernel mode only.
+
+--*/
+
+#include "ramdisk.h"
+
+VOID
+RamDiskStoreFreeNode(
+    IN PVOID Node,
+    IN ULONG Level
+    );
+
+PVOID *
+RamDiskStoreLookupSlot(
+    IN PRAMDISK_STORE Store,
+    IN ULONGLONG PageIndex,
+    IN BOOLEAN Allocate
+    );
+
+PUCHAR
+RamDiskStoreLookupPage(
+    IN PRAMDISK_STORE Store,
+    IN ULONGLONG PageIndex,
+    IN BOOLEAN Allocate
+    );
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, RamDiskStoreInitialize)
+#pragma alloc_text(PAGE, RamDiskStoreCleanup)
+#pragma alloc_text(PAGE, RamDiskStoreFreeNode)
+#endif
+
+NTSTATUS
+RamDiskStoreInitialize(
+    IN PRAMDISK_STORE Store,
+    IN ULONGLONG Length
+    )
+
+/*++
+
+Routine Description:
+
+    This routine sets up an empty store describing Length bytes.  Only the
+    root node is allocated here; everything below it is allocated on demand
+    by RamDiskStoreWrite.
+
+Arguments:
+
+    Store - Supplies the store to initialize.
+
+    Length - Supplies the size of the disk in bytes.
+
+Return Value:
+
+    STATUS_SUCCESS if successful, STATUS_INSUFFICIENT_RESOURCES if the root
+    node could not be allocated.
+
+--*/
+
+{
+    ULONGLONG pageCount;
+    ULONGLONG reach;
+
+    PAGED_CODE();
+
+    RtlZeroMemory(Store, sizeof(RAMDISK_STORE));
+
+    Store->Length = Length;
+
+    //
+    // Pick enough levels for the root to reach every page on the disk.
+    //
+
+    pageCount = (Length + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+    Store->Levels = 1;
+    reach = RAMDISK_STORE_NODE_ENTRIES;
+
+    while (reach < pageCount) {
+        Store->Levels += 1;
+        reach <<= RAMDISK_STORE_NODE_SHIFT;
+    }
+
+    Store->Root = ExAllocatePoolWithTag(NonPagedPool,
+                                        RAMDISK_STORE_NODE_SIZE,
+                                        RAMDISK_TAG);
+
+    if (Store->Root == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(Store->Root, RAMDISK_STORE_NODE_SIZE);
+    Store->IndexBytes = RAMDISK_STORE_NODE_SIZE;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+RamDiskStoreCleanup(
+    IN PRAMDISK_STORE Store
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees every node and page held by the store.
+
+Arguments:
+
+    Store - Supplies the store to tear down.
+
+Return Value:
+
+    VOID
+
+--*/
+
+{
+    PAGED_CODE();
+
+    if (Store->Root != NULL) {
+        RamDiskStoreFreeNode(Store->Root, Store->Levels);
+        Store->Root = NULL;
+    }
+
+    Store->CommittedPages = 0;
+    Store->IndexBytes = 0;
+}
+
+VOID
+RamDiskStoreFreeNode(
+    IN PVOID Node,
+    IN ULONG Level
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees an interior node and everything below it.  The tree
+    is at most a handful of levels deep so the recursion is bounded.
+
+Arguments:
+
+    Node - Supplies the node to free.
+
+    Level - Supplies the level of the node.  Level 1 nodes point at data
+            pages.
+
+Return Value:
+
+    VOID
+
+--*/
+
+{
+    PVOID *slots = (PVOID *) Node;
+    ULONG  index;
+
+    PAGED_CODE();
+
+    for (index = 0; index < RAMDISK_STORE_NODE_ENTRIES; index++) {
+
+        if (slots[index] == NULL) {
+            continue;
+        }
+
+        if (Level == 1) {
+            ExFreePoolWithTag(slots[index], RAMDISK_TAG);
+        } else {
+            RamDiskStoreFreeNode(slots[index], Level - 1);
+        }
+    }
+
+    ExFreePoolWithTag(Node, RAMDISK_TAG);
+}
+
+PVOID *
+RamDiskStoreLookupSlot(
+    IN PRAMDISK_STORE Store,
+    IN ULONGLONG PageIndex,
+    IN BOOLEAN Allocate
+    )
+
+/*++
+
+Routine Description:
+
+    This routine walks the radix tree down to the level 1 slot that holds
+    the data page for PageIndex.  Missing interior nodes are allocated if
+    requested.  New nodes are published with an interlocked compare-exchange
+    so that concurrent writers populating the same slot agree on one
+    allocation.
+
+Arguments:
+
+    Store - Supplies the store.
+
+    PageIndex - Supplies the index of the page on the disk.
+
+    Allocate - Supplies TRUE to allocate missing interior nodes.
+
+Return Value:
+
+    A pointer to the slot for the page, or NULL if an interior node is not
+    present and either Allocate is FALSE or an allocation failed.
+
+--*/
+
+{
+    PVOID  node = Store->Root;
+    PVOID  child;
+    PVOID  existing;
+    PVOID *slot;
+    ULONG  level;
+    ULONG  index;
+
+    for (level = Store->Levels; ; level--) {
+
+        index = (ULONG) (PageIndex >> ((level - 1) * RAMDISK_STORE_NODE_SHIFT)) &
+                    (RAMDISK_STORE_NODE_ENTRIES - 1);
+
+        slot = &((PVOID *) node)[index];
+
+        if (level == 1) {
+            return slot;
+        }
+
+        child = *((PVOID volatile *) slot);
+
+        if (child == NULL) {
+
+            if (!Allocate) {
+                return NULL;
+            }
+
+            child = ExAllocatePoolWithTag(NonPagedPool, RAMDISK_STORE_NODE_SIZE, RAMDISK_TAG);
+            if (child == NULL) {
+                return NULL;
+            }
+
+            RtlZeroMemory(child, RAMDISK_STORE_NODE_SIZE);
+
+            existing = InterlockedCompareExchangePointer(slot, child, NULL);
+
+            if (existing != NULL) {
+
+                //
+                // Somebody else filled this slot first.  Use theirs.
+                //
+                ExFreePoolWithTag(child, RAMDISK_TAG);
+                child = existing;
+
+            } else {
+                InterlockedExchangeAdd64(&Store->IndexBytes, RAMDISK_STORE_NODE_SIZE);
+            }
+        }
+
+        node = child;
+    }
+}
+
+PUCHAR
+RamDiskStoreLookupPage(
+    IN PRAMDISK_STORE Store,
+    IN ULONGLONG PageIndex,
+    IN BOOLEAN Allocate
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the data page for PageIndex, allocating it and
+    any missing interior nodes if requested.  The caller holds the page's
+    lock stripe shared.
+
+Arguments:
+
+    Store - Supplies the store.
+
+    PageIndex - Supplies the index of the page on the disk.
+
+    Allocate - Supplies TRUE to allocate anything missing along the path.
+
+Return Value:
+
+    A pointer to the page, or NULL if it is not present and either
+    Allocate is FALSE or an allocation failed.
+
+--*/
+
+{
+    PVOID *slot;
+    PVOID  page;
+    PVOID  existing;
+
+    slot = RamDiskStoreLookupSlot(Store, PageIndex, Allocate);
+    if (slot == NULL) {
+        return NULL;
+    }
+
+    page = *((PVOID volatile *) slot);
+
+    if ((page == NULL) && Allocate) {
+
+        page = ExAllocatePoolWithTag(NonPagedPool, PAGE_SIZE, RAMDISK_TAG);
+        if (page == NULL) {
+            return NULL;
+        }
+
+        RtlZeroMemory(page, PAGE_SIZE);
+
+        existing = InterlockedCompareExchangePointer(slot, page, NULL);
+
+        if (existing != NULL) {
+            ExFreePoolWithTag(page, RAMDISK_TAG);
+            page = existing;
+        } else {
+            InterlockedIncrement64(&Store->CommittedPages);
+        }
+    }
+
+    return (PUCHAR) page;
+}
+
+VOID
+RamDiskStoreRead(
+    IN PRAMDISK_STORE Store,
+    IN ULONGLONG ByteOffset,
+    OUT PUCHAR Buffer,
+    IN size_t Length
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies a range of the disk into Buffer.  Pages that have
+    never been written are returned as zeroes.
+
+Arguments:
+
+    Store - Supplies the store.
+
+    ByteOffset - Supplies the offset on the disk to read from.  The caller
+                 has already checked the range against the disk size.
+
+    Buffer - Receives the data.  The copy is done at DISPATCH_LEVEL, so the
+             buffer must be nonpaged.
+
+    Length - Supplies the number of bytes to read.
+
+Return Value:
+
+    VOID
+
+--*/
+
+{
+    PUCHAR      page;
+    ULONG       pageOffset;
+    size_t      chunk;
+    PEX_SPIN_LOCK lock;
+    KIRQL       oldIrql;
+
+    while (Length != 0) {
+
+        pageOffset = (ULONG) (ByteOffset & (PAGE_SIZE - 1));
+
+        chunk = PAGE_SIZE - pageOffset;
+        if (chunk > Length) {
+            chunk = Length;
+        }
+
+        lock = RamDiskStorePageLock(Store, ByteOffset >> PAGE_SHIFT);
+        oldIrql = ExAcquireSpinLockShared(lock);
+
+        page = RamDiskStoreLookupPage(Store, ByteOffset >> PAGE_SHIFT, FALSE);
+
+        if (page != NULL) {
+            RtlCopyMemory(Buffer, page + pageOffset, chunk);
+        } else {
+            RtlZeroMemory(Buffer, chunk);
+        }
+
+        ExReleaseSpinLockShared(lock, oldIrql);
+
+        ByteOffset += chunk;
+        Buffer += chunk;
+        Length -= chunk;
+    }
+}
+
+NTSTATUS
+RamDiskStoreWrite(
+    IN PRAMDISK_STORE Store,
+    IN ULONGLONG ByteOffset,
+    IN PUCHAR Buffer,
+    IN size_t Length
+    )
+
+/*++
+
+Routine Description:
+
+    This routine copies Buffer into a range of the disk, allocating pages
+    as they are first written.  A chunk of zeroes aimed at a page that does
+    not exist yet is dropped, since that page already reads as zeroes.  This
+    keeps format and zero-fill passes from committing memory.
+
+Arguments:
+
+    Store - Supplies the store.
+
+    ByteOffset - Supplies the offset on the disk to write to.  The caller
+                 has already checked the range against the disk size.
+
+    Buffer - Supplies the data.  The copy is done at DISPATCH_LEVEL, so the
+             buffer must be nonpaged.
+
+    Length - Supplies the number of bytes to write.
+
+Return Value:
+
+    STATUS_SUCCESS if successful, STATUS_INSUFFICIENT_RESOURCES if a page
+    could not be allocated.  In that case the part of the range before the
+    failing page has been written.
+
+--*/
+
+{
+    NTSTATUS    status = STATUS_SUCCESS;
+    PUCHAR      page;
+    ULONG       pageOffset;
+    size_t      chunk;
+    PEX_SPIN_LOCK lock;
+    KIRQL       oldIrql;
+
+    while (Length != 0) {
+
+        pageOffset = (ULONG) (ByteOffset & (PAGE_SIZE - 1));
+
+        chunk = PAGE_SIZE - pageOffset;
+        if (chunk > Length) {
+            chunk = Length;
+        }
+
+        lock = RamDiskStorePageLock(Store, ByteOffset >> PAGE_SHIFT);
+        oldIrql = ExAcquireSpinLockShared(lock);
+
+        page = RamDiskStoreLookupPage(Store, ByteOffset >> PAGE_SHIFT, FALSE);
+
+        //
+        // RtlCompareMemoryUlong wants an aligned buffer and a whole number
+        // of ULONGs.  Anything else just gets a page.
+        //
+        if ((page == NULL) &&
+            (((((ULONG_PTR) Buffer) | chunk) & (sizeof(ULONG) - 1)) != 0 ||
+             RtlCompareMemoryUlong(Buffer, chunk, 0) != chunk)) {
+
+            page = RamDiskStoreLookupPage(Store, ByteOffset >> PAGE_SHIFT, TRUE);
+
+            if (page == NULL) {
+                status = STATUS_INSUFFICIENT_RESOURCES;
+            }
+        }
+
+        if (page != NULL) {
+            RtlCopyMemory(page + pageOffset, Buffer, chunk);
+        }
+
+        ExReleaseSpinLockShared(lock, oldIrql);
+
+        if (!NT_SUCCESS(status)) {
+            break;
+        }
+
+        ByteOffset += chunk;
+        Buffer += chunk;
+        Length -= chunk;
+    }
+
+    return status;
+}
+
+VOID
+RamDiskStoreTrim(
+    IN PRAMDISK_STORE Store,
+    IN ULONGLONG ByteOffset,
+    IN ULONGLONG Length
+    )
+
+/*++
+
+Routine Description:
+
+    This routine discards a range of the disk.  Whole pages in the range
+    are unlinked from the tree and freed, which returns their memory.  The
+    covered part of a partial page is zeroed in place so that trimmed
+    ranges always read back as zeroes.
+
+Arguments:
+
+    Store - Supplies the store.
+
+    ByteOffset - Supplies the offset on the disk to trim from.  The caller
+                 has already checked the range against the disk size.
+
+    Length - Supplies the number of bytes to trim.
+
+Return Value:
+
+    VOID
+
+--*/
+
+{
+    PVOID      *slot;
+    PUCHAR      page;
+    ULONG       pageOffset;
+    ULONGLONG   chunk;
+    PEX_SPIN_LOCK lock;
+    KIRQL       oldIrql;
+
+    while (Length != 0) {
+
+        pageOffset = (ULONG) (ByteOffset & (PAGE_SIZE - 1));
+
+        chunk = PAGE_SIZE - pageOffset;
+        if (chunk > Length) {
+            chunk = Length;
+        }
+
+        slot = RamDiskStoreLookupSlot(Store, ByteOffset >> PAGE_SHIFT, FALSE);
+        page = NULL;
+
+        if (slot != NULL) {
+
+            lock = RamDiskStorePageLock(Store, ByteOffset >> PAGE_SHIFT);
+            oldIrql = ExAcquireSpinLockExclusive(lock);
+
+            if (chunk == PAGE_SIZE) {
+
+                page = InterlockedExchangePointer(slot, NULL);
+
+            } else if (*slot != NULL) {
+
+                RtlZeroMemory((PUCHAR) *slot + pageOffset, (size_t) chunk);
+            }
+
+            ExReleaseSpinLockExclusive(lock, oldIrql);
+        }
+
+        if (page != NULL) {
+            ExFreePoolWithTag(page, RAMDISK_TAG);
+            InterlockedDecrement64(&Store->CommittedPages);
+        }
+
+        ByteOffset += chunk;
+        Length -= chunk;
+    }
+}
@@ -0,0 +1,412 @@
+/*++
+
+Copyright (c) 1999-2002  Microsoft Corporation
+
+Module Name:
+
+    scanBench.c
+
+Abstract:
+
+    This file contains a benchmark for the scan engine used by scanuser.
+    It reads every file under a corpus directory into memory, then times
+    ScanEngineScan over them and reports the throughput in GB/s.
+
+    Files are scanned the way the filter hands them to scanuser: in
+    SCANNER_READ_BUFFER_SIZE chunks, carrying the scan state from one chunk
+    to the next, and stopping at the first chunk with a match.  Only the
+    scans are timed, not the reads.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fltuser.h>
+#include "scanuk.h"
+#include "scanuser.h"
+#include <dontuse.h>
+
+#define SCANBENCH_DEFAULT_PASSES        5
+
+//
+//  A file of the corpus, read into memory.
+//
+
+typedef struct _SCANBENCH_FILE {
+
+    struct _SCANBENCH_FILE *Next;
+    ULONG Size;
+    UCHAR Contents[1];
+
+} SCANBENCH_FILE, *PSCANBENCH_FILE;
+
+typedef struct _SCANBENCH_CORPUS {
+
+    PSCANBENCH_FILE Files;
+    ULONG FileCount;
+    ULONG SkippedCount;
+    ULONGLONG Bytes;
+
+} SCANBENCH_CORPUS, *PSCANBENCH_CORPUS;
+
+
+VOID
+Usage (
+    VOID
+    )
+/*++
+
+Routine Description
+
+    Prints usage
+
+Arguments
+
+    None
+
+Return Value
+
+    None
+
+--*/
+{
+    printf( "Measures the throughput of the scanuser scan engine\n" );
+    printf( "Usage: scanbench <corpus directory> [signature file] [passes]\n" );
+    printf( "    Every file under the directory is scanned on every pass (default %d)\n",
+            SCANBENCH_DEFAULT_PASSES );
+    printf( "    The signature file is the one scanuser takes\n" );
+}
+
+
+BOOLEAN
+ScanBenchReadFile (
+    _In_ PCSTR FileName,
+    _Inout_ PSCANBENCH_CORPUS Corpus
+    )
+/*++
+
+Routine Description
+
+    Reads a file into memory and adds it to the corpus.  Files of 4GB or
+    more can't be scanned with one ULONG size and are skipped.
+
+Arguments
+
+    FileName    -   Name of the file
+    Corpus      -   The corpus to add it to
+
+Return Value
+
+    FALSE if we ran out of memory, TRUE otherwise.
+
+--*/
+{
+    PSCANBENCH_FILE file;
+    LARGE_INTEGER size;
+    HANDLE handle;
+    DWORD bytesRead;
+    BOOL result;
+
+    handle = CreateFileA( FileName,
+                          GENERIC_READ,
+                          FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                          NULL,
+                          OPEN_EXISTING,
+                          FILE_FLAG_SEQUENTIAL_SCAN,
+                          NULL );
+
+    if (handle == INVALID_HANDLE_VALUE) {
+
+        Corpus->SkippedCount++;
+        return TRUE;
+    }
+
+    if (!GetFileSizeEx( handle, &size ) ||
+        (size.QuadPart == 0) ||
+        (size.QuadPart >= MAXULONG - FIELD_OFFSET( SCANBENCH_FILE, Contents ))) {
+
+        Corpus->SkippedCount++;
+        CloseHandle( handle );
+        return TRUE;
+    }
+
+    file = malloc( FIELD_OFFSET( SCANBENCH_FILE, Contents ) + size.LowPart );
+
+    if (file == NULL) {
+
+        CloseHandle( handle );
+        return FALSE;
+    }
+
+    result = ReadFile( handle, file->Contents, size.LowPart, &bytesRead, NULL );
+
+    CloseHandle( handle );
+
+    if (!result || (bytesRead == 0)) {
+
+        Corpus->SkippedCount++;
+        free( file );
+        return TRUE;
+    }
+
+    file->Size = bytesRead;
+    file->Next = Corpus->Files;
+    Corpus->Files = file;
+    Corpus->FileCount++;
+    Corpus->Bytes += bytesRead;
+
+    return TRUE;
+}
+
+
+BOOLEAN
+ScanBenchReadDirectory (
+    _In_ PCSTR Directory,
+    _Inout_ PSCANBENCH_CORPUS Corpus
+    )
+/*++
+
+Routine Description
+
+    Reads every file under a directory, recursively, into the corpus.
+
+Arguments
+
+    Directory   -   The directory
+    Corpus      -   The corpus to add the files to
+
+Return Value
+
+    FALSE if we ran out of memory, TRUE otherwise.
+
+--*/
+{
+    WIN32_FIND_DATAA findData;
+    CHAR path[MAX_PATH];
+    HANDLE find;
+    BOOLEAN result = TRUE;
+
+    if (sprintf_s( path, MAX_PATH, "%s\\*", Directory ) < 0) {
+
+        return TRUE;
+    }
+
+    find = FindFirstFileA( path, &findData );
+
+    if (find == INVALID_HANDLE_VALUE) {
+
+        return TRUE;
+    }
+
+    do {
+
+        if ((strcmp( findData.cFileName, "." ) == 0) ||
+            (strcmp( findData.cFileName, ".." ) == 0)) {
+
+            continue;
+        }
+
+        if (sprintf_s( path, MAX_PATH, "%s\\%s", Directory, findData.cFileName ) < 0) {
+
+            Corpus->SkippedCount++;
+            continue;
+        }
+
+        //
+        //  Don't follow junctions and symbolic links, they can loop.
+        //
+
+        if (findData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+
+            continue;
+        }
+
+        if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+
+            result = ScanBenchReadDirectory( path, Corpus );
+
+        } else {
+
+            result = ScanBenchReadFile( path, Corpus );
+        }
+
+    } while (result && FindNextFileA( find, &findData ));
+
+    FindClose( find );
+
+    return result;
+}
+
+
+ULONG
+ScanBenchScanFile (
+    _In_ PSCAN_ENGINE Engine,
+    _In_ PSCANBENCH_FILE File
+    )
+/*++
+
+Routine Description
+
+    Scans a file the way scanuser sees it, a chunk at a time.
+
+Arguments
+
+    Engine  -   The engine
+    File    -   The file
+
+Return Value
+
+    1 if a signature was found, 0 otherwise.
+
+--*/
+{
+    ULONG offset;
+    ULONG length;
+    ULONG state = 0;
+
+    for (offset = 0; offset < File->Size; offset += length) {
+
+        length = min( File->Size - offset, SCANNER_READ_BUFFER_SIZE );
+
+        if (ScanEngineScan( Engine, File->Contents + offset, length, &state )) {
+
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+int _cdecl
+main (
+    _In_ int argc,
+    _In_reads_(argc) char *argv[]
+    )
+{
+    SCANBENCH_CORPUS corpus = { NULL, 0, 0, 0 };
+    PSCAN_ENGINE engine;
+    PSCANBENCH_FILE file;
+    PCSTR signatureFile = NULL;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    LONGLONG ticks;
+    LONGLONG bestTicks = MAXLONGLONG;
+    ULONG matches = 0;
+    int passes = SCANBENCH_DEFAULT_PASSES;
+    int pass;
+    int status = 0;
+
+    if (argc < 2) {
+
+        Usage();
+        return 1;
+    }
+
+    if (argc > 2) {
+
+        signatureFile = argv[2];
+    }
+
+    if (argc > 3) {
+
+        passes = atoi( argv[3] );
+
+        if (passes <= 0) {
+
+            Usage();
+            return 1;
+        }
+    }
+
+    engine = ScanEngineLoad( signatureFile );
+
+    if (engine == NULL) {
+
+        return 4;
+    }
+
+    printf( "Scanbench: Reading %s ...\n", argv[1] );
+
+    if (!ScanBenchReadDirectory( argv[1], &corpus )) {
+
+        printf( "ERROR: Not enough memory for the corpus\n" );
+        status = 5;
+        goto main_cleanup;
+    }
+
+    if (corpus.FileCount == 0) {
+
+        printf( "ERROR: No files to scan in %s\n", argv[1] );
+        status = 2;
+        goto main_cleanup;
+    }
+
+    printf( "Scanbench: %u files, %I64u bytes, %u skipped\n",
+            corpus.FileCount,
+            corpus.Bytes,
+            corpus.SkippedCount );
+
+    QueryPerformanceFrequency( &frequency );
+
+    //
+    //  The reads left the corpus in the cache about as warm as it will get,
+    //  so every pass counts.  The best pass is the one least disturbed by
+    //  the rest of the system.
+    //
+
+    for (pass = 1; pass <= passes; pass++) {
+
+        matches = 0;
+
+        QueryPerformanceCounter( &start );
+
+        for (file = corpus.Files; file != NULL; file = file->Next) {
+
+            matches += ScanBenchScanFile( engine, file );
+        }
+
+        QueryPerformanceCounter( &end );
+
+        ticks = max( end.QuadPart - start.QuadPart, 1 );
+        bestTicks = min( bestTicks, ticks );
+
+        printf( "Scanbench: pass %d: %.3f GB/s, %u files matched\n",
+                pass,
+                ((double) corpus.Bytes * frequency.QuadPart) / ((double) ticks * 1e9),
+                matches );
+    }
+
+    printf( "Scanbench: best %.3f GB/s\n",
+            ((double) corpus.Bytes * frequency.QuadPart) / ((double) bestTicks * 1e9) );
+
+    //
+    //  A file with a match isn't scanned past it, so the figures overstate
+    //  the throughput of a corpus with many matches.
+    //
+
+    if (matches != 0) {
+
+        printf( "Scanbench: matched files stop scanning at the match; use a clean corpus for a pure throughput figure\n" );
+    }
+
+main_cleanup:
+
+    while (corpus.Files != NULL) {
+
+        file = corpus.Files;
+        corpus.Files = file->Next;
+        free( file );
+    }
+
+    ScanEngineFree( engine );
+
+    return status;
+}
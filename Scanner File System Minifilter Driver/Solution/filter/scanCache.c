@@ -0,0 +1,761 @@
+/*++
+
+Copyright (c) 1999-2002  Microsoft Corporation
+
+Module Name:
+
+    scanCache.c
+
+Abstract:
+
+    This module keeps the verdicts user mode returned for whole files, so
+    that opening and closing a file that has not changed since it was last
+    scanned doesn't need another round trip to user mode.
+
+    Verdicts are keyed by volume and file ID, and are only trusted while
+    the file's last write time, change time and size still match what they
+    were when the file was scanned.  Writes, renames, truncation and
+    deletion through the filter invalidate a verdict right away; the stamp
+    catches changes we didn't see, such as writes made before we attached.
+
+    The cache is bounded.  When it is full, the least recently used verdict
+    is evicted.
+
+Environment:
+
+    Kernel mode
+
+--*/
+
+#include <fltKernel.h>
+#include <dontuse.h>
+#include <suppress.h>
+#include "scanuk.h"
+#include "scanner.h"
+
+#define SCANNER_CACHE_TAG     'Cncs'
+
+//
+//  Local routines
+//
+
+PSCANNER_CACHE_BUCKET
+ScannerpCacheBucket (
+    _In_ PSCANNER_CACHE_KEY Key
+    );
+
+PSCANNER_CACHE_ENTRY
+ScannerpCacheFind (
+    _In_ PSCANNER_CACHE_BUCKET Bucket,
+    _In_ PSCANNER_CACHE_KEY Key
+    );
+
+VOID
+ScannerpCacheFreeEntries (
+    _Inout_ PLIST_ENTRY List
+    );
+
+#ifdef ALLOC_PRAGMA
+    #pragma alloc_text(INIT, ScannerCacheInitialize)
+    #pragma alloc_text(PAGE, ScannerCacheFree)
+    #pragma alloc_text(PAGE, ScannerCacheQueryFile)
+#endif
+
+
+VOID
+ScannerCacheInitialize (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine initializes the verdict cache.  It must be called before
+    the filter is registered.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PSCANNER_VERDICT_CACHE cache = &ScannerData.VerdictCache;
+    ULONG i;
+
+    PAGED_CODE();
+
+    RtlZeroMemory( cache, sizeof( SCANNER_VERDICT_CACHE ) );
+
+    KeInitializeSpinLock( &cache->Lock );
+    InitializeListHead( &cache->Lru );
+
+    for (i = 0; i < SCANNER_CACHE_BUCKETS; i++) {
+
+        InitializeListHead( &cache->Buckets[i].Entries );
+    }
+
+    cache->MaxEntries = SCANNER_CACHE_MAX_ENTRIES;
+
+    ExInitializeNPagedLookasideList( &cache->EntryList,
+                                     NULL,
+                                     NULL,
+                                     0,
+                                     sizeof( SCANNER_CACHE_ENTRY ),
+                                     SCANNER_CACHE_TAG,
+                                     0 );
+}
+
+
+VOID
+ScannerCacheFree (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine frees every verdict and the cache itself.  No filter
+    callbacks may be running when it is called.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    ScannerCacheFlush();
+
+    ExDeleteNPagedLookasideList( &ScannerData.VerdictCache.EntryList );
+}
+
+
+NTSTATUS
+ScannerCacheQueryFile (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PFLT_VOLUME Volume,
+    _In_ PFILE_OBJECT FileObject,
+    _Out_ PSCANNER_CACHE_KEY Key,
+    _Out_opt_ PSCANNER_CACHE_STAMP Stamp
+    )
+/*++
+
+Routine Description:
+
+    This routine builds the cache key for a file and, if asked, the stamp
+    that tells whether the file changed since a verdict was cached.
+
+Arguments:
+
+    Instance - Our instance on the volume the file is on.
+
+    Volume - The volume the file is on.
+
+    FileObject - The file.
+
+    Key - Receives the cache key.
+
+    Stamp - If present, receives the file's current change stamp.
+
+Return Value:
+
+    STATUS_SUCCESS if the file's verdict can be cached.  Directories, and
+    files on file systems that don't give them an ID, can't be.
+
+--*/
+{
+    FILE_INTERNAL_INFORMATION internalInfo;
+    FILE_NETWORK_OPEN_INFORMATION openInfo;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    Key->Volume = NULL;
+    Key->FileId.QuadPart = 0;
+
+    status = FltQueryInformationFile( Instance,
+                                      FileObject,
+                                      &internalInfo,
+                                      sizeof( internalInfo ),
+                                      FileInternalInformation,
+                                      NULL );
+
+    if (!NT_SUCCESS( status )) {
+
+        return status;
+    }
+
+    //
+    //  Some file systems return zero or -1 instead of failing when they
+    //  don't have file IDs.
+    //
+
+    if ((internalInfo.IndexNumber.QuadPart == 0) ||
+        (internalInfo.IndexNumber.QuadPart == -1)) {
+
+        return STATUS_NOT_SUPPORTED;
+    }
+
+    if (ARGUMENT_PRESENT( Stamp )) {
+
+        status = FltQueryInformationFile( Instance,
+                                          FileObject,
+                                          &openInfo,
+                                          sizeof( openInfo ),
+                                          FileNetworkOpenInformation,
+                                          NULL );
+
+        if (!NT_SUCCESS( status )) {
+
+            return status;
+        }
+
+        if (FlagOn( openInfo.FileAttributes, FILE_ATTRIBUTE_DIRECTORY )) {
+
+            return STATUS_FILE_IS_A_DIRECTORY;
+        }
+
+        Stamp->LastWriteTime = openInfo.LastWriteTime;
+        Stamp->ChangeTime = openInfo.ChangeTime;
+        Stamp->EndOfFile = openInfo.EndOfFile;
+    }
+
+    Key->Volume = Volume;
+    Key->FileId = internalInfo.IndexNumber;
+
+    return STATUS_SUCCESS;
+}
+
+
+BOOLEAN
+ScannerCacheLookup (
+    _In_ PSCANNER_CACHE_KEY Key,
+    _In_ PSCANNER_CACHE_STAMP Stamp,
+    _Out_ PBOOLEAN SafeToOpen,
+    _Out_ PULONG Sequence
+    )
+/*++
+
+Routine Description:
+
+    This routine looks for a verdict for a file that is still current.  A
+    verdict whose stamp no longer matches the file is dropped.
+
+Arguments:
+
+    Key - The file's cache key.
+
+    Stamp - The file's current change stamp.
+
+    SafeToOpen - Receives the cached verdict on a hit.
+
+    Sequence - Receives the invalidation sequence to pass to
+        ScannerCacheInsert once the file has been scanned after a miss.
+
+Return Value:
+
+    TRUE if a current verdict was found.
+
+--*/
+{
+    PSCANNER_VERDICT_CACHE cache = &ScannerData.VerdictCache;
+    PSCANNER_CACHE_BUCKET bucket;
+    PSCANNER_CACHE_ENTRY entry;
+    BOOLEAN hit = FALSE;
+    KIRQL oldIrql;
+
+    *SafeToOpen = TRUE;
+
+    bucket = ScannerpCacheBucket( Key );
+
+    KeAcquireSpinLock( &cache->Lock, &oldIrql );
+
+    *Sequence = bucket->Sequence;
+
+    entry = ScannerpCacheFind( bucket, Key );
+
+    if (entry != NULL) {
+
+        RemoveEntryList( &entry->LruLinks );
+
+        if (RtlEqualMemory( &entry->Stamp, Stamp, sizeof( SCANNER_CACHE_STAMP ) )) {
+
+            InsertHeadList( &cache->Lru, &entry->LruLinks );
+
+            *SafeToOpen = entry->SafeToOpen;
+            hit = TRUE;
+
+        } else {
+
+            //
+            //  The file changed behind our back.
+            //
+
+            RemoveEntryList( &entry->HashLinks );
+            cache->Entries--;
+
+        }
+    }
+
+    if (hit) {
+
+        cache->Hits++;
+
+    } else {
+
+        cache->Misses++;
+    }
+
+    KeReleaseSpinLock( &cache->Lock, oldIrql );
+
+    if ((entry != NULL) && !hit) {
+
+        ExFreeToNPagedLookasideList( &cache->EntryList, entry );
+    }
+
+    return hit;
+}
+
+
+VOID
+ScannerCacheInsert (
+    _In_ PSCANNER_CACHE_KEY Key,
+    _In_ PSCANNER_CACHE_STAMP Stamp,
+    _In_ BOOLEAN SafeToOpen,
+    _In_ ULONG Sequence
+    )
+/*++
+
+Routine Description:
+
+    This routine caches the verdict for a file that was just scanned.  The
+    verdict is thrown away if the file may have been changed while it was
+    being scanned.
+
+Arguments:
+
+    Key - The file's cache key.
+
+    Stamp - The file's change stamp from before it was scanned.
+
+    SafeToOpen - The verdict.
+
+    Sequence - The invalidation sequence ScannerCacheLookup returned before
+        the file was scanned.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PSCANNER_VERDICT_CACHE cache = &ScannerData.VerdictCache;
+    PSCANNER_CACHE_BUCKET bucket;
+    PSCANNER_CACHE_ENTRY entry, newEntry, freeEntry = NULL;
+    KIRQL oldIrql;
+
+    newEntry = ExAllocateFromNPagedLookasideList( &cache->EntryList );
+
+    if (newEntry == NULL) {
+
+        return;
+    }
+
+    bucket = ScannerpCacheBucket( Key );
+
+    KeAcquireSpinLock( &cache->Lock, &oldIrql );
+
+    if (bucket->Sequence != Sequence) {
+
+        //
+        //  Something wrote to, renamed or deleted a file in this bucket
+        //  while we were scanning.  It may have been this one.
+        //
+
+        freeEntry = newEntry;
+
+    } else {
+
+        entry = ScannerpCacheFind( bucket, Key );
+
+        if (entry != NULL) {
+
+            //
+            //  Another thread scanned the file at the same time.
+            //
+
+            RemoveEntryList( &entry->LruLinks );
+            freeEntry = newEntry;
+
+        } else {
+
+            if (cache->Entries >= cache->MaxEntries) {
+
+                //
+                //  Reuse the least recently used verdict.
+                //
+
+                entry = CONTAINING_RECORD( cache->Lru.Blink, SCANNER_CACHE_ENTRY, LruLinks );
+
+                RemoveEntryList( &entry->LruLinks );
+                RemoveEntryList( &entry->HashLinks );
+
+                cache->Evictions++;
+                freeEntry = newEntry;
+
+            } else {
+
+                entry = newEntry;
+                cache->Entries++;
+            }
+
+            entry->Key = *Key;
+            InsertHeadList( &bucket->Entries, &entry->HashLinks );
+        }
+
+        entry->Stamp = *Stamp;
+        entry->SafeToOpen = SafeToOpen;
+
+        InsertHeadList( &cache->Lru, &entry->LruLinks );
+    }
+
+    KeReleaseSpinLock( &cache->Lock, oldIrql );
+
+    if (freeEntry != NULL) {
+
+        ExFreeToNPagedLookasideList( &cache->EntryList, freeEntry );
+    }
+}
+
+
+VOID
+ScannerCacheInvalidate (
+    _In_ PSCANNER_CACHE_KEY Key
+    )
+/*++
+
+Routine Description:
+
+    This routine drops the verdict for a file that is about to change, and
+    makes sure a scan that is already under way won't cache one for it.
+
+    This is called for every write, so it can be called at APC_LEVEL.
+
+Arguments:
+
+    Key - The file's cache key.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PSCANNER_VERDICT_CACHE cache = &ScannerData.VerdictCache;
+    PSCANNER_CACHE_BUCKET bucket;
+    PSCANNER_CACHE_ENTRY entry;
+    KIRQL oldIrql;
+
+    bucket = ScannerpCacheBucket( Key );
+
+    KeAcquireSpinLock( &cache->Lock, &oldIrql );
+
+    bucket->Sequence++;
+
+    entry = ScannerpCacheFind( bucket, Key );
+
+    if (entry != NULL) {
+
+        RemoveEntryList( &entry->HashLinks );
+        RemoveEntryList( &entry->LruLinks );
+
+        cache->Entries--;
+        cache->Invalidations++;
+    }
+
+    KeReleaseSpinLock( &cache->Lock, oldIrql );
+
+    if (entry != NULL) {
+
+        ExFreeToNPagedLookasideList( &cache->EntryList, entry );
+    }
+}
+
+
+VOID
+ScannerCacheInvalidateVolume (
+    _In_ PFLT_VOLUME Volume
+    )
+/*++
+
+Routine Description:
+
+    This routine drops every verdict for files on a volume we are detaching
+    from, since the volume's address may be reused for another volume.
+
+Arguments:
+
+    Volume - The volume.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PSCANNER_VERDICT_CACHE cache = &ScannerData.VerdictCache;
+    PSCANNER_CACHE_ENTRY entry;
+    PLIST_ENTRY links, next;
+    LIST_ENTRY freeList;
+    KIRQL oldIrql;
+    ULONG i;
+
+    InitializeListHead( &freeList );
+
+    KeAcquireSpinLock( &cache->Lock, &oldIrql );
+
+    for (i = 0; i < SCANNER_CACHE_BUCKETS; i++) {
+
+        cache->Buckets[i].Sequence++;
+    }
+
+    for (links = cache->Lru.Flink; links != &cache->Lru; links = next) {
+
+        next = links->Flink;
+
+        entry = CONTAINING_RECORD( links, SCANNER_CACHE_ENTRY, LruLinks );
+
+        if (entry->Key.Volume == Volume) {
+
+            RemoveEntryList( &entry->HashLinks );
+            RemoveEntryList( &entry->LruLinks );
+            InsertTailList( &freeList, &entry->LruLinks );
+
+            cache->Entries--;
+        }
+    }
+
+    KeReleaseSpinLock( &cache->Lock, oldIrql );
+
+    ScannerpCacheFreeEntries( &freeList );
+}
+
+
+VOID
+ScannerCacheFlush (
+    VOID
+    )
+/*++
+
+Routine Description:
+
+    This routine drops every verdict.  It is used when the user mode scanner
+    connects or disconnects, since a different scanner may not agree with
+    the verdicts of the last one.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PSCANNER_VERDICT_CACHE cache = &ScannerData.VerdictCache;
+    LIST_ENTRY freeList;
+    KIRQL oldIrql;
+    ULONG i;
+
+    InitializeListHead( &freeList );
+
+    KeAcquireSpinLock( &cache->Lock, &oldIrql );
+
+    for (i = 0; i < SCANNER_CACHE_BUCKETS; i++) {
+
+        cache->Buckets[i].Sequence++;
+        InitializeListHead( &cache->Buckets[i].Entries );
+    }
+
+    //
+    //  Move the whole LRU list onto our local list.
+    //
+
+    if (!IsListEmpty( &cache->Lru )) {
+
+        freeList.Flink = cache->Lru.Flink;
+        freeList.Blink = cache->Lru.Blink;
+        freeList.Flink->Blink = &freeList;
+        freeList.Blink->Flink = &freeList;
+
+        InitializeListHead( &cache->Lru );
+    }
+
+    cache->Entries = 0;
+
+    KeReleaseSpinLock( &cache->Lock, oldIrql );
+
+    ScannerpCacheFreeEntries( &freeList );
+}
+
+
+VOID
+ScannerCacheQueryStatistics (
+    _Out_ PSCANNER_CACHE_STATISTICS Statistics
+    )
+/*++
+
+Routine Description:
+
+    This routine returns the cache counters.
+
+Arguments:
+
+    Statistics - Receives the counters.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PSCANNER_VERDICT_CACHE cache = &ScannerData.VerdictCache;
+    KIRQL oldIrql;
+
+    KeAcquireSpinLock( &cache->Lock, &oldIrql );
+
+    Statistics->Hits = cache->Hits;
+    Statistics->Misses = cache->Misses;
+    Statistics->Evictions = cache->Evictions;
+    Statistics->Invalidations = cache->Invalidations;
+    Statistics->Entries = cache->Entries;
+    Statistics->MaxEntries = cache->MaxEntries;
+
+    KeReleaseSpinLock( &cache->Lock, oldIrql );
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+//  Local support routines.
+//
+/////////////////////////////////////////////////////////////////////////
+
+PSCANNER_CACHE_BUCKET
+ScannerpCacheBucket (
+    _In_ PSCANNER_CACHE_KEY Key
+    )
+/*++
+
+Routine Description:
+
+    This routine returns the hash bucket for a cache key.
+
+Arguments:
+
+    Key - The cache key.
+
+Return Value:
+
+    The bucket.
+
+--*/
+{
+    ULONG hash;
+
+    hash = Key->FileId.LowPart ^
+           (ULONG) Key->FileId.HighPart ^
+           (ULONG)((ULONG_PTR) Key->Volume >> 4);
+
+    //
+    //  File IDs are often allocated sequentially, so spread the bits out
+    //  before taking the top ones.
+    //
+
+    hash *= 0x9E3779B1;
+
+    return &ScannerData.VerdictCache.Buckets[hash >> (32 - SCANNER_CACHE_BUCKET_SHIFT)];
+}
+
+
+PSCANNER_CACHE_ENTRY
+ScannerpCacheFind (
+    _In_ PSCANNER_CACHE_BUCKET Bucket,
+    _In_ PSCANNER_CACHE_KEY Key
+    )
+/*++
+
+Routine Description:
+
+    This routine finds the verdict for a key in its bucket.  The caller
+    holds the cache lock.
+
+Arguments:
+
+    Bucket - The bucket for Key.
+
+    Key - The cache key.
+
+Return Value:
+
+    The verdict, or NULL if there isn't one.
+
+--*/
+{
+    PSCANNER_CACHE_ENTRY entry;
+    PLIST_ENTRY links;
+
+    for (links = Bucket->Entries.Flink; links != &Bucket->Entries; links = links->Flink) {
+
+        entry = CONTAINING_RECORD( links, SCANNER_CACHE_ENTRY, HashLinks );
+
+        if ((entry->Key.FileId.QuadPart == Key->FileId.QuadPart) &&
+            (entry->Key.Volume == Key->Volume)) {
+
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+
+VOID
+ScannerpCacheFreeEntries (
+    _Inout_ PLIST_ENTRY List
+    )
+/*++
+
+Routine Description:
+
+    This routine frees a list of verdicts linked through their LruLinks.
+
+Arguments:
+
+    List - The list.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PSCANNER_CACHE_ENTRY entry;
+
+    while (!IsListEmpty( List )) {
+
+        entry = CONTAINING_RECORD( RemoveHeadList( List ), SCANNER_CACHE_ENTRY, LruLinks );
+
+        ExFreeToNPagedLookasideList( &ScannerData.VerdictCache.EntryList, entry );
+    }
+}
+
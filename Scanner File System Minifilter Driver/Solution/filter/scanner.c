@@ -59,6 +59,11 @@ ScannerInitializeScannedExtensions(
     _In_ PUNICODE_STRING RegistryPath
     );
 
+VOID
+ScannerInitializeScanLimit(
+    _In_ PUNICODE_STRING RegistryPath
+    );
+
 VOID
 ScannerFreeExtensions(
     );
@@ -87,6 +92,23 @@ ScannerPortDisconnect (
     _In_opt_ PVOID ConnectionCookie
     );
 
+NTSTATUS
+ScannerMessage (
+    _In_ PVOID ConnectionCookie,
+    _In_reads_bytes_opt_(InputBufferSize) PVOID InputBuffer,
+    _In_ ULONG InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize,*ReturnOutputBufferLength) PVOID OutputBuffer,
+    _In_ ULONG OutputBufferSize,
+    _Out_ PULONG ReturnOutputBufferLength
+    );
+
+NTSTATUS
+ScannerpScanFile (
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _Out_opt_ PSCANNER_CACHE_KEY Key,
+    _Out_ PBOOLEAN SafeToOpen
+    );
+
 NTSTATUS
 ScannerpScanFileInUserMode (
     _In_ PFLT_INSTANCE Instance,
@@ -106,10 +128,13 @@ ScannerpCheckExtension (
 #ifdef ALLOC_PRAGMA
     #pragma alloc_text(INIT, DriverEntry)
     #pragma alloc_text(INIT, ScannerInitializeScannedExtensions)    
+    #pragma alloc_text(INIT, ScannerInitializeScanLimit)
     #pragma alloc_text(PAGE, ScannerInstanceSetup)
     #pragma alloc_text(PAGE, ScannerPreCreate)
     #pragma alloc_text(PAGE, ScannerPortConnect)
     #pragma alloc_text(PAGE, ScannerPortDisconnect)
+    #pragma alloc_text(PAGE, ScannerMessage)
+    #pragma alloc_text(PAGE, ScannerInstanceTeardownComplete)
     #pragma alloc_text(PAGE, ScannerFreeExtensions)    
     #pragma alloc_text(PAGE, ScannerAllocateUnicodeString)
     #pragma alloc_text(PAGE, ScannerFreeUnicodeString)
@@ -139,6 +164,11 @@ const FLT_OPERATION_REGISTRATION Callbacks[] = {
       ScannerPreWrite,
       NULL},
 
+    { IRP_MJ_SET_INFORMATION,
+      0,
+      ScannerPreSetInformation,
+      NULL},
+
 #if (WINVER>=0x0602)
 
     { IRP_MJ_FILE_SYSTEM_CONTROL,
@@ -175,7 +205,7 @@ const FLT_REGISTRATION FilterRegistration = {
     ScannerInstanceSetup,               //  InstanceSetup
     ScannerQueryTeardown,               //  InstanceQueryTeardown
     NULL,                               //  InstanceTeardownStart
-    NULL,                               //  InstanceTeardownComplete
+    ScannerInstanceTeardownComplete,    //  InstanceTeardownComplete
     NULL,                               //  GenerateFileName
     NULL,                               //  GenerateDestinationFileName
     NULL                                //  NormalizeNameComponent
@@ -224,6 +254,8 @@ Return Value:
     
     ExInitializeDriverRuntime( DrvRtPoolNxOptIn );
 
+    ScannerCacheInitialize();
+
     //
     //  Register with filter manager.
     //
@@ -235,6 +267,7 @@ Return Value:
 
     if (!NT_SUCCESS( status )) {
 
+        ScannerCacheFree();
         return status;
     }
 
@@ -252,6 +285,8 @@ Return Value:
         ScannedExtensionCount = 1;    
     }    
 
+    ScannerInitializeScanLimit( RegistryPath );
+
     //
     //  Create a communication port.
     //
@@ -278,7 +313,7 @@ Return Value:
                                              NULL,
                                              ScannerPortConnect,
                                              ScannerPortDisconnect,
-                                             NULL,
+                                             ScannerMessage,
                                              1 );
         //
         //  Free the security descriptor in all cases. It is not needed once
@@ -307,6 +342,8 @@ Return Value:
     ScannerFreeExtensions();
 
     FltUnregisterFilter( ScannerData.Filter );
+
+    ScannerCacheFree();
     
     return status;
 }
@@ -494,6 +531,75 @@ ScannerInitializeScannedExtensionsCleanup:
 }
 
 
+VOID
+ScannerInitializeScanLimit(
+    _In_ PUNICODE_STRING RegistryPath
+    )
+/*++
+
+Routine Descrition:
+
+    This routine sets how much of a file is scanned on create and cleanup
+    from the MaxScanBytes registry value, or to the default if the value
+    is missing.
+
+Arguments:
+
+    RegistryPath - The path key passed to the driver during DriverEntry.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    NTSTATUS status;
+    OBJECT_ATTRIBUTES attributes;
+    HANDLE driverRegKey;
+    UNICODE_STRING valueName;
+    UCHAR valueBuffer[sizeof( KEY_VALUE_PARTIAL_INFORMATION ) + sizeof( ULONG )];
+    PKEY_VALUE_PARTIAL_INFORMATION value = (PKEY_VALUE_PARTIAL_INFORMATION) valueBuffer;
+    ULONG valueLength;
+
+    PAGED_CODE();
+
+    ScannerData.MaxScanBytes = SCANNER_DEFAULT_MAX_SCAN_BYTES;
+
+    InitializeObjectAttributes( &attributes,
+                                RegistryPath,
+                                OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                                NULL,
+                                NULL );
+
+    status = ZwOpenKey( &driverRegKey,
+                        KEY_READ,
+                        &attributes );
+
+    if (!NT_SUCCESS( status )) {
+
+        return;
+    }
+
+    RtlInitUnicodeString( &valueName, L"MaxScanBytes" );
+
+    status = ZwQueryValueKey( driverRegKey,
+                              &valueName,
+                              KeyValuePartialInformation,
+                              value,
+                              sizeof( valueBuffer ),
+                              &valueLength );
+
+    if (NT_SUCCESS( status ) &&
+        (value->Type == REG_DWORD) &&
+        (value->DataLength == sizeof( ULONG ))) {
+
+        ScannerData.MaxScanBytes = *((PULONG) value->Data);
+    }
+
+    ZwClose( driverRegKey );
+}
+
+
 VOID
 ScannerFreeExtensions(
     )
@@ -670,6 +776,12 @@ Return Value
     ScannerData.UserProcess = PsGetCurrentProcess();
     ScannerData.ClientPort = ClientPort;
 
+    //
+    //  The new scanner may not agree with verdicts cached for the last one.
+    //
+
+    ScannerCacheFlush();
+
     DbgPrint( "!!! scanner.sys --- connected, port=0x%p\n", ClientPort );
 
     return STATUS_SUCCESS;
@@ -715,6 +827,126 @@ Return value
     //
 
     ScannerData.UserProcess = NULL;
+
+    //
+    //  Nothing is scanned until the next connect, so don't hand out
+    //  verdicts until then either.
+    //
+
+    ScannerCacheFlush();
+}
+
+
+NTSTATUS
+ScannerMessage (
+    _In_ PVOID ConnectionCookie,
+    _In_reads_bytes_opt_(InputBufferSize) PVOID InputBuffer,
+    _In_ ULONG InputBufferSize,
+    _Out_writes_bytes_to_opt_(OutputBufferSize,*ReturnOutputBufferLength) PVOID OutputBuffer,
+    _In_ ULONG OutputBufferSize,
+    _Out_ PULONG ReturnOutputBufferLength
+    )
+/*++
+
+Routine Description
+
+    This is called when user-mode sends the filter a SCANNER_COMMAND_MESSAGE
+    with FilterSendMessage.
+
+Arguments
+
+    ConnectionCookie - Context from the port connect routine
+
+    InputBuffer - The raw user mode command message.
+
+    InputBufferSize - The size in bytes of the InputBuffer.
+
+    OutputBuffer - The raw user mode buffer for the command's result.
+
+    OutputBufferSize - The size in bytes of the OutputBuffer.
+
+    ReturnOutputBufferLength - Receives how much of OutputBuffer was filled.
+
+Return Value
+
+    The status of the command.
+
+--*/
+{
+    SCANNER_COMMAND command;
+    SCANNER_CACHE_STATISTICS statistics;
+    NTSTATUS status;
+
+    UNREFERENCED_PARAMETER( ConnectionCookie );
+
+    PAGED_CODE();
+
+    *ReturnOutputBufferLength = 0;
+
+    if ((InputBuffer == NULL) ||
+        (InputBufferSize < sizeof( SCANNER_COMMAND_MESSAGE ))) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    //  Filter manager has probed the buffers, but they are still raw user
+    //  mode addresses, so they must only be touched under try/except.
+    //
+
+    try {
+
+        command = ((PSCANNER_COMMAND_MESSAGE) InputBuffer)->Command;
+
+    } except( EXCEPTION_EXECUTE_HANDLER ) {
+
+        return GetExceptionCode();
+    }
+
+    switch (command) {
+
+    case ScannerGetCacheStatistics:
+
+        if ((OutputBuffer == NULL) ||
+            (OutputBufferSize < sizeof( SCANNER_CACHE_STATISTICS ))) {
+
+            status = STATUS_BUFFER_TOO_SMALL;
+            break;
+        }
+
+        ScannerCacheQueryStatistics( &statistics );
+
+        //
+        //  Copy rather than assign, so we don't care how the caller's
+        //  buffer is aligned.
+        //
+
+        try {
+
+            RtlCopyMemory( OutputBuffer, &statistics, sizeof( statistics ) );
+
+        } except( EXCEPTION_EXECUTE_HANDLER ) {
+
+            return GetExceptionCode();
+        }
+
+        *ReturnOutputBufferLength = sizeof( statistics );
+        status = STATUS_SUCCESS;
+        break;
+
+    case ScannerFlushCache:
+
+        ScannerCacheFlush();
+        status = STATUS_SUCCESS;
+        break;
+
+    default:
+
+        status = STATUS_INVALID_PARAMETER;
+        break;
+    }
+
+    return status;
 }
 
 
@@ -756,6 +988,8 @@ Return Value:
 
     FltUnregisterFilter( ScannerData.Filter );
 
+    ScannerCacheFree();
+
     return STATUS_SUCCESS;
 }
 
@@ -848,6 +1082,39 @@ Return Value:
 }
 
 
+VOID
+ScannerInstanceTeardownComplete (
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ FLT_INSTANCE_TEARDOWN_FLAGS Flags
+    )
+/*++
+
+Routine Description:
+
+    This is called when an instance is gone.  Verdicts for files on its
+    volume are keyed by the volume's address, which may be reused, so they
+    are dropped.
+
+Arguments:
+
+    FltObjects - Describes the instance and volume being torn down.
+
+    Flags - Unused
+
+Return Value:
+
+    None.
+
+--*/
+{
+    UNREFERENCED_PARAMETER( Flags );
+
+    PAGED_CODE();
+
+    ScannerCacheInvalidateVolume( FltObjects->Volume );
+}
+
+
 FLT_PREOP_CALLBACK_STATUS
 ScannerPreCreate (
     _Inout_ PFLT_CALLBACK_DATA Data,
@@ -988,6 +1255,7 @@ Return Value:
     PSCANNER_STREAM_HANDLE_CONTEXT scannerContext;
     FLT_POSTOP_CALLBACK_STATUS returnStatus = FLT_POSTOP_FINISHED_PROCESSING;
     PFLT_FILE_NAME_INFORMATION nameInfo;
+    SCANNER_CACHE_KEY key;
     NTSTATUS status;
     BOOLEAN safeToOpen, scanFile;
 
@@ -1041,9 +1309,7 @@ Return Value:
         return FLT_POSTOP_FINISHED_PROCESSING;
     }
 
-    (VOID) ScannerpScanFileInUserMode( FltObjects->Instance,
-                                       FltObjects->FileObject,
-                                       &safeToOpen );
+    (VOID) ScannerpScanFile( FltObjects, &key, &safeToOpen );
 
     if (!safeToOpen) {
 
@@ -1083,6 +1349,7 @@ Return Value:
             //
 
             scannerContext->RescanRequired = TRUE;
+            scannerContext->Key = key;
 
             (VOID) FltSetStreamHandleContext( FltObjects->Instance,
                                               FltObjects->FileObject,
@@ -1122,7 +1389,7 @@ ScannerPreCleanup (
 Routine Description:
 
     Pre cleanup callback.  If this file was opened for write access, we want
-    to rescan it now.
+    to rescan it now, unless it wasn't written after all.
 
 Arguments:
 
@@ -1155,9 +1422,7 @@ Return Value:
 
         if (context->RescanRequired) {
 
-            (VOID) ScannerpScanFileInUserMode( FltObjects->Instance,
-                                               FltObjects->FileObject,
-                                               &safe );
+            (VOID) ScannerpScanFile( FltObjects, NULL, &safe );
 
             if (!safe) {
 
@@ -1183,7 +1448,8 @@ ScannerPreWrite (
 
 Routine Description:
 
-    Pre write callback.  We want to scan what's being written now.
+    Pre write callback.  We want to scan what's being written now.  The
+    file's cached verdict, if any, is no longer any good.
 
 Arguments:
 
@@ -1206,6 +1472,7 @@ Return Value:
     PSCANNER_NOTIFICATION notification = NULL;
     PSCANNER_STREAM_HANDLE_CONTEXT context = NULL;
     ULONG replyLength;
+    ULONG bytesToScan;
     BOOLEAN safe = TRUE;
     PUCHAR buffer;
 
@@ -1233,6 +1500,18 @@ Return Value:
         return FLT_PREOP_SUCCESS_NO_CALLBACK;
     }
 
+    //
+    //  Do this before the write goes down, so a scan that reads the file
+    //  while it is being written doesn't cache its verdict.  Writes through
+    //  other file objects, such as paged writes of a mapped view, are only
+    //  caught when they change the file's stamp.
+    //
+
+    if (context->Key.Volume != NULL) {
+
+        ScannerCacheInvalidate( &context->Key );
+    }
+
     //
     //  Use try-finally to cleanup
     //
@@ -1283,8 +1562,15 @@ Return Value:
             //  This is just a sample!
             //
 
+            //
+            //  Only allocate and send as much as we are going to scan.
+            //
+
+            bytesToScan = min( Data->Iopb->Parameters.Write.Length, SCANNER_READ_BUFFER_SIZE );
+
             notification = ExAllocatePoolWithTag( NonPagedPool,
-                                                  sizeof( SCANNER_NOTIFICATION ),
+                                                  max( FIELD_OFFSET( SCANNER_NOTIFICATION, Contents ) + bytesToScan,
+                                                       sizeof( SCANNER_REPLY ) ),
                                                   'nacS' );
             if (notification == NULL) {
 
@@ -1294,7 +1580,8 @@ Return Value:
                 leave;
             }
 
-            notification->BytesToScan = min( Data->Iopb->Parameters.Write.Length, SCANNER_READ_BUFFER_SIZE );
+            notification->BytesToScan = bytesToScan;
+            notification->ScanState = 0;
 
             //
             //  The buffer can be a raw user buffer. Protect access to it
@@ -1329,7 +1616,7 @@ Return Value:
             status = FltSendMessage( ScannerData.Filter,
                                      &ScannerData.ClientPort,
                                      notification,
-                                     sizeof( SCANNER_NOTIFICATION ),
+                                     FIELD_OFFSET( SCANNER_NOTIFICATION, Contents ) + bytesToScan,
                                      notification,
                                      &replyLength,
                                      NULL );
@@ -1386,6 +1673,101 @@ Return Value:
     return returnStatus;
 }
 
+
+FLT_PREOP_CALLBACK_STATUS
+ScannerPreSetInformation (
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _Flt_CompletionContext_Outptr_ PVOID *CompletionContext
+    )
+/*++
+
+Routine Description:
+
+    Pre set information callback.  Renaming, truncating or deleting a file
+    drops its cached verdict.  Some file systems, FAT for one, derive file
+    IDs from where the file's name lives, so after a rename or delete the
+    same ID can belong to another file.
+
+Arguments:
+
+    Data - The structure which describes the operation parameters.
+
+    FltObject - The structure which describes the objects affected by this
+        operation.
+
+    CompletionContext - Output parameter which can be used to pass a context
+        from this callback to the post-set information callback.
+
+Return Value:
+
+    Always FLT_PREOP_SUCCESS_NO_CALLBACK.
+
+--*/
+{
+    PSCANNER_STREAM_HANDLE_CONTEXT context = NULL;
+    SCANNER_CACHE_KEY key;
+    NTSTATUS status;
+
+    UNREFERENCED_PARAMETER( CompletionContext );
+
+    switch (Data->Iopb->Parameters.SetFileInformation.FileInformationClass) {
+
+    case FileRenameInformation:
+    case FileDispositionInformation:
+    case FileEndOfFileInformation:
+    case FileAllocationInformation:
+
+        break;
+
+    default:
+
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
+
+    //
+    //  The cache is empty while nobody is connected.  Paging sets of the
+    //  end of file come from writes, which have already invalidated it.
+    //
+
+    if ((ScannerData.ClientPort == NULL) ||
+        FlagOn( Data->Iopb->IrpFlags, IRP_PAGING_IO )) {
+
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
+
+    //
+    //  Handles we rescan at cleanup already know the key.
+    //
+
+    status = FltGetStreamHandleContext( FltObjects->Instance,
+                                        FltObjects->FileObject,
+                                        &context );
+
+    if (NT_SUCCESS( status )) {
+
+        key = context->Key;
+        FltReleaseContext( context );
+
+        status = (key.Volume != NULL) ? STATUS_SUCCESS : STATUS_NOT_SUPPORTED;
+
+    } else {
+
+        status = ScannerCacheQueryFile( FltObjects->Instance,
+                                        FltObjects->Volume,
+                                        FltObjects->FileObject,
+                                        &key,
+                                        NULL );
+    }
+
+    if (NT_SUCCESS( status )) {
+
+        ScannerCacheInvalidate( &key );
+    }
+
+    return FLT_PREOP_SUCCESS_NO_CALLBACK;
+}
+
 #if (WINVER>=0x0602)
 
 FLT_PREOP_CALLBACK_STATUS
@@ -1493,6 +1875,94 @@ Return Value:
 //
 /////////////////////////////////////////////////////////////////////////
 
+NTSTATUS
+ScannerpScanFile (
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _Out_opt_ PSCANNER_CACHE_KEY Key,
+    _Out_ PBOOLEAN SafeToOpen
+    )
+/*++
+
+Routine Description:
+
+    This routine tells our caller whether it's safe to open a file.  If the
+    file hasn't changed since it was last scanned, the cached verdict is
+    used.  Otherwise the file is scanned in user mode, and the verdict is
+    cached if the scan succeeded.
+
+Arguments:
+
+    FltObjects - The instance, volume and file to be scanned.
+
+    Key - If present, receives the file's cache key.  Key->Volume is set to
+          NULL if the file's verdict can't be cached.
+
+    SafeToOpen - Set to FALSE if the file contains foul language.
+
+Return Value:
+
+    The status of the scan, see ScannerpScanFileInUserMode.
+
+--*/
+{
+    SCANNER_CACHE_KEY key;
+    SCANNER_CACHE_STAMP stamp;
+    ULONG sequence = 0;
+    NTSTATUS status, cacheStatus;
+
+    *SafeToOpen = TRUE;
+
+    if (ARGUMENT_PRESENT( Key )) {
+
+        Key->Volume = NULL;
+    }
+
+    //
+    //  If not client port just return.
+    //
+
+    if (ScannerData.ClientPort == NULL) {
+
+        return STATUS_PORT_DISCONNECTED;
+    }
+
+    //
+    //  The stamp has to be taken before the file is read, so that a change
+    //  made during the scan makes the verdict stale.
+    //
+
+    cacheStatus = ScannerCacheQueryFile( FltObjects->Instance,
+                                         FltObjects->Volume,
+                                         FltObjects->FileObject,
+                                         &key,
+                                         &stamp );
+
+    if (NT_SUCCESS( cacheStatus )) {
+
+        if (ARGUMENT_PRESENT( Key )) {
+
+            *Key = key;
+        }
+
+        if (ScannerCacheLookup( &key, &stamp, SafeToOpen, &sequence )) {
+
+            return STATUS_SUCCESS;
+        }
+    }
+
+    status = ScannerpScanFileInUserMode( FltObjects->Instance,
+                                         FltObjects->FileObject,
+                                         SafeToOpen );
+
+    if (NT_SUCCESS( status ) && NT_SUCCESS( cacheStatus )) {
+
+        ScannerCacheInsert( &key, &stamp, *SafeToOpen, sequence );
+    }
+
+    return status;
+}
+
+
 NTSTATUS
 ScannerpScanFileInUserMode (
     _In_ PFLT_INSTANCE Instance,
@@ -1506,6 +1976,14 @@ Routine Description:
     This routine is called to send a request up to user mode to scan a given
     file and tell our caller whether it's safe to open this file.
 
+    The file is scanned one SCANNER_READ_BUFFER_SIZE chunk per message.
+    Each message carries the scan state user mode returned for the chunk
+    before it, so signatures that span chunks are found.  We stop at the
+    first chunk user mode doesn't like, at the end of the file, or after
+    ScannerData.MaxScanBytes if that isn't zero.  The caller waits for all
+    of this, so the rest of a file larger than the limit is not scanned and
+    the verdict is that of its start.
+
     Note that if the scan fails, we set SafeToOpen to TRUE.  The scan may fail
     because the service hasn't started, or perhaps because this create/cleanup
     is for a directory, and there's no data to read & scan.
@@ -1537,6 +2015,10 @@ Return Value:
     FLT_VOLUME_PROPERTIES volumeProps;
     LARGE_INTEGER offset;
     ULONG replyLength, length;
+    ULONG bytesSent, bytesToScan;
+    ULONG scanState = 0;
+    ULONG maxScanBytes = ScannerData.MaxScanBytes;
+    ULONGLONG bytesLeft;
     PFLT_VOLUME volume = NULL;
 
     *SafeToOpen = TRUE;
@@ -1547,7 +2029,7 @@ Return Value:
 
     if (ScannerData.ClientPort == NULL) {
 
-        return STATUS_SUCCESS;
+        return STATUS_PORT_DISCONNECTED;
     }
 
     try {
@@ -1611,55 +2093,110 @@ Return Value:
         }
 
         //
-        //  Read the beginning of the file and pass the contents to user mode.
+        //  Read the file and pass the contents to user mode, until we reach
+        //  the end of the file or the scan limit, or user mode finds
+        //  something.
         //
 
-        offset.QuadPart = bytesRead = 0;
-        status = FltReadFile( Instance,
-                              FileObject,
-                              &offset,
-                              length,
-                              buffer,
-                              FLTFL_IO_OPERATION_NON_CACHED |
-                              FLTFL_IO_OPERATION_DO_NOT_UPDATE_BYTE_OFFSET,
-                              &bytesRead,
-                              NULL,
-                              NULL );
+        offset.QuadPart = 0;
+        bytesLeft = (maxScanBytes != 0) ? maxScanBytes : MAXULONGLONG;
+
+        for (;;) {
 
-        if (NT_SUCCESS( status ) && (0 != bytesRead)) {
+            if (bytesLeft == 0) {
 
-            notification->BytesToScan = (ULONG) bytesRead;
+                leave;
+            }
+
+            bytesRead = 0;
+            status = FltReadFile( Instance,
+                                  FileObject,
+                                  &offset,
+                                  length,
+                                  buffer,
+                                  FLTFL_IO_OPERATION_NON_CACHED |
+                                  FLTFL_IO_OPERATION_DO_NOT_UPDATE_BYTE_OFFSET,
+                                  &bytesRead,
+                                  NULL,
+                                  NULL );
+
+            if (status == STATUS_END_OF_FILE) {
+
+                status = STATUS_SUCCESS;
+                leave;
+            }
+
+            if (!NT_SUCCESS( status ) || (0 == bytesRead)) {
+
+                leave;
+            }
 
             //
-            //  Copy only as much as the buffer can hold
+            //  The read can be bigger than a message if the sector size is.
             //
 
-            RtlCopyMemory( &notification->Contents,
-                           buffer,
-                           min( notification->BytesToScan, SCANNER_READ_BUFFER_SIZE ) );
+            for (bytesSent = 0; bytesSent < bytesRead; bytesSent += bytesToScan) {
 
-            replyLength = sizeof( SCANNER_REPLY );
+                if (bytesLeft == 0) {
 
-            status = FltSendMessage( ScannerData.Filter,
-                                     &ScannerData.ClientPort,
-                                     notification,
-                                     sizeof(SCANNER_NOTIFICATION),
-                                     notification,
-                                     &replyLength,
-                                     NULL );
+                    leave;
+                }
 
-            if (STATUS_SUCCESS == status) {
+                bytesToScan = min( bytesRead - bytesSent, SCANNER_READ_BUFFER_SIZE );
 
-                *SafeToOpen = ((PSCANNER_REPLY) notification)->SafeToOpen;
+                if (bytesToScan > bytesLeft) {
 
-            } else {
+                    bytesToScan = (ULONG) bytesLeft;
+                }
 
-                //
-                //  Couldn't send message
-                //
+                bytesLeft -= bytesToScan;
+
+                notification->BytesToScan = bytesToScan;
+                notification->ScanState = scanState;
 
-                DbgPrint( "!!! scanner.sys --- couldn't send message to user-mode to scan file, status 0x%X\n", status );
+                RtlCopyMemory( &notification->Contents,
+                               (PUCHAR) buffer + bytesSent,
+                               bytesToScan );
+
+                replyLength = sizeof( SCANNER_REPLY );
+
+                status = FltSendMessage( ScannerData.Filter,
+                                         &ScannerData.ClientPort,
+                                         notification,
+                                         FIELD_OFFSET( SCANNER_NOTIFICATION, Contents ) + bytesToScan,
+                                         notification,
+                                         &replyLength,
+                                         NULL );
+
+                if (STATUS_SUCCESS != status) {
+
+                    //
+                    //  Couldn't send message
+                    //
+
+                    DbgPrint( "!!! scanner.sys --- couldn't send message to user-mode to scan file, status 0x%X\n", status );
+                    leave;
+                }
+
+                if (!((PSCANNER_REPLY) notification)->SafeToOpen) {
+
+                    *SafeToOpen = FALSE;
+                    leave;
+                }
+
+                scanState = ((PSCANNER_REPLY) notification)->ScanState;
+            }
+
+            //
+            //  A short read means we have reached the end of the file.
+            //
+
+            if (bytesRead < length) {
+
+                leave;
             }
+
+            offset.QuadPart += bytesRead;
         }
 
     } finally {
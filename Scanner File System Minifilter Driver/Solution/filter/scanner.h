@@ -20,6 +20,103 @@ Environment:
 #define __SCANNER_H__
 
 
+///////////////////////////////////////////////////////////////////////////
+//
+//  Verdict cache
+//
+///////////////////////////////////////////////////////////////////////////
+
+//
+//  Number of hash buckets, as a shift, and the most verdicts kept.
+//
+
+#define SCANNER_CACHE_BUCKET_SHIFT    8
+#define SCANNER_CACHE_BUCKETS         (1 << SCANNER_CACHE_BUCKET_SHIFT)
+#define SCANNER_CACHE_MAX_ENTRIES     4096
+
+//
+//  How much of a file is scanned when it is opened or closed, unless the
+//  MaxScanBytes registry value says otherwise.  Zero scans whole files.
+//
+
+#define SCANNER_DEFAULT_MAX_SCAN_BYTES  (64 * 1024 * 1024)
+
+typedef struct _SCANNER_CACHE_KEY {
+
+    PFLT_VOLUME Volume;
+    LARGE_INTEGER FileId;
+
+} SCANNER_CACHE_KEY, *PSCANNER_CACHE_KEY;
+
+//
+//  A verdict is only good while the file's stamp is unchanged.
+//
+
+typedef struct _SCANNER_CACHE_STAMP {
+
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER EndOfFile;
+
+} SCANNER_CACHE_STAMP, *PSCANNER_CACHE_STAMP;
+
+typedef struct _SCANNER_CACHE_ENTRY {
+
+    //
+    //  Links in the hash bucket and in the LRU list.
+    //
+
+    LIST_ENTRY HashLinks;
+    LIST_ENTRY LruLinks;
+
+    SCANNER_CACHE_KEY Key;
+    SCANNER_CACHE_STAMP Stamp;
+
+    BOOLEAN SafeToOpen;
+
+} SCANNER_CACHE_ENTRY, *PSCANNER_CACHE_ENTRY;
+
+typedef struct _SCANNER_CACHE_BUCKET {
+
+    LIST_ENTRY Entries;
+
+    //
+    //  Bumped whenever a file that hashes here is invalidated.  A verdict
+    //  is only inserted if this didn't change while the file was scanned.
+    //
+
+    ULONG Sequence;
+
+} SCANNER_CACHE_BUCKET, *PSCANNER_CACHE_BUCKET;
+
+typedef struct _SCANNER_VERDICT_CACHE {
+
+    //
+    //  Protects everything below.
+    //
+
+    KSPIN_LOCK Lock;
+
+    //
+    //  Every verdict, most recently used first.
+    //
+
+    LIST_ENTRY Lru;
+
+    ULONG Entries;
+    ULONG MaxEntries;
+
+    ULONGLONG Hits;
+    ULONGLONG Misses;
+    ULONGLONG Evictions;
+    ULONGLONG Invalidations;
+
+    NPAGED_LOOKASIDE_LIST EntryList;
+
+    SCANNER_CACHE_BUCKET Buckets[SCANNER_CACHE_BUCKETS];
+
+} SCANNER_VERDICT_CACHE, *PSCANNER_VERDICT_CACHE;
+
 ///////////////////////////////////////////////////////////////////////////
 //
 //  Global variables
@@ -60,6 +157,20 @@ typedef struct _SCANNER_DATA {
 
     PFLT_PORT ClientPort;
 
+    //
+    //  Verdicts for files that have been scanned
+    //
+
+    SCANNER_VERDICT_CACHE VerdictCache;
+
+    //
+    //  Only this many bytes at the start of a file are scanned on create
+    //  and cleanup, or the whole file if it is zero.  The opener waits for
+    //  the scan, so this bounds how long a large file takes to open.
+    //
+
+    ULONG MaxScanBytes;
+
 } SCANNER_DATA, *PSCANNER_DATA;
 
 extern SCANNER_DATA ScannerData;
@@ -67,6 +178,13 @@ extern SCANNER_DATA ScannerData;
 typedef struct _SCANNER_STREAM_HANDLE_CONTEXT {
 
     BOOLEAN RescanRequired;
+
+    //
+    //  Cache key of the file, so writes can invalidate its verdict.
+    //  Key.Volume is NULL if the file's verdict can't be cached.
+    //
+
+    SCANNER_CACHE_KEY Key;
     
 } SCANNER_STREAM_HANDLE_CONTEXT, *PSCANNER_STREAM_HANDLE_CONTEXT;
 
@@ -137,6 +255,13 @@ ScannerPreWrite (
     _Flt_CompletionContext_Outptr_ PVOID *CompletionContext
     );
 
+FLT_PREOP_CALLBACK_STATUS
+ScannerPreSetInformation (
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _Flt_CompletionContext_Outptr_ PVOID *CompletionContext
+    );
+
 #if (WINVER >= 0x0602)
 
 FLT_PREOP_CALLBACK_STATUS
@@ -156,5 +281,74 @@ ScannerInstanceSetup (
     _In_ FLT_FILESYSTEM_TYPE VolumeFilesystemType
     );
 
+VOID
+ScannerInstanceTeardownComplete (
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ FLT_INSTANCE_TEARDOWN_FLAGS Flags
+    );
+
+///////////////////////////////////////////////////////////////////////////
+//
+//  Verdict cache routines.
+//
+//  Implementation in scanCache.c
+//
+///////////////////////////////////////////////////////////////////////////
+
+VOID
+ScannerCacheInitialize (
+    VOID
+    );
+
+VOID
+ScannerCacheFree (
+    VOID
+    );
+
+NTSTATUS
+ScannerCacheQueryFile (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PFLT_VOLUME Volume,
+    _In_ PFILE_OBJECT FileObject,
+    _Out_ PSCANNER_CACHE_KEY Key,
+    _Out_opt_ PSCANNER_CACHE_STAMP Stamp
+    );
+
+BOOLEAN
+ScannerCacheLookup (
+    _In_ PSCANNER_CACHE_KEY Key,
+    _In_ PSCANNER_CACHE_STAMP Stamp,
+    _Out_ PBOOLEAN SafeToOpen,
+    _Out_ PULONG Sequence
+    );
+
+VOID
+ScannerCacheInsert (
+    _In_ PSCANNER_CACHE_KEY Key,
+    _In_ PSCANNER_CACHE_STAMP Stamp,
+    _In_ BOOLEAN SafeToOpen,
+    _In_ ULONG Sequence
+    );
+
+VOID
+ScannerCacheInvalidate (
+    _In_ PSCANNER_CACHE_KEY Key
+    );
+
+VOID
+ScannerCacheInvalidateVolume (
+    _In_ PFLT_VOLUME Volume
+    );
+
+VOID
+ScannerCacheFlush (
+    VOID
+    );
+
+VOID
+ScannerCacheQueryStatistics (
+    _Out_ PSCANNER_CACHE_STATISTICS Statistics
+    );
+
 #endif /* __SCANNER_H__ */
 
@@ -28,12 +28,19 @@ Environment:
 const PWSTR ScannerPortName = L"\\ScannerPort";
 
 
-#define SCANNER_READ_BUFFER_SIZE   1024
+#define SCANNER_READ_BUFFER_SIZE   (64 * 1024)
+
+//
+//  A file is scanned a chunk at a time, in order.  ScanState is zero for
+//  the first chunk of a file, and after that whatever user mode returned
+//  for the chunk before it, so that signatures spanning two chunks are
+//  found.  Only the first BytesToScan bytes of Contents are sent.
+//
 
 typedef struct _SCANNER_NOTIFICATION {
 
     ULONG BytesToScan;
-    ULONG Reserved;             // for quad-word alignement of the Contents structure
+    ULONG ScanState;            // also keeps the Contents quad-word aligned
     UCHAR Contents[SCANNER_READ_BUFFER_SIZE];
     
 } SCANNER_NOTIFICATION, *PSCANNER_NOTIFICATION;
@@ -41,9 +48,56 @@ typedef struct _SCANNER_NOTIFICATION {
 typedef struct _SCANNER_REPLY {
 
     BOOLEAN SafeToOpen;
+    ULONG ScanState;
     
 } SCANNER_REPLY, *PSCANNER_REPLY;
 
+//
+//  Commands user mode can send the filter with FilterSendMessage.
+//
+
+typedef enum _SCANNER_COMMAND {
+
+    //
+    //  Returns a SCANNER_CACHE_STATISTICS.
+    //
+
+    ScannerGetCacheStatistics,
+
+    //
+    //  Drops every cached verdict, for instance because the signatures
+    //  changed.
+    //
+
+    ScannerFlushCache
+
+} SCANNER_COMMAND;
+
+typedef struct _SCANNER_COMMAND_MESSAGE {
+
+    SCANNER_COMMAND Command;
+    ULONG Reserved;
+
+} SCANNER_COMMAND_MESSAGE, *PSCANNER_COMMAND_MESSAGE;
+
+//
+//  The filter remembers the verdict for each file it has scanned, and
+//  doesn't ask user mode again until the file changes.  Hits and Misses
+//  count lookups, Evictions count verdicts dropped to make room and
+//  Invalidations count verdicts dropped because their file changed.
+//
+
+typedef struct _SCANNER_CACHE_STATISTICS {
+
+    ULONGLONG Hits;
+    ULONGLONG Misses;
+    ULONGLONG Evictions;
+    ULONGLONG Invalidations;
+    ULONG Entries;
+    ULONG MaxEntries;
+
+} SCANNER_CACHE_STATISTICS, *PSCANNER_CACHE_STATISTICS;
+
 #endif //  __SCANUK_H__
 
 
@@ -0,0 +1,772 @@
+/*++
+
+Copyright (c) 1999-2002  Microsoft Corporation
+
+Module Name:
+
+    scanEngine.c
+
+Abstract:
+
+    This file contains the pattern matching engine used by the user mode
+    part of the scanner.  It matches any number of signatures at once with
+    an Aho-Corasick automaton, compiled into a dense state table over
+    classes of bytes, and skips over bytes that can't start a signature 16
+    at a time when the processor allows it.
+
+    The scan state is a single ULONG, so a file can be scanned in chunks by
+    passing the state left by one chunk into the scan of the next.
+
+Environment:
+
+    User mode
+
+--*/
+
+#include <windows.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <intrin.h>
+#include <tmmintrin.h>
+#include <fltuser.h>
+#include "scanuk.h"
+#include "scanuser.h"
+
+//
+//  Signature used when no signature file is given.
+//
+
+UCHAR DefaultSignature[] = "foul";
+
+//
+//  Marks a missing transition while the trie is being built.
+//
+
+#define SCAN_NO_STATE                   ((ULONG) -1)
+
+//
+//  Don't bother skipping ahead when this many different bytes can start a
+//  signature; we would stop at nearly every byte anyway.
+//
+
+#define SCAN_PREFILTER_MAX_START_BYTES  64
+
+#define SCAN_MAX_SIGNATURE_FILE_SIZE    (64 * 1024 * 1024)
+
+typedef struct _SCAN_PATTERN {
+
+    PUCHAR Bytes;
+    ULONG Length;
+
+} SCAN_PATTERN, *PSCAN_PATTERN;
+
+struct _SCAN_ENGINE {
+
+    //
+    //  Transitions[State + ByteClass[Byte]] is the next state.  States are
+    //  multiplied by ClassCount so they index the table directly.  State 0
+    //  is the root, and every state from FirstMatchState on is the end of
+    //  at least one signature.
+    //
+
+    PULONG Transitions;
+    ULONG StateCount;
+    ULONG ClassCount;
+    ULONG FirstMatchState;
+    ULONG PatternCount;
+
+    USHORT ByteClass[256];
+
+    //
+    //  Bytes that leave the root state.  Nothing else can start a match, so
+    //  in the root state we skip straight to the next one of these.  With
+    //  SSSE3 we test 16 bytes at a time against nibble masks, which can
+    //  stop on a few bytes that aren't in StartByte; the automaton just
+    //  stays in the root state for those.
+    //
+
+    BOOLEAN UsePrefilter;
+    BOOLEAN UseShuffle;
+    BOOLEAN StartByte[256];
+
+    UCHAR LowNibbleMask[16];
+    UCHAR HighNibbleMask[16];
+};
+
+
+BOOLEAN
+ScanEngineHasSsse3 (
+    VOID
+    )
+/*++
+
+Routine Description
+
+    Checks whether the processor supports SSSE3.
+
+Arguments
+
+    None
+
+Return Value
+
+    TRUE if it does.
+
+--*/
+{
+    int cpuInfo[4];
+
+    __cpuid( cpuInfo, 1 );
+
+    return (BOOLEAN) ((cpuInfo[2] & (1 << 9)) != 0);
+}
+
+
+PSCAN_ENGINE
+ScanEngineBuild (
+    _In_reads_(PatternCount) PSCAN_PATTERN Patterns,
+    _In_ ULONG PatternCount
+    )
+/*++
+
+Routine Description
+
+    Builds the automaton for a set of signatures.
+
+    The trie of signatures is built over byte classes (every byte that
+    appears in a signature gets a class, all others share class 0).  A
+    breadth first walk then fills in the failure transitions so that every
+    state has a transition for every class, and marks states that end a
+    signature directly or through a suffix.  Finally the states are
+    renumbered so the matching ones come last.
+
+Arguments
+
+    Patterns     -   The signatures
+    PatternCount -   The number of signatures
+
+Return Value
+
+    The engine, or NULL if it couldn't be built.
+
+--*/
+{
+    PSCAN_ENGINE engine = NULL;
+    PULONG trie = NULL;
+    PULONG failure = NULL;
+    PULONG queue = NULL;
+    PULONG newState = NULL;
+    PBOOLEAN matches = NULL;
+    SIZE_T maxStates = 1;
+    SIZE_T tableSize;
+    ULONG stateCount = 1;
+    ULONG classCount = 1;
+    ULONG startByteCount = 0;
+    ULONG head, tail;
+    ULONG state, next, fail;
+    ULONG c, i, j;
+    ULONG number;
+
+    engine = calloc( 1, sizeof( SCAN_ENGINE ) );
+
+    if (engine == NULL) {
+
+        goto ScanEngineBuild_Failed;
+    }
+
+    //
+    //  Give each byte used by a signature its own class.
+    //
+
+    for (i = 0; i < PatternCount; i++) {
+
+        maxStates += Patterns[i].Length;
+
+        for (j = 0; j < Patterns[i].Length; j++) {
+
+            engine->ByteClass[Patterns[i].Bytes[j]] = 1;
+        }
+    }
+
+    for (i = 0; i < 256; i++) {
+
+        if (engine->ByteClass[i] != 0) {
+
+            engine->ByteClass[i] = (USHORT) classCount++;
+        }
+    }
+
+    if ((maxStates > MAXULONG / classCount) ||
+        (maxStates * classCount > ((SIZE_T) -1) / sizeof( ULONG ))) {
+
+        printf( "Scanner: Too many signatures\n" );
+        goto ScanEngineBuild_Failed;
+    }
+
+    tableSize = maxStates * classCount * sizeof( ULONG );
+
+    trie = malloc( tableSize );
+    failure = malloc( maxStates * sizeof( ULONG ) );
+    queue = malloc( maxStates * sizeof( ULONG ) );
+    newState = malloc( maxStates * sizeof( ULONG ) );
+    matches = calloc( maxStates, sizeof( BOOLEAN ) );
+
+    if ((trie == NULL) || (failure == NULL) || (queue == NULL) ||
+        (newState == NULL) || (matches == NULL)) {
+
+        printf( "Scanner: Not enough memory for the signatures\n" );
+        goto ScanEngineBuild_Failed;
+    }
+
+    memset( trie, 0xff, tableSize );
+
+    //
+    //  Build the trie.
+    //
+
+    for (i = 0; i < PatternCount; i++) {
+
+        state = 0;
+
+        for (j = 0; j < Patterns[i].Length; j++) {
+
+            c = engine->ByteClass[Patterns[i].Bytes[j]];
+
+            if (trie[state * classCount + c] == SCAN_NO_STATE) {
+
+                trie[state * classCount + c] = stateCount++;
+            }
+
+            state = trie[state * classCount + c];
+        }
+
+        matches[state] = TRUE;
+    }
+
+    //
+    //  Fill in the missing transitions breadth first, so that the state we
+    //  fail back to has always been completed already.  Missing transitions
+    //  out of the root go back to the root.
+    //
+
+    head = tail = 0;
+
+    for (c = 0; c < classCount; c++) {
+
+        next = trie[c];
+
+        if (next == SCAN_NO_STATE) {
+
+            trie[c] = 0;
+
+        } else {
+
+            failure[next] = 0;
+            queue[tail++] = next;
+        }
+    }
+
+    while (head < tail) {
+
+        state = queue[head++];
+
+        for (c = 0; c < classCount; c++) {
+
+            next = trie[state * classCount + c];
+            fail = trie[failure[state] * classCount + c];
+
+            if (next == SCAN_NO_STATE) {
+
+                trie[state * classCount + c] = fail;
+
+            } else {
+
+                failure[next] = fail;
+                matches[next] |= matches[fail];
+                queue[tail++] = next;
+            }
+        }
+    }
+
+    //
+    //  Renumber the states, the root first and the matching ones last.
+    //
+
+    number = 0;
+    newState[0] = number++;
+
+    for (i = 0; i < tail; i++) {
+
+        if (!matches[queue[i]]) {
+
+            newState[queue[i]] = number++;
+        }
+    }
+
+    engine->FirstMatchState = number * classCount;
+
+    for (i = 0; i < tail; i++) {
+
+        if (matches[queue[i]]) {
+
+            newState[queue[i]] = number++;
+        }
+    }
+
+    engine->Transitions = malloc( (SIZE_T) stateCount * classCount * sizeof( ULONG ) );
+
+    if (engine->Transitions == NULL) {
+
+        printf( "Scanner: Not enough memory for the signatures\n" );
+        goto ScanEngineBuild_Failed;
+    }
+
+    for (state = 0; state < stateCount; state++) {
+
+        for (c = 0; c < classCount; c++) {
+
+            engine->Transitions[newState[state] * classCount + c] =
+                newState[trie[state * classCount + c]] * classCount;
+        }
+    }
+
+    engine->StateCount = stateCount;
+    engine->ClassCount = classCount;
+    engine->PatternCount = PatternCount;
+
+    //
+    //  Set up the prefilter from the bytes that leave the root.
+    //
+
+    for (i = 0; i < 256; i++) {
+
+        if (trie[engine->ByteClass[i]] != 0) {
+
+            engine->StartByte[i] = TRUE;
+            engine->LowNibbleMask[i & 0xf] |= (UCHAR) (1 << ((i >> 4) & 7));
+            engine->HighNibbleMask[i >> 4] |= (UCHAR) (1 << ((i >> 4) & 7));
+            startByteCount++;
+        }
+    }
+
+    engine->UsePrefilter = (BOOLEAN) (startByteCount <= SCAN_PREFILTER_MAX_START_BYTES);
+    engine->UseShuffle = ScanEngineHasSsse3();
+
+    free( trie );
+    free( failure );
+    free( queue );
+    free( newState );
+    free( matches );
+
+    return engine;
+
+ScanEngineBuild_Failed:
+
+    free( trie );
+    free( failure );
+    free( queue );
+    free( newState );
+    free( matches );
+    ScanEngineFree( engine );
+
+    return NULL;
+}
+
+
+ULONG
+ScanEngineParseSignatures (
+    _Inout_updates_bytes_(Length) PUCHAR Text,
+    _In_ ULONG Length,
+    _Out_writes_opt_(MaxPatterns) PSCAN_PATTERN Patterns,
+    _In_ ULONG MaxPatterns
+    )
+/*++
+
+Routine Description
+
+    Parses a signature file, one signature per line.  Blank lines and lines
+    starting with '#' are ignored.  "\xNN" in a signature is the byte with
+    hex value NN and "\\" is a backslash.  Escapes are decoded in place, so
+    this is only called with Patterns once the lines have been counted.
+
+Arguments
+
+    Text        -   Contents of the signature file
+    Length      -   Size of Text
+    Patterns    -   Receives the signatures, or NULL to just count them
+    MaxPatterns -   Size of Patterns
+
+Return Value
+
+    The number of signatures.
+
+--*/
+{
+    PUCHAR line = Text;
+    PUCHAR end = Text + Length;
+    PUCHAR lineEnd;
+    PUCHAR in;
+    PUCHAR out;
+    ULONG count = 0;
+    UCHAR value;
+    int digit;
+    int i;
+
+    while (line < end) {
+
+        lineEnd = memchr( line, '\n', end - line );
+
+        if (lineEnd == NULL) {
+
+            lineEnd = end;
+        }
+
+        if ((lineEnd > line) && (lineEnd[-1] == '\r')) {
+
+            lineEnd--;
+        }
+
+        if ((lineEnd > line) && (line[0] != '#')) {
+
+            if (Patterns != NULL) {
+
+                if (count >= MaxPatterns) {
+
+                    break;
+                }
+
+                out = line;
+
+                for (in = line; in < lineEnd; in++) {
+
+                    if ((in[0] == '\\') && (lineEnd - in >= 4) && (in[1] == 'x')) {
+
+                        value = 0;
+
+                        for (i = 2; i < 4; i++) {
+
+                            digit = in[i];
+
+                            if ((digit >= '0') && (digit <= '9')) {
+
+                                digit -= '0';
+
+                            } else if ((digit >= 'a') && (digit <= 'f')) {
+
+                                digit -= 'a' - 10;
+
+                            } else if ((digit >= 'A') && (digit <= 'F')) {
+
+                                digit -= 'A' - 10;
+
+                            } else {
+
+                                break;
+                            }
+
+                            value = (UCHAR) ((value << 4) | digit);
+                        }
+
+                        if (i == 4) {
+
+                            *out++ = value;
+                            in += 3;
+                            continue;
+                        }
+
+                    } else if ((in[0] == '\\') && (lineEnd - in >= 2) && (in[1] == '\\')) {
+
+                        *out++ = '\\';
+                        in++;
+                        continue;
+                    }
+
+                    *out++ = *in;
+                }
+
+                Patterns[count].Bytes = line;
+                Patterns[count].Length = (ULONG) (out - line);
+            }
+
+            count++;
+        }
+
+        line = lineEnd;
+
+        while ((line < end) && ((*line == '\r') || (*line == '\n'))) {
+
+            line++;
+        }
+    }
+
+    return count;
+}
+
+
+PSCAN_ENGINE
+ScanEngineLoad (
+    _In_opt_ PCSTR SignatureFile
+    )
+/*++
+
+Routine Description
+
+    Builds a scan engine from a signature file (see
+    ScanEngineParseSignatures for the format), or from the default
+    signature if there is no file.
+
+Arguments
+
+    SignatureFile   -   Name of the signature file, or NULL
+
+Return Value
+
+    The engine, or NULL if it couldn't be built.
+
+--*/
+{
+    PSCAN_ENGINE engine = NULL;
+    PSCAN_PATTERN patterns = NULL;
+    PUCHAR text = NULL;
+    FILE *file = NULL;
+    long length;
+    ULONG count;
+
+    if (SignatureFile == NULL) {
+
+        SCAN_PATTERN pattern;
+
+        pattern.Bytes = DefaultSignature;
+        pattern.Length = sizeof( DefaultSignature ) - sizeof( UCHAR );
+
+        return ScanEngineBuild( &pattern, 1 );
+    }
+
+    if (fopen_s( &file, SignatureFile, "rb" ) != 0) {
+
+        printf( "ERROR: Opening signature file %s\n", SignatureFile );
+        return NULL;
+    }
+
+    if ((fseek( file, 0, SEEK_END ) != 0) ||
+        ((length = ftell( file )) < 0) ||
+        (length > SCAN_MAX_SIGNATURE_FILE_SIZE) ||
+        (fseek( file, 0, SEEK_SET ) != 0)) {
+
+        printf( "ERROR: Signature file %s is too big or can't be read\n", SignatureFile );
+        goto ScanEngineLoad_Exit;
+    }
+
+    text = malloc( length + 1 );
+
+    if ((text == NULL) ||
+        (fread( text, 1, length, file ) != (size_t) length)) {
+
+        printf( "ERROR: Reading signature file %s\n", SignatureFile );
+        goto ScanEngineLoad_Exit;
+    }
+
+    count = ScanEngineParseSignatures( text, (ULONG) length, NULL, 0 );
+
+    if (count == 0) {
+
+        printf( "ERROR: No signatures in %s\n", SignatureFile );
+        goto ScanEngineLoad_Exit;
+    }
+
+    patterns = malloc( count * sizeof( SCAN_PATTERN ) );
+
+    if (patterns == NULL) {
+
+        printf( "ERROR: Not enough memory for the signatures\n" );
+        goto ScanEngineLoad_Exit;
+    }
+
+    count = ScanEngineParseSignatures( text, (ULONG) length, patterns, count );
+
+    engine = ScanEngineBuild( patterns, count );
+
+    if (engine != NULL) {
+
+        printf( "Scanner: Loaded %d signatures, %d states\n", count, engine->StateCount );
+    }
+
+ScanEngineLoad_Exit:
+
+    free( patterns );
+    free( text );
+    fclose( file );
+
+    return engine;
+}
+
+
+VOID
+ScanEngineFree (
+    _In_opt_ PSCAN_ENGINE Engine
+    )
+/*++
+
+Routine Description
+
+    Frees a scan engine.
+
+Arguments
+
+    Engine  -   The engine to free
+
+Return Value
+
+    None
+
+--*/
+{
+    if (Engine != NULL) {
+
+        free( Engine->Transitions );
+        free( Engine );
+    }
+}
+
+
+PUCHAR
+ScanEngineSkip (
+    _In_ PSCAN_ENGINE Engine,
+    _In_ PUCHAR Current,
+    _In_ PUCHAR End
+    )
+/*++
+
+Routine Description
+
+    Finds the next byte that might start a signature.
+
+Arguments
+
+    Engine  -   The engine
+    Current -   Where to start looking
+    End     -   End of the buffer
+
+Return Value
+
+    The next candidate byte, or End if there is none.
+
+--*/
+{
+    __m128i lowMask;
+    __m128i highMask;
+    __m128i nibble;
+    __m128i bytes;
+    __m128i hits;
+    ULONG mask;
+    ULONG index;
+
+    if (Engine->UseShuffle) {
+
+        lowMask = _mm_loadu_si128( (__m128i *) Engine->LowNibbleMask );
+        highMask = _mm_loadu_si128( (__m128i *) Engine->HighNibbleMask );
+        nibble = _mm_set1_epi8( 0x0f );
+
+        while (End - Current >= 16) {
+
+            //
+            //  A byte is a candidate if the bucket for its high nibble is
+            //  set both for its low nibble and for its high nibble.
+            //
+
+            bytes = _mm_loadu_si128( (__m128i *) Current );
+
+            hits = _mm_and_si128( _mm_shuffle_epi8( lowMask, _mm_and_si128( bytes, nibble ) ),
+                                  _mm_shuffle_epi8( highMask, _mm_and_si128( _mm_srli_epi16( bytes, 4 ), nibble ) ) );
+
+            mask = (ULONG) _mm_movemask_epi8( _mm_cmpeq_epi8( hits, _mm_setzero_si128() ) ) ^ 0xffff;
+
+            if (mask != 0) {
+
+                _BitScanForward( &index, mask );
+                return Current + index;
+            }
+
+            Current += 16;
+        }
+    }
+
+    while ((Current < End) && !Engine->StartByte[*Current]) {
+
+        Current++;
+    }
+
+    return Current;
+}
+
+
+BOOLEAN
+ScanEngineScan (
+    _In_ PSCAN_ENGINE Engine,
+    _In_reads_bytes_(BufferSize) PUCHAR Buffer,
+    _In_ ULONG BufferSize,
+    _Inout_ PULONG State
+    )
+/*++
+
+Routine Description
+
+    Scans a buffer for any of the engine's signatures, starting from the
+    state left by the scan of the data just before it.
+
+Arguments
+
+    Engine      -   The engine
+    Buffer      -   Pointer to buffer
+    BufferSize  -   Size of passed in buffer
+    State       -   On input the state to start in, zero at the start of a
+                    file.  On output the state to scan the data that
+                    follows with.
+
+Return Value
+
+    TRUE        -    Found a signature
+    FALSE       -    Buffer is ok
+
+--*/
+{
+    PUCHAR current = Buffer;
+    PUCHAR end = Buffer + BufferSize;
+    ULONG state = *State;
+
+    //
+    //  The state came back to us through the filter, so make sure it's one
+    //  of ours.
+    //
+
+    if ((state >= Engine->StateCount * Engine->ClassCount) ||
+        ((state % Engine->ClassCount) != 0)) {
+
+        state = 0;
+    }
+
+    while (current < end) {
+
+        if ((state == 0) && Engine->UsePrefilter) {
+
+            current = ScanEngineSkip( Engine, current, end );
+
+            if (current == end) {
+
+                break;
+            }
+        }
+
+        state = Engine->Transitions[state + Engine->ByteClass[*current++]];
+
+        if (state >= Engine->FirstMatchState) {
+
+            *State = state;
+            return TRUE;
+        }
+    }
+
+    *State = state;
+    return FALSE;
+}
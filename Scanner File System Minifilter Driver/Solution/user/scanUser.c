@@ -31,26 +31,87 @@ Environment:
 #include <dontuse.h>
 
 //
-//  Default and Maximum number of threads.
+//  Default and Maximum number of threads.  By default there is one thread
+//  per processor.
 //
 
 #define SCANNER_DEFAULT_REQUEST_COUNT       5
-#define SCANNER_DEFAULT_THREAD_COUNT        2
 #define SCANNER_MAX_THREAD_COUNT            64
 
-UCHAR FoulString[] = "foul";
+//
+//  The most FilterGetMessage requests we will ever have outstanding.  Each
+//  one holds a SCANNER_MESSAGE, which is a little over 64KB.
+//
+
+#define SCANNER_MAX_REQUEST_COUNT           256
+
+//
+//  How often, in milliseconds, to report throughput, verdict latency and
+//  the filter's verdict cache statistics.
+//
+
+#define SCANNER_STATISTICS_INTERVAL         (10 * 1000)
+
+//
+//  Verdict latencies are counted in a histogram of microseconds.  Each
+//  power of 2 is split into 2^SCANNER_LATENCY_SUB_BITS buckets, so a
+//  percentile is within 25% of the true value.
+//
+
+#define SCANNER_LATENCY_SUB_BITS            2
+#define SCANNER_LATENCY_BUCKETS             (((32 - SCANNER_LATENCY_SUB_BITS) + 1) << SCANNER_LATENCY_SUB_BITS)
+
+typedef struct _SCANNER_LATENCY_HISTOGRAM {
+
+    ULONGLONG Verdicts;
+    ULONGLONG Buckets[SCANNER_LATENCY_BUCKETS];
+
+} SCANNER_LATENCY_HISTOGRAM, *PSCANNER_LATENCY_HISTOGRAM;
 
 //
-//  Context passed to worker threads
+//  Context shared by the worker threads
 //
 
 typedef struct _SCANNER_THREAD_CONTEXT {
 
     HANDLE Port;
     HANDLE Completion;
+    PSCAN_ENGINE Engine;
+
+    //
+    //  Performance counter frequency, for timing verdicts.
+    //
+
+    LARGE_INTEGER Frequency;
+
+    LONG ThreadCount;
+
+    //
+    //  FilterGetMessage requests that have been issued and not completed,
+    //  and messages allocated for requests.  We never go below
+    //  MinimumRequests messages or above SCANNER_MAX_REQUEST_COUNT.
+    //
+
+    volatile LONG Pending;
+    volatile LONG Allocated;
+    LONG MinimumRequests;
 
 } SCANNER_THREAD_CONTEXT, *PSCANNER_THREAD_CONTEXT;
 
+//
+//  Per-thread state.  Each worker only updates its own histogram, so
+//  workers don't share cache lines.
+//
+
+typedef struct DECLSPEC_CACHEALIGN _SCANNER_WORKER {
+
+    PSCANNER_THREAD_CONTEXT Context;
+    HANDLE Thread;
+
+    SCANNER_LATENCY_HISTOGRAM Latency;
+
+} SCANNER_WORKER, *PSCANNER_WORKER;
+
 
 VOID
 Usage (
@@ -74,74 +135,247 @@ Return Value
 {
 
     printf( "Connects to the scanner filter and scans buffers \n" );
-    printf( "Usage: scanuser [requests per thread] [number of threads(1-64)]\n" );
+    printf( "Usage: scanuser [requests per thread] [number of threads(1-64)] [signature file]\n" );
+    printf( "    By default there is one thread per processor\n" );
+    printf( "    The signature file has one signature per line; \\xNN is a hex byte\n" );
 }
 
-BOOL
-ScanBuffer (
-    _In_reads_bytes_(BufferSize) PUCHAR Buffer,
-    _In_ ULONG BufferSize
+
+ULONG
+ScannerLatencyBucket (
+    _In_ ULONGLONG Microseconds
     )
 /*++
 
 Routine Description
 
-    Scans the supplied buffer for an instance of FoulString.
+    Returns the histogram bucket a verdict latency is counted in.
+
+Arguments
+
+    Microseconds - The latency.
+
+Return Value
+
+    The bucket index.
+
+--*/
+{
+    ULONG value, exponent;
+
+    value = (Microseconds > MAXULONG) ? MAXULONG : (ULONG) Microseconds;
+
+    if (value < (1 << SCANNER_LATENCY_SUB_BITS)) {
+
+        return value;
+    }
+
+    _BitScanReverse( &exponent, value );
+
+    return ((exponent - SCANNER_LATENCY_SUB_BITS + 1) << SCANNER_LATENCY_SUB_BITS) +
+           ((value >> (exponent - SCANNER_LATENCY_SUB_BITS)) & ((1 << SCANNER_LATENCY_SUB_BITS) - 1));
+}
+
+
+ULONGLONG
+ScannerLatencyBucketLimit (
+    _In_ ULONG Bucket
+    )
+/*++
 
-    Note: Pattern matching algorithm used here is just for illustration purposes,
-    there are many better algorithms available for real world filters
+Routine Description
+
+    Returns the smallest latency that is counted past a bucket.
 
 Arguments
 
-    Buffer      -   Pointer to buffer
-    BufferSize  -   Size of passed in buffer
+    Bucket - The bucket index.
 
 Return Value
 
-    TRUE        -    Found an occurrence of the appropriate FoulString
-    FALSE       -    Buffer is ok
+    The bucket's exclusive upper bound, in microseconds.
 
 --*/
 {
-    PUCHAR p;
-    ULONG searchStringLength = sizeof(FoulString) - sizeof(UCHAR);
+    ULONG exponent, mantissa;
 
-    for (p = Buffer;
-         p <= (Buffer + BufferSize - searchStringLength);
-         p++) {
+    Bucket++;
 
-        if (RtlEqualMemory( p, FoulString, searchStringLength )) {
+    if (Bucket < (1 << SCANNER_LATENCY_SUB_BITS)) {
 
-            printf( "Found a string\n" );
+        return Bucket;
+    }
 
-            //
-            //  Once we find our search string, we're not interested in seeing
-            //  whether it appears again.
-            //
+    exponent = (Bucket >> SCANNER_LATENCY_SUB_BITS) + SCANNER_LATENCY_SUB_BITS - 1;
+    mantissa = Bucket & ((1 << SCANNER_LATENCY_SUB_BITS) - 1);
+
+    return (ULONGLONG) ((1 << SCANNER_LATENCY_SUB_BITS) + mantissa) << (exponent - SCANNER_LATENCY_SUB_BITS);
+}
+
+
+ULONGLONG
+ScannerLatencyPercentile (
+    _In_ PSCANNER_LATENCY_HISTOGRAM Histogram,
+    _In_ ULONG Percent
+    )
+/*++
+
+Routine Description
+
+    Returns a percentile of the latencies in a histogram.
+
+Arguments
+
+    Histogram - The latencies.
+
+    Percent - Which percentile, 1 to 100.
+
+Return Value
+
+    The upper bound of the bucket the percentile falls in, in microseconds.
+
+--*/
+{
+    ULONGLONG rank, seen = 0;
+    ULONG i;
+
+    rank = (Histogram->Verdicts * Percent + 99) / 100;
+
+    for (i = 0; i < SCANNER_LATENCY_BUCKETS; i++) {
 
-            return TRUE;
+        seen += Histogram->Buckets[i];
+
+        if (seen >= rank) {
+
+            break;
         }
     }
 
-    return FALSE;
+    return ScannerLatencyBucketLimit( min( i, SCANNER_LATENCY_BUCKETS - 1 ) );
+}
+
+
+HRESULT
+ScannerGetMessage (
+    _In_ PSCANNER_THREAD_CONTEXT Context,
+    _Inout_ PSCANNER_MESSAGE Message
+    )
+/*++
+
+Routine Description
+
+    Issues a FilterGetMessage request for a message from the filter.  The
+    message completes on the context's completion port.
+
+Arguments
+
+    Context - The worker context.
+
+    Message - The buffer to receive the message into.
+
+Return Value
+
+    HRESULT_FROM_WIN32( ERROR_IO_PENDING ) if the request was issued.
+
+--*/
+{
+    HRESULT hr;
+
+    memset( &Message->Ovlp, 0, sizeof( OVERLAPPED ) );
+
+    //
+    //  Count it first, the request may complete on another thread before
+    //  FilterGetMessage returns.
+    //
+
+    InterlockedIncrement( &Context->Pending );
+
+    hr = FilterGetMessage( Context->Port,
+                           &Message->MessageHeader,
+                           FIELD_OFFSET( SCANNER_MESSAGE, Ovlp ),
+                           &Message->Ovlp );
+
+    if (hr != HRESULT_FROM_WIN32( ERROR_IO_PENDING )) {
+
+        InterlockedDecrement( &Context->Pending );
+    }
+
+    return hr;
+}
+
+
+HRESULT
+ScannerAddRequest (
+    _In_ PSCANNER_THREAD_CONTEXT Context
+    )
+/*++
+
+Routine Description
+
+    Allocates another message and issues a request for it, unless we
+    already have SCANNER_MAX_REQUEST_COUNT messages.
+
+Arguments
+
+    Context - The worker context.
+
+Return Value
+
+    HRESULT_FROM_WIN32( ERROR_IO_PENDING ) if the request was issued.
+
+--*/
+{
+    PSCANNER_MESSAGE msg;
+    HRESULT hr;
+
+    if (InterlockedIncrement( &Context->Allocated ) > SCANNER_MAX_REQUEST_COUNT) {
+
+        InterlockedDecrement( &Context->Allocated );
+        return HRESULT_FROM_WIN32( ERROR_TOO_MANY_CMDS );
+    }
+
+#pragma prefast(suppress:__WARNING_MEMORY_LEAK, "msg will not be leaked because it is freed in ScannerWorker")
+    msg = malloc( sizeof( SCANNER_MESSAGE ) );
+
+    if (msg == NULL) {
+
+        InterlockedDecrement( &Context->Allocated );
+        return HRESULT_FROM_WIN32( ERROR_NOT_ENOUGH_MEMORY );
+    }
+
+    hr = ScannerGetMessage( Context, msg );
+
+    if (hr != HRESULT_FROM_WIN32( ERROR_IO_PENDING )) {
+
+        InterlockedDecrement( &Context->Allocated );
+        free( msg );
+    }
+
+    return hr;
 }
 
 
 DWORD
 ScannerWorker(
-    _In_ PSCANNER_THREAD_CONTEXT Context
+    _In_ PSCANNER_WORKER Worker
     )
 /*++
 
 Routine Description
 
-    This is a worker thread that
+    This is a worker thread that scans the messages the filter sends us and
+    replies with a verdict.
 
+    Messages are received into a pool of buffers shared by all the workers,
+    since any worker can dequeue any completed request.  The pool grows
+    when the filter sends messages faster than we take them, that is when
+    fewer requests are waiting in the filter than there are workers, and
+    shrinks back to its minimum as the load drops.
 
 Arguments
 
-    Context  - This thread context has a pointer to the port handle we use to send/receive messages,
-                and a completion port handle that was already associated with the comm. port by the caller
+    Worker - This thread's state.  Its context has the port handle we use to send/receive messages,
+             and a completion port handle that was already associated with the comm. port by the caller
 
 Return Value
 
@@ -149,14 +383,18 @@ Return Value
 
 --*/
 {
+    PSCANNER_THREAD_CONTEXT Context = Worker->Context;
     PSCANNER_NOTIFICATION notification;
     SCANNER_REPLY_MESSAGE replyMessage;
     PSCANNER_MESSAGE message;
     LPOVERLAPPED pOvlp;
+    LARGE_INTEGER start, end;
     BOOL result;
     DWORD outSize;
     HRESULT hr;
     ULONG_PTR key;
+    ULONG scanState;
+    LONG pending;
 
 #pragma warning(push)
 #pragma warning(disable:4127) // conditional expression is constant
@@ -171,6 +409,16 @@ Return Value
 
         result = GetQueuedCompletionStatus( Context->Completion, &outSize, &key, &pOvlp, INFINITE );
 
+        if (result && (pOvlp == NULL)) {
+
+            //
+            //  Not one of our FilterGetMessage calls, for instance the
+            //  statistics query main sends on this port.
+            //
+
+            continue;
+        }
+
         //
         //  Obtain the message: note that the message we sent down via FltGetMessage() may NOT be
         //  the one dequeued off the completion queue: this is solely because there are multiple
@@ -178,7 +426,7 @@ Return Value
         //  completed in random order - and we will just dequeue a random one.
         //
 
-        message = CONTAINING_RECORD( pOvlp, SCANNER_MESSAGE, Ovlp );
+        message = (pOvlp != NULL) ? CONTAINING_RECORD( pOvlp, SCANNER_MESSAGE, Ovlp ) : NULL;
 
         if (!result) {
 
@@ -190,14 +438,40 @@ Return Value
             break;
         }
 
-        printf( "Received message, size %d\n", pOvlp->InternalHigh );
+        QueryPerformanceCounter( &start );
+
+        //
+        //  If the filter is getting ahead of us, give it another buffer to
+        //  send into before we start on this one.
+        //
+
+        pending = InterlockedDecrement( &Context->Pending );
+
+        if (pending < Context->ThreadCount) {
+
+            (VOID) ScannerAddRequest( Context );
+        }
 
         notification = &message->Notification;
 
         assert(notification->BytesToScan <= SCANNER_READ_BUFFER_SIZE);
         _Analysis_assume_(notification->BytesToScan <= SCANNER_READ_BUFFER_SIZE);
 
-        result = ScanBuffer( notification->Contents, notification->BytesToScan );
+        //
+        //  Pick up the scan where the previous chunk of this file left off.
+        //
+
+        scanState = notification->ScanState;
+
+        result = ScanEngineScan( Context->Engine,
+                                 notification->Contents,
+                                 notification->BytesToScan,
+                                 &scanState );
+
+        if (result) {
+
+            printf( "Found a string\n" );
+        }
 
         replyMessage.ReplyHeader.Status = 0;
         replyMessage.ReplyHeader.MessageId = message->MessageHeader.MessageId;
@@ -208,29 +482,40 @@ Return Value
         //
 
         replyMessage.Reply.SafeToOpen = !result;
-
-        printf( "Replying message, SafeToOpen: %d\n", replyMessage.Reply.SafeToOpen );
+        replyMessage.Reply.ScanState = scanState;
 
         hr = FilterReplyMessage( Context->Port,
                                  (PFILTER_REPLY_HEADER) &replyMessage,
                                  sizeof( replyMessage ) );
 
-        if (SUCCEEDED( hr )) {
-
-            printf( "Replied message\n" );
-
-        } else {
+        if (!SUCCEEDED( hr )) {
 
             printf( "Scanner: Error replying message. Error = 0x%X\n", hr );
             break;
         }
 
-        memset( &message->Ovlp, 0, sizeof( OVERLAPPED ) );
+        QueryPerformanceCounter( &end );
+
+        Worker->Latency.Buckets[ScannerLatencyBucket( ((end.QuadPart - start.QuadPart) * 1000000) /
+                                                      Context->Frequency.QuadPart )]++;
+        Worker->Latency.Verdicts++;
+
+        //
+        //  If enough other requests are already waiting, let this buffer go.
+        //
 
-        hr = FilterGetMessage( Context->Port,
-                               &message->MessageHeader,
-                               FIELD_OFFSET( SCANNER_MESSAGE, Ovlp ),
-                               &message->Ovlp );
+        if (Context->Pending >= Context->MinimumRequests) {
+
+            if (InterlockedDecrement( &Context->Allocated ) >= Context->MinimumRequests) {
+
+                free( message );
+                continue;
+            }
+
+            InterlockedIncrement( &Context->Allocated );
+        }
+
+        hr = ScannerGetMessage( Context, message );
 
         if (hr != HRESULT_FROM_WIN32( ERROR_IO_PENDING )) {
 
@@ -260,6 +545,156 @@ Return Value
 }
 
 
+VOID
+ScannerReportWorkerStatistics (
+    _In_ PSCANNER_WORKER Workers,
+    _In_ ULONG WorkerCount,
+    _Inout_ PSCANNER_LATENCY_HISTOGRAM Last,
+    _Inout_ PLARGE_INTEGER LastTime
+    )
+/*++
+
+Routine Description
+
+    Prints the throughput and verdict latency percentiles since the last
+    report.  Verdict latency is the time from a message being dequeued to
+    the reply being sent.
+
+Arguments
+
+    Workers - The worker threads.
+
+    WorkerCount - How many workers there are.
+
+    Last - The workers' combined histogram as of the last report, updated
+           on return.
+
+    LastTime - The performance counter as of the last report, updated on
+               return.
+
+Return Value
+
+    None
+
+--*/
+{
+    SCANNER_LATENCY_HISTOGRAM total, interval;
+    PSCANNER_THREAD_CONTEXT context = Workers[0].Context;
+    LARGE_INTEGER now;
+    ULONGLONG elapsed;
+    ULONG i, j;
+
+    QueryPerformanceCounter( &now );
+
+    //
+    //  The workers keep counting while we add up, so this is a close
+    //  estimate rather than an exact snapshot.
+    //
+
+    memset( &total, 0, sizeof( total ) );
+
+    for (i = 0; i < WorkerCount; i++) {
+
+        total.Verdicts += Workers[i].Latency.Verdicts;
+
+        for (j = 0; j < SCANNER_LATENCY_BUCKETS; j++) {
+
+            total.Buckets[j] += Workers[i].Latency.Buckets[j];
+        }
+    }
+
+    interval.Verdicts = total.Verdicts - Last->Verdicts;
+
+    for (j = 0; j < SCANNER_LATENCY_BUCKETS; j++) {
+
+        interval.Buckets[j] = total.Buckets[j] - Last->Buckets[j];
+    }
+
+    elapsed = ((now.QuadPart - LastTime->QuadPart) * 1000) / context->Frequency.QuadPart;
+
+    *Last = total;
+    *LastTime = now;
+
+    if ((interval.Verdicts == 0) || (elapsed == 0)) {
+
+        return;
+    }
+
+    printf( "Scanner: %I64u verdicts in %I64u ms (%I64u/s), latency p50 %I64u us, p99 %I64u us, %d requests\n",
+            interval.Verdicts,
+            elapsed,
+            (interval.Verdicts * 1000) / elapsed,
+            ScannerLatencyPercentile( &interval, 50 ),
+            ScannerLatencyPercentile( &interval, 99 ),
+            context->Allocated );
+}
+
+
+VOID
+ScannerReportCacheStatistics (
+    _In_ HANDLE Port,
+    _Inout_ PSCANNER_CACHE_STATISTICS Last
+    )
+/*++
+
+Routine Description
+
+    Asks the filter for its verdict cache statistics and prints them if
+    they changed since the last report.
+
+Arguments
+
+    Port - The connection to the filter.
+
+    Last - The statistics from the last report, updated on return.
+
+Return Value
+
+    None
+
+--*/
+{
+    SCANNER_COMMAND_MESSAGE command;
+    SCANNER_CACHE_STATISTICS statistics;
+    DWORD bytesReturned;
+    ULONGLONG lookups;
+    HRESULT hr;
+
+    command.Command = ScannerGetCacheStatistics;
+    command.Reserved = 0;
+
+    hr = FilterSendMessage( Port,
+                            &command,
+                            sizeof( command ),
+                            &statistics,
+                            sizeof( statistics ),
+                            &bytesReturned );
+
+    if (IS_ERROR( hr ) || (bytesReturned < sizeof( statistics ))) {
+
+        return;
+    }
+
+    if (memcmp( &statistics, Last, sizeof( statistics ) ) == 0) {
+
+        return;
+    }
+
+    lookups = statistics.Hits + statistics.Misses;
+
+    printf( "Scanner: Verdict cache: %u/%u entries, %I64u hits, %I64u misses (%I64u%% hit), %I64u evictions, %I64u invalidations\n",
+            statistics.Entries,
+            statistics.MaxEntries,
+            statistics.Hits,
+            statistics.Misses,
+            (lookups != 0) ? (statistics.Hits * 100) / lookups : 0,
+            statistics.Evictions,
+            statistics.Invalidations );
+
+    *Last = statistics;
+}
+
+
 int _cdecl
 main (
     _In_ int argc,
@@ -267,15 +702,28 @@ main (
     )
 {
     DWORD requestCount = SCANNER_DEFAULT_REQUEST_COUNT;
-    DWORD threadCount = SCANNER_DEFAULT_THREAD_COUNT;
-    HANDLE threads[SCANNER_MAX_THREAD_COUNT];
+    DWORD threadCount;
+    PCSTR signatureFile = NULL;
+    PSCANNER_WORKER workers;
     SCANNER_THREAD_CONTEXT context;
+    SCANNER_CACHE_STATISTICS statistics;
+    SCANNER_LATENCY_HISTOGRAM latency;
+    LARGE_INTEGER reportTime;
+    SYSTEM_INFO systemInfo;
+    HANDLE threads[SCANNER_MAX_THREAD_COUNT];
     HANDLE port, completion;
-    PSCANNER_MESSAGE msg;
     DWORD threadId;
     HRESULT hr;
     DWORD i, j;
 
+    //
+    //  Default to a thread per processor.
+    //
+
+    GetSystemInfo( &systemInfo );
+
+    threadCount = min( systemInfo.dwNumberOfProcessors, SCANNER_MAX_THREAD_COUNT );
+
     //
     //  Check how many threads and per thread requests are desired.
     //
@@ -300,8 +748,35 @@ main (
             Usage();
             return 1;
         }
+
+        if (argc > 3) {
+
+            signatureFile = argv[3];
+        }
     }
 
+    //
+    //  Compile the signatures before we start taking requests.
+    //
+
+    context.Engine = ScanEngineLoad( signatureFile );
+
+    if (context.Engine == NULL) {
+
+        return 4;
+    }
+
+    workers = _aligned_malloc( threadCount * sizeof( SCANNER_WORKER ),
+                               __alignof( SCANNER_WORKER ) );
+
+    if (workers == NULL) {
+
+        ScanEngineFree( context.Engine );
+        return 5;
+    }
+
+    memset( workers, 0, threadCount * sizeof( SCANNER_WORKER ) );
+
     //
     //  Open a commuication channel to the filter
     //
@@ -318,6 +793,8 @@ main (
     if (IS_ERROR( hr )) {
 
         printf( "ERROR: Connecting to filter port: 0x%08x\n", hr );
+        _aligned_free( workers );
+        ScanEngineFree( context.Engine );
         return 2;
     }
 
@@ -334,13 +811,21 @@ main (
 
         printf( "ERROR: Creating completion port: %d\n", GetLastError() );
         CloseHandle( port );
+        _aligned_free( workers );
+        ScanEngineFree( context.Engine );
         return 3;
     }
 
-    printf( "Scanner: Port = 0x%p Completion = 0x%p\n", port, completion );
+    printf( "Scanner: Port = 0x%p Completion = 0x%p, %d threads\n", port, completion, threadCount );
 
     context.Port = port;
     context.Completion = completion;
+    context.ThreadCount = threadCount;
+    context.Pending = 0;
+    context.Allocated = 0;
+    context.MinimumRequests = (LONG) min( requestCount * threadCount, SCANNER_MAX_REQUEST_COUNT );
+
+    QueryPerformanceFrequency( &context.Frequency );
 
     //
     //  Create specified number of threads.
@@ -348,10 +833,12 @@ main (
 
     for (i = 0; i < threadCount; i++) {
 
+        workers[i].Context = &context;
+
         threads[i] = CreateThread( NULL,
                                    0,
                                    (LPTHREAD_START_ROUTINE) ScannerWorker,
-                                   &context,
+                                   &workers[i],
                                    0,
                                    &threadId );
 
@@ -366,43 +853,40 @@ main (
             goto main_cleanup;
         }
 
-        for (j = 0; j < requestCount; j++) {
-
-            //
-            //  Allocate the message.
-            //
-
-#pragma prefast(suppress:__WARNING_MEMORY_LEAK, "msg will not be leaked because it is freed in ScannerWorker")
-            msg = malloc( sizeof( SCANNER_MESSAGE ) );
-
-            if (msg == NULL) {
-
-                hr = ERROR_NOT_ENOUGH_MEMORY;
-                goto main_cleanup;
-            }
+        workers[i].Thread = threads[i];
+    }
 
-            memset( &msg->Ovlp, 0, sizeof( OVERLAPPED ) );
+    //
+    //  Request messages from the filter driver.  The workers add more
+    //  requests as they need them.
+    //
 
-            //
-            //  Request messages from the filter driver.
-            //
+    for (j = 0; j < (DWORD) context.MinimumRequests; j++) {
 
-            hr = FilterGetMessage( port,
-                                   &msg->MessageHeader,
-                                   FIELD_OFFSET( SCANNER_MESSAGE, Ovlp ),
-                                   &msg->Ovlp );
+        hr = ScannerAddRequest( &context );
 
-            if (hr != HRESULT_FROM_WIN32( ERROR_IO_PENDING )) {
+        if (hr != HRESULT_FROM_WIN32( ERROR_IO_PENDING )) {
 
-                free( msg );
-                goto main_cleanup;
-            }
+            goto main_cleanup;
         }
     }
 
     hr = S_OK;
 
-    WaitForMultipleObjectsEx( i, threads, TRUE, INFINITE, FALSE );
+    //
+    //  Report how the workers and the filter's verdict cache are doing
+    //  while the workers run.
+    //
+
+    memset( &statistics, 0, sizeof( statistics ) );
+    memset( &latency, 0, sizeof( latency ) );
+    QueryPerformanceCounter( &reportTime );
+
+    while (WaitForMultipleObjectsEx( i, threads, TRUE, SCANNER_STATISTICS_INTERVAL, FALSE ) == WAIT_TIMEOUT) {
+
+        ScannerReportWorkerStatistics( workers, i, &latency, &reportTime );
+        ScannerReportCacheStatistics( port, &statistics );
+    }
 
 main_cleanup:
 
@@ -411,6 +895,17 @@ main_cleanup:
     CloseHandle( port );
     CloseHandle( completion );
 
+    //
+    //  The worker threads may still be using the engine if we bailed out
+    //  early, so only free it once they have all exited.
+    //
+
+    if (hr == S_OK) {
+
+        _aligned_free( workers );
+        ScanEngineFree( context.Engine );
+    }
+
     return hr;
 }
 
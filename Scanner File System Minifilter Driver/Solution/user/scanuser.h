@@ -20,7 +20,7 @@ Environment:
 #ifndef __SCANUSER_H__
 #define __SCANUSER_H__
 
-#pragma pack(1)
+#pragma pack(push, 1)
 
 typedef struct _SCANNER_MESSAGE {
 
@@ -62,6 +62,34 @@ typedef struct _SCANNER_REPLY_MESSAGE {
 
 } SCANNER_REPLY_MESSAGE, *PSCANNER_REPLY_MESSAGE;
 
+#pragma pack(pop)
+
+//
+//  Multi-signature scan engine.
+//
+//  Implementation in scanEngine.c
+//
+
+typedef struct _SCAN_ENGINE SCAN_ENGINE, *PSCAN_ENGINE;
+
+PSCAN_ENGINE
+ScanEngineLoad (
+    _In_opt_ PCSTR SignatureFile
+    );
+
+VOID
+ScanEngineFree (
+    _In_opt_ PSCAN_ENGINE Engine
+    );
+
+BOOLEAN
+ScanEngineScan (
+    _In_ PSCAN_ENGINE Engine,
+    _In_reads_bytes_(BufferSize) PUCHAR Buffer,
+    _In_ ULONG BufferSize,
+    _Inout_ PULONG State
+    );
+
 #endif //  __SCANUSER_H__
 
 
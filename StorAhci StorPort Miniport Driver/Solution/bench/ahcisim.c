@@ -0,0 +1,844 @@
+/*++
+
+Copyright (C) Microsoft Corporation, 2009
+
+Module Name:
+
+    ahcisim.c
+
+Abstract:
+    User mode benchmark of the StorAhci NCQ slot manager, driven by a simulated AHCI port.
+
+    The simulated port has a register file (PxCI and PxSACT) and a device behind it that completes
+    each NCQ command after a random service time, in any order, the way a disk reports completions
+    in Set Device Bits FISes. A host keeps the port's slots busy with a mix of high and normal
+    priority IO.
+
+    Two versions of the miniport code paths that the slot manager is made of are measured:
+    - old: GetSlotToActivate and the completion loop of AhciCompleteIssuedSRBs as they were before
+      the slot scan used _BitScanForward. Every slot up to CAP.NCS is tested, and a pending high
+      priority command keeps normal priority commands from being activated.
+    - new: the current io.c. Only the set bits of the slot masks are visited, and normal priority
+      commands leave AHCI_HIGH_PRIORITY_RESERVED_SLOTS free for high priority ones.
+
+    Both are copies of the NCQ paths of ActivateQueue, GetSlotToActivate, the completion part of
+    AhciHwInterrupt and AhciCompleteIssuedSRBs, reduced to their slot manager work. The miniport
+    itself only builds against the Storport headers in the WDK. Single IO, non-NCQ commands, error
+    recovery and the IO trace are not modeled.
+
+    The processor cycles spent in those paths are counted with __rdtsc and reported per completed
+    IO, along with completions per second of the whole simulation. The simulation runs in virtual
+    time, so the time high and normal priority commands wait to be activated does not depend on
+    the machine running it.
+
+Notes:
+
+Revision History:
+
+--*/
+
+#include <windows.h>
+#include <intrin.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#define AHCI_MAX_NCQ_REQUEST_COUNT              32
+
+// these match entrypts.h
+#define AHCI_HIGH_PRIORITY_RESERVED_SLOTS       2
+#define AHCI_HIGH_PRIORITY_RESERVATION_MIN_QD   8
+
+#define AHCISIM_DEFAULT_COMPLETIONS             2000000
+#define AHCISIM_DEFAULT_SERVICE_US              100
+#define AHCISIM_DEFAULT_HIGH_PRIORITY_PERCENT   10
+
+// CAP.NCS of the simulated controller, 32 command slots. Slot 0 is kept for internal commands.
+#define AHCISIM_NCS                             31
+
+// wait times are kept in a histogram with four buckets per power of two nanoseconds
+#define AHCISIM_BUCKETS                         (64 * 4)
+
+typedef enum _AHCISIM_VERSION {
+    AhciSimOld = 0,
+    AhciSimNew,
+    AhciSimVersionCount
+} AHCISIM_VERSION;
+
+const char *AhciSimVersionNames[AhciSimVersionCount] = { "old", "new" };
+
+//
+// The simulated port. The miniport only sees the registers.
+//
+typedef struct _AHCISIM_PORT {
+    volatile ULONG  CI;
+    volatile ULONG  SACT;
+
+    // device side
+    ULONG           KnownCommands;
+    ULONGLONG       DueTime[AHCI_MAX_NCQ_REQUEST_COUNT];
+} AHCISIM_PORT, *PAHCISIM_PORT;
+
+//
+// The parts of SLOT_MANAGER that NCQ IO goes through.
+//
+typedef struct _AHCISIM_SLOT_MANAGER {
+    ULONG   HighPriorityAttribute;
+    ULONG   NCQueueSlice;
+    ULONG   CommandsIssued;
+    ULONG   CommandsToComplete;
+} AHCISIM_SLOT_MANAGER, *PAHCISIM_SLOT_MANAGER;
+
+typedef struct _AHCISIM_SLOT {
+    BOOLEAN     InUse;
+    BOOLEAN     HighPriority;
+    ULONGLONG   SubmitTime;
+} AHCISIM_SLOT, *PAHCISIM_SLOT;
+
+typedef struct _AHCISIM_CHANNEL {
+    AHCISIM_SLOT_MANAGER    SlotManager;
+    UCHAR                   LastActiveSlot;
+    UCHAR                   MaxPortQueueDepth;
+    UCHAR                   MaxDeviceQueueDepth;
+    UCHAR                   Ncs;
+    PAHCISIM_PORT           Px;
+    AHCISIM_SLOT            Slot[AHCI_MAX_NCQ_REQUEST_COUNT];
+
+    // host side
+    ULONGLONG               Now;
+    ULONGLONG               Seed;
+    ULONG                   FreeTags;
+    ULONGLONG               Completed;
+    ULONG                   ActivatedSlots;
+    ULONG                   IssuedAtActivation;
+    ULONGLONG               Activations;
+    ULONGLONG               ActivatedCommands;
+    ULONGLONG               DeviceQueueDepthSum;
+    ULONGLONG               Cycles;
+    ULONGLONG               HighCount;
+    ULONGLONG               HighWait[AHCISIM_BUCKETS];
+    ULONGLONG               NormalCount;
+    ULONGLONG               NormalWait[AHCISIM_BUCKETS];
+} AHCISIM_CHANNEL, *PAHCISIM_CHANNEL;
+
+
+VOID
+Usage (
+    VOID
+    )
+{
+    printf("Benchmarks the StorAhci NCQ slot manager against a simulated AHCI port\n");
+    printf("Usage: ahcisim [completions] [device queue depth] [high priority %%] [service time us]\n");
+    printf("    Number of IO to complete with each version (default %d)\n", AHCISIM_DEFAULT_COMPLETIONS);
+    printf("    Queue depth reported by the device, 1 to %d (default %d)\n", AHCISIM_NCS, AHCISIM_NCS);
+    printf("    Percentage of high priority IO (default %d)\n", AHCISIM_DEFAULT_HIGH_PRIORITY_PERCENT);
+    printf("    Mean time the device takes to complete a command (default %d us)\n", AHCISIM_DEFAULT_SERVICE_US);
+}
+
+ULONGLONG
+AhciSimRandom (
+    _Inout_ PULONGLONG Seed
+    )
+{
+    ULONGLONG x = *Seed;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *Seed = x;
+
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+ULONG
+AhciSimBucket (
+    _In_ ULONGLONG Nanoseconds
+    )
+{
+    ULONG msb = 0;
+
+    if (Nanoseconds < 4) {
+        return (ULONG)Nanoseconds;
+    }
+
+    while ((Nanoseconds >> msb) > 1) {
+        msb++;
+    }
+
+    return (msb * 4) + (ULONG)((Nanoseconds >> (msb - 2)) & 3);
+}
+
+ULONGLONG
+AhciSimBucketLimit (
+    _In_ ULONG Bucket
+    )
+/*++
+    Returns the largest value that falls in the given histogram bucket.
+--*/
+{
+    ULONG msb = Bucket / 4;
+
+    if (Bucket < 4) {
+        return Bucket;
+    }
+
+    return ((4ULL + (Bucket & 3) + 1) << (msb - 2)) - 1;
+}
+
+ULONGLONG
+AhciSimPercentile (
+    _In_reads_(AHCISIM_BUCKETS) PULONGLONG Histogram,
+    _In_ ULONGLONG Count,
+    _In_ ULONG PerThousand
+    )
+{
+    ULONGLONG target = (Count * PerThousand + 999) / 1000;
+    ULONGLONG seen = 0;
+    ULONG i;
+
+    for (i = 0; i < AHCISIM_BUCKETS; i++) {
+        seen += Histogram[i];
+        if ((seen >= target) && (seen > 0)) {
+            return AhciSimBucketLimit(i);
+        }
+    }
+
+    return 0;
+}
+
+__inline
+ULONG
+StorPortReadRegisterUlong (
+    _In_ volatile ULONG *Register
+    )
+{
+    return *Register;
+}
+
+__inline
+VOID
+StorPortWriteRegisterUlong (
+    _In_ volatile ULONG *Register,
+    _In_ ULONG Value
+    )
+{
+    // PxCI and PxSACT are write 1 to set
+    *Register |= Value;
+}
+
+__inline
+UCHAR
+NumberOfSetBits (
+    _In_ ULONG Value
+    )
+/*++
+    This routine emulates the __popcnt intrinsic function, as util.h.
+--*/
+{
+    Value -= (Value >> 1) & 0x55555555;
+    Value = (Value & 0x33333333) + ((Value >> 2) & 0x33333333);
+    Value = (Value + (Value >> 4)) & 0x0F0F0F0F;
+
+    return (UCHAR)((Value * 0x01010101) >> 24);
+}
+
+VOID
+AhciSimReleaseSlot (
+    _In_ PAHCISIM_CHANNEL ChannelExtension,
+    _In_ UCHAR SlotNumber
+    )
+/*++
+    Gives a completed slot back, as ReleaseSlottedCommand does for an NCQ command, and hands the
+    request back to the host.
+--*/
+{
+    ChannelExtension->SlotManager.CommandsToComplete &= ~(1 << SlotNumber);
+    ChannelExtension->SlotManager.HighPriorityAttribute &= ~(1 << SlotNumber);
+
+    ChannelExtension->Slot[SlotNumber].InUse = FALSE;
+    ChannelExtension->FreeTags |= (1 << SlotNumber);
+    ChannelExtension->Completed++;
+}
+
+__inline
+VOID
+AhciSimRecordActivation (
+    _In_ PAHCISIM_CHANNEL ChannelExtension,
+    _In_ ULONG SlotsToActivate
+    )
+/*++
+    Remembers which commands were activated. They are accounted for by AhciSimAccount once the
+    measured code returns.
+--*/
+{
+    ChannelExtension->ActivatedSlots = SlotsToActivate;
+    ChannelExtension->IssuedAtActivation = ChannelExtension->SlotManager.CommandsIssued;
+}
+
+VOID
+AhciSimAccount (
+    _In_ PAHCISIM_CHANNEL ChannelExtension
+    )
+/*++
+    Accounts for the time each activated command waited in the NCQ slice. This is the
+    simulation's bookkeeping, it is not part of the miniport code being measured.
+--*/
+{
+    PAHCISIM_SLOT slot;
+    ULONG slots = ChannelExtension->ActivatedSlots;
+    ULONG index;
+
+    if (slots == 0) {
+        return;
+    }
+
+    ChannelExtension->ActivatedSlots = 0;
+    ChannelExtension->Activations++;
+    ChannelExtension->DeviceQueueDepthSum += NumberOfSetBits(ChannelExtension->IssuedAtActivation);
+
+    while (_BitScanForward(&index, slots)) {
+        slots &= slots - 1;
+        slot = &ChannelExtension->Slot[index];
+        ChannelExtension->ActivatedCommands++;
+
+        if (slot->HighPriority) {
+            ChannelExtension->HighCount++;
+            ChannelExtension->HighWait[AhciSimBucket(ChannelExtension->Now - slot->SubmitTime)]++;
+        } else {
+            ChannelExtension->NormalCount++;
+            ChannelExtension->NormalWait[AhciSimBucket(ChannelExtension->Now - slot->SubmitTime)]++;
+        }
+    }
+}
+
+//
+// The miniport paths before the change (5b763f4).
+//
+
+ULONG
+OldGetSlotToActivate(
+    _In_ PAHCISIM_CHANNEL ChannelExtension,
+    _In_ ULONG            TargetSlots
+    )
+{
+    UCHAR activeCount = 0;
+    UCHAR emptyCount;
+    UCHAR requestCount;
+    UCHAR lastActiveSlot;
+    ULONG slotToActivate = 0;
+    UCHAR i;
+
+    //count the number of slots already in use
+    if (ChannelExtension->SlotManager.CommandsIssued > 0) {
+        activeCount = NumberOfSetBits(ChannelExtension->SlotManager.CommandsIssued);
+    }
+    //1.1 Check if all slots are active.
+    if (activeCount >= ChannelExtension->MaxDeviceQueueDepth) {
+        //if all possible slots are full, no matter what, return no work (0)
+        return 0;
+    }
+
+  //2 Look for any entry from last active slot
+    requestCount = NumberOfSetBits(TargetSlots);
+    lastActiveSlot = ChannelExtension->LastActiveSlot;
+    emptyCount = ChannelExtension->MaxDeviceQueueDepth - activeCount;
+
+  //3.1 Look for any entry from last active slot
+    for (i = lastActiveSlot; i <= ChannelExtension->Ncs; i++) {
+        if ((TargetSlots & (1 << i)) > 0) {
+            slotToActivate |= (1 << i);
+            emptyCount--;
+            requestCount--;
+            if (emptyCount == 0 || requestCount == 0) {
+                ChannelExtension->LastActiveSlot = i;
+                return slotToActivate;
+            }
+        }
+    }
+
+  //3.2 Look for any entry from beginning to last active slot
+  //Slot 0 is reserved for internal command
+    for (i = 1 ; i <= lastActiveSlot; i++) {
+        if ((TargetSlots & (1 << i)) > 0) {
+            slotToActivate |= (1 << i);
+            emptyCount--;
+            requestCount--;
+            if (emptyCount == 0 || requestCount == 0) {
+                ChannelExtension->LastActiveSlot = i;
+                return slotToActivate;
+            }
+        }
+    }
+
+    return slotToActivate;
+}
+
+VOID
+OldActivateQueue(
+    _In_ PAHCISIM_CHANNEL ChannelExtension
+    )
+{
+    ULONG   sact;
+    ULONG   ci;
+    ULONG   slotsToActivate = 0;
+
+    if (ChannelExtension->SlotManager.NCQueueSlice == 0) {
+        return;
+    }
+
+    sact = StorPortReadRegisterUlong(&ChannelExtension->Px->SACT);
+    ci = StorPortReadRegisterUlong(&ChannelExtension->Px->CI);
+
+    if ( ( ci != 0 ) && (sact == 0) ) {
+        slotsToActivate = 0;
+    } else {
+        //Grab the High Priority NCQ IO before the Low Priority NCQ IO
+        slotsToActivate = ChannelExtension->SlotManager.HighPriorityAttribute & ChannelExtension->SlotManager.NCQueueSlice;
+        //If there aren't any High Priority, grab everything else
+        if (slotsToActivate == 0) {
+            slotsToActivate = ChannelExtension->SlotManager.NCQueueSlice;
+        }
+        //and apply any device outstanding IO limits to filter down which IO to activate
+        if (slotsToActivate > 0) {
+            if (ChannelExtension->MaxDeviceQueueDepth < ChannelExtension->MaxPortQueueDepth ) {
+                slotsToActivate = OldGetSlotToActivate(ChannelExtension, slotsToActivate);
+            }
+            if (slotsToActivate > 0) {
+                ChannelExtension->SlotManager.NCQueueSlice &= ~slotsToActivate;
+            }
+        }
+    }
+
+    if (slotsToActivate != 0) {
+        ChannelExtension->SlotManager.CommandsIssued |= slotsToActivate;
+
+        StorPortWriteRegisterUlong(&ChannelExtension->Px->SACT, slotsToActivate);
+        StorPortWriteRegisterUlong(&ChannelExtension->Px->CI, slotsToActivate);
+
+        AhciSimRecordActivation(ChannelExtension, slotsToActivate);
+    }
+}
+
+VOID
+OldCompleteIssuedSRBs(
+    _In_ PAHCISIM_CHANNEL ChannelExtension
+    )
+{
+    ULONG i;
+
+  //2.1 For every command marked as completed
+    for (i = 0; i <= ChannelExtension->Ncs; i++) {
+        if( ( ChannelExtension->SlotManager.CommandsToComplete & (1 << i) ) > 0) {
+            AhciSimReleaseSlot(ChannelExtension, (UCHAR)i);
+        }
+    }
+
+  //3.1 Start the next IO(s) if any
+    OldActivateQueue(ChannelExtension);
+}
+
+//
+// The current miniport paths.
+//
+
+__inline
+ULONG
+SelectSlotsCircular (
+    _In_ ULONG      Slots,
+    _In_ UCHAR      StartSlot,
+    _In_ UCHAR      MaxCount,
+    _Inout_ PUCHAR  LastSelectedSlot
+    )
+{
+    ULONG   selected = 0;
+    ULONG   pending;
+    ULONG   index;
+    UCHAR   pass;
+
+    // first pass covers StartSlot and above, second pass wraps around to the slots below it
+    for (pass = 0; (pass < 2) && (MaxCount > 0); pass++) {
+        pending = (pass == 0) ? (Slots & ~((1UL << StartSlot) - 1)) : (Slots & ((1UL << StartSlot) - 1));
+
+        while ((MaxCount > 0) && _BitScanForward(&index, pending)) {
+            pending &= pending - 1;     // clear the lowest set bit
+            selected |= (1UL << index);
+            *LastSelectedSlot = (UCHAR)index;
+            MaxCount--;
+        }
+    }
+
+    return selected;
+}
+
+ULONG
+GetSlotToActivate(
+    _In_ PAHCISIM_CHANNEL ChannelExtension,
+    _In_ ULONG            HighPrioritySlots,
+    _In_ ULONG            NormalPrioritySlots
+    )
+{
+    UCHAR activeCount;
+    UCHAR emptyCount;
+    UCHAR maxDepth;
+    UCHAR reservedCount;
+    UCHAR lastActiveSlot;
+    ULONG slotsToActivate;
+
+    maxDepth = ChannelExtension->MaxDeviceQueueDepth;
+
+    activeCount = NumberOfSetBits(ChannelExtension->SlotManager.CommandsIssued);
+    if (activeCount >= maxDepth) {
+        //if all possible slots are full, no matter what, return no work (0)
+        return 0;
+    }
+
+    emptyCount = maxDepth - activeCount;
+    lastActiveSlot = ChannelExtension->LastActiveSlot;
+
+  //2.1 High priority IO may use every free slot
+    slotsToActivate = SelectSlotsCircular(HighPrioritySlots, lastActiveSlot, emptyCount, &ChannelExtension->LastActiveSlot);
+    activeCount += NumberOfSetBits(slotsToActivate);
+
+  //3.1 Normal priority IO may not use the slots reserved for high priority IO
+    reservedCount = (maxDepth >= AHCI_HIGH_PRIORITY_RESERVATION_MIN_QD) ? AHCI_HIGH_PRIORITY_RESERVED_SLOTS : 0;
+
+    if ((NormalPrioritySlots != 0) && ((activeCount + reservedCount) < maxDepth)) {
+        slotsToActivate |= SelectSlotsCircular(NormalPrioritySlots,
+                                               lastActiveSlot,
+                                               maxDepth - reservedCount - activeCount,
+                                               &ChannelExtension->LastActiveSlot);
+    }
+
+    return slotsToActivate;
+}
+
+VOID
+ActivateQueue(
+    _In_ PAHCISIM_CHANNEL ChannelExtension
+    )
+{
+    ULONG   sact;
+    ULONG   ci;
+    ULONG   slotsToActivate = 0;
+    ULONG   highPrioritySlots;
+
+    if (ChannelExtension->SlotManager.NCQueueSlice == 0) {
+        return;
+    }
+
+    sact = StorPortReadRegisterUlong(&ChannelExtension->Px->SACT);
+    ci = StorPortReadRegisterUlong(&ChannelExtension->Px->CI);
+
+    if ( ( ci != 0 ) && (sact == 0) ) {
+        slotsToActivate = 0;
+    } else {
+        if (ChannelExtension->MaxDeviceQueueDepth < ChannelExtension->MaxPortQueueDepth) {
+            //Grab the High Priority NCQ IO before the Low Priority NCQ IO
+            highPrioritySlots = ChannelExtension->SlotManager.HighPriorityAttribute & ChannelExtension->SlotManager.NCQueueSlice;
+
+            //apply device outstanding IO limits and the high priority reservation to filter down which IO to activate
+            slotsToActivate = GetSlotToActivate(ChannelExtension,
+                                                highPrioritySlots,
+                                                ChannelExtension->SlotManager.NCQueueSlice & ~highPrioritySlots);
+        } else {
+            //the device takes as many commands as the port has slots, so every programmed command can be activated now
+            slotsToActivate = ChannelExtension->SlotManager.NCQueueSlice;
+        }
+
+        if (slotsToActivate > 0) {
+            ChannelExtension->SlotManager.NCQueueSlice &= ~slotsToActivate;
+        }
+    }
+
+    if (slotsToActivate != 0) {
+        ChannelExtension->SlotManager.CommandsIssued |= slotsToActivate;
+
+        StorPortWriteRegisterUlong(&ChannelExtension->Px->SACT, slotsToActivate);
+        StorPortWriteRegisterUlong(&ChannelExtension->Px->CI, slotsToActivate);
+
+        AhciSimRecordActivation(ChannelExtension, slotsToActivate);
+    }
+}
+
+VOID
+AhciCompleteIssuedSRBs(
+    _In_ PAHCISIM_CHANNEL ChannelExtension
+    )
+{
+    ULONG pendingCommands;
+    ULONG i;
+
+  //2.1 For every command marked as completed
+    pendingCommands = ChannelExtension->SlotManager.CommandsToComplete;
+
+    while (_BitScanForward(&i, pendingCommands)) {
+        pendingCommands &= pendingCommands - 1;
+
+        //completing an earlier slot may have already given this one back
+        if( ( ChannelExtension->SlotManager.CommandsToComplete & (1 << i) ) > 0) {
+            AhciSimReleaseSlot(ChannelExtension, (UCHAR)i);
+        }
+    }
+
+  //3.1 Start the next IO(s) if any
+    ActivateQueue(ChannelExtension);
+}
+
+//
+// Simulation
+//
+
+VOID
+AhciSimInterrupt (
+    _In_ PAHCISIM_CHANNEL ChannelExtension,
+    _In_ AHCISIM_VERSION Version
+    )
+/*++
+    The completion part of AhciHwInterrupt: commands the port no longer reports as outstanding are
+    moved from CommandsIssued to CommandsToComplete, and completed.
+--*/
+{
+    ULONG ci;
+    ULONG sact;
+    ULONG outstanding;
+
+    ci = StorPortReadRegisterUlong(&ChannelExtension->Px->CI);
+    sact = StorPortReadRegisterUlong(&ChannelExtension->Px->SACT);
+
+    outstanding = ci | sact;
+
+    if( (ChannelExtension->SlotManager.CommandsIssued & ~outstanding) > 0 ) {
+        ChannelExtension->SlotManager.CommandsToComplete |= (ChannelExtension->SlotManager.CommandsIssued & ~outstanding);
+        ChannelExtension->SlotManager.CommandsIssued &= outstanding;
+
+        if (Version == AhciSimOld) {
+            OldCompleteIssuedSRBs(ChannelExtension);
+        } else {
+            AhciCompleteIssuedSRBs(ChannelExtension);
+        }
+    }
+}
+
+VOID
+AhciSimSubmit (
+    _In_ PAHCISIM_CHANNEL ChannelExtension,
+    _In_ AHCISIM_VERSION Version,
+    _In_ ULONG HighPriorityPercent
+    )
+/*++
+    The host sends a request for every free tag. Each one is put in the NCQ slice and the queue is
+    activated, as AhciProcessIo does.
+--*/
+{
+    ULONG tag;
+    ULONGLONG start;
+
+    while (_BitScanForward(&tag, ChannelExtension->FreeTags)) {
+        ChannelExtension->FreeTags &= ~(1 << tag);
+        ChannelExtension->Slot[tag].InUse = TRUE;
+        ChannelExtension->Slot[tag].SubmitTime = ChannelExtension->Now;
+        ChannelExtension->Slot[tag].HighPriority = (BOOLEAN)((AhciSimRandom(&ChannelExtension->Seed) % 100) < HighPriorityPercent);
+
+        start = __rdtsc();
+
+        ChannelExtension->SlotManager.NCQueueSlice |= (1 << tag);
+        if (ChannelExtension->Slot[tag].HighPriority) {
+            ChannelExtension->SlotManager.HighPriorityAttribute |= (1 << tag);
+        }
+
+        if (Version == AhciSimOld) {
+            OldActivateQueue(ChannelExtension);
+        } else {
+            ActivateQueue(ChannelExtension);
+        }
+
+        ChannelExtension->Cycles += __rdtsc() - start;
+
+        AhciSimAccount(ChannelExtension);
+    }
+}
+
+BOOLEAN
+AhciSimDeviceStep (
+    _In_ PAHCISIM_CHANNEL ChannelExtension,
+    _In_ ULONGLONG MeanServiceNs
+    )
+/*++
+    Picks up the commands issued since the last step, then advances the virtual clock to the next
+    completion and clears the PxSACT and PxCI bits of every command that is done by then.
+
+Return Value:
+    FALSE if the device has nothing to do.
+--*/
+{
+    PAHCISIM_PORT px = ChannelExtension->Px;
+    ULONG newCommands;
+    ULONG pending;
+    ULONG index;
+    ULONGLONG next = MAXULONGLONG;
+    ULONGLONG random;
+
+    newCommands = px->SACT & ~px->KnownCommands;
+
+    while (_BitScanForward(&index, newCommands)) {
+        newCommands &= newCommands - 1;
+
+        // exponentially distributed service time
+        random = AhciSimRandom(&ChannelExtension->Seed) >> 11;
+        px->DueTime[index] = ChannelExtension->Now +
+                             (ULONGLONG)(-log(((double)random + 1.0) / 9007199254740992.0) * MeanServiceNs);
+    }
+
+    px->KnownCommands = px->SACT;
+
+    if (px->SACT == 0) {
+        return FALSE;
+    }
+
+    pending = px->SACT;
+    while (_BitScanForward(&index, pending)) {
+        pending &= pending - 1;
+        next = min(next, px->DueTime[index]);
+    }
+
+    ChannelExtension->Now = max(ChannelExtension->Now, next);
+
+    pending = px->SACT;
+    while (_BitScanForward(&index, pending)) {
+        pending &= pending - 1;
+        if (px->DueTime[index] <= ChannelExtension->Now) {
+            px->SACT &= ~(1 << index);
+            px->CI &= ~(1 << index);
+        }
+    }
+
+    px->KnownCommands = px->SACT;
+
+    return TRUE;
+}
+
+VOID
+AhciSimReport (
+    _In_ PAHCISIM_CHANNEL ChannelExtension,
+    _In_ AHCISIM_VERSION Version,
+    _In_ double Seconds
+    )
+{
+    printf("%-4s %12.0f %9.1f %7.1f %8.1f %10.1f %10.1f %10.1f %10.1f\n",
+           AhciSimVersionNames[Version],
+           ChannelExtension->Completed / Seconds,
+           (double)ChannelExtension->Cycles / ChannelExtension->Completed,
+           (double)ChannelExtension->DeviceQueueDepthSum / ChannelExtension->Activations,
+           (double)ChannelExtension->ActivatedCommands / ChannelExtension->Activations,
+           AhciSimPercentile(ChannelExtension->HighWait, ChannelExtension->HighCount, 500) / 1000.0,
+           AhciSimPercentile(ChannelExtension->HighWait, ChannelExtension->HighCount, 990) / 1000.0,
+           AhciSimPercentile(ChannelExtension->NormalWait, ChannelExtension->NormalCount, 500) / 1000.0,
+           AhciSimPercentile(ChannelExtension->NormalWait, ChannelExtension->NormalCount, 990) / 1000.0);
+}
+
+int __cdecl
+main (
+    _In_ int argc,
+    _In_reads_(argc) char *argv[]
+    )
+{
+    PAHCISIM_CHANNEL channelExtension;
+    AHCISIM_PORT port;
+    ULONGLONG completions = AHCISIM_DEFAULT_COMPLETIONS;
+    ULONG deviceQueueDepth = AHCISIM_NCS;
+    ULONG highPriorityPercent = AHCISIM_DEFAULT_HIGH_PRIORITY_PERCENT;
+    ULONG serviceUs = AHCISIM_DEFAULT_SERVICE_US;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    ULONGLONG cycles;
+    ULONG version;
+
+    if (argc > 1) {
+        if (argv[1][0] == '?' || argv[1][0] == '-' || argv[1][0] == '/') {
+            Usage();
+            return 0;
+        }
+        completions = _strtoui64(argv[1], NULL, 10);
+    }
+
+    if (argc > 2) {
+        deviceQueueDepth = atoi(argv[2]);
+    }
+
+    if (argc > 3) {
+        highPriorityPercent = atoi(argv[3]);
+    }
+
+    if (argc > 4) {
+        serviceUs = atoi(argv[4]);
+    }
+
+    if ((completions == 0) || (deviceQueueDepth == 0) || (deviceQueueDepth > AHCISIM_NCS) ||
+        (highPriorityPercent > 100) || (serviceUs == 0)) {
+        Usage();
+        return 1;
+    }
+
+    channelExtension = malloc(sizeof(AHCISIM_CHANNEL));
+
+    if (channelExtension == NULL) {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    QueryPerformanceFrequency(&frequency);
+
+    printf("AhciSim: %llu completions, device queue depth %u of %u slots, %u%% high priority, %u us mean service time\n",
+           completions,
+           deviceQueueDepth,
+           AHCISIM_NCS,
+           highPriorityPercent,
+           serviceUs);
+    printf("%-4s %12s %9s %7s %8s %10s %10s %10s %10s\n",
+           "", "IO/s", "cycles/IO", "dev QD", "IO/act", "hi p50 us", "hi p99 us", "lo p50 us", "lo p99 us");
+
+    for (version = 0; version < AhciSimVersionCount; version++) {
+
+        ZeroMemory(channelExtension, sizeof(AHCISIM_CHANNEL));
+        ZeroMemory(&port, sizeof(port));
+
+        channelExtension->Px = &port;
+        channelExtension->Ncs = AHCISIM_NCS;
+        channelExtension->MaxPortQueueDepth = AHCISIM_NCS;
+        channelExtension->MaxDeviceQueueDepth = (UCHAR)deviceQueueDepth;
+        channelExtension->LastActiveSlot = 1;
+        channelExtension->Seed = 1;
+
+        // slot 0 is kept for internal commands
+        channelExtension->FreeTags = 0xFFFFFFFE;
+
+        QueryPerformanceCounter(&start);
+
+        while (channelExtension->Completed < completions) {
+
+            AhciSimSubmit(channelExtension, (AHCISIM_VERSION)version, highPriorityPercent);
+
+            if (!AhciSimDeviceStep(channelExtension, serviceUs * 1000ULL)) {
+                printf("The %s version stopped activating commands\n", AhciSimVersionNames[version]);
+                return 1;
+            }
+
+            cycles = __rdtsc();
+            AhciSimInterrupt(channelExtension, (AHCISIM_VERSION)version);
+            channelExtension->Cycles += __rdtsc() - cycles;
+
+            AhciSimAccount(channelExtension);
+        }
+
+        QueryPerformanceCounter(&end);
+
+        AhciSimReport(channelExtension,
+                      (AHCISIM_VERSION)version,
+                      (double)(end.QuadPart - start.QuadPart) / frequency.QuadPart);
+    }
+
+    free(channelExtension);
+
+    return 0;
+}
@@ -0,0 +1,739 @@
+/*++
+
+Copyright (C) Microsoft Corporation, 2009
+
+Module Name:
+
+    ahcitrace.c
+
+Abstract:
+    Reads the per port IO trace of StorAHCI and decodes it into latency distributions and queue
+    depth over time.
+
+    The miniport keeps the newest AHCI_IO_TRACE_RECORD_COUNT completed commands of each port in a
+    ring, and returns them through IOCTL_SCSI_MINIPORT_AHCI_IO_TRACE. The ring is small, so the
+    capture polls it and stitches the records together by sequence number. Records that were
+    overwritten before they could be read are counted as lost.
+
+    A capture can be saved to a file and decoded later. The file is an AHCI_IO_TRACE_HEADER
+    followed by the records, the same layout the IOCTL returns.
+
+    The report has
+    - the latency distribution of each command, and of all of them;
+    - for each interval of time, the average number of commands outstanding on the port (from
+      the issue and completion times of the records), the deepest queue depth seen when a command
+      was issued, the completion rate and the mean latency.
+
+Notes:
+    ATA commands are named after their command register value. For ATAPI devices the trace holds
+    the CDB operation code, which is reported as is.
+
+Revision History:
+
+--*/
+
+#include <windows.h>
+#include <winioctl.h>
+#include <ntddscsi.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+//
+// These match entrypts.h
+//
+#define AHCI_IO_TRACE_RECORD_COUNT          128
+#define AHCI_IO_TRACE_VERSION               1
+#define IOCTL_SCSI_MINIPORT_AHCI_IO_TRACE   ((FILE_DEVICE_SCSI << 16) + 0x0F00)
+
+typedef struct _AHCI_IO_TRACE_RECORD {
+    ULONG       Sequence;       // 1-based, 0 means the record is not valid (unused or being written)
+    UCHAR       Slot;
+    UCHAR       Command;        // ATA command register value, or CDB operation code for ATAPI
+    UCHAR       SrbStatus;
+    UCHAR       QueueDepth;     // commands issued to the port, including this one, when this command was issued
+    ULONGLONG   IssueTime;      // performance counter value
+    ULONGLONG   CompleteTime;   // performance counter value
+} AHCI_IO_TRACE_RECORD, *PAHCI_IO_TRACE_RECORD;
+
+typedef struct _AHCI_IO_TRACE_HEADER {
+    ULONG       Version;
+    ULONG       RecordCount;        // number of AHCI_IO_TRACE_RECORD following this header, oldest first
+    ULONG       LastSequence;       // sequence number of the newest record written to the trace
+    ULONG       Reserved;
+    ULONGLONG   PerformanceFrequency;
+} AHCI_IO_TRACE_HEADER, *PAHCI_IO_TRACE_HEADER;
+
+#define AHCITRACE_SRB_STATUS(Status)        ((Status) & 0x3F)
+#define AHCITRACE_SRB_STATUS_SUCCESS        0x01
+
+#define AHCITRACE_DEFAULT_SECONDS           10
+#define AHCITRACE_DEFAULT_POLL_MS           5
+#define AHCITRACE_DEFAULT_BIN_MS            100
+#define AHCITRACE_BAR_WIDTH                 32
+
+typedef struct _AHCITRACE_IOCTL_BUFFER {
+    SRB_IO_CONTROL          SrbIoControl;
+    AHCI_IO_TRACE_HEADER    Header;
+    AHCI_IO_TRACE_RECORD    Records[AHCI_IO_TRACE_RECORD_COUNT];
+} AHCITRACE_IOCTL_BUFFER, *PAHCITRACE_IOCTL_BUFFER;
+
+typedef struct _AHCITRACE_CAPTURE {
+    ULONGLONG               PerformanceFrequency;
+    PAHCI_IO_TRACE_RECORD   Records;
+    ULONG                   RecordCount;
+    ULONG                   Capacity;
+    ULONG                   LastSequence;
+    ULONG                   Lost;
+} AHCITRACE_CAPTURE, *PAHCITRACE_CAPTURE;
+
+typedef struct _AHCITRACE_EVENT {
+    ULONGLONG   Time;
+    LONG        Delta;
+} AHCITRACE_EVENT, *PAHCITRACE_EVENT;
+
+typedef struct _AHCITRACE_COMMAND_NAME {
+    UCHAR       Command;
+    const char  *Name;
+} AHCITRACE_COMMAND_NAME;
+
+const AHCITRACE_COMMAND_NAME AhciTraceCommandNames[] = {
+    { 0x06, "DATA SET MANAGEMENT" },
+    { 0x25, "READ DMA EXT" },
+    { 0x2F, "READ LOG EXT" },
+    { 0x35, "WRITE DMA EXT" },
+    { 0x47, "READ LOG DMA EXT" },
+    { 0x60, "READ FPDMA QUEUED" },
+    { 0x61, "WRITE FPDMA QUEUED" },
+    { 0x64, "SEND FPDMA QUEUED" },
+    { 0xB0, "SMART" },
+    { 0xC8, "READ DMA" },
+    { 0xCA, "WRITE DMA" },
+    { 0xE0, "STANDBY IMMEDIATE" },
+    { 0xE7, "FLUSH CACHE" },
+    { 0xEA, "FLUSH CACHE EXT" },
+    { 0xEC, "IDENTIFY DEVICE" },
+    { 0xEF, "SET FEATURES" },
+};
+
+
+VOID
+Usage (
+    VOID
+    )
+{
+    printf("Decodes the StorAHCI per port IO trace\n");
+    printf("Usage: ahcitrace -d disk [-t seconds] [-p poll ms] [-w file] [-b bin ms] [-c]\n");
+    printf("       ahcitrace -r file [-b bin ms] [-c]\n");
+    printf("    -d  Capture the trace of the port \\\\.\\PhysicalDrive<disk> is on\n");
+    printf("    -t  Capture for this long (default %d s)\n", AHCITRACE_DEFAULT_SECONDS);
+    printf("    -p  Read the trace this often (default %d ms)\n", AHCITRACE_DEFAULT_POLL_MS);
+    printf("    -w  Save the capture to a file\n");
+    printf("    -r  Decode a saved capture\n");
+    printf("    -b  Report the queue depth over intervals of this length (default %d ms)\n", AHCITRACE_DEFAULT_BIN_MS);
+    printf("    -c  Report the queue depth over time as CSV\n");
+}
+
+const char *
+AhciTraceCommandName (
+    _In_ UCHAR Command
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < RTL_NUMBER_OF(AhciTraceCommandNames); i++) {
+        if (AhciTraceCommandNames[i].Command == Command) {
+            return AhciTraceCommandNames[i].Name;
+        }
+    }
+
+    return "";
+}
+
+BOOLEAN
+AhciTraceAddRecord (
+    _Inout_ PAHCITRACE_CAPTURE Capture,
+    _In_ PAHCI_IO_TRACE_RECORD Record
+    )
+{
+    PAHCI_IO_TRACE_RECORD records;
+
+    if (Capture->RecordCount == Capture->Capacity) {
+        Capture->Capacity = (Capture->Capacity == 0) ? 65536 : (Capture->Capacity * 2);
+        records = realloc(Capture->Records, Capture->Capacity * sizeof(AHCI_IO_TRACE_RECORD));
+
+        if (records == NULL) {
+            return FALSE;
+        }
+
+        Capture->Records = records;
+    }
+
+    Capture->Records[Capture->RecordCount++] = *Record;
+
+    return TRUE;
+}
+
+BOOLEAN
+AhciTraceCapture (
+    _Inout_ PAHCITRACE_CAPTURE Capture,
+    _In_ ULONG Disk,
+    _In_ ULONG Seconds,
+    _In_ ULONG PollMilliseconds
+    )
+/*++
+    Polls the port's IO trace for the given time and keeps every record not seen before.
+    A gap between the newest record already kept and the oldest one returned means records
+    were overwritten in between.
+--*/
+{
+    PAHCITRACE_IOCTL_BUFFER buffer;
+    HANDLE device;
+    WCHAR deviceName[64];
+    ULONG bytesReturned;
+    ULONGLONG startTime;
+    ULONG i;
+
+    swprintf_s(deviceName, RTL_NUMBER_OF(deviceName), L"\\\\.\\PhysicalDrive%u", Disk);
+
+    device = CreateFileW(deviceName,
+                         GENERIC_READ | GENERIC_WRITE,
+                         FILE_SHARE_READ | FILE_SHARE_WRITE,
+                         NULL,
+                         OPEN_EXISTING,
+                         0,
+                         NULL);
+
+    if (device == INVALID_HANDLE_VALUE) {
+        printf("Can't open %ws: %u\n", deviceName, GetLastError());
+        return FALSE;
+    }
+
+    buffer = malloc(sizeof(AHCITRACE_IOCTL_BUFFER));
+
+    if (buffer == NULL) {
+        printf("Out of memory\n");
+        CloseHandle(device);
+        return FALSE;
+    }
+
+    startTime = GetTickCount64();
+
+    while (GetTickCount64() - startTime < Seconds * 1000ULL) {
+
+        ZeroMemory(buffer, sizeof(AHCITRACE_IOCTL_BUFFER));
+        buffer->SrbIoControl.HeaderLength = sizeof(SRB_IO_CONTROL);
+        CopyMemory(buffer->SrbIoControl.Signature, "SCSIDISK", sizeof(buffer->SrbIoControl.Signature));
+        buffer->SrbIoControl.Timeout = 10;
+        buffer->SrbIoControl.ControlCode = IOCTL_SCSI_MINIPORT_AHCI_IO_TRACE;
+        buffer->SrbIoControl.Length = sizeof(AHCITRACE_IOCTL_BUFFER) - sizeof(SRB_IO_CONTROL);
+
+        if (!DeviceIoControl(device,
+                             IOCTL_SCSI_MINIPORT,
+                             buffer,
+                             sizeof(AHCITRACE_IOCTL_BUFFER),
+                             buffer,
+                             sizeof(AHCITRACE_IOCTL_BUFFER),
+                             &bytesReturned,
+                             NULL)) {
+            printf("IOCTL_SCSI_MINIPORT_AHCI_IO_TRACE failed: %u\n", GetLastError());
+            free(buffer);
+            CloseHandle(device);
+            return FALSE;
+        }
+
+        if (buffer->Header.Version != AHCI_IO_TRACE_VERSION) {
+            printf("Unknown IO trace version %u\n", buffer->Header.Version);
+            free(buffer);
+            CloseHandle(device);
+            return FALSE;
+        }
+
+        if (buffer->Header.PerformanceFrequency != 0) {
+            Capture->PerformanceFrequency = buffer->Header.PerformanceFrequency;
+        }
+
+        for (i = 0; (i < buffer->Header.RecordCount) && (i < AHCI_IO_TRACE_RECORD_COUNT); i++) {
+            if (buffer->Records[i].Sequence <= Capture->LastSequence) {
+                continue;
+            }
+
+            // the first poll starts wherever the ring is, only later gaps are losses
+            if (Capture->LastSequence != 0) {
+                Capture->Lost += buffer->Records[i].Sequence - Capture->LastSequence - 1;
+            }
+
+            Capture->LastSequence = buffer->Records[i].Sequence;
+
+            if (!AhciTraceAddRecord(Capture, &buffer->Records[i])) {
+                printf("Out of memory\n");
+                free(buffer);
+                CloseHandle(device);
+                return FALSE;
+            }
+        }
+
+        Sleep(PollMilliseconds);
+    }
+
+    free(buffer);
+    CloseHandle(device);
+
+    return TRUE;
+}
+
+BOOLEAN
+AhciTraceSave (
+    _In_ PAHCITRACE_CAPTURE Capture,
+    _In_ const char *FileName
+    )
+{
+    AHCI_IO_TRACE_HEADER header = {0};
+    FILE *file;
+    BOOLEAN success;
+
+    if (fopen_s(&file, FileName, "wb") != 0) {
+        printf("Can't create %s\n", FileName);
+        return FALSE;
+    }
+
+    header.Version = AHCI_IO_TRACE_VERSION;
+    header.RecordCount = Capture->RecordCount;
+    header.LastSequence = Capture->LastSequence;
+    header.PerformanceFrequency = Capture->PerformanceFrequency;
+
+    success = (fwrite(&header, sizeof(header), 1, file) == 1) &&
+              (fwrite(Capture->Records, sizeof(AHCI_IO_TRACE_RECORD), Capture->RecordCount, file) == Capture->RecordCount);
+
+    if (fclose(file) != 0) {
+        success = FALSE;
+    }
+
+    if (!success) {
+        printf("Can't write %s\n", FileName);
+    }
+
+    return success;
+}
+
+BOOLEAN
+AhciTraceLoad (
+    _Inout_ PAHCITRACE_CAPTURE Capture,
+    _In_ const char *FileName
+    )
+{
+    AHCI_IO_TRACE_HEADER header;
+    AHCI_IO_TRACE_RECORD record;
+    FILE *file;
+    ULONG i;
+
+    if (fopen_s(&file, FileName, "rb") != 0) {
+        printf("Can't open %s\n", FileName);
+        return FALSE;
+    }
+
+    if ((fread(&header, sizeof(header), 1, file) != 1) || (header.Version != AHCI_IO_TRACE_VERSION)) {
+        printf("%s is not an IO trace\n", FileName);
+        fclose(file);
+        return FALSE;
+    }
+
+    Capture->PerformanceFrequency = header.PerformanceFrequency;
+
+    for (i = 0; i < header.RecordCount; i++) {
+        if (fread(&record, sizeof(record), 1, file) != 1) {
+            printf("%s is truncated after %u records\n", FileName, i);
+            break;
+        }
+
+        if ((Capture->LastSequence != 0) && (record.Sequence > Capture->LastSequence + 1)) {
+            Capture->Lost += record.Sequence - Capture->LastSequence - 1;
+        }
+
+        Capture->LastSequence = record.Sequence;
+
+        if (!AhciTraceAddRecord(Capture, &record)) {
+            printf("Out of memory\n");
+            fclose(file);
+            return FALSE;
+        }
+    }
+
+    fclose(file);
+
+    return TRUE;
+}
+
+int __cdecl
+AhciTraceCompareUlonglong (
+    _In_ const void *Left,
+    _In_ const void *Right
+    )
+{
+    ULONGLONG left = *(const ULONGLONG *)Left;
+    ULONGLONG right = *(const ULONGLONG *)Right;
+
+    return (left > right) - (left < right);
+}
+
+int __cdecl
+AhciTraceCompareEvent (
+    _In_ const void *Left,
+    _In_ const void *Right
+    )
+{
+    const AHCITRACE_EVENT *left = Left;
+    const AHCITRACE_EVENT *right = Right;
+
+    if (left->Time != right->Time) {
+        return (left->Time > right->Time) ? 1 : -1;
+    }
+
+    // completions first, so that a command issued as another completes is not counted twice
+    return left->Delta - right->Delta;
+}
+
+double
+AhciTraceMicroseconds (
+    _In_ PAHCITRACE_CAPTURE Capture,
+    _In_ ULONGLONG Ticks
+    )
+{
+    return (double)Ticks * 1000000.0 / Capture->PerformanceFrequency;
+}
+
+ULONGLONG
+AhciTracePercentile (
+    _In_reads_(Count) PULONGLONG SortedLatencies,
+    _In_ ULONG Count,
+    _In_ ULONG Permille
+    )
+{
+    return SortedLatencies[(ULONG)((ULONGLONG)(Count - 1) * Permille / 1000)];
+}
+
+VOID
+AhciTraceReportLatency (
+    _In_ PAHCITRACE_CAPTURE Capture,
+    _In_ const char *Label,
+    _In_ const char *Name,
+    _Inout_updates_(Count) PULONGLONG Latencies,
+    _In_ ULONG Count,
+    _In_ ULONG Errors
+    )
+{
+    ULONGLONG total = 0;
+    ULONG i;
+
+    qsort(Latencies, Count, sizeof(ULONGLONG), AhciTraceCompareUlonglong);
+
+    for (i = 0; i < Count; i++) {
+        total += Latencies[i];
+    }
+
+    printf("%-5s %-20s %8u %6u %9.1f %9.1f %9.1f %9.1f %9.1f %10.1f\n",
+           Label,
+           Name,
+           Count,
+           Errors,
+           AhciTraceMicroseconds(Capture, total) / Count,
+           AhciTraceMicroseconds(Capture, AhciTracePercentile(Latencies, Count, 500)),
+           AhciTraceMicroseconds(Capture, AhciTracePercentile(Latencies, Count, 900)),
+           AhciTraceMicroseconds(Capture, AhciTracePercentile(Latencies, Count, 990)),
+           AhciTraceMicroseconds(Capture, AhciTracePercentile(Latencies, Count, 999)),
+           AhciTraceMicroseconds(Capture, Latencies[Count - 1]));
+}
+
+BOOLEAN
+AhciTraceReportLatencies (
+    _In_ PAHCITRACE_CAPTURE Capture
+    )
+/*++
+    Reports the latency distribution of each command in the capture, then of all of them.
+--*/
+{
+    PULONGLONG latencies;
+    ULONG count;
+    ULONG errors;
+    ULONG command;
+    ULONG i;
+    char label[8];
+
+    latencies = malloc(Capture->RecordCount * sizeof(ULONGLONG));
+
+    if (latencies == NULL) {
+        printf("Out of memory\n");
+        return FALSE;
+    }
+
+    printf("%-5s %-20s %8s %6s %9s %9s %9s %9s %9s %10s\n",
+           "cmd", "", "count", "errors", "mean us", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+
+    for (command = 0; command <= 0x100; command++) {
+        count = 0;
+        errors = 0;
+
+        for (i = 0; i < Capture->RecordCount; i++) {
+            if ((command == 0x100) || (Capture->Records[i].Command == command)) {
+                latencies[count++] = Capture->Records[i].CompleteTime - Capture->Records[i].IssueTime;
+
+                if (AHCITRACE_SRB_STATUS(Capture->Records[i].SrbStatus) != AHCITRACE_SRB_STATUS_SUCCESS) {
+                    errors++;
+                }
+            }
+        }
+
+        if (count == 0) {
+            continue;
+        }
+
+        if (command == 0x100) {
+            AhciTraceReportLatency(Capture, "all", "", latencies, count, errors);
+        } else {
+            sprintf_s(label, sizeof(label), "0x%02X", command);
+            AhciTraceReportLatency(Capture, label, AhciTraceCommandName((UCHAR)command), latencies, count, errors);
+        }
+    }
+
+    free(latencies);
+
+    return TRUE;
+}
+
+BOOLEAN
+AhciTraceReportQueueDepth (
+    _In_ PAHCITRACE_CAPTURE Capture,
+    _In_ ULONG BinMilliseconds,
+    _In_ BOOLEAN Csv
+    )
+/*++
+    Reports the queue depth of the port over time.
+
+    Every record adds a command to the port at its issue time and takes it away at its completion
+    time. Sweeping those events in time order gives the number of commands outstanding, which is
+    averaged over each interval. Commands lost from the trace are missing from the average, so
+    it is only exact when the capture lost no records.
+--*/
+{
+    PAHCITRACE_EVENT events;
+    ULONG eventCount = Capture->RecordCount * 2;
+    ULONGLONG binTicks;
+    ULONGLONG start = MAXULONGLONG;
+    ULONGLONG end = 0;
+    ULONGLONG binStart;
+    ULONGLONG binEnd;
+    ULONGLONG binLength;
+    ULONGLONG time;
+    ULONGLONG weightedDepth;
+    ULONGLONG latencyTotal;
+    ULONG completions;
+    UCHAR maxIssueDepth;
+    LONG depth = 0;
+    ULONG eventIndex = 0;
+    ULONG recordIndex = 0;
+    ULONG bar;
+    ULONG i;
+    PAHCI_IO_TRACE_RECORD record;
+    double averageDepth;
+
+    binTicks = Capture->PerformanceFrequency * BinMilliseconds / 1000;
+
+    if (binTicks == 0) {
+        binTicks = 1;
+    }
+
+    events = malloc(eventCount * sizeof(AHCITRACE_EVENT));
+
+    if (events == NULL) {
+        printf("Out of memory\n");
+        return FALSE;
+    }
+
+    for (i = 0; i < Capture->RecordCount; i++) {
+        record = &Capture->Records[i];
+
+        events[i * 2].Time = record->IssueTime;
+        events[i * 2].Delta = 1;
+        events[(i * 2) + 1].Time = record->CompleteTime;
+        events[(i * 2) + 1].Delta = -1;
+
+        start = min(start, record->IssueTime);
+        end = max(end, record->CompleteTime);
+    }
+
+    qsort(events, eventCount, sizeof(AHCITRACE_EVENT), AhciTraceCompareEvent);
+
+    // records are in completion order, which is what the per interval completion counts need
+    if (Csv) {
+        printf("ms,average queue depth,max issue queue depth,completions/s,mean latency us\n");
+    } else {
+        printf("\n%10s %8s %6s %10s %10s  average queue depth\n", "ms", "avg QD", "max QD", "IO/s", "mean us");
+    }
+
+    for (binStart = start; binStart <= end; binStart += binTicks) {
+        // the last interval ends with the capture
+        binEnd = min(binStart + binTicks, end + 1);
+        binLength = binEnd - binStart;
+        time = binStart;
+        weightedDepth = 0;
+
+        while ((eventIndex < eventCount) && (events[eventIndex].Time < binEnd)) {
+            weightedDepth += (ULONGLONG)depth * (events[eventIndex].Time - time);
+            time = events[eventIndex].Time;
+            depth += events[eventIndex].Delta;
+            eventIndex++;
+        }
+
+        weightedDepth += (ULONGLONG)depth * (binEnd - time);
+        averageDepth = (double)weightedDepth / binLength;
+
+        completions = 0;
+        latencyTotal = 0;
+        maxIssueDepth = 0;
+
+        while ((recordIndex < Capture->RecordCount) && (Capture->Records[recordIndex].CompleteTime < binEnd)) {
+            record = &Capture->Records[recordIndex];
+            completions++;
+            latencyTotal += record->CompleteTime - record->IssueTime;
+            if (record->QueueDepth > maxIssueDepth) {
+                maxIssueDepth = record->QueueDepth;
+            }
+            recordIndex++;
+        }
+
+        if (Csv) {
+            printf("%.1f,%.2f,%u,%.0f,%.1f\n",
+                   AhciTraceMicroseconds(Capture, binStart - start) / 1000.0,
+                   averageDepth,
+                   maxIssueDepth,
+                   (double)completions * Capture->PerformanceFrequency / binLength,
+                   completions ? (AhciTraceMicroseconds(Capture, latencyTotal) / completions) : 0.0);
+            continue;
+        }
+
+        printf("%10.1f %8.2f %6u %10.0f %10.1f  ",
+               AhciTraceMicroseconds(Capture, binStart - start) / 1000.0,
+               averageDepth,
+               maxIssueDepth,
+               (double)completions * Capture->PerformanceFrequency / binLength,
+               completions ? (AhciTraceMicroseconds(Capture, latencyTotal) / completions) : 0.0);
+
+        // one mark per command, NCQ allows up to 32
+        for (bar = 0; (bar < (ULONG)(averageDepth + 0.5)) && (bar < AHCITRACE_BAR_WIDTH); bar++) {
+            printf("#");
+        }
+
+        printf("\n");
+    }
+
+    free(events);
+
+    return TRUE;
+}
+
+int __cdecl
+main (
+    _In_ int argc,
+    _In_reads_(argc) char *argv[]
+    )
+{
+    AHCITRACE_CAPTURE capture = {0};
+    const char *readFile = NULL;
+    const char *saveFile = NULL;
+    ULONG disk = MAXULONG;
+    ULONG seconds = AHCITRACE_DEFAULT_SECONDS;
+    ULONG pollMilliseconds = AHCITRACE_DEFAULT_POLL_MS;
+    ULONG binMilliseconds = AHCITRACE_DEFAULT_BIN_MS;
+    BOOLEAN csv = FALSE;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (((argv[i][0] != '-') && (argv[i][0] != '/')) || (argv[i][1] == '\0') || (argv[i][2] != '\0')) {
+            Usage();
+            return 1;
+        }
+
+        if (argv[i][1] == 'c') {
+            csv = TRUE;
+            continue;
+        }
+
+        if (i + 1 == argc) {
+            Usage();
+            return 1;
+        }
+
+        switch (argv[i][1]) {
+            case 'd':
+                disk = atoi(argv[++i]);
+                break;
+
+            case 't':
+                seconds = atoi(argv[++i]);
+                break;
+
+            case 'p':
+                pollMilliseconds = atoi(argv[++i]);
+                break;
+
+            case 'w':
+                saveFile = argv[++i];
+                break;
+
+            case 'r':
+                readFile = argv[++i];
+                break;
+
+            case 'b':
+                binMilliseconds = atoi(argv[++i]);
+                break;
+
+            default:
+                Usage();
+                return 1;
+        }
+    }
+
+    if (((disk == MAXULONG) == (readFile == NULL)) || (seconds == 0) || (binMilliseconds == 0)) {
+        Usage();
+        return 1;
+    }
+
+    if (readFile != NULL) {
+        if (!AhciTraceLoad(&capture, readFile)) {
+            return 1;
+        }
+    } else {
+        if (!AhciTraceCapture(&capture, disk, seconds, pollMilliseconds)) {
+            return 1;
+        }
+
+        if ((saveFile != NULL) && !AhciTraceSave(&capture, saveFile)) {
+            return 1;
+        }
+    }
+
+    if ((capture.RecordCount == 0) || (capture.PerformanceFrequency == 0)) {
+        printf("The trace has no completed commands\n");
+        return 1;
+    }
+
+    if (!csv) {
+        printf("%u commands, %u lost", capture.RecordCount, capture.Lost);
+        if (capture.Lost != 0) {
+            printf(" (read the trace more often with -p to lose fewer)");
+        }
+        printf("\n\n");
+
+        if (!AhciTraceReportLatencies(&capture)) {
+            return 1;
+        }
+    }
+
+    if (!AhciTraceReportQueueDepth(&capture, binMilliseconds, csv)) {
+        return 1;
+    }
+
+    free(capture.Records);
+
+    return 0;
+}
@@ -3311,7 +3311,10 @@ IOCTLtoATA(
             break;
         }
 
+        case IOCTL_SCSI_MINIPORT_AHCI_IO_TRACE:
 
+            status = AhciReadIoTrace (ChannelExtension, Srb);
+            break;
 
         default:
 
@@ -3323,6 +3326,70 @@ IOCTLtoATA(
     return status;
 }
 
+ULONG
+AhciReadIoTrace(
+    _In_ PAHCI_CHANNEL_EXTENSION ChannelExtension,
+    _In_ PSCSI_REQUEST_BLOCK Srb
+    )
+/*
+    This routine copies the per port IO trace into the buffer following SRB_IO_CONTROL.
+    The buffer receives AHCI_IO_TRACE_HEADER followed by as many of the newest records as fit, oldest first.
+    The trace is written without a lock, records that are overwritten while being copied are skipped.
+*/
+{
+    PAHCI_IO_TRACE_HEADER   header;
+    PAHCI_IO_TRACE_RECORD   outputRecords;
+    PAHCI_IO_TRACE_RECORD   record;
+    ULONG                   maxRecords;
+    ULONG                   recordCount;
+    ULONG                   lastSequence;
+    ULONG                   sequence;
+
+    if (Srb->DataTransferLength < (sizeof(SRB_IO_CONTROL) + sizeof(AHCI_IO_TRACE_HEADER))) {
+        Srb->SrbStatus = SRB_STATUS_BAD_SRB_BLOCK_LENGTH;
+        return STOR_STATUS_BUFFER_TOO_SMALL;
+    }
+
+    header = (PAHCI_IO_TRACE_HEADER)((PUCHAR)Srb->DataBuffer + sizeof(SRB_IO_CONTROL));
+    outputRecords = (PAHCI_IO_TRACE_RECORD)(header + 1);
+
+    maxRecords = (Srb->DataTransferLength - sizeof(SRB_IO_CONTROL) - sizeof(AHCI_IO_TRACE_HEADER)) / sizeof(AHCI_IO_TRACE_RECORD);
+    if (maxRecords > AHCI_IO_TRACE_RECORD_COUNT) {
+        maxRecords = AHCI_IO_TRACE_RECORD_COUNT;
+    }
+
+    lastSequence = (ULONG)ChannelExtension->IoTrace.LastSequence;
+    recordCount = 0;
+
+    // sequence numbers are 1-based, walk the newest 'maxRecords' of them from the oldest
+    for (sequence = (lastSequence > maxRecords) ? (lastSequence - maxRecords + 1) : 1;
+         sequence <= lastSequence;
+         sequence++) {
+
+        record = &ChannelExtension->IoTrace.Records[(sequence - 1) & (AHCI_IO_TRACE_RECORD_COUNT - 1)];
+
+        if (record->Sequence != sequence) {
+            continue;
+        }
+
+        StorPortCopyMemory(&outputRecords[recordCount], record, sizeof(AHCI_IO_TRACE_RECORD));
+
+        // only keep the copy if the record was not rewritten meanwhile
+        if (record->Sequence == sequence) {
+            recordCount++;
+        }
+    }
+
+    header->Version = AHCI_IO_TRACE_VERSION;
+    header->RecordCount = recordCount;
+    header->LastSequence = lastSequence;
+    header->Reserved = 0;
+    header->PerformanceFrequency = ChannelExtension->IoTrace.PerformanceFrequency;
+
+    Srb->SrbStatus = SRB_STATUS_SUCCESS;
+    return STOR_STATUS_SUCCESS;
+}
+
 ULONG
 SmartVersion(
     _In_ PAHCI_CHANNEL_EXTENSION ChannelExtension,
@@ -688,6 +688,12 @@ IOCTLtoATA(
     _In_ PSCSI_REQUEST_BLOCK Srb
     );
 
+ULONG
+AhciReadIoTrace(
+    _In_ PAHCI_CHANNEL_EXTENSION ChannelExtension,
+    _In_ PSCSI_REQUEST_BLOCK Srb
+    );
+
 ULONG
 SmartVersion(
     _In_ PAHCI_CHANNEL_EXTENSION ChannelExtension,
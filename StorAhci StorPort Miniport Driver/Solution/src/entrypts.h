@@ -35,6 +35,11 @@ Authors:
 #define AHCI_MAX_LUN                8       //ATAport supports this much in old implementation.
 #define AHCI_MAX_NCQ_REQUEST_COUNT  32
 
+// NCQ slots held back from normal priority IO so that high priority IO can always be activated.
+// The reservation only applies when the device queue is deep enough to afford it.
+#define AHCI_HIGH_PRIORITY_RESERVED_SLOTS       2
+#define AHCI_HIGH_PRIORITY_RESERVATION_MIN_QD   8
+
 #define KB                          (1024)
 #define AHCI_MAX_TRANSFER_LENGTH    (128 * KB)
 #define MAX_SETTINGS_PRESERVED      32
@@ -42,6 +47,13 @@ Authors:
 
 #define INQUIRYDATABUFFERSIZE       36
 
+// per port IO trace, number of records must be a power of 2
+#define AHCI_IO_TRACE_RECORD_COUNT  128
+#define AHCI_IO_TRACE_VERSION       1
+
+// miniport IOCTL to read the per port IO trace, the data following SRB_IO_CONTROL is AHCI_IO_TRACE_HEADER and AHCI_IO_TRACE_RECORD array
+#define IOCTL_SCSI_MINIPORT_AHCI_IO_TRACE   ((FILE_DEVICE_SCSI << 16) + 0x0F00)
+
 // timeout values and counters for channel start
 // some big HDDs (e.g. 2TB) takes ~ 20 seconds to spin up.  We hit timeout during S3 resume for now,
 // we reset after 1/3 * AHCI_PORT_START_TIMEOUT_IN_SECONDS Busy, and give up after AHCI_PORT_START_TIMEOUT_IN_SECONDS seconds
@@ -220,6 +232,30 @@ typedef struct _SLOT_MANAGER {
     ULONG CommandsToComplete;
 } SLOT_MANAGER, *PSLOT_MANAGER;
 
+typedef struct _AHCI_IO_TRACE_RECORD {
+    ULONG       Sequence;       // 1-based, 0 means the record is not valid (unused or being written)
+    UCHAR       Slot;
+    UCHAR       Command;        // ATA command register value, or CDB operation code for ATAPI
+    UCHAR       SrbStatus;
+    UCHAR       QueueDepth;     // commands issued to the port, including this one, when this command was issued
+    ULONGLONG   IssueTime;      // performance counter value
+    ULONGLONG   CompleteTime;   // performance counter value
+} AHCI_IO_TRACE_RECORD, *PAHCI_IO_TRACE_RECORD;
+
+typedef struct _AHCI_IO_TRACE_HEADER {
+    ULONG       Version;
+    ULONG       RecordCount;        // number of AHCI_IO_TRACE_RECORD following this header, oldest first
+    ULONG       LastSequence;       // sequence number of the newest record written to the trace
+    ULONG       Reserved;
+    ULONGLONG   PerformanceFrequency;
+} AHCI_IO_TRACE_HEADER, *PAHCI_IO_TRACE_HEADER;
+
+typedef struct _AHCI_IO_TRACE {
+    volatile LONG           LastSequence;
+    ULONGLONG               PerformanceFrequency;
+    AHCI_IO_TRACE_RECORD    Records[AHCI_IO_TRACE_RECORD_COUNT];
+} AHCI_IO_TRACE, *PAHCI_IO_TRACE;
+
 typedef struct _EXECUTION_HISTORY {
     ULONG        Function;
     ULONG        IS;
@@ -316,6 +352,7 @@ typedef struct _AHCI_SRB_EXTENSION {
     PVOID                   CompletionContext;   // context information for completionRoutine
     UCHAR              QueueTag;            // for AHCI controller slots
     UCHAR              RetryCount;          // how many times the command has been retired
+    UCHAR              IssueQueueDepth;     // number of commands issued to the port when this command was issued
     ULONGLONG          StartTime;
 } AHCI_SRB_EXTENSION, *PAHCI_SRB_EXTENSION;
 
@@ -426,6 +463,7 @@ typedef struct _AHCI_CHANNEL_EXTENSION {
     COMMAND_HISTORY         CommandHistory[64];
     UCHAR                   ExecutionHistoryNextAvailableIndex;
     EXECUTION_HISTORY       ExecutionHistory[100];
+    AHCI_IO_TRACE           IoTrace;
 
 } AHCI_CHANNEL_EXTENSION, *PAHCI_CHANNEL_EXTENSION;
 
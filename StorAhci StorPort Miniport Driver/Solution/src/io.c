@@ -27,81 +27,114 @@ Revision History:
 #include "generic.h"
 
 
+__inline
+ULONG
+SelectSlotsCircular (
+    _In_ ULONG      Slots,
+    _In_ UCHAR      StartSlot,
+    _In_ UCHAR      MaxCount,
+    _Inout_ PUCHAR  LastSelectedSlot
+    )
+/*++
+    Selects up to MaxCount slots from Slots, walking circularly from StartSlot.
+    Only the set bits are visited, so the cost is bounded by the number of slots selected.
+
+Return Value:
+    Mask of the selected slots. LastSelectedSlot is updated if any slot is selected.
+--*/
+{
+    ULONG   selected = 0;
+    ULONG   pending;
+    ULONG   index;
+    UCHAR   pass;
+
+    NT_ASSERT(StartSlot < AHCI_MAX_NCQ_REQUEST_COUNT);
+
+    // first pass covers StartSlot and above, second pass wraps around to the slots below it
+    for (pass = 0; (pass < 2) && (MaxCount > 0); pass++) {
+        pending = (pass == 0) ? (Slots & ~((1UL << StartSlot) - 1)) : (Slots & ((1UL << StartSlot) - 1));
+
+        while ((MaxCount > 0) && _BitScanForward(&index, pending)) {
+            pending &= pending - 1;     // clear the lowest set bit
+            selected |= (1UL << index);
+            *LastSelectedSlot = (UCHAR)index;
+            MaxCount--;
+        }
+    }
+
+    return selected;
+}
+
 ULONG
 GetSlotToActivate(
     _In_ PAHCI_CHANNEL_EXTENSION ChannelExtension,
-    _In_ ULONG                   TargetSlots
+    _In_ ULONG                   HighPrioritySlots,
+    _In_ ULONG                   NormalPrioritySlots
     )
 /*++
-    Select Slot to activate based on maximum slot number allowed
+    Select NCQ slots to activate based on the number of slots the device allows to be outstanding
+
+It assumes:
+    HighPrioritySlots and NormalPrioritySlots do not overlap
 
 Called by:
     Activate Queue
 
 It performs:
+    (overview)
+    1 Determine how many slots are free on the device
+    2 Select high priority IO
+    3 Select normal priority IO
+    (details)
+    1.1 Count the slots already in use, leave if the device queue is full
+    2.1 High priority IO may use every free slot
+    3.1 Normal priority IO may not use the slots reserved for high priority IO
+    3.2 Both selections walk circularly from the last activated slot so that no slot is starved
 
 Affected Variables/Registers:
-    none
+    ChannelExtension->LastActiveSlot
 
 Return Value:
+    Mask of slots to activate
 --*/
 {
-
-    UCHAR activeCount = 0;
+    UCHAR activeCount;
     UCHAR emptyCount;
-    UCHAR requestCount;
+    UCHAR maxDepth;
+    UCHAR reservedCount;
     UCHAR lastActiveSlot;
-    ULONG slotToActivate = 0;
-    UCHAR i;
+    ULONG slotsToActivate;
 
-  //1 Device's queue depth is smaller than Controller's
+    maxDepth = ChannelExtension->DeviceExtension[0].DeviceParameters.MaxDeviceQueueDepth;
 
-    NT_ASSERT(ChannelExtension->DeviceExtension[0].DeviceParameters.MaxDeviceQueueDepth <= ChannelExtension->AdapterExtension->CAP.NCS);
+  //1.1 Device's queue depth is not larger than Controller's
 
-    //count the number of slots already in use
-    if (ChannelExtension->SlotManager.CommandsIssued > 0) {
-        activeCount = NumberOfSetBits(ChannelExtension->SlotManager.CommandsIssued);
-    }
-    //1.1 Check if all slots are active.
-    if (activeCount >= ChannelExtension->DeviceExtension[0].DeviceParameters.MaxDeviceQueueDepth) {
+    NT_ASSERT(maxDepth <= ChannelExtension->AdapterExtension->CAP.NCS);
+
+    activeCount = NumberOfSetBits(ChannelExtension->SlotManager.CommandsIssued);
+    if (activeCount >= maxDepth) {
         //if all possible slots are full, no matter what, return no work (0)
         return 0;
     }
 
-  //2 Look for any entry from last active slot
-    requestCount = NumberOfSetBits(TargetSlots);
+    emptyCount = maxDepth - activeCount;
     lastActiveSlot = ChannelExtension->LastActiveSlot;
-    emptyCount = ChannelExtension->DeviceExtension[0].DeviceParameters.MaxDeviceQueueDepth - activeCount;
-
-  //3.1 Look for any entry from last active slot
-    for (i = lastActiveSlot; i <= ChannelExtension->AdapterExtension->CAP.NCS; i++) {
-        if ((TargetSlots & (1 << i)) > 0) {
-            slotToActivate |= (1 << i);
-            emptyCount--;
-            requestCount--;
-            if (emptyCount == 0 || requestCount == 0) {
-                ChannelExtension->LastActiveSlot = i;
-                return slotToActivate;
-            }
-        }
-    }
 
-  //3.2 Look for any entry from beginning to last active slot
-  //Slot 0 is reserved for internal command
-    for (i = 1 ; i <= lastActiveSlot; i++) {
-        if ((TargetSlots & (1 << i)) > 0) {
-            slotToActivate |= (1 << i);
-            emptyCount--;
-            requestCount--;
-            if (emptyCount == 0 || requestCount == 0) {
-                ChannelExtension->LastActiveSlot = i;
-                return slotToActivate;
-            }
-        }
+  //2.1 High priority IO may use every free slot
+    slotsToActivate = SelectSlotsCircular(HighPrioritySlots, lastActiveSlot, emptyCount, &ChannelExtension->LastActiveSlot);
+    activeCount += NumberOfSetBits(slotsToActivate);
+
+  //3.1 Normal priority IO may not use the slots reserved for high priority IO
+    reservedCount = (maxDepth >= AHCI_HIGH_PRIORITY_RESERVATION_MIN_QD) ? AHCI_HIGH_PRIORITY_RESERVED_SLOTS : 0;
+
+    if ((NormalPrioritySlots != 0) && ((activeCount + reservedCount) < maxDepth)) {
+        slotsToActivate |= SelectSlotsCircular(NormalPrioritySlots,
+                                               lastActiveSlot,
+                                               maxDepth - reservedCount - activeCount,
+                                               &ChannelExtension->LastActiveSlot);
     }
 
-    NT_ASSERT(FALSE);
-    return slotToActivate;
+    return slotsToActivate;
 }
 
 
@@ -136,12 +169,12 @@ Return Value:
 --*/
 {
     UCHAR limit;
-    UCHAR i;
-
-    PAHCI_ADAPTER_EXTENSION adapterExtension = ChannelExtension->AdapterExtension;
+    ULONG index;
+    ULONG singleIoSlice;
 
   //1.1 Initialize variables
     limit = ChannelExtension->CurrentCommandSlot;
+    singleIoSlice = ChannelExtension->SlotManager.SingleIoSlice;
 
   // if there is internal request pending, always get it first.
     if ( (ChannelExtension->SlotManager.SingleIoSlice & 1) > 0 ) {
@@ -149,16 +182,13 @@ Return Value:
     }
 
   //2.1 Chose the slot circularly starting with CCS
-    for (i = limit; i <= adapterExtension->CAP.NCS; i++) {
-        if ( (ChannelExtension->SlotManager.SingleIoSlice & (1 << i)) > 0){
-            return i;
-        }
+    if ( (limit < AHCI_MAX_NCQ_REQUEST_COUNT) &&
+         _BitScanForward(&index, singleIoSlice & ~((1UL << limit) - 1)) ) {
+        return (UCHAR)index;
     }
 
-    for (i = 0; i < limit; i++) {
-        if ( (ChannelExtension->SlotManager.SingleIoSlice & (1 << i)) > 0){
-            return i;
-        }
+    if (_BitScanForward(&index, singleIoSlice)) {
+        return (UCHAR)index;
     }
 
     return 0xff;
@@ -306,9 +336,12 @@ It performs:
         Algorithm:
             2.1.1 Single IO SRBs (including Request Sense and non data control commands) have highest priority.
             2.1.2 When there are no Single IO commands, Normal IO get the next highest priority
-            2.1.3 When there are no Single or Normal commands, NCQ commands get the next highest priority
+            2.1.3 When there are no Single or Normal commands, NCQ commands get the next highest priority.
+                  When the device queue is shallower than the port's, high priority NCQ commands are selected first
+                  and normal priority NCQ commands fill the remaining device queue depth less the slots reserved for
+                  high priority commands. Otherwise every NCQ command is activated.
             2.1.4 In the case that no IO is present in any Slices, program nothing
-    2.2 Program all the IO from the chosen queue into the controller
+    2.2 Program all the IO from the chosen queue into the controller, stamping each command with its issue time for the IO trace
 
 Affected Variables/Registers:
     channelExtension
@@ -321,7 +354,9 @@ Return Values:
     ULONG           sact;
     ULONG           ci;
     ULONG           slotsToActivate;
+    ULONG           highPrioritySlots;
     BOOLEAN         activateNcq;
+    ULONG           index;
     int             i;
 
     PAHCI_ADAPTER_EXTENSION adapterExtension = ChannelExtension->AdapterExtension;
@@ -403,24 +438,24 @@ Return Values:
         if ( ( ci != 0 ) && (sact == 0) ) {
             slotsToActivate = 0;
         } else {
-            //Grab the High Priority NCQ IO before the Low Priority NCQ IO
-            slotsToActivate = ChannelExtension->SlotManager.HighPriorityAttribute & ChannelExtension->SlotManager.NCQueueSlice;
-            //If there aren't any High Priority, grab everything else
-            if (slotsToActivate == 0) {
+            if (ChannelExtension->DeviceExtension[0].DeviceParameters.MaxDeviceQueueDepth < ChannelExtension->MaxPortQueueDepth) {
+                //Grab the High Priority NCQ IO before the Low Priority NCQ IO
+                highPrioritySlots = ChannelExtension->SlotManager.HighPriorityAttribute & ChannelExtension->SlotManager.NCQueueSlice;
+
+                //apply device outstanding IO limits and the high priority reservation to filter down which IO to activate
+                slotsToActivate = GetSlotToActivate(ChannelExtension,
+                                                    highPrioritySlots,
+                                                    ChannelExtension->SlotManager.NCQueueSlice & ~highPrioritySlots);
+            } else {
+                //the device takes as many commands as the port has slots, so every programmed command can be activated now
                 slotsToActivate = ChannelExtension->SlotManager.NCQueueSlice;
             }
-            //and apply any device outstanding IO limits to filter down which IO to activate
+
             if (slotsToActivate > 0) {
-                if (ChannelExtension->DeviceExtension[0].DeviceParameters.MaxDeviceQueueDepth < ChannelExtension->MaxPortQueueDepth ) {
-                    // get allowed slots if the device queue depth is less than the port can support.
-                    slotsToActivate = GetSlotToActivate(ChannelExtension, slotsToActivate);
-                }
-                if (slotsToActivate > 0) {
-                    //and if there are any IO still selected, clear them from the NCQueue
-                    activateNcq = TRUE;     //Remember to program SACT for these commands
-                    ChannelExtension->SlotManager.NCQueueSlice &= ~slotsToActivate;
-                    //the selected IO will be activated at the end of this function
-                }
+                //and if there are any IO still selected, clear them from the NCQueue
+                activateNcq = TRUE;     //Remember to program SACT for these commands
+                ChannelExtension->SlotManager.NCQueueSlice &= ~slotsToActivate;
+                //the selected IO will be activated at the end of this function
             }
         }
   //2.1.4 In the case that no IO is present in any Slices, program nothing
@@ -428,28 +463,24 @@ Return Values:
 
   //2.1 Program all the IO from the chosen queue into the controller
     if (slotsToActivate != 0) {
-        //2.2 Get command start time
-        if(adapterExtension->TracingEnabled) {
-            LARGE_INTEGER perfCounter = {0};
-            ULONG pendingProgrammingCommands = slotsToActivate;
+        //2.2 Get command start time, one counter read covers the whole batch
+        LARGE_INTEGER perfCounter = {0};
+        ULONG pendingProgrammingCommands = slotsToActivate;
+        UCHAR queueDepth;
 
-            i = 0;
+        ChannelExtension->SlotManager.CommandsIssued |= slotsToActivate;
+        queueDepth = NumberOfSetBits(ChannelExtension->SlotManager.CommandsIssued);
 
-            StorPortQueryPerformanceCounter((PVOID)adapterExtension, NULL, &perfCounter);
+        StorPortQueryPerformanceCounter((PVOID)adapterExtension, NULL, &perfCounter);
 
-            while (pendingProgrammingCommands) {
-                if (pendingProgrammingCommands & 1) {
-                    PAHCI_SRB_EXTENSION srbExtension = GetSrbExtension(ChannelExtension->Slot[i].Srb);
-                    srbExtension->StartTime = perfCounter.QuadPart;
-                }
+        while (_BitScanForward(&index, pendingProgrammingCommands)) {
+            PAHCI_SRB_EXTENSION srbExtension = GetSrbExtension(ChannelExtension->Slot[index].Srb);
+            srbExtension->StartTime = perfCounter.QuadPart;
+            srbExtension->IssueQueueDepth = queueDepth;
 
-                i++;
-                pendingProgrammingCommands >>= 1;
-            }
+            pendingProgrammingCommands &= pendingProgrammingCommands - 1;
         }
 
-        ChannelExtension->SlotManager.CommandsIssued |= slotsToActivate;
-
         // program registers
         if (activateNcq) {
             StorPortWriteRegisterUlong(adapterExtension, &ChannelExtension->Px->SACT, slotsToActivate);
@@ -523,10 +554,10 @@ It performs:
     3 Start the next batch of commands
     (details)
     1.1 Initialize variables
-    2.1 For every command marked as completed
+    2.1 For every command marked as completed. Only the set bits of CommandsToComplete are visited.
     2.2 Set the status
     2.3 Monitor to see that any NCQ commands are completing
-    2.4 Give the slot back
+    2.4 Record the command in the IO trace and give the slot back
     3.1 Start the next IO(s) if any
 
 Affected Variables/Registers:
@@ -536,7 +567,8 @@ Affected Variables/Registers:
 --*/
 {
     PSLOT_CONTENT       slotContent;
-    UCHAR               i;
+    ULONG               pendingCommands;
+    ULONG               i;
 
     PAHCI_ADAPTER_EXTENSION adapterExtension;
     PAHCI_SRB_EXTENSION     srbExtension;
@@ -551,12 +583,18 @@ Affected Variables/Registers:
         RecordExecutionHistory(ChannelExtension, 0x00000046);//AhciCompleteIssuedSRBs
     }
 
-    if( adapterExtension->TracingEnabled && (ChannelExtension->SlotManager.CommandsToComplete) ) {
+    if (ChannelExtension->SlotManager.CommandsToComplete) {
         StorPortQueryPerformanceCounter((PVOID)adapterExtension, &perfFrequency, &perfCounter);
+        ChannelExtension->IoTrace.PerformanceFrequency = perfFrequency.QuadPart;
     }
 
   //2.1 For every command marked as completed
-    for (i = 0; i <= (adapterExtension->CAP.NCS); i++) {
+    pendingCommands = ChannelExtension->SlotManager.CommandsToComplete;
+
+    while (_BitScanForward(&i, pendingCommands)) {
+        pendingCommands &= pendingCommands - 1;
+
+        //completing an earlier slot may have already given this one back
         if( ( ChannelExtension->SlotManager.CommandsToComplete & (1 << i) ) > 0) {
             slotContent = &ChannelExtension->Slot[i];
             srbExtension = GetSrbExtension(slotContent->Srb);
@@ -622,8 +660,12 @@ Affected Variables/Registers:
                 ChannelExtension->StateFlags.NCQ_Succeeded = TRUE;
             }
 
-          //2.4 Give the slot back
-            ReleaseSlottedCommand(ChannelExtension, i, AtDIRQL); // Request sense is handled here.
+          //2.4 Record the command in the IO trace and give the slot back
+            if (srbExtension->StartTime != 0) {
+                RecordIoTrace(ChannelExtension, slotContent->Srb, (UCHAR)i, perfCounter.QuadPart);
+            }
+
+            ReleaseSlottedCommand(ChannelExtension, (UCHAR)i, AtDIRQL); // Request sense is handled here.
 
             if (LogExecuteFullDetail(adapterExtension->LogFlags)) {
                 RecordExecutionHistory(ChannelExtension, 0x10000046);//Completed one SRB
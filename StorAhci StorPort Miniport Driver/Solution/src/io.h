@@ -23,7 +23,8 @@ Revision History:
 ULONG
 GetSlotToActivate(
     _In_ PAHCI_CHANNEL_EXTENSION ChannelExtension,
-    _In_ ULONG                   TargetSlots
+    _In_ ULONG                   HighPrioritySlots,
+    _In_ ULONG                   NormalPrioritySlots
     );
 
 UCHAR
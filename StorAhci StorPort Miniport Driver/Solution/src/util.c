@@ -132,6 +132,54 @@ Return Value:
     }
 }
 
+VOID
+RecordIoTrace(
+    _In_ PAHCI_CHANNEL_EXTENSION ChannelExtension,
+    _In_ PSCSI_REQUEST_BLOCK Srb,
+    _In_ UCHAR SlotNumber,
+    _In_ ULONGLONG CompleteTime
+    )
+/*++
+    Adds a record of a completed command to the per port IO trace.
+It assumes:
+    srbExtension->StartTime and srbExtension->IssueQueueDepth were filled when the command was issued
+Called by:
+    AhciCompleteIssuedSRBs
+
+It performs:
+    1 Claim the next record in the ring
+    2 Fill the record, the sequence number is written last so that a reader can tell a record being written from a complete one
+Affected Variables/Registers:
+    ChannelExtension->IoTrace
+Return Value:
+    none
+--*/
+{
+    PAHCI_SRB_EXTENSION     srbExtension = GetSrbExtension(Srb);
+    PAHCI_IO_TRACE_RECORD   record;
+    LONG                    sequence;
+
+  //1 Claim the next record in the ring
+    sequence = InterlockedIncrement(&ChannelExtension->IoTrace.LastSequence);
+    record = &ChannelExtension->IoTrace.Records[(ULONG)(sequence - 1) & (AHCI_IO_TRACE_RECORD_COUNT - 1)];
+
+  //2 Fill the record
+    InterlockedExchange((LONG volatile *)&record->Sequence, 0);
+
+    record->Slot = SlotNumber;
+    if (IsAtaCommand(srbExtension->AtaFunction)) {
+        record->Command = srbExtension->TaskFile.Current.bCommandReg;
+    } else {
+        record->Command = SrbGetCdb(Srb)->CDB6GENERIC.OperationCode;
+    }
+    record->SrbStatus = Srb->SrbStatus;
+    record->QueueDepth = srbExtension->IssueQueueDepth;
+    record->IssueTime = srbExtension->StartTime;
+    record->CompleteTime = CompleteTime;
+
+    InterlockedExchange((LONG volatile *)&record->Sequence, sequence);
+}
+
 VOID
 RecordInterruptHistory(
     PAHCI_CHANNEL_EXTENSION ChannelExtension,
@@ -670,6 +670,14 @@ RecordExecutionHistory(
     ULONG Function
   );
 
+VOID
+RecordIoTrace(
+    _In_ PAHCI_CHANNEL_EXTENSION ChannelExtension,
+    _In_ PSCSI_REQUEST_BLOCK Srb,
+    _In_ UCHAR SlotNumber,
+    _In_ ULONGLONG CompleteTime
+    );
+
 VOID
 RecordInterruptHistory(
     PAHCI_CHANNEL_EXTENSION ChannelExtension,
@@ -19,6 +19,19 @@ Abstract:
     By default this filter attaches to all volumes it is notified about.  It
     does support having multiple instances on a given volume.
 
+    Swap buffers of up to 1MB come from per-volume pools, one per power of
+    2 size, so most I/Os reuse a buffer instead of allocating one.
+
+    The filter can also model an encryption filter.  If the "Transform"
+    registry value selects a transform, the data of non-cached reads and
+    writes is transformed as it is copied between the caller's buffer and
+    ours, so it is stored transformed on disk while the cache holds it as
+    written.  A transformed read only transforms what the file system read
+    from disk: the part past the stream's valid data length, which the file
+    system zero-fills, is passed through as it is.  Sparse files, whose
+    holes are zero-filled too, are not transformed, and files can't be made
+    sparse while a transform is active.
+
 Environment:
 
     Kernel mode
@@ -29,6 +42,10 @@ Environment:
 #include <dontuse.h>
 #include <suppress.h>
 
+#if defined(_M_AMD64)
+#include <emmintrin.h>
+#endif
+
 #pragma prefast(disable:__WARNING_ENCODE_MEMBER_FUNCTION_POINTER, "Not valid for kernel mode drivers")
 
 
@@ -42,11 +59,56 @@ PFLT_FILTER gFilterHandle;
 #define CONTEXT_TAG         'xcBS'
 #define NAME_TAG            'mnBS'
 #define PRE_2_POST_TAG      'ppBS'
+#define POOL_TAG            'lpBS'
+#define STREAM_CONTEXT_TAG  'csBS'
 
 /*************************************************************************
     Local structures
 *************************************************************************/
 
+//
+//  Swap buffers from 4KB to 1MB are kept in size classes, one for each
+//  power of 2.  Each class keeps at most SWAP_POOL_CLASS_BYTES of free
+//  buffers; the rest are freed.  Buffers are at least a page, so pool
+//  gives them to us page aligned, which satisfies any sector alignment.
+//
+
+#define SWAP_POOL_MIN_SHIFT     12
+#define SWAP_POOL_MAX_SHIFT     20
+#define SWAP_POOL_CLASSES       (SWAP_POOL_MAX_SHIFT - SWAP_POOL_MIN_SHIFT + 1)
+#define SWAP_POOL_CLASS_BYTES   (2 * 1024 * 1024)
+
+#define SWAP_POOL_CLASS_SIZE(_class)    (1UL << ((_class) + SWAP_POOL_MIN_SHIFT))
+
+//
+//  Size class of a buffer that didn't come from a pool.
+//
+
+#define SWAP_POOL_NONE          ((ULONG) -1)
+
+typedef struct _SWAP_BUFFER_POOL {
+
+    //
+    //  Free buffers.  The list entry lives in the buffer itself.
+    //
+
+    SLIST_HEADER FreeList;
+
+    //
+    //  The most free buffers we keep.
+    //
+
+    USHORT MaxDepth;
+
+    //
+    //  Allocations satisfied from the free list, and not.
+    //
+
+    volatile LONG Hits;
+    volatile LONG Misses;
+
+} SWAP_BUFFER_POOL, *PSWAP_BUFFER_POOL;
+
 //
 //  This is a volume context, one of these are attached to each volume
 //  we monitor.  This is used to get a "DOS" name for debug display.
@@ -66,8 +128,57 @@ typedef struct _VOLUME_CONTEXT {
 
     ULONG SectorSize;
 
+    //
+    //  Swap buffer pools, indexed by size class.  These are allocated
+    //  separately because SLIST_HEADERs need more alignment than contexts
+    //  are guaranteed.  If the allocation failed this is NULL and every
+    //  buffer is allocated and freed as it is used.
+    //
+
+    PSWAP_BUFFER_POOL Pools;
+
+    //
+    //  Whether the file system keeps a FSRTL_COMMON_FCB_HEADER in the
+    //  FsContext of its files, so we can read valid data length from it.
+    //
+
+    BOOLEAN FcbHeader;
+
 } VOLUME_CONTEXT, *PVOLUME_CONTEXT;
 
+//
+//  This is a stream context, one of these is attached to each file stream
+//  opened while a transform is active.  File systems don't read the disk
+//  past a stream's valid data length, they zero-fill the buffer, and those
+//  zeros must not be transformed.
+//
+
+typedef struct _STREAM_CONTEXT {
+
+    //
+    //  Protects ValidDataLength, which is looked at and updated at DPC
+    //  level.
+    //
+
+    KSPIN_LOCK Lock;
+
+    //
+    //  The data before this offset was on disk when the stream was opened
+    //  or was since written through us.  The file system reads the disk up
+    //  to this offset rounded up to a sector and zero-fills the rest.
+    //
+
+    LONGLONG ValidDataLength;
+
+    //
+    //  Set if the stream is sparse.  Holes read back as zeros anywhere in
+    //  the file, so sparse streams are not transformed.
+    //
+
+    BOOLEAN Sparse;
+
+} STREAM_CONTEXT, *PSTREAM_CONTEXT;
+
 #define MIN_SECTOR_SIZE 0x200
 
 
@@ -87,6 +198,13 @@ typedef struct _PRE_2_POST_CONTEXT {
 
     PVOLUME_CONTEXT VolCtx;
 
+    //
+    //  Pointer to the stream context of a transformed read or write, for
+    //  the same reason.  NULL if the operation isn't transformed.
+    //
+
+    PSTREAM_CONTEXT StreamCtx;
+
     //
     //  Since the post-operation parameters always receive the "original"
     //  parameters passed to the operation, we need to pass our new destination
@@ -95,6 +213,20 @@ typedef struct _PRE_2_POST_CONTEXT {
 
     PVOID SwappedBuffer;
 
+    //
+    //  The size class of SwappedBuffer, so it goes back to the right pool.
+    //
+
+    ULONG SizeClass;
+
+    //
+    //  Whether the data was transformed, and the file offset it was read
+    //  from or written to.
+    //
+
+    BOOLEAN Transform;
+    LONGLONG ByteOffset;
+
 } PRE_2_POST_CONTEXT, *PPRE_2_POST_CONTEXT;
 
 //
@@ -103,6 +235,48 @@ typedef struct _PRE_2_POST_CONTEXT {
 
 NPAGED_LOOKASIDE_LIST Pre2PostContextList;
 
+//
+//  A transform copies Length bytes from Source to Destination, transforming
+//  them as if they were at the given file offset.  Source and Destination
+//  may be the same buffer.  The transforms here are symmetric, so the same
+//  routine is used for reads and writes.
+//
+
+typedef VOID
+(*PSWAP_TRANSFORM_ROUTINE) (
+    _Out_writes_bytes_(Length) PUCHAR Destination,
+    _In_reads_bytes_(Length) PUCHAR Source,
+    _In_ ULONG Length,
+    _In_ LONGLONG ByteOffset
+    );
+
+//
+//  Values of the "Transform" registry value.
+//
+
+#define SWAP_TRANSFORM_NONE     0
+#define SWAP_TRANSFORM_XOR      1
+
+//
+//  The XOR transform repeats a SWAP_TRANSFORM_KEY_SIZE byte key through
+//  the file.  The key is stored twice over, so the key bytes for any file
+//  offset are contiguous.
+//
+
+#define SWAP_TRANSFORM_KEY_SIZE 64
+
+PSWAP_TRANSFORM_ROUTINE TransformRoutine = NULL;    // no transform by default
+
+DECLSPEC_ALIGN(16) UCHAR TransformKey[2 * SWAP_TRANSFORM_KEY_SIZE];
+
+//
+//  Bytes transformed, and how long it took in performance counter ticks,
+//  to tell what the transform costs per MB.
+//
+
+volatile LONG64 TransformBytes = 0;
+volatile LONG64 TransformTicks = 0;
+
 /*************************************************************************
     Prototypes
 *************************************************************************/
@@ -200,11 +374,97 @@ SwapPostWriteBuffers(
     _In_ FLT_POST_OPERATION_FLAGS Flags
     );
 
+FLT_POSTOP_CALLBACK_STATUS
+SwapPostCreate(
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_opt_ PVOID CompletionContext,
+    _In_ FLT_POST_OPERATION_FLAGS Flags
+    );
+
+FLT_PREOP_CALLBACK_STATUS
+SwapPreSetInformation(
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _Flt_CompletionContext_Outptr_ PVOID *CompletionContext
+    );
+
+FLT_POSTOP_CALLBACK_STATUS
+SwapPostSetInformation(
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PVOID CompletionContext,
+    _In_ FLT_POST_OPERATION_FLAGS Flags
+    );
+
+FLT_PREOP_CALLBACK_STATUS
+SwapPreFsControl(
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _Flt_CompletionContext_Outptr_ PVOID *CompletionContext
+    );
+
 VOID
 ReadDriverParameters (
     _In_ PUNICODE_STRING RegistryPath
     );
 
+ULONG
+SwapSizeClass (
+    _In_ ULONG Length
+    );
+
+PVOID
+SwapAllocateBuffer (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PVOLUME_CONTEXT VolCtx,
+    _In_ ULONG Length,
+    _Out_ PULONG SizeClass
+    );
+
+VOID
+SwapFreeBuffer (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PVOLUME_CONTEXT VolCtx,
+    _In_ PVOID Buffer,
+    _In_ ULONG SizeClass
+    );
+
+VOID
+SwapCopyReadData (
+    _Out_writes_bytes_(Length) PUCHAR Destination,
+    _In_ PPRE_2_POST_CONTEXT P2pCtx,
+    _In_ ULONG Length
+    );
+
+VOID
+SwapTransformData (
+    _Out_writes_bytes_(Length) PUCHAR Destination,
+    _In_reads_bytes_(Length) PUCHAR Source,
+    _In_ ULONG Length,
+    _In_ LONGLONG ByteOffset
+    );
+
+VOID
+SwapTransformXor (
+    _Out_writes_bytes_(Length) PUCHAR Destination,
+    _In_reads_bytes_(Length) PUCHAR Source,
+    _In_ ULONG Length,
+    _In_ LONGLONG ByteOffset
+    );
+
+#if defined(_M_AMD64)
+
+VOID
+SwapTransformXorSse2 (
+    _Out_writes_bytes_(Length) PUCHAR Destination,
+    _In_reads_bytes_(Length) PUCHAR Source,
+    _In_ ULONG Length,
+    _In_ LONGLONG ByteOffset
+    );
+
+#endif
+
 //
 //  Assign text sections for each routine.
 //
@@ -223,6 +483,11 @@ ReadDriverParameters (
 //
 
 CONST FLT_OPERATION_REGISTRATION Callbacks[] = {
+    { IRP_MJ_CREATE,
+      0,
+      NULL,
+      SwapPostCreate },
+
     { IRP_MJ_READ,
       0,
       SwapPreReadBuffers,
@@ -238,13 +503,24 @@ CONST FLT_OPERATION_REGISTRATION Callbacks[] = {
       SwapPreDirCtrlBuffers,
       SwapPostDirCtrlBuffers },
 
+    { IRP_MJ_SET_INFORMATION,
+      0,
+      SwapPreSetInformation,
+      SwapPostSetInformation },
+
+    { IRP_MJ_FILE_SYSTEM_CONTROL,
+      0,
+      SwapPreFsControl,
+      NULL },
+
     { IRP_MJ_OPERATION_END }
 };
 
 //
 //  Context definitions we currently care about.  Note that the system will
-//  create a lookAside list for the volume context because an explicit size
-//  of the context is specified.
+//  create a lookAside list for the volume and stream contexts because an
+//  explicit size of the context is specified.  The stream context owns
+//  nothing, so it needs no cleanup routine.
 //
 
 CONST FLT_CONTEXT_REGISTRATION ContextNotifications[] = {
@@ -255,6 +531,12 @@ CONST FLT_CONTEXT_REGISTRATION ContextNotifications[] = {
        sizeof(VOLUME_CONTEXT),
        CONTEXT_TAG },
 
+     { FLT_STREAM_CONTEXT,
+       0,
+       NULL,
+       sizeof(STREAM_CONTEXT),
+       STREAM_CONTEXT_TAG },
+
      { FLT_CONTEXT_END }
 };
 
@@ -299,6 +581,7 @@ CONST FLT_REGISTRATION FilterRegistration = {
 #define LOGFL_WRITE     0x00000004  // if set, display WRITE operation info
 #define LOGFL_DIRCTRL   0x00000008  // if set, display DIRCTRL operation info
 #define LOGFL_VOLCTX    0x00000010  // if set, display VOLCTX operation info
+#define LOGFL_STATS     0x00000020  // if set, display buffer pool and transform statistics
 
 ULONG LoggingFlags = 0;             // all disabled by default
 
@@ -357,12 +640,12 @@ Return Value:
     USHORT size;
     UCHAR volPropBuffer[sizeof(FLT_VOLUME_PROPERTIES)+512];
     PFLT_VOLUME_PROPERTIES volProp = (PFLT_VOLUME_PROPERTIES)volPropBuffer;
+    ULONG i;
 
     PAGED_CODE();
 
     UNREFERENCED_PARAMETER( Flags );
     UNREFERENCED_PARAMETER( VolumeDeviceType );
-    UNREFERENCED_PARAMETER( VolumeFilesystemType );
 
     try {
 
@@ -385,6 +668,14 @@ Return Value:
             leave;
         }
 
+        //
+        //  Init the fields the cleanup routine looks at (which may be
+        //  allocated later).
+        //
+
+        RtlInitEmptyUnicodeString( &ctx->Name, NULL, 0 );
+        ctx->Pools = NULL;
+
         //
         //  Always get the volume properties, so I can get a sector size
         //
@@ -409,11 +700,30 @@ Return Value:
 
         ctx->SectorSize = max(volProp->SectorSize,MIN_SECTOR_SIZE);
 
+        ctx->FcbHeader = (BOOLEAN)((VolumeFilesystemType == FLT_FSTYPE_NTFS) ||
+                                   (VolumeFilesystemType == FLT_FSTYPE_FAT) ||
+                                   (VolumeFilesystemType == FLT_FSTYPE_EXFAT) ||
+                                   (VolumeFilesystemType == FLT_FSTYPE_REFS));
+
         //
-        //  Init the buffer field (which may be allocated later).
+        //  Set up the swap buffer pools.  If we can't, we can still swap
+        //  buffers, we just won't reuse them.
         //
 
-        ctx->Name.Buffer = NULL;
+        ctx->Pools = ExAllocatePoolWithTag( NonPagedPool,
+                                            SWAP_POOL_CLASSES * sizeof(SWAP_BUFFER_POOL),
+                                            POOL_TAG );
+
+        if (ctx->Pools != NULL) {
+
+            for (i = 0; i < SWAP_POOL_CLASSES; i++) {
+
+                InitializeSListHead( &ctx->Pools[i].FreeList );
+                ctx->Pools[i].MaxDepth = (USHORT)(SWAP_POOL_CLASS_BYTES / SWAP_POOL_CLASS_SIZE( i ));
+                ctx->Pools[i].Hits = 0;
+                ctx->Pools[i].Misses = 0;
+            }
+        }
 
         //
         //  Get the storage device object we want a name for.
@@ -572,7 +882,8 @@ CleanupVolumeContext(
 Routine Description:
 
     The given context is being freed.
-    Free the allocated name buffer if there one.
+    Free the allocated name buffer if there one, and the buffers in the
+    swap buffer pools.
 
 Arguments:
 
@@ -587,6 +898,8 @@ Return Value:
 --*/
 {
     PVOLUME_CONTEXT ctx = Context;
+    PSLIST_ENTRY buffer;
+    ULONG i;
 
     PAGED_CODE();
 
@@ -594,6 +907,27 @@ Return Value:
 
     FLT_ASSERT(ContextType == FLT_VOLUME_CONTEXT);
 
+    if (ctx->Pools != NULL) {
+
+        for (i = 0; i < SWAP_POOL_CLASSES; i++) {
+
+            LOG_PRINT( LOGFL_STATS,
+                       ("SwapBuffers!CleanupVolumeContext:           %wZ %uKB buffers: hits=%d misses=%d\n",
+                        &ctx->Name,
+                        SWAP_POOL_CLASS_SIZE( i ) / 1024,
+                        ctx->Pools[i].Hits,
+                        ctx->Pools[i].Misses) );
+
+            while ((buffer = InterlockedPopEntrySList( &ctx->Pools[i].FreeList )) != NULL) {
+
+                ExFreePoolWithTag( buffer, BUFFER_SWAP_TAG );
+            }
+        }
+
+        ExFreePoolWithTag( ctx->Pools, POOL_TAG );
+        ctx->Pools = NULL;
+    }
+
     if (ctx->Name.Buffer != NULL) {
 
         ExFreePool(ctx->Name.Buffer);
@@ -752,6 +1086,9 @@ Return Value:
 
 --*/
 {
+    LARGE_INTEGER frequency;
+    LONGLONG microseconds;
+
     PAGED_CODE();
 
     UNREFERENCED_PARAMETER( Flags );
@@ -762,6 +1099,23 @@ Return Value:
 
     FltUnregisterFilter( gFilterHandle );
 
+    //
+    //  Report what the transform cost.
+    //
+
+    if ((TransformRoutine != NULL) && (TransformBytes != 0)) {
+
+        KeQueryPerformanceCounter( &frequency );
+
+        microseconds = (TransformTicks * 1000000) / frequency.QuadPart;
+
+        LOG_PRINT( LOGFL_STATS,
+                   ("SwapBuffers!FilterUnload:                   transformed %I64d bytes in %I64d us, %I64d us/MB\n",
+                    TransformBytes,
+                    microseconds,
+                    (microseconds * 1024 * 1024) / TransformBytes) );
+    }
+
     //
     //  Delete lookaside list
     //
@@ -788,7 +1142,8 @@ Routine Description:
 
     This routine demonstrates how to swap buffers for the READ operation.
 
-    Note that it handles all errors by simply not doing the buffer swap.
+    Note that it handles all errors by simply not doing the buffer swap,
+    except that an operation whose data needs transforming is failed.
 
 Arguments:
 
@@ -805,6 +1160,7 @@ Return Value:
 
     FLT_PREOP_SUCCESS_WITH_CALLBACK - we want a postOpeation callback
     FLT_PREOP_SUCCESS_NO_CALLBACK - we don't want a postOperation callback
+    FLT_PREOP_COMPLETE - we failed the operation
 
 --*/
 {
@@ -813,9 +1169,12 @@ Return Value:
     PVOID newBuf = NULL;
     PMDL newMdl = NULL;
     PVOLUME_CONTEXT volCtx = NULL;
+    PSTREAM_CONTEXT streamCtx = NULL;
     PPRE_2_POST_CONTEXT p2pCtx;
     NTSTATUS status;
     ULONG readLen = iopb->Parameters.Read.Length;
+    ULONG sizeClass = SWAP_POOL_NONE;
+    BOOLEAN transform = FALSE;
 
     try {
 
@@ -844,6 +1203,19 @@ Return Value:
                        ("SwapBuffers!SwapPreReadBuffers:             Error getting volume context, status=%x\n",
                         status) );
 
+            //
+            //  Data that needs transforming can't go through without us.
+            //
+
+            if (FlagOn(IRP_NOCACHE,iopb->IrpFlags) &&
+                (TransformRoutine != NULL) &&
+                !FlagOn(FltObjects->FileObject->Flags,FO_VOLUME_OPEN)) {
+
+                Data->IoStatus.Status = status;
+                Data->IoStatus.Information = 0;
+                retValue = FLT_PREOP_COMPLETE;
+            }
+
             leave;
         }
 
@@ -857,19 +1229,69 @@ Return Value:
         if (FlagOn(IRP_NOCACHE,iopb->IrpFlags)) {
 
             readLen = (ULONG)ROUND_TO_SIZE(readLen,volCtx->SectorSize);
+
+            //
+            //  Only non-cached data is transformed: the data in the cache
+            //  is the data as the user sees it.  The transform depends on
+            //  the file offset, so we must know it.
+            //
+
+            if ((TransformRoutine != NULL) &&
+                !FlagOn(FltObjects->FileObject->Flags,FO_VOLUME_OPEN)) {
+
+                if (iopb->Parameters.Read.ByteOffset.QuadPart < 0) {
+
+                    Data->IoStatus.Status = STATUS_NOT_SUPPORTED;
+                    Data->IoStatus.Information = 0;
+                    retValue = FLT_PREOP_COMPLETE;
+                    leave;
+                }
+
+                //
+                //  The stream context says which part of the data is on
+                //  disk.  Without it we can't get the data right.
+                //
+
+                status = FltGetStreamContext( FltObjects->Instance,
+                                              FltObjects->FileObject,
+                                              &streamCtx );
+
+                if (!NT_SUCCESS(status)) {
+
+                    LOG_PRINT( LOGFL_ERRORS,
+                               ("SwapBuffers!SwapPreReadBuffers:             %wZ Error getting stream context, status=%x\n",
+                                &volCtx->Name,
+                                status) );
+
+                    Data->IoStatus.Status = status;
+                    Data->IoStatus.Information = 0;
+                    retValue = FLT_PREOP_COMPLETE;
+                    leave;
+                }
+
+                if (streamCtx->Sparse) {
+
+                    FltReleaseContext( streamCtx );
+                    streamCtx = NULL;
+
+                } else {
+
+                    transform = TRUE;
+                }
+            }
         }
 
         //
-        //  Allocate aligned nonPaged memory for the buffer we are swapping
-        //  to. This is really only necessary for noncached IO but we always
-        //  do it here for simplification. If we fail to get the memory, just
+        //  Get aligned nonPaged memory for the buffer we are swapping to.
+        //  This is really only necessary for noncached IO but we always do
+        //  it here for simplification. If we fail to get the memory, just
         //  don't swap buffers on this operation.
         //
 
-        newBuf = FltAllocatePoolAlignedWithTag( FltObjects->Instance, 
-                                                NonPagedPool,
-                                                (SIZE_T) readLen,
-                                                BUFFER_SWAP_TAG );
+        newBuf = SwapAllocateBuffer( FltObjects->Instance,
+                                     volCtx,
+                                     readLen,
+                                     &sizeClass );
         if (newBuf == NULL) {
 
             LOG_PRINT( LOGFL_ERRORS,
@@ -959,7 +1381,11 @@ Return Value:
         //
 
         p2pCtx->SwappedBuffer = newBuf;
+        p2pCtx->SizeClass = sizeClass;
         p2pCtx->VolCtx = volCtx;
+        p2pCtx->StreamCtx = streamCtx;
+        p2pCtx->Transform = transform;
+        p2pCtx->ByteOffset = iopb->Parameters.Read.ByteOffset.QuadPart;
 
         *CompletionContext = p2pCtx;
 
@@ -971,6 +1397,18 @@ Return Value:
 
     } finally {
 
+        //
+        //  If the data needed transforming we can't let the read through
+        //  without us, fail it instead.
+        //
+
+        if (transform && (retValue == FLT_PREOP_SUCCESS_NO_CALLBACK)) {
+
+            Data->IoStatus.Status = STATUS_INSUFFICIENT_RESOURCES;
+            Data->IoStatus.Information = 0;
+            retValue = FLT_PREOP_COMPLETE;
+        }
+
         //
         //  If we don't want a post-operation callback, then cleanup state.
         //
@@ -979,9 +1417,10 @@ Return Value:
 
             if (newBuf != NULL) {
 
-                FltFreePoolAlignedWithTag( FltObjects->Instance,
-                                           newBuf,
-                                           BUFFER_SWAP_TAG );
+                SwapFreeBuffer( FltObjects->Instance,
+                                volCtx,
+                                newBuf,
+                                sizeClass );
             }
 
             if (newMdl != NULL) {
@@ -989,6 +1428,11 @@ Return Value:
                 IoFreeMdl( newMdl );
             }
 
+            if (streamCtx != NULL) {
+
+                FltReleaseContext( streamCtx );
+            }
+
             if (volCtx != NULL) {
 
                 FltReleaseContext( volCtx );
@@ -1174,9 +1618,9 @@ Return Value:
 
         try {
 
-            RtlCopyMemory( origBuf,
-                           p2pCtx->SwappedBuffer,
-                           Data->IoStatus.Information );
+            SwapCopyReadData( origBuf,
+                              p2pCtx,
+                              (ULONG) Data->IoStatus.Information );
 
         } except (EXCEPTION_EXECUTE_HANDLER) {
 
@@ -1210,9 +1654,15 @@ Return Value:
                         p2pCtx->SwappedBuffer,
                         Data->IoStatus.Information) );
 
-            FltFreePoolAlignedWithTag( FltObjects->Instance,
-                                       p2pCtx->SwappedBuffer,
-                                       BUFFER_SWAP_TAG );
+            SwapFreeBuffer( FltObjects->Instance,
+                            p2pCtx->VolCtx,
+                            p2pCtx->SwappedBuffer,
+                            p2pCtx->SizeClass );
+
+            if (p2pCtx->StreamCtx != NULL) {
+
+                FltReleaseContext( p2pCtx->StreamCtx );
+            }
 
             FltReleaseContext( p2pCtx->VolCtx );
 
@@ -1319,9 +1769,9 @@ Return Value:
             //  buffer address.
             //
 
-            RtlCopyMemory( origBuf,
-                           p2pCtx->SwappedBuffer,
-                           Data->IoStatus.Information );
+            SwapCopyReadData( origBuf,
+                              p2pCtx,
+                              (ULONG) Data->IoStatus.Information );
         }
     }
 
@@ -1335,9 +1785,15 @@ Return Value:
                 p2pCtx->SwappedBuffer,
                 Data->IoStatus.Information) );
 
-    FltFreePoolAlignedWithTag( FltObjects->Instance,
-                               p2pCtx->SwappedBuffer,
-                               BUFFER_SWAP_TAG );
+    SwapFreeBuffer( FltObjects->Instance,
+                    p2pCtx->VolCtx,
+                    p2pCtx->SwappedBuffer,
+                    p2pCtx->SizeClass );
+
+    if (p2pCtx->StreamCtx != NULL) {
+
+        FltReleaseContext( p2pCtx->StreamCtx );
+    }
 
     FltReleaseContext( p2pCtx->VolCtx );
 
@@ -1392,6 +1848,7 @@ Return Value:
     PVOLUME_CONTEXT volCtx = NULL;
     PPRE_2_POST_CONTEXT p2pCtx;
     NTSTATUS status;
+    ULONG sizeClass = SWAP_POOL_NONE;
 
     try {
 
@@ -1423,14 +1880,15 @@ Return Value:
         }
 
         //
-        //  Allocate nonPaged memory for the buffer we are swapping to.
+        //  Get nonPaged memory for the buffer we are swapping to.
         //  If we fail to get the memory, just don't swap buffers on this
         //  operation.
         //
 
-        newBuf = ExAllocatePoolWithTag( NonPagedPool,
-                                        iopb->Parameters.DirectoryControl.QueryDirectory.Length,
-                                        BUFFER_SWAP_TAG );
+        newBuf = SwapAllocateBuffer( FltObjects->Instance,
+                                     volCtx,
+                                     iopb->Parameters.DirectoryControl.QueryDirectory.Length,
+                                     &sizeClass );
 
         if (newBuf == NULL) {
 
@@ -1524,7 +1982,10 @@ Return Value:
         //
 
         p2pCtx->SwappedBuffer = newBuf;
+        p2pCtx->SizeClass = sizeClass;
         p2pCtx->VolCtx = volCtx;
+        p2pCtx->StreamCtx = NULL;
+        p2pCtx->Transform = FALSE;
 
         *CompletionContext = p2pCtx;
 
@@ -1544,7 +2005,10 @@ Return Value:
 
             if (newBuf != NULL) {
 
-                ExFreePool( newBuf );
+                SwapFreeBuffer( FltObjects->Instance,
+                                volCtx,
+                                newBuf,
+                                sizeClass );
             }
 
             if (newMdl != NULL) {
@@ -1772,7 +2236,11 @@ Return Value:
                         p2pCtx->SwappedBuffer,
                         Data->IoStatus.Information) );
 
-            ExFreePool( p2pCtx->SwappedBuffer );
+            SwapFreeBuffer( FltObjects->Instance,
+                            p2pCtx->VolCtx,
+                            p2pCtx->SwappedBuffer,
+                            p2pCtx->SizeClass );
+
             FltReleaseContext( p2pCtx->VolCtx );
 
             ExFreeToNPagedLookasideList( &Pre2PostContextList,
@@ -1897,7 +2365,11 @@ Return Value:
                 p2pCtx->SwappedBuffer,
                 Data->IoStatus.Information) );
 
-    ExFreePool( p2pCtx->SwappedBuffer );
+    SwapFreeBuffer( FltObjects->Instance,
+                    p2pCtx->VolCtx,
+                    p2pCtx->SwappedBuffer,
+                    p2pCtx->SizeClass );
+
     FltReleaseContext( p2pCtx->VolCtx );
 
     ExFreeToNPagedLookasideList( &Pre2PostContextList,
@@ -1919,7 +2391,8 @@ Routine Description:
 
     This routine demonstrates how to swap buffers for the WRITE operation.
 
-    Note that it handles all errors by simply not doing the buffer swap.
+    Note that it handles all errors by simply not doing the buffer swap,
+    except that an operation whose data needs transforming is failed.
 
 Arguments:
 
@@ -1944,10 +2417,13 @@ Return Value:
     PVOID newBuf = NULL;
     PMDL newMdl = NULL;
     PVOLUME_CONTEXT volCtx = NULL;
+    PSTREAM_CONTEXT streamCtx = NULL;
     PPRE_2_POST_CONTEXT p2pCtx;
     PVOID origBuf;
     NTSTATUS status;
     ULONG writeLen = iopb->Parameters.Write.Length;
+    ULONG sizeClass = SWAP_POOL_NONE;
+    BOOLEAN transform = FALSE;
 
     try {
 
@@ -1976,6 +2452,19 @@ Return Value:
                        ("SwapBuffers!SwapPreWriteBuffers:            Error getting volume context, status=%x\n",
                         status) );
 
+            //
+            //  Data that needs transforming can't go through without us.
+            //
+
+            if (FlagOn(IRP_NOCACHE,iopb->IrpFlags) &&
+                (TransformRoutine != NULL) &&
+                !FlagOn(FltObjects->FileObject->Flags,FO_VOLUME_OPEN)) {
+
+                Data->IoStatus.Status = status;
+                Data->IoStatus.Information = 0;
+                retValue = FLT_PREOP_COMPLETE;
+            }
+
             leave;
         }
 
@@ -1989,19 +2478,68 @@ Return Value:
         if (FlagOn(IRP_NOCACHE,iopb->IrpFlags)) {
 
             writeLen = (ULONG)ROUND_TO_SIZE(writeLen,volCtx->SectorSize);
+
+            //
+            //  Only non-cached data is transformed, see SwapPreReadBuffers.
+            //  A write to end of file has no offset yet, so we can't do it.
+            //
+
+            if ((TransformRoutine != NULL) &&
+                !FlagOn(FltObjects->FileObject->Flags,FO_VOLUME_OPEN)) {
+
+                if (iopb->Parameters.Write.ByteOffset.QuadPart < 0) {
+
+                    Data->IoStatus.Status = STATUS_NOT_SUPPORTED;
+                    Data->IoStatus.Information = 0;
+                    retValue = FLT_PREOP_COMPLETE;
+                    leave;
+                }
+
+                //
+                //  The stream context says which part of the data is on
+                //  disk.  Without it we can't get the data right.
+                //
+
+                status = FltGetStreamContext( FltObjects->Instance,
+                                              FltObjects->FileObject,
+                                              &streamCtx );
+
+                if (!NT_SUCCESS(status)) {
+
+                    LOG_PRINT( LOGFL_ERRORS,
+                               ("SwapBuffers!SwapPreWriteBuffers:            %wZ Error getting stream context, status=%x\n",
+                                &volCtx->Name,
+                                status) );
+
+                    Data->IoStatus.Status = status;
+                    Data->IoStatus.Information = 0;
+                    retValue = FLT_PREOP_COMPLETE;
+                    leave;
+                }
+
+                if (streamCtx->Sparse) {
+
+                    FltReleaseContext( streamCtx );
+                    streamCtx = NULL;
+
+                } else {
+
+                    transform = TRUE;
+                }
+            }
         }
 
         //
-        //  Allocate aligned nonPaged memory for the buffer we are swapping
-        //  to. This is really only necessary for noncached IO but we always
-        //  do it here for simplification. If we fail to get the memory, just
+        //  Get aligned nonPaged memory for the buffer we are swapping to.
+        //  This is really only necessary for noncached IO but we always do
+        //  it here for simplification. If we fail to get the memory, just
         //  don't swap buffers on this operation.
         //
 
-        newBuf = FltAllocatePoolAlignedWithTag( FltObjects->Instance, 
-                                                NonPagedPool,
-                                                (SIZE_T) writeLen,
-                                                BUFFER_SWAP_TAG );
+        newBuf = SwapAllocateBuffer( FltObjects->Instance,
+                                     volCtx,
+                                     writeLen,
+                                     &sizeClass );
 
         if (newBuf == NULL) {
 
@@ -2099,9 +2637,19 @@ Return Value:
 
         try {
 
-            RtlCopyMemory( newBuf,
-                           origBuf,
-                           writeLen );
+            if (transform) {
+
+                SwapTransformData( newBuf,
+                                   origBuf,
+                                   writeLen,
+                                   iopb->Parameters.Write.ByteOffset.QuadPart );
+
+            } else {
+
+                RtlCopyMemory( newBuf,
+                               origBuf,
+                               writeLen );
+            }
 
         } except (EXCEPTION_EXECUTE_HANDLER) {
 
@@ -2161,7 +2709,11 @@ Return Value:
         //
 
         p2pCtx->SwappedBuffer = newBuf;
+        p2pCtx->SizeClass = sizeClass;
         p2pCtx->VolCtx = volCtx;
+        p2pCtx->StreamCtx = streamCtx;
+        p2pCtx->Transform = transform;
+        p2pCtx->ByteOffset = iopb->Parameters.Write.ByteOffset.QuadPart;
 
         *CompletionContext = p2pCtx;
 
@@ -2173,6 +2725,18 @@ Return Value:
 
     } finally {
 
+        //
+        //  If the data needed transforming we can't let the write through
+        //  untransformed, fail it instead.
+        //
+
+        if (transform && (retValue == FLT_PREOP_SUCCESS_NO_CALLBACK)) {
+
+            Data->IoStatus.Status = STATUS_INSUFFICIENT_RESOURCES;
+            Data->IoStatus.Information = 0;
+            retValue = FLT_PREOP_COMPLETE;
+        }
+
         //
         //  If we don't want a post-operation callback, then free the buffer
         //  or MDL if it was allocated.
@@ -2182,10 +2746,10 @@ Return Value:
 
             if (newBuf != NULL) {
 
-                FltFreePoolAlignedWithTag( FltObjects->Instance,
-                                           newBuf,
-                                           BUFFER_SWAP_TAG );
-
+                SwapFreeBuffer( FltObjects->Instance,
+                                volCtx,
+                                newBuf,
+                                sizeClass );
             }
 
             if (newMdl != NULL) {
@@ -2193,6 +2757,11 @@ Return Value:
                 IoFreeMdl( newMdl );
             }
 
+            if (streamCtx != NULL) {
+
+                FltReleaseContext( streamCtx );
+            }
+
             if (volCtx != NULL) {
 
                 FltReleaseContext( volCtx );
@@ -2215,19 +2784,49 @@ SwapPostWriteBuffers(
 
 Routine Description:
 
+    This routine does postWrite buffer swap handling.  The data of a
+    transformed write is now on disk, so the stream's valid data length
+    moves up to cover it.
 
 Arguments:
 
+    Data - Pointer to the filter callbackData that is passed to us.
+
+    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
+        opaque handles to this filter, instance, its associated volume and
+        file object.
+
+    CompletionContext - The completion context set in the pre-operation routine.
+
+    Flags - Denotes whether the completion is successful or is being drained.
 
 Return Value:
 
+    FLT_POSTOP_FINISHED_PROCESSING - This is always returned.
+
 --*/
 {
     PPRE_2_POST_CONTEXT p2pCtx = CompletionContext;
+    LONGLONG endOfWrite;
+    KIRQL oldIrql;
 
     UNREFERENCED_PARAMETER( FltObjects );
     UNREFERENCED_PARAMETER( Flags );
 
+    if (p2pCtx->Transform && NT_SUCCESS(Data->IoStatus.Status)) {
+
+        endOfWrite = p2pCtx->ByteOffset + Data->IoStatus.Information;
+
+        KeAcquireSpinLock( &p2pCtx->StreamCtx->Lock, &oldIrql );
+
+        if (endOfWrite > p2pCtx->StreamCtx->ValidDataLength) {
+
+            p2pCtx->StreamCtx->ValidDataLength = endOfWrite;
+        }
+
+        KeReleaseSpinLock( &p2pCtx->StreamCtx->Lock, oldIrql );
+    }
+
     LOG_PRINT( LOGFL_WRITE,
                ("SwapBuffers!SwapPostWriteBuffers:           %wZ newB=%p info=%Iu Freeing\n",
                 &p2pCtx->VolCtx->Name,
@@ -2238,9 +2837,15 @@ Return Value:
     //  Free allocate POOL and volume context
     //
 
-    FltFreePoolAlignedWithTag( FltObjects->Instance,
-                               p2pCtx->SwappedBuffer,
-                               BUFFER_SWAP_TAG );
+    SwapFreeBuffer( FltObjects->Instance,
+                    p2pCtx->VolCtx,
+                    p2pCtx->SwappedBuffer,
+                    p2pCtx->SizeClass );
+
+    if (p2pCtx->StreamCtx != NULL) {
+
+        FltReleaseContext( p2pCtx->StreamCtx );
+    }
 
     FltReleaseContext( p2pCtx->VolCtx );
 
@@ -2251,84 +2856,909 @@ Return Value:
 }
 
 
-VOID
-ReadDriverParameters (
-    _In_ PUNICODE_STRING RegistryPath
+FLT_POSTOP_CALLBACK_STATUS
+SwapPostCreate(
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_opt_ PVOID CompletionContext,
+    _In_ FLT_POST_OPERATION_FLAGS Flags
     )
 /*++
 
 Routine Description:
 
-    This routine tries to read the driver-specific parameters from
-    the registry.  These values will be found in the registry location
-    indicated by the RegistryPath passed in.
+    While a transform is active, this attaches a stream context to each
+    file stream that is opened, recording its valid data length and
+    whether it is sparse.  If the stream already has one it is kept, since
+    it is up to date.
+
+    If we can't attach a context, transformed reads and writes of the
+    stream fail.
 
 Arguments:
 
-    RegistryPath - the path key passed to the driver during driver entry.
+    Data - Pointer to the filter callbackData that is passed to us.
+
+    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
+        opaque handles to this filter, instance, its associated volume and
+        file object.
+
+    CompletionContext - Not used.
+
+    Flags - Denotes whether the completion is successful or is being drained.
 
 Return Value:
 
-    None.
+    FLT_POSTOP_FINISHED_PROCESSING - This is always returned.
 
 --*/
 {
-    OBJECT_ATTRIBUTES attributes;
-    HANDLE driverRegKey;
+    PVOLUME_CONTEXT volCtx = NULL;
+    PSTREAM_CONTEXT streamCtx = NULL;
+    FILE_STANDARD_INFORMATION standardInfo;
+    FILE_BASIC_INFORMATION basicInfo;
+    PFSRTL_COMMON_FCB_HEADER fcbHeader;
     NTSTATUS status;
-    ULONG resultLength;
-    UNICODE_STRING valueName;
-    UCHAR buffer[sizeof( KEY_VALUE_PARTIAL_INFORMATION ) + sizeof( LONG )];
 
-    //
-    //  If this value is not zero then somebody has already explicitly set it
-    //  so don't override those settings.
-    //
+    UNREFERENCED_PARAMETER( CompletionContext );
 
-    if (0 == LoggingFlags) {
+    if ((TransformRoutine == NULL) ||
+        FlagOn(Flags,FLTFL_POST_OPERATION_DRAINING) ||
+        !NT_SUCCESS(Data->IoStatus.Status) ||
+        (Data->IoStatus.Status == STATUS_REPARSE) ||
+        FlagOn(FltObjects->FileObject->Flags,FO_VOLUME_OPEN)) {
 
-        //
-        //  Open the desired registry key
-        //
+        return FLT_POSTOP_FINISHED_PROCESSING;
+    }
 
-        InitializeObjectAttributes( &attributes,
-                                    RegistryPath,
-                                    OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
-                                    NULL,
-                                    NULL );
+    try {
+
+        status = FltQueryInformationFile( FltObjects->Instance,
+                                          FltObjects->FileObject,
+                                          &standardInfo,
+                                          sizeof(standardInfo),
+                                          FileStandardInformation,
+                                          NULL );
 
-        status = ZwOpenKey( &driverRegKey,
-                            KEY_READ,
-                            &attributes );
+        if (!NT_SUCCESS(status) || standardInfo.Directory) {
 
-        if (!NT_SUCCESS( status )) {
+            leave;
+        }
+
+        status = FltQueryInformationFile( FltObjects->Instance,
+                                          FltObjects->FileObject,
+                                          &basicInfo,
+                                          sizeof(basicInfo),
+                                          FileBasicInformation,
+                                          NULL );
+
+        if (!NT_SUCCESS(status)) {
 
-            return;
+            leave;
         }
 
-        //
-        // Read the given value from the registry.
-        //
+        status = FltGetVolumeContext( FltObjects->Filter,
+                                      FltObjects->Volume,
+                                      &volCtx );
 
-        RtlInitUnicodeString( &valueName, L"DebugFlags" );
+        if (!NT_SUCCESS(status)) {
 
-        status = ZwQueryValueKey( driverRegKey,
-                                  &valueName,
-                                  KeyValuePartialInformation,
-                                  buffer,
-                                  sizeof(buffer),
-                                  &resultLength );
+            leave;
+        }
+
+        status = FltAllocateContext( FltObjects->Filter,
+                                     FLT_STREAM_CONTEXT,
+                                     sizeof(STREAM_CONTEXT),
+                                     NonPagedPool,
+                                     &streamCtx );
 
-        if (NT_SUCCESS( status )) {
+        if (!NT_SUCCESS(status)) {
 
-            LoggingFlags = *((PULONG) &(((PKEY_VALUE_PARTIAL_INFORMATION)buffer)->Data));
+            leave;
         }
 
+        KeInitializeSpinLock( &streamCtx->Lock );
+        streamCtx->Sparse = BooleanFlagOn( basicInfo.FileAttributes, FILE_ATTRIBUTE_SPARSE_FILE );
+
         //
-        //  Close the registry entry
+        //  Nobody can tell us the valid data length directly, but file
+        //  systems that cache keep it in the common FCB header.  Otherwise
+        //  we have to assume the whole file is valid.
         //
+        //  The file systems we set FcbHeader for start the FsContext of every
+        //  data stream with a FSRTL_COMMON_FCB_HEADER, which is the contract
+        //  the cache manager and the FsRtl fast I/O routines depend on.  The
+        //  file object was just opened, so the FsContext can't go away under
+        //  us.  ValidDataLength is changed with the header's Resource held
+        //  exclusive, so we read it holding the Resource shared, as
+        //  FsRtlCopyRead does.  The file system has dropped its own resources
+        //  by the time we see the create complete, so this can't deadlock.
+        //
+
+        streamCtx->ValidDataLength = standardInfo.EndOfFile.QuadPart;
+
+        if (volCtx->FcbHeader && (FltObjects->FileObject->FsContext != NULL)) {
+
+            fcbHeader = FltObjects->FileObject->FsContext;
+
+            if (fcbHeader->Resource != NULL) {
+
+                KeEnterCriticalRegion();
+                ExAcquireResourceSharedLite( fcbHeader->Resource, TRUE );
+
+                if (fcbHeader->ValidDataLength.QuadPart < streamCtx->ValidDataLength) {
+
+                    streamCtx->ValidDataLength = fcbHeader->ValidDataLength.QuadPart;
+                }
+
+                ExReleaseResourceLite( fcbHeader->Resource );
+                KeLeaveCriticalRegion();
+            }
+        }
+
+        status = FltSetStreamContext( FltObjects->Instance,
+                                      FltObjects->FileObject,
+                                      FLT_SET_CONTEXT_KEEP_IF_EXISTS,
+                                      streamCtx,
+                                      NULL );
+
+        if (!NT_SUCCESS(status) && (status != STATUS_FLT_CONTEXT_ALREADY_DEFINED)) {
+
+            LOG_PRINT( LOGFL_ERRORS,
+                       ("SwapBuffers!SwapPostCreate:                 %wZ Error setting stream context, status=%x\n",
+                        &volCtx->Name,
+                        status) );
+        }
+
+    } finally {
+
+        if (streamCtx != NULL) {
+
+            FltReleaseContext( streamCtx );
+        }
+
+        if (volCtx != NULL) {
+
+            FltReleaseContext( volCtx );
+        }
+    }
+
+    return FLT_POSTOP_FINISHED_PROCESSING;
+}
+
+
+FLT_PREOP_CALLBACK_STATUS
+SwapPreSetInformation(
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _Flt_CompletionContext_Outptr_ PVOID *CompletionContext
+    )
+/*++
+
+Routine Description:
+
+    Setting the end of file or the allocation size can truncate a stream,
+    which truncates its valid data length.  For those operations we pass
+    the stream context to the post-operation callback, which keeps ours in
+    step.
+
+Arguments:
+
+    Data - Pointer to the filter callbackData that is passed to us.
+
+    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
+        opaque handles to this filter, instance, its associated volume and
+        file object.
+
+    CompletionContext - Receives the stream context.
+
+Return Value:
+
+    FLT_PREOP_SUCCESS_WITH_CALLBACK - we want a postOpeation callback
+    FLT_PREOP_SUCCESS_NO_CALLBACK - we don't want a postOperation callback
+
+--*/
+{
+    FILE_INFORMATION_CLASS infoClass = Data->Iopb->Parameters.SetFileInformation.FileInformationClass;
+    PSTREAM_CONTEXT streamCtx;
+    NTSTATUS status;
+
+    //
+    //  The cache manager uses AdvanceOnly to move the end of file on disk
+    //  up, which never truncates.
+    //
+
+    if ((TransformRoutine == NULL) ||
+        ((infoClass != FileEndOfFileInformation) && (infoClass != FileAllocationInformation)) ||
+        ((infoClass == FileEndOfFileInformation) && Data->Iopb->Parameters.SetFileInformation.AdvanceOnly)) {
+
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
+
+    status = FltGetStreamContext( FltObjects->Instance,
+                                  FltObjects->FileObject,
+                                  &streamCtx );
+
+    if (!NT_SUCCESS(status)) {
+
+        return FLT_PREOP_SUCCESS_NO_CALLBACK;
+    }
+
+    *CompletionContext = streamCtx;
+
+    return FLT_PREOP_SUCCESS_WITH_CALLBACK;
+}
+
+
+FLT_POSTOP_CALLBACK_STATUS
+SwapPostSetInformation(
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _In_ PVOID CompletionContext,
+    _In_ FLT_POST_OPERATION_FLAGS Flags
+    )
+/*++
+
+Routine Description:
+
+    If the stream was truncated, cut its valid data length back to the new
+    size.  If it grew, the valid data length stays where it is: the file
+    system zero-fills the new part.
+
+Arguments:
+
+    Data - Pointer to the filter callbackData that is passed to us.
+
+    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
+        opaque handles to this filter, instance, its associated volume and
+        file object.
+
+    CompletionContext - The stream context.
+
+    Flags - Denotes whether the completion is successful or is being drained.
+
+Return Value:
 
-        ZwClose(driverRegKey);
+    FLT_POSTOP_FINISHED_PROCESSING - This is always returned.
+
+--*/
+{
+    PSTREAM_CONTEXT streamCtx = CompletionContext;
+    PVOID infoBuffer = Data->Iopb->Parameters.SetFileInformation.InfoBuffer;
+    LONGLONG newSize;
+    KIRQL oldIrql;
+
+    UNREFERENCED_PARAMETER( FltObjects );
+
+    if (!FlagOn(Flags,FLTFL_POST_OPERATION_DRAINING) &&
+        NT_SUCCESS(Data->IoStatus.Status)) {
+
+        if (Data->Iopb->Parameters.SetFileInformation.FileInformationClass == FileEndOfFileInformation) {
+
+            newSize = ((PFILE_END_OF_FILE_INFORMATION) infoBuffer)->EndOfFile.QuadPart;
+
+        } else {
+
+            newSize = ((PFILE_ALLOCATION_INFORMATION) infoBuffer)->AllocationSize.QuadPart;
+        }
+
+        KeAcquireSpinLock( &streamCtx->Lock, &oldIrql );
+
+        if (newSize < streamCtx->ValidDataLength) {
+
+            streamCtx->ValidDataLength = newSize;
+        }
+
+        KeReleaseSpinLock( &streamCtx->Lock, oldIrql );
+    }
+
+    FltReleaseContext( streamCtx );
+
+    return FLT_POSTOP_FINISHED_PROCESSING;
+}
+
+
+FLT_PREOP_CALLBACK_STATUS
+SwapPreFsControl(
+    _Inout_ PFLT_CALLBACK_DATA Data,
+    _In_ PCFLT_RELATED_OBJECTS FltObjects,
+    _Flt_CompletionContext_Outptr_ PVOID *CompletionContext
+    )
+/*++
+
+Routine Description:
+
+    A hole in a sparse file reads back as zeros without going through us,
+    and the data already in the file was written transformed.  So while a
+    transform is active, files can't be made sparse or not sparse.
+
+Arguments:
+
+    Data - Pointer to the filter callbackData that is passed to us.
+
+    FltObjects - Pointer to the FLT_RELATED_OBJECTS data structure containing
+        opaque handles to this filter, instance, its associated volume and
+        file object.
+
+    CompletionContext - Not used.
+
+Return Value:
+
+    FLT_PREOP_SUCCESS_NO_CALLBACK - let the operation through
+    FLT_PREOP_COMPLETE - we failed the operation
+
+--*/
+{
+    PFLT_IO_PARAMETER_BLOCK iopb = Data->Iopb;
+
+    UNREFERENCED_PARAMETER( FltObjects );
+    UNREFERENCED_PARAMETER( CompletionContext );
+
+    if ((TransformRoutine != NULL) &&
+        ((iopb->MinorFunction == IRP_MN_USER_FS_REQUEST) ||
+         (iopb->MinorFunction == IRP_MN_KERNEL_CALL)) &&
+        (iopb->Parameters.FileSystemControl.Common.FsControlCode == FSCTL_SET_SPARSE)) {
+
+        Data->IoStatus.Status = STATUS_NOT_SUPPORTED;
+        Data->IoStatus.Information = 0;
+        return FLT_PREOP_COMPLETE;
     }
+
+    return FLT_PREOP_SUCCESS_NO_CALLBACK;
 }
 
+
+VOID
+ReadDriverParameters (
+    _In_ PUNICODE_STRING RegistryPath
+    )
+/*++
+
+Routine Description:
+
+    This routine tries to read the driver-specific parameters from
+    the registry.  These values will be found in the registry location
+    indicated by the RegistryPath passed in.
+
+    "DebugFlags" sets LoggingFlags.  "Transform" selects the transform
+    applied to non-cached data, and "TransformKey" is the key for it.
+
+Arguments:
+
+    RegistryPath - the path key passed to the driver during driver entry.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    OBJECT_ATTRIBUTES attributes;
+    HANDLE driverRegKey;
+    NTSTATUS status;
+    ULONG resultLength;
+    UNICODE_STRING valueName;
+    UCHAR buffer[sizeof( KEY_VALUE_PARTIAL_INFORMATION ) + SWAP_TRANSFORM_KEY_SIZE];
+    PKEY_VALUE_PARTIAL_INFORMATION value = (PKEY_VALUE_PARTIAL_INFORMATION)buffer;
+    ULONG transform = SWAP_TRANSFORM_NONE;
+    ULONG i;
+
+    //
+    //  Open the desired registry key
+    //
+
+    InitializeObjectAttributes( &attributes,
+                                RegistryPath,
+                                OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE,
+                                NULL,
+                                NULL );
+
+    status = ZwOpenKey( &driverRegKey,
+                        KEY_READ,
+                        &attributes );
+
+    if (!NT_SUCCESS( status )) {
+
+        return;
+    }
+
+    //
+    //  If this value is not zero then somebody has already explicitly set it
+    //  so don't override those settings.
+    //
+
+    if (0 == LoggingFlags) {
+
+        //
+        // Read the given value from the registry.
+        //
+
+        RtlInitUnicodeString( &valueName, L"DebugFlags" );
+
+        status = ZwQueryValueKey( driverRegKey,
+                                  &valueName,
+                                  KeyValuePartialInformation,
+                                  buffer,
+                                  sizeof(buffer),
+                                  &resultLength );
+
+        if (NT_SUCCESS( status ) && (value->DataLength >= sizeof(ULONG))) {
+
+            LoggingFlags = *((PULONG) &(value->Data));
+        }
+    }
+
+    //
+    //  See which transform, if any, we are to apply.
+    //
+
+    RtlInitUnicodeString( &valueName, L"Transform" );
+
+    status = ZwQueryValueKey( driverRegKey,
+                              &valueName,
+                              KeyValuePartialInformation,
+                              buffer,
+                              sizeof(buffer),
+                              &resultLength );
+
+    if (NT_SUCCESS( status ) && (value->DataLength >= sizeof(ULONG))) {
+
+        transform = *((PULONG) &(value->Data));
+    }
+
+    if (transform == SWAP_TRANSFORM_XOR) {
+
+        //
+        //  Build the key.  A key shorter than SWAP_TRANSFORM_KEY_SIZE is
+        //  repeated to fill it.  Without one we use a fixed pattern, which
+        //  is good enough to model the cost of a transform.
+        //
+
+        RtlInitUnicodeString( &valueName, L"TransformKey" );
+
+        status = ZwQueryValueKey( driverRegKey,
+                                  &valueName,
+                                  KeyValuePartialInformation,
+                                  buffer,
+                                  sizeof(buffer),
+                                  &resultLength );
+
+        if (NT_SUCCESS( status ) &&
+            (value->Type == REG_BINARY) &&
+            (value->DataLength != 0)) {
+
+            for (i = 0; i < SWAP_TRANSFORM_KEY_SIZE; i++) {
+
+                TransformKey[i] = value->Data[i % value->DataLength];
+            }
+
+        } else {
+
+            for (i = 0; i < SWAP_TRANSFORM_KEY_SIZE; i++) {
+
+                TransformKey[i] = (UCHAR)((i * 0x9d) + 0x5b);
+            }
+        }
+
+        RtlCopyMemory( &TransformKey[SWAP_TRANSFORM_KEY_SIZE],
+                       TransformKey,
+                       SWAP_TRANSFORM_KEY_SIZE );
+
+#if defined(_M_AMD64)
+        TransformRoutine = SwapTransformXorSse2;
+#else
+        TransformRoutine = SwapTransformXor;
+#endif
+    }
+
+    //
+    //  Close the registry entry
+    //
+
+    ZwClose(driverRegKey);
+}
+
+
+/*************************************************************************
+    Swap buffer pools and data transforms.
+*************************************************************************/
+
+ULONG
+SwapSizeClass (
+    _In_ ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    Returns the pool size class for a buffer of the given length: the
+    smallest power of 2 that holds it.
+
+Arguments:
+
+    Length - The length of the buffer.
+
+Return Value:
+
+    The size class, or SWAP_POOL_NONE if the buffer is too big to pool.
+
+--*/
+{
+    ULONG index;
+
+    if (Length <= SWAP_POOL_CLASS_SIZE( 0 )) {
+
+        return 0;
+    }
+
+    if (Length > SWAP_POOL_CLASS_SIZE( SWAP_POOL_CLASSES - 1 )) {
+
+        return SWAP_POOL_NONE;
+    }
+
+    _BitScanReverse( &index, Length - 1 );
+
+    return index + 1 - SWAP_POOL_MIN_SHIFT;
+}
+
+
+PVOID
+SwapAllocateBuffer (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PVOLUME_CONTEXT VolCtx,
+    _In_ ULONG Length,
+    _Out_ PULONG SizeClass
+    )
+/*++
+
+Routine Description:
+
+    Gets a sector aligned, nonPaged buffer to swap to.  It comes from the
+    volume's pool for its size if there is a free one there, otherwise it
+    is allocated.
+
+Arguments:
+
+    Instance - Our instance on the volume.
+
+    VolCtx - The volume context, which holds the pools.
+
+    Length - How big the buffer must be.
+
+    SizeClass - Receives the size class of the buffer, to be passed to
+        SwapFreeBuffer.
+
+Return Value:
+
+    The buffer, or NULL if we could not get the memory.
+
+--*/
+{
+    PSWAP_BUFFER_POOL pool;
+    PVOID buffer;
+    ULONG sizeClass;
+
+    sizeClass = SwapSizeClass( Length );
+
+    if ((VolCtx->Pools == NULL) || (sizeClass == SWAP_POOL_NONE)) {
+
+        *SizeClass = SWAP_POOL_NONE;
+
+        return FltAllocatePoolAlignedWithTag( Instance,
+                                              NonPagedPool,
+                                              (SIZE_T) Length,
+                                              BUFFER_SWAP_TAG );
+    }
+
+    *SizeClass = sizeClass;
+    pool = &VolCtx->Pools[sizeClass];
+
+    buffer = InterlockedPopEntrySList( &pool->FreeList );
+
+    if (buffer != NULL) {
+
+        InterlockedIncrement( &pool->Hits );
+        return buffer;
+    }
+
+    InterlockedIncrement( &pool->Misses );
+
+    //
+    //  Allocations of a page or more are page aligned.
+    //
+
+    return ExAllocatePoolWithTag( NonPagedPool,
+                                  SWAP_POOL_CLASS_SIZE( sizeClass ),
+                                  BUFFER_SWAP_TAG );
+}
+
+
+VOID
+SwapFreeBuffer (
+    _In_ PFLT_INSTANCE Instance,
+    _In_ PVOLUME_CONTEXT VolCtx,
+    _In_ PVOID Buffer,
+    _In_ ULONG SizeClass
+    )
+/*++
+
+Routine Description:
+
+    Frees a buffer from SwapAllocateBuffer.  Pooled buffers go back to
+    their pool unless it is full.
+
+Arguments:
+
+    Instance - Our instance on the volume.
+
+    VolCtx - The volume context the buffer was allocated with.
+
+    Buffer - The buffer.
+
+    SizeClass - The size class SwapAllocateBuffer returned.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PSWAP_BUFFER_POOL pool;
+
+    if (SizeClass == SWAP_POOL_NONE) {
+
+        FltFreePoolAlignedWithTag( Instance,
+                                   Buffer,
+                                   BUFFER_SWAP_TAG );
+        return;
+    }
+
+    pool = &VolCtx->Pools[SizeClass];
+
+    if (ExQueryDepthSList( &pool->FreeList ) < pool->MaxDepth) {
+
+        InterlockedPushEntrySList( &pool->FreeList, Buffer );
+
+    } else {
+
+        ExFreePoolWithTag( Buffer, BUFFER_SWAP_TAG );
+    }
+}
+
+
+VOID
+SwapCopyReadData (
+    _Out_writes_bytes_(Length) PUCHAR Destination,
+    _In_ PPRE_2_POST_CONTEXT P2pCtx,
+    _In_ ULONG Length
+    )
+/*++
+
+Routine Description:
+
+    Copies read data from our swap buffer to the user's buffer.  If the
+    read is transformed, only the data the file system read from disk is
+    transformed.  The rest is the file system's zero-fill, past valid data
+    length, and is copied as it is.
+
+Arguments:
+
+    Destination - The user's buffer.
+
+    P2pCtx - The state of the read.
+
+    Length - How many bytes were read.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PUCHAR source = P2pCtx->SwappedBuffer;
+    ULONG sectorSize = P2pCtx->VolCtx->SectorSize;
+    LONGLONG validDataLength;
+    ULONG transformLength = 0;
+    KIRQL oldIrql;
+
+    if (P2pCtx->Transform) {
+
+        KeAcquireSpinLock( &P2pCtx->StreamCtx->Lock, &oldIrql );
+        validDataLength = P2pCtx->StreamCtx->ValidDataLength;
+        KeReleaseSpinLock( &P2pCtx->StreamCtx->Lock, oldIrql );
+
+        //
+        //  File systems read whole sectors from disk, so the zero-fill
+        //  starts at the first sector boundary at or past valid data length.
+        //
+
+        validDataLength = (validDataLength + sectorSize - 1) & ~((LONGLONG) sectorSize - 1);
+
+        if (validDataLength > P2pCtx->ByteOffset) {
+
+            transformLength = (ULONG) min( (LONGLONG) Length,
+                                           validDataLength - P2pCtx->ByteOffset );
+
+            SwapTransformData( Destination,
+                               source,
+                               transformLength,
+                               P2pCtx->ByteOffset );
+        }
+    }
+
+    RtlCopyMemory( Destination + transformLength,
+                   source + transformLength,
+                   Length - transformLength );
+}
+
+
+VOID
+SwapTransformData (
+    _Out_writes_bytes_(Length) PUCHAR Destination,
+    _In_reads_bytes_(Length) PUCHAR Source,
+    _In_ ULONG Length,
+    _In_ LONGLONG ByteOffset
+    )
+/*++
+
+Routine Description:
+
+    Copies data between the user's buffer and ours through the transform,
+    and accounts for the time it took.
+
+Arguments:
+
+    Destination - Where the transformed data goes.
+
+    Source - The data to transform.
+
+    Length - How many bytes to transform.
+
+    ByteOffset - The file offset of the data.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+
+    FLT_ASSERT(TransformRoutine != NULL);
+
+    start = KeQueryPerformanceCounter( NULL );
+
+    TransformRoutine( Destination, Source, Length, ByteOffset );
+
+    end = KeQueryPerformanceCounter( NULL );
+
+    InterlockedAdd64( &TransformBytes, Length );
+    InterlockedAdd64( &TransformTicks, end.QuadPart - start.QuadPart );
+}
+
+
+VOID
+SwapTransformXor (
+    _Out_writes_bytes_(Length) PUCHAR Destination,
+    _In_reads_bytes_(Length) PUCHAR Source,
+    _In_ ULONG Length,
+    _In_ LONGLONG ByteOffset
+    )
+/*++
+
+Routine Description:
+
+    XORs the data with TransformKey, a pointer sized word at a time.
+
+Arguments:
+
+    Destination - Where the transformed data goes.
+
+    Source - The data to transform.
+
+    Length - How many bytes to transform.
+
+    ByteOffset - The file offset of the data.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PUCHAR key = &TransformKey[ByteOffset & (SWAP_TRANSFORM_KEY_SIZE - 1)];
+    ULONG i;
+
+    //
+    //  The key repeats every SWAP_TRANSFORM_KEY_SIZE bytes, so each block
+    //  of that size uses the same key bytes.
+    //
+
+    while (Length >= SWAP_TRANSFORM_KEY_SIZE) {
+
+        for (i = 0; i < SWAP_TRANSFORM_KEY_SIZE; i += sizeof(ULONG_PTR)) {
+
+            *(ULONG_PTR UNALIGNED *)&Destination[i] =
+                *(ULONG_PTR UNALIGNED *)&Source[i] ^ *(ULONG_PTR UNALIGNED *)&key[i];
+        }
+
+        Destination += SWAP_TRANSFORM_KEY_SIZE;
+        Source += SWAP_TRANSFORM_KEY_SIZE;
+        Length -= SWAP_TRANSFORM_KEY_SIZE;
+    }
+
+    for (i = 0; i < Length; i++) {
+
+        Destination[i] = Source[i] ^ key[i];
+    }
+}
+
+#if defined(_M_AMD64)
+
+VOID
+SwapTransformXorSse2 (
+    _Out_writes_bytes_(Length) PUCHAR Destination,
+    _In_reads_bytes_(Length) PUCHAR Source,
+    _In_ ULONG Length,
+    _In_ LONGLONG ByteOffset
+    )
+/*++
+
+Routine Description:
+
+    XORs the data with TransformKey, 64 bytes at a time with SSE2.  The
+    XMM registers are volatile on x64 so the kernel lets us use them
+    without saving them.
+
+Arguments:
+
+    Destination - Where the transformed data goes.
+
+    Source - The data to transform.
+
+    Length - How many bytes to transform.
+
+    ByteOffset - The file offset of the data.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PUCHAR key = &TransformKey[ByteOffset & (SWAP_TRANSFORM_KEY_SIZE - 1)];
+    __m128i key0 = _mm_loadu_si128( (__m128i *)&key[0] );
+    __m128i key1 = _mm_loadu_si128( (__m128i *)&key[16] );
+    __m128i key2 = _mm_loadu_si128( (__m128i *)&key[32] );
+    __m128i key3 = _mm_loadu_si128( (__m128i *)&key[48] );
+    __m128i data0, data1, data2, data3;
+    ULONG i;
+
+    C_ASSERT(SWAP_TRANSFORM_KEY_SIZE == 4 * sizeof(__m128i));
+
+    while (Length >= SWAP_TRANSFORM_KEY_SIZE) {
+
+        data0 = _mm_loadu_si128( (__m128i *)&Source[0] );
+        data1 = _mm_loadu_si128( (__m128i *)&Source[16] );
+        data2 = _mm_loadu_si128( (__m128i *)&Source[32] );
+        data3 = _mm_loadu_si128( (__m128i *)&Source[48] );
+
+        _mm_storeu_si128( (__m128i *)&Destination[0], _mm_xor_si128( data0, key0 ) );
+        _mm_storeu_si128( (__m128i *)&Destination[16], _mm_xor_si128( data1, key1 ) );
+        _mm_storeu_si128( (__m128i *)&Destination[32], _mm_xor_si128( data2, key2 ) );
+        _mm_storeu_si128( (__m128i *)&Destination[48], _mm_xor_si128( data3, key3 ) );
+
+        Destination += SWAP_TRANSFORM_KEY_SIZE;
+        Source += SWAP_TRANSFORM_KEY_SIZE;
+        Length -= SWAP_TRANSFORM_KEY_SIZE;
+    }
+
+    for (i = 0; i < Length; i++) {
+
+        Destination[i] = Source[i] ^ key[i];
+    }
+}
+
+#endif
+
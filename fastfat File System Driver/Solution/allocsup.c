@@ -177,6 +177,7 @@ FatLogOf(
     NT_ASSERT( (FAT_INDEX) + (CLUSTER_COUNT) - 2 <= (VCB)->FreeClusterBitMap.SizeOfBitMap );\
     NT_ASSERT( (FAT_INDEX) >= 2);                                                           \
     RtlClearBits(&(VCB)->FreeClusterBitMap,(FAT_INDEX)-2,(CLUSTER_COUNT));                  \
+    FatSummarizeWindowRun((VCB),(FAT_INDEX)-2,(CLUSTER_COUNT));                             \
     if ((FAT_INDEX) < (VCB)->ClusterHint) {                                                 \
         (VCB)->ClusterHint = (FAT_INDEX);                                                   \
     }                                                                                       \
@@ -199,6 +200,9 @@ FatLogOf(
     NT_ASSERT( (FAT_INDEX) + (CLUSTER_COUNT) - 2 <= (VCB)->FreeClusterBitMap.SizeOfBitMap );\
     NT_ASSERT( (FAT_INDEX) >= 2);                                                           \
     RtlSetBits(&(VCB)->FreeClusterBitMap,(FAT_INDEX)-2,(CLUSTER_COUNT));                    \
+    FatSummarizeAllocatedRun((VCB),                                                         \
+                             (FAT_INDEX)-2+(VCB)->CurrentWindow->FirstCluster,              \
+                             (CLUSTER_COUNT));                                              \
                                                                                             \
     if (_AfterRun - 2 >= (VCB)->FreeClusterBitMap.SizeOfBitMap) {                           \
         _AfterRun = 2;                                                                      \
@@ -252,6 +256,21 @@ FatLogOf(
 
 #define FatWindowOfCluster(C)           (((C) - 2) / MAX_CLUSTER_BITMAP_SIZE)
 
+//
+//  FAT32: Define the number of clusters described by each bit of the
+//  volume-wide FreeChunkSummary.  This must evenly divide the window size
+//  so that no chunk straddles two windows.
+//
+
+#define FAT_SUMMARY_CHUNK_SHIFT         8
+#define FAT_SUMMARY_CHUNK_SIZE          (1 << FAT_SUMMARY_CHUNK_SHIFT)
+
+//
+//  Calculate the summary chunk a given cluster number is in.
+//
+
+#define FatChunkOfCluster(C)            (((C) - 2) >> FAT_SUMMARY_CHUNK_SHIFT)
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, FatAddFileAllocation)
 #pragma alloc_text(PAGE, FatAllocateDiskSpace)
@@ -271,6 +290,274 @@ FatLogOf(
 #pragma alloc_text(PAGE, FatTruncateFileAllocation)
 #endif
 
+
+INLINE
+VOID
+FatSummarizeAllocatedRun (
+    IN PVCB Vcb,
+    IN ULONG FatIndex,
+    IN ULONG ClusterCount
+    )
+/*++
+
+Routine Description:
+
+    Mark every summary chunk touched by a run of clusters as not free.  The
+    caller must have the free cluster bitmap locked.
+
+Arguments:
+
+    Vcb - Supplies the Vcb for the volume
+
+    FatIndex - Supplies the first (volume relative) cluster of the run
+
+    ClusterCount - Supplies the number of clusters in the run
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONG FirstChunk;
+    ULONG LastChunk;
+
+    if ((Vcb->FreeChunkSummary.Buffer == NULL) || (ClusterCount == 0)) {
+
+        return;
+    }
+
+    FirstChunk = FatChunkOfCluster( FatIndex );
+    LastChunk = FatChunkOfCluster( FatIndex + ClusterCount - 1 );
+
+    //
+    //  The partial chunk at the end of the volume, if any, is never described.
+    //
+
+    if (FirstChunk >= Vcb->FreeChunkSummary.SizeOfBitMap) {
+
+        return;
+    }
+
+    if (LastChunk >= Vcb->FreeChunkSummary.SizeOfBitMap) {
+
+        LastChunk = Vcb->FreeChunkSummary.SizeOfBitMap - 1;
+    }
+
+    RtlSetBits( &Vcb->FreeChunkSummary, FirstChunk, LastChunk - FirstChunk + 1 );
+}
+
+
+INLINE
+VOID
+FatSummarizeFreeRun (
+    IN PVCB Vcb,
+    IN ULONG FatIndex,
+    IN ULONG ClusterCount
+    )
+/*++
+
+Routine Description:
+
+    Mark every summary chunk wholly contained in a run of free clusters as
+    free.  Chunks the run only partially covers are left alone.  The caller
+    must have the free cluster bitmap locked, or own the volume exclusively.
+
+Arguments:
+
+    Vcb - Supplies the Vcb for the volume
+
+    FatIndex - Supplies the first (volume relative) cluster of the free run
+
+    ClusterCount - Supplies the number of clusters in the free run
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONG FirstChunk;
+    ULONG EndChunk;
+
+    if (Vcb->FreeChunkSummary.Buffer == NULL) {
+
+        return;
+    }
+
+    FirstChunk = (FatIndex - 2 + FAT_SUMMARY_CHUNK_SIZE - 1) >> FAT_SUMMARY_CHUNK_SHIFT;
+    EndChunk = (FatIndex - 2 + ClusterCount) >> FAT_SUMMARY_CHUNK_SHIFT;
+
+    if (EndChunk > Vcb->FreeChunkSummary.SizeOfBitMap) {
+
+        EndChunk = Vcb->FreeChunkSummary.SizeOfBitMap;
+    }
+
+    if (FirstChunk < EndChunk) {
+
+        RtlClearBits( &Vcb->FreeChunkSummary, FirstChunk, EndChunk - FirstChunk );
+    }
+}
+
+
+INLINE
+VOID
+FatSummarizeWindowRun (
+    IN PVCB Vcb,
+    IN ULONG BitIndex,
+    IN ULONG ClusterCount
+    )
+/*++
+
+Routine Description:
+
+    Clusters have just been returned to the current window.  Recheck each
+    summary chunk the run touches against the window bitmap, and mark the
+    ones which are now completely free.  The caller must have the free
+    cluster bitmap locked.
+
+Arguments:
+
+    Vcb - Supplies the Vcb for the volume
+
+    BitIndex - Supplies the first bit of the run in the FreeClusterBitMap
+
+    ClusterCount - Supplies the number of clusters in the run
+
+Return Value:
+
+    None
+
+--*/
+{
+    ULONG Chunk;
+    ULONG LastChunk;
+    ULONG WindowBase;
+
+    if ((Vcb->FreeChunkSummary.Buffer == NULL) || (ClusterCount == 0)) {
+
+        return;
+    }
+
+    WindowBase = Vcb->CurrentWindow->FirstCluster - 2;
+
+    Chunk = (WindowBase + BitIndex) >> FAT_SUMMARY_CHUNK_SHIFT;
+    LastChunk = (WindowBase + BitIndex + ClusterCount - 1) >> FAT_SUMMARY_CHUNK_SHIFT;
+
+    for (; (Chunk <= LastChunk) && (Chunk < Vcb->FreeChunkSummary.SizeOfBitMap); Chunk++) {
+
+        ULONG ChunkBit = (Chunk << FAT_SUMMARY_CHUNK_SHIFT) - WindowBase;
+
+        if ((ChunkBit + FAT_SUMMARY_CHUNK_SIZE <= Vcb->FreeClusterBitMap.SizeOfBitMap) &&
+            RtlAreBitsClear( &Vcb->FreeClusterBitMap, ChunkBit, FAT_SUMMARY_CHUNK_SIZE )) {
+
+            RtlClearBit( &Vcb->FreeChunkSummary, Chunk );
+        }
+    }
+}
+
+
+INLINE
+BOOLEAN
+FatSelectWindowForRun (
+    IN PVCB Vcb,
+    IN ULONG ClusterCount,
+    IN ULONG AbsoluteClusterHint,
+    OUT PULONG Window
+    )
+/*++
+
+Routine Description:
+
+    Use the volume-wide free chunk summary to find a window, other than the
+    current one, which starts a completely free run of at least ClusterCount
+    clusters.  The search begins at the hint and wraps around the volume.
+    Requests larger than a window only need a window's worth of free chunks,
+    since the allocator will follow the run into the next window by itself.
+
+Arguments:
+
+    Vcb - Supplies the Vcb for the volume
+
+    ClusterCount - Supplies the number of clusters we would like in one run
+
+    AbsoluteClusterHint - Supplies the cluster to start searching from
+
+    Window - Receives the chosen window number (index into Vcb->Windows[])
+
+Return Value:
+
+    BOOLEAN - TRUE if a window was found, FALSE if the caller should fall
+        back to FatSelectBestWindow.
+
+--*/
+{
+    ULONG ChunksNeeded;
+    ULONG StartChunk;
+    ULONG Chunk;
+    ULONG Pass;
+    ULONG CurrentWindow;
+
+    if (Vcb->FreeChunkSummary.Buffer == NULL) {
+
+        return FALSE;
+    }
+
+    ChunksNeeded = (ClusterCount + FAT_SUMMARY_CHUNK_SIZE - 1) >> FAT_SUMMARY_CHUNK_SHIFT;
+
+    if (ChunksNeeded > (MAX_CLUSTER_BITMAP_SIZE >> FAT_SUMMARY_CHUNK_SHIFT)) {
+
+        ChunksNeeded = MAX_CLUSTER_BITMAP_SIZE >> FAT_SUMMARY_CHUNK_SHIFT;
+    }
+
+    if (AbsoluteClusterHint < 2) {
+
+        AbsoluteClusterHint = 2;
+    }
+
+    StartChunk = FatChunkOfCluster( AbsoluteClusterHint );
+
+    if (StartChunk >= Vcb->FreeChunkSummary.SizeOfBitMap) {
+
+        StartChunk = 0;
+    }
+
+    CurrentWindow = (ULONG)(Vcb->CurrentWindow - Vcb->Windows);
+
+    //
+    //  A run that begins in the current window is of no use to us, since we
+    //  only get here when the current window couldn't satisfy the request.
+    //  Try once more from the start of the following window before giving up.
+    //
+
+    for (Pass = 0; Pass < 2; Pass++) {
+
+        Chunk = RtlFindClearBits( &Vcb->FreeChunkSummary, ChunksNeeded, StartChunk );
+
+        if (Chunk == -1) {
+
+            return FALSE;
+        }
+
+        *Window = FatWindowOfCluster( (Chunk << FAT_SUMMARY_CHUNK_SHIFT) + 2 );
+
+        if (*Window != CurrentWindow) {
+
+            NT_ASSERT( Vcb->Windows[*Window].ClustersFree >= FAT_SUMMARY_CHUNK_SIZE );
+            return TRUE;
+        }
+
+        StartChunk = ((CurrentWindow + 1) * MAX_CLUSTER_BITMAP_SIZE) >> FAT_SUMMARY_CHUNK_SHIFT;
+
+        if (StartChunk >= Vcb->FreeChunkSummary.SizeOfBitMap) {
+
+            StartChunk = 0;
+        }
+    }
+
+    return FALSE;
+}
+
 
 INLINE
 ULONG
@@ -467,12 +754,34 @@ Arguments:
                              NULL,
                              0 );
 
+        RtlInitializeBitMap( &Vcb->FreeChunkSummary,
+                             NULL,
+                             0 );
+
         //
         //  Chose a FAT window to begin operation in.
         //
 
         if (Vcb->NumberOfWindows > 1) {
 
+            ULONG NumberOfChunks;
+
+            //
+            //  Build the free chunk summary for the whole volume.  It starts out
+            //  claiming nothing is free, and the scan below clears the chunks
+            //  which it finds completely free.
+            //
+
+            NumberOfChunks = Vcb->AllocationSupport.NumberOfClusters >> FAT_SUMMARY_CHUNK_SHIFT;
+
+            RtlInitializeBitMap( &Vcb->FreeChunkSummary,
+                                 FsRtlAllocatePoolWithTag( PagedPool,
+                                                           ((NumberOfChunks + 31) / 32) * sizeof(ULONG),
+                                                           TAG_FAT_SUMMARY ),
+                                 NumberOfChunks );
+
+            RtlSetAllBits( &Vcb->FreeChunkSummary );
+
             //
             //  Read the fat and count up free clusters.  We bias by the two reserved
             //  entries in the FAT.
@@ -597,6 +906,16 @@ Return Value:
         Vcb->FreeClusterBitMap.Buffer = NULL;
     }
 
+    //
+    //  And the volume-wide free chunk summary.
+    //
+
+    if ( Vcb->FreeChunkSummary.Buffer != NULL ) {
+
+        ExFreePool( Vcb->FreeChunkSummary.Buffer );
+        Vcb->FreeChunkSummary.Buffer = NULL;
+    }
+
     //
     //  And remove all the runs in the dirty fat Mcb
     //
@@ -2136,6 +2455,9 @@ Arguments:
 
         BOOLEAN LockedBitMap = FALSE;
         BOOLEAN SelectNextContigWindow = FALSE;
+        BOOLEAN SelectSummaryWindow = FALSE;
+        BOOLEAN SummaryWindowTried = FALSE;
+        ULONG SummaryWindow = 0;
 
         //
         //  Drop our shared lock on the ChangeBitMapResource,  and pick it up again
@@ -2290,7 +2612,26 @@ Arguments:
                             }
                         }
 
-                        if (0 == ClustersFound)  {
+                        if ((0 == ClustersFound) &&
+                            !SummaryWindowTried &&
+                            (ClustersRemaining > FAT_SUMMARY_CHUNK_SIZE) &&
+                            FatSelectWindowForRun( Vcb,
+                                                   ClustersRemaining,
+                                                   Vcb->CurrentWindow->FirstCluster,
+                                                   &SummaryWindow ))  {
+
+                            //
+                            //  This window can't hold the rest of the request in one run, but
+                            //  the free chunk summary knows of one that can.  Leave ClustersFound
+                            //  at zero so that we switch to it below, rather than fragmenting the
+                            //  allocation across whatever is left here.  Only do this once per
+                            //  request, so that we can't keep bouncing between windows.
+                            //
+
+                            SummaryWindowTried = TRUE;
+                            SelectSummaryWindow = TRUE;
+                        }
+                        else if (0 == ClustersFound)  {
                             
                             //
                             //  Still nothing,  so just take the largest free run we can find.
@@ -2306,7 +2647,7 @@ Arguments:
 
                             ClustersFound = ClustersRemaining;
                         }
-                        else {
+                        else if (!SelectSummaryWindow) {
 
                             //
                             //  If we just ran up to the end of a window,  set up a hint that
@@ -2381,13 +2722,34 @@ Arguments:
                         SelectNextContigWindow = FALSE;
                     }
 
+                    if (!SelectedWindow && SelectSummaryWindow)  {
+
+                        //
+                        //  We already know of a window with a free run big enough for
+                        //  the rest of the request.
+                        //
+
+                        FaveWindow = SummaryWindow;
+                        SelectedWindow = TRUE;
+                    }
+
+                    SelectSummaryWindow = FALSE;
+
                     if (!SelectedWindow)  {
 
                         //
-                        //  Select a new window to begin allocating from
+                        //  Select a new window to begin allocating from.  Prefer one which
+                        //  the free chunk summary says can take the rest of the request in
+                        //  one run, starting from where we are now.
                         //
+
+                        if (!FatSelectWindowForRun( Vcb,
+                                                    ClustersRemaining,
+                                                    Vcb->CurrentWindow->FirstCluster,
+                                                    &FaveWindow ))  {
                         
-                        FaveWindow = FatSelectBestWindow( Vcb);
+                            FaveWindow = FatSelectBestWindow( Vcb);
+                        }
                     }
 
                     //
@@ -2821,6 +3183,13 @@ Return Value:
                 }
             }
 
+            //
+            //  Any summary chunks this run covers completely are now free, whichever
+            //  window they happen to be in.
+            //
+
+            FatSummarizeFreeRun( Vcb, ClusterIndex, ClusterCount );
+
             //
             //  Deallocation is now complete.  Adjust the free cluster count.
             //
@@ -4542,6 +4911,8 @@ Return Value:
     PRTL_BITMAP BitMap = NULL;
     RTL_BITMAP PrivateBitMap;
 
+    BOOLEAN UpdateSummary = FALSE;
+
     ULONG ClusterSize = 0;
     ULONG PrefetchPages = 0;
     ULONG FatPages = 0;
@@ -4651,6 +5022,14 @@ Return Value:
 
         }
 
+        //
+        //  We are about to learn the exact state of this window, so forget
+        //  what the free chunk summary thought it knew and rebuild that part
+        //  of it from the free runs we find.
+        //
+
+        FatSummarizeAllocatedRun( Vcb, StartIndex, EndIndex - StartIndex + 1 );
+
     } else {
 
         BitMap = &PrivateBitMap;
@@ -4665,6 +5044,13 @@ Return Value:
         FreeClusterCount = NULL;
     }
 
+    //
+    //  Setup and window switches both describe the real state of the volume,
+    //  so the free runs they find feed the free chunk summary.
+    //
+
+    UpdateSummary = (BitMapBuffer == NULL);
+
     //
     //  Now, our start index better be in the file heap.
     //
@@ -4792,6 +5178,8 @@ Return Value:
                             *FreeClusterCount += ClustersThisRun;
                         }
 
+                        FatSummarizeFreeRun( Vcb, StartIndexOfThisRun, ClustersThisRun );
+
                     } else {
 
                         NT_ASSERT(CurrentRun == AllocatedClusters);
@@ -4850,9 +5238,9 @@ Return Value:
 
                 if (FatIndexBitSize == 32) {
 
-#pragma warning( suppress: 4213 )
-                    FatEntry = *((PULONG)FatBuffer)++;
+                    FatEntry = *((PULONG)FatBuffer);
                     FatEntry = FatEntry & FAT32_ENTRY_MASK;
+                    FatBuffer += 2;
 
                 } else {
 
@@ -4889,6 +5277,11 @@ Return Value:
                                   ClustersThisRun );
                 }
 
+                if (UpdateSummary) {
+
+                    FatSummarizeFreeRun( Vcb, StartIndexOfThisRun, ClustersThisRun );
+                }
+
                 CurrentRun = AllocatedClusters;
                 StartIndexOfThisRun = FatIndex;
             }
@@ -4958,6 +5351,11 @@ Return Value:
                               ClustersThisRun );
             }
 
+            if (UpdateSummary) {
+
+                FatSummarizeFreeRun( Vcb, StartIndexOfThisRun, ClustersThisRun );
+            }
+
         } else {
 
             if (BitMap) {
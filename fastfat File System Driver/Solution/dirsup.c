@@ -27,6 +27,42 @@ Abstract:
 
 #define Dbg                              (DEBUG_TRACE_DIRSUP)
 
+//
+//  Directories with less allocation than this are always searched linearly,
+//  since it isn't worth building a name index for them.
+//
+
+#define FAT_DIRENT_INDEX_MIN_DIRECTORY_SIZE     (0x10000)
+
+//
+//  The most pool all the directory name indexes in the system may use.
+//
+
+#define FAT_DIRENT_INDEX_MAX_TOTAL_SIZE         (0x1000000)
+
+//
+//  The most candidates we will check for one name before giving up on the
+//  index and searching the directory linearly.
+//
+
+#define FAT_DIRENT_INDEX_MAX_CANDIDATES         (16)
+
+//
+//  The largest possible dirent set, all LFN dirents plus the short dirent.
+//
+
+#define FAT_DIRENT_SET_SIZE                     ((MAX_LFN_DIRENTS + 1) * sizeof(DIRENT))
+
+#define FatAcquireDirentIndexMutex() {                  \
+    NT_ASSERT(KeAreApcsDisabled());                     \
+    ExAcquireFastMutexUnsafe( &FatDirentIndexMutex );   \
+}
+
+#define FatReleaseDirentIndexMutex() {                  \
+    NT_ASSERT(KeAreApcsDisabled());                     \
+    ExReleaseFastMutexUnsafe( &FatDirentIndexMutex );   \
+}
+
 //
 //  The following three macro all assume the input dirent has been zeroed.
 //
@@ -170,20 +206,110 @@ FatDefragDirectory (
     IN ULONG DirentsNeeded
     );
 
+_Requires_lock_held_(_Global_critical_region_)
+VOID
+FatLocateDirentInRange (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB ParentDirectory,
+    IN PCCB Ccb,
+    IN VBO OffsetToStartSearchFrom,
+    IN VBO OffsetToEndSearchAt,
+    OUT PDIRENT *Dirent,
+    OUT PBCB *Bcb,
+    OUT PVBO ByteOffset,
+    OUT PBOOLEAN FileNameDos OPTIONAL,
+    IN OUT PUNICODE_STRING LongFileName OPTIONAL
+    );
+
+ULONG
+FatHashShortName (
+    IN PUCHAR FileName
+    );
+
+ULONG
+FatHashLongName (
+    IN PUNICODE_STRING FileName
+    );
+
+_Requires_lock_held_(_Global_critical_region_)
+BOOLEAN
+FatLookupDirentIndex (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN PCCB Ccb,
+    IN BOOLEAN MatchLongName,
+    OUT PVBO Candidates,
+    OUT PULONG CandidateCount
+    );
+
+_Requires_lock_held_(_Global_critical_region_)
+VOID
+FatBuildDirentIndex (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb
+    );
+
+_Requires_lock_held_(_Global_critical_region_)
+VOID
+FatFoldDirentIndexPending (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb
+    );
+
+BOOLEAN
+FatAddDirentIndexEntry (
+    IN PFAT_DIRENT_INDEX Index,
+    IN ULONG Hash,
+    IN VBO DirentOffset
+    );
+
+BOOLEAN
+FatAddDirentIndexCandidate (
+    IN OUT PVBO Candidates,
+    IN OUT PULONG CandidateCount,
+    IN VBO Offset
+    );
+
+VOID
+FatRemoveDirentIndexEntries (
+    IN PDCB Dcb,
+    IN VBO LfnOffset,
+    IN VBO DirentOffset,
+    IN PUCHAR ShortName,
+    IN PUNICODE_STRING LongName OPTIONAL
+    );
+
+VOID
+FatFreeDirentIndex (
+    IN PDCB Dcb
+    );
+
 #ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, FatAddDirentIndexCandidate)
+#pragma alloc_text(PAGE, FatAddDirentIndexEntry)
+#pragma alloc_text(PAGE, FatBuildDirentIndex)
 #pragma alloc_text(PAGE, FatComputeLfnChecksum)
 #pragma alloc_text(PAGE, FatConstructDirent)
 #pragma alloc_text(PAGE, FatConstructLabelDirent)
 #pragma alloc_text(PAGE, FatCreateNewDirent)
 #pragma alloc_text(PAGE, FatDefragDirectory)
 #pragma alloc_text(PAGE, FatDeleteDirent)
+#pragma alloc_text(PAGE, FatDiscardDirentIndex)
+#pragma alloc_text(PAGE, FatFoldDirentIndexPending)
+#pragma alloc_text(PAGE, FatFreeDirentIndex)
 #pragma alloc_text(PAGE, FatGetDirentFromFcbOrDcb)
+#pragma alloc_text(PAGE, FatHashLongName)
+#pragma alloc_text(PAGE, FatHashShortName)
 #pragma alloc_text(PAGE, FatInitializeDirectoryDirent)
 #pragma alloc_text(PAGE, FatIsDirectoryEmpty)
 #pragma alloc_text(PAGE, FatLfnDirentExists)
 #pragma alloc_text(PAGE, FatLocateDirent)
+#pragma alloc_text(PAGE, FatLocateDirentInRange)
 #pragma alloc_text(PAGE, FatLocateSimpleOemDirent)
 #pragma alloc_text(PAGE, FatLocateVolumeLabel)
+#pragma alloc_text(PAGE, FatLookupDirentIndex)
+#pragma alloc_text(PAGE, FatNoteDirentIndexChange)
+#pragma alloc_text(PAGE, FatRemoveDirentIndexEntries)
 #pragma alloc_text(PAGE, FatRescanDirectory)
 #pragma alloc_text(PAGE, FatSetFileSizeInDirent)
 #pragma alloc_text(PAGE, FatSetFileSizeInDirentNoRaise)
@@ -536,6 +662,13 @@ Return Value:
     ParentDirectory->Specific.Dcb.UnusedDirentVbo = UnusedVbo;
     ParentDirectory->Specific.Dcb.DeletedDirentHint = DeletedHint;
 
+    //
+    //  The caller is about to write a name here, so the name index must
+    //  consider these dirents until it can read them back.
+    //
+
+    FatNoteDirentIndexChange( ParentDirectory, ByteOffset );
+
     DebugTrace(-1, Dbg, "FatCreateNewDirent -> (VOID)\n", 0);
 
     return ByteOffset;
@@ -817,6 +950,7 @@ Return Value:
     NTSTATUS DontCare;
     ULONG Offset;
     ULONG DirentsToDelete;
+    UCHAR ShortName[11];
 
     PAGED_CODE();
 
@@ -900,6 +1034,17 @@ Return Value:
             }
 
             NT_ASSERT( (Dirent->FirstClusterOfFile == 0) || !DeleteEa );
+
+            //
+            //  Remember the short name before we wipe it out, so we can take
+            //  it back out of the name index.
+            //
+
+            if (Offset == FcbOrDcb->DirentOffsetWithinDirectory) {
+
+                RtlCopyMemory( ShortName, Dirent->FileName, sizeof(ShortName) );
+            }
+
             Dirent->FileName[0] = FAT_DIRENT_DELETED;
         }
 
@@ -950,6 +1095,12 @@ Return Value:
                       FcbOrDcb->LfnOffsetWithinDirectory / sizeof(DIRENT),
                       DirentsToDelete );
 
+        FatRemoveDirentIndexEntries( FcbOrDcb->ParentDcb,
+                                     FcbOrDcb->LfnOffsetWithinDirectory,
+                                     FcbOrDcb->DirentOffsetWithinDirectory,
+                                     ShortName,
+                                     &FcbOrDcb->ExactCaseLongName );
+
         //
         //  Now, if the caller specified a DeleteContext, use it.
         //
@@ -1113,6 +1264,119 @@ Return Value:
 
 --*/
 
+{
+    VBO Candidates[FAT_DIRENT_INDEX_MAX_CANDIDATES];
+    ULONG CandidateCount;
+    ULONG i;
+
+    PAGED_CODE();
+
+    //
+    //  A search for one constant name from the start of a large directory
+    //  can be answered from the directory's name index.  The index only
+    //  narrows down where to look; each candidate is checked on the disk by
+    //  searching just its own dirent set, lowest offset first, so we find
+    //  the same dirent a linear search would.
+    //
+
+    if ((OffsetToStartSearchFrom == 0) &&
+        !Ccb->ContainsWildCards &&
+        !FlagOn( Ccb->Flags, CCB_FLAG_MATCH_ALL | CCB_FLAG_MATCH_VOLUME_ID ) &&
+        FatLookupDirentIndex( IrpContext,
+                              ParentDirectory,
+                              Ccb,
+                              (BOOLEAN)(FatData.ChicagoMode && ARGUMENT_PRESENT( LongFileName )),
+                              Candidates,
+                              &CandidateCount )) {
+
+        FatUnpinBcb( IrpContext, *Bcb );
+
+        *Dirent = NULL;
+        *ByteOffset = 0;
+
+        if (ARGUMENT_PRESENT( LongFileName )) {
+
+            LongFileName->Length = 0;
+        }
+
+        if (FileNameDos) {
+
+            *FileNameDos = FALSE;
+        }
+
+        for (i = 0; (i < CandidateCount) && (*Dirent == NULL); i++) {
+
+            FatLocateDirentInRange( IrpContext,
+                                    ParentDirectory,
+                                    Ccb,
+                                    Candidates[i],
+                                    Candidates[i] + FAT_DIRENT_SET_SIZE,
+                                    Dirent,
+                                    Bcb,
+                                    ByteOffset,
+                                    FileNameDos,
+                                    LongFileName );
+        }
+
+        return;
+    }
+
+    FatLocateDirentInRange( IrpContext,
+                            ParentDirectory,
+                            Ccb,
+                            OffsetToStartSearchFrom,
+                            FAT_DIRENT_INDEX_NIL,
+                            Dirent,
+                            Bcb,
+                            ByteOffset,
+                            FileNameDos,
+                            LongFileName );
+
+    return;
+}
+
+
+//
+//  Internal support routine
+//
+
+_Requires_lock_held_(_Global_critical_region_)
+VOID
+FatLocateDirentInRange (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB ParentDirectory,
+    IN PCCB Ccb,
+    IN VBO OffsetToStartSearchFrom,
+    IN VBO OffsetToEndSearchAt,
+    OUT PDIRENT *Dirent,
+    OUT PBCB *Bcb,
+    OUT PVBO ByteOffset,
+    OUT PBOOLEAN FileNameDos OPTIONAL,
+    IN OUT PUNICODE_STRING LongFileName OPTIONAL
+    )
+
+/*++
+
+Routine Description:
+
+    This routine locates on the disk an undeleted dirent matching a given
+    name, looking no further than the given offset.  It does the real work
+    for FatLocateDirent.
+
+Arguments:
+
+    OffsetToEndSearchAt - Supplies the VBO within the parent directory at
+        which to give up, as if the end of the directory had been reached.
+        FAT_DIRENT_INDEX_NIL searches to the end of the directory.
+
+    For the remaining arguments, see FatLocateDirent.
+
+Return Value:
+
+    None.
+
+--*/
+
 {
     NTSTATUS Status = STATUS_SUCCESS;
 
@@ -1134,10 +1398,11 @@ Return Value:
 
     PAGED_CODE();
 
-    DebugTrace(+1, Dbg, "FatLocateDirent\n", 0);
+    DebugTrace(+1, Dbg, "FatLocateDirentInRange\n", 0);
 
     DebugTrace( 0, Dbg, "  ParentDirectory         = %08lx\n", ParentDirectory);
     DebugTrace( 0, Dbg, "  OffsetToStartSearchFrom = %08lx\n", OffsetToStartSearchFrom);
+    DebugTrace( 0, Dbg, "  OffsetToEndSearchAt     = %08lx\n", OffsetToEndSearchAt);
     DebugTrace( 0, Dbg, "  Dirent                  = %08lx\n", Dirent);
     DebugTrace( 0, Dbg, "  Bcb                     = %08lx\n", Bcb);
     DebugTrace( 0, Dbg, "  ByteOffset              = %08lx\n", ByteOffset);
@@ -1233,6 +1498,22 @@ Return Value:
 
             BOOLEAN FoundValidLfn;
 
+            //
+            //  If we have run off the end of the range we were asked to
+            //  search, treat it just like the end of the directory.
+            //
+
+            if (*ByteOffset >= OffsetToEndSearchAt) {
+
+                DebugTrace( 0, Dbg, "End of range: entry not found.\n", 0);
+
+                FatUnpinBcb( IrpContext, *Bcb );
+
+                *Dirent = NULL;
+                *ByteOffset = 0;
+                break;
+            }
+
             //
             //  Try to read in the dirent
             //
@@ -1650,9 +1931,9 @@ GetNextDirent:
         FatFreeStringBuffer( &UpcasedLfn);
     }
 
-    DebugTrace(-1, Dbg, "FatLocateDirent -> (VOID)\n", 0);
+    DebugTrace(-1, Dbg, "FatLocateDirentInRange -> (VOID)\n", 0);
 
-    TimerStop(Dbg,"FatLocateDirent");
+    TimerStop(Dbg,"FatLocateDirentInRange");
 
     return;
 }
@@ -3051,6 +3332,13 @@ Return Value:
 
     DebugTrace( 0, Dbg, "We must scan the whole directory.\n", 0);
 
+    //
+    //  We are rebuilding our picture of this directory from the disk, so
+    //  start the name index over too.
+    //
+
+    FatDiscardDirentIndex( Dcb );
+
     UnusedVbo = 0;
     DeletedHint = 0xffffffff;
 
@@ -3300,6 +3588,12 @@ Return Value:
         return (ULONG)-1;
     }
 
+    //
+    //  Dirents are about to move around, so the name index is useless.
+    //
+
+    FatDiscardDirentIndex( Dcb );
+
     //
     //  Force wait to TRUE
     //
@@ -3476,7 +3770,7 @@ Return Value:
                                           Page * PAGE_SIZE,
                                           PinSize,
                                           &Bcbs[Page],
-                                          &Dirent,
+                                          (PVOID *)&Dirent,
                                           FALSE,
                                           TRUE,
                                           &DontCare );
@@ -3705,6 +3999,1040 @@ Return Value:
 
     return ReturnValue;
 }
+
+VOID
+FatNoteDirentIndexChange (
+    IN PDCB Dcb,
+    IN VBO DirentOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tells the name index for a directory that a set of dirents
+    is about to have a name written into it.  Until the index can read the
+    name back, the dirent set is a candidate for every lookup.
+
+Arguments:
+
+    Dcb - Supplies the directory being changed.
+
+    DirentOffset - Supplies the offset of the first dirent of the set.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PFAT_DIRENT_INDEX Index;
+    ULONG i;
+
+    PAGED_CODE();
+
+    FatAcquireDirentIndexMutex();
+
+    Dcb->Specific.Dcb.DirentIndexChangeCount += 1;
+
+    Index = Dcb->Specific.Dcb.DirentIndex;
+
+    if (Index != NULL) {
+
+        for (i = 0; i < Index->PendingCount; i++) {
+
+            if (Index->PendingOffsets[i] == DirentOffset) {
+
+                break;
+            }
+        }
+
+        if (i == Index->PendingCount) {
+
+            //
+            //  If there is no room to remember this one, just throw the
+            //  index away.  It will be rebuilt by a later lookup.
+            //
+
+            if (Index->PendingCount == FAT_DIRENT_INDEX_MAX_PENDING) {
+
+                FatFreeDirentIndex( Dcb );
+
+            } else {
+
+                Index->PendingOffsets[Index->PendingCount] = DirentOffset;
+                Index->PendingCount += 1;
+            }
+        }
+    }
+
+    FatReleaseDirentIndexMutex();
+}
+
+
+VOID
+FatDiscardDirentIndex (
+    IN PDCB Dcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine throws away the name index for a directory, if it has one.
+    This is used when the directory goes away, or when its dirents are
+    rearranged in a way the index cannot follow.
+
+Arguments:
+
+    Dcb - Supplies the directory.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PAGED_CODE();
+
+    FatAcquireDirentIndexMutex();
+
+    Dcb->Specific.Dcb.DirentIndexChangeCount += 1;
+
+    if (Dcb->Specific.Dcb.DirentIndex != NULL) {
+
+        FatFreeDirentIndex( Dcb );
+    }
+
+    FatReleaseDirentIndexMutex();
+}
+
+
+//
+//  Internal support routine
+//
+
+ULONG
+FatHashShortName (
+    IN PUCHAR FileName
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hashes the 11 bytes of a short name exactly as they appear
+    in a dirent, since that is how FatLocateDirent compares them.
+
+Arguments:
 
+    FileName - Supplies the 8.3 name.
 
+Return Value:
+
+    ULONG - The hash.
+
+--*/
+
+{
+    ULONG Hash = 0x811c9dc5;
+    ULONG i;
+
+    PAGED_CODE();
+
+    for (i = 0; i < 11; i++) {
+
+        Hash = (Hash ^ FileName[i]) * 0x01000193;
+    }
+
+    return Hash;
+}
+
+
+//
+//  Internal support routine
+//
+
+ULONG
+FatHashLongName (
+    IN PUNICODE_STRING FileName
+    )
+
+/*++
+
+Routine Description:
+
+    This routine hashes a long name without regard to case.
+
+Arguments:
+
+    FileName - Supplies the long name.
+
+Return Value:
+
+    ULONG - The hash.
+
+--*/
+
+{
+    ULONG Hash = 0x4c464e00;
+    ULONG i;
+    WCHAR Char;
+
+    PAGED_CODE();
+
+    for (i = 0; i < FileName->Length / sizeof(WCHAR); i++) {
+
+        Char = RtlUpcaseUnicodeChar( FileName->Buffer[i] );
+
+        Hash = (Hash ^ (Char & 0xff)) * 0x01000193;
+        Hash = (Hash ^ (Char >> 8)) * 0x01000193;
+    }
+
+    return Hash;
+}
+
+
+//
+//  Internal support routine
+//
+
+_Requires_lock_held_(_Global_critical_region_)
+BOOLEAN
+FatLookupDirentIndex (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb,
+    IN PCCB Ccb,
+    IN BOOLEAN MatchLongName,
+    OUT PVBO Candidates,
+    OUT PULONG CandidateCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine uses the name index of a directory to find the places a
+    constant name could be, building the index first if the directory is
+    large enough to be worth it.
+
+    A candidate is the offset from which to search at most
+    FAT_DIRENT_SET_SIZE bytes for the name.  Every dirent which might match
+    lies within one of the candidate ranges.
+
+Arguments:
+
+    Dcb - Supplies the directory to search.
+
+    Ccb - Supplies the constant name being looked for.
+
+    MatchLongName - Supplies TRUE if the caller will match long names as
+        well as short ones.
+
+    Candidates - Receives the candidate offsets in ascending order.  This
+        must have room for FAT_DIRENT_INDEX_MAX_CANDIDATES entries.
+
+    CandidateCount - Receives the number of candidates.
+
+Return Value:
+
+    BOOLEAN - TRUE if the candidates were found, FALSE if the caller must
+        search the whole directory.
+
+--*/
+
+{
+    PFAT_DIRENT_INDEX Index;
+    BOOLEAN Build = FALSE;
+    BOOLEAN Fold = FALSE;
+    BOOLEAN Result = FALSE;
+
+    ULONG Hashes[2];
+    ULONG HashCount = 0;
+    ULONG Entry;
+    ULONG i;
+    VBO Offset;
+
+    PAGED_CODE();
+
+    *CandidateCount = 0;
+
+    if (!FlagOn( Ccb->Flags, CCB_FLAG_SKIP_SHORT_NAME_COMPARE )) {
+
+        Hashes[HashCount] = FatHashShortName( &Ccb->OemQueryTemplate.Constant[0] );
+        HashCount += 1;
+    }
+
+    if (MatchLongName && (Ccb->UnicodeQueryTemplate.Length != 0)) {
+
+        Hashes[HashCount] = FatHashLongName( &Ccb->UnicodeQueryTemplate );
+        HashCount += 1;
+    }
+
+    if (HashCount == 0) {
+
+        return FALSE;
+    }
+
+    //
+    //  Reading dirents to build or update the index is only done by callers
+    //  who own the volume exclusive, so that nothing can be changing the
+    //  directory underneath us.
+    //
+
+    if (FatVcbAcquiredExclusive( IrpContext, Dcb->Vcb )) {
+
+        FatAcquireDirentIndexMutex();
+
+        Index = Dcb->Specific.Dcb.DirentIndex;
+
+        if (Index == NULL) {
+
+            Build = (Dcb->Header.AllocationSize.QuadPart != FCB_LOOKUP_ALLOCATIONSIZE_HINT) &&
+                    (Dcb->Header.AllocationSize.QuadPart >= FAT_DIRENT_INDEX_MIN_DIRECTORY_SIZE);
+
+        } else {
+
+            Fold = (Index->PendingCount != 0);
+        }
+
+        FatReleaseDirentIndexMutex();
+
+        if (Build) {
+
+            FatBuildDirentIndex( IrpContext, Dcb );
+
+        } else if (Fold) {
+
+            FatFoldDirentIndexPending( IrpContext, Dcb );
+        }
+    }
+
+    FatAcquireDirentIndexMutex();
+
+    Index = Dcb->Specific.Dcb.DirentIndex;
+
+    if (Index != NULL) {
+
+        Result = TRUE;
+
+        for (i = 0; Result && (i < Index->PendingCount); i++) {
+
+            Result = FatAddDirentIndexCandidate( Candidates,
+                                                 CandidateCount,
+                                                 Index->PendingOffsets[i] );
+        }
+
+        for (i = 0; Result && (i < HashCount); i++) {
+
+            for (Entry = Index->Buckets[Hashes[i] & Index->BucketMask];
+                 Result && (Entry != FAT_DIRENT_INDEX_NIL);
+                 Entry = Index->Entries[Entry].Next) {
+
+                if (Index->Entries[Entry].Hash != Hashes[i]) {
+
+                    continue;
+                }
+
+                //
+                //  Back up far enough to take in the longest possible LFN.
+                //
+
+                Offset = Index->Entries[Entry].DirentOffset;
+
+                if (Offset > MAX_LFN_DIRENTS * sizeof(DIRENT)) {
+
+                    Offset -= MAX_LFN_DIRENTS * sizeof(DIRENT);
+
+                } else {
+
+                    Offset = 0;
+                }
+
+                Result = FatAddDirentIndexCandidate( Candidates,
+                                                     CandidateCount,
+                                                     Offset );
+            }
+        }
+
+        if (Result) {
+
+            RemoveEntryList( &Index->LruLinks );
+            InsertTailList( &FatData.DirentIndexLruList, &Index->LruLinks );
+        }
+    }
+
+    FatReleaseDirentIndexMutex();
+
+    return Result;
+}
+
+
+//
+//  Internal support routine
+//
+
+BOOLEAN
+FatAddDirentIndexCandidate (
+    IN OUT PVBO Candidates,
+    IN OUT PULONG CandidateCount,
+    IN VBO Offset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine inserts an offset into a sorted list of candidates, unless
+    it is already there.
+
+Arguments:
+
+    Candidates - Supplies the list of candidates.
+
+    CandidateCount - Supplies the number of candidates in the list.
+
+    Offset - Supplies the offset to insert.
+
+Return Value:
+
+    BOOLEAN - FALSE if the list is full.
+
+--*/
+
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    for (i = *CandidateCount; (i > 0) && (Candidates[i - 1] >= Offset); i--) {
+
+        if (Candidates[i - 1] == Offset) {
+
+            return TRUE;
+        }
+    }
+
+    if (*CandidateCount == FAT_DIRENT_INDEX_MAX_CANDIDATES) {
+
+        return FALSE;
+    }
+
+    RtlMoveMemory( &Candidates[i + 1],
+                   &Candidates[i],
+                   (*CandidateCount - i) * sizeof(VBO) );
+
+    Candidates[i] = Offset;
+    *CandidateCount += 1;
+
+    return TRUE;
+}
+
+
+//
+//  Internal support routine
+//
+
+_Requires_lock_held_(_Global_critical_region_)
+VOID
+FatBuildDirentIndex (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads every dirent in a directory and builds its name
+    index.  If we run short of pool, or the directory changes while we are
+    reading it, we quietly do without the index.
+
+Arguments:
+
+    Dcb - Supplies the directory to index.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    CCB Ccb;
+    PBCB Bcb = NULL;
+    PDIRENT Dirent;
+    VBO ByteOffset;
+    UNICODE_STRING Lfn = {0,0,NULL};
+
+    PFAT_DIRENT_INDEX_ENTRY Scratch = NULL;
+    PFAT_DIRENT_INDEX_ENTRY NewScratch;
+    ULONG ScratchCount = 0;
+    ULONG ScratchSize = 256;
+
+    PFAT_DIRENT_INDEX Index = NULL;
+    ULONG ChangeCount;
+    ULONG MaximumEntries;
+    ULONG BucketCount;
+    ULONG IndexSize;
+    ULONG i;
+
+    PAGED_CODE();
+
+    DebugTrace(+1, Dbg, "FatBuildDirentIndex, Dcb = %p\n", Dcb);
+
+    FatAcquireDirentIndexMutex();
+    ChangeCount = Dcb->Specific.Dcb.DirentIndexChangeCount;
+    FatReleaseDirentIndexMutex();
+
+    try {
+
+        RtlZeroMemory( &Ccb, sizeof(CCB) );
+        Ccb.Flags = CCB_FLAG_MATCH_ALL;
+
+        Lfn.MaximumLength = 260 * sizeof(WCHAR);
+        Lfn.Buffer = FsRtlAllocatePoolWithTag( PagedPool,
+                                               260*sizeof(WCHAR),
+                                               TAG_FILENAME_BUFFER );
+
+        Scratch = ExAllocatePoolWithTag( PagedPool,
+                                         ScratchSize * sizeof(FAT_DIRENT_INDEX_ENTRY),
+                                         TAG_DIRENT_INDEX );
+
+        if (Scratch == NULL) {
+
+            try_return( NOTHING );
+        }
+
+        //
+        //  Collect the hash of every name in the directory.
+        //
+
+        FatLocateDirentInRange( IrpContext,
+                                Dcb,
+                                &Ccb,
+                                0,
+                                FAT_DIRENT_INDEX_NIL,
+                                &Dirent,
+                                &Bcb,
+                                &ByteOffset,
+                                NULL,
+                                (FatData.ChicagoMode ? &Lfn : NULL) );
+
+        while (Dirent != NULL) {
+
+            if (ScratchCount + 2 > ScratchSize) {
+
+                NewScratch = ExAllocatePoolWithTag( PagedPool,
+                                                    ScratchSize * 2 * sizeof(FAT_DIRENT_INDEX_ENTRY),
+                                                    TAG_DIRENT_INDEX );
+
+                if (NewScratch == NULL) {
+
+                    try_return( NOTHING );
+                }
+
+                RtlCopyMemory( NewScratch,
+                               Scratch,
+                               ScratchCount * sizeof(FAT_DIRENT_INDEX_ENTRY) );
+
+                ExFreePool( Scratch );
+                Scratch = NewScratch;
+                ScratchSize *= 2;
+            }
+
+            Scratch[ScratchCount].Hash = FatHashShortName( &Dirent->FileName[0] );
+            Scratch[ScratchCount].DirentOffset = ByteOffset;
+            ScratchCount += 1;
+
+            if (Lfn.Length != 0) {
+
+                Scratch[ScratchCount].Hash = FatHashLongName( &Lfn );
+                Scratch[ScratchCount].DirentOffset = ByteOffset;
+                ScratchCount += 1;
+            }
+
+            FatLocateDirentInRange( IrpContext,
+                                    Dcb,
+                                    &Ccb,
+                                    ByteOffset + sizeof(DIRENT),
+                                    FAT_DIRENT_INDEX_NIL,
+                                    &Dirent,
+                                    &Bcb,
+                                    &ByteOffset,
+                                    NULL,
+                                    (FatData.ChicagoMode ? &Lfn : NULL) );
+        }
+
+        FatUnpinBcb( IrpContext, Bcb );
+
+        //
+        //  Size the index with some room to absorb new names, and a power of
+        //  two number of buckets so we can mask rather than divide.
+        //
+
+        MaximumEntries = ScratchCount + ScratchCount / 4 + 2 * FAT_DIRENT_INDEX_MAX_PENDING;
+
+        for (BucketCount = 64; BucketCount < MaximumEntries; BucketCount <<= 1) {
+
+            NOTHING;
+        }
+
+        IndexSize = sizeof(FAT_DIRENT_INDEX) +
+                    MaximumEntries * sizeof(FAT_DIRENT_INDEX_ENTRY) +
+                    BucketCount * sizeof(ULONG);
+
+        if (IndexSize > FAT_DIRENT_INDEX_MAX_TOTAL_SIZE / 4) {
+
+            try_return( NOTHING );
+        }
+
+        Index = ExAllocatePoolWithTag( PagedPool,
+                                       IndexSize,
+                                       TAG_DIRENT_INDEX );
+
+        if (Index == NULL) {
+
+            try_return( NOTHING );
+        }
+
+        RtlZeroMemory( Index, sizeof(FAT_DIRENT_INDEX) );
+
+        Index->Dcb = Dcb;
+        Index->IndexSize = IndexSize;
+        Index->MaximumEntries = MaximumEntries;
+        Index->Entries = (PFAT_DIRENT_INDEX_ENTRY)(Index + 1);
+        Index->Buckets = (PULONG)(Index->Entries + MaximumEntries);
+        Index->BucketMask = BucketCount - 1;
+
+        RtlFillMemory( Index->Buckets, BucketCount * sizeof(ULONG), 0xff );
+
+        for (i = 0; i < ScratchCount; i++) {
+
+            (VOID)FatAddDirentIndexEntry( Index,
+                                          Scratch[i].Hash,
+                                          Scratch[i].DirentOffset );
+        }
+
+        //
+        //  Install the index, unless someone beat us to it or the directory
+        //  changed while we were reading it, and trim the oldest indexes in
+        //  the system if we are now over budget.
+        //
+
+        FatAcquireDirentIndexMutex();
+
+        if ((Dcb->Specific.Dcb.DirentIndex == NULL) &&
+            (Dcb->Specific.Dcb.DirentIndexChangeCount == ChangeCount)) {
+
+            Dcb->Specific.Dcb.DirentIndex = Index;
+            InsertTailList( &FatData.DirentIndexLruList, &Index->LruLinks );
+            FatData.DirentIndexBytes += IndexSize;
+
+            Index = NULL;
+
+            while (FatData.DirentIndexBytes > FAT_DIRENT_INDEX_MAX_TOTAL_SIZE) {
+
+                PFAT_DIRENT_INDEX Victim;
+
+                Victim = CONTAINING_RECORD( FatData.DirentIndexLruList.Flink,
+                                            FAT_DIRENT_INDEX,
+                                            LruLinks );
+
+                FatFreeDirentIndex( Victim->Dcb );
+            }
+        }
+
+        FatReleaseDirentIndexMutex();
+
+    try_exit: NOTHING;
+    } finally {
+
+        DebugUnwind( FatBuildDirentIndex );
+
+        FatUnpinBcb( IrpContext, Bcb );
+
+        if (Lfn.Buffer != NULL) {
+
+            ExFreePool( Lfn.Buffer );
+        }
+
+        if (Scratch != NULL) {
+
+            ExFreePool( Scratch );
+        }
+
+        if (Index != NULL) {
+
+            ExFreePool( Index );
+        }
+
+        DebugTrace(-1, Dbg, "FatBuildDirentIndex -> (VOID)\n", 0);
+    }
+}
+
+
+//
+//  Internal support routine
+//
+
+_Requires_lock_held_(_Global_critical_region_)
+VOID
+FatFoldDirentIndexPending (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads back the names written into dirent sets on the
+    pending list of a directory's name index and adds them to the index.
+
+    A pending set is only folded in once the dirents at its offset describe
+    a complete set, so one which has been allocated but not yet written
+    stays pending.
+
+Arguments:
+
+    Dcb - Supplies the directory.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    CCB Ccb;
+    PBCB Bcb = NULL;
+    PDIRENT Dirent;
+    VBO ByteOffset;
+    VBO SetOffset;
+    UNICODE_STRING Lfn = {0,0,NULL};
+
+    PFAT_DIRENT_INDEX Index;
+    VBO Pending[FAT_DIRENT_INDEX_MAX_PENDING];
+    ULONG PendingCount;
+    ULONG ShortHash;
+    ULONG LongHash = 0;
+    ULONG i, j;
+
+    PAGED_CODE();
+
+    FatAcquireDirentIndexMutex();
+
+    Index = Dcb->Specific.Dcb.DirentIndex;
+    PendingCount = 0;
+
+    if (Index != NULL) {
+
+        PendingCount = Index->PendingCount;
+        RtlCopyMemory( Pending, Index->PendingOffsets, PendingCount * sizeof(VBO) );
+    }
+
+    FatReleaseDirentIndexMutex();
+
+    if (PendingCount == 0) {
+
+        return;
+    }
+
+    try {
+
+        RtlZeroMemory( &Ccb, sizeof(CCB) );
+        Ccb.Flags = CCB_FLAG_MATCH_ALL;
+
+        Lfn.MaximumLength = 260 * sizeof(WCHAR);
+        Lfn.Buffer = FsRtlAllocatePoolWithTag( PagedPool,
+                                               260*sizeof(WCHAR),
+                                               TAG_FILENAME_BUFFER );
+
+        for (i = 0; i < PendingCount; i++) {
+
+            //
+            //  The pending offsets are in no particular order, so start each
+            //  search afresh.
+            //
+
+            FatUnpinBcb( IrpContext, Bcb );
+
+            FatLocateDirentInRange( IrpContext,
+                                    Dcb,
+                                    &Ccb,
+                                    Pending[i],
+                                    Pending[i] + FAT_DIRENT_SET_SIZE,
+                                    &Dirent,
+                                    &Bcb,
+                                    &ByteOffset,
+                                    NULL,
+                                    (FatData.ChicagoMode ? &Lfn : NULL) );
+
+            if (Dirent == NULL) {
+
+                continue;
+            }
+
+            SetOffset = ByteOffset;
+
+            if (Lfn.Length != 0) {
+
+                SetOffset -= FAT_LFN_DIRENTS_NEEDED( &Lfn ) * sizeof(DIRENT);
+            }
+
+            if (SetOffset != Pending[i]) {
+
+                continue;
+            }
+
+            ShortHash = FatHashShortName( &Dirent->FileName[0] );
+
+            if (Lfn.Length != 0) {
+
+                LongHash = FatHashLongName( &Lfn );
+            }
+
+            FatAcquireDirentIndexMutex();
+
+            Index = Dcb->Specific.Dcb.DirentIndex;
+
+            if (Index != NULL) {
+
+                if (!FatAddDirentIndexEntry( Index, ShortHash, ByteOffset ) ||
+                    ((Lfn.Length != 0) &&
+                     !FatAddDirentIndexEntry( Index, LongHash, ByteOffset ))) {
+
+                    FatFreeDirentIndex( Dcb );
+
+                } else {
+
+                    for (j = 0; j < Index->PendingCount; j++) {
+
+                        if (Index->PendingOffsets[j] == Pending[i]) {
+
+                            Index->PendingCount -= 1;
+                            Index->PendingOffsets[j] = Index->PendingOffsets[Index->PendingCount];
+                            break;
+                        }
+                    }
+                }
+            }
+
+            FatReleaseDirentIndexMutex();
+        }
+
+    } finally {
+
+        DebugUnwind( FatFoldDirentIndexPending );
+
+        FatUnpinBcb( IrpContext, Bcb );
+
+        if (Lfn.Buffer != NULL) {
+
+            ExFreePool( Lfn.Buffer );
+        }
+    }
+}
+
+
+//
+//  Internal support routine
+//
+
+BOOLEAN
+FatAddDirentIndexEntry (
+    IN PFAT_DIRENT_INDEX Index,
+    IN ULONG Hash,
+    IN VBO DirentOffset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds a name to a directory's name index.  The index must
+    not yet be installed, or the caller must hold the FatDirentIndexMutex.
+
+Arguments:
+
+    Index - Supplies the index.
+
+    Hash - Supplies the hash of the name.
+
+    DirentOffset - Supplies the offset of the short dirent of the set.
+
+Return Value:
+
+    BOOLEAN - FALSE if the index is full.
+
+--*/
+
+{
+    ULONG Entry;
+    PULONG Bucket;
+
+    PAGED_CODE();
+
+    if (Index->EntryCount == Index->MaximumEntries) {
+
+        return FALSE;
+    }
+
+    Entry = Index->EntryCount;
+    Index->EntryCount += 1;
+
+    Bucket = &Index->Buckets[Hash & Index->BucketMask];
+
+    Index->Entries[Entry].Hash = Hash;
+    Index->Entries[Entry].DirentOffset = DirentOffset;
+    Index->Entries[Entry].Next = *Bucket;
+
+    *Bucket = Entry;
+
+    return TRUE;
+}
+
+
+//
+//  Internal support routine
+//
+
+VOID
+FatRemoveDirentIndexEntries (
+    IN PDCB Dcb,
+    IN VBO LfnOffset,
+    IN VBO DirentOffset,
+    IN PUCHAR ShortName,
+    IN PUNICODE_STRING LongName OPTIONAL
+    )
+
+/*++
+
+Routine Description:
+
+    This routine takes the names of a deleted dirent set out of a
+    directory's name index.  Leaving them in would be harmless, but would
+    make every later lookup of those names check the disk for nothing.
+
+Arguments:
+
+    Dcb - Supplies the directory.
+
+    LfnOffset - Supplies the offset of the first dirent of the set.
+
+    DirentOffset - Supplies the offset of the short dirent of the set.
+
+    ShortName - Supplies the short name the dirent carried.
+
+    LongName - Supplies the long name the dirent carried, if any.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PFAT_DIRENT_INDEX Index;
+    ULONG Hashes[2];
+    ULONG HashCount = 0;
+    PULONG Link;
+    ULONG Entry;
+    ULONG i;
+
+    PAGED_CODE();
+
+    Hashes[HashCount] = FatHashShortName( ShortName );
+    HashCount += 1;
+
+    if (ARGUMENT_PRESENT( LongName ) && (LongName->Length != 0)) {
+
+        Hashes[HashCount] = FatHashLongName( LongName );
+        HashCount += 1;
+    }
+
+    FatAcquireDirentIndexMutex();
+
+    Index = Dcb->Specific.Dcb.DirentIndex;
+
+    if (Index != NULL) {
+
+        for (i = 0; i < HashCount; i++) {
+
+            Link = &Index->Buckets[Hashes[i] & Index->BucketMask];
+
+            while (*Link != FAT_DIRENT_INDEX_NIL) {
+
+                Entry = *Link;
+
+                if ((Index->Entries[Entry].Hash == Hashes[i]) &&
+                    (Index->Entries[Entry].DirentOffset == DirentOffset)) {
+
+                    *Link = Index->Entries[Entry].Next;
+
+                } else {
+
+                    Link = &Index->Entries[Entry].Next;
+                }
+            }
+        }
+
+        for (i = 0; i < Index->PendingCount; i++) {
+
+            if (Index->PendingOffsets[i] == LfnOffset) {
+
+                Index->PendingCount -= 1;
+                Index->PendingOffsets[i] = Index->PendingOffsets[Index->PendingCount];
+                break;
+            }
+        }
+    }
+
+    FatReleaseDirentIndexMutex();
+}
+
+
+//
+//  Internal support routine
+//
+
+VOID
+FatFreeDirentIndex (
+    IN PDCB Dcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees the name index of a directory.  The caller must hold
+    the FatDirentIndexMutex.
+
+Arguments:
+
+    Dcb - Supplies the directory, which must have an index.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PFAT_DIRENT_INDEX Index = Dcb->Specific.Dcb.DirentIndex;
+
+    PAGED_CODE();
+
+    NT_ASSERT( Index != NULL );
+
+    RemoveEntryList( &Index->LruLinks );
+    FatData.DirentIndexBytes -= Index->IndexSize;
+
+    Dcb->Specific.Dcb.DirentIndex = NULL;
+
+    ExFreePool( Index );
+}
 
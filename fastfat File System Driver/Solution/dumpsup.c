@@ -236,7 +236,12 @@ Return Value:
     DumpField           (AllocationSupport.LogOfBytesPerSector);
     DumpField           (AllocationSupport.LogOfBytesPerCluster);
     DumpField           (DirtyFatMcb);
+    DumpField           (DirtyFatWrites);
+    DumpField           (DirtyFatWriteIos);
+    DumpField           (DirtyFatWriteSectors);
+    DumpField           (DirtyFatWriteCleanSectors);
     DumpField           (FreeClusterBitMap);
+    DumpField           (FreeChunkSummary);
     DumpField           (VirtualVolumeFile);
     DumpField           (SectionObjectPointers.DataSectionObject);
     DumpField           (SectionObjectPointers.SharedCacheMap);
@@ -87,6 +87,12 @@ SLIST_HEADER FatCloseContextSList;
 
 FAST_MUTEX FatCloseQueueMutex;
 
+//
+//  Synchronization for the directory name indexes
+//
+
+FAST_MUTEX FatDirentIndexMutex;
+
 //
 //  Reserve MDL for paging file operations.
 //
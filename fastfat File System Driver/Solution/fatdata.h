@@ -30,6 +30,7 @@ extern NPAGED_LOOKASIDE_LIST FatEResourceLookasideList;
 
 extern SLIST_HEADER FatCloseContextSList;
 extern FAST_MUTEX FatCloseQueueMutex;
+extern FAST_MUTEX FatDirentIndexMutex;
 
 extern PDEVICE_OBJECT FatDiskFileSystemDeviceObject;
 extern PDEVICE_OBJECT FatCdromFileSystemDeviceObject;
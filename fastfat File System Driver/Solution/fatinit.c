@@ -238,6 +238,12 @@ Return Value:
 
     InitializeListHead( &FatData.AsyncCloseList );
     InitializeListHead( &FatData.DelayedCloseList );
+
+    //
+    //  And this one keeps track of directory name indexes.
+    //
+
+    InitializeListHead( &FatData.DirentIndexLruList );
     
     FatData.FatCloseItem = IoAllocateWorkItem( FatDiskFileSystemDeviceObject);
 
@@ -380,6 +386,7 @@ Return Value:
 
     ExInitializeSListHead( &FatCloseContextSList );
     ExInitializeFastMutex( &FatCloseQueueMutex );
+    ExInitializeFastMutex( &FatDirentIndexMutex );
     KeInitializeEvent( &FatReserveEvent, SynchronizationEvent, TRUE );
 
     //
@@ -630,6 +630,17 @@ FatCreateNewDirent (
     IN ULONG DirentsNeeded
     );
 
+VOID
+FatNoteDirentIndexChange (
+    IN PDCB Dcb,
+    IN VBO DirentOffset
+    );
+
+VOID
+FatDiscardDirentIndex (
+    IN PDCB Dcb
+    );
+
 _Requires_lock_held_(_Global_critical_region_)
 VOID
 FatInitializeDirectoryDirent (
@@ -948,18 +959,6 @@ FatUnpinEaRange (
 //  of the file object, implemented in FilObSup.c
 //
 
-typedef enum _TYPE_OF_OPEN {
-
-    UnopenedFileObject = 1,
-    UserFileOpen,
-    UserDirectoryOpen,
-    UserVolumeOpen,
-    VirtualVolumeFile,
-    DirectoryFile,
-    EaFile
-
-} TYPE_OF_OPEN;
-
 typedef enum _FAT_FLUSH_TYPE {
     
     NoFlush = 0,
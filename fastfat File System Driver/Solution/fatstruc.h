@@ -146,6 +146,15 @@ typedef struct _FAT_DATA {
 
     KSPIN_LOCK GeneralSpinLock;
 
+    //
+    //  All the directory name indexes in the system, least recently used
+    //  first, and the pool they occupy.  Both are protected by the
+    //  FatDirentIndexMutex.
+    //
+
+    LIST_ENTRY DirentIndexLruList;
+    ULONG DirentIndexBytes;
+
     //
     //  Cache manager call back structures, which must be passed on each call
     //  to CcInitializeCacheMap.
@@ -168,6 +177,66 @@ typedef struct _FAT_WINDOW {
 } FAT_WINDOW;
 typedef FAT_WINDOW *PFAT_WINDOW;
 
+//
+//  The dirent index is a hash of the upcased long and short names in a
+//  large directory, built on demand so that FatLocateDirent doesn't have
+//  to walk every dirent to open a name.  Each entry holds the hash of one
+//  name and the offset of the short dirent carrying it, so any LFN dirents
+//  for the name lie within MAX_LFN_DIRENTS before it.  Dirent sets allocated
+//  after the index was built sit on the pending list, by the offset of their
+//  first dirent, until their names can be read back and hashed.
+//
+//  The index only produces candidates, each of which is checked on the
+//  disk, so a stale entry costs a little time but never a wrong answer.
+//  A name which is neither indexed nor pending would be missed, though, so
+//  every path which writes a name into a directory must either note the
+//  dirent offset or discard the index.
+//
+
+#define FAT_DIRENT_INDEX_NIL            (0xffffffff)
+#define FAT_DIRENT_INDEX_MAX_PENDING    (32)
+
+typedef struct _FAT_DIRENT_INDEX_ENTRY {
+
+    ULONG Next;                 // Next entry in this bucket, or FAT_DIRENT_INDEX_NIL
+    ULONG Hash;                 // Hash of the upcased long, or the short, name
+    VBO DirentOffset;           // Short dirent of the set
+
+} FAT_DIRENT_INDEX_ENTRY;
+typedef FAT_DIRENT_INDEX_ENTRY *PFAT_DIRENT_INDEX_ENTRY;
+
+typedef struct _FAT_DIRENT_INDEX {
+
+    //
+    //  Links on FatData.DirentIndexLruList, and the directory we describe.
+    //
+
+    LIST_ENTRY LruLinks;
+    struct _FCB *Dcb;
+
+    //
+    //  The size of this allocation, the hash buckets and the entries, which
+    //  all follow this header in the same allocation.
+    //
+
+    ULONG IndexSize;
+    ULONG BucketMask;
+    PULONG Buckets;
+
+    ULONG EntryCount;
+    ULONG MaximumEntries;
+    PFAT_DIRENT_INDEX_ENTRY Entries;
+
+    //
+    //  Offsets of dirent sets allocated since the index was built.
+    //
+
+    ULONG PendingCount;
+    VBO PendingOffsets[FAT_DIRENT_INDEX_MAX_PENDING];
+
+} FAT_DIRENT_INDEX;
+typedef FAT_DIRENT_INDEX *PFAT_DIRENT_INDEX;
+
 //
 //  Forward reference some circular referenced structures.
 //
@@ -178,6 +247,24 @@ typedef VCB *PVCB;
 typedef struct _FCB FCB;
 typedef FCB *PFCB;
 
+//
+//  The kinds of file object we hand out, recorded in the fscontext fields
+//  by FatSetFileObject.  This is defined here rather than with the
+//  FilObSup.c routines because a deferred close remembers it.
+//
+
+typedef enum _TYPE_OF_OPEN {
+
+    UnopenedFileObject = 1,
+    UserFileOpen,
+    UserDirectoryOpen,
+    UserVolumeOpen,
+    VirtualVolumeFile,
+    DirectoryFile,
+    EaFile
+
+} TYPE_OF_OPEN;
+
 //
 //  This structure is used to keep track of information needed to do a
 //  deferred close.  It is now embedded in a CCB so we don't have to
@@ -363,6 +450,19 @@ typedef struct _VCB {
 
     RTL_BITMAP FreeClusterBitMap;
 
+    //
+    //  FAT32: The FreeChunkSummary describes the whole volume, not just the
+    //  current window.  Each bit covers FAT_SUMMARY_CHUNK_SIZE clusters and
+    //  a 0 means every cluster in the chunk is known to be free.  A 1 means
+    //  the chunk is in use or that we simply don't know, so the summary may
+    //  understate the free space but never overstates it.  It lets the
+    //  allocator find a window holding a large free run without loading
+    //  each window in turn.  Only present for volumes with NumberOfWindows > 1,
+    //  and protected by the FreeClusterBitMapMutex.
+    //
+
+    RTL_BITMAP FreeChunkSummary;
+
     //
     //  The following fast mutex controls access to the free cluster bit map
     //  and the buckets.
@@ -479,6 +579,19 @@ typedef struct _VCB {
 
     struct _FILE_SYSTEM_STATISTICS *Statistics;
 
+    //
+    //  Counters for writes of the dirty fat sectors: the number of volume
+    //  file writes, the disk ios they issued across all the fats, the
+    //  sectors those ios covered, and how many of those sectors were clean
+    //  ones written only to bridge a gap between dirty runs.  These are
+    //  updated with interlocked operations.
+    //
+
+    LONG64 DirtyFatWrites;
+    LONG64 DirtyFatWriteIos;
+    LONG64 DirtyFatWriteSectors;
+    LONG64 DirtyFatWriteCleanSectors;
+
     //
     //  The property tunneling cache for this volume
     //
@@ -1004,6 +1117,16 @@ typedef struct _FCB {
             PRTL_SPLAY_LINKS RootOemNode;
             PRTL_SPLAY_LINKS RootUnicodeNode;
 
+            //
+            //  The name index for this directory, if it is large enough to
+            //  have one, and a count of the dirents allocated in it which lets
+            //  us tell if one raced with building the index.  Both are protected
+            //  by the FatDirentIndexMutex.
+            //
+
+            PFAT_DIRENT_INDEX DirentIndex;
+            ULONG DirentIndexChangeCount;
+
             //
             //  The following field keeps track of free dirents, i.e.,
             //  dirents that are either unallocated for deleted.
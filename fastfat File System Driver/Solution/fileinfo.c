@@ -3396,6 +3396,13 @@ Return Value:
         } else {
 
             NewOffset = Fcb->LfnOffsetWithinDirectory;
+
+            //
+            //  The new name is going into the same dirents, so the name index
+            //  has to look at them again.
+            //
+
+            FatNoteDirentIndexChange( TargetDcb, NewOffset );
         }
 
         ContinueWithRename = TRUE;
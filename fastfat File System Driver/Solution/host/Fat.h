@@ -0,0 +1,28 @@
+/*++
+
+Copyright (c) 1989-2000 Microsoft Corporation
+
+Module Name:
+
+    Fat.h
+
+Abstract:
+
+    The host build's Fat.h, found ahead of the driver's own fat.h, which it
+    includes.  FAT32_ENTRY_MASK is written with a UL suffix, which is 32
+    bits where the driver is built but 64 bits on the host, and that leaves
+    FAT_CLEAN_VOLUME and FAT_DIRTY_VOLUME wider than the FAT_ENTRY they are
+    compared with and stored in.  Give the mask the width the driver means.
+
+
+--*/
+
+#ifndef _HOST_FAT_
+#define _HOST_FAT_
+
+#include "fat.h"
+
+#undef FAT32_ENTRY_MASK
+#define FAT32_ENTRY_MASK 0x0FFFFFFFU
+
+#endif // _HOST_FAT_
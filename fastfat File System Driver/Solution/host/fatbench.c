@@ -0,0 +1,2029 @@
+/*++
+
+Copyright (c) 1989-2000 Microsoft Corporation
+
+Module Name:
+
+    FatBench.c
+
+Abstract:
+
+    This module implements fatbench, a metadata benchmark for the host build
+    of the Fat allocation, directory and name support.  It mounts an image
+    file with the real FatMountVolume and times four workloads against it,
+    each driving the same routines, in the same order, as the create, write,
+    cleanup and close paths do:
+
+        create  - create N files with long names in one directory
+
+        append  - grow a set of open files one cluster at a time, round
+                  robin, so that their allocations interleave
+
+        lookup  - open random files down a deep tree of large directories,
+                  finding each directory through the prefix splay trees or,
+                  failing that, by searching its parent
+
+        delete  - delete the files made by create
+
+    Each phase reports its operation count, elapsed time and rate.  The
+    volume is flushed and dismounted at the end, so the image can be
+    checked with a host fsck.
+
+    Every request runs with the Vcb and the parent directory held
+    exclusive, as create does.
+
+    With -t it instead replays an allocation trace, calling the allocator
+    the way extending a file and deleting it do, and reports each phase of
+    the trace with the number of runs each allocation came back in.  -g
+    writes a synthetic trace sized to the volume: age it by filling it with
+    files of mixed sizes and deleting most of them at random, then grow a
+    set of streams while small files come and go around them, then free
+    everything.  Replaying one trace against a build from an older tree
+    (see the Makefile) compares the two allocators.
+
+
+--*/
+
+#include "FatProcs.h"
+#include "fathost.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+//
+//  The names the benchmark builds.  Every one of them is a long name, so
+//  each create also generates and checks a short name.
+//
+
+#define BENCH_NAME_CHARS                 64
+
+typedef struct _BENCH_NAME {
+
+    UNICODE_STRING Unicode;
+    UNICODE_STRING Upcased;
+    OEM_STRING Oem;
+
+    WCHAR UnicodeBuffer[BENCH_NAME_CHARS];
+    WCHAR UpcasedBuffer[BENCH_NAME_CHARS];
+    CHAR OemBuffer[BENCH_NAME_CHARS];
+
+} BENCH_NAME, *PBENCH_NAME;
+
+//
+//  The benchmark parameters, and the defaults used when the command line
+//  does not override them.
+//
+
+typedef struct _BENCH_PARAMETERS {
+
+    ULONG Files;
+    ULONG AppendFiles;
+    ULONG AppendRounds;
+    ULONG Depth;
+    ULONG Width;
+    ULONG Lookups;
+    ULONG Seed;
+
+} BENCH_PARAMETERS, *PBENCH_PARAMETERS;
+
+//
+//  An allocation trace is a header line giving the number of files it
+//  uses, then one operation per line:
+//
+//      p name          start a phase called name
+//      a file count    add count clusters to the end of file
+//      f file          free all of the file's allocation
+//
+//  Files are numbered from zero and start out empty.  The whole trace is
+//  read in before the replay starts, so parsing is not timed.
+//
+
+#define BENCH_TRACE_SIGNATURE            "fatbench-trace"
+#define BENCH_TRACE_PHASE_CHARS          16
+
+typedef struct _BENCH_TRACE_OP {
+
+    CHAR Op;
+    ULONG File;
+    ULONG Clusters;
+    CHAR Phase[BENCH_TRACE_PHASE_CHARS];
+
+} BENCH_TRACE_OP, *PBENCH_TRACE_OP;
+
+//
+//  The state of each file during a replay.
+//
+
+typedef struct _BENCH_TRACE_FILE {
+
+    LARGE_MCB Mcb;
+    ULONG Clusters;
+
+} BENCH_TRACE_FILE, *PBENCH_TRACE_FILE;
+
+PVCB BenchVcb;
+
+ULONG BenchRandomState;
+
+//
+//  Local support routines
+//
+
+VOID
+BenchMakeName (
+    OUT PBENCH_NAME Name,
+    IN PCSTR Format,
+    IN ULONG Number
+    );
+
+PFCB
+BenchFindFcb (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB ParentDcb,
+    IN PBENCH_NAME Name
+    );
+
+BOOLEAN
+BenchLocateDirent (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB ParentDcb,
+    IN PBENCH_NAME Name,
+    OUT PDIRENT *Dirent,
+    OUT PBCB *Bcb,
+    OUT PULONG DirentByteOffset,
+    OUT PULONG LfnByteOffset,
+    IN OUT PUNICODE_STRING Lfn
+    );
+
+PFCB
+BenchCreate (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB ParentDcb,
+    IN PBENCH_NAME Name,
+    IN BOOLEAN Directory
+    );
+
+PFCB
+BenchOpen (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB ParentDcb,
+    IN PBENCH_NAME Name,
+    IN BOOLEAN Directory
+    );
+
+VOID
+BenchClose (
+    IN PIRP_CONTEXT IrpContext,
+    IN PFCB Fcb
+    );
+
+VOID
+BenchCloseTree (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb
+    );
+
+VOID
+BenchAppendCluster (
+    IN PIRP_CONTEXT IrpContext,
+    IN PFCB Fcb
+    );
+
+VOID
+BenchDelete (
+    IN PIRP_CONTEXT IrpContext,
+    IN PFCB Fcb
+    );
+
+PDCB
+BenchMakeDirectory (
+    IN PDCB ParentDcb,
+    IN PBENCH_NAME Name
+    );
+
+double
+BenchNow (
+    VOID
+    );
+
+ULONG
+BenchRandom (
+    VOID
+    );
+
+VOID
+BenchReport (
+    IN PCSTR Phase,
+    IN ULONG Operations,
+    IN double Seconds,
+    IN PCSTR Note OPTIONAL
+    );
+
+BOOLEAN
+BenchGenerateTrace (
+    IN PCSTR TracePath
+    );
+
+BOOLEAN
+BenchReplayTrace (
+    IN PCSTR TracePath
+    );
+
+VOID
+BenchReplayAllocate (
+    IN PBENCH_TRACE_FILE File,
+    IN ULONG Clusters,
+    OUT PULONG Runs
+    );
+
+VOID
+BenchReplayFree (
+    IN PBENCH_TRACE_FILE File
+    );
+
+VOID
+BenchUsage (
+    VOID
+    );
+
+
+int
+main (
+    int argc,
+    char **argv
+    )
+
+/*++
+
+Routine Description:
+
+    This is the benchmark's entry point.  It parses the command line,
+    formats the image if asked to, mounts it and runs the phases.
+
+Arguments:
+
+    argc, argv - The command line.
+
+Return Value:
+
+    Zero if every phase ran, non zero otherwise.
+
+--*/
+
+{
+    BENCH_PARAMETERS Parameters;
+    PCSTR ImagePath = NULL;
+    PCSTR GeneratePath = NULL;
+    PCSTR ReplayPath = NULL;
+    BOOLEAN Format = FALSE;
+    ULONGLONG FormatSize = 1024ULL << 20;
+    ULONG FormatClusterSize = 4096;
+
+    PIRP_CONTEXT IrpContext;
+    PDCB RootDcb;
+    PDCB CreateDcb;
+    PDCB AppendDcb;
+    PDCB TreeDcb;
+    PDCB Dcb;
+    PFCB Fcb;
+    PFCB *AppendFcbs;
+    BENCH_NAME Name;
+    ULONG ClusterSize;
+    ULONG Runs;
+    ULONG Level;
+    ULONG Round;
+    ULONG i;
+    double Start;
+    char Note[64];
+    int Arg;
+
+    Parameters.Files = 20000;
+    Parameters.AppendFiles = 64;
+    Parameters.AppendRounds = 256;
+    Parameters.Depth = 8;
+    Parameters.Width = 2000;
+    Parameters.Lookups = 20000;
+    Parameters.Seed = 1;
+
+    for (Arg = 1; Arg < argc; Arg += 1) {
+
+        PCSTR Option = argv[Arg];
+        ULONGLONG Value = 0;
+
+        if (Option[0] != '-') {
+
+            if (ImagePath != NULL) { BenchUsage(); return 2; }
+            ImagePath = Option;
+            continue;
+        }
+
+        if (Option[1] == 'f' && Option[2] == '\0') {
+
+            Format = TRUE;
+            continue;
+        }
+
+        if (Option[1] == '\0' || Option[2] != '\0' || Arg + 1 == argc) {
+
+            BenchUsage();
+            return 2;
+        }
+
+        if (Option[1] == 'g' || Option[1] == 't') {
+
+            if (Option[1] == 'g') {
+
+                GeneratePath = argv[++Arg];
+
+            } else {
+
+                ReplayPath = argv[++Arg];
+            }
+
+            continue;
+        }
+
+        Value = strtoull( argv[++Arg], NULL, 0 );
+
+        switch (Option[1]) {
+
+        case 's': FormatSize = Value << 20; break;
+        case 'c': FormatClusterSize = (ULONG)Value; break;
+        case 'n': Parameters.Files = (ULONG)Value; break;
+        case 'a': Parameters.AppendFiles = (ULONG)Value; break;
+        case 'r': Parameters.AppendRounds = (ULONG)Value; break;
+        case 'd': Parameters.Depth = (ULONG)Value; break;
+        case 'w': Parameters.Width = (ULONG)Value; break;
+        case 'l': Parameters.Lookups = (ULONG)Value; break;
+        case 'S': Parameters.Seed = (ULONG)Value; break;
+
+        default:
+
+            BenchUsage();
+            return 2;
+        }
+    }
+
+    if (ImagePath == NULL ||
+        (GeneratePath != NULL && ReplayPath != NULL) ||
+        Parameters.AppendFiles == 0 ||
+        Parameters.Depth == 0 ||
+        Parameters.Width == 0) {
+
+        BenchUsage();
+        return 2;
+    }
+
+    BenchRandomState = Parameters.Seed ? Parameters.Seed : 1;
+
+    if (Format &&
+        !NT_SUCCESS( FatHostFormatImage( ImagePath, FormatSize, FormatClusterSize ))) {
+
+        fprintf( stderr, "fatbench: cannot format %s\n", ImagePath );
+        return 1;
+    }
+
+    if (!NT_SUCCESS( FatHostOpenImage( ImagePath ))) {
+
+        fprintf( stderr, "fatbench: cannot open %s\n", ImagePath );
+        return 1;
+    }
+
+    FatHostInitialize();
+
+    BenchVcb = FatHostMount();
+
+    if (BenchVcb == NULL) {
+
+        fprintf( stderr, "fatbench: %s does not hold a Fat volume\n", ImagePath );
+        FatHostCloseImage();
+        return 1;
+    }
+
+    RootDcb = BenchVcb->RootDcb;
+    ClusterSize = 1 << BenchVcb->AllocationSupport.LogOfBytesPerCluster;
+
+    printf( "fatbench: %s, FAT%u, %u clusters of %u bytes, %u free\n",
+            ImagePath,
+            BenchVcb->AllocationSupport.FatIndexBitSize,
+            BenchVcb->AllocationSupport.NumberOfClusters,
+            ClusterSize,
+            BenchVcb->AllocationSupport.NumberOfFreeClusters );
+
+    if (GeneratePath != NULL || ReplayPath != NULL) {
+
+        BOOLEAN Success;
+
+        if (GeneratePath != NULL) {
+
+            Success = BenchGenerateTrace( GeneratePath );
+
+        } else {
+
+            Success = BenchReplayTrace( ReplayPath );
+        }
+
+        FatHostDismount( BenchVcb );
+        FatHostCloseImage();
+
+        return Success ? 0 : 1;
+    }
+
+    //
+    //  A volume that already holds a run would collide with it, so insist
+    //  on a fresh one.
+    //
+
+    BenchMakeName( &Name, "Fat Benchmark Create %u", 0 );
+
+    IrpContext = FatHostCreateIrpContext( BenchVcb, IRP_MJ_CREATE );
+    (VOID)FatAcquireExclusiveVcb( IrpContext, BenchVcb );
+    (VOID)FatAcquireExclusiveFcb( IrpContext, RootDcb );
+
+    Fcb = BenchOpen( IrpContext, RootDcb, &Name, TRUE );
+
+    FatReleaseFcb( IrpContext, RootDcb );
+    FatReleaseVcb( IrpContext, BenchVcb );
+    FatHostCompleteRequest( IrpContext );
+
+    if (Fcb != NULL) {
+
+        fprintf( stderr, "fatbench: %s already holds a benchmark run, format it with -f\n", ImagePath );
+
+        IrpContext = FatHostCreateIrpContext( BenchVcb, IRP_MJ_CLOSE );
+        BenchClose( IrpContext, Fcb );
+        FatHostCompleteRequest( IrpContext );
+
+        FatHostDismount( BenchVcb );
+        FatHostCloseImage();
+        return 1;
+    }
+
+    printf( "%-8s %10s %10s %12s\n", "phase", "ops", "seconds", "ops/s" );
+
+    //
+    //  Create.  Each file is created and then closed, as an application
+    //  writing out many small files would.
+    //
+
+    CreateDcb = BenchMakeDirectory( RootDcb, &Name );
+
+    Start = BenchNow();
+
+    for (i = 0; i < Parameters.Files; i += 1) {
+
+        BenchMakeName( &Name, "Benchmark File %06u.dat", i );
+
+        IrpContext = FatHostCreateIrpContext( BenchVcb, IRP_MJ_CREATE );
+        (VOID)FatAcquireExclusiveVcb( IrpContext, BenchVcb );
+        (VOID)FatAcquireExclusiveFcb( IrpContext, CreateDcb );
+
+        Fcb = BenchCreate( IrpContext, CreateDcb, &Name, FALSE );
+        BenchClose( IrpContext, Fcb );
+
+        FatReleaseFcb( IrpContext, CreateDcb );
+        FatReleaseVcb( IrpContext, BenchVcb );
+        FatHostCompleteRequest( IrpContext );
+    }
+
+    BenchReport( "create", Parameters.Files, BenchNow() - Start, NULL );
+
+    //
+    //  Fragmented append.  The files stay open while every one of them is
+    //  extended by a cluster in turn, so each extension has to find space
+    //  near a file whose neighbour just took the next cluster.
+    //
+
+    BenchMakeName( &Name, "Fat Benchmark Append %u", 0 );
+    AppendDcb = BenchMakeDirectory( RootDcb, &Name );
+
+    AppendFcbs = calloc( Parameters.AppendFiles, sizeof(PFCB) );
+
+    IrpContext = FatHostCreateIrpContext( BenchVcb, IRP_MJ_CREATE );
+    (VOID)FatAcquireExclusiveVcb( IrpContext, BenchVcb );
+    (VOID)FatAcquireExclusiveFcb( IrpContext, AppendDcb );
+
+    for (i = 0; i < Parameters.AppendFiles; i += 1) {
+
+        BenchMakeName( &Name, "Append Target %06u.log", i );
+        AppendFcbs[i] = BenchCreate( IrpContext, AppendDcb, &Name, FALSE );
+    }
+
+    FatReleaseFcb( IrpContext, AppendDcb );
+    FatReleaseVcb( IrpContext, BenchVcb );
+    FatHostCompleteRequest( IrpContext );
+
+    Start = BenchNow();
+
+    for (Round = 0; Round < Parameters.AppendRounds; Round += 1) {
+
+        for (i = 0; i < Parameters.AppendFiles; i += 1) {
+
+            IrpContext = FatHostCreateIrpContext( BenchVcb, IRP_MJ_WRITE );
+            (VOID)FatAcquireExclusiveVcb( IrpContext, BenchVcb );
+            (VOID)FatAcquireExclusiveFcb( IrpContext, AppendFcbs[i] );
+
+            BenchAppendCluster( IrpContext, AppendFcbs[i] );
+
+            FatReleaseFcb( IrpContext, AppendFcbs[i] );
+            FatReleaseVcb( IrpContext, BenchVcb );
+            FatHostCompleteRequest( IrpContext );
+        }
+    }
+
+    for (i = 0, Runs = 0; i < Parameters.AppendFiles; i += 1) {
+
+        Runs += FsRtlNumberOfRunsInLargeMcb( &AppendFcbs[i]->Mcb );
+    }
+
+    snprintf( Note, sizeof(Note), "%.1f runs/file", (double)Runs / Parameters.AppendFiles );
+
+    BenchReport( "append",
+                 Parameters.AppendFiles * Parameters.AppendRounds,
+                 BenchNow() - Start,
+                 Note );
+
+    IrpContext = FatHostCreateIrpContext( BenchVcb, IRP_MJ_CLOSE );
+
+    for (i = 0; i < Parameters.AppendFiles; i += 1) {
+
+        BenchClose( IrpContext, AppendFcbs[i] );
+    }
+
+    FatHostCompleteRequest( IrpContext );
+    free( AppendFcbs );
+
+    //
+    //  Deep tree lookup.  Build the tree, each level holding Width files
+    //  and then the next level's directory, so finding a directory by
+    //  searching means reading its parent to the end.  Then close it all,
+    //  and open random files at random depths by full path.
+    //
+
+    BenchMakeName( &Name, "Fat Benchmark Tree %u", 0 );
+    TreeDcb = Dcb = BenchMakeDirectory( RootDcb, &Name );
+
+    for (Level = 0; Level < Parameters.Depth; Level += 1) {
+
+        IrpContext = FatHostCreateIrpContext( BenchVcb, IRP_MJ_CREATE );
+        (VOID)FatAcquireExclusiveVcb( IrpContext, BenchVcb );
+        (VOID)FatAcquireExclusiveFcb( IrpContext, Dcb );
+
+        for (i = 0; i < Parameters.Width; i += 1) {
+
+            BenchMakeName( &Name, "Tree Leaf %06u.txt", i );
+            BenchClose( IrpContext, BenchCreate( IrpContext, Dcb, &Name, FALSE ));
+        }
+
+        FatReleaseFcb( IrpContext, Dcb );
+        FatReleaseVcb( IrpContext, BenchVcb );
+        FatHostCompleteRequest( IrpContext );
+
+        if (Level + 1 < Parameters.Depth) {
+
+            BenchMakeName( &Name, "Tree Level %02u", Level + 1 );
+            Dcb = BenchMakeDirectory( Dcb, &Name );
+        }
+    }
+
+    IrpContext = FatHostCreateIrpContext( BenchVcb, IRP_MJ_CLOSE );
+    BenchCloseTree( IrpContext, TreeDcb );
+    FatHostCompleteRequest( IrpContext );
+
+    Start = BenchNow();
+
+    for (i = 0; i < Parameters.Lookups; i += 1) {
+
+        ULONG TargetLevel = BenchRandom() % Parameters.Depth;
+
+        IrpContext = FatHostCreateIrpContext( BenchVcb, IRP_MJ_CREATE );
+        (VOID)FatAcquireExclusiveVcb( IrpContext, BenchVcb );
+
+        BenchMakeName( &Name, "Fat Benchmark Tree %u", 0 );
+        Dcb = BenchOpen( IrpContext, RootDcb, &Name, TRUE );
+
+        for (Level = 1; Level <= TargetLevel; Level += 1) {
+
+            BenchMakeName( &Name, "Tree Level %02u", Level );
+            Dcb = BenchOpen( IrpContext, Dcb, &Name, TRUE );
+        }
+
+        BenchMakeName( &Name, "Tree Leaf %06u.txt", BenchRandom() % Parameters.Width );
+
+        (VOID)FatAcquireExclusiveFcb( IrpContext, Dcb );
+        Fcb = BenchOpen( IrpContext, Dcb, &Name, FALSE );
+        FatReleaseFcb( IrpContext, Dcb );
+
+        if (Fcb == NULL) {
+
+            fprintf( stderr, "fatbench: lookup of a tree leaf failed\n" );
+            abort();
+        }
+
+        BenchClose( IrpContext, Fcb );
+
+        FatReleaseVcb( IrpContext, BenchVcb );
+        FatHostCompleteRequest( IrpContext );
+    }
+
+    BenchReport( "lookup", Parameters.Lookups, BenchNow() - Start, NULL );
+
+    IrpContext = FatHostCreateIrpContext( BenchVcb, IRP_MJ_CLOSE );
+    BenchCloseTree( IrpContext, RootDcb );
+    FatHostCompleteRequest( IrpContext );
+
+    //
+    //  Mass delete.  Open, delete and close each of the created files, in
+    //  creation order.
+    //
+
+    BenchMakeName( &Name, "Fat Benchmark Create %u", 0 );
+
+    IrpContext = FatHostCreateIrpContext( BenchVcb, IRP_MJ_CREATE );
+    (VOID)FatAcquireExclusiveVcb( IrpContext, BenchVcb );
+    CreateDcb = BenchOpen( IrpContext, RootDcb, &Name, TRUE );
+    FatReleaseVcb( IrpContext, BenchVcb );
+    FatHostCompleteRequest( IrpContext );
+
+    Start = BenchNow();
+
+    for (i = 0; i < Parameters.Files; i += 1) {
+
+        BenchMakeName( &Name, "Benchmark File %06u.dat", i );
+
+        IrpContext = FatHostCreateIrpContext( BenchVcb, IRP_MJ_CLEANUP );
+        (VOID)FatAcquireExclusiveVcb( IrpContext, BenchVcb );
+        (VOID)FatAcquireExclusiveFcb( IrpContext, CreateDcb );
+
+        Fcb = BenchOpen( IrpContext, CreateDcb, &Name, FALSE );
+
+        if (Fcb == NULL) {
+
+            fprintf( stderr, "fatbench: created file %u is missing\n", i );
+            abort();
+        }
+
+        BenchDelete( IrpContext, Fcb );
+
+        FatReleaseFcb( IrpContext, CreateDcb );
+        FatReleaseVcb( IrpContext, BenchVcb );
+        FatHostCompleteRequest( IrpContext );
+    }
+
+    BenchReport( "delete", Parameters.Files, BenchNow() - Start, NULL );
+
+    IrpContext = FatHostCreateIrpContext( BenchVcb, IRP_MJ_CLOSE );
+    BenchCloseTree( IrpContext, RootDcb );
+    FatHostCompleteRequest( IrpContext );
+
+    Start = BenchNow();
+    FatHostDismount( BenchVcb );
+    BenchReport( "flush", 1, BenchNow() - Start, NULL );
+
+    FatHostCloseImage();
+
+    return 0;
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+BenchMakeName (
+    OUT PBENCH_NAME Name,
+    IN PCSTR Format,
+    IN ULONG Number
+    )
+
+/*++
+
+Routine Description:
+
+    This routine formats a name and builds the three forms of it create
+    works with: the name as given, upcased, and upcased in the Oem code
+    page.
+
+Arguments:
+
+    Name - Receives the name.
+
+    Format - Supplies a printf format taking one unsigned argument.
+
+    Number - Supplies the argument.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    ULONG Length;
+    ULONG i;
+
+    Length = snprintf( Name->OemBuffer, sizeof(Name->OemBuffer), Format, Number );
+
+    for (i = 0; i < Length; i += 1) {
+
+        Name->UnicodeBuffer[i] = (WCHAR)(UCHAR)Name->OemBuffer[i];
+    }
+
+    Name->Unicode.Buffer = Name->UnicodeBuffer;
+    Name->Unicode.Length = Name->Unicode.MaximumLength = (USHORT)(Length * sizeof(WCHAR));
+
+    Name->Upcased.Buffer = Name->UpcasedBuffer;
+    Name->Upcased.MaximumLength = sizeof(Name->UpcasedBuffer);
+    (VOID)RtlUpcaseUnicodeString( &Name->Upcased, &Name->Unicode, FALSE );
+
+    Name->Oem.Buffer = Name->OemBuffer;
+    Name->Oem.MaximumLength = sizeof(Name->OemBuffer);
+    (VOID)RtlUpcaseUnicodeStringToCountedOemString( &Name->Oem, &Name->Unicode, FALSE );
+}
+
+
+//
+//  Local support routine
+//
+
+PFCB
+BenchFindFcb (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB ParentDcb,
+    IN PBENCH_NAME Name
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks for an open Fcb or Dcb in a directory the way
+    create's prefix search does, first in the Oem tree and then, if there
+    is one, in the Unicode tree.
+
+Arguments:
+
+    ParentDcb - Supplies the directory to look in.
+
+    Name - Supplies the name to look for.
+
+Return Value:
+
+    PFCB - The Fcb or Dcb, or NULL if there is none.
+
+--*/
+
+{
+    PFCB Fcb;
+    BOOLEAN FileNameDos;
+
+    Fcb = FatFindFcb( IrpContext,
+                      &ParentDcb->Specific.Dcb.RootOemNode,
+                      (PSTRING)&Name->Oem,
+                      &FileNameDos );
+
+    if ((Fcb == NULL) && ParentDcb->Specific.Dcb.RootUnicodeNode) {
+
+        Fcb = FatFindFcb( IrpContext,
+                          &ParentDcb->Specific.Dcb.RootUnicodeNode,
+                          (PSTRING)&Name->Upcased,
+                          &FileNameDos );
+    }
+
+    return Fcb;
+}
+
+
+//
+//  Local support routine
+//
+
+BOOLEAN
+BenchLocateDirent (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB ParentDcb,
+    IN PBENCH_NAME Name,
+    OUT PDIRENT *Dirent,
+    OUT PBCB *Bcb,
+    OUT PULONG DirentByteOffset,
+    OUT PULONG LfnByteOffset,
+    IN OUT PUNICODE_STRING Lfn
+    )
+
+/*++
+
+Routine Description:
+
+    This routine searches a directory for a name with the same local Ccb
+    create builds for FatLocateDirent.
+
+Arguments:
+
+    ParentDcb - Supplies the directory to search.
+
+    Name - Supplies the name to look for.
+
+    Dirent - Receives the short dirent, or NULL.
+
+    Bcb - Receives the Bcb for the dirent, which the caller must unpin.
+
+    DirentByteOffset - Receives the offset of the short dirent.
+
+    LfnByteOffset - Receives the offset of the first dirent of the set.
+
+    Lfn - Receives the long name found with the dirent.
+
+Return Value:
+
+    BOOLEAN - TRUE if the name was found.
+
+--*/
+
+{
+    CCB LocalCcb;
+    BOOLEAN FileNameDos;
+
+    RtlZeroMemory( &LocalCcb, sizeof(CCB) );
+
+    if (FatIsNameShortOemValid( IrpContext, Name->Oem, FALSE, FALSE, FALSE )) {
+
+        FatStringTo8dot3( IrpContext,
+                          Name->Oem,
+                          &LocalCcb.OemQueryTemplate.Constant );
+
+        LocalCcb.Flags = 0;
+
+    } else {
+
+        LocalCcb.Flags = CCB_FLAG_SKIP_SHORT_NAME_COMPARE;
+    }
+
+    LocalCcb.UnicodeQueryTemplate = Name->Upcased;
+    LocalCcb.ContainsWildCards = FALSE;
+
+    Lfn->Length = 0;
+
+    FatLocateDirent( IrpContext,
+                     ParentDcb,
+                     &LocalCcb,
+                     0,
+                     Dirent,
+                     Bcb,
+                     (PVBO)DirentByteOffset,
+                     &FileNameDos,
+                     Lfn );
+
+    if (*Dirent == NULL) {
+
+        return FALSE;
+    }
+
+    *LfnByteOffset = *DirentByteOffset -
+                     FAT_LFN_DIRENTS_NEEDED(Lfn) * sizeof(LFN_DIRENT);
+
+    return TRUE;
+}
+
+
+//
+//  Local support routine
+//
+
+PFCB
+BenchCreate (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB ParentDcb,
+    IN PBENCH_NAME Name,
+    IN BOOLEAN Directory
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a new file or directory the way FatCreateNewFile
+    and FatCreateNewDirectory do: select the names, allocate the dirent
+    set, build it in place, and create the Fcb or Dcb.  The caller has
+    already established that the name does not exist.
+
+    As in BenchOpen, a new file is counted as open and a new directory is
+    not.
+
+Arguments:
+
+    ParentDcb - Supplies the directory to create in.
+
+    Name - Supplies the name to create.
+
+    Directory - Supplies TRUE to create a directory.
+
+Return Value:
+
+    PFCB - The new Fcb or Dcb.
+
+--*/
+
+{
+    UCHAR ShortNameBuffer[12];
+    OEM_STRING ShortName;
+
+    BOOLEAN AllLowerComponent;
+    BOOLEAN AllLowerExtension;
+    BOOLEAN CreateLfn;
+
+    ULONG DirentsNeeded;
+    ULONG DirentByteOffset;
+    ULONG ShortDirentByteOffset;
+
+    PBCB DirentBcb = NULL;
+    PDIRENT Dirent;
+    PDIRENT ShortDirent;
+
+    ULONG BytesInFirstPage = 0;
+    ULONG DirentsInFirstPage = 0;
+    PDIRENT FirstPageDirent = NULL;
+    PBCB SecondPageBcb = NULL;
+    ULONG SecondPageOffset;
+    PDIRENT SecondPageDirent = NULL;
+    BOOLEAN DirentFromPool = FALSE;
+
+    NTSTATUS Status;
+    PFCB Fcb;
+
+    ShortName.Length = 0;
+    ShortName.MaximumLength = sizeof(ShortNameBuffer);
+    ShortName.Buffer = (PCHAR)&ShortNameBuffer[0];
+
+    FatSelectNames( IrpContext,
+                    ParentDcb,
+                    &Name->Oem,
+                    &Name->Unicode,
+                    &ShortName,
+                    NULL,
+                    &AllLowerComponent,
+                    &AllLowerExtension,
+                    &CreateLfn );
+
+    DirentsNeeded = CreateLfn ? FAT_LFN_DIRENTS_NEEDED(&Name->Unicode) + 1 : 1;
+
+    DirentByteOffset = FatCreateNewDirent( IrpContext,
+                                           ParentDcb,
+                                           DirentsNeeded );
+
+    FatPrepareWriteDirectoryFile( IrpContext,
+                                  ParentDcb,
+                                  DirentByteOffset,
+                                  sizeof(DIRENT),
+                                  &DirentBcb,
+                                  (PVOID *)&Dirent,
+                                  FALSE,
+                                  TRUE,
+                                  &Status );
+
+    //
+    //  A set that straddles a page is built in pool and copied into the
+    //  two pages, as create does.
+    //
+
+    if ((DirentByteOffset / PAGE_SIZE) !=
+        ((DirentByteOffset + (DirentsNeeded - 1) * sizeof(DIRENT)) / PAGE_SIZE)) {
+
+        SecondPageOffset = (DirentByteOffset & ~(PAGE_SIZE - 1)) + PAGE_SIZE;
+
+        BytesInFirstPage = SecondPageOffset - DirentByteOffset;
+
+        DirentsInFirstPage = BytesInFirstPage / sizeof(DIRENT);
+
+        FatPrepareWriteDirectoryFile( IrpContext,
+                                      ParentDcb,
+                                      SecondPageOffset,
+                                      sizeof(DIRENT),
+                                      &SecondPageBcb,
+                                      (PVOID *)&SecondPageDirent,
+                                      FALSE,
+                                      TRUE,
+                                      &Status );
+
+        FirstPageDirent = Dirent;
+
+        Dirent = FsRtlAllocatePoolWithTag( PagedPool,
+                                           DirentsNeeded * sizeof(DIRENT),
+                                           TAG_DIRENT );
+
+        DirentFromPool = TRUE;
+    }
+
+    ShortDirent = Dirent + DirentsNeeded - 1;
+    ShortDirentByteOffset = DirentByteOffset +
+                            (DirentsNeeded - 1) * sizeof(DIRENT);
+
+    FatConstructDirent( IrpContext,
+                        ShortDirent,
+                        &ShortName,
+                        AllLowerComponent,
+                        AllLowerExtension,
+                        CreateLfn ? &Name->Unicode : NULL,
+                        (UCHAR)(Directory ? FAT_DIRENT_ATTR_DIRECTORY : FAT_DIRENT_ATTR_ARCHIVE),
+                        TRUE,
+                        NULL );
+
+    if (DirentFromPool) {
+
+        RtlCopyMemory( FirstPageDirent, Dirent, BytesInFirstPage );
+
+        RtlCopyMemory( SecondPageDirent,
+                       Dirent + DirentsInFirstPage,
+                       DirentsNeeded*sizeof(DIRENT) - BytesInFirstPage );
+
+        ShortDirent = SecondPageDirent + (DirentsNeeded - DirentsInFirstPage) - 1;
+    }
+
+    if (Directory) {
+
+        Fcb = FatCreateDcb( IrpContext,
+                            BenchVcb,
+                            ParentDcb,
+                            DirentByteOffset,
+                            ShortDirentByteOffset,
+                            ShortDirent,
+                            CreateLfn ? &Name->Unicode : NULL );
+
+        FatInitializeDirectoryDirent( IrpContext, Fcb, ShortDirent );
+
+    } else {
+
+        Fcb = FatCreateFcb( IrpContext,
+                            BenchVcb,
+                            ParentDcb,
+                            DirentByteOffset,
+                            ShortDirentByteOffset,
+                            ShortDirent,
+                            CreateLfn ? &Name->Unicode : NULL,
+                            FALSE,
+                            FALSE );
+    }
+
+    if (!Directory) {
+
+        Fcb->OpenCount += 1;
+        BenchVcb->OpenFileCount += 1;
+    }
+
+    FatUnpinBcb( IrpContext, DirentBcb );
+    FatUnpinBcb( IrpContext, SecondPageBcb );
+
+    if (DirentFromPool) {
+
+        ExFreePool( Dirent );
+    }
+
+    return Fcb;
+}
+
+
+//
+//  Local support routine
+//
+
+PFCB
+BenchOpen (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB ParentDcb,
+    IN PBENCH_NAME Name,
+    IN BOOLEAN Directory
+    )
+
+/*++
+
+Routine Description:
+
+    This routine opens an existing file or directory.  A directory that is
+    already in memory is found through the prefix splay trees, which is
+    how create walks the leading components of a path.  Anything else is
+    searched for on disk and gets a new Fcb or Dcb.
+
+    Opens of directories are not counted, so that a directory stays in
+    memory only while it has children or a directory stream, as it would
+    if the path walk opened and closed it.
+
+Arguments:
+
+    ParentDcb - Supplies the directory to look in.
+
+    Name - Supplies the name to open.
+
+    Directory - Supplies TRUE if the caller wants a directory.
+
+Return Value:
+
+    PFCB - The Fcb or Dcb, or NULL if the name does not exist.
+
+--*/
+
+{
+    PFCB Fcb;
+    PDIRENT Dirent;
+    PBCB DirentBcb = NULL;
+    ULONG DirentByteOffset;
+    ULONG LfnByteOffset;
+    UNICODE_STRING Lfn;
+    WCHAR LfnBuffer[FAT_CREATE_INITIAL_NAME_BUF_SIZE * 2];
+
+    Fcb = BenchFindFcb( IrpContext, ParentDcb, Name );
+
+    if (Fcb == NULL) {
+
+        Lfn.Length = 0;
+        Lfn.MaximumLength = sizeof(LfnBuffer);
+        Lfn.Buffer = LfnBuffer;
+
+        if (!BenchLocateDirent( IrpContext,
+                                ParentDcb,
+                                Name,
+                                &Dirent,
+                                &DirentBcb,
+                                &DirentByteOffset,
+                                &LfnByteOffset,
+                                &Lfn )) {
+
+            FatUnpinBcb( IrpContext, DirentBcb );
+            return NULL;
+        }
+
+        if (Directory) {
+
+            Fcb = FatCreateDcb( IrpContext,
+                                BenchVcb,
+                                ParentDcb,
+                                LfnByteOffset,
+                                DirentByteOffset,
+                                Dirent,
+                                &Lfn );
+
+        } else {
+
+            Fcb = FatCreateFcb( IrpContext,
+                                BenchVcb,
+                                ParentDcb,
+                                LfnByteOffset,
+                                DirentByteOffset,
+                                Dirent,
+                                &Lfn,
+                                FALSE,
+                                FALSE );
+        }
+
+        FatUnpinBcb( IrpContext, DirentBcb );
+    }
+
+    if (!Directory) {
+
+        Fcb->OpenCount += 1;
+        BenchVcb->OpenFileCount += 1;
+    }
+
+    return Fcb;
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+BenchClose (
+    IN PIRP_CONTEXT IrpContext,
+    IN PFCB Fcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine closes a file opened or created by the benchmark, deleting
+    its Fcb once it is no longer open, as close does.
+
+Arguments:
+
+    Fcb - Supplies the file to close.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    if (NodeType( Fcb ) != FAT_NTC_FCB) {
+
+        return;
+    }
+
+    Fcb->OpenCount -= 1;
+    BenchVcb->OpenFileCount -= 1;
+
+    if (Fcb->OpenCount == 0) {
+
+        SetFlag( BenchVcb->VcbState, VCB_STATE_FLAG_DELETED_FCB );
+        FatDeleteFcb( IrpContext, &Fcb );
+    }
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+BenchCloseTree (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDCB Dcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tears down every directory below a Dcb, closing each
+    directory stream and deleting each Dcb bottom up, the way the last
+    close of a directory does.  The Dcb itself is torn down too unless it
+    is the root, and so is everything in it but the Ea file.
+
+Arguments:
+
+    Dcb - Supplies the top of the tree.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PFILE_OBJECT DirectoryFile;
+    PLIST_ENTRY Links;
+
+    Links = Dcb->Specific.Dcb.ParentDcbQueue.Flink;
+
+    while (Links != &Dcb->Specific.Dcb.ParentDcbQueue) {
+
+        PFCB Child = CONTAINING_RECORD( Links, FCB, ParentDcbLinks );
+
+        Links = Links->Flink;
+
+        //
+        //  The Ea file's Fcb in a Fat16 root belongs to the volume.
+        //
+
+        if (Child == BenchVcb->EaFcb) {
+
+            continue;
+        }
+
+        NT_ASSERT( NodeType( Child ) == FAT_NTC_DCB );
+
+        BenchCloseTree( IrpContext, Child );
+    }
+
+    if (NodeType( Dcb ) == FAT_NTC_ROOT_DCB) {
+
+        return;
+    }
+
+    DirectoryFile = Dcb->Specific.Dcb.DirectoryFile;
+
+    if (DirectoryFile != NULL) {
+
+        CcUninitializeCacheMap( DirectoryFile, NULL, NULL );
+
+        Dcb->Specific.Dcb.DirectoryFile = NULL;
+        ObDereferenceObject( DirectoryFile );
+    }
+
+    SetFlag( BenchVcb->VcbState, VCB_STATE_FLAG_DELETED_FCB );
+    FatDeleteFcb( IrpContext, &Dcb );
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+BenchAppendCluster (
+    IN PIRP_CONTEXT IrpContext,
+    IN PFCB Fcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine extends a file by one cluster as an extending write does:
+    add the allocation, move the file size and record it in the dirent.
+
+Arguments:
+
+    Fcb - Supplies the file to extend.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    ULONG NewSize;
+
+    if (Fcb->Header.AllocationSize.QuadPart == FCB_LOOKUP_ALLOCATIONSIZE_HINT) {
+
+        FatLookupFileAllocationSize( IrpContext, Fcb );
+    }
+
+    NewSize = Fcb->Header.AllocationSize.LowPart +
+              (1 << BenchVcb->AllocationSupport.LogOfBytesPerCluster);
+
+    FatAddFileAllocation( IrpContext, Fcb, NULL, NewSize );
+
+    Fcb->Header.FileSize.LowPart = NewSize;
+    Fcb->Header.ValidDataLength.LowPart = NewSize;
+
+    FatSetFileSizeInDirent( IrpContext, Fcb, NULL );
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+BenchDelete (
+    IN PIRP_CONTEXT IrpContext,
+    IN PFCB Fcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine deletes an open file as cleanup does for a delete on
+    close: zero the size in the dirent, free the allocation, delete the
+    dirent and remove the names, and then closes it.
+
+Arguments:
+
+    Fcb - Supplies the file to delete.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    DELETE_CONTEXT DeleteContext;
+
+    if (Fcb->Header.AllocationSize.QuadPart == FCB_LOOKUP_ALLOCATIONSIZE_HINT) {
+
+        FatLookupFileAllocationSize( IrpContext, Fcb );
+    }
+
+    DeleteContext.FileSize = Fcb->Header.FileSize.LowPart;
+    DeleteContext.FirstClusterOfFile = Fcb->FirstClusterOfFile;
+
+    Fcb->Header.FileSize.LowPart = 0;
+    Fcb->Header.ValidDataLength.LowPart = 0;
+    Fcb->ValidDataToDisk = 0;
+
+    FatSetFileSizeInDirent( IrpContext, Fcb, NULL );
+
+    FatTruncateFileAllocation( IrpContext, Fcb, 0 );
+
+    FatDeleteDirent( IrpContext, Fcb, &DeleteContext, TRUE );
+
+    FatRemoveNames( IrpContext, Fcb );
+
+    BenchClose( IrpContext, Fcb );
+}
+
+
+//
+//  Local support routine
+//
+
+PDCB
+BenchMakeDirectory (
+    IN PDCB ParentDcb,
+    IN PBENCH_NAME Name
+    )
+
+/*++
+
+Routine Description:
+
+    This routine creates a directory as a request of its own.
+
+Arguments:
+
+    ParentDcb - Supplies the directory to create in.
+
+    Name - Supplies the name of the new directory.
+
+Return Value:
+
+    PDCB - The new directory.
+
+--*/
+
+{
+    PIRP_CONTEXT IrpContext;
+    PDCB Dcb;
+
+    IrpContext = FatHostCreateIrpContext( BenchVcb, IRP_MJ_CREATE );
+    (VOID)FatAcquireExclusiveVcb( IrpContext, BenchVcb );
+    (VOID)FatAcquireExclusiveFcb( IrpContext, ParentDcb );
+
+    Dcb = BenchCreate( IrpContext, ParentDcb, Name, TRUE );
+
+    FatReleaseFcb( IrpContext, ParentDcb );
+    FatReleaseVcb( IrpContext, BenchVcb );
+    FatHostCompleteRequest( IrpContext );
+
+    return Dcb;
+}
+
+
+//
+//  Local support routine
+//
+
+double
+BenchNow (
+    VOID
+    )
+{
+    struct timespec Now;
+
+    clock_gettime( CLOCK_MONOTONIC, &Now );
+
+    return (double)Now.tv_sec + (double)Now.tv_nsec / 1e9;
+}
+
+
+//
+//  Local support routine
+//
+
+ULONG
+BenchRandom (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the next value from a xorshift generator, so runs
+    with the same seed open the same files.
+
+--*/
+
+{
+    BenchRandomState ^= BenchRandomState << 13;
+    BenchRandomState ^= BenchRandomState >> 17;
+    BenchRandomState ^= BenchRandomState << 5;
+
+    return BenchRandomState;
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+BenchReport (
+    IN PCSTR Phase,
+    IN ULONG Operations,
+    IN double Seconds,
+    IN PCSTR Note OPTIONAL
+    )
+{
+    printf( "%-8s %10u %10.3f %12.0f%s%s\n",
+            Phase,
+            Operations,
+            Seconds,
+            Seconds > 0 ? Operations / Seconds : 0.0,
+            Note != NULL ? "   " : "",
+            Note != NULL ? Note : "" );
+
+    fflush( stdout );
+}
+
+
+//
+//  Local support routine
+//
+
+BOOLEAN
+BenchGenerateTrace (
+    IN PCSTR TracePath
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes a synthetic allocation trace sized to the mounted
+    volume, in three phases:
+
+        age     - fill 70% of the free space with files of 1 to 256
+                  clusters, mostly small, then free 60% of them at random,
+                  leaving free space scattered over every FAT window
+
+        stream  - grow 16 files 32 clusters at a time, round robin, until
+                  they hold a tenth of the volume, creating a small file
+                  or freeing one at random between extensions
+
+        free    - free every file that is left
+
+    The random generator is seeded with -S, so a trace can be made again.
+
+Arguments:
+
+    TracePath - Supplies the file to write the trace to.
+
+Return Value:
+
+    BOOLEAN - TRUE if the trace was written.
+
+--*/
+
+{
+    FILE *Trace;
+    PULONG Live;
+    ULONG LiveCount = 0;
+    ULONG Files = 0;
+    ULONG Budget;
+    ULONG Used = 0;
+    ULONG Streams[16];
+    ULONG StreamRounds;
+    ULONG Clusters;
+    ULONG Round;
+    ULONG Index;
+    ULONG i;
+
+    Trace = fopen( TracePath, "w" );
+
+    if (Trace == NULL) {
+
+        fprintf( stderr, "fatbench: cannot create %s\n", TracePath );
+        return FALSE;
+    }
+
+    //
+    //  No file is ever smaller than a cluster, so the free cluster count
+    //  bounds the number of files alive at once.
+    //
+
+    Live = malloc( BenchVcb->AllocationSupport.NumberOfFreeClusters * sizeof(ULONG) );
+
+    if (Live == NULL) {
+
+        fclose( Trace );
+        return FALSE;
+    }
+
+    //
+    //  The file count is not known until the end, so leave room for it in
+    //  the header and fill it in then.
+    //
+
+    fprintf( Trace, "%s %10u\n", BENCH_TRACE_SIGNATURE, 0 );
+
+    Budget = BenchVcb->AllocationSupport.NumberOfFreeClusters / 10 * 7;
+
+    fprintf( Trace, "p age\n" );
+
+    while (TRUE) {
+
+        Clusters = 1 + BenchRandom() % (1 << (BenchRandom() % 9));
+
+        if (Used + Clusters > Budget) {
+
+            break;
+        }
+
+        fprintf( Trace, "a %u %u\n", Files, Clusters );
+
+        Live[LiveCount++] = Files++;
+        Used += Clusters;
+    }
+
+    for (i = LiveCount / 10 * 6; i > 0; i -= 1) {
+
+        Index = BenchRandom() % LiveCount;
+
+        fprintf( Trace, "f %u\n", Live[Index] );
+
+        Live[Index] = Live[--LiveCount];
+    }
+
+    fprintf( Trace, "p stream\n" );
+
+    for (i = 0; i < 16; i += 1) {
+
+        Streams[i] = Files++;
+    }
+
+    StreamRounds = BenchVcb->AllocationSupport.NumberOfClusters / 10 / (16 * 32);
+
+    for (Round = 0; Round < StreamRounds; Round += 1) {
+
+        for (i = 0; i < 16; i += 1) {
+
+            fprintf( Trace, "a %u 32\n", Streams[i] );
+
+            if (BenchRandom() % 2) {
+
+                fprintf( Trace, "a %u %u\n", Files, 1 + BenchRandom() % 16 );
+                Live[LiveCount++] = Files++;
+
+            } else if (LiveCount != 0) {
+
+                Index = BenchRandom() % LiveCount;
+
+                fprintf( Trace, "f %u\n", Live[Index] );
+
+                Live[Index] = Live[--LiveCount];
+            }
+        }
+    }
+
+    fprintf( Trace, "p free\n" );
+
+    for (i = 0; i < 16; i += 1) {
+
+        fprintf( Trace, "f %u\n", Streams[i] );
+    }
+
+    for (i = 0; i < LiveCount; i += 1) {
+
+        fprintf( Trace, "f %u\n", Live[i] );
+    }
+
+    free( Live );
+
+    fseek( Trace, 0, SEEK_SET );
+    fprintf( Trace, "%s %10u\n", BENCH_TRACE_SIGNATURE, Files );
+
+    if (fclose( Trace ) != 0) {
+
+        fprintf( stderr, "fatbench: cannot write %s\n", TracePath );
+        return FALSE;
+    }
+
+    printf( "fatbench: wrote a trace of %u files to %s\n", Files, TracePath );
+
+    return TRUE;
+}
+
+
+//
+//  Local support routine
+//
+
+BOOLEAN
+BenchReplayTrace (
+    IN PCSTR TracePath
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads an allocation trace and replays it against the
+    mounted volume, reporting each phase as it ends.  Allocation left over
+    at the end of the trace is freed, so the volume is left as it was
+    found.
+
+Arguments:
+
+    TracePath - Supplies the trace to replay.
+
+Return Value:
+
+    BOOLEAN - TRUE if the whole trace was replayed.
+
+--*/
+
+{
+    FILE *Trace;
+    char Line[128];
+    PBENCH_TRACE_OP Ops = NULL;
+    ULONG OpCount = 0;
+    ULONG OpsAllocated = 0;
+    PBENCH_TRACE_FILE Files;
+    ULONG FileCount;
+    PBENCH_TRACE_OP Op;
+    PCSTR Phase = NULL;
+    ULONG PhaseOps = 0;
+    ULONG PhaseAllocations = 0;
+    ULONG PhaseRuns = 0;
+    ULONG Runs;
+    double Start = 0;
+    char Note[64];
+    ULONG LineNumber = 1;
+    ULONG i;
+
+    Trace = fopen( TracePath, "r" );
+
+    if (Trace == NULL) {
+
+        fprintf( stderr, "fatbench: cannot open %s\n", TracePath );
+        return FALSE;
+    }
+
+    if (fgets( Line, sizeof(Line), Trace ) == NULL ||
+        sscanf( Line, BENCH_TRACE_SIGNATURE " %u", &FileCount ) != 1) {
+
+        fprintf( stderr, "fatbench: %s is not an allocation trace\n", TracePath );
+        fclose( Trace );
+        return FALSE;
+    }
+
+    while (fgets( Line, sizeof(Line), Trace ) != NULL) {
+
+        BENCH_TRACE_OP NewOp = {0};
+        BOOLEAN Valid;
+
+        LineNumber += 1;
+        NewOp.Op = Line[0];
+
+        switch (NewOp.Op) {
+
+        case 'p': Valid = sscanf( Line, "p %15s", NewOp.Phase ) == 1; break;
+        case 'a': Valid = sscanf( Line, "a %u %u", &NewOp.File, &NewOp.Clusters ) == 2 && NewOp.Clusters != 0; break;
+        case 'f': Valid = sscanf( Line, "f %u", &NewOp.File ) == 1; break;
+        default: Valid = FALSE; break;
+        }
+
+        if (!Valid || NewOp.File >= FileCount) {
+
+            fprintf( stderr, "fatbench: %s line %u is not a trace operation\n", TracePath, LineNumber );
+            fclose( Trace );
+            free( Ops );
+            return FALSE;
+        }
+
+        if (OpCount == OpsAllocated) {
+
+            OpsAllocated = OpsAllocated ? OpsAllocated * 2 : 65536;
+            Ops = realloc( Ops, OpsAllocated * sizeof(BENCH_TRACE_OP) );
+
+            if (Ops == NULL) {
+
+                fclose( Trace );
+                return FALSE;
+            }
+        }
+
+        Ops[OpCount++] = NewOp;
+    }
+
+    fclose( Trace );
+
+    Files = calloc( FileCount, sizeof(BENCH_TRACE_FILE) );
+
+    if (Files == NULL) {
+
+        free( Ops );
+        return FALSE;
+    }
+
+    for (i = 0; i < FileCount; i += 1) {
+
+        FsRtlInitializeLargeMcb( &Files[i].Mcb, PagedPool );
+    }
+
+    printf( "%-8s %10s %10s %12s\n", "phase", "ops", "seconds", "ops/s" );
+
+    //
+    //  A sentinel phase after the last operation reports the last phase.
+    //
+
+    for (Op = Ops; Op <= Ops + OpCount; Op += 1) {
+
+        if (Op == Ops + OpCount || Op->Op == 'p') {
+
+            if (Phase != NULL) {
+
+                snprintf( Note, sizeof(Note), "%.3f runs/allocation",
+                          PhaseAllocations ? (double)PhaseRuns / PhaseAllocations : 0.0 );
+
+                BenchReport( Phase,
+                             PhaseOps,
+                             BenchNow() - Start,
+                             PhaseAllocations ? Note : NULL );
+            }
+
+            if (Op == Ops + OpCount) {
+
+                break;
+            }
+
+            Phase = Op->Phase;
+            PhaseOps = PhaseAllocations = PhaseRuns = 0;
+            Start = BenchNow();
+            continue;
+        }
+
+        if (Op->Op == 'a') {
+
+            if (Op->Clusters > BenchVcb->AllocationSupport.NumberOfFreeClusters) {
+
+                fprintf( stderr, "fatbench: the volume is too full for the trace\n" );
+                break;
+            }
+
+            BenchReplayAllocate( &Files[Op->File], Op->Clusters, &Runs );
+
+            PhaseAllocations += 1;
+            PhaseRuns += Runs;
+
+        } else {
+
+            BenchReplayFree( &Files[Op->File] );
+        }
+
+        PhaseOps += 1;
+    }
+
+    for (i = 0; i < FileCount; i += 1) {
+
+        BenchReplayFree( &Files[i] );
+        FsRtlUninitializeLargeMcb( &Files[i].Mcb );
+    }
+
+    free( Files );
+    free( Ops );
+
+    return Op == Ops + OpCount;
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+BenchReplayAllocate (
+    IN PBENCH_TRACE_FILE File,
+    IN ULONG Clusters,
+    OUT PULONG Runs
+    )
+
+/*++
+
+Routine Description:
+
+    This routine adds clusters to the end of a file's allocation as
+    FatAddFileAllocation does: the first allocation of a file takes the
+    volume's hint, and each later one asks for the cluster following the
+    file's last and is merged onto its Mcb.
+
+Arguments:
+
+    File - Supplies the file to extend.
+
+    Clusters - Supplies the number of clusters to add.
+
+    Runs - Receives the number of runs the new allocation came back in.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PIRP_CONTEXT IrpContext;
+    LARGE_MCB NewMcb;
+    ULONG ByteCount;
+    VBO DontCare;
+    LBO LastAllocatedLbo;
+
+    ByteCount = Clusters << BenchVcb->AllocationSupport.LogOfBytesPerCluster;
+
+    IrpContext = FatHostCreateIrpContext( BenchVcb, IRP_MJ_WRITE );
+    (VOID)FatAcquireExclusiveVcb( IrpContext, BenchVcb );
+
+    if (File->Clusters == 0) {
+
+        FatAllocateDiskSpace( IrpContext, BenchVcb, 0, &ByteCount, FALSE, &File->Mcb );
+
+        *Runs = FsRtlNumberOfRunsInLargeMcb( &File->Mcb );
+
+    } else {
+
+        (VOID)FatLookupLastMcbEntry( BenchVcb, &File->Mcb, &DontCare, &LastAllocatedLbo, NULL );
+
+        FsRtlInitializeLargeMcb( &NewMcb, PagedPool );
+
+        FatAllocateDiskSpace( IrpContext,
+                              BenchVcb,
+                              FatGetIndexFromLbo( BenchVcb, LastAllocatedLbo + 1 ),
+                              &ByteCount,
+                              FALSE,
+                              &NewMcb );
+
+        *Runs = FsRtlNumberOfRunsInLargeMcb( &NewMcb );
+
+        FatMergeAllocation( IrpContext, BenchVcb, &File->Mcb, &NewMcb );
+        FsRtlUninitializeLargeMcb( &NewMcb );
+    }
+
+    File->Clusters += Clusters;
+
+    FatReleaseVcb( IrpContext, BenchVcb );
+    FatHostCompleteRequest( IrpContext );
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+BenchReplayFree (
+    IN PBENCH_TRACE_FILE File
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees all of a file's allocation, as truncating it to
+    zero does.
+
+Arguments:
+
+    File - Supplies the file to free.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PIRP_CONTEXT IrpContext;
+
+    if (File->Clusters == 0) {
+
+        return;
+    }
+
+    IrpContext = FatHostCreateIrpContext( BenchVcb, IRP_MJ_CLEANUP );
+    (VOID)FatAcquireExclusiveVcb( IrpContext, BenchVcb );
+
+    FatDeallocateDiskSpace( IrpContext, BenchVcb, &File->Mcb );
+
+    FsRtlTruncateLargeMcb( &File->Mcb, 0 );
+    File->Clusters = 0;
+
+    FatReleaseVcb( IrpContext, BenchVcb );
+    FatHostCompleteRequest( IrpContext );
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+BenchUsage (
+    VOID
+    )
+{
+    fprintf( stderr,
+             "usage: fatbench [-f] [-s MB] [-c bytes] [-n files] [-a files] [-r rounds]\n"
+             "                [-d depth] [-w width] [-l lookups] [-S seed] image\n"
+             "       fatbench [-f] [-s MB] [-c bytes] [-S seed] -g trace image\n"
+             "       fatbench [-f] [-s MB] [-c bytes] -t trace image\n"
+             "\n"
+             "  -f          format the image first, creating it if need be\n"
+             "  -s MB       size of the image to format (1024)\n"
+             "  -c bytes    cluster size to format with (4096)\n"
+             "  -n files    files to create and then delete (20000)\n"
+             "  -a files    files to append to in turn (64)\n"
+             "  -r rounds   clusters to append to each of them (256)\n"
+             "  -d depth    levels in the lookup tree (8)\n"
+             "  -w width    files in each level of the tree (2000)\n"
+             "  -l lookups  random opens to make in the tree (20000)\n"
+             "  -S seed     seed for the random opens and the trace (1)\n"
+             "  -g trace    write an allocation trace sized to the volume and stop\n"
+             "  -t trace    replay an allocation trace instead of the phases above\n" );
+}
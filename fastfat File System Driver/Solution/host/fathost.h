@@ -0,0 +1,129 @@
+/*++
+
+Copyright (c) 1989-2000 Microsoft Corporation
+
+Module Name:
+
+    FatHost.h
+
+Abstract:
+
+    This module defines the interface between the pieces of the host build:
+    the image file that stands in for the disk, the cache manager that maps
+    streams onto it, and the mount and dismount support the benchmark uses.
+
+    It is included after FatProcs.h by the host modules that need the Fat
+    structures.
+
+
+--*/
+
+#ifndef _FATHOST_
+#define _FATHOST_
+
+//
+//  The image file backing the volume.  The whole image is mapped shared,
+//  so a byte offset on the disk is a byte offset from FatHostImage.
+//
+
+typedef struct _HOST_IMAGE {
+
+    int Fd;
+
+    PUCHAR Base;
+
+    ULONGLONG Size;
+
+    ULONG BytesPerSector;
+
+    //
+    //  The disk device and volume parameter block the mount is handed, as
+    //  the I/O manager would have built them for a partition.
+    //
+
+    DEVICE_OBJECT DiskDevice;
+
+    VPB Vpb;
+
+} HOST_IMAGE, *PHOST_IMAGE;
+
+extern HOST_IMAGE FatHostImage;
+
+//
+//  Image support, in HostVol.c.
+//
+
+NTSTATUS
+FatHostFormatImage (
+    IN PCSTR Path,
+    IN ULONGLONG Size,
+    IN ULONG BytesPerCluster
+    );
+
+NTSTATUS
+FatHostOpenImage (
+    IN PCSTR Path
+    );
+
+VOID
+FatHostCloseImage (
+    VOID
+    );
+
+//
+//  Driver and volume support, in HostVol.c.  FatHostInitialize does what
+//  DriverEntry does for the global data, and mount and dismount drive the
+//  real FatMountVolume and the close path for the internal streams.
+//
+
+VOID
+FatHostInitialize (
+    VOID
+    );
+
+PVCB
+FatHostMount (
+    VOID
+    );
+
+VOID
+FatHostDismount (
+    IN PVCB Vcb
+    );
+
+PIRP_CONTEXT
+FatHostCreateIrpContext (
+    IN PVCB Vcb,
+    IN UCHAR MajorFunction
+    );
+
+VOID
+FatHostCompleteRequest (
+    IN PIRP_CONTEXT IrpContext
+    );
+
+VOID
+FatHostCloseStreamFile (
+    IN PFILE_OBJECT FileObject
+    );
+
+//
+//  Irp support, in HostShim.c.  The Irp has a stack location for the file
+//  system, which is current, and one below it for the disk.
+//
+
+PIRP
+HostAllocateIrp (
+    VOID
+    );
+
+//
+//  Cache support, in HostCc.c.
+//
+
+VOID
+FatHostFlushAllCacheMaps (
+    VOID
+    );
+
+#endif // _FATHOST_
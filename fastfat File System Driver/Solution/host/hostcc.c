@@ -0,0 +1,1098 @@
+/*++
+
+Copyright (c) 1989-2000 Microsoft Corporation
+
+Module Name:
+
+    HostCc.c
+
+Abstract:
+
+    This module implements the cache manager routines the host build of Fat
+    calls.
+
+    The volume stream is not cached at all: its pins point straight into
+    the mapped image, so Fat and dirent updates through it land on the
+    image as they are made.  Every other stream (the directory and Ea
+    streams) gets a shared cache map of VACB_MAPPING_GRANULARITY chunks,
+    filled a page at a time through the stream's Mcb and written back the
+    same way when it is flushed, uninitialized for the last time or when
+    the volume is dismounted.
+
+    Bcbs are counted pins of a range of one stream.  A pin never crosses a
+    chunk boundary, as no pin the cache manager hands out crosses a view.
+
+
+--*/
+
+#include "FatProcs.h"
+#include "fathost.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HOST_PAGES_PER_CHUNK             (VACB_MAPPING_GRANULARITY / PAGE_SIZE)
+
+//
+//  A chunk of a cached stream.  A page's bit is set in Valid once it has
+//  been read or zeroed, and in Dirty once it has been changed.
+//
+
+typedef struct _HOST_CACHE_CHUNK {
+
+    ULONGLONG Valid;
+    ULONGLONG Dirty;
+
+    UCHAR Data[VACB_MAPPING_GRANULARITY];
+
+} HOST_CACHE_CHUNK, *PHOST_CACHE_CHUNK;
+
+//
+//  The shared cache map of a stream, hung from its section object
+//  pointers.  Fcb is the file the stream belongs to, whose Mcb gives the
+//  stream's layout on the disk.
+//
+
+typedef struct _HOST_CACHE_MAP {
+
+    LIST_ENTRY Links;
+
+    PSECTION_OBJECT_POINTERS SectionObjectPointer;
+
+    PFCB Fcb;
+
+    ULONG OpenCount;
+
+    LONGLONG AllocationSize;
+
+    ULONG ChunkCount;
+
+    PHOST_CACHE_CHUNK *Chunks;
+
+} HOST_CACHE_MAP, *PHOST_CACHE_MAP;
+
+//
+//  A pinned or mapped range.  CacheMap is NULL for a range of the volume
+//  stream.
+//
+
+typedef struct _HOST_BCB {
+
+    PFILE_OBJECT FileObject;
+
+    PHOST_CACHE_MAP CacheMap;
+
+    LONGLONG Offset;
+
+    ULONG Length;
+
+    LONG PinCount;
+
+} HOST_BCB, *PHOST_BCB;
+
+//
+//  Every shared cache map, for flushing the lot at dismount.
+//
+
+LIST_ENTRY HostCacheMaps = { &HostCacheMaps, &HostCacheMaps };
+
+//
+//  Local support routines
+//
+
+BOOLEAN
+HostIsVolumeStream (
+    IN PFILE_OBJECT FileObject
+    );
+
+PVOID
+HostPinRange (
+    IN PFILE_OBJECT FileObject,
+    IN PLARGE_INTEGER FileOffset,
+    IN ULONG Length,
+    OUT PVOID *Bcb
+    );
+
+PHOST_CACHE_CHUNK
+HostGetChunk (
+    IN PHOST_CACHE_MAP CacheMap,
+    IN ULONG ChunkIndex
+    );
+
+ULONGLONG
+HostPageMask (
+    IN ULONG Offset,
+    IN ULONG Length
+    );
+
+VOID
+HostTransferPage (
+    IN PHOST_CACHE_MAP CacheMap,
+    IN PHOST_CACHE_CHUNK Chunk,
+    IN ULONG ChunkIndex,
+    IN ULONG Page,
+    IN BOOLEAN Write
+    );
+
+VOID
+HostWriteBack (
+    IN PHOST_CACHE_MAP CacheMap,
+    IN LONGLONG Offset,
+    IN LONGLONG Length
+    );
+
+VOID
+HostDiscard (
+    IN PHOST_CACHE_MAP CacheMap,
+    IN LONGLONG Offset
+    );
+
+
+//
+//  Cache maps
+//
+
+VOID
+CcInitializeCacheMap (
+    IN PFILE_OBJECT FileObject,
+    IN PCC_FILE_SIZES FileSizes,
+    IN BOOLEAN PinAccess,
+    IN PCACHE_MANAGER_CALLBACKS Callbacks,
+    IN PVOID LazyWriteContext
+    )
+{
+    PHOST_CACHE_MAP CacheMap;
+
+    UNREFERENCED_PARAMETER( PinAccess );
+    UNREFERENCED_PARAMETER( Callbacks );
+    UNREFERENCED_PARAMETER( LazyWriteContext );
+
+    if (FileObject->PrivateCacheMap != NULL) {
+
+        return;
+    }
+
+    if (HostIsVolumeStream( FileObject )) {
+
+        FileObject->PrivateCacheMap = &FatHostImage;
+        return;
+    }
+
+    CacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+
+    if (CacheMap == NULL) {
+
+        CacheMap = FsRtlAllocatePoolWithTag( PagedPool, sizeof(HOST_CACHE_MAP), 'mcHF' );
+        RtlZeroMemory( CacheMap, sizeof(HOST_CACHE_MAP) );
+
+        CacheMap->SectionObjectPointer = FileObject->SectionObjectPointer;
+        CacheMap->Fcb = FileObject->FsContext;
+        CacheMap->AllocationSize = FileSizes->AllocationSize.QuadPart;
+
+        InsertTailList( &HostCacheMaps, &CacheMap->Links );
+
+        FileObject->SectionObjectPointer->SharedCacheMap = CacheMap;
+    }
+
+    CacheMap->OpenCount += 1;
+
+    FileObject->PrivateCacheMap = CacheMap;
+}
+
+BOOLEAN
+CcUninitializeCacheMap (
+    IN PFILE_OBJECT FileObject,
+    IN PLARGE_INTEGER TruncateSize OPTIONAL,
+    IN PCACHE_UNINITIALIZE_EVENT UninitializeCompleteEvent OPTIONAL
+    )
+{
+    PHOST_CACHE_MAP CacheMap;
+    ULONG i;
+
+    if (FileObject->PrivateCacheMap != NULL &&
+        !HostIsVolumeStream( FileObject )) {
+
+        CacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+
+        if (ARGUMENT_PRESENT( TruncateSize )) {
+
+            HostDiscard( CacheMap, TruncateSize->QuadPart );
+        }
+
+        //
+        //  The last close of the stream writes back what is left and
+        //  deletes the shared cache map, as the lazy writer would once the
+        //  section went away.
+        //
+
+        if (--CacheMap->OpenCount == 0) {
+
+            HostWriteBack( CacheMap, 0, MAXLONGLONG );
+
+            RemoveEntryList( &CacheMap->Links );
+
+            for (i = 0; i < CacheMap->ChunkCount; i += 1) {
+
+                if (CacheMap->Chunks[i] != NULL) {
+
+                    ExFreePool( CacheMap->Chunks[i] );
+                }
+            }
+
+            if (CacheMap->Chunks != NULL) {
+
+                ExFreePool( CacheMap->Chunks );
+            }
+
+            CacheMap->SectionObjectPointer->SharedCacheMap = NULL;
+
+            ExFreePool( CacheMap );
+        }
+    }
+
+    FileObject->PrivateCacheMap = NULL;
+
+    if (ARGUMENT_PRESENT( UninitializeCompleteEvent )) {
+
+        KeSetEvent( &UninitializeCompleteEvent->Event, 0, FALSE );
+    }
+
+    return TRUE;
+}
+
+VOID
+CcSetFileSizes (
+    IN PFILE_OBJECT FileObject,
+    IN PCC_FILE_SIZES FileSizes
+    )
+{
+    PHOST_CACHE_MAP CacheMap;
+
+    if (HostIsVolumeStream( FileObject ) ||
+        FileObject->SectionObjectPointer == NULL ||
+        FileObject->SectionObjectPointer->SharedCacheMap == NULL) {
+
+        return;
+    }
+
+    CacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+
+    //
+    //  Pages past a shrunken allocation no longer map to the stream.
+    //
+
+    if (FileSizes->AllocationSize.QuadPart < CacheMap->AllocationSize) {
+
+        HostDiscard( CacheMap, FileSizes->AllocationSize.QuadPart );
+    }
+
+    CacheMap->AllocationSize = FileSizes->AllocationSize.QuadPart;
+}
+
+VOID
+CcSetAdditionalCacheAttributes (
+    IN PFILE_OBJECT FileObject,
+    IN BOOLEAN DisableReadAhead,
+    IN BOOLEAN DisableWriteBehind
+    )
+{
+    UNREFERENCED_PARAMETER( FileObject );
+    UNREFERENCED_PARAMETER( DisableReadAhead );
+    UNREFERENCED_PARAMETER( DisableWriteBehind );
+}
+
+VOID
+CcSetAdditionalCacheAttributesEx (
+    IN PFILE_OBJECT FileObject,
+    IN ULONG Flags
+    )
+{
+    UNREFERENCED_PARAMETER( FileObject );
+    UNREFERENCED_PARAMETER( Flags );
+}
+
+
+//
+//  Pinning and mapping
+//
+
+BOOLEAN
+CcMapData (
+    IN PFILE_OBJECT FileObject,
+    IN PLARGE_INTEGER FileOffset,
+    IN ULONG Length,
+    IN ULONG Flags,
+    OUT PVOID *Bcb,
+    OUT PVOID *Buffer
+    )
+{
+    UNREFERENCED_PARAMETER( Flags );
+
+    *Buffer = HostPinRange( FileObject, FileOffset, Length, Bcb );
+
+    return TRUE;
+}
+
+BOOLEAN
+CcPinRead (
+    IN PFILE_OBJECT FileObject,
+    IN PLARGE_INTEGER FileOffset,
+    IN ULONG Length,
+    IN ULONG Flags,
+    OUT PVOID *Bcb,
+    OUT PVOID *Buffer
+    )
+{
+    UNREFERENCED_PARAMETER( Flags );
+
+    *Buffer = HostPinRange( FileObject, FileOffset, Length, Bcb );
+
+    return TRUE;
+}
+
+BOOLEAN
+CcPinMappedData (
+    IN PFILE_OBJECT FileObject,
+    IN PLARGE_INTEGER FileOffset,
+    IN ULONG Length,
+    IN ULONG Flags,
+    IN OUT PVOID *Bcb
+    )
+{
+    //
+    //  Mapped and pinned ranges are the same thing here.
+    //
+
+    UNREFERENCED_PARAMETER( FileObject );
+    UNREFERENCED_PARAMETER( FileOffset );
+    UNREFERENCED_PARAMETER( Length );
+    UNREFERENCED_PARAMETER( Flags );
+    UNREFERENCED_PARAMETER( Bcb );
+
+    return TRUE;
+}
+
+BOOLEAN
+CcPreparePinWrite (
+    IN PFILE_OBJECT FileObject,
+    IN PLARGE_INTEGER FileOffset,
+    IN ULONG Length,
+    IN BOOLEAN Zero,
+    IN ULONG Flags,
+    OUT PVOID *Bcb,
+    OUT PVOID *Buffer
+    )
+{
+    UNREFERENCED_PARAMETER( Flags );
+
+    *Buffer = HostPinRange( FileObject, FileOffset, Length, Bcb );
+
+    if (Zero) {
+
+        RtlZeroMemory( *Buffer, Length );
+    }
+
+    CcSetDirtyPinnedData( *Bcb, NULL );
+
+    return TRUE;
+}
+
+VOID
+CcSetDirtyPinnedData (
+    IN PVOID BcbVoid,
+    IN PLARGE_INTEGER Lsn OPTIONAL
+    )
+{
+    PHOST_BCB Bcb = BcbVoid;
+    PHOST_CACHE_CHUNK Chunk;
+    ULONG ChunkOffset;
+
+    UNREFERENCED_PARAMETER( Lsn );
+
+    if (Bcb->CacheMap == NULL) {
+
+        return;
+    }
+
+    Chunk = Bcb->CacheMap->Chunks[ Bcb->Offset / VACB_MAPPING_GRANULARITY ];
+    ChunkOffset = (ULONG)(Bcb->Offset % VACB_MAPPING_GRANULARITY);
+
+    Chunk->Dirty |= HostPageMask( ChunkOffset, Bcb->Length );
+}
+
+VOID
+CcRepinBcb (
+    IN PVOID Bcb
+    )
+{
+    ((PHOST_BCB)Bcb)->PinCount += 1;
+}
+
+VOID
+CcUnpinData (
+    IN PVOID Bcb
+    )
+{
+    if (--((PHOST_BCB)Bcb)->PinCount == 0) {
+
+        ExFreePool( Bcb );
+    }
+}
+
+VOID
+CcUnpinRepinnedBcb (
+    IN PVOID BcbVoid,
+    IN BOOLEAN WriteThrough,
+    OUT PIO_STATUS_BLOCK IoStatus
+    )
+{
+    PHOST_BCB Bcb = BcbVoid;
+
+    if (WriteThrough && Bcb->CacheMap != NULL) {
+
+        HostWriteBack( Bcb->CacheMap, Bcb->Offset, Bcb->Length );
+    }
+
+    IoStatus->Status = STATUS_SUCCESS;
+    IoStatus->Information = 0;
+
+    CcUnpinData( Bcb );
+}
+
+PFILE_OBJECT
+CcGetFileObjectFromBcb (
+    IN PVOID Bcb
+    )
+{
+    return ((PHOST_BCB)Bcb)->FileObject;
+}
+
+
+//
+//  Flushing, purging and zeroing
+//
+
+VOID
+CcFlushCache (
+    IN PSECTION_OBJECT_POINTERS SectionObjectPointer,
+    IN PLARGE_INTEGER FileOffset OPTIONAL,
+    IN ULONG Length,
+    OUT PIO_STATUS_BLOCK IoStatus OPTIONAL
+    )
+{
+    PHOST_CACHE_MAP CacheMap = SectionObjectPointer->SharedCacheMap;
+
+    if (CacheMap != NULL && CacheMap->SectionObjectPointer == SectionObjectPointer) {
+
+        if (ARGUMENT_PRESENT( FileOffset )) {
+
+            HostWriteBack( CacheMap, FileOffset->QuadPart, Length );
+
+        } else {
+
+            HostWriteBack( CacheMap, 0, MAXLONGLONG );
+        }
+    }
+
+    if (ARGUMENT_PRESENT( IoStatus )) {
+
+        IoStatus->Status = STATUS_SUCCESS;
+        IoStatus->Information = 0;
+    }
+}
+
+BOOLEAN
+CcPurgeCacheSection (
+    IN PSECTION_OBJECT_POINTERS SectionObjectPointer,
+    IN PLARGE_INTEGER FileOffset OPTIONAL,
+    IN ULONG Length,
+    IN ULONG Flags
+    )
+{
+    PHOST_CACHE_MAP CacheMap = SectionObjectPointer->SharedCacheMap;
+
+    UNREFERENCED_PARAMETER( Length );
+    UNREFERENCED_PARAMETER( Flags );
+
+    if (CacheMap != NULL && CacheMap->SectionObjectPointer == SectionObjectPointer) {
+
+        HostDiscard( CacheMap, ARGUMENT_PRESENT( FileOffset ) ? FileOffset->QuadPart : 0 );
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+CcZeroData (
+    IN PFILE_OBJECT FileObject,
+    IN PLARGE_INTEGER StartOffset,
+    IN PLARGE_INTEGER EndOffset,
+    IN BOOLEAN Wait
+    )
+{
+    LONGLONG Offset = StartOffset->QuadPart;
+    PVOID Bcb;
+    PVOID Buffer;
+    ULONG Length;
+    LARGE_INTEGER PinOffset;
+
+    UNREFERENCED_PARAMETER( Wait );
+
+    //
+    //  Zero a chunk at a time through pins, so the pages are read in and
+    //  marked dirty as any other change would be.
+    //
+
+    while (Offset < EndOffset->QuadPart) {
+
+        Length = (ULONG)min( EndOffset->QuadPart - Offset,
+                             VACB_MAPPING_GRANULARITY - (Offset % VACB_MAPPING_GRANULARITY) );
+
+        PinOffset.QuadPart = Offset;
+
+        Buffer = HostPinRange( FileObject, &PinOffset, Length, &Bcb );
+
+        RtlZeroMemory( Buffer, Length );
+
+        CcSetDirtyPinnedData( Bcb, NULL );
+        CcUnpinData( Bcb );
+
+        Offset += Length;
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+CcIsThereDirtyData (
+    IN PVPB Vpb
+    )
+{
+    PLIST_ENTRY Links;
+    ULONG i;
+
+    UNREFERENCED_PARAMETER( Vpb );
+
+    for (Links = HostCacheMaps.Flink; Links != &HostCacheMaps; Links = Links->Flink) {
+
+        PHOST_CACHE_MAP CacheMap = CONTAINING_RECORD( Links, HOST_CACHE_MAP, Links );
+
+        for (i = 0; i < CacheMap->ChunkCount; i += 1) {
+
+            if (CacheMap->Chunks[i] != NULL && CacheMap->Chunks[i]->Dirty != 0) {
+
+                return TRUE;
+            }
+        }
+    }
+
+    return FALSE;
+}
+
+BOOLEAN
+CcCanIWrite (
+    IN PFILE_OBJECT FileObject,
+    IN ULONG BytesToWrite,
+    IN BOOLEAN Wait,
+    IN UCHAR Retrying
+    )
+{
+    UNREFERENCED_PARAMETER( FileObject );
+    UNREFERENCED_PARAMETER( BytesToWrite );
+    UNREFERENCED_PARAMETER( Wait );
+    UNREFERENCED_PARAMETER( Retrying );
+
+    return TRUE;
+}
+
+NTSTATUS
+CcWaitForCurrentLazyWriterActivity (
+    VOID
+    )
+{
+    return STATUS_SUCCESS;
+}
+
+VOID
+CcMdlReadComplete (
+    IN PFILE_OBJECT FileObject,
+    IN PMDL MdlChain
+    )
+{
+    UNREFERENCED_PARAMETER( FileObject );
+    UNREFERENCED_PARAMETER( MdlChain );
+}
+
+VOID
+CcMdlWriteComplete (
+    IN PFILE_OBJECT FileObject,
+    IN PLARGE_INTEGER FileOffset,
+    IN PMDL MdlChain
+    )
+{
+    UNREFERENCED_PARAMETER( FileObject );
+    UNREFERENCED_PARAMETER( FileOffset );
+    UNREFERENCED_PARAMETER( MdlChain );
+}
+
+VOID
+CcMdlWriteAbort (
+    IN PFILE_OBJECT FileObject,
+    IN PMDL MdlChain
+    )
+{
+    UNREFERENCED_PARAMETER( FileObject );
+    UNREFERENCED_PARAMETER( MdlChain );
+}
+
+
+//
+//  Host support
+//
+
+VOID
+FatHostFlushAllCacheMaps (
+    VOID
+    )
+{
+    PLIST_ENTRY Links;
+
+    for (Links = HostCacheMaps.Flink; Links != &HostCacheMaps; Links = Links->Flink) {
+
+        HostWriteBack( CONTAINING_RECORD( Links, HOST_CACHE_MAP, Links ), 0, MAXLONGLONG );
+    }
+}
+
+
+//
+//  Local support routine
+//
+
+BOOLEAN
+HostIsVolumeStream (
+    IN PFILE_OBJECT FileObject
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tells whether a stream is the volume file, whose ranges
+    are the image itself.
+
+--*/
+
+{
+    return (FileObject->FsContext != NULL &&
+            NodeType( FileObject->FsContext ) == FAT_NTC_VCB);
+}
+
+
+//
+//  Local support routine
+//
+
+PVOID
+HostPinRange (
+    IN PFILE_OBJECT FileObject,
+    IN PLARGE_INTEGER FileOffset,
+    IN ULONG Length,
+    OUT PVOID *Bcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine pins a range of a stream, reading in any of its pages that
+    are not yet in the cache.
+
+Arguments:
+
+    FileObject - Supplies the stream.
+
+    FileOffset - Supplies the start of the range.
+
+    Length - Supplies the length of the range.
+
+    Bcb - Receives the new Bcb for the range.
+
+Return Value:
+
+    PVOID - The range in memory.
+
+--*/
+
+{
+    PHOST_BCB NewBcb;
+    PHOST_CACHE_MAP CacheMap = NULL;
+    PHOST_CACHE_CHUNK Chunk;
+    LONGLONG Offset = FileOffset->QuadPart;
+    ULONG ChunkIndex;
+    ULONG ChunkOffset;
+    ULONGLONG Missing;
+    PVOID Buffer;
+    ULONG Page;
+
+    if (Length == 0) {
+
+        Length = 1;
+    }
+
+    if (HostIsVolumeStream( FileObject )) {
+
+        if (Offset < 0 || (ULONGLONG)Offset + Length > FatHostImage.Size) {
+
+            fprintf( stderr, "fathost: pin of %llx bytes at %llx is off the volume\n",
+                     (unsigned long long)Length, (unsigned long long)Offset );
+            abort();
+        }
+
+        Buffer = FatHostImage.Base + Offset;
+
+    } else {
+
+        CacheMap = FileObject->SectionObjectPointer->SharedCacheMap;
+
+        ChunkIndex = (ULONG)(Offset / VACB_MAPPING_GRANULARITY);
+        ChunkOffset = (ULONG)(Offset % VACB_MAPPING_GRANULARITY);
+
+        if (CacheMap == NULL ||
+            Offset < 0 ||
+            ChunkOffset + Length > VACB_MAPPING_GRANULARITY) {
+
+            fprintf( stderr, "fathost: pin of %llx bytes at %llx does not fit a view\n",
+                     (unsigned long long)Length, (unsigned long long)Offset );
+            abort();
+        }
+
+        Chunk = HostGetChunk( CacheMap, ChunkIndex );
+
+        Missing = HostPageMask( ChunkOffset, Length ) & ~Chunk->Valid;
+
+        for (Page = 0; Missing != 0; Page += 1, Missing >>= 1) {
+
+            if (Missing & 1) {
+
+                HostTransferPage( CacheMap, Chunk, ChunkIndex, Page, FALSE );
+            }
+        }
+
+        Buffer = &Chunk->Data[ChunkOffset];
+    }
+
+    NewBcb = FsRtlAllocatePoolWithTag( PagedPool, sizeof(HOST_BCB), 'bcHF' );
+
+    NewBcb->FileObject = FileObject;
+    NewBcb->CacheMap = CacheMap;
+    NewBcb->Offset = Offset;
+    NewBcb->Length = Length;
+    NewBcb->PinCount = 1;
+
+    *Bcb = NewBcb;
+
+    return Buffer;
+}
+
+
+//
+//  Local support routine
+//
+
+PHOST_CACHE_CHUNK
+HostGetChunk (
+    IN PHOST_CACHE_MAP CacheMap,
+    IN ULONG ChunkIndex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns a chunk of a cache map, creating it empty if it
+    does not exist yet.
+
+--*/
+
+{
+    PHOST_CACHE_CHUNK *Chunks;
+    ULONG ChunkCount;
+
+    if (ChunkIndex >= CacheMap->ChunkCount) {
+
+        ChunkCount = max( ChunkIndex + 1, CacheMap->ChunkCount * 2 );
+
+        Chunks = FsRtlAllocatePoolWithTag( PagedPool, ChunkCount * sizeof(PHOST_CACHE_CHUNK), 'ccHF' );
+
+        RtlZeroMemory( Chunks, ChunkCount * sizeof(PHOST_CACHE_CHUNK) );
+
+        if (CacheMap->Chunks != NULL) {
+
+            RtlCopyMemory( Chunks, CacheMap->Chunks, CacheMap->ChunkCount * sizeof(PHOST_CACHE_CHUNK) );
+            ExFreePool( CacheMap->Chunks );
+        }
+
+        CacheMap->Chunks = Chunks;
+        CacheMap->ChunkCount = ChunkCount;
+    }
+
+    if (CacheMap->Chunks[ChunkIndex] == NULL) {
+
+        CacheMap->Chunks[ChunkIndex] = FsRtlAllocatePoolWithTag( PagedPool, sizeof(HOST_CACHE_CHUNK), 'ccHF' );
+
+        CacheMap->Chunks[ChunkIndex]->Valid = 0;
+        CacheMap->Chunks[ChunkIndex]->Dirty = 0;
+    }
+
+    return CacheMap->Chunks[ChunkIndex];
+}
+
+
+//
+//  Local support routine
+//
+
+ULONGLONG
+HostPageMask (
+    IN ULONG Offset,
+    IN ULONG Length
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the mask of the pages of a chunk that a range
+    within it touches.
+
+--*/
+
+{
+    ULONG First = Offset / PAGE_SIZE;
+    ULONG Count = (Offset + Length + PAGE_SIZE - 1) / PAGE_SIZE - First;
+
+    if (Count >= HOST_PAGES_PER_CHUNK) {
+
+        return ~0ULL;
+    }
+
+    return ((1ULL << Count) - 1) << First;
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+HostTransferPage (
+    IN PHOST_CACHE_MAP CacheMap,
+    IN PHOST_CACHE_CHUNK Chunk,
+    IN ULONG ChunkIndex,
+    IN ULONG Page,
+    IN BOOLEAN Write
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads a page of a stream into the cache, or writes it back
+    to the image, following the stream's Mcb as a paging read or write
+    would.  The part of a page beyond the stream's allocation reads as
+    zeroes and is not written.
+
+Arguments:
+
+    CacheMap - Supplies the stream's cache map.
+
+    Chunk - Supplies the chunk holding the page.
+
+    ChunkIndex - Supplies the chunk's index in the stream.
+
+    Page - Supplies the page's index in the chunk.
+
+    Write - Supplies TRUE to write the page back, FALSE to read it in.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PFCB Fcb = CacheMap->Fcb;
+    PUCHAR Data = &Chunk->Data[Page * PAGE_SIZE];
+    VBO Vbo = ChunkIndex * VACB_MAPPING_GRANULARITY + Page * PAGE_SIZE;
+    ULONG Remaining = PAGE_SIZE;
+    ULONG ByteCount;
+    LBO Lbo;
+
+    if (!Write) {
+
+        RtlZeroMemory( Data, PAGE_SIZE );
+        Chunk->Valid |= 1ULL << Page;
+
+    } else {
+
+        Chunk->Dirty &= ~(1ULL << Page);
+    }
+
+    while (Remaining != 0) {
+
+        if (!FatLookupMcbEntry( Fcb->Vcb, &Fcb->Mcb, Vbo, &Lbo, &ByteCount, NULL ) ||
+            Lbo == 0) {
+
+            break;
+        }
+
+        ByteCount = min( ByteCount, Remaining );
+
+        if ((ULONGLONG)Lbo + ByteCount > FatHostImage.Size) {
+
+            fprintf( stderr, "fathost: stream maps off the volume at %lx\n", (unsigned long)Lbo );
+            abort();
+        }
+
+        if (Write) {
+
+            RtlCopyMemory( FatHostImage.Base + Lbo, Data, ByteCount );
+
+        } else {
+
+            RtlCopyMemory( Data, FatHostImage.Base + Lbo, ByteCount );
+        }
+
+        Data += ByteCount;
+        Vbo += ByteCount;
+        Remaining -= ByteCount;
+    }
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+HostWriteBack (
+    IN PHOST_CACHE_MAP CacheMap,
+    IN LONGLONG Offset,
+    IN LONGLONG Length
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes back the dirty pages of a range of a stream.
+
+Arguments:
+
+    CacheMap - Supplies the stream's cache map.
+
+    Offset - Supplies the start of the range.
+
+    Length - Supplies the length of the range, MAXLONGLONG for all of it.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PHOST_CACHE_CHUNK Chunk;
+    ULONGLONG FirstPage = Offset / PAGE_SIZE;
+    ULONGLONG LastPage;
+    ULONGLONG PageNumber;
+    ULONG ChunkIndex;
+    ULONG Page;
+
+    if (Length == MAXLONGLONG || Offset + Length > (LONGLONG)CacheMap->ChunkCount * VACB_MAPPING_GRANULARITY) {
+
+        LastPage = (ULONGLONG)CacheMap->ChunkCount * HOST_PAGES_PER_CHUNK;
+
+    } else {
+
+        LastPage = (Offset + Length + PAGE_SIZE - 1) / PAGE_SIZE;
+    }
+
+    for (PageNumber = FirstPage; PageNumber < LastPage; PageNumber += 1) {
+
+        ChunkIndex = (ULONG)(PageNumber / HOST_PAGES_PER_CHUNK);
+        Page = (ULONG)(PageNumber % HOST_PAGES_PER_CHUNK);
+
+        Chunk = CacheMap->Chunks[ChunkIndex];
+
+        if (Chunk == NULL || Chunk->Dirty == 0) {
+
+            PageNumber += HOST_PAGES_PER_CHUNK - Page - 1;
+            continue;
+        }
+
+        if (Chunk->Dirty & (1ULL << Page)) {
+
+            HostTransferPage( CacheMap, Chunk, ChunkIndex, Page, TRUE );
+        }
+    }
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+HostDiscard (
+    IN PHOST_CACHE_MAP CacheMap,
+    IN LONGLONG Offset
+    )
+
+/*++
+
+Routine Description:
+
+    This routine drops the pages of a stream from an offset on, without
+    writing them back.  A page the offset falls inside of is kept.
+
+Arguments:
+
+    CacheMap - Supplies the stream's cache map.
+
+    Offset - Supplies the offset to discard from.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    ULONGLONG FirstPage = (Offset + PAGE_SIZE - 1) / PAGE_SIZE;
+    ULONG ChunkIndex;
+    ULONG Page;
+
+    for (ChunkIndex = (ULONG)(FirstPage / HOST_PAGES_PER_CHUNK);
+         ChunkIndex < CacheMap->ChunkCount;
+         ChunkIndex += 1) {
+
+        PHOST_CACHE_CHUNK Chunk = CacheMap->Chunks[ChunkIndex];
+        ULONGLONG Keep = 0;
+
+        if (Chunk == NULL) {
+
+            continue;
+        }
+
+        if (ChunkIndex == FirstPage / HOST_PAGES_PER_CHUNK) {
+
+            Page = (ULONG)(FirstPage % HOST_PAGES_PER_CHUNK);
+            Keep = (1ULL << Page) - 1;
+        }
+
+        Chunk->Valid &= Keep;
+        Chunk->Dirty &= Keep;
+    }
+}
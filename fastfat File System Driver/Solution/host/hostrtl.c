@@ -0,0 +1,2196 @@
+/*++
+
+Copyright (c) 1989-2000 Microsoft Corporation
+
+Module Name:
+
+    HostRtl.c
+
+Abstract:
+
+    This module implements the run time library routines the host build of
+    Fat uses: bitmaps, splay trees, counted strings, time conversion, short
+    name generation, name legality and matching, and the large Mcb.
+
+    The Oem code page is taken to be Latin 1, so every Unicode character
+    below 0x100 has an Oem equivalent of the same value, and upcasing is
+    that of Latin 1.  This is enough for the names the benchmark builds and
+    for the ones a Linux mkfs.fat writes.
+
+    The bitmap and Mcb routines are on the allocation path, so they work a
+    word or a run at a time rather than a bit at a time.
+
+
+--*/
+
+#include "FatProcs.h"
+#include "fathost.h"
+
+#include <stdlib.h>
+
+//
+//  The length of a run of clear bits the bitmap scans below step over
+//  when a whole word is clear.
+//
+
+#define BITS_PER_WORD                    32
+
+//
+//  Local support routines
+//
+
+ULONG
+HostFindClearRun (
+    IN PRTL_BITMAP BitMapHeader,
+    IN ULONG From,
+    IN ULONG To,
+    IN ULONG NumberToFind
+    );
+
+VOID
+HostSplayRotate (
+    IN PRTL_SPLAY_LINKS Links
+    );
+
+BOOLEAN
+HostMatchExpression (
+    IN PCWCH Expression,
+    IN ULONG ExpressionLength,
+    IN PCWCH Name,
+    IN ULONG NameLength
+    );
+
+BOOLEAN
+HostIsShortNameCharacter (
+    IN WCHAR Character
+    );
+
+LONGLONG
+HostDaysFromCivil (
+    IN LONGLONG Year,
+    IN ULONG Month,
+    IN ULONG Day
+    );
+
+VOID
+HostSetMcbRange (
+    IN PLARGE_MCB Mcb,
+    IN LONGLONG Vbn,
+    IN LONGLONG Lbn,
+    IN LONGLONG SectorCount
+    );
+
+
+//
+//  Bitmap routines
+//
+
+VOID
+RtlInitializeBitMap (
+    IN PRTL_BITMAP BitMapHeader,
+    IN PULONG BitMapBuffer,
+    IN ULONG SizeOfBitMap
+    )
+{
+    BitMapHeader->SizeOfBitMap = SizeOfBitMap;
+    BitMapHeader->Buffer = BitMapBuffer;
+}
+
+VOID
+RtlClearAllBits (
+    IN PRTL_BITMAP BitMapHeader
+    )
+{
+    RtlZeroMemory( BitMapHeader->Buffer,
+                   ((BitMapHeader->SizeOfBitMap + 31) / 32) * sizeof(ULONG) );
+}
+
+VOID
+RtlSetAllBits (
+    IN PRTL_BITMAP BitMapHeader
+    )
+{
+    RtlFillMemory( BitMapHeader->Buffer,
+                   ((BitMapHeader->SizeOfBitMap + 31) / 32) * sizeof(ULONG),
+                   0xff );
+}
+
+VOID
+RtlClearBit (
+    IN PRTL_BITMAP BitMapHeader,
+    IN ULONG BitNumber
+    )
+{
+    BitMapHeader->Buffer[BitNumber / 32] &= ~(1u << (BitNumber % 32));
+}
+
+VOID
+RtlSetBit (
+    IN PRTL_BITMAP BitMapHeader,
+    IN ULONG BitNumber
+    )
+{
+    BitMapHeader->Buffer[BitNumber / 32] |= (1u << (BitNumber % 32));
+}
+
+BOOLEAN
+RtlTestBit (
+    IN PRTL_BITMAP BitMapHeader,
+    IN ULONG BitNumber
+    )
+{
+    return (BOOLEAN)((BitMapHeader->Buffer[BitNumber / 32] >> (BitNumber % 32)) & 1);
+}
+
+VOID
+RtlClearBits (
+    IN PRTL_BITMAP BitMapHeader,
+    IN ULONG StartingIndex,
+    IN ULONG NumberToClear
+    )
+{
+    ULONG Index = StartingIndex;
+    ULONG End = StartingIndex + NumberToClear;
+
+    NT_ASSERT( End <= BitMapHeader->SizeOfBitMap );
+
+    while (Index < End) {
+
+        if ((Index % 32) == 0 && (Index + 32) <= End) {
+
+            BitMapHeader->Buffer[Index / 32] = 0;
+            Index += 32;
+
+        } else {
+
+            RtlClearBit( BitMapHeader, Index );
+            Index += 1;
+        }
+    }
+}
+
+VOID
+RtlSetBits (
+    IN PRTL_BITMAP BitMapHeader,
+    IN ULONG StartingIndex,
+    IN ULONG NumberToSet
+    )
+{
+    ULONG Index = StartingIndex;
+    ULONG End = StartingIndex + NumberToSet;
+
+    NT_ASSERT( End <= BitMapHeader->SizeOfBitMap );
+
+    while (Index < End) {
+
+        if ((Index % 32) == 0 && (Index + 32) <= End) {
+
+            BitMapHeader->Buffer[Index / 32] = MAXULONG;
+            Index += 32;
+
+        } else {
+
+            RtlSetBit( BitMapHeader, Index );
+            Index += 1;
+        }
+    }
+}
+
+BOOLEAN
+RtlAreBitsClear (
+    IN PRTL_BITMAP BitMapHeader,
+    IN ULONG StartingIndex,
+    IN ULONG Length
+    )
+{
+    if (StartingIndex + Length > BitMapHeader->SizeOfBitMap ||
+        StartingIndex + Length < StartingIndex) {
+
+        return FALSE;
+    }
+
+    return (BOOLEAN)(HostFindClearRun( BitMapHeader,
+                                       StartingIndex,
+                                       StartingIndex + Length,
+                                       Length ) == StartingIndex);
+}
+
+BOOLEAN
+RtlAreBitsSet (
+    IN PRTL_BITMAP BitMapHeader,
+    IN ULONG StartingIndex,
+    IN ULONG Length
+    )
+{
+    ULONG Index;
+
+    if (StartingIndex + Length > BitMapHeader->SizeOfBitMap ||
+        StartingIndex + Length < StartingIndex) {
+
+        return FALSE;
+    }
+
+    for (Index = StartingIndex; Index < StartingIndex + Length; Index += 1) {
+
+        if (!RtlTestBit( BitMapHeader, Index )) {
+
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+ULONG
+RtlFindClearBits (
+    IN PRTL_BITMAP BitMapHeader,
+    IN ULONG NumberToFind,
+    IN ULONG HintIndex
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds a run of clear bits, looking from the hint to the
+    end of the bitmap and then from the start of the bitmap up to the hint,
+    as the kernel's does.
+
+Return Value:
+
+    ULONG - The index of the run, or 0xffffffff if there is none.
+
+--*/
+
+{
+    ULONG Size = BitMapHeader->SizeOfBitMap;
+    ULONG Index;
+
+    if (NumberToFind == 0) {
+
+        return HintIndex < Size ? HintIndex : 0;
+    }
+
+    if (NumberToFind > Size) {
+
+        return MAXULONG;
+    }
+
+    if (HintIndex >= Size) {
+
+        HintIndex = 0;
+    }
+
+    Index = HostFindClearRun( BitMapHeader, HintIndex, Size, NumberToFind );
+
+    if (Index == MAXULONG && HintIndex != 0) {
+
+        Index = HostFindClearRun( BitMapHeader,
+                                  0,
+                                  min( Size, HintIndex + NumberToFind - 1 ),
+                                  NumberToFind );
+    }
+
+    return Index;
+}
+
+ULONG
+RtlFindClearBitsAndSet (
+    IN PRTL_BITMAP BitMapHeader,
+    IN ULONG NumberToFind,
+    IN ULONG HintIndex
+    )
+{
+    ULONG Index = RtlFindClearBits( BitMapHeader, NumberToFind, HintIndex );
+
+    if (Index != MAXULONG) {
+
+        RtlSetBits( BitMapHeader, Index, NumberToFind );
+    }
+
+    return Index;
+}
+
+ULONG
+RtlFindLongestRunClear (
+    IN PRTL_BITMAP BitMapHeader,
+    OUT PULONG StartingIndex
+    )
+{
+    ULONG Size = BitMapHeader->SizeOfBitMap;
+    ULONG Index = 0;
+    ULONG RunStart = 0;
+    ULONG RunLength = 0;
+    ULONG BestLength = 0;
+
+    *StartingIndex = 0;
+
+    while (Index < Size) {
+
+        ULONG Word = BitMapHeader->Buffer[Index / 32];
+
+        if ((Index % 32) == 0 && (Index + 32) <= Size && (Word == 0 || Word == MAXULONG)) {
+
+            if (Word == 0) {
+
+                if (RunLength == 0) { RunStart = Index; }
+                RunLength += 32;
+
+            } else {
+
+                RunLength = 0;
+            }
+
+            Index += 32;
+
+        } else if (RtlTestBit( BitMapHeader, Index )) {
+
+            RunLength = 0;
+            Index += 1;
+
+        } else {
+
+            if (RunLength == 0) { RunStart = Index; }
+            RunLength += 1;
+            Index += 1;
+        }
+
+        if (RunLength > BestLength) {
+
+            BestLength = RunLength;
+            *StartingIndex = RunStart;
+        }
+    }
+
+    return BestLength;
+}
+
+ULONG
+RtlNumberOfClearBits (
+    IN PRTL_BITMAP BitMapHeader
+    )
+{
+    return BitMapHeader->SizeOfBitMap - RtlNumberOfSetBits( BitMapHeader );
+}
+
+ULONG
+RtlNumberOfSetBits (
+    IN PRTL_BITMAP BitMapHeader
+    )
+{
+    ULONG Size = BitMapHeader->SizeOfBitMap;
+    ULONG Count = 0;
+    ULONG Word;
+
+    for (Word = 0; Word < Size / 32; Word += 1) {
+
+        Count += __builtin_popcount( BitMapHeader->Buffer[Word] );
+    }
+
+    if (Size % 32) {
+
+        Count += __builtin_popcount( BitMapHeader->Buffer[Word] & ((1u << (Size % 32)) - 1) );
+    }
+
+    return Count;
+}
+
+
+//
+//  Local support routine
+//
+
+ULONG
+HostFindClearRun (
+    IN PRTL_BITMAP BitMapHeader,
+    IN ULONG From,
+    IN ULONG To,
+    IN ULONG NumberToFind
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the first run of clear bits of the given length that
+    starts at or after From and ends at or before To, stepping over whole
+    words that are all set or all clear.
+
+Return Value:
+
+    ULONG - The index of the run, or 0xffffffff if there is none.
+
+--*/
+
+{
+    ULONG Index = From;
+    ULONG RunStart = From;
+    ULONG RunLength = 0;
+
+    while (Index < To) {
+
+        if ((Index % BITS_PER_WORD) == 0 && (Index + BITS_PER_WORD) <= To) {
+
+            ULONG Word = BitMapHeader->Buffer[Index / BITS_PER_WORD];
+
+            if (Word == 0) {
+
+                if (RunLength == 0) { RunStart = Index; }
+
+                RunLength += BITS_PER_WORD;
+
+                if (RunLength >= NumberToFind) { return RunStart; }
+
+                Index += BITS_PER_WORD;
+                continue;
+            }
+
+            if (Word == MAXULONG) {
+
+                RunLength = 0;
+                Index += BITS_PER_WORD;
+                continue;
+            }
+        }
+
+        if (RtlTestBit( BitMapHeader, Index )) {
+
+            RunLength = 0;
+
+        } else {
+
+            if (RunLength == 0) { RunStart = Index; }
+
+            RunLength += 1;
+
+            if (RunLength >= NumberToFind) { return RunStart; }
+        }
+
+        Index += 1;
+    }
+
+    return MAXULONG;
+}
+
+
+//
+//  Splay tree routines
+//
+
+PRTL_SPLAY_LINKS
+RtlSplay (
+    IN PRTL_SPLAY_LINKS Links
+    )
+
+/*++
+
+Routine Description:
+
+    This routine splays a node to the root of its tree with the usual zig,
+    zig-zig and zig-zag steps.
+
+Return Value:
+
+    PRTL_SPLAY_LINKS - The node, which is now the root.
+
+--*/
+
+{
+    while (!RtlIsRoot( Links )) {
+
+        PRTL_SPLAY_LINKS Parent = RtlParent( Links );
+
+        if (RtlIsRoot( Parent )) {
+
+            HostSplayRotate( Links );
+
+        } else if (RtlIsLeftChild( Links ) == RtlIsLeftChild( Parent )) {
+
+            HostSplayRotate( Parent );
+            HostSplayRotate( Links );
+
+        } else {
+
+            HostSplayRotate( Links );
+            HostSplayRotate( Links );
+        }
+    }
+
+    return Links;
+}
+
+PRTL_SPLAY_LINKS
+RtlDelete (
+    IN PRTL_SPLAY_LINKS Links
+    )
+
+/*++
+
+Routine Description:
+
+    This routine removes a node from its tree.  The node is splayed to the
+    root and replaced by the greatest node of its left subtree, which has
+    no right child once it is splayed to the top of that subtree.
+
+Return Value:
+
+    PRTL_SPLAY_LINKS - The new root of the tree, or NULL if it is empty.
+
+--*/
+
+{
+    PRTL_SPLAY_LINKS Left;
+    PRTL_SPLAY_LINKS Right;
+    PRTL_SPLAY_LINKS Predecessor;
+
+    RtlSplay( Links );
+
+    Left = RtlLeftChild( Links );
+    Right = RtlRightChild( Links );
+
+    if (Left == NULL) {
+
+        if (Right != NULL) { Right->Parent = Right; }
+        return Right;
+    }
+
+    Left->Parent = Left;
+
+    for (Predecessor = Left;
+         RtlRightChild( Predecessor ) != NULL;
+         Predecessor = RtlRightChild( Predecessor )) {
+
+        NOTHING;
+    }
+
+    RtlSplay( Predecessor );
+
+    Predecessor->RightChild = Right;
+
+    if (Right != NULL) { Right->Parent = Predecessor; }
+
+    return Predecessor;
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+HostSplayRotate (
+    IN PRTL_SPLAY_LINKS Links
+    )
+
+/*++
+
+Routine Description:
+
+    This routine rotates a node above its parent.
+
+--*/
+
+{
+    PRTL_SPLAY_LINKS Parent = RtlParent( Links );
+    PRTL_SPLAY_LINKS GrandParent = RtlParent( Parent );
+    BOOLEAN ParentIsRoot = RtlIsRoot( Parent );
+
+    if (RtlLeftChild( Parent ) == Links) {
+
+        Parent->LeftChild = Links->RightChild;
+        if (Links->RightChild != NULL) { Links->RightChild->Parent = Parent; }
+        Links->RightChild = Parent;
+
+    } else {
+
+        Parent->RightChild = Links->LeftChild;
+        if (Links->LeftChild != NULL) { Links->LeftChild->Parent = Parent; }
+        Links->LeftChild = Parent;
+    }
+
+    if (ParentIsRoot) {
+
+        Links->Parent = Links;
+
+    } else {
+
+        if (RtlLeftChild( GrandParent ) == Parent) {
+
+            GrandParent->LeftChild = Links;
+
+        } else {
+
+            GrandParent->RightChild = Links;
+        }
+
+        Links->Parent = GrandParent;
+    }
+
+    Parent->Parent = Links;
+}
+
+
+//
+//  String routines
+//
+
+SIZE_T
+RtlCompareMemory (
+    IN const VOID *Source1,
+    IN const VOID *Source2,
+    IN SIZE_T Length
+    )
+{
+    const UCHAR *Left = Source1;
+    const UCHAR *Right = Source2;
+    SIZE_T Index;
+
+    for (Index = 0; Index < Length && Left[Index] == Right[Index]; Index += 1) {
+
+        NOTHING;
+    }
+
+    return Index;
+}
+
+WCHAR
+RtlUpcaseUnicodeChar (
+    IN WCHAR SourceCharacter
+    )
+{
+    if ((SourceCharacter >= 'a' && SourceCharacter <= 'z') ||
+        (SourceCharacter >= 0xe0 && SourceCharacter <= 0xfe && SourceCharacter != 0xf7)) {
+
+        return SourceCharacter - 0x20;
+    }
+
+    return SourceCharacter;
+}
+
+WCHAR
+RtlDowncaseUnicodeChar (
+    IN WCHAR SourceCharacter
+    )
+{
+    if ((SourceCharacter >= 'A' && SourceCharacter <= 'Z') ||
+        (SourceCharacter >= 0xc0 && SourceCharacter <= 0xde && SourceCharacter != 0xd7)) {
+
+        return SourceCharacter + 0x20;
+    }
+
+    return SourceCharacter;
+}
+
+CHAR
+RtlUpperChar (
+    IN CHAR Character
+    )
+{
+    return (CHAR)RtlUpcaseUnicodeChar( (UCHAR)Character );
+}
+
+NTSTATUS
+RtlUpcaseUnicodeString (
+    OUT PUNICODE_STRING DestinationString,
+    IN PCUNICODE_STRING SourceString,
+    IN BOOLEAN AllocateDestinationString
+    )
+{
+    ULONG Index;
+
+    if (AllocateDestinationString) {
+
+        DestinationString->MaximumLength = SourceString->Length;
+        DestinationString->Buffer = ExAllocatePoolWithTag( PagedPool, SourceString->Length + 1, 'rtsU' );
+
+    } else if (DestinationString->MaximumLength < SourceString->Length) {
+
+        return STATUS_BUFFER_OVERFLOW;
+    }
+
+    for (Index = 0; Index < SourceString->Length / sizeof(WCHAR); Index += 1) {
+
+        DestinationString->Buffer[Index] = RtlUpcaseUnicodeChar( SourceString->Buffer[Index] );
+    }
+
+    DestinationString->Length = SourceString->Length;
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+RtlDowncaseUnicodeString (
+    OUT PUNICODE_STRING DestinationString,
+    IN PCUNICODE_STRING SourceString,
+    IN BOOLEAN AllocateDestinationString
+    )
+{
+    ULONG Index;
+
+    if (AllocateDestinationString) {
+
+        DestinationString->MaximumLength = SourceString->Length;
+        DestinationString->Buffer = ExAllocatePoolWithTag( PagedPool, SourceString->Length + 1, 'rtsU' );
+
+    } else if (DestinationString->MaximumLength < SourceString->Length) {
+
+        return STATUS_BUFFER_OVERFLOW;
+    }
+
+    for (Index = 0; Index < SourceString->Length / sizeof(WCHAR); Index += 1) {
+
+        DestinationString->Buffer[Index] = RtlDowncaseUnicodeChar( SourceString->Buffer[Index] );
+    }
+
+    DestinationString->Length = SourceString->Length;
+
+    return STATUS_SUCCESS;
+}
+
+BOOLEAN
+RtlEqualUnicodeString (
+    IN PCUNICODE_STRING String1,
+    IN PCUNICODE_STRING String2,
+    IN BOOLEAN CaseInSensitive
+    )
+{
+    return (BOOLEAN)((String1->Length == String2->Length) &&
+                     (RtlCompareUnicodeString( String1, String2, CaseInSensitive ) == 0));
+}
+
+LONG
+RtlCompareUnicodeString (
+    IN PCUNICODE_STRING String1,
+    IN PCUNICODE_STRING String2,
+    IN BOOLEAN CaseInSensitive
+    )
+{
+    ULONG Length1 = String1->Length / sizeof(WCHAR);
+    ULONG Length2 = String2->Length / sizeof(WCHAR);
+    ULONG Index;
+
+    for (Index = 0; Index < Length1 && Index < Length2; Index += 1) {
+
+        WCHAR Char1 = String1->Buffer[Index];
+        WCHAR Char2 = String2->Buffer[Index];
+
+        if (CaseInSensitive) {
+
+            Char1 = RtlUpcaseUnicodeChar( Char1 );
+            Char2 = RtlUpcaseUnicodeChar( Char2 );
+        }
+
+        if (Char1 != Char2) {
+
+            return (LONG)Char1 - (LONG)Char2;
+        }
+    }
+
+    return (LONG)Length1 - (LONG)Length2;
+}
+
+BOOLEAN
+RtlEqualString (
+    IN const STRING *String1,
+    IN const STRING *String2,
+    IN BOOLEAN CaseInSensitive
+    )
+{
+    ULONG Index;
+
+    if (String1->Length != String2->Length) {
+
+        return FALSE;
+    }
+
+    for (Index = 0; Index < String1->Length; Index += 1) {
+
+        CHAR Char1 = String1->Buffer[Index];
+        CHAR Char2 = String2->Buffer[Index];
+
+        if (CaseInSensitive) {
+
+            Char1 = RtlUpperChar( Char1 );
+            Char2 = RtlUpperChar( Char2 );
+        }
+
+        if (Char1 != Char2) {
+
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+VOID
+RtlFreeUnicodeString (
+    IN OUT PUNICODE_STRING UnicodeString
+    )
+{
+    if (UnicodeString->Buffer != NULL) {
+
+        ExFreePool( UnicodeString->Buffer );
+    }
+
+    RtlZeroMemory( UnicodeString, sizeof(UNICODE_STRING) );
+}
+
+VOID
+RtlFreeOemString (
+    IN OUT POEM_STRING OemString
+    )
+{
+    if (OemString->Buffer != NULL) {
+
+        ExFreePool( OemString->Buffer );
+    }
+
+    RtlZeroMemory( OemString, sizeof(OEM_STRING) );
+}
+
+ULONG
+RtlOemStringToCountedUnicodeSize (
+    IN const STRING *OemString
+    )
+{
+    return OemString->Length * sizeof(WCHAR);
+}
+
+ULONG
+RtlUnicodeStringToCountedOemSize (
+    IN PCUNICODE_STRING UnicodeString
+    )
+{
+    return UnicodeString->Length / sizeof(WCHAR);
+}
+
+NTSTATUS
+RtlOemToUnicodeN (
+    OUT PWCH UnicodeString,
+    IN ULONG MaxBytesInUnicodeString,
+    OUT PULONG BytesInUnicodeString OPTIONAL,
+    IN PCSTR OemString,
+    IN ULONG BytesInOemString
+    )
+{
+    ULONG Count = min( MaxBytesInUnicodeString / sizeof(WCHAR), BytesInOemString );
+    ULONG Index;
+
+    for (Index = 0; Index < Count; Index += 1) {
+
+        UnicodeString[Index] = (UCHAR)OemString[Index];
+    }
+
+    if (ARGUMENT_PRESENT( BytesInUnicodeString )) {
+
+        *BytesInUnicodeString = Count * sizeof(WCHAR);
+    }
+
+    return Count < BytesInOemString ? STATUS_BUFFER_OVERFLOW : STATUS_SUCCESS;
+}
+
+NTSTATUS
+RtlUnicodeToOemN (
+    OUT PCHAR OemString,
+    IN ULONG MaxBytesInOemString,
+    OUT PULONG BytesInOemString OPTIONAL,
+    IN PCWSTR UnicodeString,
+    IN ULONG BytesInUnicodeString
+    )
+{
+    ULONG Count = min( MaxBytesInOemString, BytesInUnicodeString / sizeof(WCHAR) );
+    ULONG Index;
+
+    for (Index = 0; Index < Count; Index += 1) {
+
+        OemString[Index] = UnicodeString[Index] < 0x100 ? (CHAR)UnicodeString[Index] : '?';
+    }
+
+    if (ARGUMENT_PRESENT( BytesInOemString )) {
+
+        *BytesInOemString = Count;
+    }
+
+    return Count < BytesInUnicodeString / sizeof(WCHAR) ? STATUS_BUFFER_OVERFLOW : STATUS_SUCCESS;
+}
+
+NTSTATUS
+RtlUpcaseUnicodeToOemN (
+    OUT PCHAR OemString,
+    IN ULONG MaxBytesInOemString,
+    OUT PULONG BytesInOemString OPTIONAL,
+    IN PCWSTR UnicodeString,
+    IN ULONG BytesInUnicodeString
+    )
+{
+    NTSTATUS Status;
+    ULONG Count;
+    ULONG Index;
+
+    Status = RtlUnicodeToOemN( OemString, MaxBytesInOemString, &Count, UnicodeString, BytesInUnicodeString );
+
+    for (Index = 0; Index < Count; Index += 1) {
+
+        OemString[Index] = RtlUpperChar( OemString[Index] );
+    }
+
+    if (ARGUMENT_PRESENT( BytesInOemString )) {
+
+        *BytesInOemString = Count;
+    }
+
+    return Status;
+}
+
+NTSTATUS
+RtlOemStringToCountedUnicodeString (
+    OUT PUNICODE_STRING DestinationString,
+    IN const STRING *SourceString,
+    IN BOOLEAN AllocateDestinationString
+    )
+{
+    ULONG Length = RtlOemStringToCountedUnicodeSize( SourceString );
+
+    if (AllocateDestinationString) {
+
+        DestinationString->MaximumLength = (USHORT)Length;
+        DestinationString->Buffer = ExAllocatePoolWithTag( PagedPool, Length + 1, 'rtsU' );
+
+    } else if (DestinationString->MaximumLength < Length) {
+
+        return STATUS_BUFFER_OVERFLOW;
+    }
+
+    DestinationString->Length = (USHORT)Length;
+
+    return RtlOemToUnicodeN( DestinationString->Buffer,
+                             Length,
+                             NULL,
+                             SourceString->Buffer,
+                             SourceString->Length );
+}
+
+NTSTATUS
+RtlOemStringToUnicodeString (
+    OUT PUNICODE_STRING DestinationString,
+    IN const STRING *SourceString,
+    IN BOOLEAN AllocateDestinationString
+    )
+{
+    return RtlOemStringToCountedUnicodeString( DestinationString,
+                                               SourceString,
+                                               AllocateDestinationString );
+}
+
+NTSTATUS
+RtlUnicodeStringToCountedOemString (
+    OUT POEM_STRING DestinationString,
+    IN PCUNICODE_STRING SourceString,
+    IN BOOLEAN AllocateDestinationString
+    )
+{
+    ULONG Length = RtlUnicodeStringToCountedOemSize( SourceString );
+
+    if (AllocateDestinationString) {
+
+        DestinationString->MaximumLength = (USHORT)Length;
+        DestinationString->Buffer = ExAllocatePoolWithTag( PagedPool, Length + 1, 'rtsO' );
+
+    } else if (DestinationString->MaximumLength < Length) {
+
+        return STATUS_BUFFER_OVERFLOW;
+    }
+
+    DestinationString->Length = (USHORT)Length;
+
+    return RtlUnicodeToOemN( DestinationString->Buffer,
+                             Length,
+                             NULL,
+                             SourceString->Buffer,
+                             SourceString->Length );
+}
+
+NTSTATUS
+RtlUpcaseUnicodeStringToCountedOemString (
+    OUT POEM_STRING DestinationString,
+    IN PCUNICODE_STRING SourceString,
+    IN BOOLEAN AllocateDestinationString
+    )
+{
+    NTSTATUS Status;
+    ULONG Index;
+
+    Status = RtlUnicodeStringToCountedOemString( DestinationString,
+                                                 SourceString,
+                                                 AllocateDestinationString );
+
+    if (NT_SUCCESS( Status )) {
+
+        for (Index = 0; Index < DestinationString->Length; Index += 1) {
+
+            DestinationString->Buffer[Index] = RtlUpperChar( DestinationString->Buffer[Index] );
+        }
+    }
+
+    return Status;
+}
+
+
+//
+//  Time routines
+//
+
+BOOLEAN
+RtlTimeFieldsToTime (
+    IN PTIME_FIELDS TimeFields,
+    OUT PLARGE_INTEGER Time
+    )
+{
+    static const UCHAR DaysInMonth[12] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    LONGLONG Days;
+
+    if (TimeFields->Year < 1601 ||
+        TimeFields->Month < 1 || TimeFields->Month > 12 ||
+        TimeFields->Day < 1 || TimeFields->Day > DaysInMonth[TimeFields->Month - 1] ||
+        TimeFields->Hour < 0 || TimeFields->Hour > 23 ||
+        TimeFields->Minute < 0 || TimeFields->Minute > 59 ||
+        TimeFields->Second < 0 || TimeFields->Second > 59 ||
+        TimeFields->Milliseconds < 0 || TimeFields->Milliseconds > 999) {
+
+        return FALSE;
+    }
+
+    Days = HostDaysFromCivil( TimeFields->Year, TimeFields->Month, TimeFields->Day ) -
+           HostDaysFromCivil( 1601, 1, 1 );
+
+    //
+    //  Catch the 29th of February in a year that does not have one.
+    //
+
+    if (TimeFields->Month == 2 && TimeFields->Day == 29 &&
+        HostDaysFromCivil( TimeFields->Year, 3, 1 ) - HostDaysFromCivil( TimeFields->Year, 2, 1 ) != 29) {
+
+        return FALSE;
+    }
+
+    Time->QuadPart = ((((Days * 24 + TimeFields->Hour) * 60 + TimeFields->Minute) * 60 +
+                       TimeFields->Second) * 1000 + TimeFields->Milliseconds) * 10000;
+
+    return TRUE;
+}
+
+VOID
+RtlTimeToTimeFields (
+    IN PLARGE_INTEGER Time,
+    OUT PTIME_FIELDS TimeFields
+    )
+{
+    LONGLONG Milliseconds = Time->QuadPart / 10000;
+    LONGLONG Days = Milliseconds / (24 * 60 * 60 * 1000);
+    LONGLONG Remainder = Milliseconds % (24 * 60 * 60 * 1000);
+    LONGLONG Era, Z;
+    ULONG DayOfEra, YearOfEra, DayOfYear, MonthPrime;
+
+    TimeFields->Milliseconds = (SHORT)(Remainder % 1000);
+    TimeFields->Second = (SHORT)((Remainder / 1000) % 60);
+    TimeFields->Minute = (SHORT)((Remainder / (60 * 1000)) % 60);
+    TimeFields->Hour = (SHORT)(Remainder / (60 * 60 * 1000));
+
+    //
+    //  The first of January 1601 was a Monday.
+    //
+
+    TimeFields->Weekday = (SHORT)((Days + 1) % 7);
+
+    //
+    //  Convert the day count to a civil date, counting eras of 400 years
+    //  from the first of March of year zero.
+    //
+
+    Z = Days + HostDaysFromCivil( 1601, 1, 1 ) + 719468;
+    Era = (Z >= 0 ? Z : Z - 146096) / 146097;
+    DayOfEra = (ULONG)(Z - Era * 146097);
+    YearOfEra = (DayOfEra - DayOfEra / 1460 + DayOfEra / 36524 - DayOfEra / 146096) / 365;
+    DayOfYear = DayOfEra - (365 * YearOfEra + YearOfEra / 4 - YearOfEra / 100);
+    MonthPrime = (5 * DayOfYear + 2) / 153;
+
+    TimeFields->Day = (SHORT)(DayOfYear - (153 * MonthPrime + 2) / 5 + 1);
+    TimeFields->Month = (SHORT)(MonthPrime < 10 ? MonthPrime + 3 : MonthPrime - 9);
+    TimeFields->Year = (SHORT)(YearOfEra + Era * 400 + (TimeFields->Month <= 2));
+}
+
+
+//
+//  Local support routine
+//
+
+LONGLONG
+HostDaysFromCivil (
+    IN LONGLONG Year,
+    IN ULONG Month,
+    IN ULONG Day
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the number of days from the first of January 1970
+    to a date in the proleptic Gregorian calendar.
+
+--*/
+
+{
+    LONGLONG Era;
+    ULONG YearOfEra;
+    ULONG DayOfYear;
+
+    Year -= (Month <= 2);
+    Era = (Year >= 0 ? Year : Year - 399) / 400;
+    YearOfEra = (ULONG)(Year - Era * 400);
+    DayOfYear = (153 * (Month > 2 ? Month - 3 : Month + 9) + 2) / 5 + Day - 1;
+
+    return Era * 146097 + (YearOfEra * 365 + YearOfEra / 4 - YearOfEra / 100 + DayOfYear) - 719468;
+}
+
+
+//
+//  Short name generation
+//
+
+NTSTATUS
+RtlGenerate8dot3Name (
+    IN PCUNICODE_STRING Name,
+    IN BOOLEAN AllowExtendedCharacters,
+    IN OUT PGENERATE_NAME_CONTEXT Context,
+    OUT PUNICODE_STRING Name8dot3
+    )
+
+/*++
+
+Routine Description:
+
+    This routine generates the next short name candidate for a long name,
+    the way the kernel's does.  The first four candidates are the first six
+    legal characters of the name followed by ~1 to ~4.  After that the name
+    is cut to two characters and a four digit hex checksum of the long name
+    is inserted, and the index counts up again from ~1, shortening the name
+    further as it grows.  The extension is the first three legal characters
+    after the last dot.
+
+    Illegal characters become underscores, spaces and extra dots are
+    dropped, and everything is upcased.
+
+Arguments:
+
+    Name - Supplies the long name.
+
+    AllowExtendedCharacters - Supplies TRUE if characters above 0x7f may be
+        kept.  The host keeps only those with a Latin 1 Oem equivalent.
+
+    Context - Supplies the context, zeroed before the first call for a name.
+
+    Name8dot3 - Receives the candidate.  It must have room for twelve
+        characters.
+
+Return Value:
+
+    NTSTATUS - STATUS_SUCCESS.
+
+--*/
+
+{
+    ULONG NameLength = Name->Length / sizeof(WCHAR);
+    ULONG LastDot = NameLength;
+    ULONG Index;
+    ULONG Length;
+    ULONG Digits;
+    ULONG Value;
+    WCHAR IndexBuffer[8];
+
+    //
+    //  The first call fills in the pieces of the name the candidates are
+    //  built from.
+    //
+
+    if (Context->NameLength == 0) {
+
+        USHORT Checksum = 0;
+
+        for (Index = NameLength; Index > 0; Index -= 1) {
+
+            if (Name->Buffer[Index - 1] == L'.') {
+
+                LastDot = Index - 1;
+                break;
+            }
+        }
+
+        for (Index = 0; Index < LastDot && Context->NameLength < 6; Index += 1) {
+
+            WCHAR Char = RtlUpcaseUnicodeChar( Name->Buffer[Index] );
+
+            if (Char == L' ' || Char == L'.') { continue; }
+
+            if (!HostIsShortNameCharacter( Char ) ||
+                (Char > 0x7f && !AllowExtendedCharacters)) {
+
+                Char = L'_';
+            }
+
+            Context->NameBuffer[Context->NameLength++] = Char;
+        }
+
+        for (Index = LastDot + 1; Index < NameLength && Context->ExtensionLength < 3; Index += 1) {
+
+            WCHAR Char = RtlUpcaseUnicodeChar( Name->Buffer[Index] );
+
+            if (Char == L' ') { continue; }
+
+            if (!HostIsShortNameCharacter( Char ) || Char == L'.' ||
+                (Char > 0x7f && !AllowExtendedCharacters)) {
+
+                Char = L'_';
+            }
+
+            Context->ExtensionBuffer[Context->ExtensionLength++] = Char;
+        }
+
+        if (Context->NameLength == 0) {
+
+            Context->NameBuffer[Context->NameLength++] = L'_';
+        }
+
+        for (Index = 0; Index < NameLength; Index += 1) {
+
+            Checksum = (USHORT)(((Checksum & 1) ? 0x8000 : 0) + (Checksum >> 1) + Name->Buffer[Index]);
+        }
+
+        Context->Checksum = Checksum;
+        Context->ChecksumInserted = FALSE;
+        Context->LastIndexValue = 0;
+    }
+
+    Context->LastIndexValue += 1;
+
+    if (!Context->ChecksumInserted && Context->LastIndexValue > 4) {
+
+        Context->ChecksumInserted = TRUE;
+        Context->LastIndexValue = 1;
+    }
+
+    //
+    //  Format ~n backwards, and cut the base name to leave room for it.
+    //
+
+    Digits = 0;
+    Value = Context->LastIndexValue;
+
+    do {
+
+        IndexBuffer[Digits++] = (WCHAR)(L'0' + Value % 10);
+        Value /= 10;
+
+    } while (Value != 0 && Digits < 6);
+
+    Length = 0;
+
+    if (Context->ChecksumInserted) {
+
+        static const char Hex[] = "0123456789ABCDEF";
+
+        for (Index = 0; Index < min( 2, Context->NameLength ); Index += 1) {
+
+            Name8dot3->Buffer[Length++] = Context->NameBuffer[Index];
+        }
+
+        for (Index = 0; Index < 4; Index += 1) {
+
+            Name8dot3->Buffer[Length++] = Hex[(Context->Checksum >> (12 - 4 * Index)) & 0xf];
+        }
+
+    } else {
+
+        for (Index = 0; Index < Context->NameLength; Index += 1) {
+
+            Name8dot3->Buffer[Length++] = Context->NameBuffer[Index];
+        }
+    }
+
+    Length = min( Length, 8 - (Digits + 1) );
+
+    Name8dot3->Buffer[Length++] = L'~';
+
+    while (Digits > 0) {
+
+        Name8dot3->Buffer[Length++] = IndexBuffer[--Digits];
+    }
+
+    if (Context->ExtensionLength != 0) {
+
+        Name8dot3->Buffer[Length++] = L'.';
+
+        for (Index = 0; Index < Context->ExtensionLength; Index += 1) {
+
+            Name8dot3->Buffer[Length++] = Context->ExtensionBuffer[Index];
+        }
+    }
+
+    Name8dot3->Length = (USHORT)(Length * sizeof(WCHAR));
+
+    return STATUS_SUCCESS;
+}
+
+
+//
+//  Local support routine
+//
+
+BOOLEAN
+HostIsShortNameCharacter (
+    IN WCHAR Character
+    )
+{
+    if (Character > 0xff) {
+
+        return FALSE;
+    }
+
+    return FsRtlIsAnsiCharacterLegalFat( (UCHAR)Character, FALSE );
+}
+
+
+//
+//  Name legality and matching
+//
+
+BOOLEAN
+FsRtlIsAnsiCharacterLegalFat (
+    IN UCHAR Character,
+    IN BOOLEAN WildOk
+    )
+{
+    if (Character < 0x20) {
+
+        return FALSE;
+    }
+
+    if (FsRtlIsAnsiCharacterWild( Character )) {
+
+        return WildOk;
+    }
+
+    return (BOOLEAN)(strchr( "+,/:;=[\\]|", Character ) == NULL);
+}
+
+BOOLEAN
+FsRtlIsFatDbcsLegal (
+    IN ANSI_STRING DbcsName,
+    IN BOOLEAN WildCardsPermissible,
+    IN BOOLEAN PathNamePermissible,
+    IN BOOLEAN LeadingBackslashPermissible
+    )
+
+/*++
+
+Routine Description:
+
+    This routine checks that a name, or each component of a path, is a legal
+    8.3 name: at most eight characters, optionally a dot and at most three
+    more, all legal on Fat.  The names . and .. are legal.
+
+--*/
+
+{
+    ULONG Index = 0;
+    ULONG Length = DbcsName.Length;
+
+    if (Length == 0) {
+
+        return FALSE;
+    }
+
+    if (DbcsName.Buffer[0] == '\\') {
+
+        if (!LeadingBackslashPermissible) { return FALSE; }
+        Index = 1;
+    }
+
+    while (Index < Length) {
+
+        ULONG Start = Index;
+        ULONG Dot = MAXULONG;
+        ULONG Scan;
+        ULONG End;
+
+        while (Index < Length && DbcsName.Buffer[Index] != '\\') {
+
+            Index += 1;
+        }
+
+        End = Index;
+
+        if (Index < Length) {
+
+            if (!PathNamePermissible) { return FALSE; }
+            Index += 1;
+        }
+
+        if ((End - Start == 1 && DbcsName.Buffer[Start] == '.') ||
+            (End - Start == 2 && DbcsName.Buffer[Start] == '.' && DbcsName.Buffer[Start + 1] == '.')) {
+
+            continue;
+        }
+
+        if (End == Start) {
+
+            return FALSE;
+        }
+
+        for (Scan = Start; Scan < End; Scan += 1) {
+
+            UCHAR Char = (UCHAR)DbcsName.Buffer[Scan];
+
+            if (Char == '.') {
+
+                if (Dot != MAXULONG || Scan == Start) { return FALSE; }
+                Dot = Scan;
+                continue;
+            }
+
+            if (!FsRtlIsAnsiCharacterLegalFat( Char, WildCardsPermissible )) {
+
+                return FALSE;
+            }
+        }
+
+        if (Dot == MAXULONG) {
+
+            if (End - Start > 8) { return FALSE; }
+
+        } else if (Dot - Start > 8 || End - Dot - 1 > 3 || End - Dot - 1 == 0) {
+
+            return FALSE;
+        }
+
+        //
+        //  A trailing space is not a legal short name.
+        //
+
+        if (DbcsName.Buffer[End - 1] == ' ' ||
+            (Dot != MAXULONG && DbcsName.Buffer[Dot - 1] == ' ')) {
+
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+FsRtlAreNamesEqual (
+    IN PCUNICODE_STRING ConstantNameA,
+    IN PCUNICODE_STRING ConstantNameB,
+    IN BOOLEAN IgnoreCase,
+    IN PCWCH UpcaseTable OPTIONAL
+    )
+{
+    UNREFERENCED_PARAMETER( UpcaseTable );
+
+    return RtlEqualUnicodeString( ConstantNameA, ConstantNameB, IgnoreCase );
+}
+
+BOOLEAN
+FsRtlDoesNameContainWildCards (
+    IN PUNICODE_STRING Name
+    )
+{
+    ULONG Index;
+
+    for (Index = 0; Index < Name->Length / sizeof(WCHAR); Index += 1) {
+
+        if (FsRtlIsUnicodeCharacterWild( Name->Buffer[Index] )) {
+
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+BOOLEAN
+FsRtlIsNameInExpression (
+    IN PUNICODE_STRING Expression,
+    IN PUNICODE_STRING Name,
+    IN BOOLEAN IgnoreCase,
+    IN PWCH UpcaseTable OPTIONAL
+    )
+
+/*++
+
+Routine Description:
+
+    This routine matches a name against an expression with the kernel's
+    wild cards.  As there, the expression must already be upcased when
+    IgnoreCase is TRUE.
+
+--*/
+
+{
+    UNICODE_STRING UpcasedName;
+    WCHAR Buffer[256];
+    BOOLEAN Result;
+
+    UNREFERENCED_PARAMETER( UpcaseTable );
+
+    if (!IgnoreCase) {
+
+        return HostMatchExpression( Expression->Buffer,
+                                    Expression->Length / sizeof(WCHAR),
+                                    Name->Buffer,
+                                    Name->Length / sizeof(WCHAR) );
+    }
+
+    UpcasedName.Buffer = Name->Length <= sizeof(Buffer) ?
+                         Buffer :
+                         ExAllocatePoolWithTag( PagedPool, Name->Length, 'rtsU' );
+
+    UpcasedName.MaximumLength = Name->Length;
+
+    (VOID)RtlUpcaseUnicodeString( &UpcasedName, Name, FALSE );
+
+    Result = HostMatchExpression( Expression->Buffer,
+                                  Expression->Length / sizeof(WCHAR),
+                                  UpcasedName.Buffer,
+                                  UpcasedName.Length / sizeof(WCHAR) );
+
+    if (UpcasedName.Buffer != Buffer) {
+
+        ExFreePool( UpcasedName.Buffer );
+    }
+
+    return Result;
+}
+
+BOOLEAN
+FsRtlIsDbcsInExpression (
+    IN PANSI_STRING Expression,
+    IN PANSI_STRING Name
+    )
+{
+    WCHAR ExpressionBuffer[256];
+    WCHAR NameBuffer[256];
+    ULONG Index;
+
+    if (Expression->Length > ARRAYSIZE(ExpressionBuffer) ||
+        Name->Length > ARRAYSIZE(NameBuffer)) {
+
+        return FALSE;
+    }
+
+    for (Index = 0; Index < Expression->Length; Index += 1) {
+
+        ExpressionBuffer[Index] = (UCHAR)Expression->Buffer[Index];
+    }
+
+    for (Index = 0; Index < Name->Length; Index += 1) {
+
+        NameBuffer[Index] = (UCHAR)Name->Buffer[Index];
+    }
+
+    return HostMatchExpression( ExpressionBuffer, Expression->Length, NameBuffer, Name->Length );
+}
+
+
+//
+//  Local support routine
+//
+
+BOOLEAN
+HostMatchExpression (
+    IN PCWCH Expression,
+    IN ULONG ExpressionLength,
+    IN PCWCH Name,
+    IN ULONG NameLength
+    )
+
+/*++
+
+Routine Description:
+
+    This routine matches a name against an expression by backtracking.
+    * matches any run of characters and ? any one character.  The Dos wild
+    cards follow the kernel: < matches any run up to the last dot of the
+    name, > matches one character or nothing at a dot or the end of the
+    name, and " matches a dot or the end of the name.
+
+--*/
+
+{
+    ULONG Index;
+
+    while (ExpressionLength != 0) {
+
+        WCHAR Char = Expression[0];
+
+        switch (Char) {
+
+        case L'*':
+
+            for (Index = 0; Index <= NameLength; Index += 1) {
+
+                if (HostMatchExpression( Expression + 1, ExpressionLength - 1,
+                                         Name + Index, NameLength - Index )) {
+
+                    return TRUE;
+                }
+            }
+
+            return FALSE;
+
+        case L'<':
+
+            for (Index = 0; Index <= NameLength; Index += 1) {
+
+                ULONG Scan;
+
+                if (HostMatchExpression( Expression + 1, ExpressionLength - 1,
+                                         Name + Index, NameLength - Index )) {
+
+                    return TRUE;
+                }
+
+                //
+                //  Stop before consuming the last dot in the name.
+                //
+
+                if (Index < NameLength && Name[Index] == L'.') {
+
+                    for (Scan = Index + 1; Scan < NameLength && Name[Scan] != L'.'; Scan += 1) {
+
+                        NOTHING;
+                    }
+
+                    if (Scan == NameLength) { return FALSE; }
+                }
+            }
+
+            return FALSE;
+
+        case L'>':
+
+            if (NameLength == 0 || Name[0] == L'.') {
+
+                Expression += 1;
+                ExpressionLength -= 1;
+                continue;
+            }
+
+            if (HostMatchExpression( Expression + 1, ExpressionLength - 1, Name + 1, NameLength - 1 )) {
+
+                return TRUE;
+            }
+
+            Expression += 1;
+            ExpressionLength -= 1;
+            continue;
+
+        case L'"':
+
+            if (NameLength == 0) {
+
+                Expression += 1;
+                ExpressionLength -= 1;
+                continue;
+            }
+
+            if (Name[0] != L'.') { return FALSE; }
+            break;
+
+        case L'?':
+
+            if (NameLength == 0) { return FALSE; }
+            break;
+
+        default:
+
+            if (NameLength == 0 || Name[0] != Char) { return FALSE; }
+            break;
+        }
+
+        Expression += 1;
+        ExpressionLength -= 1;
+        Name += 1;
+        NameLength -= 1;
+    }
+
+    return (BOOLEAN)(NameLength == 0);
+}
+
+
+//
+//  Large Mcb routines.  An Mcb is kept, as in the kernel, as an array of
+//  pairs each giving the Vbn that ends a run and the Lbn it starts at, with
+//  an Lbn of -1 for a hole.  Runs start at Vbn zero and trailing holes are
+//  never kept.
+//
+
+typedef struct _HOST_MCB_PAIR {
+
+    LONGLONG NextVbn;
+    LONGLONG Lbn;
+
+} HOST_MCB_PAIR, *PHOST_MCB_PAIR;
+
+#define McbPairs(M)          ((PHOST_MCB_PAIR)(M)->BaseMcb.Mapping)
+#define McbStartVbn(M,I)     ((I) == 0 ? 0 : McbPairs(M)[(I) - 1].NextVbn)
+
+//
+//  Local support routine
+//
+
+ULONG
+HostFindMcbRun (
+    IN PLARGE_MCB Mcb,
+    IN LONGLONG Vbn
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the run holding a Vbn by binary search.
+
+Return Value:
+
+    ULONG - The index of the run, or the pair count if the Vbn is past the
+        last run.
+
+--*/
+
+{
+    ULONG Low = 0;
+    ULONG High = Mcb->BaseMcb.PairCount;
+
+    while (Low < High) {
+
+        ULONG Middle = (Low + High) / 2;
+
+        if (McbPairs(Mcb)[Middle].NextVbn <= Vbn) {
+
+            Low = Middle + 1;
+
+        } else {
+
+            High = Middle;
+        }
+    }
+
+    return Low;
+}
+
+VOID
+FsRtlInitializeLargeMcb (
+    IN PLARGE_MCB Mcb,
+    IN POOL_TYPE PoolType
+    )
+{
+    Mcb->GuardedMutex = NULL;
+    Mcb->BaseMcb.MaximumPairCount = 0;
+    Mcb->BaseMcb.PairCount = 0;
+    Mcb->BaseMcb.PoolType = (USHORT)PoolType;
+    Mcb->BaseMcb.Flags = 0;
+    Mcb->BaseMcb.Mapping = NULL;
+}
+
+VOID
+FsRtlUninitializeLargeMcb (
+    IN PLARGE_MCB Mcb
+    )
+{
+    free( Mcb->BaseMcb.Mapping );
+
+    Mcb->BaseMcb.Mapping = NULL;
+    Mcb->BaseMcb.MaximumPairCount = 0;
+    Mcb->BaseMcb.PairCount = 0;
+}
+
+VOID
+FsRtlResetLargeMcb (
+    IN PLARGE_MCB Mcb,
+    IN BOOLEAN SelfSynchronized
+    )
+{
+    UNREFERENCED_PARAMETER( SelfSynchronized );
+
+    Mcb->BaseMcb.PairCount = 0;
+}
+
+VOID
+FsRtlTruncateLargeMcb (
+    IN PLARGE_MCB Mcb,
+    IN LONGLONG Vbn
+    )
+{
+    ULONG Index = HostFindMcbRun( Mcb, Vbn );
+
+    if (Index < Mcb->BaseMcb.PairCount) {
+
+        McbPairs(Mcb)[Index].NextVbn = Vbn;
+        Mcb->BaseMcb.PairCount = (McbStartVbn( Mcb, Index ) == Vbn) ? Index : Index + 1;
+    }
+
+    while (Mcb->BaseMcb.PairCount != 0 &&
+           McbPairs(Mcb)[Mcb->BaseMcb.PairCount - 1].Lbn == -1) {
+
+        Mcb->BaseMcb.PairCount -= 1;
+    }
+}
+
+BOOLEAN
+FsRtlAddLargeMcbEntry (
+    IN PLARGE_MCB Mcb,
+    IN LONGLONG Vbn,
+    IN LONGLONG Lbn,
+    IN LONGLONG SectorCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine maps a range of Vbns.  Any part of the range that is
+    already mapped must be mapped to the same Lbns, or nothing is changed
+    and FALSE is returned.
+
+--*/
+
+{
+    ULONG Index;
+    LONGLONG End = Vbn + SectorCount;
+
+    //
+    //  Check the range against what is there already.
+    //
+
+    for (Index = HostFindMcbRun( Mcb, Vbn );
+         Index < Mcb->BaseMcb.PairCount && McbStartVbn( Mcb, Index ) < End;
+         Index += 1) {
+
+        LONGLONG RunStart = McbStartVbn( Mcb, Index );
+        LONGLONG RunLbn = McbPairs(Mcb)[Index].Lbn;
+
+        if (RunLbn != -1 && RunLbn - RunStart != Lbn - Vbn) {
+
+            return FALSE;
+        }
+    }
+
+    HostSetMcbRange( Mcb, Vbn, Lbn, SectorCount );
+
+    return TRUE;
+}
+
+VOID
+FsRtlRemoveLargeMcbEntry (
+    IN PLARGE_MCB Mcb,
+    IN LONGLONG Vbn,
+    IN LONGLONG SectorCount
+    )
+{
+    ULONG PairCount = Mcb->BaseMcb.PairCount;
+    LONGLONG LastVbn;
+
+    if (PairCount == 0) {
+
+        return;
+    }
+
+    LastVbn = McbPairs(Mcb)[PairCount - 1].NextVbn;
+
+    if (Vbn >= LastVbn) {
+
+        return;
+    }
+
+    if (SectorCount > LastVbn - Vbn) {
+
+        SectorCount = LastVbn - Vbn;
+    }
+
+    HostSetMcbRange( Mcb, Vbn, -1, SectorCount );
+}
+
+BOOLEAN
+FsRtlLookupLargeMcbEntry (
+    IN PLARGE_MCB Mcb,
+    IN LONGLONG Vbn,
+    OUT PLONGLONG Lbn OPTIONAL,
+    OUT PLONGLONG SectorCountFromLbn OPTIONAL,
+    OUT PLONGLONG StartingLbn OPTIONAL,
+    OUT PLONGLONG SectorCountFromStartingLbn OPTIONAL,
+    OUT PULONG Index OPTIONAL
+    )
+{
+    ULONG Run = HostFindMcbRun( Mcb, Vbn );
+    LONGLONG RunStart;
+    LONGLONG RunLbn;
+
+    if (Run == Mcb->BaseMcb.PairCount) {
+
+        if (ARGUMENT_PRESENT( Lbn )) { *Lbn = -1; }
+        return FALSE;
+    }
+
+    RunStart = McbStartVbn( Mcb, Run );
+    RunLbn = McbPairs(Mcb)[Run].Lbn;
+
+    if (ARGUMENT_PRESENT( Lbn )) {
+
+        *Lbn = (RunLbn == -1) ? -1 : RunLbn + (Vbn - RunStart);
+    }
+
+    if (ARGUMENT_PRESENT( SectorCountFromLbn )) {
+
+        *SectorCountFromLbn = McbPairs(Mcb)[Run].NextVbn - Vbn;
+    }
+
+    if (ARGUMENT_PRESENT( StartingLbn )) {
+
+        *StartingLbn = RunLbn;
+    }
+
+    if (ARGUMENT_PRESENT( SectorCountFromStartingLbn )) {
+
+        *SectorCountFromStartingLbn = McbPairs(Mcb)[Run].NextVbn - RunStart;
+    }
+
+    if (ARGUMENT_PRESENT( Index )) {
+
+        *Index = Run;
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+FsRtlLookupLastLargeMcbEntryAndIndex (
+    IN PLARGE_MCB Mcb,
+    OUT PLONGLONG Vbn,
+    OUT PLONGLONG Lbn,
+    OUT PULONG Index
+    )
+{
+    ULONG Last;
+
+    if (Mcb->BaseMcb.PairCount == 0) {
+
+        return FALSE;
+    }
+
+    Last = Mcb->BaseMcb.PairCount - 1;
+
+    *Vbn = McbPairs(Mcb)[Last].NextVbn - 1;
+    *Lbn = McbPairs(Mcb)[Last].Lbn + (*Vbn - McbStartVbn( Mcb, Last ));
+    *Index = Last;
+
+    return TRUE;
+}
+
+BOOLEAN
+FsRtlLookupLastLargeMcbEntry (
+    IN PLARGE_MCB Mcb,
+    OUT PLONGLONG Vbn,
+    OUT PLONGLONG Lbn
+    )
+{
+    ULONG Index;
+
+    return FsRtlLookupLastLargeMcbEntryAndIndex( Mcb, Vbn, Lbn, &Index );
+}
+
+ULONG
+FsRtlNumberOfRunsInLargeMcb (
+    IN PLARGE_MCB Mcb
+    )
+{
+    return Mcb->BaseMcb.PairCount;
+}
+
+BOOLEAN
+FsRtlGetNextLargeMcbEntry (
+    IN PLARGE_MCB Mcb,
+    IN ULONG RunIndex,
+    OUT PLONGLONG Vbn,
+    OUT PLONGLONG Lbn,
+    OUT PLONGLONG SectorCount
+    )
+{
+    if (RunIndex >= Mcb->BaseMcb.PairCount) {
+
+        return FALSE;
+    }
+
+    *Vbn = McbStartVbn( Mcb, RunIndex );
+    *Lbn = McbPairs(Mcb)[RunIndex].Lbn;
+    *SectorCount = McbPairs(Mcb)[RunIndex].NextVbn - *Vbn;
+
+    return TRUE;
+}
+
+
+//
+//  Local support routine
+//
+
+VOID
+HostSetMcbRange (
+    IN PLARGE_MCB Mcb,
+    IN LONGLONG Vbn,
+    IN LONGLONG Lbn,
+    IN LONGLONG SectorCount
+    )
+
+/*++
+
+Routine Description:
+
+    This routine maps a range of Vbns to a run of Lbns, or to a hole if the
+    Lbn is -1, replacing whatever the range held.  The runs either side are
+    split as needed, and runs that become contiguous are merged.
+
+--*/
+
+{
+    ULONG PairCount = Mcb->BaseMcb.PairCount;
+    LONGLONG End = Vbn + SectorCount;
+    LONGLONG LastVbn = PairCount ? McbPairs(Mcb)[PairCount - 1].NextVbn : 0;
+    PHOST_MCB_PAIR Pairs;
+    ULONG First;
+    ULONG Last;
+    ULONG Count = 0;
+    HOST_MCB_PAIR New[4];
+    ULONG Needed;
+    ULONG Index;
+
+    if (SectorCount == 0) {
+
+        return;
+    }
+
+    //
+    //  Build the replacement for the runs from the one holding Vbn through
+    //  the one holding End - 1: the head of the first, a hole up to Vbn if
+    //  the range starts past the end, the range itself, and the tail of
+    //  the last.
+    //
+
+    First = HostFindMcbRun( Mcb, Vbn );
+    Last = HostFindMcbRun( Mcb, End - 1 );
+
+    if (First < PairCount && McbStartVbn( Mcb, First ) < Vbn) {
+
+        New[Count].NextVbn = Vbn;
+        New[Count].Lbn = McbPairs(Mcb)[First].Lbn;
+        Count += 1;
+
+    } else if (First == PairCount && LastVbn < Vbn) {
+
+        New[Count].NextVbn = Vbn;
+        New[Count].Lbn = -1;
+        Count += 1;
+    }
+
+    New[Count].NextVbn = End;
+    New[Count].Lbn = Lbn;
+    Count += 1;
+
+    if (Last < PairCount && McbPairs(Mcb)[Last].NextVbn > End) {
+
+        LONGLONG TailLbn = McbPairs(Mcb)[Last].Lbn;
+
+        if (TailLbn != -1) {
+
+            TailLbn += End - McbStartVbn( Mcb, Last );
+        }
+
+        New[Count].NextVbn = McbPairs(Mcb)[Last].NextVbn;
+        New[Count].Lbn = TailLbn;
+        Count += 1;
+    }
+
+    //
+    //  Splice the replacement in place of runs First through Last.
+    //
+
+    if (Last == PairCount) {
+
+        Last = PairCount - 1;
+        if (First == PairCount) { Last = First - 1; }
+    }
+
+    Needed = PairCount - (Last + 1 - First) + Count;
+
+    if (Needed > Mcb->BaseMcb.MaximumPairCount) {
+
+        ULONG Maximum = max( 16, Mcb->BaseMcb.MaximumPairCount * 2 );
+
+        while (Maximum < Needed) { Maximum *= 2; }
+
+        Mcb->BaseMcb.Mapping = realloc( Mcb->BaseMcb.Mapping, Maximum * sizeof(HOST_MCB_PAIR) );
+
+        if (Mcb->BaseMcb.Mapping == NULL) {
+
+            ExRaiseStatus( STATUS_INSUFFICIENT_RESOURCES );
+        }
+
+        Mcb->BaseMcb.MaximumPairCount = Maximum;
+    }
+
+    Pairs = McbPairs(Mcb);
+
+    RtlMoveMemory( &Pairs[First + Count],
+                   &Pairs[Last + 1],
+                   (PairCount - (Last + 1)) * sizeof(HOST_MCB_PAIR) );
+
+    RtlCopyMemory( &Pairs[First], New, Count * sizeof(HOST_MCB_PAIR) );
+
+    PairCount = Needed;
+
+    //
+    //  Merge around the splice, then drop any trailing hole.
+    //
+
+    Index = (First > 0) ? First - 1 : 0;
+
+    while (Index + 1 < PairCount && Index <= First + Count) {
+
+        LONGLONG NextStart = Pairs[Index].NextVbn;
+        LONGLONG ThisLbnEnd = (Pairs[Index].Lbn == -1) ?
+                              -1 :
+                              Pairs[Index].Lbn + (NextStart - (Index ? Pairs[Index - 1].NextVbn : 0));
+
+        if ((Pairs[Index].Lbn == -1 && Pairs[Index + 1].Lbn == -1) ||
+            (Pairs[Index].Lbn != -1 && Pairs[Index + 1].Lbn == ThisLbnEnd)) {
+
+            Pairs[Index].NextVbn = Pairs[Index + 1].NextVbn;
+
+            RtlMoveMemory( &Pairs[Index + 1],
+                           &Pairs[Index + 2],
+                           (PairCount - (Index + 2)) * sizeof(HOST_MCB_PAIR) );
+
+            PairCount -= 1;
+            continue;
+        }
+
+        Index += 1;
+    }
+
+    while (PairCount != 0 && Pairs[PairCount - 1].Lbn == -1) {
+
+        PairCount -= 1;
+    }
+
+    Mcb->BaseMcb.PairCount = PairCount;
+}
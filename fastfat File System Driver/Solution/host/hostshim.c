@@ -0,0 +1,1586 @@
+/*++
+
+Copyright (c) 1989-2000 Microsoft Corporation
+
+Module Name:
+
+    HostShim.c
+
+Abstract:
+
+    This module implements the executive, kernel, I/O, object and file
+    system run time routines the host build of Fat calls, other than those
+    of the run time library (HostRtl.c) and the cache manager (HostCc.c).
+
+    The host is a single thread working on one volume, so resources only
+    count their owners, events are never waited on unsignalled, and timers
+    and DPCs never fire.  Anything that would block forever, and any
+    exception the file system raises, ends the process with a message.
+
+    File and device objects are counted, and the last dereference of a
+    stream file object closes it as the close path would (HostVol.c).
+
+
+--*/
+
+#define _GNU_SOURCE
+
+#include "FatProcs.h"
+#include "fathost.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+//
+//  The object type codes the I/O manager stamps on its objects.
+//
+
+#define IO_TYPE_DEVICE                   3
+#define IO_TYPE_FILE                     5
+#define IO_TYPE_IRP                      6
+
+//
+//  Seconds between the Nt epoch, 1601, and the Unix one, 1970.
+//
+
+#define HOST_EPOCH_DIFFERENCE            11644473600LL
+
+//
+//  The Irp at the top of the host's one call stack.
+//
+
+PIRP HostTopLevelIrp;
+
+BOOLEAN NlsMbOemCodePageTag = FALSE;
+
+POBJECT_TYPE *IoFileObjectType = NULL;
+
+//
+//  Local support routine
+//
+
+VOID DECLSPEC_NORETURN
+HostFail (
+    IN PCSTR Message,
+    IN ULONG_PTR Value
+    );
+
+
+//
+//  Failures
+//
+
+VOID
+HostAssertFailed (
+    IN PCSTR Expression,
+    IN PCSTR File,
+    IN ULONG Line
+    )
+{
+    fprintf( stderr, "fathost: assertion %s failed at %s:%u\n", Expression, File, Line );
+    abort();
+}
+
+VOID DECLSPEC_NORETURN
+KeBugCheckEx (
+    IN ULONG Code,
+    IN ULONG_PTR P1,
+    IN ULONG_PTR P2,
+    IN ULONG_PTR P3,
+    IN ULONG_PTR P4
+    )
+{
+    fprintf( stderr,
+             "fathost: bugcheck %08x (%lx, %lx, %lx, %lx)\n",
+             Code,
+             (unsigned long)P1,
+             (unsigned long)P2,
+             (unsigned long)P3,
+             (unsigned long)P4 );
+    abort();
+}
+
+VOID DECLSPEC_NORETURN
+ExRaiseStatus (
+    IN NTSTATUS Status
+    )
+{
+    HostFail( "exception raised", (ULONG)Status );
+}
+
+
+//
+//  Pool and lookaside lists
+//
+
+PVOID
+ExAllocatePoolWithTag (
+    IN POOL_TYPE PoolType,
+    IN SIZE_T NumberOfBytes,
+    IN ULONG Tag
+    )
+{
+    PVOID P;
+
+    UNREFERENCED_PARAMETER( PoolType );
+    UNREFERENCED_PARAMETER( Tag );
+
+    P = malloc( NumberOfBytes ? NumberOfBytes : 1 );
+
+    if (P == NULL) {
+
+        HostFail( "out of memory", NumberOfBytes );
+    }
+
+    return P;
+}
+
+PVOID
+FsRtlAllocatePoolWithTag (
+    IN POOL_TYPE PoolType,
+    IN SIZE_T NumberOfBytes,
+    IN ULONG Tag
+    )
+{
+    return ExAllocatePoolWithTag( PoolType, NumberOfBytes, Tag );
+}
+
+VOID
+ExFreePool (
+    IN PVOID P
+    )
+{
+    free( P );
+}
+
+VOID
+ExFreePoolWithTag (
+    IN PVOID P,
+    IN ULONG Tag
+    )
+{
+    UNREFERENCED_PARAMETER( Tag );
+
+    free( P );
+}
+
+VOID
+ExInitializeNPagedLookasideList (
+    IN PNPAGED_LOOKASIDE_LIST Lookaside,
+    IN PALLOCATE_FUNCTION Allocate,
+    IN PFREE_FUNCTION Free,
+    IN ULONG Flags,
+    IN SIZE_T Size,
+    IN ULONG Tag,
+    IN USHORT Depth
+    )
+{
+    UNREFERENCED_PARAMETER( Allocate );
+    UNREFERENCED_PARAMETER( Free );
+    UNREFERENCED_PARAMETER( Flags );
+    UNREFERENCED_PARAMETER( Depth );
+
+    Lookaside->Size = Size;
+    Lookaside->Tag = Tag;
+}
+
+VOID
+ExDeleteNPagedLookasideList (
+    IN PNPAGED_LOOKASIDE_LIST Lookaside
+    )
+{
+    UNREFERENCED_PARAMETER( Lookaside );
+}
+
+PVOID
+ExAllocateFromNPagedLookasideList (
+    IN PNPAGED_LOOKASIDE_LIST Lookaside
+    )
+{
+    return ExAllocatePoolWithTag( NonPagedPool, Lookaside->Size, Lookaside->Tag );
+}
+
+VOID
+ExFreeToNPagedLookasideList (
+    IN PNPAGED_LOOKASIDE_LIST Lookaside,
+    IN PVOID Entry
+    )
+{
+    UNREFERENCED_PARAMETER( Lookaside );
+
+    free( Entry );
+}
+
+VOID
+InitializeSListHead (
+    IN PSLIST_HEADER ListHead
+    )
+{
+    ListHead->Head.Next = NULL;
+    ListHead->Depth = 0;
+}
+
+PSLIST_ENTRY
+InterlockedPushEntrySList (
+    IN PSLIST_HEADER ListHead,
+    IN PSLIST_ENTRY ListEntry
+    )
+{
+    PSLIST_ENTRY First = ListHead->Head.Next;
+
+    PushEntryList( &ListHead->Head, ListEntry );
+    ListHead->Depth += 1;
+
+    return First;
+}
+
+PSLIST_ENTRY
+InterlockedPopEntrySList (
+    IN PSLIST_HEADER ListHead
+    )
+{
+    PSLIST_ENTRY Entry = PopEntryList( &ListHead->Head );
+
+    if (Entry != NULL) {
+
+        ListHead->Depth -= 1;
+    }
+
+    return Entry;
+}
+
+PSLIST_ENTRY
+ExInterlockedPushEntrySList (
+    IN PSLIST_HEADER ListHead,
+    IN PSLIST_ENTRY ListEntry,
+    IN PKSPIN_LOCK Lock
+    )
+{
+    UNREFERENCED_PARAMETER( Lock );
+
+    return InterlockedPushEntrySList( ListHead, ListEntry );
+}
+
+PSLIST_ENTRY
+ExInterlockedPopEntrySList (
+    IN PSLIST_HEADER ListHead,
+    IN PKSPIN_LOCK Lock
+    )
+{
+    UNREFERENCED_PARAMETER( Lock );
+
+    return InterlockedPopEntrySList( ListHead );
+}
+
+
+//
+//  Dispatcher objects
+//
+
+VOID
+KeInitializeEvent (
+    IN PRKEVENT Event,
+    IN EVENT_TYPE Type,
+    IN BOOLEAN State
+    )
+{
+    UNREFERENCED_PARAMETER( Type );
+
+    Event->Header.SignalState = State;
+}
+
+LONG
+KeSetEvent (
+    IN PRKEVENT Event,
+    IN LONG Increment,
+    IN BOOLEAN Wait
+    )
+{
+    LONG Previous = Event->Header.SignalState;
+
+    UNREFERENCED_PARAMETER( Increment );
+    UNREFERENCED_PARAMETER( Wait );
+
+    Event->Header.SignalState = 1;
+
+    return Previous;
+}
+
+VOID
+KeClearEvent (
+    IN PRKEVENT Event
+    )
+{
+    Event->Header.SignalState = 0;
+}
+
+LONG
+KeReadStateEvent (
+    IN PRKEVENT Event
+    )
+{
+    return Event->Header.SignalState;
+}
+
+NTSTATUS
+KeWaitForSingleObject (
+    IN PVOID Object,
+    IN KWAIT_REASON WaitReason,
+    IN KPROCESSOR_MODE WaitMode,
+    IN BOOLEAN Alertable,
+    IN PLARGE_INTEGER Timeout
+    )
+{
+    PKEVENT Event = Object;
+
+    UNREFERENCED_PARAMETER( WaitReason );
+    UNREFERENCED_PARAMETER( WaitMode );
+    UNREFERENCED_PARAMETER( Alertable );
+
+    //
+    //  Nothing else runs, so an unsignalled object stays that way.  The
+    //  waits Fat does are on I/O the host completes inline and on its own
+    //  synchronization events, so the object is always signalled here and
+    //  the wait consumes it.
+    //
+
+    if (Event->Header.SignalState == 0) {
+
+        if (Timeout != NULL) {
+
+            return STATUS_TIMEOUT;
+        }
+
+        HostFail( "wait on an unsignalled object", (ULONG_PTR)Object );
+    }
+
+    Event->Header.SignalState = 0;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+KeInitializeSpinLock (
+    IN PKSPIN_LOCK SpinLock
+    )
+{
+    *SpinLock = 0;
+}
+
+VOID
+KeAcquireSpinLock (
+    IN PKSPIN_LOCK SpinLock,
+    OUT PKIRQL OldIrql
+    )
+{
+    UNREFERENCED_PARAMETER( SpinLock );
+
+    *OldIrql = PASSIVE_LEVEL;
+}
+
+VOID
+KeReleaseSpinLock (
+    IN PKSPIN_LOCK SpinLock,
+    IN KIRQL NewIrql
+    )
+{
+    UNREFERENCED_PARAMETER( SpinLock );
+    UNREFERENCED_PARAMETER( NewIrql );
+}
+
+VOID
+KeInitializeTimer (
+    IN PKTIMER Timer
+    )
+{
+    Timer->Header.SignalState = 0;
+    Timer->DueTime.QuadPart = 0;
+}
+
+BOOLEAN
+KeSetTimer (
+    IN PKTIMER Timer,
+    IN LARGE_INTEGER DueTime,
+    IN PKDPC Dpc
+    )
+{
+    BOOLEAN WasSet = (BOOLEAN)(Timer->DueTime.QuadPart != 0);
+
+    UNREFERENCED_PARAMETER( Dpc );
+
+    Timer->DueTime = DueTime;
+
+    return WasSet;
+}
+
+BOOLEAN
+KeCancelTimer (
+    IN PKTIMER Timer
+    )
+{
+    BOOLEAN WasSet = (BOOLEAN)(Timer->DueTime.QuadPart != 0);
+
+    Timer->DueTime.QuadPart = 0;
+
+    return WasSet;
+}
+
+VOID
+KeInitializeDpc (
+    IN PRKDPC Dpc,
+    IN PKDEFERRED_ROUTINE DeferredRoutine,
+    IN PVOID DeferredContext
+    )
+{
+    Dpc->DeferredRoutine = DeferredRoutine;
+    Dpc->DeferredContext = DeferredContext;
+}
+
+BOOLEAN
+KeRemoveQueueDpc (
+    IN PRKDPC Dpc
+    )
+{
+    UNREFERENCED_PARAMETER( Dpc );
+
+    return FALSE;
+}
+
+VOID
+KeQuerySystemTime (
+    OUT PLARGE_INTEGER CurrentTime
+    )
+{
+    struct timespec Now;
+
+    clock_gettime( CLOCK_REALTIME, &Now );
+
+    CurrentTime->QuadPart = (Now.tv_sec + HOST_EPOCH_DIFFERENCE) * 10000000LL +
+                            Now.tv_nsec / 100;
+}
+
+VOID
+ExSystemTimeToLocalTime (
+    IN PLARGE_INTEGER SystemTime,
+    OUT PLARGE_INTEGER LocalTime
+    )
+{
+    *LocalTime = *SystemTime;
+}
+
+VOID
+ExLocalTimeToSystemTime (
+    IN PLARGE_INTEGER LocalTime,
+    OUT PLARGE_INTEGER SystemTime
+    )
+{
+    *SystemTime = *LocalTime;
+}
+
+KIRQL
+KeGetCurrentIrql (
+    VOID
+    )
+{
+    return PASSIVE_LEVEL;
+}
+
+BOOLEAN
+KeAreApcsDisabled (
+    VOID
+    )
+{
+    return TRUE;
+}
+
+BOOLEAN
+KeAreAllApcsDisabled (
+    VOID
+    )
+{
+    return FALSE;
+}
+
+VOID
+KeEnterCriticalRegion (
+    VOID
+    )
+{
+}
+
+VOID
+KeLeaveCriticalRegion (
+    VOID
+    )
+{
+}
+
+ULONG
+KeQueryActiveProcessorCount (
+    OUT PKAFFINITY ActiveProcessors
+    )
+{
+    if (ActiveProcessors != NULL) {
+
+        *ActiveProcessors = 1;
+    }
+
+    return 1;
+}
+
+ULONG
+KeGetCurrentProcessorNumber (
+    VOID
+    )
+{
+    return 0;
+}
+
+PKTHREAD
+KeGetCurrentThread (
+    VOID
+    )
+{
+    return (PKTHREAD)&HostTopLevelIrp;
+}
+
+PKTHREAD
+PsGetCurrentThread (
+    VOID
+    )
+{
+    return KeGetCurrentThread();
+}
+
+PEPROCESS
+PsGetCurrentProcess (
+    VOID
+    )
+{
+    return (PEPROCESS)&HostTopLevelIrp;
+}
+
+BOOLEAN
+PsIsSystemThread (
+    IN PKTHREAD Thread
+    )
+{
+    UNREFERENCED_PARAMETER( Thread );
+
+    return FALSE;
+}
+
+VOID
+ExQueueWorkItem (
+    IN PWORK_QUEUE_ITEM WorkItem,
+    IN WORK_QUEUE_TYPE QueueType
+    )
+{
+    UNREFERENCED_PARAMETER( QueueType );
+
+    WorkItem->WorkerRoutine( WorkItem->Parameter );
+}
+
+
+//
+//  Resources.  ActiveCount counts the acquisitions, and Flag is set while
+//  they are exclusive.  A shared acquire by the exclusive owner nests, as
+//  it does in the kernel.
+//
+
+#define HOST_RESOURCE_EXCLUSIVE          0x0080
+
+NTSTATUS
+ExInitializeResourceLite (
+    IN PERESOURCE Resource
+    )
+{
+    Resource->ActiveCount = 0;
+    Resource->ExclusiveCount = 0;
+    Resource->Flag = 0;
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+ExDeleteResourceLite (
+    IN PERESOURCE Resource
+    )
+{
+    if (Resource->ActiveCount != 0) {
+
+        HostFail( "deleting an owned resource", (ULONG_PTR)Resource );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+BOOLEAN
+ExAcquireResourceExclusiveLite (
+    IN PERESOURCE Resource,
+    IN BOOLEAN Wait
+    )
+{
+    UNREFERENCED_PARAMETER( Wait );
+
+    if (Resource->ActiveCount != 0 &&
+        !FlagOn( Resource->Flag, HOST_RESOURCE_EXCLUSIVE )) {
+
+        HostFail( "exclusive acquire of a shared resource", (ULONG_PTR)Resource );
+    }
+
+    SetFlag( Resource->Flag, HOST_RESOURCE_EXCLUSIVE );
+    Resource->ActiveCount += 1;
+    Resource->ExclusiveCount += 1;
+
+    return TRUE;
+}
+
+BOOLEAN
+ExAcquireResourceSharedLite (
+    IN PERESOURCE Resource,
+    IN BOOLEAN Wait
+    )
+{
+    UNREFERENCED_PARAMETER( Wait );
+
+    if (FlagOn( Resource->Flag, HOST_RESOURCE_EXCLUSIVE )) {
+
+        Resource->ExclusiveCount += 1;
+    }
+
+    Resource->ActiveCount += 1;
+
+    return TRUE;
+}
+
+BOOLEAN
+ExAcquireSharedStarveExclusive (
+    IN PERESOURCE Resource,
+    IN BOOLEAN Wait
+    )
+{
+    return ExAcquireResourceSharedLite( Resource, Wait );
+}
+
+BOOLEAN
+ExAcquireSharedWaitForExclusive (
+    IN PERESOURCE Resource,
+    IN BOOLEAN Wait
+    )
+{
+    return ExAcquireResourceSharedLite( Resource, Wait );
+}
+
+VOID
+ExReleaseResourceLite (
+    IN PERESOURCE Resource
+    )
+{
+    if (Resource->ActiveCount == 0) {
+
+        HostFail( "releasing an unowned resource", (ULONG_PTR)Resource );
+    }
+
+    Resource->ActiveCount -= 1;
+
+    if (FlagOn( Resource->Flag, HOST_RESOURCE_EXCLUSIVE )) {
+
+        Resource->ExclusiveCount -= 1;
+    }
+
+    if (Resource->ActiveCount == 0) {
+
+        Resource->ExclusiveCount = 0;
+        Resource->Flag = 0;
+    }
+}
+
+VOID
+ExReleaseResourceForThreadLite (
+    IN PERESOURCE Resource,
+    IN ERESOURCE_THREAD Thread
+    )
+{
+    UNREFERENCED_PARAMETER( Thread );
+
+    ExReleaseResourceLite( Resource );
+}
+
+VOID
+ExConvertExclusiveToSharedLite (
+    IN PERESOURCE Resource
+    )
+{
+    Resource->ExclusiveCount = 0;
+    ClearFlag( Resource->Flag, HOST_RESOURCE_EXCLUSIVE );
+}
+
+BOOLEAN
+ExIsResourceAcquiredExclusiveLite (
+    IN PERESOURCE Resource
+    )
+{
+    return BooleanFlagOn( Resource->Flag, HOST_RESOURCE_EXCLUSIVE );
+}
+
+ULONG
+ExIsResourceAcquiredSharedLite (
+    IN PERESOURCE Resource
+    )
+{
+    return (ULONG)Resource->ActiveCount;
+}
+
+ULONG
+ExGetExclusiveWaiterCount (
+    IN PERESOURCE Resource
+    )
+{
+    UNREFERENCED_PARAMETER( Resource );
+
+    return 0;
+}
+
+ULONG
+ExGetSharedWaiterCount (
+    IN PERESOURCE Resource
+    )
+{
+    UNREFERENCED_PARAMETER( Resource );
+
+    return 0;
+}
+
+VOID
+ExSetResourceOwnerPointer (
+    IN PERESOURCE Resource,
+    IN PVOID OwnerPointer
+    )
+{
+    UNREFERENCED_PARAMETER( Resource );
+    UNREFERENCED_PARAMETER( OwnerPointer );
+}
+
+
+//
+//  File and device objects
+//
+
+PFILE_OBJECT
+IoCreateStreamFileObject (
+    IN PFILE_OBJECT FileObject,
+    IN PDEVICE_OBJECT DeviceObject
+    )
+{
+    PFILE_OBJECT StreamFile;
+
+    UNREFERENCED_PARAMETER( FileObject );
+
+    StreamFile = calloc( 1, sizeof(FILE_OBJECT) );
+
+    if (StreamFile == NULL) {
+
+        HostFail( "out of memory", sizeof(FILE_OBJECT) );
+    }
+
+    StreamFile->Type = IO_TYPE_FILE;
+    StreamFile->Size = sizeof(FILE_OBJECT);
+    StreamFile->DeviceObject = DeviceObject;
+    StreamFile->Vpb = DeviceObject->Vpb;
+    StreamFile->Flags = FO_STREAM_FILE;
+    StreamFile->ReferenceCount = 1;
+
+    return StreamFile;
+}
+
+PFILE_OBJECT
+IoCreateStreamFileObjectLite (
+    IN PFILE_OBJECT FileObject,
+    IN PDEVICE_OBJECT DeviceObject
+    )
+{
+    return IoCreateStreamFileObject( FileObject, DeviceObject );
+}
+
+NTSTATUS
+IoCreateDevice (
+    IN PDRIVER_OBJECT DriverObject,
+    IN ULONG DeviceExtensionSize,
+    IN PUNICODE_STRING DeviceName,
+    IN ULONG DeviceType,
+    IN ULONG DeviceCharacteristics,
+    IN BOOLEAN Exclusive,
+    OUT PDEVICE_OBJECT *DeviceObject
+    )
+{
+    PDEVICE_OBJECT Device;
+
+    UNREFERENCED_PARAMETER( DeviceName );
+    UNREFERENCED_PARAMETER( Exclusive );
+
+    Device = calloc( 1, sizeof(DEVICE_OBJECT) + DeviceExtensionSize );
+
+    if (Device == NULL) {
+
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    Device->Type = IO_TYPE_DEVICE;
+    Device->Size = (USHORT)(sizeof(DEVICE_OBJECT) + DeviceExtensionSize);
+    Device->ReferenceCount = 1;
+    Device->DriverObject = DriverObject;
+    Device->DeviceType = DeviceType;
+    Device->Characteristics = DeviceCharacteristics;
+    Device->Flags = DO_DEVICE_INITIALIZING;
+    Device->StackSize = 1;
+    Device->DeviceExtension = Device + 1;
+
+    *DeviceObject = Device;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+IoDeleteDevice (
+    IN PDEVICE_OBJECT DeviceObject
+    )
+{
+    free( DeviceObject );
+}
+
+VOID
+ObReferenceObject (
+    IN PVOID Object
+    )
+{
+    CSHORT *Type = Object;
+
+    if (*Type == IO_TYPE_FILE) {
+
+        ((PFILE_OBJECT)Object)->ReferenceCount += 1;
+
+    } else if (*Type == IO_TYPE_DEVICE) {
+
+        ((PDEVICE_OBJECT)Object)->ReferenceCount += 1;
+    }
+}
+
+VOID
+ObDereferenceObject (
+    IN PVOID Object
+    )
+{
+    CSHORT *Type = Object;
+
+    if (*Type == IO_TYPE_FILE) {
+
+        PFILE_OBJECT FileObject = Object;
+
+        if (--FileObject->ReferenceCount == 0) {
+
+            FatHostCloseStreamFile( FileObject );
+            free( FileObject );
+        }
+
+    } else if (*Type == IO_TYPE_DEVICE) {
+
+        ((PDEVICE_OBJECT)Object)->ReferenceCount -= 1;
+    }
+}
+
+//
+//  Callers pass the address of their own typed object pointer, which the
+//  Windows compiler takes as a PVOID * without complaint.  Take it as a
+//  plain PVOID so gcc does too.
+//
+
+NTSTATUS
+ObReferenceObjectByHandle (
+    IN HANDLE Handle,
+    IN ACCESS_MASK DesiredAccess,
+    IN PVOID ObjectType,
+    IN KPROCESSOR_MODE AccessMode,
+    OUT PVOID Object,
+    OUT PVOID HandleInformation
+    )
+{
+    UNREFERENCED_PARAMETER( Handle );
+    UNREFERENCED_PARAMETER( DesiredAccess );
+    UNREFERENCED_PARAMETER( ObjectType );
+    UNREFERENCED_PARAMETER( AccessMode );
+    UNREFERENCED_PARAMETER( HandleInformation );
+
+    *(PVOID *)Object = NULL;
+
+    return STATUS_INVALID_HANDLE;
+}
+
+
+//
+//  Irps.  Each has a stack location for the file system and one below it
+//  for the disk, which IoCallDriver (HostVol.c) completes inline.
+//
+
+#define HOST_IRP_STACK_SIZE              2
+
+PIRP
+HostAllocateIrp (
+    VOID
+    )
+{
+    PIRP Irp;
+    SIZE_T Size = sizeof(IRP) + (HOST_IRP_STACK_SIZE - 1) * sizeof(IO_STACK_LOCATION);
+
+    Irp = calloc( 1, Size );
+
+    if (Irp == NULL) {
+
+        HostFail( "out of memory", Size );
+    }
+
+    Irp->Type = IO_TYPE_IRP;
+    Irp->Size = (USHORT)Size;
+    Irp->Tail.Overlay.Thread = PsGetCurrentThread();
+    Irp->Tail.Overlay.CurrentStackLocation = &Irp->Stack[HOST_IRP_STACK_SIZE - 1];
+
+    return Irp;
+}
+
+PIRP
+IoBuildAsynchronousFsdRequest (
+    IN ULONG MajorFunction,
+    IN PDEVICE_OBJECT DeviceObject,
+    IN PVOID Buffer,
+    IN ULONG Length,
+    IN PLARGE_INTEGER StartingOffset,
+    IN PIO_STATUS_BLOCK IoStatusBlock
+    )
+{
+    PIRP Irp = HostAllocateIrp();
+    PIO_STACK_LOCATION NextSp = IoGetNextIrpStackLocation( Irp );
+
+    NextSp->MajorFunction = (UCHAR)MajorFunction;
+    NextSp->DeviceObject = DeviceObject;
+
+    if (MajorFunction == IRP_MJ_READ || MajorFunction == IRP_MJ_WRITE) {
+
+        NextSp->Parameters.Read.Length = Length;
+        NextSp->Parameters.Read.ByteOffset = *StartingOffset;
+    }
+
+    Irp->UserBuffer = Buffer;
+    Irp->UserIosb = IoStatusBlock;
+
+    return Irp;
+}
+
+PIRP
+IoBuildSynchronousFsdRequest (
+    IN ULONG MajorFunction,
+    IN PDEVICE_OBJECT DeviceObject,
+    IN PVOID Buffer,
+    IN ULONG Length,
+    IN PLARGE_INTEGER StartingOffset,
+    IN PKEVENT Event,
+    IN PIO_STATUS_BLOCK IoStatusBlock
+    )
+{
+    PIRP Irp = IoBuildAsynchronousFsdRequest( MajorFunction,
+                                              DeviceObject,
+                                              Buffer,
+                                              Length,
+                                              StartingOffset,
+                                              IoStatusBlock );
+
+    Irp->UserEvent = Event;
+
+    return Irp;
+}
+
+PIRP
+IoBuildDeviceIoControlRequest (
+    IN ULONG IoControlCode,
+    IN PDEVICE_OBJECT DeviceObject,
+    IN PVOID InputBuffer,
+    IN ULONG InputBufferLength,
+    IN PVOID OutputBuffer,
+    IN ULONG OutputBufferLength,
+    IN BOOLEAN InternalDeviceIoControl,
+    IN PKEVENT Event,
+    IN PIO_STATUS_BLOCK IoStatusBlock
+    )
+{
+    PIRP Irp = HostAllocateIrp();
+    PIO_STACK_LOCATION NextSp = IoGetNextIrpStackLocation( Irp );
+
+    UNREFERENCED_PARAMETER( InternalDeviceIoControl );
+
+    NextSp->MajorFunction = IRP_MJ_DEVICE_CONTROL;
+    NextSp->DeviceObject = DeviceObject;
+    NextSp->Parameters.DeviceIoControl.IoControlCode = IoControlCode;
+    NextSp->Parameters.DeviceIoControl.InputBufferLength = InputBufferLength;
+    NextSp->Parameters.DeviceIoControl.OutputBufferLength = OutputBufferLength;
+    NextSp->Parameters.DeviceIoControl.Type3InputBuffer = InputBuffer;
+
+    Irp->UserBuffer = OutputBuffer;
+    Irp->UserIosb = IoStatusBlock;
+    Irp->UserEvent = Event;
+
+    return Irp;
+}
+
+VOID
+IoFreeIrp (
+    IN PIRP Irp
+    )
+{
+    free( Irp );
+}
+
+VOID
+IoSetCompletionRoutine (
+    IN PIRP Irp,
+    IN PIO_COMPLETION_ROUTINE CompletionRoutine,
+    IN PVOID Context,
+    IN BOOLEAN InvokeOnSuccess,
+    IN BOOLEAN InvokeOnError,
+    IN BOOLEAN InvokeOnCancel
+    )
+{
+    PIO_STACK_LOCATION NextSp = IoGetNextIrpStackLocation( Irp );
+
+    UNREFERENCED_PARAMETER( InvokeOnSuccess );
+    UNREFERENCED_PARAMETER( InvokeOnError );
+    UNREFERENCED_PARAMETER( InvokeOnCancel );
+
+    NextSp->CompletionRoutine = CompletionRoutine;
+    NextSp->Context = Context;
+}
+
+VOID
+IoCompleteRequest (
+    IN PIRP Irp,
+    IN CCHAR PriorityBoost
+    )
+{
+    UNREFERENCED_PARAMETER( Irp );
+    UNREFERENCED_PARAMETER( PriorityBoost );
+}
+
+BOOLEAN
+IoIsOperationSynchronous (
+    IN PIRP Irp
+    )
+{
+    UNREFERENCED_PARAMETER( Irp );
+
+    return TRUE;
+}
+
+PIRP
+IoGetTopLevelIrp (
+    VOID
+    )
+{
+    return HostTopLevelIrp;
+}
+
+VOID
+IoSetTopLevelIrp (
+    IN PIRP Irp
+    )
+{
+    HostTopLevelIrp = Irp;
+}
+
+VOID
+IoFreeMdl (
+    IN PMDL Mdl
+    )
+{
+    free( Mdl );
+}
+
+VOID
+IoAcquireVpbSpinLock (
+    OUT PKIRQL Irql
+    )
+{
+    *Irql = PASSIVE_LEVEL;
+}
+
+VOID
+IoReleaseVpbSpinLock (
+    IN KIRQL Irql
+    )
+{
+    UNREFERENCED_PARAMETER( Irql );
+}
+
+VOID
+IoGetStackLimits (
+    OUT PULONG_PTR LowLimit,
+    OUT PULONG_PTR HighLimit
+    )
+{
+    static PVOID Base = NULL;
+    static size_t Size = 0;
+    pthread_attr_t Attributes;
+
+    //
+    //  Fat uses these to tell a stack buffer from pool, so they have to be
+    //  the real bounds of the calling thread's stack.  The host has one
+    //  thread, so look them up once; finding the main thread's stack means
+    //  reading the process's mappings.
+    //
+
+    if (Size == 0 &&
+        pthread_getattr_np( pthread_self(), &Attributes ) == 0) {
+
+        pthread_attr_getstack( &Attributes, &Base, &Size );
+        pthread_attr_destroy( &Attributes );
+    }
+
+    *LowLimit = (ULONG_PTR)Base;
+    *HighLimit = (ULONG_PTR)Base + Size;
+}
+
+VOID
+IoSetHardErrorOrVerifyDevice (
+    IN PIRP Irp,
+    IN PDEVICE_OBJECT DeviceObject
+    )
+{
+    UNREFERENCED_PARAMETER( Irp );
+    UNREFERENCED_PARAMETER( DeviceObject );
+}
+
+PDEVICE_OBJECT
+IoGetDeviceToVerify (
+    IN PETHREAD Thread
+    )
+{
+    UNREFERENCED_PARAMETER( Thread );
+
+    return NULL;
+}
+
+VOID
+IoSetDeviceToVerify (
+    IN PETHREAD Thread,
+    IN PDEVICE_OBJECT DeviceObject
+    )
+{
+    UNREFERENCED_PARAMETER( Thread );
+    UNREFERENCED_PARAMETER( DeviceObject );
+}
+
+BOOLEAN
+IoIsSystemThread (
+    IN PETHREAD Thread
+    )
+{
+    UNREFERENCED_PARAMETER( Thread );
+
+    return FALSE;
+}
+
+BOOLEAN
+IoRaiseInformationalHardError (
+    IN NTSTATUS ErrorStatus,
+    IN PUNICODE_STRING String,
+    IN PKTHREAD Thread
+    )
+{
+    UNREFERENCED_PARAMETER( String );
+    UNREFERENCED_PARAMETER( Thread );
+
+    fprintf( stderr, "fathost: hard error %08x\n", (ULONG)ErrorStatus );
+
+    return TRUE;
+}
+
+VOID
+IoRaiseHardError (
+    IN PIRP Irp,
+    IN PVPB Vpb,
+    IN PDEVICE_OBJECT RealDeviceObject
+    )
+{
+    UNREFERENCED_PARAMETER( Vpb );
+    UNREFERENCED_PARAMETER( RealDeviceObject );
+
+    fprintf( stderr, "fathost: hard error %08x\n", (ULONG)Irp->IoStatus.Status );
+}
+
+NTSTATUS
+IoVerifyVolume (
+    IN PDEVICE_OBJECT DeviceObject,
+    IN BOOLEAN AllowRawMount
+    )
+{
+    UNREFERENCED_PARAMETER( DeviceObject );
+    UNREFERENCED_PARAMETER( AllowRawMount );
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+IoInitializePriorityInfo (
+    OUT PIO_PRIORITY_INFO PriorityInfo
+    )
+{
+    RtlZeroMemory( PriorityInfo, sizeof(IO_PRIORITY_INFO) );
+    PriorityInfo->Size = sizeof(IO_PRIORITY_INFO);
+}
+
+NTSTATUS
+IoRetrievePriorityInfo (
+    IN PIRP Irp,
+    IN PFILE_OBJECT FileObject,
+    IN PETHREAD Thread,
+    IN OUT PIO_PRIORITY_INFO PriorityInfo
+    )
+{
+    UNREFERENCED_PARAMETER( Irp );
+    UNREFERENCED_PARAMETER( FileObject );
+    UNREFERENCED_PARAMETER( Thread );
+    UNREFERENCED_PARAMETER( PriorityInfo );
+
+    return STATUS_SUCCESS;
+}
+
+BOOLEAN
+SeSinglePrivilegeCheck (
+    IN LUID PrivilegeValue,
+    IN KPROCESSOR_MODE PreviousMode
+    )
+{
+    UNREFERENCED_PARAMETER( PrivilegeValue );
+    UNREFERENCED_PARAMETER( PreviousMode );
+
+    return FALSE;
+}
+
+
+//
+//  Memory management
+//
+
+PVOID
+MmGetSystemAddressForMdlSafe (
+    IN PMDL Mdl,
+    IN ULONG Priority
+    )
+{
+    UNREFERENCED_PARAMETER( Priority );
+
+    return Mdl->MappedSystemVa;
+}
+
+VOID
+MmUnlockPages (
+    IN PMDL MemoryDescriptorList
+    )
+{
+    UNREFERENCED_PARAMETER( MemoryDescriptorList );
+}
+
+BOOLEAN
+MmFlushImageSection (
+    IN PSECTION_OBJECT_POINTERS SectionPointer,
+    IN ULONG FlushType
+    )
+{
+    UNREFERENCED_PARAMETER( SectionPointer );
+    UNREFERENCED_PARAMETER( FlushType );
+
+    return TRUE;
+}
+
+NTSTATUS
+MmPrefetchPages (
+    IN ULONG NumberOfLists,
+    IN PREAD_LIST *ReadLists
+    )
+{
+    UNREFERENCED_PARAMETER( NumberOfLists );
+    UNREFERENCED_PARAMETER( ReadLists );
+
+    return STATUS_SUCCESS;
+}
+
+
+//
+//  File system run time support other than names and Mcbs.  There are
+//  no byte range locks, oplocks, filters or notifications on the host.
+//
+
+VOID
+FsRtlInitializeFileLock (
+    IN PFILE_LOCK FileLock,
+    IN PVOID CompleteLockIrpRoutine,
+    IN PVOID UnlockRoutine
+    )
+{
+    FileLock->CompleteLockIrpRoutine = CompleteLockIrpRoutine;
+    FileLock->UnlockRoutine = UnlockRoutine;
+    FileLock->FastIoIsQuestionable = FALSE;
+    FileLock->LockInformation = NULL;
+}
+
+VOID
+FsRtlUninitializeFileLock (
+    IN PFILE_LOCK FileLock
+    )
+{
+    UNREFERENCED_PARAMETER( FileLock );
+}
+
+BOOLEAN
+FsRtlAreThereCurrentFileLocks (
+    IN PFILE_LOCK FileLock
+    )
+{
+    UNREFERENCED_PARAMETER( FileLock );
+
+    return FALSE;
+}
+
+VOID
+FsRtlInitializeOplock (
+    IN POPLOCK Oplock
+    )
+{
+    *Oplock = NULL;
+}
+
+VOID
+FsRtlUninitializeOplock (
+    IN POPLOCK Oplock
+    )
+{
+    *Oplock = NULL;
+}
+
+BOOLEAN
+FsRtlOplockIsFastIoPossible (
+    IN POPLOCK Oplock
+    )
+{
+    UNREFERENCED_PARAMETER( Oplock );
+
+    return TRUE;
+}
+
+BOOLEAN
+FsRtlCurrentBatchOplock (
+    IN POPLOCK Oplock
+    )
+{
+    UNREFERENCED_PARAMETER( Oplock );
+
+    return FALSE;
+}
+
+VOID
+FsRtlInitializeTunnelCache (
+    IN PTUNNEL Cache
+    )
+{
+    RtlZeroMemory( Cache, sizeof(TUNNEL) );
+}
+
+VOID
+FsRtlDeleteTunnelCache (
+    IN PTUNNEL Cache
+    )
+{
+    UNREFERENCED_PARAMETER( Cache );
+}
+
+VOID
+FsRtlAddToTunnelCache (
+    IN PTUNNEL Cache,
+    IN ULONGLONG DirectoryKey,
+    IN PUNICODE_STRING ShortName,
+    IN PUNICODE_STRING LongName,
+    IN BOOLEAN KeyByShortName,
+    IN ULONG DataLength,
+    IN PVOID Data
+    )
+{
+    UNREFERENCED_PARAMETER( Cache );
+    UNREFERENCED_PARAMETER( DirectoryKey );
+    UNREFERENCED_PARAMETER( ShortName );
+    UNREFERENCED_PARAMETER( LongName );
+    UNREFERENCED_PARAMETER( KeyByShortName );
+    UNREFERENCED_PARAMETER( DataLength );
+    UNREFERENCED_PARAMETER( Data );
+}
+
+VOID
+FsRtlDeleteKeyFromTunnelCache (
+    IN PTUNNEL Cache,
+    IN ULONGLONG DirectoryKey
+    )
+{
+    UNREFERENCED_PARAMETER( Cache );
+    UNREFERENCED_PARAMETER( DirectoryKey );
+}
+
+VOID
+FsRtlNotifyInitializeSync (
+    IN PNOTIFY_SYNC *NotifySync
+    )
+{
+    *NotifySync = NULL;
+}
+
+VOID
+FsRtlNotifyUninitializeSync (
+    IN PNOTIFY_SYNC *NotifySync
+    )
+{
+    *NotifySync = NULL;
+}
+
+VOID
+FsRtlNotifyFullReportChange (
+    IN PNOTIFY_SYNC NotifySync,
+    IN PLIST_ENTRY NotifyList,
+    IN PSTRING FullTargetName,
+    IN USHORT TargetNameOffset,
+    IN PSTRING StreamName,
+    IN PSTRING NormalizedParentName,
+    IN ULONG FilterMatch,
+    IN ULONG Action,
+    IN PVOID TargetContext
+    )
+{
+    UNREFERENCED_PARAMETER( NotifySync );
+    UNREFERENCED_PARAMETER( NotifyList );
+    UNREFERENCED_PARAMETER( FullTargetName );
+    UNREFERENCED_PARAMETER( TargetNameOffset );
+    UNREFERENCED_PARAMETER( StreamName );
+    UNREFERENCED_PARAMETER( NormalizedParentName );
+    UNREFERENCED_PARAMETER( FilterMatch );
+    UNREFERENCED_PARAMETER( Action );
+    UNREFERENCED_PARAMETER( TargetContext );
+}
+
+NTSTATUS
+FsRtlNotifyVolumeEvent (
+    IN PFILE_OBJECT FileObject,
+    IN ULONG EventCode
+    )
+{
+    UNREFERENCED_PARAMETER( FileObject );
+    UNREFERENCED_PARAMETER( EventCode );
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+FsRtlDismountComplete (
+    IN PDEVICE_OBJECT DeviceObject,
+    IN NTSTATUS DismountStatus
+    )
+{
+    UNREFERENCED_PARAMETER( DeviceObject );
+    UNREFERENCED_PARAMETER( DismountStatus );
+}
+
+NTSTATUS
+FsRtlBalanceReads (
+    IN PDEVICE_OBJECT TargetDevice
+    )
+{
+    UNREFERENCED_PARAMETER( TargetDevice );
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+FsRtlTeardownPerStreamContexts (
+    IN PFSRTL_ADVANCED_FCB_HEADER AdvancedHeader
+    )
+{
+    UNREFERENCED_PARAMETER( AdvancedHeader );
+}
+
+BOOLEAN
+FsRtlIsNtstatusExpected (
+    IN NTSTATUS Exception
+    )
+{
+    return (BOOLEAN)(Exception != STATUS_DATATYPE_MISALIGNMENT &&
+                     Exception != STATUS_ACCESS_VIOLATION &&
+                     Exception != STATUS_ILLEGAL_INSTRUCTION &&
+                     Exception != STATUS_INSTRUCTION_MISALIGNMENT);
+}
+
+NTSTATUS
+FsRtlNormalizeNtstatus (
+    IN NTSTATUS Exception,
+    IN NTSTATUS GenericException
+    )
+{
+    return FsRtlIsNtstatusExpected( Exception ) ? Exception : GenericException;
+}
+
+BOOLEAN
+FsRtlIsTotalDeviceFailure (
+    IN NTSTATUS Status
+    )
+{
+    return (BOOLEAN)(NT_SUCCESS( Status ) ? FALSE : Status != STATUS_VERIFY_REQUIRED);
+}
+
+VOID
+FsRtlEnterFileSystem (
+    VOID
+    )
+{
+}
+
+VOID
+FsRtlExitFileSystem (
+    VOID
+    )
+{
+}
+
+
+//
+//  Local support routine
+//
+
+VOID DECLSPEC_NORETURN
+HostFail (
+    IN PCSTR Message,
+    IN ULONG_PTR Value
+    )
+
+/*++
+
+Routine Description:
+
+    This routine ends the process for something the host cannot carry on
+    from: an exception, a wait that would never end, or a resource misuse.
+
+Arguments:
+
+    Message - What went wrong.
+
+    Value - The status or object it concerns.
+
+--*/
+
+{
+    fprintf( stderr, "fathost: %s (%lx)\n", Message, (unsigned long)Value );
+    abort();
+}
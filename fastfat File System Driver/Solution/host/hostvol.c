@@ -0,0 +1,1103 @@
+/*++
+
+Copyright (c) 1989-2000 Microsoft Corporation
+
+Module Name:
+
+    HostVol.c
+
+Abstract:
+
+    This module implements the volume side of the host build of Fat: the
+    image file that stands in for the disk, the disk driver below the file
+    system, and the mount, dismount and close support that the I/O manager
+    and the rest of the driver would otherwise provide.
+
+    The image is mapped shared, and the disk completes every request it is
+    sent inline, copying to or from the mapping.  Mount runs the real
+    FatMountVolume against the image, and dismount flushes and marks the
+    volume clean the way the dismount fsctl does before tearing it down.
+
+
+--*/
+
+#define _GNU_SOURCE
+
+#include "FatProcs.h"
+#include "fathost.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+//
+//  The sector size images are formatted with, and the boot record
+//  signature at the end of the boot sector.
+//
+
+#define HOST_SECTOR_SIZE                 512
+
+#define HOST_BOOT_SIGNATURE_OFFSET       510
+
+//
+//  The layout of a Fat32 format: reserved sectors, where the FsInfo sector
+//  and the backup boot sector go, and the cluster holding the root.
+//
+
+#define HOST_FAT32_RESERVED_SECTORS      32
+#define HOST_FAT32_FSINFO_SECTOR         1
+#define HOST_FAT32_BACKUP_BOOT_SECTOR    6
+#define HOST_FAT32_ROOT_CLUSTER          2
+
+#define HOST_FAT16_RESERVED_SECTORS      1
+#define HOST_FAT16_ROOT_ENTRIES          512
+
+//
+//  The cluster counts that separate Fat12 from Fat16, and Fat16 from
+//  Fat32.
+//
+
+#define HOST_FAT16_MIN_CLUSTERS          4085
+#define HOST_FAT32_MIN_CLUSTERS          65525
+
+HOST_IMAGE FatHostImage;
+
+//
+//  The driver object the file system's devices belong to.
+//
+
+DRIVER_OBJECT FatHostDriverObject;
+
+//
+//  Normally in Close.c, which the host does not build.
+//
+
+ULONG FatMaxDelayedCloseCount;
+
+NTSTATUS
+FatMountVolume (
+    IN PIRP_CONTEXT IrpContext,
+    IN PDEVICE_OBJECT TargetDeviceObject,
+    IN PVPB Vpb,
+    IN PDEVICE_OBJECT FsDeviceObject
+    );
+
+//
+//  Local support routines
+//
+
+NTSTATUS
+HostDiskDeviceControl (
+    IN PIO_STACK_LOCATION IrpSp,
+    IN PVOID Buffer,
+    OUT PULONG_PTR Information
+    );
+
+BOOLEAN
+HostWriteSectors (
+    IN int Fd,
+    IN ULONGLONG Sector,
+    IN PVOID Buffer,
+    IN ULONG Length
+    );
+
+
+//
+//  Image support
+//
+
+NTSTATUS
+FatHostFormatImage (
+    IN PCSTR Path,
+    IN ULONGLONG Size,
+    IN ULONG BytesPerCluster
+    )
+{
+    UCHAR BootSector[HOST_SECTOR_SIZE];
+    UCHAR FatSector[HOST_SECTOR_SIZE];
+    FSINFO_SECTOR FsInfo;
+
+    PPACKED_BOOT_SECTOR Boot = (PPACKED_BOOT_SECTOR)BootSector;
+    PPACKED_BOOT_SECTOR_EX BootEx = (PPACKED_BOOT_SECTOR_EX)BootSector;
+
+    ULONGLONG TotalSectors = Size / HOST_SECTOR_SIZE;
+    ULONG SectorsPerCluster = BytesPerCluster / HOST_SECTOR_SIZE;
+    ULONG ReservedSectors;
+    ULONG RootDirSectors;
+    ULONG SectorsPerFat;
+    ULONG BytesPerEntry;
+    ULONG Clusters = 0;
+    ULONG Needed;
+    ULONG Value;
+    BOOLEAN Fat32 = FALSE;
+    BOOLEAN Written;
+    ULONG i;
+    int Fd;
+
+    if (SectorsPerCluster == 0 ||
+        SectorsPerCluster > 128 ||
+        (SectorsPerCluster & (SectorsPerCluster - 1)) != 0 ||
+        BytesPerCluster % HOST_SECTOR_SIZE != 0 ||
+        TotalSectors > MAXULONG) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    //  Lay the volume out as Fat16 and switch to Fat32 if that leaves too
+    //  many clusters.  The Fat is sized by growing it until it covers the
+    //  clusters that remain after it.
+    //
+
+    while (TRUE) {
+
+        ReservedSectors = Fat32 ? HOST_FAT32_RESERVED_SECTORS : HOST_FAT16_RESERVED_SECTORS;
+        RootDirSectors = Fat32 ? 0 : HOST_FAT16_ROOT_ENTRIES * sizeof(DIRENT) / HOST_SECTOR_SIZE;
+        BytesPerEntry = Fat32 ? sizeof(ULONG) : sizeof(USHORT);
+
+        for (SectorsPerFat = 1; ; SectorsPerFat = Needed) {
+
+            if (ReservedSectors + RootDirSectors + 2 * SectorsPerFat >= TotalSectors) {
+
+                return STATUS_INVALID_PARAMETER;
+            }
+
+            Clusters = (ULONG)((TotalSectors - ReservedSectors - RootDirSectors - 2 * SectorsPerFat) /
+                               SectorsPerCluster);
+
+            Needed = (ULONG)((((ULONGLONG)Clusters + 2) * BytesPerEntry + HOST_SECTOR_SIZE - 1) /
+                             HOST_SECTOR_SIZE);
+
+            if (Needed <= SectorsPerFat) {
+
+                break;
+            }
+        }
+
+        if (Fat32 || Clusters < HOST_FAT32_MIN_CLUSTERS) {
+
+            break;
+        }
+
+        Fat32 = TRUE;
+    }
+
+    if ((Fat32 && Clusters < HOST_FAT32_MIN_CLUSTERS) ||
+        (!Fat32 && Clusters < HOST_FAT16_MIN_CLUSTERS)) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    //
+    //  Build the boot sector.
+    //
+
+    RtlZeroMemory( BootSector, sizeof(BootSector) );
+
+    BootSector[0] = 0xEB;
+    BootSector[1] = Fat32 ? 0x58 : 0x3C;
+    BootSector[2] = 0x90;
+
+    RtlCopyMemory( Boot->Oem, "MSWIN4.1", 8 );
+
+    Value = HOST_SECTOR_SIZE;
+    CopyUchar2( Boot->PackedBpb.BytesPerSector, &Value );
+    CopyUchar1( Boot->PackedBpb.SectorsPerCluster, &SectorsPerCluster );
+    CopyUchar2( Boot->PackedBpb.ReservedSectors, &ReservedSectors );
+    Value = 2;
+    CopyUchar1( Boot->PackedBpb.Fats, &Value );
+    Value = Fat32 ? 0 : HOST_FAT16_ROOT_ENTRIES;
+    CopyUchar2( Boot->PackedBpb.RootEntries, &Value );
+
+    if (!Fat32 && TotalSectors < 0x10000) {
+
+        Value = (ULONG)TotalSectors;
+        CopyUchar2( Boot->PackedBpb.Sectors, &Value );
+
+    } else {
+
+        Value = (ULONG)TotalSectors;
+        CopyUchar4( Boot->PackedBpb.LargeSectors, &Value );
+    }
+
+    Value = 0xF8;
+    CopyUchar1( Boot->PackedBpb.Media, &Value );
+    Value = 63;
+    CopyUchar2( Boot->PackedBpb.SectorsPerTrack, &Value );
+    Value = 255;
+    CopyUchar2( Boot->PackedBpb.Heads, &Value );
+
+    Value = (ULONG)time( NULL );
+
+    if (Fat32) {
+
+        CopyUchar4( BootEx->PackedBpb.LargeSectorsPerFat, &SectorsPerFat );
+        CopyUchar4( BootEx->Id, &Value );
+        Value = HOST_FAT32_ROOT_CLUSTER;
+        CopyUchar4( BootEx->PackedBpb.RootDirFirstCluster, &Value );
+        Value = HOST_FAT32_FSINFO_SECTOR;
+        CopyUchar2( BootEx->PackedBpb.FsInfoSector, &Value );
+        Value = HOST_FAT32_BACKUP_BOOT_SECTOR;
+        CopyUchar2( BootEx->PackedBpb.BackupBootSector, &Value );
+
+        BootEx->PhysicalDriveNumber = 0x80;
+        BootEx->Signature = 0x29;
+        RtlCopyMemory( BootEx->VolumeLabel, "NO NAME    ", 11 );
+        RtlCopyMemory( BootEx->SystemId, "FAT32   ", 8 );
+
+    } else {
+
+        CopyUchar2( Boot->PackedBpb.SectorsPerFat, &SectorsPerFat );
+        CopyUchar4( Boot->Id, &Value );
+
+        Boot->PhysicalDriveNumber = 0x80;
+        Boot->Signature = 0x29;
+        RtlCopyMemory( Boot->VolumeLabel, "NO NAME    ", 11 );
+        RtlCopyMemory( Boot->SystemId, "FAT16   ", 8 );
+    }
+
+    BootSector[HOST_BOOT_SIGNATURE_OFFSET] = 0x55;
+    BootSector[HOST_BOOT_SIGNATURE_OFFSET + 1] = 0xAA;
+
+    //
+    //  The first sector of each Fat holds the media entry, the clean
+    //  volume entry and, on Fat32, the end of the root's chain.
+    //
+
+    RtlZeroMemory( FatSector, sizeof(FatSector) );
+
+    if (Fat32) {
+
+        ((PULONG)FatSector)[0] = 0x0FFFFFF8;
+        ((PULONG)FatSector)[1] = 0x0FFFFFFF;
+        ((PULONG)FatSector)[HOST_FAT32_ROOT_CLUSTER] = 0x0FFFFFFF;
+
+    } else {
+
+        ((PUSHORT)FatSector)[0] = 0xFFF8;
+        ((PUSHORT)FatSector)[1] = 0xFFFF;
+    }
+
+    RtlZeroMemory( &FsInfo, sizeof(FsInfo) );
+
+    FsInfo.SectorBeginSignature = FSINFO_SECTOR_BEGIN_SIGNATURE;
+    FsInfo.FsInfoSignature = FSINFO_SIGNATURE;
+    FsInfo.FreeClusterCount = Clusters - 1;
+    FsInfo.NextFreeCluster = HOST_FAT32_ROOT_CLUSTER + 1;
+    FsInfo.SectorEndSignature = FSINFO_SECTOR_END_SIGNATURE;
+
+    //
+    //  Empty the image first so the Fats, the root directory and the rest
+    //  of the volume read back as zeroes.
+    //
+
+    Fd = open( Path, O_RDWR | O_CREAT, 0644 );
+
+    if (Fd < 0) {
+
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    Written = (ftruncate( Fd, 0 ) == 0 && ftruncate( Fd, (off_t)Size ) == 0);
+
+    Written = Written && HostWriteSectors( Fd, 0, BootSector, sizeof(BootSector) );
+
+    if (Fat32) {
+
+        Written = Written &&
+                  HostWriteSectors( Fd, HOST_FAT32_FSINFO_SECTOR, &FsInfo, sizeof(FsInfo) ) &&
+                  HostWriteSectors( Fd, HOST_FAT32_BACKUP_BOOT_SECTOR, BootSector, sizeof(BootSector) ) &&
+                  HostWriteSectors( Fd, HOST_FAT32_BACKUP_BOOT_SECTOR + 1, &FsInfo, sizeof(FsInfo) );
+    }
+
+    for (i = 0; i < 2; i += 1) {
+
+        Written = Written &&
+                  HostWriteSectors( Fd,
+                                    ReservedSectors + i * SectorsPerFat,
+                                    FatSector,
+                                    sizeof(FatSector) );
+    }
+
+    if (close( Fd ) != 0 || !Written) {
+
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+FatHostOpenImage (
+    IN PCSTR Path
+    )
+{
+    struct stat Stat;
+    USHORT BytesPerSector;
+
+    RtlZeroMemory( &FatHostImage, sizeof(HOST_IMAGE) );
+
+    FatHostImage.Fd = open( Path, O_RDWR );
+
+    if (FatHostImage.Fd < 0) {
+
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    if (fstat( FatHostImage.Fd, &Stat ) != 0 ||
+        Stat.st_size < HOST_SECTOR_SIZE) {
+
+        close( FatHostImage.Fd );
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    FatHostImage.Size = (ULONGLONG)Stat.st_size;
+
+    FatHostImage.Base = mmap( NULL,
+                              FatHostImage.Size,
+                              PROT_READ | PROT_WRITE,
+                              MAP_SHARED,
+                              FatHostImage.Fd,
+                              0 );
+
+    if (FatHostImage.Base == MAP_FAILED) {
+
+        close( FatHostImage.Fd );
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    //
+    //  Report the sector size the boot sector claims, so mount's check
+    //  of the geometry against the Bpb holds for any image we are given.
+    //
+
+    CopyUchar2( &BytesPerSector,
+                ((PPACKED_BOOT_SECTOR)FatHostImage.Base)->PackedBpb.BytesPerSector );
+
+    if (BytesPerSector != 512 && BytesPerSector != 1024 &&
+        BytesPerSector != 2048 && BytesPerSector != 4096) {
+
+        BytesPerSector = HOST_SECTOR_SIZE;
+    }
+
+    FatHostImage.BytesPerSector = BytesPerSector;
+
+    FatHostImage.DiskDevice.Type = 3;
+    FatHostImage.DiskDevice.Size = sizeof(DEVICE_OBJECT);
+    FatHostImage.DiskDevice.ReferenceCount = 1;
+    FatHostImage.DiskDevice.DeviceType = FILE_DEVICE_DISK;
+    FatHostImage.DiskDevice.StackSize = 1;
+    FatHostImage.DiskDevice.SectorSize = BytesPerSector;
+    FatHostImage.DiskDevice.Vpb = &FatHostImage.Vpb;
+
+    FatHostImage.Vpb.Type = IO_TYPE_VPB;
+    FatHostImage.Vpb.Size = sizeof(VPB);
+    FatHostImage.Vpb.RealDevice = &FatHostImage.DiskDevice;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+FatHostCloseImage (
+    VOID
+    )
+{
+    msync( FatHostImage.Base, FatHostImage.Size, MS_SYNC );
+    munmap( FatHostImage.Base, FatHostImage.Size );
+    close( FatHostImage.Fd );
+
+    FatHostImage.Base = NULL;
+    FatHostImage.Fd = -1;
+}
+
+
+//
+//  Driver and volume support
+//
+
+VOID
+FatHostInitialize (
+    VOID
+    )
+{
+    //
+    //  This follows DriverEntry, less the registry, the dispatch table and
+    //  the CD-ROM file system device.
+    //
+
+    (VOID)IoCreateDevice( &FatHostDriverObject,
+                          0,
+                          NULL,
+                          FILE_DEVICE_DISK_FILE_SYSTEM,
+                          0,
+                          FALSE,
+                          &FatDiskFileSystemDeviceObject );
+
+    RtlZeroMemory( &FatData, sizeof(FAT_DATA) );
+
+    FatData.NodeTypeCode = FAT_NTC_DATA_HEADER;
+    FatData.NodeByteSize = sizeof(FAT_DATA);
+
+    InitializeListHead( &FatData.VcbQueue );
+
+    FatData.DriverObject = &FatHostDriverObject;
+    FatData.DiskFileSystemDeviceObject = FatDiskFileSystemDeviceObject;
+    FatData.CdromFileSystemDeviceObject = NULL;
+
+    InitializeListHead( &FatData.AsyncCloseList );
+    InitializeListHead( &FatData.DelayedCloseList );
+    InitializeListHead( &FatData.DirentIndexLruList );
+
+    KeInitializeSpinLock( &FatData.GeneralSpinLock );
+
+    FatMaxDelayedCloseCount = FAT_MAX_DELAYED_CLOSES;
+
+    FatData.CacheManagerCallbacks.AcquireForLazyWrite  = &FatAcquireFcbForLazyWrite;
+    FatData.CacheManagerCallbacks.ReleaseFromLazyWrite = &FatReleaseFcbFromLazyWrite;
+    FatData.CacheManagerCallbacks.AcquireForReadAhead  = &FatAcquireFcbForReadAhead;
+    FatData.CacheManagerCallbacks.ReleaseFromReadAhead = &FatReleaseFcbFromReadAhead;
+
+    FatData.CacheManagerNoOpCallbacks.AcquireForLazyWrite  = &FatNoOpAcquire;
+    FatData.CacheManagerNoOpCallbacks.ReleaseFromLazyWrite = &FatNoOpRelease;
+    FatData.CacheManagerNoOpCallbacks.AcquireForReadAhead  = &FatNoOpAcquire;
+    FatData.CacheManagerNoOpCallbacks.ReleaseFromReadAhead = &FatNoOpRelease;
+
+    FatData.OurProcess = PsGetCurrentProcess();
+    FatData.NumberProcessors = KeQueryActiveProcessorCount( NULL );
+    FatData.ChicagoMode = TRUE;
+    FatData.CodePageInvariant = TRUE;
+    FatData.FujitsuFMR = FALSE;
+
+    ExInitializeResourceLite( &FatData.Resource );
+
+    ExInitializeNPagedLookasideList( &FatIrpContextLookasideList,
+                                     NULL,
+                                     NULL,
+                                     0,
+                                     sizeof(IRP_CONTEXT),
+                                     TAG_IRP_CONTEXT,
+                                     0 );
+
+    ExInitializeNPagedLookasideList( &FatNonPagedFcbLookasideList,
+                                     NULL,
+                                     NULL,
+                                     0,
+                                     sizeof(NON_PAGED_FCB),
+                                     TAG_FCB_NONPAGED,
+                                     0 );
+
+    ExInitializeNPagedLookasideList( &FatEResourceLookasideList,
+                                     NULL,
+                                     NULL,
+                                     0,
+                                     sizeof(ERESOURCE),
+                                     TAG_ERESOURCE,
+                                     0 );
+
+    ExInitializeSListHead( &FatCloseContextSList );
+    ExInitializeFastMutex( &FatCloseQueueMutex );
+    ExInitializeFastMutex( &FatDirentIndexMutex );
+    KeInitializeEvent( &FatReserveEvent, SynchronizationEvent, TRUE );
+}
+
+PVCB
+FatHostMount (
+    VOID
+    )
+{
+    PIRP Irp;
+    PIO_STACK_LOCATION IrpSp;
+    PIRP_CONTEXT IrpContext;
+    NTSTATUS Status;
+
+    //
+    //  Build the mount request the I/O manager sends the file system
+    //  device when a volume is first opened.
+    //
+
+    Irp = HostAllocateIrp();
+    IrpSp = IoGetCurrentIrpStackLocation( Irp );
+
+    IrpSp->MajorFunction = IRP_MJ_FILE_SYSTEM_CONTROL;
+    IrpSp->MinorFunction = IRP_MN_MOUNT_VOLUME;
+    IrpSp->DeviceObject = FatData.DiskFileSystemDeviceObject;
+    IrpSp->Parameters.MountVolume.Vpb = &FatHostImage.Vpb;
+    IrpSp->Parameters.MountVolume.DeviceObject = &FatHostImage.DiskDevice;
+
+    IoSetTopLevelIrp( Irp );
+
+    IrpContext = FatCreateIrpContext( Irp, TRUE );
+
+    Status = FatMountVolume( IrpContext,
+                             &FatHostImage.DiskDevice,
+                             &FatHostImage.Vpb,
+                             FatData.DiskFileSystemDeviceObject );
+
+    FatUnpinRepinnedBcbs( IrpContext );
+
+    FatCompleteRequest( IrpContext, NULL, Status );
+
+    IoSetTopLevelIrp( NULL );
+    IoFreeIrp( Irp );
+
+    if (!NT_SUCCESS( Status )) {
+
+        return NULL;
+    }
+
+    SetFlag( FatHostImage.Vpb.Flags, VPB_MOUNTED );
+
+    return &((PVOLUME_DEVICE_OBJECT)FatHostImage.Vpb.DeviceObject)->Vcb;
+}
+
+VOID
+FatHostDismount (
+    IN PVCB Vcb
+    )
+{
+    PIRP_CONTEXT IrpContext;
+    PVOLUME_DEVICE_OBJECT VolDo;
+    PUCHAR Fat;
+    ULONG i;
+
+    VolDo = CONTAINING_RECORD( Vcb, VOLUME_DEVICE_OBJECT, Vcb );
+
+    IrpContext = FatHostCreateIrpContext( Vcb, IRP_MJ_FILE_SYSTEM_CONTROL );
+
+    (VOID)FatAcquireExclusiveGlobal( IrpContext );
+    (VOID)FatAcquireExclusiveVcb( IrpContext, Vcb );
+
+    //
+    //  Write everything back and mark the volume clean, as a flushing
+    //  dismount does.
+    //
+
+    FatHostFlushAllCacheMaps();
+
+    if (FlagOn( Vcb->VcbState, VCB_STATE_FLAG_VOLUME_DIRTY ) &&
+        !FlagOn( Vcb->VcbState, VCB_STATE_FLAG_MOUNTED_DIRTY )) {
+
+        FatMarkVolume( IrpContext, Vcb, VolumeClean );
+        ClearFlag( Vcb->VcbState, VCB_STATE_FLAG_VOLUME_DIRTY );
+    }
+
+    FatUnpinRepinnedBcbs( IrpContext );
+
+    //
+    //  The volume file is mapped straight onto the image, so the Fat has
+    //  only been updated in place.  Bring the other copies up to date, as
+    //  writing the Fat through the volume file would have.
+    //
+
+    if (!Vcb->Bpb.MirrorDisabled) {
+
+        Fat = FatHostImage.Base + FatReservedBytes( &Vcb->Bpb );
+
+        for (i = 1; i < Vcb->Bpb.Fats; i += 1) {
+
+            RtlCopyMemory( Fat + i * FatBytesPerFat( &Vcb->Bpb ),
+                           Fat,
+                           FatBytesPerFat( &Vcb->Bpb ));
+        }
+    }
+
+    msync( FatHostImage.Base, FatHostImage.Size, MS_SYNC );
+
+    FatTearDownVcb( IrpContext, Vcb );
+
+    FatReleaseVcb( IrpContext, Vcb );
+
+    FatDeleteVcb( IrpContext, Vcb );
+
+    FatReleaseGlobal( IrpContext );
+
+    FatHostCompleteRequest( IrpContext );
+
+    ClearFlag( FatHostImage.Vpb.Flags, VPB_MOUNTED );
+    FatHostImage.Vpb.DeviceObject = NULL;
+
+    IoDeleteDevice( &VolDo->DeviceObject );
+}
+
+PIRP_CONTEXT
+FatHostCreateIrpContext (
+    IN PVCB Vcb,
+    IN UCHAR MajorFunction
+    )
+{
+    PIRP Irp;
+    PIO_STACK_LOCATION IrpSp;
+    PIRP_CONTEXT IrpContext;
+
+    Irp = HostAllocateIrp();
+    IrpSp = IoGetCurrentIrpStackLocation( Irp );
+
+    IrpSp->MajorFunction = MajorFunction;
+    IrpSp->DeviceObject = &CONTAINING_RECORD( Vcb, VOLUME_DEVICE_OBJECT, Vcb )->DeviceObject;
+
+    //
+    //  There is no file object, so a file system control finds the real
+    //  device through the Vpb it names.
+    //
+
+    if (MajorFunction == IRP_MJ_FILE_SYSTEM_CONTROL) {
+
+        IrpSp->Parameters.MountVolume.Vpb = Vcb->Vpb;
+    }
+
+    IoSetTopLevelIrp( Irp );
+
+    IrpContext = FatCreateIrpContext( Irp, TRUE );
+
+    IrpContext->Vcb = Vcb;
+    IrpContext->RealDevice = Vcb->CurrentDevice;
+
+    return IrpContext;
+}
+
+VOID
+FatHostCompleteRequest (
+    IN PIRP_CONTEXT IrpContext
+    )
+{
+    PIRP Irp = IrpContext->OriginatingIrp;
+
+    //
+    //  The dispatch routines unpin what the request left repinned before
+    //  they complete it.
+    //
+
+    FatUnpinRepinnedBcbs( IrpContext );
+
+    FatCompleteRequest( IrpContext, NULL, STATUS_SUCCESS );
+
+    IoSetTopLevelIrp( NULL );
+    IoFreeIrp( Irp );
+}
+
+VOID
+FatHostCloseStreamFile (
+    IN PFILE_OBJECT FileObject
+    )
+{
+    PVCB Vcb;
+    PFCB Fcb;
+    PCCB Ccb;
+
+    //
+    //  This is what close does for the internal streams.  The directory
+    //  and Ea streams had a close context set aside for them when they
+    //  were opened, which the close would have been queued with.
+    //
+
+    switch (FatDecodeFileObject( FileObject, &Vcb, &Fcb, &Ccb )) {
+
+    case VirtualVolumeFile:
+
+        Vcb->InternalOpenCount -= 1;
+        Vcb->ResidualOpenCount -= 1;
+        break;
+
+    case EaFile:
+
+        Vcb->InternalOpenCount -= 1;
+        Vcb->ResidualOpenCount -= 1;
+
+        ExFreePool( FatAllocateCloseContext( Vcb ));
+        break;
+
+    case DirectoryFile:
+
+        Fcb->Specific.Dcb.DirectoryFileOpenCount -= 1;
+        Vcb->InternalOpenCount -= 1;
+
+        if (NodeType( Fcb ) == FAT_NTC_ROOT_DCB) {
+
+            Vcb->ResidualOpenCount -= 1;
+        }
+
+        ExFreePool( FatAllocateCloseContext( Vcb ));
+        break;
+
+    default:
+
+        break;
+    }
+}
+
+
+//
+//  The disk
+//
+
+NTSTATUS
+IoCallDriver (
+    IN PDEVICE_OBJECT DeviceObject,
+    IN PIRP Irp
+    )
+{
+    PIO_STACK_LOCATION IrpSp;
+    PIO_COMPLETION_ROUTINE CompletionRoutine;
+    NTSTATUS Status;
+    PUCHAR Buffer;
+    ULONGLONG Offset;
+    ULONG Length;
+
+    Irp->Tail.Overlay.CurrentStackLocation -= 1;
+    IrpSp = IoGetCurrentIrpStackLocation( Irp );
+
+    if (DeviceObject != &FatHostImage.DiskDevice) {
+
+        fprintf( stderr, "fathost: request for a device other than the disk\n" );
+        abort();
+    }
+
+    Buffer = Irp->UserBuffer;
+
+    if (Buffer == NULL && Irp->MdlAddress != NULL) {
+
+        Buffer = MmGetSystemAddressForMdlSafe( Irp->MdlAddress, NormalPagePriority );
+    }
+
+    Irp->IoStatus.Information = 0;
+
+    switch (IrpSp->MajorFunction) {
+
+    case IRP_MJ_READ:
+    case IRP_MJ_WRITE:
+
+        Offset = IrpSp->Parameters.Read.ByteOffset.QuadPart;
+        Length = IrpSp->Parameters.Read.Length;
+
+        if (Offset > FatHostImage.Size || Length > FatHostImage.Size - Offset) {
+
+            Status = STATUS_END_OF_FILE;
+            break;
+        }
+
+        //
+        //  The buffer may be a pinned piece of the image itself.
+        //
+
+        if (IrpSp->MajorFunction == IRP_MJ_READ) {
+
+            memmove( Buffer, FatHostImage.Base + Offset, Length );
+
+        } else {
+
+            memmove( FatHostImage.Base + Offset, Buffer, Length );
+        }
+
+        Irp->IoStatus.Information = Length;
+        Status = STATUS_SUCCESS;
+        break;
+
+    case IRP_MJ_DEVICE_CONTROL:
+
+        Status = HostDiskDeviceControl( IrpSp, Buffer, &Irp->IoStatus.Information );
+        break;
+
+    case IRP_MJ_FLUSH_BUFFERS:
+
+        Status = STATUS_SUCCESS;
+        break;
+
+    default:
+
+        Status = STATUS_INVALID_DEVICE_REQUEST;
+        break;
+    }
+
+    Irp->IoStatus.Status = Status;
+
+    //
+    //  Complete the request inline.  A completion routine that claims the
+    //  Irp frees it itself.
+    //
+
+    CompletionRoutine = IrpSp->CompletionRoutine;
+
+    Irp->Tail.Overlay.CurrentStackLocation += 1;
+
+    if (CompletionRoutine != NULL &&
+        CompletionRoutine( DeviceObject, Irp, IrpSp->Context ) == STATUS_MORE_PROCESSING_REQUIRED) {
+
+        return Status;
+    }
+
+    if (Irp->UserIosb != NULL) {
+
+        *Irp->UserIosb = Irp->IoStatus;
+    }
+
+    if (Irp->UserEvent != NULL) {
+
+        KeSetEvent( Irp->UserEvent, 0, FALSE );
+    }
+
+    IoFreeIrp( Irp );
+
+    return Status;
+}
+
+
+//
+//  Device I/O, close and Ea support normally in DevIoSup.c, Close.c and
+//  EaSup.c
+//
+
+NTSTATUS
+FatPerformDevIoCtrl (
+    IN PIRP_CONTEXT IrpContext,
+    IN ULONG IoControlCode,
+    IN PDEVICE_OBJECT Device,
+    IN PVOID InputBuffer OPTIONAL,
+    IN ULONG InputBufferLength,
+    OUT PVOID OutputBuffer OPTIONAL,
+    IN ULONG OutputBufferLength,
+    IN BOOLEAN InternalDeviceIoControl,
+    IN BOOLEAN OverrideVerify,
+    OUT PIO_STATUS_BLOCK Iosb OPTIONAL
+    )
+{
+    IO_STATUS_BLOCK LocalIosb;
+    KEVENT Event;
+    PIRP Irp;
+
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( OverrideVerify );
+
+    KeInitializeEvent( &Event, NotificationEvent, FALSE );
+
+    Irp = IoBuildDeviceIoControlRequest( IoControlCode,
+                                         Device,
+                                         InputBuffer,
+                                         InputBufferLength,
+                                         OutputBuffer,
+                                         OutputBufferLength,
+                                         InternalDeviceIoControl,
+                                         &Event,
+                                         ARGUMENT_PRESENT( Iosb ) ? Iosb : &LocalIosb );
+
+    return IoCallDriver( Device, Irp );
+}
+
+NTSTATUS
+FatToggleMediaEjectDisable (
+    IN PIRP_CONTEXT IrpContext,
+    IN PVCB Vcb,
+    IN BOOLEAN PreventRemoval
+    )
+{
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Vcb );
+    UNREFERENCED_PARAMETER( PreventRemoval );
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+FatFspClose (
+    IN PVCB Vcb OPTIONAL
+    )
+{
+    //
+    //  Closes are never queued here, the last dereference of a stream
+    //  closes it on the spot.
+    //
+
+    UNREFERENCED_PARAMETER( Vcb );
+}
+
+VOID
+FatDeleteEa (
+    IN PIRP_CONTEXT IrpContext,
+    IN PVCB Vcb,
+    IN USHORT EaHandle,
+    IN POEM_STRING FileName
+    )
+{
+    //
+    //  The benchmark never gives a file extended attributes.
+    //
+
+    UNREFERENCED_PARAMETER( IrpContext );
+    UNREFERENCED_PARAMETER( Vcb );
+    UNREFERENCED_PARAMETER( EaHandle );
+    UNREFERENCED_PARAMETER( FileName );
+}
+
+
+//
+//  Local support routine
+//
+
+NTSTATUS
+HostDiskDeviceControl (
+    IN PIO_STACK_LOCATION IrpSp,
+    IN PVOID Buffer,
+    OUT PULONG_PTR Information
+    )
+
+/*++
+
+Routine Description:
+
+    This routine answers the disk and storage ioctls the mount path sends,
+    describing the image as a fixed, writable disk holding one partition.
+
+Arguments:
+
+    IrpSp - Supplies the disk's stack location for the request.
+
+    Buffer - Supplies the output buffer.
+
+    Information - Receives the number of bytes returned.
+
+Return Value:
+
+    NTSTATUS - The status of the request.
+
+--*/
+
+{
+    ULONG OutputLength = IrpSp->Parameters.DeviceIoControl.OutputBufferLength;
+
+    switch (IrpSp->Parameters.DeviceIoControl.IoControlCode) {
+
+    case IOCTL_DISK_CHECK_VERIFY:
+    case IOCTL_STORAGE_CHECK_VERIFY:
+
+        if (Buffer != NULL && OutputLength >= sizeof(ULONG)) {
+
+            *(PULONG)Buffer = 0;
+            *Information = sizeof(ULONG);
+        }
+
+        return STATUS_SUCCESS;
+
+    case IOCTL_DISK_IS_WRITABLE:
+
+        return STATUS_SUCCESS;
+
+    case IOCTL_DISK_GET_DRIVE_GEOMETRY: {
+
+        PDISK_GEOMETRY Geometry = Buffer;
+
+        if (OutputLength < sizeof(DISK_GEOMETRY)) {
+
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+
+        Geometry->MediaType = FixedMedia;
+        Geometry->TracksPerCylinder = 255;
+        Geometry->SectorsPerTrack = 63;
+        Geometry->BytesPerSector = FatHostImage.BytesPerSector;
+        Geometry->Cylinders.QuadPart = FatHostImage.Size /
+                                       (255 * 63 * FatHostImage.BytesPerSector);
+
+        *Information = sizeof(DISK_GEOMETRY);
+        return STATUS_SUCCESS;
+    }
+
+    case IOCTL_DISK_GET_LENGTH_INFO: {
+
+        PGET_LENGTH_INFORMATION LengthInfo = Buffer;
+
+        if (OutputLength < sizeof(GET_LENGTH_INFORMATION)) {
+
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+
+        LengthInfo->Length.QuadPart = FatHostImage.Size;
+
+        *Information = sizeof(GET_LENGTH_INFORMATION);
+        return STATUS_SUCCESS;
+    }
+
+    case IOCTL_DISK_GET_PARTITION_INFO_EX: {
+
+        PPARTITION_INFORMATION_EX Partition = Buffer;
+
+        if (OutputLength < sizeof(PARTITION_INFORMATION_EX)) {
+
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+
+        RtlZeroMemory( Partition, sizeof(PARTITION_INFORMATION_EX) );
+
+        Partition->PartitionStyle = PARTITION_STYLE_MBR;
+        Partition->PartitionLength.QuadPart = FatHostImage.Size;
+        Partition->PartitionNumber = 1;
+        Partition->Mbr.PartitionType = 0x0C;
+        Partition->Mbr.RecognizedPartition = TRUE;
+
+        *Information = sizeof(PARTITION_INFORMATION_EX);
+        return STATUS_SUCCESS;
+    }
+
+    case IOCTL_STORAGE_GET_HOTPLUG_INFO: {
+
+        PSTORAGE_HOTPLUG_INFO Hotplug = Buffer;
+
+        if (OutputLength < sizeof(STORAGE_HOTPLUG_INFO)) {
+
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+
+        RtlZeroMemory( Hotplug, sizeof(STORAGE_HOTPLUG_INFO) );
+        Hotplug->Size = sizeof(STORAGE_HOTPLUG_INFO);
+
+        *Information = sizeof(STORAGE_HOTPLUG_INFO);
+        return STATUS_SUCCESS;
+    }
+
+    default:
+
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+}
+
+
+//
+//  Local support routine
+//
+
+BOOLEAN
+HostWriteSectors (
+    IN int Fd,
+    IN ULONGLONG Sector,
+    IN PVOID Buffer,
+    IN ULONG Length
+    )
+
+/*++
+
+Routine Description:
+
+    This routine writes whole sectors to an image being formatted.
+
+Arguments:
+
+    Fd - Supplies the image.
+
+    Sector - Supplies the first sector to write.
+
+    Buffer - Supplies the data.
+
+    Length - Supplies the number of bytes to write.
+
+Return Value:
+
+    BOOLEAN - TRUE if every byte was written.
+
+--*/
+
+{
+    return pwrite( Fd, Buffer, Length, (off_t)(Sector * HOST_SECTOR_SIZE)) == (ssize_t)Length;
+}
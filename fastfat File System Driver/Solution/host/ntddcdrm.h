@@ -0,0 +1,45 @@
+/*++
+
+Copyright (c) 1989-2000 Microsoft Corporation
+
+Module Name:
+
+    NtDdCdrm.h
+
+Abstract:
+
+    The host build's stand in for the cdrom ioctl definitions used by the
+    Fat mount path.
+
+
+--*/
+
+#ifndef _HOST_NTDDCDRM_
+#define _HOST_NTDDCDRM_
+
+#include <ntddstor.h>
+
+#define IOCTL_CDROM_BASE 0x00000002
+
+#define IOCTL_CDROM_READ_TOC CTL_CODE(IOCTL_CDROM_BASE, 0x0000, METHOD_BUFFERED, FILE_READ_ACCESS)
+#define IOCTL_CDROM_CHECK_VERIFY CTL_CODE(IOCTL_CDROM_BASE, 0x0200, METHOD_BUFFERED, FILE_READ_ACCESS)
+
+#define MAXIMUM_NUMBER_TRACKS 100
+
+typedef struct _TRACK_DATA {
+    UCHAR Reserved;
+    UCHAR Control : 4;
+    UCHAR Adr : 4;
+    UCHAR TrackNumber;
+    UCHAR Reserved1;
+    UCHAR Address[4];
+} TRACK_DATA, *PTRACK_DATA;
+
+typedef struct _CDROM_TOC {
+    UCHAR Length[2];
+    UCHAR FirstTrack;
+    UCHAR LastTrack;
+    TRACK_DATA TrackData[MAXIMUM_NUMBER_TRACKS];
+} CDROM_TOC, *PCDROM_TOC;
+
+#endif // _HOST_NTDDCDRM_
@@ -0,0 +1,20 @@
+/*++
+
+Copyright (c) 1989-2000 Microsoft Corporation
+
+Module Name:
+
+    NtDdScsi.h
+
+Abstract:
+
+    The host build's stand in for the scsi ioctl definitions.  The Fat
+    modules built on the host use none of them.
+
+
+--*/
+
+#ifndef _HOST_NTDDSCSI_
+#define _HOST_NTDDSCSI_
+
+#endif // _HOST_NTDDSCSI_
@@ -0,0 +1,1693 @@
+/*++
+
+Copyright (c) 1989-2000 Microsoft Corporation
+
+Module Name:
+
+    NtIfs.h
+
+Abstract:
+
+    This module is the host build's stand in for the kernel headers.  It
+    defines just enough of the types, macros and routines used by the Fat
+    allocation, directory, name and cache support modules for them to be
+    compiled unchanged by a user mode compiler.  The routines declared
+    here are implemented in HostShim.c, HostRtl.c, HostCc.c and HostVol.c.
+
+    The host build is single threaded and runs against an image file, so
+    resources, mutexes, events and spin locks are bookkeeping only, and an
+    exception raised by the file system terminates the process.
+
+
+--*/
+
+#ifndef _HOST_NTIFS_
+#define _HOST_NTIFS_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+//
+//  Basic types.  The host is LP64, so the 32 bit Windows types must not
+//  be built on long.
+//
+
+#define VOID void
+#define IN
+#define OUT
+#define OPTIONAL
+#define UNALIGNED
+#define NOTHING
+#define FASTCALL
+#define NTAPI
+#define CONST const
+#define __inline inline
+#define __forceinline inline
+#define FORCEINLINE inline
+#define __volatile
+#define DECLSPEC_NORETURN __attribute__((noreturn))
+
+#define __declspec(X)
+#define __assume(X)
+
+typedef char CHAR, CCHAR, *PCHAR, *PSZ;
+typedef unsigned char UCHAR, *PUCHAR;
+typedef short SHORT, CSHORT, *PSHORT;
+typedef unsigned short USHORT, *PUSHORT;
+typedef int LONG, *PLONG;
+typedef unsigned int ULONG, *PULONG, CLONG, *PCLONG, ULONG32, LOGICAL;
+typedef int64_t LONGLONG, LONG64, *PLONGLONG, *PLONG64;
+typedef uint64_t ULONGLONG, ULONG64, *PULONGLONG, *PULONG64;
+typedef intptr_t LONG_PTR;
+typedef uintptr_t ULONG_PTR, *PULONG_PTR, SIZE_T, *PSIZE_T, KAFFINITY, *PKAFFINITY;
+typedef unsigned short WCHAR, *PWCHAR, *PWCH, *PWSTR;
+typedef const WCHAR *PCWSTR, *PCWCH;
+typedef const CHAR *PCSTR;
+typedef void *PVOID, **PPVOID;
+typedef UCHAR BOOLEAN, *PBOOLEAN;
+typedef LONG NTSTATUS, *PNTSTATUS;
+typedef ULONG ACCESS_MASK, *PACCESS_MASK;
+typedef UCHAR KIRQL, *PKIRQL;
+typedef CHAR KPROCESSOR_MODE;
+typedef ULONG_PTR KSPIN_LOCK, *PKSPIN_LOCK;
+typedef ULONG_PTR ERESOURCE_THREAD;
+typedef PVOID PSECURITY_DESCRIPTOR, PSID, HANDLE, *PHANDLE;
+
+#define TRUE 1
+#define FALSE 0
+#ifndef NULL
+#define NULL ((void *)0)
+#endif
+
+#define MAXULONG 0xffffffff
+#define MAXUSHORT 0xffff
+#define MAXLONG 0x7fffffff
+#define MAXLONGLONG 0x7fffffffffffffffLL
+
+#define NTDDI_VISTA 0x06000000
+#define NTDDI_WIN7 0x06010000
+#define NTDDI_WIN8 0x06020000
+#define NTDDI_VERSION NTDDI_WIN8
+
+#define KernelMode 0
+#define UserMode 1
+
+#define PAGE_SIZE 0x1000
+#define PAGE_SHIFT 12
+
+#define ROUND_TO_PAGES(Size) (((ULONG_PTR)(Size) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+#define BYTES_TO_PAGES(Size) ((ULONG)(((ULONG_PTR)(Size) + PAGE_SIZE - 1) >> PAGE_SHIFT))
+#define ALIGN_DOWN_BY(L,A) ((ULONG_PTR)(L) & ~((ULONG_PTR)(A) - 1))
+#define ALIGN_UP_BY(L,A) (ALIGN_DOWN_BY(((ULONG_PTR)(L) + (A) - 1), (A)))
+#define PAGE_ALIGN(Va) ((PVOID)((ULONG_PTR)(Va) & ~(PAGE_SIZE - 1)))
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        LONG HighPart;
+    };
+    struct {
+        ULONG LowPart;
+        LONG HighPart;
+    } u;
+    LONGLONG QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+typedef struct _LUID {
+    ULONG LowPart;
+    LONG HighPart;
+} LUID, *PLUID;
+
+typedef union _ULARGE_INTEGER {
+    struct {
+        ULONG LowPart;
+        ULONG HighPart;
+    };
+    ULONGLONG QuadPart;
+} ULARGE_INTEGER, *PULARGE_INTEGER;
+
+#define FIELD_OFFSET(Type,Field) ((LONG)offsetof(Type,Field))
+#define RTL_FIELD_SIZE(Type,Field) (sizeof(((Type *)0)->Field))
+#define RTL_SIZEOF_THROUGH_FIELD(Type,Field) (FIELD_OFFSET(Type,Field) + RTL_FIELD_SIZE(Type,Field))
+#define CONTAINING_RECORD(Address,Type,Field) ((Type *)((PCHAR)(Address) - (ULONG_PTR)(&((Type *)0)->Field)))
+#define ARGUMENT_PRESENT(P) ((P) != NULL)
+#define ARRAYSIZE(A) (sizeof(A) / sizeof((A)[0]))
+#define UNREFERENCED_PARAMETER(P) ((void)(P))
+#define DBG_UNREFERENCED_PARAMETER(P) ((void)(P))
+#define DBG_UNREFERENCED_LOCAL_VARIABLE(V) ((void)(V))
+#define C_ASSERT(E) _Static_assert((E), #E)
+#define min(A,B) (((A) < (B)) ? (A) : (B))
+#define max(A,B) (((A) > (B)) ? (A) : (B))
+
+#define FlagOn(F,SF) ((F) & (SF))
+#define BooleanFlagOn(F,SF) ((BOOLEAN)(((F) & (SF)) != 0))
+#define SetFlag(F,SF) ((F) |= (SF))
+#define ClearFlag(F,SF) ((F) &= ~(SF))
+
+#define Int32x32To64(A,B) ((LONGLONG)((LONG)(A)) * (LONGLONG)((LONG)(B)))
+#define UInt32x32To64(A,B) ((ULONGLONG)(ULONG)(A) * (ULONGLONG)(ULONG)(B))
+
+//
+//  Source annotations carry no meaning here.
+//
+
+#define _In_
+#define _In_opt_
+#define _In_reads_opt_(X)
+#define _In_z_
+#define _Inout_
+#define _Inout_opt_
+#define _Out_
+#define _Out_opt_
+#define _Outptr_
+#define _Outptr_result_maybenull_
+#define _Outptr_result_bytebuffer_(X)
+#define _Out_writes_bytes_(X)
+#define _In_reads_bytes_(X)
+#define _In_reads_(X)
+#define _Out_writes_(X)
+#define _Inout_updates_bytes_(X)
+#define _Field_size_(X)
+#define _Field_size_bytes_(X)
+#define _Field_size_bytes_part_(X,Y)
+#define _Success_(X)
+#define _When_(X,Y)
+#define _At_(X,Y)
+#define _Pre_satisfies_(X)
+#define _Post_satisfies_(X)
+#define _Post_notnull_
+#define _Ret_maybenull_
+#define _Ret_notnull_
+#define _Must_inspect_result_
+#define _Check_return_
+#define _Analysis_assume_(X)
+#define _Analysis_assume_lock_held_(X)
+#define _Analysis_assume_lock_not_held_(X)
+#define _Function_class_(X)
+#define _Dispatch_type_(X)
+#define _Requires_lock_held_(X)
+#define _Requires_lock_not_held_(X)
+#define _Requires_exclusive_lock_held_(X)
+#define _Requires_shared_lock_held_(X)
+#define _Acquires_lock_(X)
+#define _Acquires_exclusive_lock_(X)
+#define _Acquires_shared_lock_(X)
+#define _Releases_lock_(X)
+#define _Releases_exclusive_lock_(X)
+#define _Releases_shared_lock_(X)
+#define _Releases_nonreentrant_lock_(X)
+#define _Acquires_nonreentrant_lock_(X)
+#define _Guarded_by_(X)
+#define _Interlocked_
+#define _IRQL_requires_(X)
+#define _IRQL_requires_max_(X)
+#define _IRQL_requires_same_
+#define _IRQL_raises_(X)
+#define _IRQL_saves_
+#define _IRQL_restores_
+#define _Kernel_float_used_
+#define _Enters_critical_region_
+#define _Leaves_critical_region_
+#define _Global_critical_region_
+#define _Global_cancel_spin_lock_
+#define _No_competing_thread_
+#define _Unreferenced_parameter_
+#define _Printf_format_string_
+#define _Null_terminated_
+#define _Post_invalid_
+#define _Frees_ptr_
+#define _Frees_ptr_opt_
+#define _Pre_notnull_
+#define _Notnull_
+#define _Maybenull_
+#define _Readable_bytes_(X)
+#define _Writable_bytes_(X)
+
+//
+//  Structured exception handling.  The host cannot unwind, so an exception
+//  is fatal (see ExRaiseStatus) and a try body always terminates normally.
+//  Each try opens a block with its own leave label, so leave behaves as it
+//  does in the kernel even from inside a loop, and except handlers are
+//  compiled but never run.
+//
+
+#define try { __label__ __host_leave; if (1)
+#define finally __host_leave: ; } if (1)
+#define except(X) __host_leave: ; } if (0)
+#define leave goto __host_leave
+#define AbnormalTermination() (FALSE)
+#define GetExceptionCode() (STATUS_SUCCESS)
+#define GetExceptionInformation() (NULL)
+
+#define EXCEPTION_EXECUTE_HANDLER 1
+#define EXCEPTION_CONTINUE_SEARCH 0
+#define EXCEPTION_CONTINUE_EXECUTION (-1)
+
+typedef struct _EXCEPTION_RECORD {
+    NTSTATUS ExceptionCode;
+    ULONG ExceptionFlags;
+    struct _EXCEPTION_RECORD *ExceptionRecord;
+    PVOID ExceptionAddress;
+    ULONG NumberParameters;
+    ULONG_PTR ExceptionInformation[15];
+} EXCEPTION_RECORD, *PEXCEPTION_RECORD;
+
+typedef struct _EXCEPTION_POINTERS {
+    PEXCEPTION_RECORD ExceptionRecord;
+    PVOID ContextRecord;
+} EXCEPTION_POINTERS, *PEXCEPTION_POINTERS;
+
+//
+//  Status values.
+//
+
+#define NT_SUCCESS(S) (((NTSTATUS)(S)) >= 0)
+#define NT_ERROR(S) ((((ULONG)(S)) >> 30) == 3)
+#define NT_WARNING(S) ((((ULONG)(S)) >> 30) == 2)
+#define NT_INFORMATION(S) ((((ULONG)(S)) >> 30) == 1)
+
+#define STATUS_SUCCESS                   ((NTSTATUS)0x00000000)
+#define STATUS_PENDING                   ((NTSTATUS)0x00000103)
+#define STATUS_MORE_PROCESSING_REQUIRED  ((NTSTATUS)0xC0000016)
+#define STATUS_REPARSE                   ((NTSTATUS)0x00000104)
+#define STATUS_FSFILTER_OP_COMPLETED_SUCCESSFULLY ((NTSTATUS)0x00000126)
+#define STATUS_BUFFER_OVERFLOW           ((NTSTATUS)0x80000005)
+#define STATUS_NO_MORE_FILES             ((NTSTATUS)0x80000006)
+#define STATUS_VERIFY_REQUIRED           ((NTSTATUS)0x80000016)
+#define STATUS_UNSUCCESSFUL              ((NTSTATUS)0xC0000001)
+#define STATUS_NOT_IMPLEMENTED           ((NTSTATUS)0xC0000002)
+#define STATUS_INVALID_PARAMETER         ((NTSTATUS)0xC000000D)
+#define STATUS_NO_SUCH_DEVICE            ((NTSTATUS)0xC000000E)
+#define STATUS_END_OF_FILE               ((NTSTATUS)0xC0000011)
+#define STATUS_NO_MEDIA_IN_DEVICE        ((NTSTATUS)0xC0000013)
+#define STATUS_NO_MEMORY                 ((NTSTATUS)0xC0000017)
+#define STATUS_ACCESS_DENIED             ((NTSTATUS)0xC0000022)
+#define STATUS_BUFFER_TOO_SMALL          ((NTSTATUS)0xC0000023)
+#define STATUS_OBJECT_NAME_INVALID       ((NTSTATUS)0xC0000033)
+#define STATUS_OBJECT_NAME_NOT_FOUND     ((NTSTATUS)0xC0000034)
+#define STATUS_OBJECT_NAME_COLLISION     ((NTSTATUS)0xC0000035)
+#define STATUS_FILE_LOCK_CONFLICT        ((NTSTATUS)0xC0000054)
+#define STATUS_NONEXISTENT_EA_ENTRY      ((NTSTATUS)0xC0000051)
+#define STATUS_NO_EAS_ON_FILE            ((NTSTATUS)0xC0000052)
+#define STATUS_EA_CORRUPT_ERROR          ((NTSTATUS)0xC0000053)
+#define STATUS_DELETE_PENDING            ((NTSTATUS)0xC0000056)
+#define STATUS_DISK_CORRUPT_ERROR        ((NTSTATUS)0xC0000032)
+#define STATUS_DISK_FULL                 ((NTSTATUS)0xC000007F)
+#define STATUS_INSUFFICIENT_RESOURCES    ((NTSTATUS)0xC000009A)
+#define STATUS_DEVICE_NOT_READY          ((NTSTATUS)0xC00000A3)
+#define STATUS_IN_PAGE_ERROR             ((NTSTATUS)0xC0000006)
+#define STATUS_INVALID_DEVICE_REQUEST    ((NTSTATUS)0xC0000010)
+#define STATUS_FILE_INVALID              ((NTSTATUS)0xC0000098)
+#define STATUS_INVALID_EA_NAME           ((NTSTATUS)0x80000013)
+#define STATUS_EA_LIST_INCONSISTENT      ((NTSTATUS)0x80000014)
+#define STATUS_IO_DEVICE_ERROR           ((NTSTATUS)0xC0000185)
+#define STATUS_FILE_CORRUPT_ERROR        ((NTSTATUS)0xC0000102)
+#define STATUS_FILE_CORRUPT              STATUS_FILE_CORRUPT_ERROR
+#define STATUS_UNEXPECTED_IO_ERROR       ((NTSTATUS)0xC00000E9)
+#define STATUS_CANNOT_MAKE               ((NTSTATUS)0xC00002EA)
+#define STATUS_CANT_WAIT                 ((NTSTATUS)0xC00000D8)
+#define STATUS_DRIVER_INTERNAL_ERROR     ((NTSTATUS)0xC0000183)
+#define STATUS_UNMAPPABLE_CHARACTER      ((NTSTATUS)0x00000107)
+#define STATUS_FILE_LOCKED_WITH_ONLY_READERS ((NTSTATUS)0x0000012A)
+#define STATUS_FILE_LOCKED_WITH_WRITERS  ((NTSTATUS)0x0000012B)
+#define STATUS_OPLOCK_BREAK_IN_PROGRESS  ((NTSTATUS)0x00000108)
+#define STATUS_FILE_SYSTEM_LIMITATION    ((NTSTATUS)0xC0000427)
+#define STATUS_WRONG_VOLUME              ((NTSTATUS)0xC0000012)
+#define STATUS_UNRECOGNIZED_VOLUME       ((NTSTATUS)0xC000014F)
+#define STATUS_VOLUME_DISMOUNTED         ((NTSTATUS)0xC000026E)
+#define STATUS_FILE_DELETED              ((NTSTATUS)0xC0000123)
+#define STATUS_MEDIA_WRITE_PROTECTED     ((NTSTATUS)0xC00000A2)
+#define STATUS_FILE_CLOSED               ((NTSTATUS)0xC0000128)
+#define STATUS_FILE_IS_A_DIRECTORY       ((NTSTATUS)0xC00000BA)
+#define STATUS_INVALID_USER_BUFFER       ((NTSTATUS)0xC00000E8)
+#define STATUS_NOT_LOCKED                ((NTSTATUS)0xC000002A)
+#define STATUS_PRIVILEGE_NOT_HELD        ((NTSTATUS)0xC0000061)
+#define STATUS_ALREADY_COMMITTED         ((NTSTATUS)0xC0000021)
+#define STATUS_NOT_SUPPORTED             ((NTSTATUS)0xC00000BB)
+#define STATUS_INVALID_DEVICE_STATE      ((NTSTATUS)0xC0000184)
+#define STATUS_TIMEOUT                   ((NTSTATUS)0x00000102)
+#define STATUS_INVALID_HANDLE            ((NTSTATUS)0xC0000008)
+#define STATUS_ACCESS_VIOLATION          ((NTSTATUS)0xC0000005)
+#define STATUS_DATATYPE_MISALIGNMENT     ((NTSTATUS)0x80000002)
+#define STATUS_ILLEGAL_INSTRUCTION       ((NTSTATUS)0xC000001D)
+#define STATUS_INSTRUCTION_MISALIGNMENT  ((NTSTATUS)0xC00000AA)
+
+//
+//  Doubly and singly linked lists.
+//
+
+typedef struct _LIST_ENTRY {
+    struct _LIST_ENTRY *Flink;
+    struct _LIST_ENTRY *Blink;
+} LIST_ENTRY, *PLIST_ENTRY;
+
+typedef struct _SINGLE_LIST_ENTRY {
+    struct _SINGLE_LIST_ENTRY *Next;
+} SINGLE_LIST_ENTRY, *PSINGLE_LIST_ENTRY, SLIST_ENTRY, *PSLIST_ENTRY;
+
+typedef struct _SLIST_HEADER {
+    SLIST_ENTRY Head;
+    USHORT Depth;
+} SLIST_HEADER, *PSLIST_HEADER;
+
+static inline VOID InitializeListHead( PLIST_ENTRY H ) { H->Flink = H->Blink = H; }
+static inline BOOLEAN IsListEmpty( const LIST_ENTRY *H ) { return (BOOLEAN)(H->Flink == H); }
+
+static inline BOOLEAN
+RemoveEntryList( PLIST_ENTRY E )
+{
+    PLIST_ENTRY Flink = E->Flink, Blink = E->Blink;
+    Blink->Flink = Flink;
+    Flink->Blink = Blink;
+    return (BOOLEAN)(Flink == Blink);
+}
+
+static inline PLIST_ENTRY
+RemoveHeadList( PLIST_ENTRY H )
+{
+    PLIST_ENTRY E = H->Flink;
+    RemoveEntryList( E );
+    return E;
+}
+
+static inline PLIST_ENTRY
+RemoveTailList( PLIST_ENTRY H )
+{
+    PLIST_ENTRY E = H->Blink;
+    RemoveEntryList( E );
+    return E;
+}
+
+static inline VOID
+InsertTailList( PLIST_ENTRY H, PLIST_ENTRY E )
+{
+    E->Flink = H;
+    E->Blink = H->Blink;
+    H->Blink->Flink = E;
+    H->Blink = E;
+}
+
+static inline VOID
+InsertHeadList( PLIST_ENTRY H, PLIST_ENTRY E )
+{
+    E->Flink = H->Flink;
+    E->Blink = H;
+    H->Flink->Blink = E;
+    H->Flink = E;
+}
+
+static inline VOID
+PushEntryList( PSINGLE_LIST_ENTRY H, PSINGLE_LIST_ENTRY E )
+{
+    E->Next = H->Next;
+    H->Next = E;
+}
+
+static inline PSINGLE_LIST_ENTRY
+PopEntryList( PSINGLE_LIST_ENTRY H )
+{
+    PSINGLE_LIST_ENTRY E = H->Next;
+    if (E != NULL) { H->Next = E->Next; }
+    return E;
+}
+
+//
+//  Counted strings.
+//
+
+typedef struct _STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PCHAR Buffer;
+} STRING, *PSTRING, ANSI_STRING, *PANSI_STRING, OEM_STRING, *POEM_STRING;
+
+typedef struct _UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PWCH Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+
+typedef const UNICODE_STRING *PCUNICODE_STRING;
+
+#define UNICODE_NULL ((WCHAR)0)
+#define ANSI_NULL ((CHAR)0)
+
+#define RTL_CONSTANT_STRING(S) { sizeof(S) - sizeof((S)[0]), sizeof(S), (PVOID)(S) }
+
+//
+//  Memory and interlocked operations.
+//
+
+#define RtlCopyMemory(D,S,L) memcpy((D),(S),(L))
+#define RtlMoveMemory(D,S,L) memmove((D),(S),(L))
+#define RtlFillMemory(D,L,F) memset((D),(F),(L))
+#define RtlZeroMemory(D,L) memset((D),0,(L))
+#define RtlEqualMemory(A,B,L) (memcmp((A),(B),(L)) == 0)
+#define RtlSecureZeroMemory(D,L) memset((D),0,(L))
+
+SIZE_T RtlCompareMemory( const VOID *Source1, const VOID *Source2, SIZE_T Length );
+VOID RtlFillMemoryUlong( PVOID Destination, SIZE_T Length, ULONG Pattern );
+
+#define InterlockedIncrement(P) __sync_add_and_fetch((P), 1)
+#define InterlockedDecrement(P) __sync_sub_and_fetch((P), 1)
+#define InterlockedExchange(P,V) __sync_lock_test_and_set((P), (V))
+#define InterlockedExchangeAdd(P,V) __sync_fetch_and_add((P), (V))
+#define InterlockedExchangeAdd64(P,V) __sync_fetch_and_add((P), (V))
+#define InterlockedIncrement64(P) __sync_add_and_fetch((P), 1)
+#define InterlockedAdd64(P,V) __sync_add_and_fetch((P), (V))
+#define InterlockedCompareExchange(P,E,C) __sync_val_compare_and_swap((P), (C), (E))
+#define InterlockedCompareExchangePointer(P,E,C) __sync_val_compare_and_swap((P), (C), (E))
+#define InterlockedOr(P,V) __sync_fetch_and_or((P), (V))
+#define InterlockedAnd(P,V) __sync_fetch_and_and((P), (V))
+
+//
+//  Assertions and bugchecks.
+//
+
+#define FAT_FILE_SYSTEM 0x00000023
+
+VOID DECLSPEC_NORETURN KeBugCheckEx( ULONG Code, ULONG_PTR P1, ULONG_PTR P2, ULONG_PTR P3, ULONG_PTR P4 );
+VOID HostAssertFailed( PCSTR Expression, PCSTR File, ULONG Line );
+
+#if DBG
+#define NT_ASSERT(E) ((E) ? (VOID)0 : HostAssertFailed( #E, __FILE__, __LINE__ ))
+#else
+#define NT_ASSERT(E) ((VOID)0)
+#endif
+
+#define ASSERT(E) NT_ASSERT(E)
+#define NT_ASSERTMSG(M,E) NT_ASSERT(E)
+#define ASSERTMSG(M,E) NT_ASSERT(E)
+#define NT_VERIFY(E) ((VOID)(E))
+#define PAGED_CODE()
+#define PAGED_CODE_LOCKED()
+
+#define DbgPrint printf
+#define KdPrint(X)
+#define KdPrintEx(X)
+#define DbgBreakPoint() __builtin_trap()
+
+int printf( const char *Format, ... );
+
+//
+//  Pool.
+//
+
+typedef enum _POOL_TYPE {
+    NonPagedPool,
+    NonPagedPoolExecute = NonPagedPool,
+    PagedPool,
+    NonPagedPoolMustSucceed = NonPagedPool + 2,
+    NonPagedPoolCacheAligned = NonPagedPool + 4,
+    PagedPoolCacheAligned,
+    NonPagedPoolNx = 512,
+    NonPagedPoolNxCacheAligned = NonPagedPoolNx + 4,
+} POOL_TYPE;
+
+#define POOL_RAISE_IF_ALLOCATION_FAILURE 16
+#define POOL_COLD_ALLOCATION 256
+
+PVOID ExAllocatePoolWithTag( POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag );
+PVOID FsRtlAllocatePoolWithTag( POOL_TYPE PoolType, SIZE_T NumberOfBytes, ULONG Tag );
+VOID ExFreePool( PVOID P );
+VOID ExFreePoolWithTag( PVOID P, ULONG Tag );
+
+#define ExAllocatePool(T,N) ExAllocatePoolWithTag((T),(N),' hsH')
+#define FsRtlAllocatePool(T,N) FsRtlAllocatePoolWithTag((T),(N),' hsH')
+
+typedef struct _NPAGED_LOOKASIDE_LIST {
+    SIZE_T Size;
+    ULONG Tag;
+} NPAGED_LOOKASIDE_LIST, *PNPAGED_LOOKASIDE_LIST, PAGED_LOOKASIDE_LIST, *PPAGED_LOOKASIDE_LIST;
+
+typedef PVOID (*PALLOCATE_FUNCTION)( POOL_TYPE, SIZE_T, ULONG );
+typedef VOID (*PFREE_FUNCTION)( PVOID );
+
+VOID ExInitializeNPagedLookasideList( PNPAGED_LOOKASIDE_LIST Lookaside, PALLOCATE_FUNCTION Allocate, PFREE_FUNCTION Free, ULONG Flags, SIZE_T Size, ULONG Tag, USHORT Depth );
+VOID ExDeleteNPagedLookasideList( PNPAGED_LOOKASIDE_LIST Lookaside );
+PVOID ExAllocateFromNPagedLookasideList( PNPAGED_LOOKASIDE_LIST Lookaside );
+VOID ExFreeToNPagedLookasideList( PNPAGED_LOOKASIDE_LIST Lookaside, PVOID Entry );
+
+PSLIST_ENTRY ExInterlockedPopEntrySList( PSLIST_HEADER ListHead, PKSPIN_LOCK Lock );
+PSLIST_ENTRY ExInterlockedPushEntrySList( PSLIST_HEADER ListHead, PSLIST_ENTRY ListEntry, PKSPIN_LOCK Lock );
+PSLIST_ENTRY InterlockedPopEntrySList( PSLIST_HEADER ListHead );
+PSLIST_ENTRY InterlockedPushEntrySList( PSLIST_HEADER ListHead, PSLIST_ENTRY ListEntry );
+VOID InitializeSListHead( PSLIST_HEADER ListHead );
+#define ExInitializeSListHead InitializeSListHead
+
+//
+//  Dispatcher objects, locks and resources.  None of these block.
+//
+
+typedef struct _DISPATCHER_HEADER {
+    LONG SignalState;
+} DISPATCHER_HEADER;
+
+typedef enum _EVENT_TYPE {
+    NotificationEvent,
+    SynchronizationEvent
+} EVENT_TYPE;
+
+typedef struct _KEVENT {
+    DISPATCHER_HEADER Header;
+} KEVENT, *PKEVENT, *PRKEVENT;
+
+typedef struct _KSEMAPHORE {
+    DISPATCHER_HEADER Header;
+    LONG Limit;
+} KSEMAPHORE, *PKSEMAPHORE;
+
+typedef struct _KDPC {
+    PVOID DeferredRoutine;
+    PVOID DeferredContext;
+} KDPC, *PKDPC, *PRKDPC;
+
+typedef VOID KDEFERRED_ROUTINE( PKDPC Dpc, PVOID DeferredContext, PVOID SystemArgument1, PVOID SystemArgument2 );
+typedef KDEFERRED_ROUTINE *PKDEFERRED_ROUTINE;
+
+typedef struct _KTIMER {
+    DISPATCHER_HEADER Header;
+    LARGE_INTEGER DueTime;
+} KTIMER, *PKTIMER;
+
+typedef struct _FAST_MUTEX {
+    LONG Count;
+    PVOID Owner;
+} FAST_MUTEX, *PFAST_MUTEX, KGUARDED_MUTEX, *PKGUARDED_MUTEX;
+
+typedef struct _ERESOURCE {
+    LONG ActiveCount;
+    LONG ExclusiveCount;
+    USHORT Flag;
+} ERESOURCE, *PERESOURCE;
+
+typedef struct _KTHREAD *PKTHREAD, *PETHREAD, *PRKTHREAD;
+typedef struct _KPROCESS *PKPROCESS, *PEPROCESS, *PRKPROCESS;
+
+typedef struct _KAPC_STATE {
+    PVOID Process;
+} KAPC_STATE, *PKAPC_STATE;
+
+typedef enum _KWAIT_REASON {
+    Executive
+} KWAIT_REASON;
+
+#define PASSIVE_LEVEL 0
+#define APC_LEVEL 1
+#define DISPATCH_LEVEL 2
+
+VOID KeInitializeEvent( PRKEVENT Event, EVENT_TYPE Type, BOOLEAN State );
+LONG KeSetEvent( PRKEVENT Event, LONG Increment, BOOLEAN Wait );
+VOID KeClearEvent( PRKEVENT Event );
+LONG KeReadStateEvent( PRKEVENT Event );
+NTSTATUS KeWaitForSingleObject( PVOID Object, KWAIT_REASON WaitReason, KPROCESSOR_MODE WaitMode, BOOLEAN Alertable, PLARGE_INTEGER Timeout );
+VOID KeInitializeSpinLock( PKSPIN_LOCK SpinLock );
+VOID KeAcquireSpinLock( PKSPIN_LOCK SpinLock, PKIRQL OldIrql );
+VOID KeReleaseSpinLock( PKSPIN_LOCK SpinLock, KIRQL NewIrql );
+VOID KeInitializeTimer( PKTIMER Timer );
+BOOLEAN KeSetTimer( PKTIMER Timer, LARGE_INTEGER DueTime, PKDPC Dpc );
+BOOLEAN KeCancelTimer( PKTIMER Timer );
+VOID KeInitializeDpc( PRKDPC Dpc, PKDEFERRED_ROUTINE DeferredRoutine, PVOID DeferredContext );
+BOOLEAN KeRemoveQueueDpc( PRKDPC Dpc );
+VOID KeQuerySystemTime( PLARGE_INTEGER CurrentTime );
+KIRQL KeGetCurrentIrql( VOID );
+BOOLEAN KeAreApcsDisabled( VOID );
+BOOLEAN KeAreAllApcsDisabled( VOID );
+VOID KeEnterCriticalRegion( VOID );
+VOID KeLeaveCriticalRegion( VOID );
+ULONG KeQueryActiveProcessorCount( PKAFFINITY ActiveProcessors );
+ULONG KeGetCurrentProcessorNumber( VOID );
+PKTHREAD KeGetCurrentThread( VOID );
+
+#define ExInitializeFastMutex(M) ((M)->Count = 1, (M)->Owner = NULL)
+#define ExAcquireFastMutex(M) ((M)->Count -= 1)
+#define ExReleaseFastMutex(M) ((M)->Count += 1)
+#define ExAcquireFastMutexUnsafe(M) ((M)->Count -= 1)
+#define ExReleaseFastMutexUnsafe(M) ((M)->Count += 1)
+#define ExTryToAcquireFastMutex(M) ((M)->Count -= 1, TRUE)
+
+NTSTATUS ExInitializeResourceLite( PERESOURCE Resource );
+NTSTATUS ExDeleteResourceLite( PERESOURCE Resource );
+BOOLEAN ExAcquireResourceExclusiveLite( PERESOURCE Resource, BOOLEAN Wait );
+BOOLEAN ExAcquireResourceSharedLite( PERESOURCE Resource, BOOLEAN Wait );
+BOOLEAN ExAcquireSharedStarveExclusive( PERESOURCE Resource, BOOLEAN Wait );
+BOOLEAN ExAcquireSharedWaitForExclusive( PERESOURCE Resource, BOOLEAN Wait );
+VOID ExReleaseResourceLite( PERESOURCE Resource );
+VOID ExReleaseResourceForThreadLite( PERESOURCE Resource, ERESOURCE_THREAD Thread );
+VOID ExConvertExclusiveToSharedLite( PERESOURCE Resource );
+BOOLEAN ExIsResourceAcquiredExclusiveLite( PERESOURCE Resource );
+ULONG ExIsResourceAcquiredSharedLite( PERESOURCE Resource );
+ULONG ExGetExclusiveWaiterCount( PERESOURCE Resource );
+ULONG ExGetSharedWaiterCount( PERESOURCE Resource );
+VOID ExSetResourceOwnerPointer( PERESOURCE Resource, PVOID OwnerPointer );
+#define ExGetCurrentResourceThread() ((ERESOURCE_THREAD)1)
+#define ExReleaseResource ExReleaseResourceLite
+
+VOID DECLSPEC_NORETURN ExRaiseStatus( NTSTATUS Status );
+VOID ExSystemTimeToLocalTime( PLARGE_INTEGER SystemTime, PLARGE_INTEGER LocalTime );
+VOID ExLocalTimeToSystemTime( PLARGE_INTEGER LocalTime, PLARGE_INTEGER SystemTime );
+
+PKTHREAD PsGetCurrentThread( VOID );
+PEPROCESS PsGetCurrentProcess( VOID );
+BOOLEAN PsIsSystemThread( PKTHREAD Thread );
+
+typedef VOID WORKER_THREAD_ROUTINE( PVOID Parameter );
+typedef WORKER_THREAD_ROUTINE *PWORKER_THREAD_ROUTINE;
+
+typedef struct _WORK_QUEUE_ITEM {
+    LIST_ENTRY List;
+    PWORKER_THREAD_ROUTINE WorkerRoutine;
+    PVOID Parameter;
+} WORK_QUEUE_ITEM, *PWORK_QUEUE_ITEM;
+
+typedef enum _WORK_QUEUE_TYPE {
+    CriticalWorkQueue,
+    DelayedWorkQueue,
+    HyperCriticalWorkQueue
+} WORK_QUEUE_TYPE;
+
+#define ExInitializeWorkItem(I,R,P) ((I)->WorkerRoutine = (R), (I)->Parameter = (P), (I)->List.Flink = NULL)
+VOID ExQueueWorkItem( PWORK_QUEUE_ITEM WorkItem, WORK_QUEUE_TYPE QueueType );
+
+//
+//  Time.
+//
+
+typedef struct _TIME_FIELDS {
+    SHORT Year;
+    SHORT Month;
+    SHORT Day;
+    SHORT Hour;
+    SHORT Minute;
+    SHORT Second;
+    SHORT Milliseconds;
+    SHORT Weekday;
+} TIME_FIELDS, *PTIME_FIELDS;
+
+BOOLEAN RtlTimeFieldsToTime( PTIME_FIELDS TimeFields, PLARGE_INTEGER Time );
+VOID RtlTimeToTimeFields( PLARGE_INTEGER Time, PTIME_FIELDS TimeFields );
+LARGE_INTEGER RtlExtendedMagicDivide( LARGE_INTEGER Dividend, LARGE_INTEGER MagicDivisor, CCHAR ShiftCount );
+LARGE_INTEGER RtlExtendedLargeIntegerDivide( LARGE_INTEGER Dividend, ULONG Divisor, PULONG Remainder );
+
+//
+//  Bitmaps.
+//
+
+typedef struct _RTL_BITMAP {
+    ULONG SizeOfBitMap;
+    PULONG Buffer;
+} RTL_BITMAP, *PRTL_BITMAP;
+
+typedef struct _RTL_BITMAP_RUN {
+    ULONG StartingIndex;
+    ULONG NumberOfBits;
+} RTL_BITMAP_RUN, *PRTL_BITMAP_RUN;
+
+VOID RtlInitializeBitMap( PRTL_BITMAP BitMapHeader, PULONG BitMapBuffer, ULONG SizeOfBitMap );
+VOID RtlClearAllBits( PRTL_BITMAP BitMapHeader );
+VOID RtlSetAllBits( PRTL_BITMAP BitMapHeader );
+VOID RtlClearBit( PRTL_BITMAP BitMapHeader, ULONG BitNumber );
+VOID RtlSetBit( PRTL_BITMAP BitMapHeader, ULONG BitNumber );
+BOOLEAN RtlTestBit( PRTL_BITMAP BitMapHeader, ULONG BitNumber );
+VOID RtlClearBits( PRTL_BITMAP BitMapHeader, ULONG StartingIndex, ULONG NumberToClear );
+VOID RtlSetBits( PRTL_BITMAP BitMapHeader, ULONG StartingIndex, ULONG NumberToSet );
+BOOLEAN RtlAreBitsClear( PRTL_BITMAP BitMapHeader, ULONG StartingIndex, ULONG Length );
+BOOLEAN RtlAreBitsSet( PRTL_BITMAP BitMapHeader, ULONG StartingIndex, ULONG Length );
+ULONG RtlFindClearBits( PRTL_BITMAP BitMapHeader, ULONG NumberToFind, ULONG HintIndex );
+ULONG RtlFindClearBitsAndSet( PRTL_BITMAP BitMapHeader, ULONG NumberToFind, ULONG HintIndex );
+ULONG RtlFindSetBits( PRTL_BITMAP BitMapHeader, ULONG NumberToFind, ULONG HintIndex );
+ULONG RtlFindLongestRunClear( PRTL_BITMAP BitMapHeader, PULONG StartingIndex );
+ULONG RtlFindNextForwardRunClear( PRTL_BITMAP BitMapHeader, ULONG FromIndex, PULONG StartingRunIndex );
+ULONG RtlNumberOfClearBits( PRTL_BITMAP BitMapHeader );
+ULONG RtlNumberOfSetBits( PRTL_BITMAP BitMapHeader );
+#define RtlCheckBit(B,N) ((((B)->Buffer[(N) >> 5]) >> ((N) & 31)) & 1)
+
+//
+//  Splay trees.
+//
+
+typedef struct _RTL_SPLAY_LINKS {
+    struct _RTL_SPLAY_LINKS *Parent;
+    struct _RTL_SPLAY_LINKS *LeftChild;
+    struct _RTL_SPLAY_LINKS *RightChild;
+} RTL_SPLAY_LINKS, *PRTL_SPLAY_LINKS;
+
+#define RtlInitializeSplayLinks(L) {                   \
+    PRTL_SPLAY_LINKS _SplayLinks;                      \
+    _SplayLinks = (PRTL_SPLAY_LINKS)(L);               \
+    _SplayLinks->Parent = _SplayLinks;                 \
+    _SplayLinks->LeftChild = NULL;                     \
+    _SplayLinks->RightChild = NULL;                    \
+    }
+
+#define RtlParent(L) ((PRTL_SPLAY_LINKS)(L)->Parent)
+#define RtlLeftChild(L) ((PRTL_SPLAY_LINKS)(L)->LeftChild)
+#define RtlRightChild(L) ((PRTL_SPLAY_LINKS)(L)->RightChild)
+#define RtlIsRoot(L) (RtlParent(L) == (PRTL_SPLAY_LINKS)(L))
+#define RtlIsLeftChild(L) (RtlLeftChild(RtlParent(L)) == (PRTL_SPLAY_LINKS)(L))
+#define RtlIsRightChild(L) (RtlRightChild(RtlParent(L)) == (PRTL_SPLAY_LINKS)(L))
+
+#define RtlInsertAsLeftChild(ParentLinks,ChildLinks) {  \
+    PRTL_SPLAY_LINKS _SplayParent;                      \
+    PRTL_SPLAY_LINKS _SplayChild;                       \
+    _SplayParent = (PRTL_SPLAY_LINKS)(ParentLinks);     \
+    _SplayChild = (PRTL_SPLAY_LINKS)(ChildLinks);       \
+    _SplayParent->LeftChild = _SplayChild;              \
+    _SplayChild->Parent = _SplayParent;                 \
+    }
+
+#define RtlInsertAsRightChild(ParentLinks,ChildLinks) { \
+    PRTL_SPLAY_LINKS _SplayParent;                      \
+    PRTL_SPLAY_LINKS _SplayChild;                       \
+    _SplayParent = (PRTL_SPLAY_LINKS)(ParentLinks);     \
+    _SplayChild = (PRTL_SPLAY_LINKS)(ChildLinks);       \
+    _SplayParent->RightChild = _SplayChild;             \
+    _SplayChild->Parent = _SplayParent;                 \
+    }
+
+PRTL_SPLAY_LINKS RtlSplay( PRTL_SPLAY_LINKS Links );
+PRTL_SPLAY_LINKS RtlDelete( PRTL_SPLAY_LINKS Links );
+VOID RtlDeleteNoSplay( PRTL_SPLAY_LINKS Links, PRTL_SPLAY_LINKS *Root );
+PRTL_SPLAY_LINKS RtlSubtreeSuccessor( PRTL_SPLAY_LINKS Links );
+PRTL_SPLAY_LINKS RtlSubtreePredecessor( PRTL_SPLAY_LINKS Links );
+PRTL_SPLAY_LINKS RtlRealSuccessor( PRTL_SPLAY_LINKS Links );
+PRTL_SPLAY_LINKS RtlRealPredecessor( PRTL_SPLAY_LINKS Links );
+
+//
+//  String routines.  The host uses code page 437 style single byte OEM
+//  strings, with the ASCII range mapping to itself.
+//
+
+VOID RtlInitString( PSTRING DestinationString, PCSTR SourceString );
+VOID RtlInitUnicodeString( PUNICODE_STRING DestinationString, PCWSTR SourceString );
+VOID RtlCopyUnicodeString( PUNICODE_STRING DestinationString, PCUNICODE_STRING SourceString );
+NTSTATUS RtlAppendUnicodeStringToString( PUNICODE_STRING Destination, PCUNICODE_STRING Source );
+NTSTATUS RtlAppendUnicodeToString( PUNICODE_STRING Destination, PCWSTR Source );
+BOOLEAN RtlEqualUnicodeString( PCUNICODE_STRING String1, PCUNICODE_STRING String2, BOOLEAN CaseInSensitive );
+LONG RtlCompareUnicodeString( PCUNICODE_STRING String1, PCUNICODE_STRING String2, BOOLEAN CaseInSensitive );
+BOOLEAN RtlEqualString( const STRING *String1, const STRING *String2, BOOLEAN CaseInSensitive );
+WCHAR RtlUpcaseUnicodeChar( WCHAR SourceCharacter );
+WCHAR RtlDowncaseUnicodeChar( WCHAR SourceCharacter );
+CHAR RtlUpperChar( CHAR Character );
+NTSTATUS RtlUpcaseUnicodeString( PUNICODE_STRING DestinationString, PCUNICODE_STRING SourceString, BOOLEAN AllocateDestinationString );
+NTSTATUS RtlDowncaseUnicodeString( PUNICODE_STRING DestinationString, PCUNICODE_STRING SourceString, BOOLEAN AllocateDestinationString );
+VOID RtlUpperString( PSTRING DestinationString, const STRING *SourceString );
+NTSTATUS RtlOemStringToUnicodeString( PUNICODE_STRING DestinationString, const STRING *SourceString, BOOLEAN AllocateDestinationString );
+NTSTATUS RtlOemStringToCountedUnicodeString( PUNICODE_STRING DestinationString, const STRING *SourceString, BOOLEAN AllocateDestinationString );
+NTSTATUS RtlUnicodeStringToOemString( POEM_STRING DestinationString, PCUNICODE_STRING SourceString, BOOLEAN AllocateDestinationString );
+NTSTATUS RtlUnicodeStringToCountedOemString( POEM_STRING DestinationString, PCUNICODE_STRING SourceString, BOOLEAN AllocateDestinationString );
+NTSTATUS RtlUpcaseUnicodeStringToOemString( POEM_STRING DestinationString, PCUNICODE_STRING SourceString, BOOLEAN AllocateDestinationString );
+NTSTATUS RtlUpcaseUnicodeStringToCountedOemString( POEM_STRING DestinationString, PCUNICODE_STRING SourceString, BOOLEAN AllocateDestinationString );
+NTSTATUS RtlUpcaseUnicodeToOemN( PCHAR OemString, ULONG MaxBytesInOemString, PULONG BytesInOemString, PCWSTR UnicodeString, ULONG BytesInUnicodeString );
+NTSTATUS RtlOemToUnicodeN( PWCH UnicodeString, ULONG MaxBytesInUnicodeString, PULONG BytesInUnicodeString, PCSTR OemString, ULONG BytesInOemString );
+NTSTATUS RtlUnicodeToOemN( PCHAR OemString, ULONG MaxBytesInOemString, PULONG BytesInOemString, PCWSTR UnicodeString, ULONG BytesInUnicodeString );
+VOID RtlFreeUnicodeString( PUNICODE_STRING UnicodeString );
+VOID RtlFreeOemString( POEM_STRING OemString );
+ULONG RtlOemStringToCountedUnicodeSize( const STRING *OemString );
+ULONG RtlUnicodeStringToCountedOemSize( PCUNICODE_STRING UnicodeString );
+#define RtlOemStringToUnicodeSize(S) ((ULONG)((S)->Length + 1) * sizeof(WCHAR))
+#define RtlUnicodeStringToOemSize(S) ((ULONG)((S)->Length / sizeof(WCHAR) + 1))
+
+typedef struct _GENERATE_NAME_CONTEXT {
+    USHORT Checksum;
+    BOOLEAN ChecksumInserted;
+    UCHAR NameLength;
+    WCHAR NameBuffer[8];
+    ULONG ExtensionLength;
+    WCHAR ExtensionBuffer[4];
+    ULONG LastIndexValue;
+} GENERATE_NAME_CONTEXT, *PGENERATE_NAME_CONTEXT;
+
+NTSTATUS RtlGenerate8dot3Name( PCUNICODE_STRING Name, BOOLEAN AllowExtendedCharacters, PGENERATE_NAME_CONTEXT Context, PUNICODE_STRING Name8dot3 );
+BOOLEAN RtlIsNameLegalDOS8Dot3( PCUNICODE_STRING Name, POEM_STRING OemName, PBOOLEAN NameContainsSpaces );
+
+extern BOOLEAN NlsMbOemCodePageTag;
+#define NLS_MB_OEM_CODE_PAGE_TAG NlsMbOemCodePageTag
+
+//
+//  Large Mcbs, mapping virtual to logical byte or sector numbers.
+//
+
+typedef struct _BASE_MCB {
+    ULONG MaximumPairCount;
+    ULONG PairCount;
+    USHORT PoolType;
+    USHORT Flags;
+    PVOID Mapping;
+} BASE_MCB, *PBASE_MCB;
+
+typedef struct _LARGE_MCB {
+    PFAST_MUTEX GuardedMutex;
+    BASE_MCB BaseMcb;
+} LARGE_MCB, *PLARGE_MCB;
+
+VOID FsRtlInitializeLargeMcb( PLARGE_MCB Mcb, POOL_TYPE PoolType );
+VOID FsRtlUninitializeLargeMcb( PLARGE_MCB Mcb );
+VOID FsRtlResetLargeMcb( PLARGE_MCB Mcb, BOOLEAN SelfSynchronized );
+VOID FsRtlTruncateLargeMcb( PLARGE_MCB Mcb, LONGLONG Vbn );
+BOOLEAN FsRtlAddLargeMcbEntry( PLARGE_MCB Mcb, LONGLONG Vbn, LONGLONG Lbn, LONGLONG SectorCount );
+VOID FsRtlRemoveLargeMcbEntry( PLARGE_MCB Mcb, LONGLONG Vbn, LONGLONG SectorCount );
+BOOLEAN FsRtlLookupLargeMcbEntry( PLARGE_MCB Mcb, LONGLONG Vbn, PLONGLONG Lbn, PLONGLONG SectorCountFromLbn, PLONGLONG StartingLbn, PLONGLONG SectorCountFromStartingLbn, PULONG Index );
+BOOLEAN FsRtlLookupLastLargeMcbEntry( PLARGE_MCB Mcb, PLONGLONG Vbn, PLONGLONG Lbn );
+BOOLEAN FsRtlLookupLastLargeMcbEntryAndIndex( PLARGE_MCB Mcb, PLONGLONG Vbn, PLONGLONG Lbn, PULONG Index );
+ULONG FsRtlNumberOfRunsInLargeMcb( PLARGE_MCB Mcb );
+BOOLEAN FsRtlGetNextLargeMcbEntry( PLARGE_MCB Mcb, ULONG RunIndex, PLONGLONG Vbn, PLONGLONG Lbn, PLONGLONG SectorCount );
+BOOLEAN FsRtlSplitLargeMcb( PLARGE_MCB Mcb, LONGLONG Vbn, LONGLONG Amount );
+
+//
+//  Objects the I/O system hands the file system.
+//
+
+typedef struct _IO_STATUS_BLOCK {
+    union {
+        NTSTATUS Status;
+        PVOID Pointer;
+    };
+    ULONG_PTR Information;
+} IO_STATUS_BLOCK, *PIO_STATUS_BLOCK;
+
+typedef struct _MDL {
+    struct _MDL *Next;
+    CSHORT Size;
+    CSHORT MdlFlags;
+    PVOID MappedSystemVa;
+    PVOID StartVa;
+    ULONG ByteCount;
+    ULONG ByteOffset;
+} MDL, *PMDL;
+
+typedef enum _LOCK_OPERATION {
+    IoReadAccess,
+    IoWriteAccess,
+    IoModifyAccess
+} LOCK_OPERATION;
+
+typedef struct _SECTION_OBJECT_POINTERS {
+    PVOID DataSectionObject;
+    PVOID SharedCacheMap;
+    PVOID ImageSectionObject;
+} SECTION_OBJECT_POINTERS, *PSECTION_OBJECT_POINTERS;
+
+typedef struct _SHARE_ACCESS {
+    ULONG OpenCount;
+    ULONG Readers;
+    ULONG Writers;
+    ULONG Deleters;
+    ULONG SharedRead;
+    ULONG SharedWrite;
+    ULONG SharedDelete;
+} SHARE_ACCESS, *PSHARE_ACCESS;
+
+typedef struct _VPB {
+    CSHORT Type;
+    CSHORT Size;
+    USHORT Flags;
+    USHORT VolumeLabelLength;
+    struct _DEVICE_OBJECT *DeviceObject;
+    struct _DEVICE_OBJECT *RealDevice;
+    ULONG SerialNumber;
+    ULONG ReferenceCount;
+    WCHAR VolumeLabel[32];
+} VPB, *PVPB;
+
+#define VPB_MOUNTED 0x0001
+#define VPB_LOCKED 0x0002
+#define VPB_PERSISTENT 0x0004
+#define VPB_REMOVE_PENDING 0x0008
+#define VPB_RAW_MOUNT 0x0010
+#define VPB_DIRECT_WRITES_ALLOWED 0x0020
+
+typedef struct _DEVICE_OBJECT {
+    CSHORT Type;
+    USHORT Size;
+    LONG ReferenceCount;
+    struct _DRIVER_OBJECT *DriverObject;
+    struct _DEVICE_OBJECT *NextDevice;
+    PVPB Vpb;
+    ULONG Flags;
+    ULONG Characteristics;
+    ULONG DeviceType;
+    CCHAR StackSize;
+    ULONG AlignmentRequirement;
+    USHORT SectorSize;
+    PVOID DeviceExtension;
+} DEVICE_OBJECT, *PDEVICE_OBJECT;
+
+typedef struct _DRIVER_OBJECT {
+    CSHORT Type;
+    PDEVICE_OBJECT DeviceObject;
+    PVOID MajorFunction[28];
+} DRIVER_OBJECT, *PDRIVER_OBJECT;
+
+#define DO_VERIFY_VOLUME 0x00000002
+#define DO_SYSTEM_BOOT_PARTITION 0x00000100
+#define DO_DEVICE_INITIALIZING 0x00000080
+#define FILE_REMOVABLE_MEDIA 0x00000001
+#define FILE_FLOPPY_DISKETTE 0x00000004
+#define FILE_DEVICE_DISK 0x00000007
+#define FILE_DEVICE_CD_ROM 0x00000002
+#define FILE_DEVICE_DISK_FILE_SYSTEM 0x00000008
+#define FILE_DEVICE_FILE_SYSTEM 0x00000009
+
+#define CTL_CODE(DeviceType,Function,Method,Access) \
+    (((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+
+#define METHOD_BUFFERED 0
+#define METHOD_NEITHER 3
+#define FILE_ANY_ACCESS 0
+#define FILE_SPECIAL_ACCESS FILE_ANY_ACCESS
+#define FILE_READ_ACCESS 1
+#define FILE_WRITE_ACCESS 2
+
+typedef struct _FILE_OBJECT {
+    CSHORT Type;
+    CSHORT Size;
+    PDEVICE_OBJECT DeviceObject;
+    PVPB Vpb;
+    PVOID FsContext;
+    PVOID FsContext2;
+    PSECTION_OBJECT_POINTERS SectionObjectPointer;
+    PVOID PrivateCacheMap;
+    NTSTATUS FinalStatus;
+    struct _FILE_OBJECT *RelatedFileObject;
+    BOOLEAN LockOperation;
+    BOOLEAN DeletePending;
+    BOOLEAN ReadAccess;
+    BOOLEAN WriteAccess;
+    BOOLEAN DeleteAccess;
+    BOOLEAN SharedRead;
+    BOOLEAN SharedWrite;
+    BOOLEAN SharedDelete;
+    ULONG Flags;
+    UNICODE_STRING FileName;
+    LARGE_INTEGER CurrentByteOffset;
+    LONG ReferenceCount;
+} FILE_OBJECT, *PFILE_OBJECT;
+
+#define FO_FILE_OPEN 0x00000001
+#define FO_SYNCHRONOUS_IO 0x00000002
+#define FO_WRITE_THROUGH 0x00000010
+#define FO_SEQUENTIAL_ONLY 0x00000020
+#define FO_CACHE_SUPPORTED 0x00000040
+#define FO_NO_INTERMEDIATE_BUFFERING 0x00000008
+#define FO_STREAM_FILE 0x00000100
+#define FO_TEMPORARY_FILE 0x00010000
+#define FO_FILE_MODIFIED 0x00001000
+#define FO_FILE_SIZE_CHANGED 0x00002000
+#define FO_CLEANUP_COMPLETE 0x00004000
+#define FO_FILE_FAST_IO_READ 0x00080000
+#define FO_RANDOM_ACCESS 0x00100000
+#define FO_DISALLOW_EXCLUSIVE 0x02000000
+#define FO_VOLUME_OPEN 0x00400000
+
+typedef struct _IO_STACK_LOCATION {
+    UCHAR MajorFunction;
+    UCHAR MinorFunction;
+    UCHAR Flags;
+    UCHAR Control;
+    union {
+        struct {
+            ULONG Length;
+            ULONG Key;
+            LARGE_INTEGER ByteOffset;
+        } Read;
+        struct {
+            ULONG Length;
+            ULONG Key;
+            LARGE_INTEGER ByteOffset;
+        } Write;
+        struct {
+            PVOID SecurityContext;
+            ULONG Options;
+            USHORT FileAttributes;
+            USHORT ShareAccess;
+            ULONG EaLength;
+        } Create;
+        struct {
+            ULONG OutputBufferLength;
+            ULONG InputBufferLength;
+            ULONG FsControlCode;
+            PVOID Type3InputBuffer;
+        } FileSystemControl;
+        struct {
+            ULONG Length;
+            ULONG FileInformationClass;
+            PFILE_OBJECT FileObject;
+        } SetFile;
+        struct {
+            ULONG Length;
+            ULONG FsInformationClass;
+        } QueryVolume;
+        struct {
+            PVPB Vpb;
+            PDEVICE_OBJECT DeviceObject;
+        } MountVolume;
+        struct {
+            PVPB Vpb;
+            PDEVICE_OBJECT DeviceObject;
+        } VerifyVolume;
+        struct {
+            ULONG OutputBufferLength;
+            ULONG InputBufferLength;
+            ULONG IoControlCode;
+            PVOID Type3InputBuffer;
+        } DeviceIoControl;
+    } Parameters;
+    PDEVICE_OBJECT DeviceObject;
+    PFILE_OBJECT FileObject;
+    PVOID CompletionRoutine;
+    PVOID Context;
+} IO_STACK_LOCATION, *PIO_STACK_LOCATION;
+
+typedef struct _IRP {
+    CSHORT Type;
+    USHORT Size;
+    PMDL MdlAddress;
+    ULONG Flags;
+    union {
+        PVOID SystemBuffer;
+    } AssociatedIrp;
+    IO_STATUS_BLOCK IoStatus;
+    KPROCESSOR_MODE RequestorMode;
+    BOOLEAN PendingReturned;
+    BOOLEAN Cancel;
+    PVOID UserBuffer;
+    PIO_STATUS_BLOCK UserIosb;
+    PKEVENT UserEvent;
+    struct {
+        struct {
+            PETHREAD Thread;
+            PIO_STACK_LOCATION CurrentStackLocation;
+            PFILE_OBJECT OriginalFileObject;
+        } Overlay;
+    } Tail;
+    IO_STACK_LOCATION Stack[1];
+} IRP, *PIRP;
+
+#define IRP_PAGING_IO 0x00000002
+#define IRP_NOCACHE 0x00000001
+#define IRP_SYNCHRONOUS_PAGING_IO 0x00000040
+
+#define IRP_MJ_CREATE 0x00
+#define IRP_MJ_CLOSE 0x02
+#define IRP_MJ_READ 0x03
+#define IRP_MJ_WRITE 0x04
+#define IRP_MJ_QUERY_INFORMATION 0x05
+#define IRP_MJ_SET_INFORMATION 0x06
+#define IRP_MJ_QUERY_EA 0x07
+#define IRP_MJ_SET_EA 0x08
+#define IRP_MJ_FLUSH_BUFFERS 0x09
+#define IRP_MJ_QUERY_VOLUME_INFORMATION 0x0a
+#define IRP_MJ_SET_VOLUME_INFORMATION 0x0b
+#define IRP_MJ_DIRECTORY_CONTROL 0x0c
+#define IRP_MJ_FILE_SYSTEM_CONTROL 0x0d
+#define IRP_MJ_DEVICE_CONTROL 0x0e
+#define IRP_MJ_SHUTDOWN 0x10
+#define IRP_MJ_LOCK_CONTROL 0x11
+#define IRP_MJ_CLEANUP 0x12
+#define IRP_MJ_PNP 0x1b
+#define IRP_MN_USER_FS_REQUEST 0x00
+#define IRP_MN_MOUNT_VOLUME 0x01
+#define IRP_MN_VERIFY_VOLUME 0x02
+#define IRP_MN_COMPLETE 0x04
+#define IRP_MN_MDL 0x02
+#define IRP_MN_COMPLETE_MDL (IRP_MN_COMPLETE + IRP_MN_MDL)
+
+#define SL_WRITE_THROUGH 0x04
+#define SL_OVERRIDE_VERIFY_VOLUME 0x02
+#define IRP_INPUT_OPERATION 0x00000040
+
+#define IO_TYPE_VPB 0x00000010
+
+#define IRP_MN_KERNEL_CALL 0x04
+#define SL_ALLOW_RAW_MOUNT 0x01
+#define IO_REMOUNT 0x00000001
+
+#define IO_NO_INCREMENT 0
+#define IO_DISK_INCREMENT 1
+
+typedef struct _IO_WORKITEM *PIO_WORKITEM;
+
+#define FSRTL_FSP_TOP_LEVEL_IRP ((LONG_PTR)0x01)
+#define FSRTL_CACHE_TOP_LEVEL_IRP ((LONG_PTR)0x02)
+#define FSRTL_MOD_WRITE_TOP_LEVEL_IRP ((LONG_PTR)0x03)
+#define FSRTL_FAST_IO_TOP_LEVEL_IRP ((LONG_PTR)0x04)
+#define FSRTL_NETWORK1_TOP_LEVEL_IRP ((LONG_PTR)0x05)
+#define FSRTL_NETWORK2_TOP_LEVEL_IRP ((LONG_PTR)0x06)
+#define FSRTL_MAX_TOP_LEVEL_IRP_FLAG ((LONG_PTR)0xFFFF)
+
+#define IoGetCurrentIrpStackLocation(I) ((I)->Tail.Overlay.CurrentStackLocation)
+#define IoGetNextIrpStackLocation(I) ((I)->Tail.Overlay.CurrentStackLocation - 1)
+#define IoIsErrorUserInduced(S) ((BOOLEAN)(((S) == STATUS_DEVICE_NOT_READY) || ((S) == STATUS_NO_MEDIA_IN_DEVICE) || ((S) == STATUS_VERIFY_REQUIRED) || ((S) == STATUS_WRONG_VOLUME)))
+#define IoMarkIrpPending(I) ((VOID)(I))
+
+PFILE_OBJECT IoCreateStreamFileObject( PFILE_OBJECT FileObject, PDEVICE_OBJECT DeviceObject );
+PFILE_OBJECT IoCreateStreamFileObjectLite( PFILE_OBJECT FileObject, PDEVICE_OBJECT DeviceObject );
+VOID IoDeleteDevice( PDEVICE_OBJECT DeviceObject );
+VOID IoFreeMdl( PMDL Mdl );
+VOID IoAcquireVpbSpinLock( PKIRQL Irql );
+VOID IoReleaseVpbSpinLock( KIRQL Irql );
+VOID IoGetStackLimits( PULONG_PTR LowLimit, PULONG_PTR HighLimit );
+PIRP IoGetTopLevelIrp( VOID );
+VOID IoSetTopLevelIrp( PIRP Irp );
+VOID IoSetHardErrorOrVerifyDevice( PIRP Irp, PDEVICE_OBJECT DeviceObject );
+PDEVICE_OBJECT IoGetDeviceToVerify( PETHREAD Thread );
+VOID IoSetDeviceToVerify( PETHREAD Thread, PDEVICE_OBJECT DeviceObject );
+VOID IoCompleteRequest( PIRP Irp, CCHAR PriorityBoost );
+BOOLEAN IoIsSystemThread( PETHREAD Thread );
+BOOLEAN IoRaiseInformationalHardError( NTSTATUS ErrorStatus, PUNICODE_STRING String, PKTHREAD Thread );
+VOID IoRaiseHardError( PIRP Irp, PVPB Vpb, PDEVICE_OBJECT RealDeviceObject );
+VOID ObReferenceObject( PVOID Object );
+VOID ObDereferenceObject( PVOID Object );
+
+typedef NTSTATUS IO_COMPLETION_ROUTINE( PDEVICE_OBJECT DeviceObject, PIRP Irp, PVOID Context );
+typedef IO_COMPLETION_ROUTINE *PIO_COMPLETION_ROUTINE;
+
+NTSTATUS IoCreateDevice( PDRIVER_OBJECT DriverObject, ULONG DeviceExtensionSize, PUNICODE_STRING DeviceName, ULONG DeviceType, ULONG DeviceCharacteristics, BOOLEAN Exclusive, PDEVICE_OBJECT *DeviceObject );
+NTSTATUS IoCallDriver( PDEVICE_OBJECT DeviceObject, PIRP Irp );
+PIRP IoBuildSynchronousFsdRequest( ULONG MajorFunction, PDEVICE_OBJECT DeviceObject, PVOID Buffer, ULONG Length, PLARGE_INTEGER StartingOffset, PKEVENT Event, PIO_STATUS_BLOCK IoStatusBlock );
+PIRP IoBuildAsynchronousFsdRequest( ULONG MajorFunction, PDEVICE_OBJECT DeviceObject, PVOID Buffer, ULONG Length, PLARGE_INTEGER StartingOffset, PIO_STATUS_BLOCK IoStatusBlock );
+PIRP IoBuildDeviceIoControlRequest( ULONG IoControlCode, PDEVICE_OBJECT DeviceObject, PVOID InputBuffer, ULONG InputBufferLength, PVOID OutputBuffer, ULONG OutputBufferLength, BOOLEAN InternalDeviceIoControl, PKEVENT Event, PIO_STATUS_BLOCK IoStatusBlock );
+VOID IoFreeIrp( PIRP Irp );
+VOID IoSetCompletionRoutine( PIRP Irp, PIO_COMPLETION_ROUTINE CompletionRoutine, PVOID Context, BOOLEAN InvokeOnSuccess, BOOLEAN InvokeOnError, BOOLEAN InvokeOnCancel );
+BOOLEAN IoIsOperationSynchronous( PIRP Irp );
+NTSTATUS IoVerifyVolume( PDEVICE_OBJECT DeviceObject, BOOLEAN AllowRawMount );
+NTSTATUS ObReferenceObjectByHandle( HANDLE Handle, ACCESS_MASK DesiredAccess, PVOID ObjectType, KPROCESSOR_MODE AccessMode, PVOID Object, PVOID HandleInformation );
+BOOLEAN SeSinglePrivilegeCheck( LUID PrivilegeValue, KPROCESSOR_MODE PreviousMode );
+VOID ProbeForRead( const volatile VOID *Address, SIZE_T Length, ULONG Alignment );
+VOID ProbeForWrite( volatile VOID *Address, SIZE_T Length, ULONG Alignment );
+PVOID MmGetSystemAddressForMdlSafe( PMDL Mdl, ULONG Priority );
+VOID MmUnlockPages( PMDL MemoryDescriptorList );
+
+//
+//  File information and attribute values.
+//
+
+#define FILE_ATTRIBUTE_READONLY 0x00000001
+#define FILE_ATTRIBUTE_HIDDEN 0x00000002
+#define FILE_ATTRIBUTE_SYSTEM 0x00000004
+#define FILE_ATTRIBUTE_DIRECTORY 0x00000010
+#define FILE_ATTRIBUTE_ARCHIVE 0x00000020
+#define FILE_ATTRIBUTE_DEVICE 0x00000040
+#define FILE_ATTRIBUTE_NORMAL 0x00000080
+#define FILE_ATTRIBUTE_TEMPORARY 0x00000100
+
+#define FILE_NOTIFY_CHANGE_FILE_NAME 0x00000001
+#define FILE_NOTIFY_CHANGE_DIR_NAME 0x00000002
+#define FILE_NOTIFY_CHANGE_NAME 0x00000003
+#define FILE_NOTIFY_CHANGE_ATTRIBUTES 0x00000004
+#define FILE_NOTIFY_CHANGE_SIZE 0x00000008
+#define FILE_NOTIFY_CHANGE_LAST_WRITE 0x00000010
+#define FILE_NOTIFY_CHANGE_LAST_ACCESS 0x00000020
+#define FILE_NOTIFY_CHANGE_CREATION 0x00000040
+#define FILE_NOTIFY_CHANGE_EA 0x00000080
+#define FILE_NOTIFY_CHANGE_SECURITY 0x00000100
+
+#define FILE_ACTION_ADDED 0x00000001
+#define FILE_ACTION_REMOVED 0x00000002
+#define FILE_ACTION_MODIFIED 0x00000003
+#define FILE_ACTION_RENAMED_OLD_NAME 0x00000004
+#define FILE_ACTION_RENAMED_NEW_NAME 0x00000005
+
+typedef struct _FILE_BASIC_INFORMATION {
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    ULONG FileAttributes;
+} FILE_BASIC_INFORMATION, *PFILE_BASIC_INFORMATION;
+
+typedef struct _FILE_STANDARD_INFORMATION {
+    LARGE_INTEGER AllocationSize;
+    LARGE_INTEGER EndOfFile;
+    ULONG NumberOfLinks;
+    BOOLEAN DeletePending;
+    BOOLEAN Directory;
+} FILE_STANDARD_INFORMATION, *PFILE_STANDARD_INFORMATION;
+
+typedef struct _FILE_NETWORK_OPEN_INFORMATION {
+    LARGE_INTEGER CreationTime;
+    LARGE_INTEGER LastAccessTime;
+    LARGE_INTEGER LastWriteTime;
+    LARGE_INTEGER ChangeTime;
+    LARGE_INTEGER AllocationSize;
+    LARGE_INTEGER EndOfFile;
+    ULONG FileAttributes;
+} FILE_NETWORK_OPEN_INFORMATION, *PFILE_NETWORK_OPEN_INFORMATION;
+
+typedef struct _FILE_FULL_EA_INFORMATION {
+    ULONG NextEntryOffset;
+    UCHAR Flags;
+    UCHAR EaNameLength;
+    USHORT EaValueLength;
+    CHAR EaName[1];
+} FILE_FULL_EA_INFORMATION, *PFILE_FULL_EA_INFORMATION;
+
+typedef struct _FILESYSTEM_STATISTICS {
+    USHORT FileSystemType;
+    USHORT Version;
+    ULONG SizeOfCompleteStructure;
+    ULONG UserFileReads;
+    ULONG UserFileReadBytes;
+    ULONG UserDiskReads;
+    ULONG UserFileWrites;
+    ULONG UserFileWriteBytes;
+    ULONG UserDiskWrites;
+    ULONG MetaDataReads;
+    ULONG MetaDataReadBytes;
+    ULONG MetaDataDiskReads;
+    ULONG MetaDataWrites;
+    ULONG MetaDataWriteBytes;
+    ULONG MetaDataDiskWrites;
+} FILESYSTEM_STATISTICS, *PFILESYSTEM_STATISTICS;
+
+typedef struct _FAT_STATISTICS {
+    ULONG CreateHits;
+    ULONG SuccessfulCreates;
+    ULONG FailedCreates;
+    ULONG NonCachedReads;
+    ULONG NonCachedReadBytes;
+    ULONG NonCachedWrites;
+    ULONG NonCachedWriteBytes;
+    ULONG NonCachedDiskReads;
+    ULONG NonCachedDiskWrites;
+} FAT_STATISTICS, *PFAT_STATISTICS;
+
+#define FILESYSTEM_STATISTICS_TYPE_FAT 2
+
+typedef struct _ACCESS_STATE {
+    ACCESS_MASK RemainingDesiredAccess;
+    ACCESS_MASK PreviouslyGrantedAccess;
+} ACCESS_STATE, *PACCESS_STATE;
+
+typedef struct _FAST_IO_DISPATCH {
+    ULONG SizeOfFastIoDispatch;
+} FAST_IO_DISPATCH, *PFAST_IO_DISPATCH;
+
+typedef enum _FS_FILTER_SECTION_SYNC_TYPE {
+    SyncTypeOther = 0,
+    SyncTypeCreateSection
+} FS_FILTER_SECTION_SYNC_TYPE;
+
+#define FS_FILTER_ACQUIRE_FOR_SECTION_SYNCHRONIZATION ((UCHAR)-1)
+
+typedef struct _FS_FILTER_CALLBACK_DATA {
+    ULONG SizeOfFsFilterCallbackData;
+    UCHAR Operation;
+    PDEVICE_OBJECT DeviceObject;
+    PFILE_OBJECT FileObject;
+    union {
+        struct {
+            FS_FILTER_SECTION_SYNC_TYPE SyncType;
+            ULONG PageProtection;
+        } AcquireForSectionSynchronization;
+    } Parameters;
+} FS_FILTER_CALLBACK_DATA, *PFS_FILTER_CALLBACK_DATA;
+
+typedef NTSTATUS DRIVER_DISPATCH( PDEVICE_OBJECT DeviceObject, PIRP Irp );
+typedef DRIVER_DISPATCH *PDRIVER_DISPATCH;
+
+//
+//  File system controls.
+//
+
+#define FSCTL_REQUEST_OPLOCK_LEVEL_1 CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 0, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_REQUEST_OPLOCK_LEVEL_2 CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 1, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_REQUEST_BATCH_OPLOCK CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 2, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_OPLOCK_BREAK_ACKNOWLEDGE CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 3, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_OPBATCH_ACK_CLOSE_PENDING CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 4, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_OPLOCK_BREAK_NOTIFY CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 5, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_LOCK_VOLUME CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 6, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_UNLOCK_VOLUME CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 7, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_DISMOUNT_VOLUME CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 8, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_IS_VOLUME_MOUNTED CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 10, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_IS_PATHNAME_VALID CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 11, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_MARK_VOLUME_DIRTY CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 12, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_QUERY_RETRIEVAL_POINTERS CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 14, METHOD_NEITHER, FILE_ANY_ACCESS)
+#define FSCTL_OPLOCK_BREAK_ACK_NO_2 CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 20, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_INVALIDATE_VOLUMES CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 21, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_QUERY_FAT_BPB CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 22, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_REQUEST_FILTER_OPLOCK CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 23, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_FILESYSTEM_GET_STATISTICS CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 24, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_GET_VOLUME_BITMAP CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 27, METHOD_NEITHER, FILE_ANY_ACCESS)
+#define FSCTL_GET_RETRIEVAL_POINTERS CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 28, METHOD_NEITHER, FILE_ANY_ACCESS)
+#define FSCTL_MOVE_FILE CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 29, METHOD_BUFFERED, FILE_SPECIAL_ACCESS)
+#define FSCTL_IS_VOLUME_DIRTY CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 30, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_ALLOW_EXTENDED_DASD_IO CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 32, METHOD_NEITHER, FILE_ANY_ACCESS)
+#define FSCTL_MARK_HANDLE CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 63, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_REQUEST_OPLOCK CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 144, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_GET_RETRIEVAL_POINTER_BASE CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 141, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_SET_PURGE_FAILURE_MODE CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 156, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define FSCTL_GET_BOOT_AREA_INFO CTL_CODE(FILE_DEVICE_FILE_SYSTEM, 140, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+#define VOLUME_IS_DIRTY 0x00000001
+
+#define FSRTL_VOLUME_DISMOUNT 1
+#define FSRTL_VOLUME_DISMOUNT_FAILED 2
+#define FSRTL_VOLUME_LOCK 3
+#define FSRTL_VOLUME_LOCK_FAILED 4
+#define FSRTL_VOLUME_UNLOCK 5
+#define FSRTL_VOLUME_MOUNT 6
+
+#define OPLOCK_LEVEL_CACHE_READ 0x00000001
+#define OPLOCK_LEVEL_CACHE_HANDLE 0x00000002
+#define OPLOCK_LEVEL_CACHE_WRITE 0x00000004
+
+#define REQUEST_OPLOCK_INPUT_FLAG_REQUEST 0x00000001
+#define REQUEST_OPLOCK_INPUT_FLAG_ACK 0x00000002
+
+typedef struct _REQUEST_OPLOCK_INPUT_BUFFER {
+    USHORT StructureVersion;
+    USHORT StructureLength;
+    ULONG RequestedOplockLevel;
+    ULONG Flags;
+} REQUEST_OPLOCK_INPUT_BUFFER, *PREQUEST_OPLOCK_INPUT_BUFFER;
+
+typedef struct _REQUEST_OPLOCK_OUTPUT_BUFFER {
+    USHORT StructureVersion;
+    USHORT StructureLength;
+    ULONG OriginalOplockLevel;
+    ULONG NewOplockLevel;
+    ULONG Flags;
+    ACCESS_MASK AccessMode;
+    USHORT ShareMode;
+} REQUEST_OPLOCK_OUTPUT_BUFFER, *PREQUEST_OPLOCK_OUTPUT_BUFFER;
+
+typedef struct _FSCTL_QUERY_FAT_BPB_BUFFER {
+    UCHAR First0x24BytesOfBootSector[0x24];
+} FSCTL_QUERY_FAT_BPB_BUFFER, *PFSCTL_QUERY_FAT_BPB_BUFFER;
+
+typedef struct _STARTING_LCN_INPUT_BUFFER {
+    LARGE_INTEGER StartingLcn;
+} STARTING_LCN_INPUT_BUFFER, *PSTARTING_LCN_INPUT_BUFFER;
+
+typedef struct _VOLUME_BITMAP_BUFFER {
+    LARGE_INTEGER StartingLcn;
+    LARGE_INTEGER BitmapSize;
+    UCHAR Buffer[1];
+} VOLUME_BITMAP_BUFFER, *PVOLUME_BITMAP_BUFFER;
+
+typedef struct _STARTING_VCN_INPUT_BUFFER {
+    LARGE_INTEGER StartingVcn;
+} STARTING_VCN_INPUT_BUFFER, *PSTARTING_VCN_INPUT_BUFFER;
+
+typedef struct _RETRIEVAL_POINTERS_BUFFER {
+    ULONG ExtentCount;
+    LARGE_INTEGER StartingVcn;
+    struct {
+        LARGE_INTEGER NextVcn;
+        LARGE_INTEGER Lcn;
+    } Extents[1];
+} RETRIEVAL_POINTERS_BUFFER, *PRETRIEVAL_POINTERS_BUFFER;
+
+typedef struct _RETRIEVAL_POINTER_BASE {
+    LARGE_INTEGER FileAreaOffset;
+} RETRIEVAL_POINTER_BASE, *PRETRIEVAL_POINTER_BASE;
+
+typedef struct _BOOT_AREA_INFO {
+    ULONG BootSectorCount;
+    struct {
+        LARGE_INTEGER Offset;
+    } BootSectors[2];
+} BOOT_AREA_INFO, *PBOOT_AREA_INFO;
+
+typedef struct _MOVE_FILE_DATA {
+    HANDLE FileHandle;
+    LARGE_INTEGER StartingVcn;
+    LARGE_INTEGER StartingLcn;
+    ULONG ClusterCount;
+} MOVE_FILE_DATA, *PMOVE_FILE_DATA;
+
+#define MARK_HANDLE_PROTECT_CLUSTERS 0x00000001
+
+#define USN_SOURCE_DATA_MANAGEMENT 0x00000001
+#define USN_SOURCE_AUXILIARY_DATA 0x00000002
+#define USN_SOURCE_REPLICATION_MANAGEMENT 0x00000004
+
+typedef struct _MARK_HANDLE_INFO {
+    union {
+        ULONG UsnSourceInfo;
+        ULONG CopyNumber;
+    };
+    HANDLE VolumeHandle;
+    ULONG HandleInfo;
+} MARK_HANDLE_INFO, *PMARK_HANDLE_INFO;
+
+#define SET_PURGE_FAILURE_MODE_ENABLED 0x00000001
+#define SET_PURGE_FAILURE_MODE_DISABLED 0x00000002
+
+typedef struct _SET_PURGE_FAILURE_MODE_INPUT {
+    ULONG Flags;
+} SET_PURGE_FAILURE_MODE_INPUT, *PSET_PURGE_FAILURE_MODE_INPUT;
+
+#define MAXIMUM_VOLUME_LABEL_LENGTH (32 * sizeof(WCHAR))
+
+#define SE_TCB_PRIVILEGE 7
+
+typedef struct _OBJECT_TYPE *POBJECT_TYPE;
+extern POBJECT_TYPE *IoFileObjectType;
+
+#define DPFLTR_FASTFAT_ID 0x3b
+#define DPFLTR_INFO_LEVEL 3
+
+typedef enum _MM_PAGE_PRIORITY {
+    LowPagePriority,
+    NormalPagePriority = 16,
+    HighPagePriority = 32
+} MM_PAGE_PRIORITY;
+
+//
+//  File system run time library.
+//
+
+typedef struct _FSRTL_COMMON_FCB_HEADER {
+    CSHORT NodeTypeCode;
+    CSHORT NodeByteSize;
+    UCHAR Flags;
+    UCHAR IsFastIoPossible;
+    UCHAR Flags2;
+    UCHAR Reserved;
+    PERESOURCE Resource;
+    PERESOURCE PagingIoResource;
+    LARGE_INTEGER AllocationSize;
+    LARGE_INTEGER FileSize;
+    LARGE_INTEGER ValidDataLength;
+} FSRTL_COMMON_FCB_HEADER, *PFSRTL_COMMON_FCB_HEADER;
+
+typedef struct _FSRTL_ADVANCED_FCB_HEADER {
+    FSRTL_COMMON_FCB_HEADER;
+    PFAST_MUTEX FastMutex;
+    LIST_ENTRY FilterContexts;
+    PVOID PushLock;
+    PVOID *FileContextSupportPointer;
+    PVOID Oplock;
+} FSRTL_ADVANCED_FCB_HEADER, *PFSRTL_ADVANCED_FCB_HEADER;
+
+#define FsRtlSetupAdvancedHeader(H,M) {                         \
+    ((PFSRTL_ADVANCED_FCB_HEADER)(H))->FastMutex = (M);         \
+    InitializeListHead( &((PFSRTL_ADVANCED_FCB_HEADER)(H))->FilterContexts ); \
+    }
+
+#define FSRTL_FLAG_FILE_MODIFIED 0x01
+#define FSRTL_FLAG_FILE_LENGTH_CHANGED 0x02
+#define FSRTL_FLAG_LIMIT_MODIFIED_PAGES 0x04
+#define FSRTL_FLAG_ACQUIRE_MAIN_RSRC_EX 0x08
+#define FSRTL_FLAG_ACQUIRE_MAIN_RSRC_SH 0x10
+#define FSRTL_FLAG_USER_MAPPED_FILE 0x20
+#define FSRTL_FLAG_ADVANCED_HEADER 0x40
+#define FSRTL_FLAG2_DO_MODIFIED_WRITE 0x01
+#define FSRTL_FLAG2_SUPPORTS_FILTER_CONTEXTS 0x02
+#define FSRTL_FLAG2_PURGE_WHEN_MAPPED 0x04
+#define FSRTL_FLAG2_IS_PAGING_FILE 0x08
+
+typedef enum _FAST_IO_POSSIBLE {
+    FastIoIsNotPossible = 0,
+    FastIoIsPossible,
+    FastIoIsQuestionable
+} FAST_IO_POSSIBLE;
+
+typedef PVOID OPLOCK, *POPLOCK;
+
+#define OPLOCK_FLAG_COMPLETE_IF_OPLOCKED 0x00000001
+#define OPLOCK_FLAG_PARENT_OBJECT 0x00000004
+typedef struct _NOTIFY_SYNC *PNOTIFY_SYNC;
+
+typedef struct _FILE_LOCK {
+    PVOID CompleteLockIrpRoutine;
+    PVOID UnlockRoutine;
+    BOOLEAN FastIoIsQuestionable;
+    PVOID LockInformation;
+} FILE_LOCK, *PFILE_LOCK;
+
+typedef struct _TUNNEL {
+    FAST_MUTEX Mutex;
+    PVOID Cache;
+    ULONG NumEntries;
+} TUNNEL, *PTUNNEL;
+
+#define FSRTL_FAT_LEGAL 0x01
+#define FSRTL_HPFS_LEGAL 0x02
+#define FSRTL_NTFS_LEGAL 0x04
+#define FSRTL_WILD_CHARACTER 0x08
+#define FSRTL_OLE_LEGAL 0x10
+
+#define FsRtlIsUnicodeCharacterWild(C) ((C) < 0x80 && ((C) == L'*' || (C) == L'?' || (C) == L'"' || (C) == L'<' || (C) == L'>'))
+#define FsRtlIsAnsiCharacterWild(C) FsRtlIsUnicodeCharacterWild((UCHAR)(C))
+#define FsRtlIsLeadDbcsCharacter(C) ((BOOLEAN)FALSE)
+
+BOOLEAN FsRtlIsAnsiCharacterLegalFat( UCHAR Character, BOOLEAN WildOk );
+BOOLEAN FsRtlIsAnsiCharacterLegalHpfs( UCHAR Character, BOOLEAN WildOk );
+BOOLEAN FsRtlIsFatDbcsLegal( ANSI_STRING DbcsName, BOOLEAN WildCardsPermissible, BOOLEAN PathNamePermissible, BOOLEAN LeadingBackslashPermissible );
+BOOLEAN FsRtlIsNameInExpression( PUNICODE_STRING Expression, PUNICODE_STRING Name, BOOLEAN IgnoreCase, PWCH UpcaseTable );
+BOOLEAN FsRtlIsDbcsInExpression( PANSI_STRING Expression, PANSI_STRING Name );
+BOOLEAN FsRtlDoesNameContainWildCards( PUNICODE_STRING Name );
+BOOLEAN FsRtlAreNamesEqual( PCUNICODE_STRING ConstantNameA, PCUNICODE_STRING ConstantNameB, BOOLEAN IgnoreCase, PCWCH UpcaseTable );
+VOID FsRtlDissectName( UNICODE_STRING Path, PUNICODE_STRING FirstName, PUNICODE_STRING RemainingName );
+BOOLEAN FsRtlIsNtstatusExpected( NTSTATUS Exception );
+NTSTATUS FsRtlNormalizeNtstatus( NTSTATUS Exception, NTSTATUS GenericException );
+BOOLEAN FsRtlIsTotalDeviceFailure( NTSTATUS Status );
+
+VOID FsRtlInitializeFileLock( PFILE_LOCK FileLock, PVOID CompleteLockIrpRoutine, PVOID UnlockRoutine );
+VOID FsRtlUninitializeFileLock( PFILE_LOCK FileLock );
+VOID FsRtlInitializeOplock( POPLOCK Oplock );
+VOID FsRtlUninitializeOplock( POPLOCK Oplock );
+NTSTATUS FsRtlCheckOplockEx( POPLOCK Oplock, PIRP Irp, ULONG Flags, PVOID Context, PVOID CompletionRoutine, PVOID PostIrpRoutine );
+BOOLEAN FsRtlOplockIsFastIoPossible( POPLOCK Oplock );
+BOOLEAN FsRtlCurrentBatchOplock( POPLOCK Oplock );
+VOID FsRtlInitializeTunnelCache( PTUNNEL Cache );
+VOID FsRtlDeleteTunnelCache( PTUNNEL Cache );
+VOID FsRtlAddToTunnelCache( PTUNNEL Cache, ULONGLONG DirectoryKey, PUNICODE_STRING ShortName, PUNICODE_STRING LongName, BOOLEAN KeyByShortName, ULONG DataLength, PVOID Data );
+VOID FsRtlDeleteKeyFromTunnelCache( PTUNNEL Cache, ULONGLONG DirectoryKey );
+VOID FsRtlNotifyInitializeSync( PNOTIFY_SYNC *NotifySync );
+VOID FsRtlNotifyUninitializeSync( PNOTIFY_SYNC *NotifySync );
+VOID FsRtlNotifyFullReportChange( PNOTIFY_SYNC NotifySync, PLIST_ENTRY NotifyList, PSTRING FullTargetName, USHORT TargetNameOffset, PSTRING StreamName, PSTRING NormalizedParentName, ULONG FilterMatch, ULONG Action, PVOID TargetContext );
+VOID FsRtlTeardownPerStreamContexts( PFSRTL_ADVANCED_FCB_HEADER AdvancedHeader );
+BOOLEAN FsRtlFastCheckLockForRead( PFILE_LOCK FileLock, PLARGE_INTEGER StartingByte, PLARGE_INTEGER Length, ULONG Key, PFILE_OBJECT FileObject, PVOID ProcessId );
+BOOLEAN FsRtlFastCheckLockForWrite( PFILE_LOCK FileLock, PLARGE_INTEGER StartingByte, PLARGE_INTEGER Length, ULONG Key, PVOID FileObject, PVOID ProcessId );
+BOOLEAN FsRtlAreThereCurrentFileLocks( PFILE_LOCK FileLock );
+BOOLEAN FsRtlCheckLockForOplockRequest( PFILE_LOCK FileLock, PLARGE_INTEGER AllocationSize );
+NTSTATUS FsRtlOplockFsctrl( POPLOCK Oplock, PIRP Irp, ULONG OpenCount );
+BOOLEAN FsRtlOplockIsSharedRequest( PIRP Irp );
+NTSTATUS FsRtlNotifyVolumeEvent( PFILE_OBJECT FileObject, ULONG EventCode );
+VOID FsRtlDismountComplete( PDEVICE_OBJECT DeviceObject, NTSTATUS DismountStatus );
+NTSTATUS FsRtlBalanceReads( PDEVICE_OBJECT TargetDevice );
+VOID FsRtlEnterFileSystem( VOID );
+VOID FsRtlExitFileSystem( VOID );
+
+#define FsRtlNumberOfRunsInMcb FsRtlNumberOfRunsInLargeMcb
+
+//
+//  Cache manager.  The host's cache maps the volume stream directly onto
+//  the image and keeps page buffers for every other stream.
+//
+
+typedef struct _CC_FILE_SIZES {
+    LARGE_INTEGER AllocationSize;
+    LARGE_INTEGER FileSize;
+    LARGE_INTEGER ValidDataLength;
+} CC_FILE_SIZES, *PCC_FILE_SIZES;
+
+typedef BOOLEAN (*PACQUIRE_FOR_LAZY_WRITE)( PVOID Context, BOOLEAN Wait );
+typedef VOID (*PRELEASE_FROM_LAZY_WRITE)( PVOID Context );
+typedef BOOLEAN (*PACQUIRE_FOR_READ_AHEAD)( PVOID Context, BOOLEAN Wait );
+typedef VOID (*PRELEASE_FROM_READ_AHEAD)( PVOID Context );
+
+typedef struct _CACHE_MANAGER_CALLBACKS {
+    PACQUIRE_FOR_LAZY_WRITE AcquireForLazyWrite;
+    PRELEASE_FROM_LAZY_WRITE ReleaseFromLazyWrite;
+    PACQUIRE_FOR_READ_AHEAD AcquireForReadAhead;
+    PRELEASE_FROM_READ_AHEAD ReleaseFromReadAhead;
+} CACHE_MANAGER_CALLBACKS, *PCACHE_MANAGER_CALLBACKS;
+
+typedef struct _CACHE_UNINITIALIZE_EVENT {
+    struct _CACHE_UNINITIALIZE_EVENT *Next;
+    KEVENT Event;
+} CACHE_UNINITIALIZE_EVENT, *PCACHE_UNINITIALIZE_EVENT;
+
+#define PIN_WAIT 1
+#define PIN_EXCLUSIVE 2
+#define PIN_NO_READ 4
+#define PIN_IF_BCB 8
+#define PIN_CALLER_TRACKS_DIRTY_DATA 32
+#define PIN_HIGH_PRIORITY 64
+#define MAP_WAIT 1
+#define MAP_NO_READ 16
+#define MAP_HIGH_PRIORITY 64
+
+#define VACB_MAPPING_GRANULARITY 0x40000
+#define VACB_OFFSET_SHIFT 18
+
+#define CC_ENABLE_DISK_IO_ACCOUNTING 0x00000010
+
+#define DISABLE_READ_AHEAD 0x0002
+#define DISABLE_WRITE_BEHIND 0x0004
+#define MODIFIED_WRITE_DISABLED 0x0010
+
+#define CcIsFileCached(FO) (((FO)->SectionObjectPointer != NULL) && ((FO)->SectionObjectPointer->SharedCacheMap != NULL))
+
+VOID CcInitializeCacheMap( PFILE_OBJECT FileObject, PCC_FILE_SIZES FileSizes, BOOLEAN PinAccess, PCACHE_MANAGER_CALLBACKS Callbacks, PVOID LazyWriteContext );
+BOOLEAN CcUninitializeCacheMap( PFILE_OBJECT FileObject, PLARGE_INTEGER TruncateSize, PCACHE_UNINITIALIZE_EVENT UninitializeCompleteEvent );
+VOID CcSetFileSizes( PFILE_OBJECT FileObject, PCC_FILE_SIZES FileSizes );
+BOOLEAN CcPinRead( PFILE_OBJECT FileObject, PLARGE_INTEGER FileOffset, ULONG Length, ULONG Flags, PVOID *Bcb, PVOID *Buffer );
+BOOLEAN CcMapData( PFILE_OBJECT FileObject, PLARGE_INTEGER FileOffset, ULONG Length, ULONG Flags, PVOID *Bcb, PVOID *Buffer );
+BOOLEAN CcPinMappedData( PFILE_OBJECT FileObject, PLARGE_INTEGER FileOffset, ULONG Length, ULONG Flags, PVOID *Bcb );
+BOOLEAN CcPreparePinWrite( PFILE_OBJECT FileObject, PLARGE_INTEGER FileOffset, ULONG Length, BOOLEAN Zero, ULONG Flags, PVOID *Bcb, PVOID *Buffer );
+VOID CcSetDirtyPinnedData( PVOID BcbVoid, PLARGE_INTEGER Lsn );
+VOID CcUnpinData( PVOID Bcb );
+VOID CcRepinBcb( PVOID Bcb );
+VOID CcUnpinRepinnedBcb( PVOID Bcb, BOOLEAN WriteThrough, PIO_STATUS_BLOCK IoStatus );
+PFILE_OBJECT CcGetFileObjectFromBcb( PVOID Bcb );
+VOID CcFlushCache( PSECTION_OBJECT_POINTERS SectionObjectPointer, PLARGE_INTEGER FileOffset, ULONG Length, PIO_STATUS_BLOCK IoStatus );
+BOOLEAN CcPurgeCacheSection( PSECTION_OBJECT_POINTERS SectionObjectPointer, PLARGE_INTEGER FileOffset, ULONG Length, ULONG Flags );
+BOOLEAN CcZeroData( PFILE_OBJECT FileObject, PLARGE_INTEGER StartOffset, PLARGE_INTEGER EndOffset, BOOLEAN Wait );
+VOID CcSetAdditionalCacheAttributes( PFILE_OBJECT FileObject, BOOLEAN DisableReadAhead, BOOLEAN DisableWriteBehind );
+VOID CcSetAdditionalCacheAttributesEx( PFILE_OBJECT FileObject, ULONG Flags );
+BOOLEAN CcCanIWrite( PFILE_OBJECT FileObject, ULONG BytesToWrite, BOOLEAN Wait, UCHAR Retrying );
+BOOLEAN CcIsThereDirtyData( PVPB Vpb );
+NTSTATUS CcWaitForCurrentLazyWriterActivity( VOID );
+VOID CcMdlReadComplete( PFILE_OBJECT FileObject, PMDL MdlChain );
+VOID CcMdlWriteComplete( PFILE_OBJECT FileObject, PLARGE_INTEGER FileOffset, PMDL MdlChain );
+VOID CcMdlWriteAbort( PFILE_OBJECT FileObject, PMDL MdlChain );
+typedef ULONG_PTR PFN_NUMBER;
+
+#define SYSTEM_PAGE_PRIORITY_LEVELS 8
+
+typedef struct _IO_PRIORITY_INFO {
+    ULONG Size;
+    ULONG ThreadPriority;
+    ULONG PagePriority;
+    ULONG IoPriority;
+} IO_PRIORITY_INFO, *PIO_PRIORITY_INFO;
+
+typedef union _MM_PREFETCH_FLAGS {
+    struct {
+        ULONG Priority : 3;
+        ULONG RepurposePriority : 3;
+        ULONG PriorityProtection : 1;
+    } Flags;
+    ULONG AllFlags;
+} MM_PREFETCH_FLAGS;
+
+typedef union _FILE_SEGMENT_ELEMENT {
+    PVOID Buffer;
+    ULONGLONG Alignment;
+} FILE_SEGMENT_ELEMENT, *PFILE_SEGMENT_ELEMENT;
+
+typedef struct _READ_LIST {
+    PFILE_OBJECT FileObject;
+    ULONG NumberOfEntries;
+    LOGICAL IsImage;
+    FILE_SEGMENT_ELEMENT List[1];
+} READ_LIST, *PREAD_LIST;
+
+VOID IoInitializePriorityInfo( PIO_PRIORITY_INFO PriorityInfo );
+NTSTATUS IoRetrievePriorityInfo( PIRP Irp, PFILE_OBJECT FileObject, PETHREAD Thread, PIO_PRIORITY_INFO PriorityInfo );
+
+BOOLEAN MmFlushImageSection( PSECTION_OBJECT_POINTERS SectionPointer, ULONG FlushType );
+NTSTATUS MmPrefetchPages( ULONG NumberOfLists, PREAD_LIST *ReadLists );
+
+#define MmFlushForWrite 1
+#define MmFlushForDelete 0
+
+#endif // _HOST_NTIFS_
@@ -0,0 +1,20 @@
+/*++
+
+Copyright (c) 1989-2000 Microsoft Corporation
+
+Module Name:
+
+    Scsi.h
+
+Abstract:
+
+    The host build's stand in for the scsi definitions.  The Fat modules
+    built on the host use none of them.
+
+
+--*/
+
+#ifndef _HOST_SCSI_
+#define _HOST_SCSI_
+
+#endif // _HOST_SCSI_
@@ -156,6 +156,7 @@ typedef CSHORT NODE_BYTE_SIZE;
 #define TAG_BCB                         'btaF'
 #define TAG_DIRENT                      'DtaF'
 #define TAG_DIRENT_BITMAP               'TtaF'
+#define TAG_DIRENT_INDEX                'HtaF'
 #define TAG_EA_DATA                     'dtaF'
 #define TAG_EA_SET_HEADER               'etaF'
 #define TAG_EVENT                       'ttaF'
@@ -163,6 +164,7 @@ typedef CSHORT NODE_BYTE_SIZE;
 #define TAG_FAT_CLOSE_CONTEXT           'xtaF'
 #define TAG_FAT_IO_CONTEXT              'XtaF'
 #define TAG_FAT_WINDOW                  'WtaF'
+#define TAG_FAT_SUMMARY                 'wtaF'
 #define TAG_FILENAME_BUFFER             'ntaF'
 #define TAG_IO_RUNS                     'itaF'
 #define TAG_REPINNED_BCB                'RtaF'
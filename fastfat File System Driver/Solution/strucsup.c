@@ -1925,6 +1925,12 @@ Return Value:
             ExFreePool(Fcb->Specific.Dcb.FreeDirentBitmap.Buffer);
         }
 
+        //
+        //  Free the name index, if we built one.
+        //
+
+        FatDiscardDirentIndex( Fcb );
+
 #if (NTDDI_VERSION >= NTDDI_WIN8)
         //
         //  Uninitialize the oplock.
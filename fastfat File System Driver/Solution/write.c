@@ -28,6 +28,27 @@ Abstract:
 
 #define Dbg                              (DEBUG_TRACE_WRITE)
 
+//
+//  When writing dirty fat sectors we bridge clean gaps of up to this many
+//  bytes rather than start another io, and never issue more than this many
+//  ios per fat for one write of the volume file.
+//
+
+#define FAT_FLUSH_MAX_CLEAN_GAP          (0x4000)
+#define FAT_FLUSH_MAX_RUNS               (4)
+
+#define FatAddDirtyFatRun(VBOS,COUNTS,RUNS,VBO,BYTE_COUNT) {                    \
+    if (((RUNS) != 0) &&                                                        \
+        (((RUNS) == FAT_FLUSH_MAX_RUNS) ||                                      \
+         ((VBO) - ((VBOS)[(RUNS)-1] + (COUNTS)[(RUNS)-1]) <= FAT_FLUSH_MAX_CLEAN_GAP))) { \
+        (COUNTS)[(RUNS)-1] = (VBO) + (BYTE_COUNT) - (VBOS)[(RUNS)-1];            \
+    } else {                                                                    \
+        (VBOS)[(RUNS)] = (VBO);                                                 \
+        (COUNTS)[(RUNS)] = (BYTE_COUNT);                                        \
+        (RUNS) += 1;                                                            \
+    }                                                                           \
+}
+
 //
 //  Macros to increment the appropriate performance counters.
 //
@@ -507,10 +528,12 @@ Return Value:
     //  file (boot sector) is always clean (a hole), and an Mcb never ends in
     //  a hole, there must always be an even number of runs(entries) in the Mcb.
     //
-    //  The strategy is to find the first and last dirty run in the desired
-    //  write range (which will always be a set of pages), and write from the
-    //  former to the later.  The may result in writing some clean data, but
-    //  will generally be more efficient than writing each runs seperately.
+    //  The strategy is to find the dirty runs in the desired write range
+    //  (which will always be a set of pages), in ascending order, and merge
+    //  them into at most FAT_FLUSH_MAX_RUNS writes, bridging any clean gap
+    //  no larger than FAT_FLUSH_MAX_CLEAN_GAP.  This may result in writing
+    //  some clean data, but will generally be more efficient than writing
+    //  each run seperately, without rewriting long stretches of clean fat.
     //
 
     if (TypeOfOpen == VirtualVolumeFile) {
@@ -519,12 +542,17 @@ Return Value:
         LBO CleanLbo;
 
         VBO DirtyVbo;
-        VBO StartingDirtyVbo;
 
         ULONG DirtyByteCount;
         ULONG CleanByteCount;
 
+        VBO RunVbo[FAT_FLUSH_MAX_RUNS];
+        ULONG RunByteCount[FAT_FLUSH_MAX_RUNS];
+        ULONG RunCount = 0;
+        ULONG Run;
+
         ULONG WriteLength;
+        ULONG DirtyLength = 0;
 
         BOOLEAN MoreDirtyRuns = TRUE;
 
@@ -604,13 +632,6 @@ Return Value:
             DirtyVbo = StartingVbo + DirtyByteCount;
         }
 
-        //
-        //  This is where the write will start.
-        //
-
-        StartingDirtyVbo = DirtyVbo;
-
-        //
         //
         //  Now start enumerating the dirty fat sectors spanning the desired
         //  write range, this first one of which is now DirtyVbo.
@@ -677,8 +698,14 @@ Return Value:
 
                     MoreDirtyRuns = FALSE;
 
+                    FatAddDirtyFatRun( RunVbo, RunByteCount, RunCount, DirtyVbo, DirtyByteCount );
+                    DirtyLength += DirtyByteCount;
+
                 } else {
 
+                    FatAddDirtyFatRun( RunVbo, RunByteCount, RunCount, DirtyVbo, DirtyByteCount );
+                    DirtyLength += DirtyByteCount;
+
                     //
                     //  Scan the clean hole after this dirty run.  If this
                     //  run was the last, prepare to exit the loop
@@ -726,13 +753,19 @@ Return Value:
         } // while ( MoreDirtyRuns )
 
         //
-        //  At this point DirtyVbo and DirtyByteCount correctly reflect the
-        //  final dirty run, constrained to the desired write range.
-        //
-        //  Now compute the length we finally must write.
+        //  At this point the runs describe every dirty sector in the
+        //  desired write range.  Now compute the length we finally must
+        //  write.
         //
 
-        WriteLength = (DirtyVbo + DirtyByteCount) - StartingDirtyVbo;
+        NT_ASSERT( RunCount != 0 );
+
+        WriteLength = 0;
+
+        for (Run = 0; Run < RunCount; Run++) {
+
+            WriteLength += RunByteCount[Run];
+        }
 
         //
         // We must now assume that the write will complete with success,
@@ -745,22 +778,24 @@ Return Value:
 
         //
         //  Loop through all the fats, setting up a multiple async to
-        //  write them all.  If there are more than FAT_MAX_PARALLEL_IOS
-        //  then we do several muilple asyncs.
+        //  write each run to them all.
         //
 
         {
             ULONG Fat;
             ULONG BytesPerFat;
+            ULONG IoRunCount;
+            ULONG SectorShift;
             IO_RUN StackIoRuns[2];
             PIO_RUN IoRuns;
 
             BytesPerFat = FatBytesPerFat( &Vcb->Bpb );
+            IoRunCount = (ULONG)Vcb->Bpb.Fats * RunCount;
 
-            if ((ULONG)Vcb->Bpb.Fats > 2) {
+            if (IoRunCount > 2) {
 
                 IoRuns = FsRtlAllocatePoolWithTag( PagedPool,
-                                                   (ULONG)(Vcb->Bpb.Fats*sizeof(IO_RUN)),
+                                                   IoRunCount * sizeof(IO_RUN),
                                                    TAG_IO_RUNS );
 
             } else {
@@ -770,24 +805,37 @@ Return Value:
 
             for (Fat = 0; Fat < (ULONG)Vcb->Bpb.Fats; Fat++) {
 
-                IoRuns[Fat].Vbo = StartingDirtyVbo;
-                IoRuns[Fat].Lbo = Fat * BytesPerFat + StartingDirtyVbo;
-                IoRuns[Fat].Offset = StartingDirtyVbo - StartingVbo;
-                IoRuns[Fat].ByteCount = WriteLength;
+                for (Run = 0; Run < RunCount; Run++) {
+
+                    IoRuns[Fat * RunCount + Run].Vbo = RunVbo[Run];
+                    IoRuns[Fat * RunCount + Run].Lbo = Fat * BytesPerFat + RunVbo[Run];
+                    IoRuns[Fat * RunCount + Run].Offset = RunVbo[Run] - StartingVbo;
+                    IoRuns[Fat * RunCount + Run].ByteCount = RunByteCount[Run];
+                }
             }
 
             //
-            //  Keep track of meta-data disk ios.
+            //  Keep track of meta-data disk ios, and of how well we are
+            //  combining dirty fat sectors into them.
             //
 
-            Vcb->Statistics[KeGetCurrentProcessorNumber() % FatData.NumberProcessors].Common.MetaDataDiskWrites += Vcb->Bpb.Fats;
+            Vcb->Statistics[KeGetCurrentProcessorNumber() % FatData.NumberProcessors].Common.MetaDataDiskWrites += IoRunCount;
+
+            SectorShift = Vcb->AllocationSupport.LogOfBytesPerSector;
+
+            InterlockedIncrement64( &Vcb->DirtyFatWrites );
+            InterlockedExchangeAdd64( &Vcb->DirtyFatWriteIos, IoRunCount );
+            InterlockedExchangeAdd64( &Vcb->DirtyFatWriteSectors,
+                                      (LONG64)(WriteLength >> SectorShift) * Vcb->Bpb.Fats );
+            InterlockedExchangeAdd64( &Vcb->DirtyFatWriteCleanSectors,
+                                      (LONG64)((WriteLength - DirtyLength) >> SectorShift) * Vcb->Bpb.Fats );
 
             try {
 
                 FatMultipleAsync( IrpContext,
                                   Vcb,
                                   Irp,
-                                  (ULONG)Vcb->Bpb.Fats,
+                                  IoRunCount,
                                   IoRuns );
 
             } finally {
@@ -812,7 +860,7 @@ Return Value:
                                       0,
                                       WriteLength,
                                       0,
-                                      1,
+                                      RunCount,
                                       0 );
             }
 
@@ -852,9 +900,12 @@ Return Value:
 
         if ( NT_SUCCESS( Status = Irp->IoStatus.Status )) {
 
-            FatRemoveMcbEntry( Vcb, &Vcb->DirtyFatMcb,
-                               StartingDirtyVbo,
-                               WriteLength );
+            for (Run = 0; Run < RunCount; Run++) {
+
+                FatRemoveMcbEntry( Vcb, &Vcb->DirtyFatMcb,
+                                   RunVbo[Run],
+                                   RunByteCount[Run] );
+            }
 
         } else {
 